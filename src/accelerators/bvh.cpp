@@ -34,17 +34,71 @@
 // accelerators/bvh.cpp*
 #include "accelerators/bvh.h"
 #include "interaction.h"
+#include "morton.h"
+#include "memory.h"
 #include "paramset.h"
 #include "stats.h"
 #include "parallel.h"
+#include "rng.h"
+#include "sampling.h"
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+#if defined(__AVX__) && !defined(PBRT_FLOAT_AS_DOUBLE)
+#include <immintrin.h>
+#define PBRT_WBVH_HAVE_AVX
+#endif
 
 namespace pbrt {
 
 STAT_MEMORY_COUNTER("Memory/BVH tree", treeBytes);
+
+// Live flattened-node bytes across all BVHs, reported to the memory budget
+// manager; registered on first BVH construction.
+static std::atomic<uint64_t> bvhLiveNodeBytes{0};
+static std::once_flag bvhBudgetRegistered;
+
+static void registerBVHNodeBytes(uint64_t bytes) {
+    std::call_once(bvhBudgetRegistered, []() {
+        MemoryBudgetRegister("BVH nodes",
+                             []() { return bvhLiveNodeBytes.load(); });
+    });
+    bvhLiveNodeBytes += bytes;
+}
 STAT_RATIO("BVH/Primitives per leaf node", totalPrimitives, totalLeafNodes);
 STAT_COUNTER("BVH/Interior nodes", interiorNodes);
 STAT_COUNTER("BVH/Leaf nodes", leafNodes);
+STAT_COUNTER("BVH/Wide interior nodes", wideInteriorNodes);
+// Per-ray traversal quality statistics, reported with the rest of the
+// render stats; useful for tuning maxPrimsInNode and split methods without
+// A/B renders.
+STAT_FLOAT_DISTRIBUTION("BVH/SAH cost of built tree", treeSAHCost);
+STAT_INT_DISTRIBUTION("BVH/Nodes visited per Intersect() ray",
+                      nodesVisitedPerRay);
+STAT_INT_DISTRIBUTION("BVH/Nodes visited per IntersectP() ray",
+                      nodesVisitedPerShadowRay);
+STAT_INT_DISTRIBUTION("BVH/Primitives tested per Intersect() ray",
+                      primsTestedPerRay);
+STAT_INT_DISTRIBUTION("BVH/Primitives tested per IntersectP() ray",
+                      primsTestedPerShadowRay);
+
+// The primitive that most recently occluded a shadow ray on this thread.
+// Nearby shadow rays are very likely to be blocked by the same primitive, so
+// testing it before traversing saves a full tree walk when it hits. The
+// cache is keyed on the aggregate that stored it: with object instancing, a
+// nested object-space BVH's rays must not be tested against a primitive
+// cached from the world-space tree (or vice versa), since a test in the
+// wrong coordinate space can report a false hit.
+static PBRT_THREAD_LOCAL const Primitive *lastOccluder = nullptr;
+static PBRT_THREAD_LOCAL const BVHAccel *lastOccluderBVH = nullptr;
+// Cached occluders are owned by some accelerator; destroying any BVH bumps
+// the generation so stale pointers are never dereferenced (also covering a
+// new BVH reusing a destroyed one's address).
+static std::atomic<uint32_t> occluderGeneration{0};
+static PBRT_THREAD_LOCAL uint32_t lastOccluderGeneration = 0;
+
 
 // BVHAccel Local Declarations
 struct BVHPrimitiveInfo {
@@ -82,11 +136,6 @@ struct BVHBuildNode {
     int splitAxis, firstPrimOffset, nPrimitives;
 };
 
-struct MortonPrimitive {
-    int primitiveIndex;
-    uint32_t mortonCode;
-};
-
 struct LBVHTreelet {
     int startIndex, nPrimitives;
     BVHBuildNode *buildNodes;
@@ -100,93 +149,139 @@ struct LinearBVHNode {
     };
     uint16_t nPrimitives;  // 0 -> interior node
     uint8_t axis;          // interior node: xyz
-    uint8_t pad[1];        // ensure 32 byte total size
+    // Interior node: nonzero if the second child has the larger surface area
+    // and is therefore the better first visit for any-hit traversal. Also
+    // keeps the node at 32 bytes.
+    uint8_t occludeSecondFirst;
 };
 
-// BVHAccel Utility Functions
-inline uint32_t LeftShift3(uint32_t x) {
-    CHECK_LE(x, (1 << 10));
-    if (x == (1 << 10)) --x;
-#ifdef PBRT_HAVE_BINARY_CONSTANTS
-    x = (x | (x << 16)) & 0b00000011000000000000000011111111;
-    // x = ---- --98 ---- ---- ---- ---- 7654 3210
-    x = (x | (x << 8)) & 0b00000011000000001111000000001111;
-    // x = ---- --98 ---- ---- 7654 ---- ---- 3210
-    x = (x | (x << 4)) & 0b00000011000011000011000011000011;
-    // x = ---- --98 ---- 76-- --54 ---- 32-- --10
-    x = (x | (x << 2)) & 0b00001001001001001001001001001001;
-    // x = ---- 9--8 --7- -6-- 5--4 --3- -2-- 1--0
-#else
-    x = (x | (x << 16)) & 0x30000ff;
-    // x = ---- --98 ---- ---- ---- ---- 7654 3210
-    x = (x | (x << 8)) & 0x300f00f;
-    // x = ---- --98 ---- ---- 7654 ---- ---- 3210
-    x = (x | (x << 4)) & 0x30c30c3;
-    // x = ---- --98 ---- 76-- --54 ---- 32-- --10
-    x = (x | (x << 2)) & 0x9249249;
-    // x = ---- 9--8 --7- -6-- 5--4 --3- -2-- 1--0
-#endif // PBRT_HAVE_BINARY_CONSTANTS
-    return x;
-}
-
-inline uint32_t EncodeMorton3(const Vector3f &v) {
-    CHECK_GE(v.x, 0);
-    CHECK_GE(v.y, 0);
-    CHECK_GE(v.z, 0);
-    return (LeftShift3(v.z) << 2) | (LeftShift3(v.y) << 1) | LeftShift3(v.x);
-}
-
-static void RadixSort(std::vector<MortonPrimitive> *v) {
-    std::vector<MortonPrimitive> tempVector(v->size());
-    PBRT_CONSTEXPR int bitsPerPass = 6;
-    PBRT_CONSTEXPR int nBits = 30;
-    static_assert((nBits % bitsPerPass) == 0,
-                  "Radix sort bitsPerPass must evenly divide nBits");
-    PBRT_CONSTEXPR int nPasses = nBits / bitsPerPass;
-
-    for (int pass = 0; pass < nPasses; ++pass) {
-        // Perform one pass of radix sort, sorting _bitsPerPass_ bits
-        int lowBit = pass * bitsPerPass;
-
-        // Set in and out vector pointers for radix sort pass
-        std::vector<MortonPrimitive> &in = (pass & 1) ? tempVector : *v;
-        std::vector<MortonPrimitive> &out = (pass & 1) ? *v : tempVector;
-
-        // Count number of zero bits in array for current radix sort bit
-        PBRT_CONSTEXPR int nBuckets = 1 << bitsPerPass;
-        int bucketCount[nBuckets] = {0};
-        PBRT_CONSTEXPR int bitMask = (1 << bitsPerPass) - 1;
-        for (const MortonPrimitive &mp : in) {
-            int bucket = (mp.mortonCode >> lowBit) & bitMask;
-            CHECK_GE(bucket, 0);
-            CHECK_LT(bucket, nBuckets);
-            ++bucketCount[bucket];
-        }
-
-        // Compute starting index in output array for each bucket
-        int outIndex[nBuckets];
-        outIndex[0] = 0;
-        for (int i = 1; i < nBuckets; ++i)
-            outIndex[i] = outIndex[i - 1] + bucketCount[i - 1];
-
-        // Store sorted values in output array
-        for (const MortonPrimitive &mp : in) {
-            int bucket = (mp.mortonCode >> lowBit) & bitMask;
-            out[outIndex[bucket]++] = mp;
-        }
-    }
-    // Copy final result from _tempVector_, if needed
-    if (nPasses & 1) std::swap(*v, tempVector);
+// TriangleBundle holds up to eight triangles of one leaf with their vertex
+// positions transposed into SoA order (_p[vertex][axis][lane]_), so that the
+// rejection tests of the watertight ray--triangle algorithm can run over all
+// of the leaf's triangles with one AVX instruction per step. Lanes past _n_
+// are zeroed and masked out of the kernel's result.
+PBRT_CONSTEXPR int TriangleBundleWidth = 8;
+struct TriangleBundle {
+    float p[3][3][TriangleBundleWidth];
+    int n;
+};
+
+#ifdef PBRT_WBVH_HAVE_AVX
+// Run the edge-function, determinant, and t-range rejection tests of
+// Triangle::Intersect() over the bundle's eight triangles at once, given
+// the axis permutation and shear coefficients of the ray's watertight
+// transformation. Returns a bitmask of the lanes that may intersect; each
+// surviving lane must be confirmed with the scalar test, which also
+// handles the double-precision edge fallback, alpha masking, and the
+// intersection's error bounds. The kernel only ever errs on the side of
+// passing a lane through, so the scalar test's watertight guarantees are
+// preserved.
+static inline int IntersectTriangleBundle(const TriangleBundle &b,
+                                          const Ray &ray, int kx, int ky,
+                                          int kz, Float Sx, Float Sy,
+                                          Float Sz) {
+    // Translate bundle vertices based on ray origin, in permuted axis order
+    __m256 ox = _mm256_set1_ps(ray.o[kx]);
+    __m256 oy = _mm256_set1_ps(ray.o[ky]);
+    __m256 oz = _mm256_set1_ps(ray.o[kz]);
+    __m256 p0tx = _mm256_sub_ps(_mm256_loadu_ps(b.p[0][kx]), ox);
+    __m256 p0ty = _mm256_sub_ps(_mm256_loadu_ps(b.p[0][ky]), oy);
+    __m256 p0tz = _mm256_sub_ps(_mm256_loadu_ps(b.p[0][kz]), oz);
+    __m256 p1tx = _mm256_sub_ps(_mm256_loadu_ps(b.p[1][kx]), ox);
+    __m256 p1ty = _mm256_sub_ps(_mm256_loadu_ps(b.p[1][ky]), oy);
+    __m256 p1tz = _mm256_sub_ps(_mm256_loadu_ps(b.p[1][kz]), oz);
+    __m256 p2tx = _mm256_sub_ps(_mm256_loadu_ps(b.p[2][kx]), ox);
+    __m256 p2ty = _mm256_sub_ps(_mm256_loadu_ps(b.p[2][ky]), oy);
+    __m256 p2tz = _mm256_sub_ps(_mm256_loadu_ps(b.p[2][kz]), oz);
+
+    // Apply shear transformation to translated vertex positions
+    __m256 sx = _mm256_set1_ps(Sx), sy = _mm256_set1_ps(Sy);
+    p0tx = _mm256_add_ps(p0tx, _mm256_mul_ps(sx, p0tz));
+    p0ty = _mm256_add_ps(p0ty, _mm256_mul_ps(sy, p0tz));
+    p1tx = _mm256_add_ps(p1tx, _mm256_mul_ps(sx, p1tz));
+    p1ty = _mm256_add_ps(p1ty, _mm256_mul_ps(sy, p1tz));
+    p2tx = _mm256_add_ps(p2tx, _mm256_mul_ps(sx, p2tz));
+    p2ty = _mm256_add_ps(p2ty, _mm256_mul_ps(sy, p2tz));
+
+    // Compute edge function coefficients _e0_, _e1_, and _e2_
+    __m256 e0 = _mm256_sub_ps(_mm256_mul_ps(p1tx, p2ty),
+                              _mm256_mul_ps(p1ty, p2tx));
+    __m256 e1 = _mm256_sub_ps(_mm256_mul_ps(p2tx, p0ty),
+                              _mm256_mul_ps(p2ty, p0tx));
+    __m256 e2 = _mm256_sub_ps(_mm256_mul_ps(p0tx, p1ty),
+                              _mm256_mul_ps(p0ty, p1tx));
+
+    // Reject lanes whose edge functions have mixed signs; a zero edge
+    // function keeps its lane alive on both sides of the test, matching
+    // the scalar test's behavior before its double-precision fallback.
+    __m256 zero = _mm256_setzero_ps();
+    __m256 anyNeg =
+        _mm256_or_ps(_mm256_cmp_ps(e0, zero, _CMP_LT_OQ),
+                     _mm256_or_ps(_mm256_cmp_ps(e1, zero, _CMP_LT_OQ),
+                                  _mm256_cmp_ps(e2, zero, _CMP_LT_OQ)));
+    __m256 anyPos =
+        _mm256_or_ps(_mm256_cmp_ps(e0, zero, _CMP_GT_OQ),
+                     _mm256_or_ps(_mm256_cmp_ps(e1, zero, _CMP_GT_OQ),
+                                  _mm256_cmp_ps(e2, zero, _CMP_GT_OQ)));
+    __m256 reject = _mm256_and_ps(anyNeg, anyPos);
+
+    // Compute scaled hit distance and reject lanes outside the ray's
+    // $t$ range
+    __m256 det = _mm256_add_ps(e0, _mm256_add_ps(e1, e2));
+    __m256 sz = _mm256_set1_ps(Sz);
+    p0tz = _mm256_mul_ps(p0tz, sz);
+    p1tz = _mm256_mul_ps(p1tz, sz);
+    p2tz = _mm256_mul_ps(p2tz, sz);
+    __m256 tScaled =
+        _mm256_add_ps(_mm256_mul_ps(e0, p0tz),
+                      _mm256_add_ps(_mm256_mul_ps(e1, p1tz),
+                                    _mm256_mul_ps(e2, p2tz)));
+    __m256 tMaxDet = _mm256_mul_ps(det, _mm256_set1_ps(ray.tMax));
+    __m256 rejectT = _mm256_or_ps(
+        _mm256_and_ps(
+            _mm256_cmp_ps(det, zero, _CMP_LT_OQ),
+            _mm256_or_ps(_mm256_cmp_ps(tScaled, zero, _CMP_GE_OQ),
+                         _mm256_cmp_ps(tScaled, tMaxDet, _CMP_LT_OQ))),
+        _mm256_and_ps(
+            _mm256_cmp_ps(det, zero, _CMP_GT_OQ),
+            _mm256_or_ps(_mm256_cmp_ps(tScaled, zero, _CMP_LE_OQ),
+                         _mm256_cmp_ps(tScaled, tMaxDet, _CMP_GT_OQ))));
+    rejectT = _mm256_or_ps(rejectT, _mm256_cmp_ps(det, zero, _CMP_EQ_OQ));
+    // Lanes with an exactly zero edge function take the scalar test's
+    // double-precision fallback, which recomputes the values the
+    // determinant and $t$ tests depend on; keep those lanes as candidates.
+    __m256 anyZero =
+        _mm256_or_ps(_mm256_cmp_ps(e0, zero, _CMP_EQ_OQ),
+                     _mm256_or_ps(_mm256_cmp_ps(e1, zero, _CMP_EQ_OQ),
+                                  _mm256_cmp_ps(e2, zero, _CMP_EQ_OQ)));
+    reject = _mm256_or_ps(reject, _mm256_andnot_ps(anyZero, rejectT));
+    return ~_mm256_movemask_ps(reject) & ((1 << b.n) - 1);
 }
+#endif  // PBRT_WBVH_HAVE_AVX
+
+// WideBVHNode stores the slabs of up to eight children in SoA order so that
+// a single SIMD slab test covers all of them. Slot encoding: _nPrimitives[i]_
+// nonzero means slot _i_ is a leaf with primitives starting at _child[i]_;
+// otherwise _child[i]_ is the index of a wide interior node, or -1 for an
+// empty slot (whose degenerate bounds can never be hit).
+PBRT_CONSTEXPR int WideBVHMaxWidth = 8;
+struct WideBVHNode {
+    Float boundsMin[3][WideBVHMaxWidth];
+    Float boundsMax[3][WideBVHMaxWidth];
+    int32_t child[WideBVHMaxWidth];
+    uint16_t nPrimitives[WideBVHMaxWidth];
+};
 
 // BVHAccel Method Definitions
 BVHAccel::BVHAccel(std::vector<std::shared_ptr<Primitive>> p,
-                   int maxPrimsInNode, SplitMethod splitMethod)
+                   int maxPrimsInNode, SplitMethod splitMethod,
+                   bool recordPrimitiveIndices)
     : maxPrimsInNode(std::min(255, maxPrimsInNode)),
       splitMethod(splitMethod),
       primitives(std::move(p)) {
     ProfilePhase _(Prof::AccelConstruction);
     if (primitives.empty()) return;
+    nOriginalPrimitives = primitives.size();
     // Build BVH from _primitives_
 
     // Initialize _primitiveInfo_ array for primitives
@@ -195,16 +290,59 @@ BVHAccel::BVHAccel(std::vector<std::shared_ptr<Primitive>> p,
         primitiveInfo[i] = {i, primitives[i]->WorldBound()};
 
     // Build BVH tree for primitives using _primitiveInfo_
-    MemoryArena arena(1024 * 1024);
+    MemoryArena arena(LargeArenaBlockSize);
+    // Per-thread build arenas for the parallel SAH path; MemoryArena is not
+    // thread-safe, and they must outlive flattenBVHTree() below.
+    std::vector<std::unique_ptr<MemoryArena>> threadArenas;
     int totalNodes = 0;
     std::vector<std::shared_ptr<Primitive>> orderedPrims;
     orderedPrims.reserve(primitives.size());
     BVHBuildNode *root;
-    if (splitMethod == SplitMethod::HLBVH)
-        root = HLBVHBuild(arena, primitiveInfo, &totalNodes, orderedPrims);
-    else
+    if (splitMethod == SplitMethod::HLBVH) {
+        // The upper SAH tree over treelet roots is built with the same
+        // task-spawning scheme as parallelSAHBuild() and allocates its
+        // nodes from the per-thread arenas.
+        for (int i = 0; i < MaxThreadIndex(); ++i)
+            threadArenas.push_back(
+                std::unique_ptr<MemoryArena>(
+                    new MemoryArena(LargeArenaBlockSize)));
+        root = HLBVHBuild(arena, threadArenas, primitiveInfo, &totalNodes,
+                          orderedPrims);
+    } else if (splitMethod == SplitMethod::SBVH) {
+        // Allow spatial splits to duplicate at most 25% extra references.
+        int spatialSplitBudget = primitives.size() / 4;
+        root = SBVHBuild(arena, primitiveInfo, &totalNodes, orderedPrims,
+                         &spatialSplitBudget);
+    } else if (splitMethod == SplitMethod::SAH &&
+               primitives.size() >= 64 * 1024 && MaxThreadIndex() > 1) {
+        // Large SAH builds are parallelized by task-spawning the two
+        // children of each upper-level split; see parallelSAHBuild().
+        for (int i = 0; i < MaxThreadIndex(); ++i)
+            threadArenas.push_back(
+                std::unique_ptr<MemoryArena>(
+                    new MemoryArena(LargeArenaBlockSize)));
+        std::atomic<int> atomicTotal(0), orderedPrimsOffset(0);
+        orderedPrims.resize(primitives.size());
+        root = parallelSAHBuild(threadArenas, primitiveInfo, 0,
+                                primitives.size(), &atomicTotal, orderedPrims,
+                                &orderedPrimsOffset);
+        totalNodes = atomicTotal;
+        CHECK_EQ((int)orderedPrimsOffset, (int)primitives.size());
+    } else
         root = recursiveBuild(arena, primitiveInfo, 0, primitives.size(),
                               &totalNodes, orderedPrims);
+    if (recordPrimitiveIndices) {
+        // Record, for each (possibly duplicated) ordered primitive, its index
+        // in the input vector so that Refit() can splice in next frame's
+        // primitives in build order.
+        std::unordered_map<const Primitive *, int> originalIndex;
+        originalIndex.reserve(primitives.size());
+        for (size_t i = 0; i < primitives.size(); ++i)
+            originalIndex[primitives[i].get()] = i;
+        primitiveIndices.resize(orderedPrims.size());
+        for (size_t i = 0; i < orderedPrims.size(); ++i)
+            primitiveIndices[i] = originalIndex[orderedPrims[i].get()];
+    }
     primitives.swap(orderedPrims);
     primitiveInfo.resize(0);
     LOG(INFO) << StringPrintf("BVH created with %d nodes for %d "
@@ -219,15 +357,85 @@ BVHAccel::BVHAccel(std::vector<std::shared_ptr<Primitive>> p,
     treeBytes += totalNodes * sizeof(LinearBVHNode) + sizeof(*this) +
                  primitives.size() * sizeof(primitives[0]);
     nodes = AllocAligned<LinearBVHNode>(totalNodes);
+    registerBVHNodeBytes(totalNodes * sizeof(LinearBVHNode));
+    // Touch the node array's pages from all of the worker threads before
+    // flattening fills it in; under the kernel's first-touch policy this
+    // spreads the pages across NUMA nodes instead of leaving the whole hot
+    // array on whichever node ran the build.
+    {
+        PBRT_CONSTEXPR int nodesPerChunk = 4096 / sizeof(LinearBVHNode);
+        ParallelFor(
+            [this, totalNodes](int64_t chunk) {
+                int64_t start = chunk * nodesPerChunk;
+                int64_t end = std::min<int64_t>(start + nodesPerChunk,
+                                                totalNodes);
+                memset(nodes + start, 0, (end - start) * sizeof(LinearBVHNode));
+            },
+            (totalNodes + nodesPerChunk - 1) / nodesPerChunk);
+    }
+    nNodes = totalNodes;
     int offset = 0;
     flattenBVHTree(root, &offset);
     CHECK_EQ(totalNodes, offset);
+
+    // Report the SAH cost of the built tree
+    Float sahCost = SAHCost();
+    if (sahCost > 0) ReportValue(treeSAHCost, sahCost);
+
+    // Pre-gather all-triangle leaves into SoA bundles for SIMD leaf tests
+    buildTriangleBundles();
+}
+
+void BVHAccel::Refit() {
+    if (!nodes) return;
+    ProfilePhase _(Prof::AccelConstruction);
+    // Children follow their parent in the depth-first node array, so a single
+    // reverse sweep sees both children of every interior node before the
+    // node itself.
+    for (int i = nNodes - 1; i >= 0; --i) {
+        LinearBVHNode *node = &nodes[i];
+        if (node->nPrimitives > 0) {
+            Bounds3f bounds;
+            for (int j = 0; j < node->nPrimitives; ++j)
+                bounds = Union(
+                    bounds,
+                    primitives[node->primitivesOffset + j]->WorldBound());
+            node->bounds = bounds;
+        } else
+            node->bounds = Union(nodes[i + 1].bounds,
+                                 nodes[node->secondChildOffset].bounds);
+    }
+}
+
+bool BVHAccel::Refit(const std::vector<std::shared_ptr<Primitive>> &p) {
+    if (!nodes || p.size() != nOriginalPrimitives ||
+        primitiveIndices.size() != primitives.size())
+        return false;
+    for (size_t i = 0; i < primitives.size(); ++i)
+        primitives[i] = p[primitiveIndices[i]];
+    Refit();
+    // The new primitives' vertex positions may differ, so the SoA leaf
+    // bundles must be re-gathered as well.
+    buildTriangleBundles();
+    return true;
 }
 
 Bounds3f BVHAccel::WorldBound() const {
     return nodes ? nodes[0].bounds : Bounds3f();
 }
 
+Float BVHAccel::SAHCost() const {
+    if (!nodes) return 0;
+    Float rootSA = nodes[0].bounds.SurfaceArea();
+    if (rootSA <= 0) return 0;
+    Float sahCost = 0;
+    for (int i = 0; i < nNodes; ++i) {
+        Float sa = nodes[i].bounds.SurfaceArea();
+        sahCost += nodes[i].nPrimitives > 0 ? sa * nodes[i].nPrimitives : sa;
+    }
+    return sahCost / rootSA;
+}
+
 struct BucketInfo {
     int count = 0;
     Bounds3f bounds;
@@ -401,9 +609,325 @@ BVHBuildNode *BVHAccel::recursiveBuild(
     return node;
 }
 
+// Parallel top-down SAH build. The tree structure and split selection are
+// identical to the SAH path of recursiveBuild(); above
+// _parallelBuildThreshold_ primitives the two children of a split are built
+// as independent tasks. Each task allocates build nodes from its own
+// per-thread arena and leaves claim their range of _orderedPrims_ (which is
+// pre-sized) through an atomic offset, so the only coordination between
+// tasks is the two atomic counters.
+static PBRT_CONSTEXPR int parallelBuildThreshold = 16 * 1024;
+BVHBuildNode *BVHAccel::parallelSAHBuild(
+    std::vector<std::unique_ptr<MemoryArena>> &threadArenas,
+    std::vector<BVHPrimitiveInfo> &primitiveInfo, int start, int end,
+    std::atomic<int> *totalNodes,
+    std::vector<std::shared_ptr<Primitive>> &orderedPrims,
+    std::atomic<int> *orderedPrimsOffset) {
+    CHECK_NE(start, end);
+    BVHBuildNode *node = threadArenas[ThreadIndex]->Alloc<BVHBuildNode>();
+    ++*totalNodes;
+    // Compute bounds of all primitives in BVH node
+    Bounds3f bounds;
+    for (int i = start; i < end; ++i)
+        bounds = Union(bounds, primitiveInfo[i].bounds);
+    int nPrimitives = end - start;
+    // Lambda to create a leaf claiming its slots in _orderedPrims_
+    auto makeLeaf = [&]() {
+        int firstPrimOffset = orderedPrimsOffset->fetch_add(nPrimitives);
+        for (int i = start; i < end; ++i)
+            orderedPrims[firstPrimOffset + i - start] =
+                primitives[primitiveInfo[i].primitiveNumber];
+        node->InitLeaf(firstPrimOffset, nPrimitives, bounds);
+    };
+    if (nPrimitives == 1) {
+        makeLeaf();
+        return node;
+    }
+    // Compute bound of primitive centroids, choose split dimension _dim_
+    Bounds3f centroidBounds;
+    for (int i = start; i < end; ++i)
+        centroidBounds = Union(centroidBounds, primitiveInfo[i].centroid);
+    int dim = centroidBounds.MaximumExtent();
+    if (centroidBounds.pMax[dim] == centroidBounds.pMin[dim]) {
+        makeLeaf();
+        return node;
+    }
+    int mid;
+    if (nPrimitives <= 2) {
+        // Partition primitives into equally-sized subsets
+        mid = (start + end) / 2;
+        std::nth_element(&primitiveInfo[start], &primitiveInfo[mid],
+                         &primitiveInfo[end - 1] + 1,
+                         [dim](const BVHPrimitiveInfo &a,
+                               const BVHPrimitiveInfo &b) {
+                             return a.centroid[dim] < b.centroid[dim];
+                         });
+    } else {
+        // Allocate _BucketInfo_ for SAH partition buckets
+        PBRT_CONSTEXPR int nBuckets = 12;
+        BucketInfo buckets[nBuckets];
+        for (int i = start; i < end; ++i) {
+            int b = nBuckets *
+                    centroidBounds.Offset(primitiveInfo[i].centroid)[dim];
+            if (b == nBuckets) b = nBuckets - 1;
+            buckets[b].count++;
+            buckets[b].bounds =
+                Union(buckets[b].bounds, primitiveInfo[i].bounds);
+        }
+        // Compute costs for splitting after each bucket
+        Float cost[nBuckets - 1];
+        for (int i = 0; i < nBuckets - 1; ++i) {
+            Bounds3f b0, b1;
+            int count0 = 0, count1 = 0;
+            for (int j = 0; j <= i; ++j) {
+                b0 = Union(b0, buckets[j].bounds);
+                count0 += buckets[j].count;
+            }
+            for (int j = i + 1; j < nBuckets; ++j) {
+                b1 = Union(b1, buckets[j].bounds);
+                count1 += buckets[j].count;
+            }
+            cost[i] = 1 + (count0 * b0.SurfaceArea() +
+                           count1 * b1.SurfaceArea()) /
+                              bounds.SurfaceArea();
+        }
+        // Find bucket to split at that minimizes SAH metric
+        Float minCost = cost[0];
+        int minCostSplitBucket = 0;
+        for (int i = 1; i < nBuckets - 1; ++i)
+            if (cost[i] < minCost) {
+                minCost = cost[i];
+                minCostSplitBucket = i;
+            }
+        Float leafCost = nPrimitives;
+        if (nPrimitives > maxPrimsInNode || minCost < leafCost) {
+            BVHPrimitiveInfo *pmid = std::partition(
+                &primitiveInfo[start], &primitiveInfo[end - 1] + 1,
+                [=](const BVHPrimitiveInfo &pi) {
+                    int b =
+                        nBuckets * centroidBounds.Offset(pi.centroid)[dim];
+                    if (b == nBuckets) b = nBuckets - 1;
+                    return b <= minCostSplitBucket;
+                });
+            mid = pmid - &primitiveInfo[0];
+        } else {
+            makeLeaf();
+            return node;
+        }
+    }
+    BVHBuildNode *children[2];
+    if (nPrimitives >= parallelBuildThreshold) {
+        int bounds01[3] = {start, mid, end};
+        ParallelFor(
+            [&](int c) {
+                children[c] = parallelSAHBuild(
+                    threadArenas, primitiveInfo, bounds01[c], bounds01[c + 1],
+                    totalNodes, orderedPrims, orderedPrimsOffset);
+            },
+            2);
+    } else {
+        children[0] =
+            parallelSAHBuild(threadArenas, primitiveInfo, start, mid,
+                             totalNodes, orderedPrims, orderedPrimsOffset);
+        children[1] = parallelSAHBuild(threadArenas, primitiveInfo, mid, end,
+                                       totalNodes, orderedPrims,
+                                       orderedPrimsOffset);
+    }
+    node->InitInterior(dim, children[0], children[1]);
+    return node;
+}
+
+// Spatial-split BVH build. References carry clipped ("chopped") AABBs, so a
+// long thin primitive that straddles a split plane can be referenced from
+// both sides with tight per-side bounds instead of inflating one child's
+// bounds with the primitive's whole extent. Since only Primitive::WorldBound()
+// is available here, a reference's bounds are clipped to the split plane
+// rather than re-derived from the underlying geometry; that approximation is
+// conservative and keeps the build independent of shape type. A global
+// _spatialSplitBudget_ bounds reference duplication.
+BVHBuildNode *BVHAccel::SBVHBuild(
+    MemoryArena &arena, std::vector<BVHPrimitiveInfo> &refs, int *totalNodes,
+    std::vector<std::shared_ptr<Primitive>> &orderedPrims,
+    int *spatialSplitBudget) {
+    CHECK(!refs.empty());
+    BVHBuildNode *node = arena.Alloc<BVHBuildNode>();
+    (*totalNodes)++;
+    // Compute bounds of all references in SBVH node
+    Bounds3f bounds;
+    for (const BVHPrimitiveInfo &ref : refs)
+        bounds = Union(bounds, ref.bounds);
+    int nRefs = refs.size();
+    // Compute bound of reference centroids, choose split dimension _dim_
+    Bounds3f centroidBounds;
+    for (const BVHPrimitiveInfo &ref : refs)
+        centroidBounds = Union(centroidBounds, ref.centroid);
+    int dim = centroidBounds.MaximumExtent();
+    if (nRefs == 1 ||
+        centroidBounds.pMax[dim] == centroidBounds.pMin[dim]) {
+        // Create leaf _BVHBuildNode_
+        int firstPrimOffset = orderedPrims.size();
+        for (const BVHPrimitiveInfo &ref : refs)
+            orderedPrims.push_back(primitives[ref.primitiveNumber]);
+        node->InitLeaf(firstPrimOffset, nRefs, bounds);
+        return node;
+    }
+
+    PBRT_CONSTEXPR int nBuckets = 12;
+
+    // Evaluate binned object split along _dim_, as in recursiveBuild()
+    BucketInfo buckets[nBuckets];
+    for (const BVHPrimitiveInfo &ref : refs) {
+        int b = nBuckets * centroidBounds.Offset(ref.centroid)[dim];
+        if (b == nBuckets) b = nBuckets - 1;
+        buckets[b].count++;
+        buckets[b].bounds = Union(buckets[b].bounds, ref.bounds);
+    }
+    Float objectCost[nBuckets - 1];
+    for (int i = 0; i < nBuckets - 1; ++i) {
+        Bounds3f b0, b1;
+        int count0 = 0, count1 = 0;
+        for (int j = 0; j <= i; ++j) {
+            b0 = Union(b0, buckets[j].bounds);
+            count0 += buckets[j].count;
+        }
+        for (int j = i + 1; j < nBuckets; ++j) {
+            b1 = Union(b1, buckets[j].bounds);
+            count1 += buckets[j].count;
+        }
+        objectCost[i] = 1 + (count0 * b0.SurfaceArea() +
+                             count1 * b1.SurfaceArea()) /
+                                bounds.SurfaceArea();
+    }
+    Float minObjectCost = objectCost[0];
+    int minObjectSplitBucket = 0;
+    for (int i = 1; i < nBuckets - 1; ++i)
+        if (objectCost[i] < minObjectCost) {
+            minObjectCost = objectCost[i];
+            minObjectSplitBucket = i;
+        }
+
+    // Evaluate binned spatial split along _dim_ over the node bounds. Each
+    // reference contributes its clipped bounds to every bin it overlaps;
+    // entry/exit counts give the number of references on each side of a
+    // candidate plane.
+    struct SpatialBin {
+        Bounds3f bounds;
+        int entries = 0, exits = 0;
+    };
+    SpatialBin spatialBins[nBuckets];
+    Float binExtent =
+        (bounds.pMax[dim] - bounds.pMin[dim]) / nBuckets;
+    Float minSpatialCost = Infinity;
+    int minSpatialSplitBucket = -1;
+    if (binExtent > 0) {
+        for (const BVHPrimitiveInfo &ref : refs) {
+            int b0 = Clamp(int((ref.bounds.pMin[dim] - bounds.pMin[dim]) /
+                               binExtent), 0, nBuckets - 1);
+            int b1 = Clamp(int((ref.bounds.pMax[dim] - bounds.pMin[dim]) /
+                               binExtent), 0, nBuckets - 1);
+            for (int b = b0; b <= b1; ++b) {
+                Bounds3f clipped = ref.bounds;
+                clipped.pMin[dim] = std::max(
+                    clipped.pMin[dim], bounds.pMin[dim] + b * binExtent);
+                clipped.pMax[dim] = std::min(
+                    clipped.pMax[dim], bounds.pMin[dim] + (b + 1) * binExtent);
+                spatialBins[b].bounds = Union(spatialBins[b].bounds, clipped);
+            }
+            ++spatialBins[b0].entries;
+            ++spatialBins[b1].exits;
+        }
+        for (int i = 0; i < nBuckets - 1; ++i) {
+            Bounds3f b0, b1;
+            int count0 = 0, count1 = 0;
+            for (int j = 0; j <= i; ++j) {
+                b0 = Union(b0, spatialBins[j].bounds);
+                count0 += spatialBins[j].entries;
+            }
+            for (int j = i + 1; j < nBuckets; ++j) {
+                b1 = Union(b1, spatialBins[j].bounds);
+                count1 += spatialBins[j].exits;
+            }
+            if (count0 == 0 || count1 == 0) continue;
+            Float cost = 1 + (count0 * b0.SurfaceArea() +
+                              count1 * b1.SurfaceArea()) /
+                                 bounds.SurfaceArea();
+            if (cost < minSpatialCost) {
+                minSpatialCost = cost;
+                minSpatialSplitBucket = i;
+            }
+        }
+    }
+
+    // Either create a leaf or perform the cheaper of the two splits
+    Float leafCost = nRefs;
+    Float minCost = std::min(minObjectCost, minSpatialCost);
+    if (nRefs <= maxPrimsInNode && minCost >= leafCost) {
+        // Create leaf _BVHBuildNode_
+        int firstPrimOffset = orderedPrims.size();
+        for (const BVHPrimitiveInfo &ref : refs)
+            orderedPrims.push_back(primitives[ref.primitiveNumber]);
+        node->InitLeaf(firstPrimOffset, nRefs, bounds);
+        return node;
+    }
+    std::vector<BVHPrimitiveInfo> leftRefs, rightRefs;
+    if (minSpatialSplitBucket >= 0 && minSpatialCost < minObjectCost &&
+        *spatialSplitBudget > 0) {
+        // Distribute references across the spatial split plane, duplicating
+        // (and clipping) those that straddle it while budget remains.
+        Float plane =
+            bounds.pMin[dim] + (minSpatialSplitBucket + 1) * binExtent;
+        for (const BVHPrimitiveInfo &ref : refs) {
+            if (ref.bounds.pMax[dim] <= plane)
+                leftRefs.push_back(ref);
+            else if (ref.bounds.pMin[dim] >= plane)
+                rightRefs.push_back(ref);
+            else if (*spatialSplitBudget > 0) {
+                --*spatialSplitBudget;
+                BVHPrimitiveInfo left(ref.primitiveNumber, ref.bounds);
+                left.bounds.pMax[dim] = plane;
+                left.centroid = .5f * left.bounds.pMin + .5f * left.bounds.pMax;
+                BVHPrimitiveInfo right(ref.primitiveNumber, ref.bounds);
+                right.bounds.pMin[dim] = plane;
+                right.centroid =
+                    .5f * right.bounds.pMin + .5f * right.bounds.pMax;
+                leftRefs.push_back(left);
+                rightRefs.push_back(right);
+            } else if (ref.centroid[dim] < plane)
+                leftRefs.push_back(ref);
+            else
+                rightRefs.push_back(ref);
+        }
+    }
+    if (leftRefs.empty() || rightRefs.empty()) {
+        // Object split at _minObjectSplitBucket_
+        leftRefs.clear();
+        rightRefs.clear();
+        for (const BVHPrimitiveInfo &ref : refs) {
+            int b = nBuckets * centroidBounds.Offset(ref.centroid)[dim];
+            if (b == nBuckets) b = nBuckets - 1;
+            if (b <= minObjectSplitBucket)
+                leftRefs.push_back(ref);
+            else
+                rightRefs.push_back(ref);
+        }
+    }
+    CHECK(!leftRefs.empty());
+    CHECK(!rightRefs.empty());
+    // Release this node's reference list before recursing
+    refs.clear();
+    refs.shrink_to_fit();
+    node->InitInterior(dim,
+                       SBVHBuild(arena, leftRefs, totalNodes, orderedPrims,
+                                 spatialSplitBudget),
+                       SBVHBuild(arena, rightRefs, totalNodes, orderedPrims,
+                                 spatialSplitBudget));
+    return node;
+}
+
 BVHBuildNode *BVHAccel::HLBVHBuild(
-    MemoryArena &arena, const std::vector<BVHPrimitiveInfo> &primitiveInfo,
-    int *totalNodes,
+    MemoryArena &arena,
+    std::vector<std::unique_ptr<MemoryArena>> &threadArenas,
+    const std::vector<BVHPrimitiveInfo> &primitiveInfo, int *totalNodes,
     std::vector<std::shared_ptr<Primitive>> &orderedPrims) const {
     // Compute bounding box of all primitive centroids
     Bounds3f bounds;
@@ -426,24 +950,39 @@ BVHBuildNode *BVHAccel::HLBVHBuild(
 
     // Create LBVH treelets at bottom of BVH
 
-    // Find intervals of primitives for each treelet
-    std::vector<LBVHTreelet> treeletsToBuild;
-    for (int start = 0, end = 1; end <= (int)mortonPrims.size(); ++end) {
+    // Find intervals of primitives for each treelet: flag the first
+    // primitive of each treelet in parallel and prefix-sum the flags to
+    // get each treelet's index
 #ifdef PBRT_HAVE_BINARY_CONSTANTS
-      uint32_t mask = 0b00111111111111000000000000000000;
+    PBRT_CONSTEXPR uint32_t mask = 0b00111111111111000000000000000000;
 #else
-      uint32_t mask = 0x3ffc0000;
+    PBRT_CONSTEXPR uint32_t mask = 0x3ffc0000;
 #endif
-      if (end == (int)mortonPrims.size() ||
-            ((mortonPrims[start].mortonCode & mask) !=
-             (mortonPrims[end].mortonCode & mask))) {
-            // Add entry to _treeletsToBuild_ for this treelet
-            int nPrimitives = end - start;
-            int maxBVHNodes = 2 * nPrimitives;
-            BVHBuildNode *nodes = arena.Alloc<BVHBuildNode>(maxBVHNodes, false);
-            treeletsToBuild.push_back({start, nPrimitives, nodes});
-            start = end;
-        }
+    std::vector<int> isTreeletStart(mortonPrims.size()),
+        treeletIndex(mortonPrims.size());
+    ParallelFor([&](int64_t i) {
+        isTreeletStart[i] =
+            i == 0 || ((mortonPrims[i - 1].mortonCode & mask) !=
+                       (mortonPrims[i].mortonCode & mask));
+    }, mortonPrims.size(), 4096);
+    int nTreelets = ParallelExclusiveScan(
+        &isTreeletStart[0], isTreeletStart.size(), &treeletIndex[0]);
+    std::vector<LBVHTreelet> treeletsToBuild(nTreelets);
+    ParallelFor([&](int64_t i) {
+        if (isTreeletStart[i])
+            treeletsToBuild[treeletIndex[i]].startIndex = i;
+    }, mortonPrims.size(), 4096);
+    // Size the treelets and allocate their build nodes (the arena isn't
+    // thread-safe, so this stays serial)
+    for (int t = 0; t < nTreelets; ++t) {
+        int start = treeletsToBuild[t].startIndex;
+        int end = t + 1 < nTreelets ? treeletsToBuild[t + 1].startIndex
+                                    : (int)mortonPrims.size();
+        int nPrimitives = end - start;
+        int maxBVHNodes = 2 * nPrimitives;
+        treeletsToBuild[t].nPrimitives = nPrimitives;
+        treeletsToBuild[t].buildNodes =
+            arena.Alloc<BVHBuildNode>(maxBVHNodes, false);
     }
 
     // Create LBVHs for treelets in parallel
@@ -460,15 +999,17 @@ BVHBuildNode *BVHAccel::HLBVHBuild(
                      &orderedPrimsOffset, firstBitIndex);
         atomicTotal += nodesCreated;
     }, treeletsToBuild.size());
-    *totalNodes = atomicTotal;
 
     // Create and return SAH BVH from LBVH treelets
     std::vector<BVHBuildNode *> finishedTreelets;
     finishedTreelets.reserve(treeletsToBuild.size());
     for (LBVHTreelet &treelet : treeletsToBuild)
         finishedTreelets.push_back(treelet.buildNodes);
-    return buildUpperSAH(arena, finishedTreelets, 0, finishedTreelets.size(),
-                         totalNodes);
+    BVHBuildNode *root =
+        buildUpperSAH(threadArenas, finishedTreelets, 0,
+                      finishedTreelets.size(), &atomicTotal);
+    *totalNodes = atomicTotal;
+    return root;
 }
 
 BVHBuildNode *BVHAccel::emitLBVH(
@@ -535,15 +1076,20 @@ BVHBuildNode *BVHAccel::emitLBVH(
     }
 }
 
-BVHBuildNode *BVHAccel::buildUpperSAH(MemoryArena &arena,
-                                      std::vector<BVHBuildNode *> &treeletRoots,
-                                      int start, int end,
-                                      int *totalNodes) const {
+// Above _upperSAHParallelThreshold_ treelet roots the two children of an
+// upper-tree split are built as independent tasks, following the same
+// pattern as parallelSAHBuild(): each task allocates build nodes from its
+// own per-thread arena and the only coordination is the atomic node count.
+static PBRT_CONSTEXPR int upperSAHParallelThreshold = 128;
+BVHBuildNode *BVHAccel::buildUpperSAH(
+    std::vector<std::unique_ptr<MemoryArena>> &threadArenas,
+    std::vector<BVHBuildNode *> &treeletRoots, int start, int end,
+    std::atomic<int> *totalNodes) const {
     CHECK_LT(start, end);
     int nNodes = end - start;
     if (nNodes == 1) return treeletRoots[start];
-    (*totalNodes)++;
-    BVHBuildNode *node = arena.Alloc<BVHBuildNode>();
+    ++*totalNodes;
+    BVHBuildNode *node = threadArenas[ThreadIndex]->Alloc<BVHBuildNode>();
 
     // Compute bounds of all nodes under this HLBVH node
     Bounds3f bounds;
@@ -631,9 +1177,23 @@ BVHBuildNode *BVHAccel::buildUpperSAH(MemoryArena &arena,
     int mid = pmid - &treeletRoots[0];
     CHECK_GT(mid, start);
     CHECK_LT(mid, end);
-    node->InitInterior(
-        dim, this->buildUpperSAH(arena, treeletRoots, start, mid, totalNodes),
-        this->buildUpperSAH(arena, treeletRoots, mid, end, totalNodes));
+    BVHBuildNode *children[2];
+    if (nNodes >= upperSAHParallelThreshold) {
+        int bounds01[3] = {start, mid, end};
+        ParallelFor(
+            [&](int c) {
+                children[c] =
+                    buildUpperSAH(threadArenas, treeletRoots, bounds01[c],
+                                  bounds01[c + 1], totalNodes);
+            },
+            2);
+    } else {
+        children[0] =
+            buildUpperSAH(threadArenas, treeletRoots, start, mid, totalNodes);
+        children[1] =
+            buildUpperSAH(threadArenas, treeletRoots, mid, end, totalNodes);
+    }
+    node->InitInterior(dim, children[0], children[1]);
     return node;
 }
 
@@ -653,11 +1213,86 @@ int BVHAccel::flattenBVHTree(BVHBuildNode *node, int *offset) {
         flattenBVHTree(node->children[0], offset);
         linearNode->secondChildOffset =
             flattenBVHTree(node->children[1], offset);
+        // A bigger box is proportionally more likely to contain an occluder,
+        // so note which child any-hit traversal should descend into first.
+        linearNode->occludeSecondFirst =
+            node->children[1]->bounds.SurfaceArea() >
+            node->children[0]->bounds.SurfaceArea();
     }
     return myOffset;
 }
 
-BVHAccel::~BVHAccel() { FreeAligned(nodes); }
+STAT_COUNTER("BVH/Bundled leaf triangles", bundledLeafTriangles);
+
+void BVHAccel::buildTriangleBundles() {
+#ifdef PBRT_WBVH_HAVE_AVX
+    freeTriangleBundles();
+    if (!nodes) return;
+    // Count the bundles needed for leaves whose primitives are all
+    // triangles; leaves with just a few primitives aren't worth a kernel
+    // invocation and keep the scalar loop.
+    PBRT_CONSTEXPR int minPrimsToBundle = 4;
+    int nBundles = 0;
+    Point3f tri[3];
+    std::vector<int> offsets(nNodes, -1);
+    for (int i = 0; i < nNodes; ++i) {
+        const LinearBVHNode &node = nodes[i];
+        if (node.nPrimitives < minPrimsToBundle) continue;
+        bool allTriangles = true;
+        for (int j = 0; j < node.nPrimitives && allTriangles; ++j)
+            allTriangles =
+                primitives[node.primitivesOffset + j]->GetTriangleVertices(
+                    tri);
+        if (!allTriangles) continue;
+        offsets[i] = nBundles;
+        nBundles += (node.nPrimitives + TriangleBundleWidth - 1) /
+                    TriangleBundleWidth;
+    }
+    if (nBundles == 0) return;
+
+    // Gather the bundled leaves' vertex positions into SoA order
+    triangleBundles = AllocAligned<TriangleBundle>(nBundles);
+    memset(triangleBundles, 0, nBundles * sizeof(TriangleBundle));
+    nTriangleBundles = nBundles;
+    leafBundleOffset.swap(offsets);
+    treeBytes += nBundles * sizeof(TriangleBundle) +
+                 leafBundleOffset.size() * sizeof(int);
+    for (int i = 0; i < nNodes; ++i) {
+        if (leafBundleOffset[i] < 0) continue;
+        const LinearBVHNode &node = nodes[i];
+        TriangleBundle *bundle = &triangleBundles[leafBundleOffset[i]];
+        for (int j = 0; j < node.nPrimitives; ++j) {
+            if (j > 0 && (j % TriangleBundleWidth) == 0) ++bundle;
+            int lane = j % TriangleBundleWidth;
+            primitives[node.primitivesOffset + j]->GetTriangleVertices(tri);
+            for (int vtx = 0; vtx < 3; ++vtx)
+                for (int a = 0; a < 3; ++a)
+                    bundle->p[vtx][a][lane] = (float)tri[vtx][a];
+            bundle->n = lane + 1;
+        }
+        bundledLeafTriangles += node.nPrimitives;
+    }
+#endif  // PBRT_WBVH_HAVE_AVX
+}
+
+void BVHAccel::freeTriangleBundles() {
+    if (triangleBundles) {
+        treeBytes -= nTriangleBundles * sizeof(TriangleBundle) +
+                     leafBundleOffset.size() * sizeof(int);
+        FreeAligned(triangleBundles);
+        triangleBundles = nullptr;
+        nTriangleBundles = 0;
+    }
+    leafBundleOffset.clear();
+}
+
+BVHAccel::~BVHAccel() {
+    if (nodes) bvhLiveNodeBytes -= nNodes * sizeof(LinearBVHNode);
+    FreeAligned(nodes);
+    freeTriangleBundles();
+    // Invalidate any shadow-ray occluder caches that may point into this tree
+    ++occluderGeneration;
+}
 
 bool BVHAccel::Intersect(const Ray &ray, SurfaceInteraction *isect) const {
     if (!nodes) return false;
@@ -665,15 +1300,56 @@ bool BVHAccel::Intersect(const Ray &ray, SurfaceInteraction *isect) const {
     bool hit = false;
     Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
     int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+#ifdef PBRT_WBVH_HAVE_AVX
+    // Precompute the watertight triangle test's axis permutation and shear
+    // coefficients for the SIMD leaf kernel
+    int kx = 0, ky = 0, kz = 0;
+    Float Sx = 0, Sy = 0, Sz = 0;
+    if (triangleBundles) {
+        kz = MaxDimension(Abs(ray.d));
+        kx = kz + 1;
+        if (kx == 3) kx = 0;
+        ky = kx + 1;
+        if (ky == 3) ky = 0;
+        Sx = -ray.d[kx] / ray.d[kz];
+        Sy = -ray.d[ky] / ray.d[kz];
+        Sz = 1.f / ray.d[kz];
+    }
+#endif
     // Follow ray through BVH nodes to find primitive intersections
     int toVisitOffset = 0, currentNodeIndex = 0;
     int nodesToVisit[64];
+    int nodesVisited = 0, primsTested = 0;
     while (true) {
         const LinearBVHNode *node = &nodes[currentNodeIndex];
+        ++nodesVisited;
         // Check ray against BVH node
         if (node->bounds.IntersectP(ray, invDir, dirIsNeg)) {
             if (node->nPrimitives > 0) {
                 // Intersect ray with primitives in leaf BVH node
+                primsTested += node->nPrimitives;
+#ifdef PBRT_WBVH_HAVE_AVX
+                if (triangleBundles &&
+                    leafBundleOffset[currentNodeIndex] >= 0) {
+                    // Run the SIMD rejection kernel over the leaf's
+                    // triangle bundles; surviving lanes take the full
+                    // scalar test.
+                    int bundle = leafBundleOffset[currentNodeIndex];
+                    for (int i = 0; i < node->nPrimitives;
+                         i += TriangleBundleWidth, ++bundle) {
+                        int mask = IntersectTriangleBundle(
+                            triangleBundles[bundle], ray, kx, ky, kz, Sx, Sy,
+                            Sz);
+                        while (mask) {
+                            int lane = CountTrailingZeros(mask);
+                            mask &= mask - 1;
+                            if (primitives[node->primitivesOffset + i + lane]
+                                    ->Intersect(ray, isect))
+                                hit = true;
+                        }
+                    }
+                } else
+#endif
                 for (int i = 0; i < node->nPrimitives; ++i)
                     if (primitives[node->primitivesOffset + i]->Intersect(
                             ray, isect))
@@ -696,32 +1372,903 @@ bool BVHAccel::Intersect(const Ray &ray, SurfaceInteraction *isect) const {
             currentNodeIndex = nodesToVisit[--toVisitOffset];
         }
     }
+    ReportValue(nodesVisitedPerRay, nodesVisited);
+    ReportValue(primsTestedPerRay, primsTested);
     return hit;
 }
 
+bool BVHAccel::IntersectCompact(const Ray &ray, CompactHit *hit) const {
+    // Identical traversal to Intersect(), but leaf primitives are tested
+    // through the compact interface so only a CompactHit is carried along.
+    if (!nodes) return false;
+    ProfilePhase p(Prof::AccelIntersect);
+    bool anyHit = false;
+    Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+    int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+#ifdef PBRT_WBVH_HAVE_AVX
+    // Precompute the watertight triangle test's axis permutation and shear
+    // coefficients for the SIMD leaf kernel
+    int kx = 0, ky = 0, kz = 0;
+    Float Sx = 0, Sy = 0, Sz = 0;
+    if (triangleBundles) {
+        kz = MaxDimension(Abs(ray.d));
+        kx = kz + 1;
+        if (kx == 3) kx = 0;
+        ky = kx + 1;
+        if (ky == 3) ky = 0;
+        Sx = -ray.d[kx] / ray.d[kz];
+        Sy = -ray.d[ky] / ray.d[kz];
+        Sz = 1.f / ray.d[kz];
+    }
+#endif
+    // Follow ray through BVH nodes to find primitive intersections
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    int nodesToVisit[64];
+    int nodesVisited = 0, primsTested = 0;
+    while (true) {
+        const LinearBVHNode *node = &nodes[currentNodeIndex];
+        ++nodesVisited;
+        // Check ray against BVH node
+        if (node->bounds.IntersectP(ray, invDir, dirIsNeg)) {
+            if (node->nPrimitives > 0) {
+                // Intersect ray with primitives in leaf BVH node
+                primsTested += node->nPrimitives;
+#ifdef PBRT_WBVH_HAVE_AVX
+                if (triangleBundles &&
+                    leafBundleOffset[currentNodeIndex] >= 0) {
+                    // Run the SIMD rejection kernel over the leaf's
+                    // triangle bundles; surviving lanes take the full
+                    // scalar test.
+                    int bundle = leafBundleOffset[currentNodeIndex];
+                    for (int i = 0; i < node->nPrimitives;
+                         i += TriangleBundleWidth, ++bundle) {
+                        int mask = IntersectTriangleBundle(
+                            triangleBundles[bundle], ray, kx, ky, kz, Sx, Sy,
+                            Sz);
+                        while (mask) {
+                            int lane = CountTrailingZeros(mask);
+                            mask &= mask - 1;
+                            if (primitives[node->primitivesOffset + i + lane]
+                                    ->IntersectCompact(ray, hit))
+                                anyHit = true;
+                        }
+                    }
+                } else
+#endif
+                for (int i = 0; i < node->nPrimitives; ++i)
+                    if (primitives[node->primitivesOffset + i]
+                            ->IntersectCompact(ray, hit))
+                        anyHit = true;
+                if (toVisitOffset == 0) break;
+                currentNodeIndex = nodesToVisit[--toVisitOffset];
+            } else {
+                // Put far BVH node on _nodesToVisit_ stack, advance to near
+                // node
+                if (dirIsNeg[node->axis]) {
+                    nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+                    currentNodeIndex = node->secondChildOffset;
+                } else {
+                    nodesToVisit[toVisitOffset++] = node->secondChildOffset;
+                    currentNodeIndex = currentNodeIndex + 1;
+                }
+            }
+        } else {
+            if (toVisitOffset == 0) break;
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
+        }
+    }
+    ReportValue(nodesVisitedPerRay, nodesVisited);
+    ReportValue(primsTestedPerRay, primsTested);
+    return anyHit;
+}
+
+STAT_COUNTER("BVH/Shadow-ray mailbox hits", shadowMailboxHits);
+
 bool BVHAccel::IntersectP(const Ray &ray) const {
     if (!nodes) return false;
     ProfilePhase p(Prof::AccelIntersectP);
+    // Test the thread's last occluding primitive before traversing, but
+    // only if this aggregate cached it: its ray is in this tree's
+    // coordinate space.
+    if (lastOccluder && lastOccluderBVH == this &&
+        lastOccluderGeneration == occluderGeneration &&
+        lastOccluder->IntersectP(ray)) {
+        ++shadowMailboxHits;
+        return true;
+    }
     Vector3f invDir(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
     int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+#ifdef PBRT_WBVH_HAVE_AVX
+    // Precompute the watertight triangle test's axis permutation and shear
+    // coefficients for the SIMD leaf kernel
+    int kx = 0, ky = 0, kz = 0;
+    Float Sx = 0, Sy = 0, Sz = 0;
+    if (triangleBundles) {
+        kz = MaxDimension(Abs(ray.d));
+        kx = kz + 1;
+        if (kx == 3) kx = 0;
+        ky = kx + 1;
+        if (ky == 3) ky = 0;
+        Sx = -ray.d[kx] / ray.d[kz];
+        Sy = -ray.d[ky] / ray.d[kz];
+        Sz = 1.f / ray.d[kz];
+    }
+#endif
     int nodesToVisit[64];
     int toVisitOffset = 0, currentNodeIndex = 0;
+    int nodesVisited = 0, primsTested = 0;
     while (true) {
         const LinearBVHNode *node = &nodes[currentNodeIndex];
+        ++nodesVisited;
         if (node->bounds.IntersectP(ray, invDir, dirIsNeg)) {
             // Process BVH node _node_ for traversal
             if (node->nPrimitives > 0) {
+#ifdef PBRT_WBVH_HAVE_AVX
+                if (triangleBundles &&
+                    leafBundleOffset[currentNodeIndex] >= 0) {
+                    // Run the SIMD rejection kernel over the leaf's
+                    // triangle bundles; surviving lanes take the full
+                    // scalar test.
+                    primsTested += node->nPrimitives;
+                    int bundle = leafBundleOffset[currentNodeIndex];
+                    for (int i = 0; i < node->nPrimitives;
+                         i += TriangleBundleWidth, ++bundle) {
+                        int mask = IntersectTriangleBundle(
+                            triangleBundles[bundle], ray, kx, ky, kz, Sx, Sy,
+                            Sz);
+                        while (mask) {
+                            int lane = CountTrailingZeros(mask);
+                            mask &= mask - 1;
+                            const Primitive *prim =
+                                primitives[node->primitivesOffset + i + lane]
+                                    .get();
+                            if (prim->IntersectP(ray)) {
+                                lastOccluder = prim;
+                                lastOccluderBVH = this;
+                                lastOccluderGeneration = occluderGeneration;
+                                ReportValue(nodesVisitedPerShadowRay,
+                                            nodesVisited);
+                                ReportValue(primsTestedPerShadowRay,
+                                            primsTested);
+                                return true;
+                            }
+                        }
+                    }
+                    if (toVisitOffset == 0) break;
+                    currentNodeIndex = nodesToVisit[--toVisitOffset];
+                    continue;
+                }
+#endif
                 for (int i = 0; i < node->nPrimitives; ++i) {
+                    ++primsTested;
                     if (primitives[node->primitivesOffset + i]->IntersectP(
                             ray)) {
+                        lastOccluder =
+                            primitives[node->primitivesOffset + i].get();
+                        lastOccluderBVH = this;
+                        lastOccluderGeneration = occluderGeneration;
+                        ReportValue(nodesVisitedPerShadowRay, nodesVisited);
+                        ReportValue(primsTestedPerShadowRay, primsTested);
+                        return true;
+                    }
+                }
+                if (toVisitOffset == 0) break;
+                currentNodeIndex = nodesToVisit[--toVisitOffset];
+            } else {
+                // Any hit terminates the walk, so descend into the child
+                // more likely to contain an occluder rather than the
+                // nearer one.
+                if (node->occludeSecondFirst) {
+                    nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+                    currentNodeIndex = node->secondChildOffset;
+                } else {
+                    nodesToVisit[toVisitOffset++] = node->secondChildOffset;
+                    currentNodeIndex = currentNodeIndex + 1;
+                }
+            }
+        } else {
+            if (toVisitOffset == 0) break;
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
+        }
+    }
+    ReportValue(nodesVisitedPerShadowRay, nodesVisited);
+    ReportValue(primsTestedPerShadowRay, primsTested);
+    return false;
+}
+
+// BVHAccel stream traversal: a depth-first walk that carries the list of rays
+// still active in the current subtree, so each visited node is fetched once
+// for the whole batch rather than once per ray. The active list is compacted
+// in place; rays that miss a node's bounds are dropped for its entire
+// subtree.
+void BVHAccel::streamIntersect(int nodeIndex, int *rayIndices, int nActive,
+                               const RaySpan &rays, const Vector3f *invDirs,
+                               SurfaceInteraction *isects, bool *hits) const {
+    const LinearBVHNode *node = &nodes[nodeIndex];
+    // Compact the active list down to the rays that hit this node's bounds
+    int nSurviving = 0;
+    for (int i = 0; i < nActive; ++i) {
+        int r = rayIndices[i];
+        const Vector3f &invDir = invDirs[r];
+        int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+        if (node->bounds.IntersectP(rays[r], invDir, dirIsNeg))
+            std::swap(rayIndices[nSurviving++], rayIndices[i]);
+    }
+    if (nSurviving == 0) return;
+    if (node->nPrimitives > 0) {
+        for (int i = 0; i < nSurviving; ++i) {
+            int r = rayIndices[i];
+            for (int p = 0; p < node->nPrimitives; ++p)
+                if (primitives[node->primitivesOffset + p]->Intersect(
+                        rays[r], &isects[r]))
+                    hits[r] = true;
+        }
+    } else {
+        // Visit the near child first for the first surviving ray; coherent
+        // batches overwhelmingly agree on traversal order.
+        if (invDirs[rayIndices[0]][node->axis] < 0) {
+            streamIntersect(node->secondChildOffset, rayIndices, nSurviving,
+                            rays, invDirs, isects, hits);
+            streamIntersect(nodeIndex + 1, rayIndices, nSurviving, rays,
+                            invDirs, isects, hits);
+        } else {
+            streamIntersect(nodeIndex + 1, rayIndices, nSurviving, rays,
+                            invDirs, isects, hits);
+            streamIntersect(node->secondChildOffset, rayIndices, nSurviving,
+                            rays, invDirs, isects, hits);
+        }
+    }
+}
+
+void BVHAccel::streamIntersectP(int nodeIndex, int *rayIndices, int nActive,
+                                const RaySpan &rays, const Vector3f *invDirs,
+                                bool *hits) const {
+    const LinearBVHNode *node = &nodes[nodeIndex];
+    int nSurviving = 0;
+    for (int i = 0; i < nActive; ++i) {
+        int r = rayIndices[i];
+        const Vector3f &invDir = invDirs[r];
+        int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+        if (node->bounds.IntersectP(rays[r], invDir, dirIsNeg))
+            std::swap(rayIndices[nSurviving++], rayIndices[i]);
+    }
+    if (nSurviving == 0) return;
+    if (node->nPrimitives > 0) {
+        for (int p = 0; p < node->nPrimitives; ++p) {
+            const Primitive &prim = *primitives[node->primitivesOffset + p];
+            if (prim.HasBatchedIntersectP() && nSurviving > 1) {
+                // Gather the rays not yet found occluded into a span and
+                // test them against the primitive's batched kernel.
+                PBRT_CONSTEXPR int spanSize = 64;
+                Ray buf[spanSize];
+                int bufIndices[spanSize];
+                bool bufHits[spanSize];
+                int m = 0;
+                auto flush = [&]() {
+                    prim.IntersectPN(RaySpan(buf, m), bufHits);
+                    for (int k = 0; k < m; ++k)
+                        if (bufHits[k]) hits[bufIndices[k]] = true;
+                    m = 0;
+                };
+                for (int i = 0; i < nSurviving; ++i) {
+                    int r = rayIndices[i];
+                    if (hits[r]) continue;
+                    bufIndices[m] = r;
+                    buf[m++] = rays[r];
+                    if (m == spanSize) flush();
+                }
+                if (m > 0) flush();
+            } else {
+                for (int i = 0; i < nSurviving; ++i) {
+                    int r = rayIndices[i];
+                    if (!hits[r] && prim.IntersectP(rays[r])) hits[r] = true;
+                }
+            }
+        }
+    } else {
+        streamIntersectP(nodeIndex + 1, rayIndices, nSurviving, rays, invDirs,
+                         hits);
+        // Rays already found occluded need not visit the second child
+        int nRemaining = 0;
+        for (int i = 0; i < nSurviving; ++i)
+            if (!hits[rayIndices[i]])
+                std::swap(rayIndices[nRemaining++], rayIndices[i]);
+        if (nRemaining > 0)
+            streamIntersectP(node->secondChildOffset, rayIndices, nRemaining,
+                             rays, invDirs, hits);
+    }
+}
+
+void BVHAccel::IntersectN(const RaySpan &rays, SurfaceInteraction *isects,
+                          bool *hits) const {
+    for (int i = 0; i < rays.n; ++i) hits[i] = false;
+    if (!nodes || rays.n == 0) return;
+    ProfilePhase p(Prof::AccelIntersect);
+    std::vector<Vector3f> invDirs(rays.n);
+    std::vector<int> rayIndices(rays.n);
+    for (int i = 0; i < rays.n; ++i) {
+        invDirs[i] =
+            Vector3f(1 / rays[i].d.x, 1 / rays[i].d.y, 1 / rays[i].d.z);
+        rayIndices[i] = i;
+    }
+    streamIntersect(0, rayIndices.data(), rays.n, rays, invDirs.data(), isects,
+                    hits);
+}
+
+void BVHAccel::IntersectPN(const RaySpan &rays, bool *hits) const {
+    for (int i = 0; i < rays.n; ++i) hits[i] = false;
+    if (!nodes || rays.n == 0) return;
+    ProfilePhase p(Prof::AccelIntersectP);
+    std::vector<Vector3f> invDirs(rays.n);
+    std::vector<int> rayIndices(rays.n);
+    for (int i = 0; i < rays.n; ++i) {
+        invDirs[i] =
+            Vector3f(1 / rays[i].d.x, 1 / rays[i].d.y, 1 / rays[i].d.z);
+        rayIndices[i] = i;
+    }
+    streamIntersectP(0, rayIndices.data(), rays.n, rays, invDirs.data(), hits);
+}
+
+// WideBVHAccel Utility Functions
+
+// Test the ray against all child slabs of _node_, returning a bitmask of the
+// slots that were hit and their entry distances in _tMins_. Uses the same
+// conservative tMax scaling as Bounds3f::IntersectP().
+static inline int IntersectWideNode(const WideBVHNode &node, const Point3f &o,
+                                    const Vector3f &invDir,
+                                    const int dirIsNeg[3], Float rayTMax,
+                                    Float *tMins) {
+#ifdef PBRT_WBVH_HAVE_AVX
+    __m256 t0 = _mm256_setzero_ps();
+    __m256 t1 = _mm256_set1_ps(rayTMax);
+    for (int a = 0; a < 3; ++a) {
+        const Float *bNear = dirIsNeg[a] ? node.boundsMax[a] : node.boundsMin[a];
+        const Float *bFar = dirIsNeg[a] ? node.boundsMin[a] : node.boundsMax[a];
+        __m256 org = _mm256_set1_ps(o[a]);
+        __m256 inv = _mm256_set1_ps(invDir[a]);
+        __m256 tNear = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(bNear), org), inv);
+        __m256 tFar = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(bFar), org), inv);
+        tFar = _mm256_mul_ps(tFar, _mm256_set1_ps(1 + 2 * gamma(3)));
+        t0 = _mm256_max_ps(t0, tNear);
+        t1 = _mm256_min_ps(t1, tFar);
+    }
+    _mm256_storeu_ps(tMins, t0);
+    return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+#else
+    int hitMask = 0;
+    for (int i = 0; i < WideBVHMaxWidth; ++i) {
+        Float t0 = 0, t1 = rayTMax;
+        for (int a = 0; a < 3; ++a) {
+            const Float bNear =
+                dirIsNeg[a] ? node.boundsMax[a][i] : node.boundsMin[a][i];
+            const Float bFar =
+                dirIsNeg[a] ? node.boundsMin[a][i] : node.boundsMax[a][i];
+            Float tNear = (bNear - o[a]) * invDir[a];
+            Float tFar = (bFar - o[a]) * invDir[a] * (1 + 2 * gamma(3));
+            t0 = tNear > t0 ? tNear : t0;
+            t1 = tFar < t1 ? tFar : t1;
+        }
+        if (t0 <= t1) {
+            hitMask |= 1 << i;
+            tMins[i] = t0;
+        }
+    }
+    return hitMask;
+#endif
+}
+
+// WideBVHAccel Method Definitions
+WideBVHAccel::WideBVHAccel(std::vector<std::shared_ptr<Primitive>> p,
+                           int maxPrimsInNode, SplitMethod splitMethod,
+                           int branchingFactor)
+    : BVHAccel(std::move(p), maxPrimsInNode, splitMethod),
+      branchingFactor(Clamp(branchingFactor, 2, WideBVHMaxWidth)) {
+    ProfilePhase _(Prof::AccelConstruction);
+    if (!nodes) return;
+    worldBound = nodes[0].bounds;
+    if (nodes[0].nPrimitives > 0) {
+        // Degenerate case: the root of the binary tree is already a leaf, so
+        // emit a single wide node holding it in its first slot.
+        WideBVHNode wn;
+        for (int i = 0; i < WideBVHMaxWidth; ++i) {
+            for (int a = 0; a < 3; ++a) {
+                wn.boundsMin[a][i] = MaxFloat;
+                wn.boundsMax[a][i] = -MaxFloat;
+            }
+            wn.child[i] = -1;
+            wn.nPrimitives[i] = 0;
+        }
+        for (int a = 0; a < 3; ++a) {
+            wn.boundsMin[a][0] = nodes[0].bounds.pMin[a];
+            wn.boundsMax[a][0] = nodes[0].bounds.pMax[a];
+        }
+        wn.child[0] = nodes[0].primitivesOffset;
+        wn.nPrimitives[0] = nodes[0].nPrimitives;
+        wideNodes.push_back(wn);
+    } else
+        collapseBVHTree(0);
+    wideInteriorNodes += wideNodes.size();
+    treeBytes += wideNodes.size() * sizeof(WideBVHNode);
+    LOG(INFO) << StringPrintf(
+        "Wide BVH (branching factor %d) created with %d nodes (%.2f MB)",
+        this->branchingFactor, (int)wideNodes.size(),
+        float(wideNodes.size() * sizeof(WideBVHNode)) / (1024.f * 1024.f));
+    // The binary node array is no longer needed once it has been collapsed,
+    // and the SoA triangle bundles are keyed by its leaves.
+    bvhLiveNodeBytes -= nNodes * sizeof(LinearBVHNode);
+    FreeAligned(nodes);
+    nodes = nullptr;
+    freeTriangleBundles();
+}
+
+WideBVHAccel::~WideBVHAccel() {}
+
+Bounds3f WideBVHAccel::WorldBound() const { return worldBound; }
+
+int WideBVHAccel::collapseBVHTree(int binaryNodeIndex) {
+    // Reserve the slot for this wide node before recursing so that parents
+    // precede children in _wideNodes_.
+    int wideIndex = wideNodes.size();
+    wideNodes.push_back(WideBVHNode());
+
+    // Gather up to _branchingFactor_ binary subtrees, greedily expanding the
+    // interior child with the largest surface area.
+    int slots[WideBVHMaxWidth];
+    int nSlots = 0;
+    slots[nSlots++] = binaryNodeIndex + 1;
+    slots[nSlots++] = nodes[binaryNodeIndex].secondChildOffset;
+    while (nSlots < branchingFactor) {
+        int best = -1;
+        Float bestArea = 0;
+        for (int i = 0; i < nSlots; ++i) {
+            const LinearBVHNode *c = &nodes[slots[i]];
+            if (c->nPrimitives == 0 &&
+                (best == -1 || c->bounds.SurfaceArea() > bestArea)) {
+                best = i;
+                bestArea = c->bounds.SurfaceArea();
+            }
+        }
+        if (best == -1) break;
+        int expanded = slots[best];
+        slots[best] = expanded + 1;
+        slots[nSlots++] = nodes[expanded].secondChildOffset;
+    }
+
+    // Fill in the wide node; recursion may reallocate _wideNodes_, so build a
+    // local copy and store it once all children have been emitted.
+    WideBVHNode wn;
+    for (int i = 0; i < WideBVHMaxWidth; ++i) {
+        if (i < nSlots) {
+            const LinearBVHNode *c = &nodes[slots[i]];
+            for (int a = 0; a < 3; ++a) {
+                wn.boundsMin[a][i] = c->bounds.pMin[a];
+                wn.boundsMax[a][i] = c->bounds.pMax[a];
+            }
+            if (c->nPrimitives > 0) {
+                wn.child[i] = c->primitivesOffset;
+                wn.nPrimitives[i] = c->nPrimitives;
+            } else {
+                wn.child[i] = collapseBVHTree(slots[i]);
+                wn.nPrimitives[i] = 0;
+            }
+        } else {
+            // Empty slot; degenerate slabs guarantee the test misses.
+            for (int a = 0; a < 3; ++a) {
+                wn.boundsMin[a][i] = MaxFloat;
+                wn.boundsMax[a][i] = -MaxFloat;
+            }
+            wn.child[i] = -1;
+            wn.nPrimitives[i] = 0;
+        }
+    }
+    wideNodes[wideIndex] = wn;
+    return wideIndex;
+}
+
+bool WideBVHAccel::Intersect(const Ray &ray,
+                             SurfaceInteraction *isect) const {
+    if (wideNodes.empty()) return false;
+    ProfilePhase p(Prof::AccelIntersect);
+    bool hit = false;
+    Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+    int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    int nodesToVisit[128];
+    while (true) {
+        const WideBVHNode &node = wideNodes[currentNodeIndex];
+        Float tMins[WideBVHMaxWidth];
+        int hitMask =
+            IntersectWideNode(node, ray.o, invDir, dirIsNeg, ray.tMax, tMins);
+        // Intersect leaf slots front to back and collect interior slots,
+        // sorted by entry distance, for the traversal stack.
+        int order[WideBVHMaxWidth], nHit = 0;
+        for (int i = 0; i < WideBVHMaxWidth; ++i) {
+            if (!(hitMask & (1 << i))) continue;
+            int j = nHit++;
+            while (j > 0 && tMins[order[j - 1]] > tMins[i]) {
+                order[j] = order[j - 1];
+                --j;
+            }
+            order[j] = i;
+        }
+        int interior[WideBVHMaxWidth], nInterior = 0;
+        for (int k = 0; k < nHit; ++k) {
+            int i = order[k];
+            if (node.nPrimitives[i] > 0) {
+                for (int pi = 0; pi < node.nPrimitives[i]; ++pi)
+                    if (primitives[node.child[i] + pi]->Intersect(ray, isect))
+                        hit = true;
+            } else
+                interior[nInterior++] = node.child[i];
+        }
+        // Push far interior slots first so the nearest is visited next.
+        for (int k = nInterior - 1; k > 0; --k)
+            nodesToVisit[toVisitOffset++] = interior[k];
+        if (nInterior > 0)
+            currentNodeIndex = interior[0];
+        else {
+            if (toVisitOffset == 0) break;
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
+        }
+    }
+    return hit;
+}
+
+bool WideBVHAccel::IntersectP(const Ray &ray) const {
+    if (wideNodes.empty()) return false;
+    ProfilePhase p(Prof::AccelIntersectP);
+    Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+    int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    int nodesToVisit[128];
+    while (true) {
+        const WideBVHNode &node = wideNodes[currentNodeIndex];
+        Float tMins[WideBVHMaxWidth];
+        int hitMask =
+            IntersectWideNode(node, ray.o, invDir, dirIsNeg, ray.tMax, tMins);
+        int interior[WideBVHMaxWidth], nInterior = 0;
+        for (int i = 0; i < WideBVHMaxWidth; ++i) {
+            if (!(hitMask & (1 << i))) continue;
+            if (node.nPrimitives[i] > 0) {
+                for (int pi = 0; pi < node.nPrimitives[i]; ++pi)
+                    if (primitives[node.child[i] + pi]->IntersectP(ray))
                         return true;
+            } else
+                interior[nInterior++] = node.child[i];
+        }
+        for (int k = nInterior - 1; k > 0; --k)
+            nodesToVisit[toVisitOffset++] = interior[k];
+        if (nInterior > 0)
+            currentNodeIndex = interior[0];
+        else {
+            if (toVisitOffset == 0) break;
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
+        }
+    }
+    return false;
+}
+
+// CompressedBVHNode stores both children of an interior node with bounds
+// quantized to 8-bit offsets within the node's own box; leaves live entirely
+// in their parent's child slots, so only interior nodes are stored at all.
+// Minima are rounded down and maxima up when encoding, so decoded boxes are
+// conservative. 28 bytes cover what takes 64 bytes in two LinearBVHNodes.
+struct CompressedBVHNode {
+    uint8_t qMin[2][3], qMax[2][3];
+    // Per child: interior node index if _nPrimitives_ is zero, offset into
+    // _primitives_ otherwise.
+    int32_t child[2];
+    uint16_t nPrimitives[2];
+    uint8_t axis;
+    uint8_t pad[3];
+};
+
+// CompressedBVHAccel Method Definitions
+CompressedBVHAccel::CompressedBVHAccel(
+    std::vector<std::shared_ptr<Primitive>> p, int maxPrimsInNode,
+    SplitMethod splitMethod)
+    : BVHAccel(std::move(p), maxPrimsInNode, splitMethod) {
+    ProfilePhase _(Prof::AccelConstruction);
+    if (!nodes) return;
+    worldBound = nodes[0].bounds;
+    if (nodes[0].nPrimitives > 0)
+        // A single-leaf tree has no interior nodes to compress; traversal
+        // falls back to the binary node array in that case.
+        return;
+    compressedNodes.reserve(nNodes / 2);
+    compressBVHTree(0, worldBound);
+    treeBytes += compressedNodes.size() * sizeof(CompressedBVHNode);
+    LOG(INFO) << StringPrintf(
+        "Compressed BVH created with %d nodes (%.2f MB, binary layout %.2f "
+        "MB)",
+        (int)compressedNodes.size(),
+        float(compressedNodes.size() * sizeof(CompressedBVHNode)) /
+            (1024.f * 1024.f),
+        float(nNodes * sizeof(LinearBVHNode)) / (1024.f * 1024.f));
+    treeBytes -= nNodes * sizeof(LinearBVHNode);
+    bvhLiveNodeBytes -= nNodes * sizeof(LinearBVHNode);
+    FreeAligned(nodes);
+    nodes = nullptr;
+    freeTriangleBundles();
+}
+
+CompressedBVHAccel::~CompressedBVHAccel() {}
+
+Bounds3f CompressedBVHAccel::WorldBound() const { return worldBound; }
+
+// Decode the quantized bounds of child _c_ of _node_ relative to the node's
+// own (decoded) box _b_.
+static inline Bounds3f DecodeChildBounds(const CompressedBVHNode &node, int c,
+                                         const Bounds3f &b) {
+    Bounds3f cb;
+    for (int a = 0; a < 3; ++a) {
+        Float extent = b.pMax[a] - b.pMin[a];
+        cb.pMin[a] = b.pMin[a] + node.qMin[c][a] * extent * (1.f / 255.f);
+        cb.pMax[a] = b.pMin[a] + node.qMax[c][a] * extent * (1.f / 255.f);
+    }
+    return cb;
+}
+
+int CompressedBVHAccel::compressBVHTree(int binaryNodeIndex,
+                                        const Bounds3f &nodeBounds) {
+    CHECK_EQ(nodes[binaryNodeIndex].nPrimitives, 0);
+    int compressedIndex = compressedNodes.size();
+    compressedNodes.push_back(CompressedBVHNode());
+    CompressedBVHNode cn;
+    cn.axis = nodes[binaryNodeIndex].axis;
+    cn.pad[0] = cn.pad[1] = cn.pad[2] = 0;
+    int binaryChild[2] = {binaryNodeIndex + 1,
+                          nodes[binaryNodeIndex].secondChildOffset};
+    for (int c = 0; c < 2; ++c) {
+        const LinearBVHNode *child = &nodes[binaryChild[c]];
+        // Quantize child bounds, rounding minima down and maxima up
+        for (int a = 0; a < 3; ++a) {
+            Float extent = nodeBounds.pMax[a] - nodeBounds.pMin[a];
+            Float invExtent = extent > 0 ? 1 / extent : 0;
+            cn.qMin[c][a] = (uint8_t)Clamp(
+                std::floor(255.f * (child->bounds.pMin[a] -
+                                    nodeBounds.pMin[a]) * invExtent),
+                0, 255);
+            cn.qMax[c][a] = (uint8_t)Clamp(
+                std::ceil(255.f * (child->bounds.pMax[a] -
+                                   nodeBounds.pMin[a]) * invExtent),
+                0, 255);
+        }
+        if (child->nPrimitives > 0) {
+            cn.child[c] = child->primitivesOffset;
+            cn.nPrimitives[c] = child->nPrimitives;
+        } else {
+            // Children are encoded against the box their parent will decode,
+            // not the original one, so quantization error doesn't accumulate.
+            cn.child[c] =
+                compressBVHTree(binaryChild[c],
+                                DecodeChildBounds(cn, c, nodeBounds));
+            cn.nPrimitives[c] = 0;
+        }
+    }
+    compressedNodes[compressedIndex] = cn;
+    return compressedIndex;
+}
+
+bool CompressedBVHAccel::Intersect(const Ray &ray,
+                                   SurfaceInteraction *isect) const {
+    if (compressedNodes.empty()) return BVHAccel::Intersect(ray, isect);
+    ProfilePhase p(Prof::AccelIntersect);
+    bool hit = false;
+    Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+    int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    if (!worldBound.IntersectP(ray, invDir, dirIsNeg)) return false;
+    // Stack entries carry each node's decoded box so children can be decoded
+    struct TraversalEntry {
+        int nodeIndex;
+        Bounds3f bounds;
+    };
+    TraversalEntry nodesToVisit[64];
+    int toVisitOffset = 0;
+    TraversalEntry current = {0, worldBound};
+    while (true) {
+        const CompressedBVHNode &node = compressedNodes[current.nodeIndex];
+        int first = dirIsNeg[node.axis] ? 1 : 0;
+        int next = -1;
+        Bounds3f nextBounds;
+        for (int i = 0; i < 2; ++i) {
+            int c = first ^ i;
+            Bounds3f childBounds = DecodeChildBounds(node, c, current.bounds);
+            if (!childBounds.IntersectP(ray, invDir, dirIsNeg)) continue;
+            if (node.nPrimitives[c] > 0) {
+                for (int pi = 0; pi < node.nPrimitives[c]; ++pi)
+                    if (primitives[node.child[c] + pi]->Intersect(ray, isect))
+                        hit = true;
+            } else if (next < 0) {
+                next = node.child[c];
+                nextBounds = childBounds;
+            } else
+                nodesToVisit[toVisitOffset++] = {node.child[c], childBounds};
+        }
+        if (next >= 0) {
+            current = {next, nextBounds};
+        } else {
+            if (toVisitOffset == 0) break;
+            current = nodesToVisit[--toVisitOffset];
+        }
+    }
+    return hit;
+}
+
+bool CompressedBVHAccel::IntersectP(const Ray &ray) const {
+    if (compressedNodes.empty()) return BVHAccel::IntersectP(ray);
+    ProfilePhase p(Prof::AccelIntersectP);
+    Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+    int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    if (!worldBound.IntersectP(ray, invDir, dirIsNeg)) return false;
+    struct TraversalEntry {
+        int nodeIndex;
+        Bounds3f bounds;
+    };
+    TraversalEntry nodesToVisit[64];
+    int toVisitOffset = 0;
+    TraversalEntry current = {0, worldBound};
+    while (true) {
+        const CompressedBVHNode &node = compressedNodes[current.nodeIndex];
+        int next = -1;
+        Bounds3f nextBounds;
+        for (int c = 0; c < 2; ++c) {
+            Bounds3f childBounds = DecodeChildBounds(node, c, current.bounds);
+            if (!childBounds.IntersectP(ray, invDir, dirIsNeg)) continue;
+            if (node.nPrimitives[c] > 0) {
+                for (int pi = 0; pi < node.nPrimitives[c]; ++pi)
+                    if (primitives[node.child[c] + pi]->IntersectP(ray))
+                        return true;
+            } else if (next < 0) {
+                next = node.child[c];
+                nextBounds = childBounds;
+            } else
+                nodesToVisit[toVisitOffset++] = {node.child[c], childBounds};
+        }
+        if (next >= 0) {
+            current = {next, nextBounds};
+        } else {
+            if (toVisitOffset == 0) break;
+            current = nodesToVisit[--toVisitOffset];
+        }
+    }
+    return false;
+}
+
+// MotionBVHAccel Method Definitions
+STAT_COUNTER("BVH/Motion-blurred primitives", motionBlurredPrims);
+
+static Bounds3f LerpBounds(Float t, const Bounds3f &b0, const Bounds3f &b1) {
+    return Bounds3f(Lerp(t, b0.pMin, b1.pMin), Lerp(t, b0.pMax, b1.pMax));
+}
+
+MotionBVHAccel::MotionBVHAccel(std::vector<std::shared_ptr<Primitive>> p,
+                               int maxPrimsInNode, SplitMethod splitMethod,
+                               Float time0, Float time1)
+    : BVHAccel(std::move(p), maxPrimsInNode, splitMethod),
+      time0(time0),
+      time1(time1) {
+    if (!nodes) return;
+    // Compute per-node endpoint bounds with a reverse sweep over the
+    // flattened tree; every node's children follow it in the array, so by
+    // the time a node is visited both children's bounds are final.
+    startBounds.resize(nNodes);
+    endBounds.resize(nNodes);
+    // Number of intermediate shutter times checked per leaf primitive to
+    // make the interpolated bounds conservative under rotation.
+    PBRT_CONSTEXPR int nMotionSamples = 4;
+    for (int i = nNodes - 1; i >= 0; --i) {
+        const LinearBVHNode &node = nodes[i];
+        if (node.nPrimitives > 0) {
+            Bounds3f b0, b1;
+            for (int j = 0; j < node.nPrimitives; ++j) {
+                const Primitive &prim =
+                    *primitives[node.primitivesOffset + j];
+                Bounds3f p0 = prim.WorldBoundAtTime(time0);
+                Bounds3f p1 = prim.WorldBoundAtTime(time1);
+                if (p0 != p1) ++motionBlurredPrims;
+                // Linearly interpolated bounds aren't conservative under
+                // rotational motion; pad the endpoint bounds by however far
+                // the primitive escapes them at intermediate times. Growing
+                // both endpoints by the worst-case escape keeps every
+                // interpolated box valid at the sampled time.
+                for (int s = 1; s <= nMotionSamples; ++s) {
+                    Float w = Float(s) / (nMotionSamples + 1);
+                    Bounds3f bs =
+                        prim.WorldBoundAtTime(Lerp(w, time0, time1));
+                    Bounds3f lerped = LerpBounds(w, p0, p1);
+                    for (int a = 0; a < 3; ++a) {
+                        Float below =
+                            std::max((Float)0, lerped.pMin[a] - bs.pMin[a]);
+                        Float above =
+                            std::max((Float)0, bs.pMax[a] - lerped.pMax[a]);
+                        p0.pMin[a] -= below;
+                        p1.pMin[a] -= below;
+                        p0.pMax[a] += above;
+                        p1.pMax[a] += above;
                     }
                 }
+                b0 = Union(b0, p0);
+                b1 = Union(b1, p1);
+            }
+            startBounds[i] = b0;
+            endBounds[i] = b1;
+        } else {
+            startBounds[i] = Union(startBounds[i + 1],
+                                   startBounds[node.secondChildOffset]);
+            endBounds[i] =
+                Union(endBounds[i + 1], endBounds[node.secondChildOffset]);
+        }
+    }
+    treeBytes += 2 * nNodes * sizeof(Bounds3f);
+}
+
+bool MotionBVHAccel::Intersect(const Ray &ray,
+                               SurfaceInteraction *isect) const {
+    if (!nodes) return false;
+    ProfilePhase p(Prof::AccelIntersect);
+    Float w = time1 > time0
+                  ? Clamp((ray.time - time0) / (time1 - time0), 0, 1)
+                  : 0;
+    bool hit = false;
+    Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+    int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    int nodesToVisit[64];
+    while (true) {
+        const LinearBVHNode *node = &nodes[currentNodeIndex];
+        // Check ray against node bounds interpolated to _ray.time_
+        Bounds3f bounds = LerpBounds(w, startBounds[currentNodeIndex],
+                                     endBounds[currentNodeIndex]);
+        if (bounds.IntersectP(ray, invDir, dirIsNeg)) {
+            if (node->nPrimitives > 0) {
+                for (int i = 0; i < node->nPrimitives; ++i)
+                    if (primitives[node->primitivesOffset + i]->Intersect(
+                            ray, isect))
+                        hit = true;
+                if (toVisitOffset == 0) break;
+                currentNodeIndex = nodesToVisit[--toVisitOffset];
+            } else {
+                if (dirIsNeg[node->axis]) {
+                    nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+                    currentNodeIndex = node->secondChildOffset;
+                } else {
+                    nodesToVisit[toVisitOffset++] = node->secondChildOffset;
+                    currentNodeIndex = currentNodeIndex + 1;
+                }
+            }
+        } else {
+            if (toVisitOffset == 0) break;
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
+        }
+    }
+    return hit;
+}
+
+bool MotionBVHAccel::IntersectP(const Ray &ray) const {
+    if (!nodes) return false;
+    ProfilePhase p(Prof::AccelIntersectP);
+    Float w = time1 > time0
+                  ? Clamp((ray.time - time0) / (time1 - time0), 0, 1)
+                  : 0;
+    Vector3f invDir(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
+    int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    int nodesToVisit[64];
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    while (true) {
+        const LinearBVHNode *node = &nodes[currentNodeIndex];
+        Bounds3f bounds = LerpBounds(w, startBounds[currentNodeIndex],
+                                     endBounds[currentNodeIndex]);
+        if (bounds.IntersectP(ray, invDir, dirIsNeg)) {
+            if (node->nPrimitives > 0) {
+                for (int i = 0; i < node->nPrimitives; ++i)
+                    if (primitives[node->primitivesOffset + i]->IntersectP(
+                            ray))
+                        return true;
                 if (toVisitOffset == 0) break;
                 currentNodeIndex = nodesToVisit[--toVisitOffset];
             } else {
                 if (dirIsNeg[node->axis]) {
-                    /// second child first
                     nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
                     currentNodeIndex = node->secondChildOffset;
                 } else {
@@ -737,26 +2284,441 @@ bool BVHAccel::IntersectP(const Ray &ray) const {
     return false;
 }
 
+// BVH disk cache support. The cache file holds the flattened node array and
+// the build-order primitive indices; cache keys hash each primitive's world
+// bounds, which change whenever geometry or transforms do.
+struct BVHCacheHeader {
+    uint32_t magic;       // 'pbvh'
+    uint32_t nodeSize;    // sizeof(LinearBVHNode), guards Float width
+    uint64_t nPrimitives;
+    uint64_t nOrdered;
+    uint64_t nNodes;
+};
+static PBRT_CONSTEXPR uint32_t bvhCacheMagic = 0x70627668;  // 'pbvh'
+
+bool BVHAccel::Save(const std::string &filename) const {
+    if (!nodes || primitiveIndices.size() != primitives.size()) return false;
+    FILE *f = fopen(filename.c_str(), "wb");
+    if (!f) {
+        Warning("Unable to open BVH cache file \"%s\" for writing",
+                filename.c_str());
+        return false;
+    }
+    BVHCacheHeader header;
+    header.magic = bvhCacheMagic;
+    header.nodeSize = sizeof(LinearBVHNode);
+    header.nPrimitives = nOriginalPrimitives;
+    header.nOrdered = primitiveIndices.size();
+    header.nNodes = nNodes;
+    bool ok =
+        fwrite(&header, sizeof(header), 1, f) == 1 &&
+        fwrite(primitiveIndices.data(), sizeof(int),
+               primitiveIndices.size(), f) == primitiveIndices.size() &&
+        fwrite(nodes, sizeof(LinearBVHNode), nNodes, f) == (size_t)nNodes;
+    fclose(f);
+    if (!ok) Warning("Failed writing BVH cache file \"%s\"", filename.c_str());
+    return ok;
+}
+
+std::shared_ptr<BVHAccel> BVHAccel::Load(
+    const std::string &filename,
+    const std::vector<std::shared_ptr<Primitive>> &prims, int maxPrimsInNode,
+    SplitMethod splitMethod) {
+    FILE *f = fopen(filename.c_str(), "rb");
+    if (!f) return nullptr;
+    BVHCacheHeader header;
+    if (fread(&header, sizeof(header), 1, f) != 1 ||
+        header.magic != bvhCacheMagic ||
+        header.nodeSize != sizeof(LinearBVHNode) ||
+        header.nPrimitives != prims.size()) {
+        fclose(f);
+        return nullptr;
+    }
+    std::shared_ptr<BVHAccel> accel(
+        new BVHAccel(maxPrimsInNode, splitMethod));
+    accel->primitiveIndices.resize(header.nOrdered);
+    accel->nNodes = header.nNodes;
+    accel->nOriginalPrimitives = header.nPrimitives;
+    accel->nodes = AllocAligned<LinearBVHNode>(header.nNodes);
+    registerBVHNodeBytes(header.nNodes * sizeof(LinearBVHNode));
+    if (fread(accel->primitiveIndices.data(), sizeof(int), header.nOrdered,
+              f) != header.nOrdered ||
+        fread(accel->nodes, sizeof(LinearBVHNode), header.nNodes, f) !=
+            header.nNodes) {
+        fclose(f);
+        Warning("Truncated BVH cache file \"%s\"; rebuilding", filename.c_str());
+        return nullptr;
+    }
+    fclose(f);
+    accel->primitives.resize(header.nOrdered);
+    for (size_t i = 0; i < header.nOrdered; ++i) {
+        if (accel->primitiveIndices[i] < 0 ||
+            (size_t)accel->primitiveIndices[i] >= prims.size())
+            return nullptr;
+        accel->primitives[i] = prims[accel->primitiveIndices[i]];
+    }
+    treeBytes += header.nNodes * sizeof(LinearBVHNode) + sizeof(*accel) +
+                 accel->primitives.size() * sizeof(accel->primitives[0]);
+    LOG(INFO) << StringPrintf("Loaded cached BVH (%d nodes) from \"%s\"",
+                              (int)header.nNodes, filename.c_str());
+    accel->buildTriangleBundles();
+    return accel;
+}
+
+// Hash the "primitive soup" (world bounds of every primitive, in order) and
+// the build parameters; FNV-1a.
+static uint64_t HashPrimitiveSoup(
+    const std::vector<std::shared_ptr<Primitive>> &prims, int maxPrimsInNode,
+    BVHAccel::SplitMethod splitMethod) {
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&hash](const void *data, size_t size) {
+        const unsigned char *bytes = (const unsigned char *)data;
+        for (size_t i = 0; i < size; ++i) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+    };
+    uint64_t n = prims.size();
+    mix(&n, sizeof(n));
+    mix(&maxPrimsInNode, sizeof(maxPrimsInNode));
+    int sm = (int)splitMethod;
+    mix(&sm, sizeof(sm));
+    for (const auto &prim : prims) {
+        Bounds3f b = prim->WorldBound();
+        Float bounds[6] = {b.pMin.x, b.pMin.y, b.pMin.z,
+                           b.pMax.x, b.pMax.y, b.pMax.z};
+        mix(bounds, sizeof(bounds));
+    }
+    return hash;
+}
+
+STAT_COUNTER("BVH/Lazy treelets built", lazyTreeletsBuilt);
+STAT_COUNTER("BVH/Lazy treelets evicted", lazyTreeletsEvicted);
+
+// Lazy-build support: for scenes whose fully built tree would not fit in
+// memory, primitives are partitioned into treelets that behave like ordinary
+// primitives under the top-level accelerator but only build (and can drop)
+// their subtree node arrays on demand.
+class LazyBVHTreelet;
+
+// Tracks which treelets currently hold a built subtree and evicts the least
+// recently used one when the resident budget is exceeded. Eviction only
+// drops the treelet's reference; traversals in flight keep the subtree alive
+// through their own shared_ptr until they finish.
+struct LazyTreeletCache {
+    LazyTreeletCache(int maxResident) : maxResident(std::max(1, maxResident)) {}
+    void NotifyBuilt(LazyBVHTreelet *treelet);
+    void NotifyUsed(LazyBVHTreelet *treelet);
+    const int maxResident;
+    std::mutex mutex;
+    std::vector<LazyBVHTreelet *> resident;  // front is least recently used
+};
+
+class LazyBVHTreelet : public Aggregate {
+  public:
+    LazyBVHTreelet(std::vector<std::shared_ptr<Primitive>> p,
+                   int maxPrimsInNode, BVHAccel::SplitMethod splitMethod,
+                   std::shared_ptr<LazyTreeletCache> cache)
+        : primitives(std::move(p)),
+          maxPrimsInNode(maxPrimsInNode),
+          splitMethod(splitMethod),
+          cache(cache) {
+        for (const auto &prim : primitives)
+            bounds = Union(bounds, prim->WorldBound());
+    }
+    Bounds3f WorldBound() const { return bounds; }
+    bool Intersect(const Ray &ray, SurfaceInteraction *isect) const {
+        return ensureBuilt()->Intersect(ray, isect);
+    }
+    bool IntersectP(const Ray &ray) const {
+        return ensureBuilt()->IntersectP(ray);
+    }
+    void Evict() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (bvh) {
+            bvh.reset();
+            ++lazyTreeletsEvicted;
+        }
+    }
+
+  private:
+    std::shared_ptr<BVHAccel> ensureBuilt() const {
+        std::shared_ptr<BVHAccel> built;
+        bool wasBuilt = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!bvh) {
+                bvh = std::make_shared<BVHAccel>(primitives, maxPrimsInNode,
+                                                 splitMethod);
+                ++lazyTreeletsBuilt;
+                wasBuilt = true;
+            }
+            built = bvh;
+        }
+        // Update the cache outside our own mutex; see LazyTreeletCache for
+        // the lock ordering this avoids.
+        if (wasBuilt)
+            cache->NotifyBuilt(const_cast<LazyBVHTreelet *>(this));
+        else
+            cache->NotifyUsed(const_cast<LazyBVHTreelet *>(this));
+        return built;
+    }
+    std::vector<std::shared_ptr<Primitive>> primitives;
+    Bounds3f bounds;
+    const int maxPrimsInNode;
+    const BVHAccel::SplitMethod splitMethod;
+    std::shared_ptr<LazyTreeletCache> cache;
+    mutable std::mutex mutex;
+    mutable std::shared_ptr<BVHAccel> bvh;
+};
+
+void LazyTreeletCache::NotifyBuilt(LazyBVHTreelet *treelet) {
+    std::vector<LazyBVHTreelet *> victims;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        resident.push_back(treelet);
+        while ((int)resident.size() > maxResident) {
+            victims.push_back(resident.front());
+            resident.erase(resident.begin());
+        }
+    }
+    // Evict with the cache mutex released; Evict() takes the treelet mutex,
+    // which ensureBuilt() holds while calling back into the cache.
+    for (LazyBVHTreelet *victim : victims) victim->Evict();
+}
+
+void LazyTreeletCache::NotifyUsed(LazyBVHTreelet *treelet) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto iter = std::find(resident.begin(), resident.end(), treelet);
+    if (iter != resident.end()) {
+        resident.erase(iter);
+        resident.push_back(treelet);
+    }
+}
+
+// Partition _prims_ into Morton-ordered treelets of roughly _treeletSize_
+// primitives each, returning the treelet primitives for the top-level build.
+static std::vector<std::shared_ptr<Primitive>> PartitionIntoLazyTreelets(
+    std::vector<std::shared_ptr<Primitive>> prims, int treeletSize,
+    int maxPrimsInNode, BVHAccel::SplitMethod splitMethod, int maxResident) {
+    Bounds3f centroidBounds;
+    std::vector<Bounds3f> primBounds(prims.size());
+    for (size_t i = 0; i < prims.size(); ++i) {
+        primBounds[i] = prims[i]->WorldBound();
+        centroidBounds = Union(
+            centroidBounds, .5f * primBounds[i].pMin + .5f * primBounds[i].pMax);
+    }
+    std::vector<MortonPrimitive> mortonPrims(prims.size());
+    ParallelFor([&](int i) {
+        PBRT_CONSTEXPR int mortonBits = 10;
+        PBRT_CONSTEXPR int mortonScale = 1 << mortonBits;
+        mortonPrims[i].primitiveIndex = i;
+        Vector3f centroidOffset = centroidBounds.Offset(
+            .5f * primBounds[i].pMin + .5f * primBounds[i].pMax);
+        mortonPrims[i].mortonCode = EncodeMorton3(centroidOffset * mortonScale);
+    }, prims.size(), 512);
+    RadixSort(&mortonPrims);
+    std::shared_ptr<LazyTreeletCache> cache =
+        std::make_shared<LazyTreeletCache>(maxResident);
+    std::vector<std::shared_ptr<Primitive>> treelets;
+    for (size_t start = 0; start < mortonPrims.size(); start += treeletSize) {
+        size_t end = std::min(start + treeletSize, mortonPrims.size());
+        std::vector<std::shared_ptr<Primitive>> treeletPrims;
+        treeletPrims.reserve(end - start);
+        for (size_t i = start; i < end; ++i)
+            treeletPrims.push_back(
+                prims[mortonPrims[i].primitiveIndex]);
+        treelets.push_back(std::make_shared<LazyBVHTreelet>(
+            std::move(treeletPrims), maxPrimsInNode, splitMethod, cache));
+    }
+    LOG(INFO) << StringPrintf(
+        "Lazy BVH: %d treelets of ~%d primitives, resident budget %d",
+        (int)treelets.size(), treeletSize, maxResident);
+    return treelets;
+}
+
+// BVH Auto-Tuning Definitions
+STAT_COUNTER("BVH/Auto-tune candidate builds", nAutoTuneBuilds);
+
+// Picks a split method and leaf size by building each candidate
+// configuration over a subset of the primitives, then scoring it with a
+// micro traversal benchmark over a shared, deterministic set of rays.
+// The fastest candidate wins; within 5% of the best time, the lower
+// predicted SAH cost breaks the tie (the timing noise floor on subset
+// trees is about that large).
+static void AutoTuneBVH(const std::vector<std::shared_ptr<Primitive>> &prims,
+                        BVHAccel::SplitMethod *splitMethod,
+                        int *maxPrimsInNode) {
+    PBRT_CONSTEXPR int minPrimsToTune = 4 * 1024;
+    PBRT_CONSTEXPR int maxSubsetSize = 32 * 1024;
+    if ((int)prims.size() < minPrimsToTune) return;
+
+    // Take a uniform-stride subset so every region of the scene is
+    // represented.
+    std::vector<std::shared_ptr<Primitive>> subset;
+    size_t stride = std::max<size_t>(1, prims.size() / maxSubsetSize);
+    subset.reserve(prims.size() / stride + 1);
+    Bounds3f bounds;
+    for (size_t i = 0; i < prims.size(); i += stride) {
+        subset.push_back(prims[i]);
+        bounds = Union(bounds, prims[i]->WorldBound());
+    }
+
+    // Generate the benchmark rays: half aimed from outside the subset's
+    // bounds at points inside (primary-like), half between two points
+    // inside (secondary-like).
+    PBRT_CONSTEXPR int nRays = 4096;
+    RNG rng(630);
+    Vector3f diag = bounds.Diagonal();
+    auto insidePoint = [&]() {
+        return bounds.pMin + Vector3f(rng.UniformFloat() * diag.x,
+                                      rng.UniformFloat() * diag.y,
+                                      rng.UniformFloat() * diag.z);
+    };
+    std::vector<Ray> rays;
+    rays.reserve(nRays);
+    for (int i = 0; i < nRays; ++i) {
+        Point3f target = insidePoint();
+        Point3f origin;
+        if (i & 1) {
+            Vector3f d = UniformSampleSphere(
+                {rng.UniformFloat(), rng.UniformFloat()});
+            origin = bounds.pMin + .5f * diag + d * 1.5f * diag.Length();
+        } else
+            origin = insidePoint();
+        Vector3f dir = target - origin;
+        if (dir.LengthSquared() == 0) dir = Vector3f(0, 0, 1);
+        rays.push_back(Ray(origin, Normalize(dir)));
+    }
+
+    struct Candidate {
+        BVHAccel::SplitMethod sm;
+        int maxPrims;
+    };
+    const Candidate candidates[] = {
+        {BVHAccel::SplitMethod::SAH, 1}, {BVHAccel::SplitMethod::SAH, 2},
+        {BVHAccel::SplitMethod::SAH, 4}, {BVHAccel::SplitMethod::SAH, 8},
+        {BVHAccel::SplitMethod::HLBVH, 2}, {BVHAccel::SplitMethod::HLBVH, 4},
+        {BVHAccel::SplitMethod::Middle, 4}};
+    double bestTime = Infinity;
+    Float bestCost = Infinity;
+    Candidate best = candidates[0];
+    for (const Candidate &c : candidates) {
+        BVHAccel tree(subset, c.maxPrims, c.sm);
+        ++nAutoTuneBuilds;
+        auto traverse = [&]() {
+            int nHit = 0;
+            SurfaceInteraction isect;
+            for (const Ray &r : rays) {
+                Ray ray = r;
+                if (tree.Intersect(ray, &isect)) ++nHit;
+            }
+            return nHit;
+        };
+        traverse();  // warm the caches before timing
+        auto start = std::chrono::high_resolution_clock::now();
+        traverse();
+        double secs = std::chrono::duration<double>(
+                          std::chrono::high_resolution_clock::now() - start)
+                          .count();
+        Float cost = tree.SAHCost();
+        VLOG(1) << StringPrintf(
+            "BVH auto-tune: split %d maxPrims %d: %.3f ms, SAH cost %.1f",
+            (int)c.sm, c.maxPrims, 1e3 * secs, cost);
+        if (secs < bestTime * 1.05 &&
+            (secs < bestTime || cost < bestCost)) {
+            best = c;
+            bestTime = std::min(bestTime, secs);
+            bestCost = cost;
+        }
+    }
+    LOG(INFO) << StringPrintf(
+        "BVH auto-tune picked split method %d, maxPrimsInNode %d",
+        (int)best.sm, best.maxPrims);
+    *splitMethod = best.sm;
+    *maxPrimsInNode = best.maxPrims;
+}
+
 std::shared_ptr<BVHAccel> CreateBVHAccelerator(
     std::vector<std::shared_ptr<Primitive>> prims, const ParamSet &ps) {
     std::string splitMethodName = ps.FindOneString("splitmethod", "sah");
+    bool autoTune = ps.FindOneBool("autotune", false);
     BVHAccel::SplitMethod splitMethod;
     if (splitMethodName == "sah")
         splitMethod = BVHAccel::SplitMethod::SAH;
     else if (splitMethodName == "hlbvh")
         splitMethod = BVHAccel::SplitMethod::HLBVH;
+    else if (splitMethodName == "sbvh")
+        splitMethod = BVHAccel::SplitMethod::SBVH;
     else if (splitMethodName == "middle")
         splitMethod = BVHAccel::SplitMethod::Middle;
     else if (splitMethodName == "equal")
         splitMethod = BVHAccel::SplitMethod::EqualCounts;
-    else {
+    else if (splitMethodName == "auto") {
+        autoTune = true;
+        splitMethod = BVHAccel::SplitMethod::SAH;
+    } else {
         Warning("BVH split method \"%s\" unknown.  Using \"sah\".",
                 splitMethodName.c_str());
         splitMethod = BVHAccel::SplitMethod::SAH;
     }
 
     int maxPrimsInNode = ps.FindOneInt("maxnodeprims", 4);
-    return std::make_shared<BVHAccel>(std::move(prims), maxPrimsInNode, splitMethod);
+    if (autoTune) AutoTuneBVH(prims, &splitMethod, &maxPrimsInNode);
+    // "refit" requests cross-frame aggregate reuse; the primitive index
+    // bookkeeping it needs is only recorded when asked for.
+    bool refit = ps.FindOneBool("refit", false);
+    // Lazily built subtrees for scenes whose fully built tree would exceed
+    // memory; the treelets stand in as primitives for the top-level build.
+    if (ps.FindOneBool("lazybuild", false)) {
+        int treeletSize = ps.FindOneInt("lazytreeletsize", 64 * 1024);
+        int maxResident = ps.FindOneInt("lazyresidenttreelets", 64);
+        if ((int)prims.size() > 2 * treeletSize)
+            prims = PartitionIntoLazyTreelets(std::move(prims), treeletSize,
+                                              maxPrimsInNode, splitMethod,
+                                              maxResident);
+    }
+    // Interpolated node bounds for motion-heavy scenes: nodes store bounds
+    // at both shutter endpoints instead of the union over the whole shutter,
+    // and traversal interpolates them to each ray's time.
+    if (ps.FindOneBool("motionbounds", false)) {
+        Float time0 = ps.FindOneFloat("time0", 0.f);
+        Float time1 = ps.FindOneFloat("time1", 1.f);
+        return std::make_shared<MotionBVHAccel>(
+            std::move(prims), maxPrimsInNode, splitMethod, time0, time1);
+    }
+    std::string layout = ps.FindOneString("layout", "binary");
+    if (layout == "bvh4")
+        return std::make_shared<WideBVHAccel>(std::move(prims), maxPrimsInNode,
+                                              splitMethod, 4);
+    else if (layout == "bvh8")
+        return std::make_shared<WideBVHAccel>(std::move(prims), maxPrimsInNode,
+                                              splitMethod, 8);
+    else if (layout == "compressed")
+        return std::make_shared<CompressedBVHAccel>(std::move(prims),
+                                                    maxPrimsInNode,
+                                                    splitMethod);
+    else if (layout != "binary")
+        Warning("BVH layout \"%s\" unknown.  Using \"binary\".",
+                layout.c_str());
+    // With "string cachedir" set, look for a serialized tree for this exact
+    // primitive soup before building, and save one afterwards for the next
+    // run of the same scene.
+    std::string cacheDir = ps.FindOneString("cachedir", "");
+    if (!cacheDir.empty()) {
+        uint64_t hash = HashPrimitiveSoup(prims, maxPrimsInNode, splitMethod);
+        std::string cacheFile =
+            cacheDir + "/" + StringPrintf("%016llx.bvh", (unsigned long long)hash);
+        std::shared_ptr<BVHAccel> cached =
+            BVHAccel::Load(cacheFile, prims, maxPrimsInNode, splitMethod);
+        if (cached) return cached;
+        std::shared_ptr<BVHAccel> accel = std::make_shared<BVHAccel>(
+            std::move(prims), maxPrimsInNode, splitMethod, true);
+        accel->Save(cacheFile);
+        return accel;
+    }
+    return std::make_shared<BVHAccel>(std::move(prims), maxPrimsInNode,
+                                      splitMethod, refit);
 }
 
 }  // namespace pbrt
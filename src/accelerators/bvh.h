@@ -50,31 +50,89 @@ struct BVHBuildNode;
 struct BVHPrimitiveInfo;
 struct MortonPrimitive;
 struct LinearBVHNode;
+struct WideBVHNode;
+struct CompressedBVHNode;
+struct TriangleBundle;
 
 // BVHAccel Declarations
 class BVHAccel : public Aggregate {
   public:
     // BVHAccel Public Types
-    enum class SplitMethod { SAH, HLBVH, Middle, EqualCounts };
+    enum class SplitMethod { SAH, HLBVH, Middle, EqualCounts, SBVH };
 
     // BVHAccel Public Methods
     BVHAccel(std::vector<std::shared_ptr<Primitive>> p,
              int maxPrimsInNode = 1,
-             SplitMethod splitMethod = SplitMethod::SAH);
+             SplitMethod splitMethod = SplitMethod::SAH,
+             bool recordPrimitiveIndices = false);
     Bounds3f WorldBound() const;
     ~BVHAccel();
+    // Update node bounds in place from the current primitives' world bounds,
+    // preserving the tree topology. Useful after transforms referenced by the
+    // primitives have been mutated between frames.
+    void Refit();
+    // Replace the primitives with _p_ (which must match the topology of the
+    // primitives the tree was built over, e.g. next frame's version of the
+    // same scene) and refit. Returns false, leaving the tree untouched, if
+    // the tree cannot be refit over _p_; requires the accelerator to have
+    // been built with _recordPrimitiveIndices_ set.
+    bool Refit(const std::vector<std::shared_ptr<Primitive>> &p);
+    bool CanRefit() const { return !primitiveIndices.empty(); }
+    // Serialize the flattened tree and primitive ordering to _filename_ so
+    // identical scenes can skip the build on subsequent runs; requires the
+    // accelerator to have been built with _recordPrimitiveIndices_ set.
+    bool Save(const std::string &filename) const;
+    // Reconstitute a previously saved tree over _prims_, or return nullptr
+    // if the file is missing or doesn't match.
+    static std::shared_ptr<BVHAccel> Load(
+        const std::string &filename,
+        const std::vector<std::shared_ptr<Primitive>> &prims,
+        int maxPrimsInNode, SplitMethod splitMethod);
+    // SAH cost of the built tree: unit node-traversal and
+    // primitive-intersection costs, weighted by the probability of
+    // reaching each node (surface area relative to the root).
+    Float SAHCost() const;
     bool Intersect(const Ray &ray, SurfaceInteraction *isect) const;
     bool IntersectP(const Ray &ray) const;
+    bool IntersectCompact(const Ray &ray, CompactHit *hit) const;
+    void IntersectN(const RaySpan &rays, SurfaceInteraction *isects,
+                    bool *hits) const;
+    void IntersectPN(const RaySpan &rays, bool *hits) const;
+    void ForEachPrimitive(
+        const std::function<void(const Primitive &)> &callback) const {
+        for (const auto &p : primitives) p->ForEachPrimitive(callback);
+    }
 
   private:
     // BVHAccel Private Methods
+    // Bare constructor used by Load() to build up a tree from cached data
+    BVHAccel(int maxPrimsInNode, SplitMethod splitMethod)
+        : maxPrimsInNode(maxPrimsInNode), splitMethod(splitMethod) {}
+    void streamIntersect(int nodeIndex, int *rayIndices, int nActive,
+                         const RaySpan &rays, const Vector3f *invDirs,
+                         SurfaceInteraction *isects, bool *hits) const;
+    void streamIntersectP(int nodeIndex, int *rayIndices, int nActive,
+                          const RaySpan &rays, const Vector3f *invDirs,
+                          bool *hits) const;
     BVHBuildNode *recursiveBuild(
         MemoryArena &arena, std::vector<BVHPrimitiveInfo> &primitiveInfo,
         int start, int end, int *totalNodes,
         std::vector<std::shared_ptr<Primitive>> &orderedPrims);
+    BVHBuildNode *parallelSAHBuild(
+        std::vector<std::unique_ptr<MemoryArena>> &threadArenas,
+        std::vector<BVHPrimitiveInfo> &primitiveInfo, int start, int end,
+        std::atomic<int> *totalNodes,
+        std::vector<std::shared_ptr<Primitive>> &orderedPrims,
+        std::atomic<int> *orderedPrimsOffset);
+    BVHBuildNode *SBVHBuild(MemoryArena &arena,
+                            std::vector<BVHPrimitiveInfo> &refs,
+                            int *totalNodes,
+                            std::vector<std::shared_ptr<Primitive>> &orderedPrims,
+                            int *spatialSplitBudget);
     BVHBuildNode *HLBVHBuild(
-        MemoryArena &arena, const std::vector<BVHPrimitiveInfo> &primitiveInfo,
-        int *totalNodes,
+        MemoryArena &arena,
+        std::vector<std::unique_ptr<MemoryArena>> &threadArenas,
+        const std::vector<BVHPrimitiveInfo> &primitiveInfo, int *totalNodes,
         std::vector<std::shared_ptr<Primitive>> &orderedPrims) const;
     BVHBuildNode *emitLBVH(
         BVHBuildNode *&buildNodes,
@@ -82,16 +140,96 @@ class BVHAccel : public Aggregate {
         MortonPrimitive *mortonPrims, int nPrimitives, int *totalNodes,
         std::vector<std::shared_ptr<Primitive>> &orderedPrims,
         std::atomic<int> *orderedPrimsOffset, int bitIndex) const;
-    BVHBuildNode *buildUpperSAH(MemoryArena &arena,
-                                std::vector<BVHBuildNode *> &treeletRoots,
-                                int start, int end, int *totalNodes) const;
+    BVHBuildNode *buildUpperSAH(
+        std::vector<std::unique_ptr<MemoryArena>> &threadArenas,
+        std::vector<BVHBuildNode *> &treeletRoots, int start, int end,
+        std::atomic<int> *totalNodes) const;
     int flattenBVHTree(BVHBuildNode *node, int *offset);
 
-    // BVHAccel Private Data
+    // BVHAccel Protected Data
+  protected:
+    // (Re)gather the triangles of all-triangle leaves into SoA bundles for
+    // the SIMD leaf intersection kernel; a no-op when AVX isn't available.
+    // Subclasses that discard the binary node array free the bundles too.
+    void buildTriangleBundles();
+    void freeTriangleBundles();
     const int maxPrimsInNode;
     const SplitMethod splitMethod;
     std::vector<std::shared_ptr<Primitive>> primitives;
     LinearBVHNode *nodes = nullptr;
+    int nNodes = 0;
+    // Number of primitives the tree was built over and, if requested at
+    // construction time, the original index of each (possibly duplicated)
+    // entry of _primitives_; both support Refit() with new primitives.
+    size_t nOriginalPrimitives = 0;
+    std::vector<int> primitiveIndices;
+    // SoA bundles of leaf triangles for SIMD leaf tests and, parallel to
+    // _nodes_, the index of each leaf's first bundle (-1 for interior nodes
+    // and for leaves that weren't bundled). Null when AVX isn't available
+    // or no leaf qualified.
+    TriangleBundle *triangleBundles = nullptr;
+    int nTriangleBundles = 0;
+    std::vector<int> leafBundleOffset;
+};
+
+// WideBVHAccel Declarations
+class WideBVHAccel : public BVHAccel {
+  public:
+    // WideBVHAccel Public Methods
+    WideBVHAccel(std::vector<std::shared_ptr<Primitive>> p, int maxPrimsInNode,
+                 SplitMethod splitMethod, int branchingFactor);
+    ~WideBVHAccel();
+    Bounds3f WorldBound() const;
+    bool Intersect(const Ray &ray, SurfaceInteraction *isect) const;
+    bool IntersectP(const Ray &ray) const;
+
+  private:
+    // WideBVHAccel Private Methods
+    int collapseBVHTree(int binaryNodeIndex);
+
+    // WideBVHAccel Private Data
+    const int branchingFactor;
+    std::vector<WideBVHNode> wideNodes;
+    Bounds3f worldBound;
+};
+
+// CompressedBVHAccel Declarations
+class CompressedBVHAccel : public BVHAccel {
+  public:
+    // CompressedBVHAccel Public Methods
+    CompressedBVHAccel(std::vector<std::shared_ptr<Primitive>> p,
+                       int maxPrimsInNode, SplitMethod splitMethod);
+    ~CompressedBVHAccel();
+    Bounds3f WorldBound() const;
+    bool Intersect(const Ray &ray, SurfaceInteraction *isect) const;
+    bool IntersectP(const Ray &ray) const;
+
+  private:
+    // CompressedBVHAccel Private Methods
+    int compressBVHTree(int binaryNodeIndex, const Bounds3f &nodeBounds);
+
+    // CompressedBVHAccel Private Data
+    std::vector<CompressedBVHNode> compressedNodes;
+    Bounds3f worldBound;
+};
+
+// MotionBVHAccel Declarations
+class MotionBVHAccel : public BVHAccel {
+  public:
+    // MotionBVHAccel Public Methods
+    MotionBVHAccel(std::vector<std::shared_ptr<Primitive>> p,
+                   int maxPrimsInNode, SplitMethod splitMethod, Float time0,
+                   Float time1);
+    bool Intersect(const Ray &ray, SurfaceInteraction *isect) const;
+    bool IntersectP(const Ray &ray) const;
+
+  private:
+    // MotionBVHAccel Private Data
+    const Float time0, time1;
+    // Conservative per-node bounds at the two shutter endpoints, parallel
+    // to _nodes_; traversal interpolates between them by _ray.time_ rather
+    // than testing the union over the whole shutter.
+    std::vector<Bounds3f> startBounds, endBounds;
 };
 
 std::shared_ptr<BVHAccel> CreateBVHAccelerator(
@@ -35,11 +35,15 @@
 #include "accelerators/kdtreeaccel.h"
 #include "paramset.h"
 #include "interaction.h"
+#include "memory.h"
+#include "parallel.h"
 #include "stats.h"
 #include <algorithm>
 
 namespace pbrt {
 
+STAT_MEMORY_COUNTER("Memory/Kd-tree ropes", kdRopeBytes);
+
 // KdTreeAccel Local Declarations
 struct KdAccelNode {
     // KdAccelNode Methods
@@ -68,6 +72,19 @@ struct KdAccelNode {
     };
 };
 
+// KdLeafRopes holds the per-leaf state for stackless rope traversal: the
+// leaf's bounds and, for each of its six faces, the index of the node whose
+// region abuts that face (-1 for faces on the tree boundary). Faces are
+// numbered 2 * axis + side, where side 1 is the maximum face. Each record is
+// padded to a full 64-byte cache line, and records are laid out in the same
+// depth-first order as the nodes themselves, so records for leaves in the
+// same subtree share cache lines; the 8-byte _KdAccelNode_ is untouched.
+struct KdLeafRopes {
+    Bounds3f bounds;
+    int rope[6];
+    int pad[4];  // ensure 64 byte total size
+};
+
 enum class EdgeType { Start, End };
 struct BoundEdge {
     // BoundEdge Public Methods
@@ -80,15 +97,121 @@ struct BoundEdge {
     EdgeType type;
 };
 
+// Subtrees with at least this many primitives build their children as
+// parallel tasks.
+static PBRT_CONSTEXPR int kdParallelTaskThreshold = 64 * 1024;
+
+// KdBuildNode is the intermediate representation used by the parallel build;
+// the finished tree is flattened into the usual _KdAccelNode_ array
+// afterwards. A node is a leaf iff _belowChild_ is nullptr.
+struct KdBuildNode {
+    void InitLeaf(const int *prims, int np, MemoryArena &arena) {
+        belowChild = aboveChild = nullptr;
+        nPrimitives = np;
+        primNums = arena.Alloc<int>(np, false);
+        for (int i = 0; i < np; ++i) primNums[i] = prims[i];
+    }
+    void InitInterior(int axis, Float split, KdBuildNode *below,
+                      KdBuildNode *above) {
+        splitAxis = axis;
+        tSplit = split;
+        belowChild = below;
+        aboveChild = above;
+    }
+    KdBuildNode *belowChild, *aboveChild;
+    int splitAxis;
+    Float tSplit;
+    int nPrimitives;
+    int *primNums;
+};
+
+// Select the SAH split for a node, starting with the largest-extent axis and
+// falling back to the other two; this is the split-selection logic that was
+// previously inline in KdTreeAccel::buildTree(). On return the edge array
+// for _*bestAxis_ is sorted; returns false if no candidate split was found.
+static bool ChooseKdTreeSplit(const Bounds3f &nodeBounds,
+                              const std::vector<Bounds3f> &allPrimBounds,
+                              const int *primNums, int nPrimitives,
+                              int isectCost, int traversalCost,
+                              Float emptyBonus, BoundEdge *const edges[3],
+                              int *bestAxisOut, int *bestOffsetOut,
+                              Float *bestCostOut) {
+    int bestAxis = -1, bestOffset = -1;
+    Float bestCost = Infinity;
+    Float invTotalSA = 1 / nodeBounds.SurfaceArea();
+    Vector3f d = nodeBounds.pMax - nodeBounds.pMin;
+    int axis = nodeBounds.MaximumExtent();
+    for (int retries = 0; retries < 3 && bestAxis == -1; ++retries) {
+        // Initialize edges for _axis_
+        for (int i = 0; i < nPrimitives; ++i) {
+            int pn = primNums[i];
+            const Bounds3f &bounds = allPrimBounds[pn];
+            edges[axis][2 * i] = BoundEdge(bounds.pMin[axis], pn, true);
+            edges[axis][2 * i + 1] = BoundEdge(bounds.pMax[axis], pn, false);
+        }
+
+        // Sort _edges_ for _axis_
+        std::sort(&edges[axis][0], &edges[axis][2 * nPrimitives],
+                  [](const BoundEdge &e0, const BoundEdge &e1) -> bool {
+                      if (e0.t == e1.t)
+                          return (int)e0.type < (int)e1.type;
+                      else
+                          return e0.t < e1.t;
+                  });
+
+        // Compute cost of all splits for _axis_ to find best
+        int nBelow = 0, nAbove = nPrimitives;
+        for (int i = 0; i < 2 * nPrimitives; ++i) {
+            if (edges[axis][i].type == EdgeType::End) --nAbove;
+            Float edgeT = edges[axis][i].t;
+            if (edgeT > nodeBounds.pMin[axis] &&
+                edgeT < nodeBounds.pMax[axis]) {
+                // Compute cost for split at _i_th edge
+
+                // Compute child surface areas for split at _edgeT_
+                int otherAxis0 = (axis + 1) % 3, otherAxis1 = (axis + 2) % 3;
+                Float belowSA = 2 * (d[otherAxis0] * d[otherAxis1] +
+                                     (edgeT - nodeBounds.pMin[axis]) *
+                                         (d[otherAxis0] + d[otherAxis1]));
+                Float aboveSA = 2 * (d[otherAxis0] * d[otherAxis1] +
+                                     (nodeBounds.pMax[axis] - edgeT) *
+                                         (d[otherAxis0] + d[otherAxis1]));
+                Float pBelow = belowSA * invTotalSA;
+                Float pAbove = aboveSA * invTotalSA;
+                Float eb = (nAbove == 0 || nBelow == 0) ? emptyBonus : 0;
+                Float cost =
+                    traversalCost +
+                    isectCost * (1 - eb) * (pBelow * nBelow + pAbove * nAbove);
+
+                // Update best split if this is lowest cost so far
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestOffset = i;
+                }
+            }
+            if (edges[axis][i].type == EdgeType::Start) ++nBelow;
+        }
+        CHECK(nBelow == nPrimitives && nAbove == 0);
+        axis = (axis + 1) % 3;
+    }
+    *bestAxisOut = bestAxis;
+    *bestOffsetOut = bestOffset;
+    *bestCostOut = bestCost;
+    return bestAxis != -1;
+}
+
 // KdTreeAccel Method Definitions
 KdTreeAccel::KdTreeAccel(std::vector<std::shared_ptr<Primitive>> p,
                          int isectCost, int traversalCost, Float emptyBonus,
-                         int maxPrims, int maxDepth)
+                         int maxPrims, int maxDepth, bool stackless)
     : isectCost(isectCost),
       traversalCost(traversalCost),
       maxPrims(maxPrims),
       emptyBonus(emptyBonus),
-      primitives(std::move(p)) {
+      primitives(std::move(p)),
+      ropes(nullptr),
+      nRopes(0) {
     // Build kd-tree for accelerator
     ProfilePhase _(Prof::AccelConstruction);
     nextFreeNode = nAllocedNodes = 0;
@@ -104,6 +227,32 @@ KdTreeAccel::KdTreeAccel(std::vector<std::shared_ptr<Primitive>> p,
         primBounds.push_back(b);
     }
 
+    // Initialize _primNums_ for kd-tree construction
+    std::unique_ptr<int[]> primNums(new int[primitives.size()]);
+    for (size_t i = 0; i < primitives.size(); ++i) primNums[i] = i;
+
+    if (primitives.size() >= 2 * kdParallelTaskThreshold &&
+        MaxThreadIndex() > 1) {
+        // Build large trees with the task-parallel path and flatten the
+        // result into the node array
+        std::vector<std::unique_ptr<MemoryArena>> threadArenas;
+        for (int i = 0; i < MaxThreadIndex(); ++i)
+            threadArenas.push_back(
+                std::unique_ptr<MemoryArena>(
+                    new MemoryArena(LargeArenaBlockSize)));
+        std::atomic<int> totalNodes(0);
+        KdBuildNode *root =
+            parallelBuildTree(threadArenas, bounds, primBounds,
+                              primNums.get(), primitives.size(), maxDepth, 0,
+                              &totalNodes);
+        nAllocedNodes = totalNodes;
+        nodes = AllocAligned<KdAccelNode>(nAllocedNodes);
+        flattenKdTree(root);
+        CHECK_EQ(nextFreeNode, (int)totalNodes);
+        if (stackless) initRopes();
+        return;
+    }
+
     // Allocate working memory for kd-tree construction
     std::unique_ptr<BoundEdge[]> edges[3];
     for (int i = 0; i < 3; ++i)
@@ -111,13 +260,10 @@ KdTreeAccel::KdTreeAccel(std::vector<std::shared_ptr<Primitive>> p,
     std::unique_ptr<int[]> prims0(new int[primitives.size()]);
     std::unique_ptr<int[]> prims1(new int[(maxDepth + 1) * primitives.size()]);
 
-    // Initialize _primNums_ for kd-tree construction
-    std::unique_ptr<int[]> primNums(new int[primitives.size()]);
-    for (size_t i = 0; i < primitives.size(); ++i) primNums[i] = i;
-
     // Start recursive construction of kd-tree
     buildTree(0, bounds, primBounds, primNums.get(), primitives.size(),
               maxDepth, edges, prims0.get(), prims1.get());
+    if (stackless) initRopes();
 }
 
 void KdAccelNode::InitLeaf(int *primNums, int np,
@@ -135,7 +281,10 @@ void KdAccelNode::InitLeaf(int *primNums, int np,
     }
 }
 
-KdTreeAccel::~KdTreeAccel() { FreeAligned(nodes); }
+KdTreeAccel::~KdTreeAccel() {
+    FreeAligned(nodes);
+    FreeAligned(ropes);
+}
 
 void KdTreeAccel::buildTree(int nodeNum, const Bounds3f &nodeBounds,
                             const std::vector<Bounds3f> &allPrimBounds,
@@ -165,75 +314,16 @@ void KdTreeAccel::buildTree(int nodeNum, const Bounds3f &nodeBounds,
     // Initialize interior node and continue recursion
 
     // Choose split axis position for interior node
-    int bestAxis = -1, bestOffset = -1;
-    Float bestCost = Infinity;
+    int bestAxis, bestOffset;
+    Float bestCost;
     Float oldCost = isectCost * Float(nPrimitives);
-    Float totalSA = nodeBounds.SurfaceArea();
-    Float invTotalSA = 1 / totalSA;
-    Vector3f d = nodeBounds.pMax - nodeBounds.pMin;
-
-    // Choose which axis to split along
-    int axis = nodeBounds.MaximumExtent();
-    int retries = 0;
-retrySplit:
-
-    // Initialize edges for _axis_
-    for (int i = 0; i < nPrimitives; ++i) {
-        int pn = primNums[i];
-        const Bounds3f &bounds = allPrimBounds[pn];
-        edges[axis][2 * i] = BoundEdge(bounds.pMin[axis], pn, true);
-        edges[axis][2 * i + 1] = BoundEdge(bounds.pMax[axis], pn, false);
-    }
-
-    // Sort _edges_ for _axis_
-    std::sort(&edges[axis][0], &edges[axis][2 * nPrimitives],
-              [](const BoundEdge &e0, const BoundEdge &e1) -> bool {
-                  if (e0.t == e1.t)
-                      return (int)e0.type < (int)e1.type;
-                  else
-                      return e0.t < e1.t;
-              });
-
-    // Compute cost of all splits for _axis_ to find best
-    int nBelow = 0, nAbove = nPrimitives;
-    for (int i = 0; i < 2 * nPrimitives; ++i) {
-        if (edges[axis][i].type == EdgeType::End) --nAbove;
-        Float edgeT = edges[axis][i].t;
-        if (edgeT > nodeBounds.pMin[axis] && edgeT < nodeBounds.pMax[axis]) {
-            // Compute cost for split at _i_th edge
-
-            // Compute child surface areas for split at _edgeT_
-            int otherAxis0 = (axis + 1) % 3, otherAxis1 = (axis + 2) % 3;
-            Float belowSA = 2 * (d[otherAxis0] * d[otherAxis1] +
-                                 (edgeT - nodeBounds.pMin[axis]) *
-                                     (d[otherAxis0] + d[otherAxis1]));
-            Float aboveSA = 2 * (d[otherAxis0] * d[otherAxis1] +
-                                 (nodeBounds.pMax[axis] - edgeT) *
-                                     (d[otherAxis0] + d[otherAxis1]));
-            Float pBelow = belowSA * invTotalSA;
-            Float pAbove = aboveSA * invTotalSA;
-            Float eb = (nAbove == 0 || nBelow == 0) ? emptyBonus : 0;
-            Float cost =
-                traversalCost +
-                isectCost * (1 - eb) * (pBelow * nBelow + pAbove * nAbove);
-
-            // Update best split if this is lowest cost so far
-            if (cost < bestCost) {
-                bestCost = cost;
-                bestAxis = axis;
-                bestOffset = i;
-            }
-        }
-        if (edges[axis][i].type == EdgeType::Start) ++nBelow;
-    }
-    CHECK(nBelow == nPrimitives && nAbove == 0);
+    BoundEdge *const rawEdges[3] = {edges[0].get(), edges[1].get(),
+                                    edges[2].get()};
+    ChooseKdTreeSplit(nodeBounds, allPrimBounds, primNums, nPrimitives,
+                      isectCost, traversalCost, emptyBonus, rawEdges,
+                      &bestAxis, &bestOffset, &bestCost);
 
     // Create leaf if no good splits were found
-    if (bestAxis == -1 && retries < 2) {
-        ++retries;
-        axis = (axis + 1) % 3;
-        goto retrySplit;
-    }
     if (bestCost > oldCost) ++badRefines;
     if ((bestCost > 4 * oldCost && nPrimitives < 16) || bestAxis == -1 ||
         badRefines == 3) {
@@ -262,6 +352,172 @@ retrySplit:
               prims0, prims1 + nPrimitives, badRefines);
 }
 
+// Parallel kd-tree build: the same SAH construction as buildTree(), but
+// producing arena-allocated _KdBuildNode_s so the two children of a split
+// can be built as independent tasks; subtrees above
+// _kdParallelTaskThreshold_ primitives are task-spawned. Scratch edge and
+// primitive buffers are per call here (rather than shared and reused as in
+// the serial path), which is what makes the recursion safe to run
+// concurrently.
+KdBuildNode *KdTreeAccel::parallelBuildTree(
+    std::vector<std::unique_ptr<MemoryArena>> &threadArenas,
+    const Bounds3f &nodeBounds, const std::vector<Bounds3f> &allPrimBounds,
+    const int *primNums, int nPrimitives, int depth, int badRefines,
+    std::atomic<int> *totalNodes) {
+    MemoryArena &arena = *threadArenas[ThreadIndex];
+    KdBuildNode *node = arena.Alloc<KdBuildNode>();
+    ++*totalNodes;
+
+    // Initialize leaf node if termination criteria met
+    if (nPrimitives <= maxPrims || depth == 0) {
+        node->InitLeaf(primNums, nPrimitives, arena);
+        return node;
+    }
+
+    // Choose split axis position for interior node
+    std::vector<BoundEdge> edgeStorage(3 * 2 * nPrimitives);
+    BoundEdge *const edges[3] = {&edgeStorage[0],
+                                 &edgeStorage[2 * nPrimitives],
+                                 &edgeStorage[4 * nPrimitives]};
+    int bestAxis, bestOffset;
+    Float bestCost;
+    Float oldCost = isectCost * Float(nPrimitives);
+    ChooseKdTreeSplit(nodeBounds, allPrimBounds, primNums, nPrimitives,
+                      isectCost, traversalCost, emptyBonus, edges, &bestAxis,
+                      &bestOffset, &bestCost);
+
+    // Create leaf if no good splits were found
+    if (bestCost > oldCost) ++badRefines;
+    if ((bestCost > 4 * oldCost && nPrimitives < 16) || bestAxis == -1 ||
+        badRefines == 3) {
+        node->InitLeaf(primNums, nPrimitives, arena);
+        return node;
+    }
+
+    // Classify primitives with respect to split
+    std::vector<int> prims0, prims1;
+    for (int i = 0; i < bestOffset; ++i)
+        if (edges[bestAxis][i].type == EdgeType::Start)
+            prims0.push_back(edges[bestAxis][i].primNum);
+    for (int i = bestOffset + 1; i < 2 * nPrimitives; ++i)
+        if (edges[bestAxis][i].type == EdgeType::End)
+            prims1.push_back(edges[bestAxis][i].primNum);
+
+    // Grab the split position, the last thing needed from the edges, then
+    // release their storage before recursing so the working set doesn't
+    // accumulate down the tree.
+    Float tSplit = edges[bestAxis][bestOffset].t;
+    edgeStorage.resize(0);
+    edgeStorage.shrink_to_fit();
+
+    // Recursively initialize children nodes, in parallel for large subtrees
+    Bounds3f bounds0 = nodeBounds, bounds1 = nodeBounds;
+    bounds0.pMax[bestAxis] = bounds1.pMin[bestAxis] = tSplit;
+    KdBuildNode *children[2];
+    if (nPrimitives >= kdParallelTaskThreshold) {
+        ParallelFor(
+            [&](int c) {
+                const std::vector<int> &prims = (c == 0) ? prims0 : prims1;
+                children[c] = parallelBuildTree(
+                    threadArenas, (c == 0) ? bounds0 : bounds1, allPrimBounds,
+                    prims.data(), prims.size(), depth - 1, badRefines,
+                    totalNodes);
+            },
+            2);
+    } else {
+        children[0] =
+            parallelBuildTree(threadArenas, bounds0, allPrimBounds,
+                              prims0.data(), prims0.size(), depth - 1,
+                              badRefines, totalNodes);
+        children[1] =
+            parallelBuildTree(threadArenas, bounds1, allPrimBounds,
+                              prims1.data(), prims1.size(), depth - 1,
+                              badRefines, totalNodes);
+    }
+    node->InitInterior(bestAxis, tSplit, children[0], children[1]);
+    return node;
+}
+
+// Flatten the build tree into the contiguous _KdAccelNode_ array, preserving
+// the "below child follows its parent" layout the traversal relies on.
+int KdTreeAccel::flattenKdTree(const KdBuildNode *buildNode) {
+    CHECK_LT(nextFreeNode, nAllocedNodes);
+    int nodeNum = nextFreeNode++;
+    if (!buildNode->belowChild) {
+        nodes[nodeNum].InitLeaf(buildNode->primNums, buildNode->nPrimitives,
+                                &primitiveIndices);
+    } else {
+        flattenKdTree(buildNode->belowChild);
+        int aboveChild = flattenKdTree(buildNode->aboveChild);
+        nodes[nodeNum].InitInterior(buildNode->splitAxis, aboveChild,
+                                    buildNode->tSplit);
+    }
+    return nodeNum;
+}
+
+// Build the per-leaf rope table used by stackless traversal: each leaf
+// records, for each of its six faces, the smallest node that fully covers
+// the neighboring region, so traversal can step through a leaf's exit face
+// directly instead of unwinding a stack.
+void KdTreeAccel::initRopes() {
+    leafRopeIndex.assign(nextFreeNode, -1);
+    int nLeaves = 0;
+    for (int i = 0; i < nextFreeNode; ++i)
+        if (nodes[i].IsLeaf()) ++nLeaves;
+    ropes = AllocAligned<KdLeafRopes>(nLeaves);
+    int initial[6] = {-1, -1, -1, -1, -1, -1};
+    buildRopes(0, bounds, initial);
+    CHECK_EQ(nRopes, nLeaves);
+    kdRopeBytes += nLeaves * sizeof(KdLeafRopes) +
+                   leafRopeIndex.size() * sizeof(int);
+}
+
+void KdTreeAccel::buildRopes(int nodeNum, const Bounds3f &nodeBounds,
+                             const int inherited[6]) {
+    // Push each inherited rope down past interior nodes that don't straddle
+    // the corresponding face, so leaves link to the tightest neighbor.
+    int rope[6];
+    for (int f = 0; f < 6; ++f) {
+        int r = inherited[f];
+        int faceAxis = f >> 1;
+        while (r >= 0 && !nodes[r].IsLeaf()) {
+            int axis = nodes[r].SplitAxis();
+            if (axis == faceAxis)
+                // Take the neighbor's half adjacent to the face: its above
+                // child for our minimum face, its below child for our
+                // maximum one
+                r = (f & 1) ? r + 1 : nodes[r].AboveChild();
+            else if (nodes[r].SplitPos() <= nodeBounds.pMin[axis])
+                r = nodes[r].AboveChild();
+            else if (nodes[r].SplitPos() >= nodeBounds.pMax[axis])
+                r = r + 1;
+            else
+                break;
+        }
+        rope[f] = r;
+    }
+    if (nodes[nodeNum].IsLeaf()) {
+        leafRopeIndex[nodeNum] = nRopes;
+        KdLeafRopes &lr = ropes[nRopes++];
+        lr.bounds = nodeBounds;
+        for (int f = 0; f < 6; ++f) lr.rope[f] = rope[f];
+        return;
+    }
+
+    // Recurse into the children; each gains a rope to its sibling through
+    // the splitting plane
+    int axis = nodes[nodeNum].SplitAxis();
+    Float tSplit = nodes[nodeNum].SplitPos();
+    Bounds3f bounds0 = nodeBounds, bounds1 = nodeBounds;
+    bounds0.pMax[axis] = bounds1.pMin[axis] = tSplit;
+    int ropeBelow[6], ropeAbove[6];
+    for (int f = 0; f < 6; ++f) ropeBelow[f] = ropeAbove[f] = rope[f];
+    ropeBelow[2 * axis + 1] = nodes[nodeNum].AboveChild();
+    ropeAbove[2 * axis] = nodeNum + 1;
+    buildRopes(nodeNum + 1, bounds0, ropeBelow);
+    buildRopes(nodes[nodeNum].AboveChild(), bounds1, ropeAbove);
+}
+
 bool KdTreeAccel::Intersect(const Ray &ray, SurfaceInteraction *isect) const {
     ProfilePhase p(Prof::AccelIntersect);
     // Compute initial parametric range of ray inside kd-tree extent
@@ -269,6 +525,7 @@ bool KdTreeAccel::Intersect(const Ray &ray, SurfaceInteraction *isect) const {
     if (!bounds.IntersectP(ray, &tMin, &tMax)) {
         return false;
     }
+    if (ropes) return ropeIntersect(ray, isect, tMin, tMax);
 
     // Prepare to traverse kd-tree for ray
     Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
@@ -354,6 +611,7 @@ bool KdTreeAccel::IntersectP(const Ray &ray) const {
     if (!bounds.IntersectP(ray, &tMin, &tMax)) {
         return false;
     }
+    if (ropes) return ropeIntersectP(ray, tMin, tMax);
 
     // Prepare to traverse kd-tree for ray
     Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
@@ -430,6 +688,126 @@ bool KdTreeAccel::IntersectP(const Ray &ray) const {
     return false;
 }
 
+// Stackless traversal with ropes: descend to the leaf containing the ray at
+// its current parametric position, test its primitives, then follow the rope
+// through the leaf's exit face and repeat. No _KdToDo_ stack is read or
+// written.
+bool KdTreeAccel::ropeIntersect(const Ray &ray, SurfaceInteraction *isect,
+                                Float tMin, Float tMax) const {
+    Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+    bool hit = false;
+    Float t = tMin;
+    int nodeNum = 0;
+    while (true) {
+        // Bail out if we found a hit closer than the current leaf
+        if (ray.tMax < t) break;
+
+        // Descend to the leaf containing the ray at parameter _t_
+        Point3f p = ray.o + t * ray.d;
+        while (!nodes[nodeNum].IsLeaf()) {
+            int axis = nodes[nodeNum].SplitAxis();
+            int below = (p[axis] < nodes[nodeNum].SplitPos()) ||
+                        (p[axis] == nodes[nodeNum].SplitPos() &&
+                         ray.d[axis] <= 0);
+            nodeNum = below ? nodeNum + 1 : nodes[nodeNum].AboveChild();
+        }
+        const KdAccelNode *node = &nodes[nodeNum];
+
+        // Check for intersections inside leaf node
+        int nPrimitives = node->nPrimitives();
+        if (nPrimitives == 1) {
+            const std::shared_ptr<Primitive> &p =
+                primitives[node->onePrimitive];
+            // Check one primitive inside leaf node
+            if (p->Intersect(ray, isect)) hit = true;
+        } else {
+            for (int i = 0; i < nPrimitives; ++i) {
+                int index =
+                    primitiveIndices[node->primitiveIndicesOffset + i];
+                const std::shared_ptr<Primitive> &p = primitives[index];
+                // Check one primitive inside leaf node
+                if (p->Intersect(ray, isect)) hit = true;
+            }
+        }
+
+        // Step through the leaf's exit face to the neighboring node
+        const KdLeafRopes &lr = ropes[leafRopeIndex[nodeNum]];
+        Float tExit = tMax;
+        int exitFace = -1;
+        for (int axis = 0; axis < 3; ++axis) {
+            if (ray.d[axis] == 0) continue;
+            Float tFar = ((ray.d[axis] > 0 ? lr.bounds.pMax[axis]
+                                           : lr.bounds.pMin[axis]) -
+                          ray.o[axis]) *
+                         invDir[axis];
+            if (tFar < tExit) {
+                tExit = tFar;
+                exitFace = 2 * axis + (ray.d[axis] > 0 ? 1 : 0);
+            }
+        }
+        // A missing rope or an exit at or past _tMax_ leaves the tree
+        if (exitFace == -1 || lr.rope[exitFace] < 0) break;
+        nodeNum = lr.rope[exitFace];
+        t = tExit;
+    }
+    return hit;
+}
+
+bool KdTreeAccel::ropeIntersectP(const Ray &ray, Float tMin, Float tMax) const {
+    Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+    Float t = tMin;
+    int nodeNum = 0;
+    while (true) {
+        // Descend to the leaf containing the ray at parameter _t_
+        Point3f p = ray.o + t * ray.d;
+        while (!nodes[nodeNum].IsLeaf()) {
+            int axis = nodes[nodeNum].SplitAxis();
+            int below = (p[axis] < nodes[nodeNum].SplitPos()) ||
+                        (p[axis] == nodes[nodeNum].SplitPos() &&
+                         ray.d[axis] <= 0);
+            nodeNum = below ? nodeNum + 1 : nodes[nodeNum].AboveChild();
+        }
+        const KdAccelNode *node = &nodes[nodeNum];
+
+        // Check for shadow ray intersections inside leaf node
+        int nPrimitives = node->nPrimitives();
+        if (nPrimitives == 1) {
+            const std::shared_ptr<Primitive> &p =
+                primitives[node->onePrimitive];
+            if (p->IntersectP(ray)) return true;
+        } else {
+            for (int i = 0; i < nPrimitives; ++i) {
+                int primitiveIndex =
+                    primitiveIndices[node->primitiveIndicesOffset + i];
+                const std::shared_ptr<Primitive> &prim =
+                    primitives[primitiveIndex];
+                if (prim->IntersectP(ray)) return true;
+            }
+        }
+
+        // Step through the leaf's exit face to the neighboring node
+        const KdLeafRopes &lr = ropes[leafRopeIndex[nodeNum]];
+        Float tExit = tMax;
+        int exitFace = -1;
+        for (int axis = 0; axis < 3; ++axis) {
+            if (ray.d[axis] == 0) continue;
+            Float tFar = ((ray.d[axis] > 0 ? lr.bounds.pMax[axis]
+                                           : lr.bounds.pMin[axis]) -
+                          ray.o[axis]) *
+                         invDir[axis];
+            if (tFar < tExit) {
+                tExit = tFar;
+                exitFace = 2 * axis + (ray.d[axis] > 0 ? 1 : 0);
+            }
+        }
+        // A missing rope or an exit at or past _tMax_ leaves the tree
+        if (exitFace == -1 || lr.rope[exitFace] < 0) break;
+        nodeNum = lr.rope[exitFace];
+        t = tExit;
+    }
+    return false;
+}
+
 std::shared_ptr<KdTreeAccel> CreateKdTreeAccelerator(
     std::vector<std::shared_ptr<Primitive>> prims, const ParamSet &ps) {
     int isectCost = ps.FindOneInt("intersectcost", 80);
@@ -437,8 +815,9 @@ std::shared_ptr<KdTreeAccel> CreateKdTreeAccelerator(
     Float emptyBonus = ps.FindOneFloat("emptybonus", 0.5f);
     int maxPrims = ps.FindOneInt("maxprims", 1);
     int maxDepth = ps.FindOneInt("maxdepth", -1);
+    bool stackless = ps.FindOneBool("stackless", false);
     return std::make_shared<KdTreeAccel>(std::move(prims), isectCost, travCost, emptyBonus,
-                                         maxPrims, maxDepth);
+                                         maxPrims, maxDepth, stackless);
 }
 
 }  // namespace pbrt
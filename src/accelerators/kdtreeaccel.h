@@ -41,22 +41,30 @@
 // accelerators/kdtreeaccel.h*
 #include "pbrt.h"
 #include "primitive.h"
+#include <atomic>
 
 namespace pbrt {
 
 // KdTreeAccel Declarations
 struct KdAccelNode;
+struct KdBuildNode;
+struct KdLeafRopes;
 struct BoundEdge;
 class KdTreeAccel : public Aggregate {
   public:
     // KdTreeAccel Public Methods
     KdTreeAccel(std::vector<std::shared_ptr<Primitive>> p,
                 int isectCost = 80, int traversalCost = 1,
-                Float emptyBonus = 0.5, int maxPrims = 1, int maxDepth = -1);
+                Float emptyBonus = 0.5, int maxPrims = 1, int maxDepth = -1,
+                bool stackless = false);
     Bounds3f WorldBound() const { return bounds; }
     ~KdTreeAccel();
     bool Intersect(const Ray &ray, SurfaceInteraction *isect) const;
     bool IntersectP(const Ray &ray) const;
+    void ForEachPrimitive(
+        const std::function<void(const Primitive &)> &callback) const {
+        for (const auto &p : primitives) p->ForEachPrimitive(callback);
+    }
 
   private:
     // KdTreeAccel Private Methods
@@ -65,6 +73,20 @@ class KdTreeAccel : public Aggregate {
                    int nprims, int depth,
                    const std::unique_ptr<BoundEdge[]> edges[3], int *prims0,
                    int *prims1, int badRefines = 0);
+    KdBuildNode *parallelBuildTree(
+        std::vector<std::unique_ptr<MemoryArena>> &threadArenas,
+        const Bounds3f &nodeBounds, const std::vector<Bounds3f> &primBounds,
+        const int *primNums, int nprims, int depth, int badRefines,
+        std::atomic<int> *totalNodes);
+    int flattenKdTree(const KdBuildNode *buildNode);
+    // Rope-based stackless traversal support; see KdLeafRopes in
+    // kdtreeaccel.cpp.
+    void initRopes();
+    void buildRopes(int nodeNum, const Bounds3f &nodeBounds,
+                    const int inherited[6]);
+    bool ropeIntersect(const Ray &ray, SurfaceInteraction *isect, Float tMin,
+                       Float tMax) const;
+    bool ropeIntersectP(const Ray &ray, Float tMin, Float tMax) const;
 
     // KdTreeAccel Private Data
     const int isectCost, traversalCost, maxPrims;
@@ -74,6 +96,11 @@ class KdTreeAccel : public Aggregate {
     KdAccelNode *nodes;
     int nAllocedNodes, nextFreeNode;
     Bounds3f bounds;
+    // Per-leaf rope records, in node order; _leafRopeIndex_ maps a leaf's
+    // node index to its record. Empty unless built with _stackless_ set.
+    std::vector<int> leafRopeIndex;
+    KdLeafRopes *ropes;
+    int nRopes;
 };
 
 struct KdToDo {
@@ -0,0 +1,173 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+// bench/bench.cpp*
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include "parallel.h"
+#include "spectrum.h"
+#include "stringprint.h"
+
+#include <glog/logging.h>
+
+namespace pbrt {
+
+std::vector<BenchmarkInfo> *GetBenchmarks() {
+    // Allocated on first use so that registration from static
+    // initializers in other translation units is safe regardless of
+    // initialization order.
+    static std::vector<BenchmarkInfo> *benchmarks =
+        new std::vector<BenchmarkInfo>;
+    return benchmarks;
+}
+
+BenchmarkRegisterer::BenchmarkRegisterer(const std::string &name,
+                                         std::function<void(int64_t)> func) {
+    GetBenchmarks()->push_back(BenchmarkInfo{name, func});
+}
+
+struct BenchmarkResult {
+    std::string name;
+    int64_t iterations;
+    double nsPerOp;
+};
+
+// Run _b_, growing the iteration count until the timed region lasts at
+// least _minTime_ seconds, and return the timing of the final run.
+static BenchmarkResult RunBenchmark(const BenchmarkInfo &b, double minTime) {
+    using clock = std::chrono::high_resolution_clock;
+    int64_t iters = 1;
+    while (true) {
+        clock::time_point start = clock::now();
+        b.func(iters);
+        double elapsed =
+            std::chrono::duration<double>(clock::now() - start).count();
+        if (elapsed >= minTime)
+            return BenchmarkResult{b.name, iters, elapsed * 1e9 / iters};
+        // Grow toward the target time, at least doubling so that very
+        // short first runs converge quickly.
+        int64_t next = (elapsed > 0)
+                           ? (int64_t)(iters * 1.2 * minTime / elapsed)
+                           : 10 * iters;
+        iters = std::max(2 * iters, next);
+    }
+}
+
+}  // namespace pbrt
+
+static void usage() {
+    fprintf(stderr, R"(usage: pbrt_bench [<options>]
+Options:
+  --filter <substr>    Only run benchmarks whose name contains the given
+                       substring.
+  --json <filename>    Additionally write the results as JSON to the given
+                       file ("-" for standard output).
+  --list               Print the names of all registered benchmarks and exit.
+  --mintime <seconds>  Minimum measurement time per benchmark. Default: 0.5.
+)");
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    using namespace pbrt;
+    google::InitGoogleLogging(argv[0]);
+    FLAGS_stderrthreshold = 1;  // Warning and above.
+
+    std::string filter, jsonFile;
+    double minTime = 0.5;
+    bool listOnly = false;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--filter") || !strcmp(argv[i], "-filter")) {
+            if (i + 1 == argc) usage();
+            filter = argv[++i];
+        } else if (!strcmp(argv[i], "--json") || !strcmp(argv[i], "-json")) {
+            if (i + 1 == argc) usage();
+            jsonFile = argv[++i];
+        } else if (!strcmp(argv[i], "--list") || !strcmp(argv[i], "-list")) {
+            listOnly = true;
+        } else if (!strcmp(argv[i], "--mintime") ||
+                   !strcmp(argv[i], "-mintime")) {
+            if (i + 1 == argc) usage();
+            minTime = atof(argv[++i]);
+        } else
+            usage();
+    }
+
+    if (listOnly) {
+        for (const BenchmarkInfo &b : *GetBenchmarks())
+            printf("%s\n", b.name.c_str());
+        return 0;
+    }
+
+    // The benchmarked kernels run single threaded for stable timings, but
+    // their setup code (MIP map construction, BVH builds) may use
+    // ParallelFor().
+    SampledSpectrum::Init();
+    ParallelInit();
+
+    std::vector<BenchmarkResult> results;
+    for (const BenchmarkInfo &b : *GetBenchmarks()) {
+        if (b.name.find(filter) == std::string::npos) continue;
+        BenchmarkResult r = RunBenchmark(b, minTime);
+        printf("%-40s %12" PRId64 " iters %14.1f ns/op\n", r.name.c_str(),
+               r.iterations, r.nsPerOp);
+        fflush(stdout);
+        results.push_back(r);
+    }
+
+    if (!jsonFile.empty()) {
+        FILE *f = (jsonFile == "-") ? stdout : fopen(jsonFile.c_str(), "w");
+        if (!f) {
+            fprintf(stderr, "pbrt_bench: couldn't open \"%s\"\n",
+                    jsonFile.c_str());
+            ParallelCleanup();
+            return 1;
+        }
+        fprintf(f, "{\n  \"benchmarks\": [\n");
+        for (size_t i = 0; i < results.size(); ++i)
+            fprintf(f,
+                    "    { \"name\": \"%s\", \"iterations\": %" PRId64
+                    ", \"ns_per_op\": %.3f }%s\n",
+                    results[i].name.c_str(), results[i].iterations,
+                    results[i].nsPerOp, (i + 1 < results.size()) ? "," : "");
+        fprintf(f, "  ]\n}\n");
+        if (f != stdout) fclose(f);
+    }
+
+    ParallelCleanup();
+    return 0;
+}
@@ -0,0 +1,82 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_BENCH_BENCH_H
+#define PBRT_BENCH_BENCH_H
+
+// bench/bench.h*
+#include "pbrt.h"
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace pbrt {
+
+// Minimal microbenchmark harness for the pbrt_bench target. A benchmark
+// is a function that runs its kernel _iters_ times; the driver in
+// bench.cpp calibrates _iters_ so that each timed region is long enough
+// to measure reliably, and reports nanoseconds per iteration (as text
+// and, with --json, in a stable machine-readable form). Benchmarks are
+// registered at static initialization time with PBRT_BENCHMARK(), the
+// same pattern the statistics system uses for its per-file callbacks.
+
+struct BenchmarkInfo {
+    std::string name;
+    std::function<void(int64_t)> func;
+};
+
+std::vector<BenchmarkInfo> *GetBenchmarks();
+
+class BenchmarkRegisterer {
+  public:
+    BenchmarkRegisterer(const std::string &name,
+                        std::function<void(int64_t)> func);
+};
+
+#define PBRT_BENCHMARK(fn) \
+    static BenchmarkRegisterer benchReg_##fn(#fn, fn)
+
+// Keep _value_ (and the computation that produced it) alive so that the
+// compiler can't optimize the benchmarked expression away.
+template <typename T>
+inline void BenchUse(const T &value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+}  // namespace pbrt
+
+#endif  // PBRT_BENCH_BENCH_H
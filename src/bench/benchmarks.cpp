@@ -0,0 +1,300 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+// bench/benchmarks.cpp*
+#include "bench.h"
+#include <cmath>
+#include <vector>
+#include "accelerators/bvh.h"
+#include "media/grid.h"
+#include "mipmap.h"
+#include "primitive.h"
+#include "reflection.h"
+#include "rng.h"
+#include "samplers/random.h"
+#include "samplers/sobol.h"
+#include "sampling.h"
+#include "shape.h"
+#include "shapes/triangle.h"
+#include "spectrum.h"
+#include "transform.h"
+
+// Benchmarks for the proven hot kernels, run against canned inputs so
+// timings are comparable across runs and machines. All inputs are built
+// deterministically (fixed RNG seeds) the first time each benchmark runs.
+
+namespace pbrt {
+
+// A deterministic set of rays aimed from a sphere of the given radius
+// toward jittered points near the origin, cycled through by the
+// intersection benchmarks so the measured ray mix stays fixed.
+static std::vector<Ray> MakeBenchRays(int n, Float radius) {
+    RNG rng(3021);
+    std::vector<Ray> rays;
+    for (int i = 0; i < n; ++i) {
+        Vector3f from =
+            radius * UniformSampleSphere(
+                         Point2f(rng.UniformFloat(), rng.UniformFloat()));
+        Point3f target(rng.UniformFloat() - 0.5f, rng.UniformFloat() - 0.5f,
+                       rng.UniformFloat() - 0.5f);
+        rays.push_back(
+            Ray(Point3f(from.x, from.y, from.z),
+                Normalize(target - Point3f(from.x, from.y, from.z))));
+    }
+    return rays;
+}
+
+// BVHAccel::Intersect() over a cloud of small random triangles.
+static void BM_BVHIntersect(int64_t iters) {
+    static Transform identity;
+    static std::shared_ptr<BVHAccel> bvh = []() {
+        RNG rng(1989);
+        int nTriangles = 10000;
+        std::vector<int> indices;
+        std::vector<Point3f> p;
+        for (int i = 0; i < nTriangles; ++i) {
+            Point3f c(rng.UniformFloat() - 0.5f, rng.UniformFloat() - 0.5f,
+                      rng.UniformFloat() - 0.5f);
+            for (int j = 0; j < 3; ++j) {
+                indices.push_back(3 * i + j);
+                p.push_back(c + 0.02f * Vector3f(rng.UniformFloat(),
+                                                 rng.UniformFloat(),
+                                                 rng.UniformFloat()));
+            }
+        }
+        std::vector<std::shared_ptr<Shape>> tris = CreateTriangleMesh(
+            &identity, &identity, false, nTriangles, &indices[0],
+            (int)p.size(), &p[0], nullptr, nullptr, nullptr, nullptr, nullptr);
+        std::vector<std::shared_ptr<Primitive>> prims;
+        for (const auto &tri : tris)
+            prims.push_back(std::make_shared<GeometricPrimitive>(
+                tri, nullptr, nullptr, MediumInterface()));
+        return std::make_shared<BVHAccel>(std::move(prims), 4,
+                                          BVHAccel::SplitMethod::SAH);
+    }();
+    static std::vector<Ray> rays = MakeBenchRays(1024, 3.f);
+
+    SurfaceInteraction isect;
+    for (int64_t n = 0; n < iters; ++n) {
+        Ray r = rays[n % rays.size()];
+        bool hit = bvh->Intersect(r, &isect);
+        BenchUse(hit);
+    }
+}
+PBRT_BENCHMARK(BM_BVHIntersect);
+
+// Triangle::Intersect() against a single triangle, all rays hitting.
+static void BM_TriangleIntersect(int64_t iters) {
+    static Transform identity;
+    static std::shared_ptr<Shape> tri = []() {
+        const int indices[3] = {0, 1, 2};
+        const Point3f p[3] = {Point3f(-1, -1, 0), Point3f(1, -1, 0),
+                              Point3f(0, 1, 0)};
+        return CreateTriangleMesh(&identity, &identity, false, 1, indices, 3,
+                                  p, nullptr, nullptr, nullptr, nullptr,
+                                  nullptr)[0];
+    }();
+    static std::vector<Ray> rays = MakeBenchRays(1024, 3.f);
+
+    SurfaceInteraction isect;
+    for (int64_t n = 0; n < iters; ++n) {
+        Ray r = rays[n % rays.size()];
+        Float tHit;
+        bool hit = tri->Intersect(r, &tHit, &isect, false);
+        BenchUse(hit);
+    }
+}
+PBRT_BENCHMARK(BM_TriangleIntersect);
+
+// Shared MIP map for the texture filtering benchmarks: 512x512 procedural
+// RGB texture with the full pyramid resident.
+static MIPMap<RGBSpectrum> *BenchMIPMap() {
+    static MIPMap<RGBSpectrum> *mipmap = []() {
+        const int res = 512;
+        std::vector<RGBSpectrum> texels(res * res);
+        for (int t = 0; t < res; ++t)
+            for (int s = 0; s < res; ++s) {
+                Float rgb[3] = {Float(s) / res, Float(t) / res,
+                                Float((s ^ t) & 0xff) / 255.f};
+                texels[t * res + s] = RGBSpectrum::FromRGB(rgb);
+            }
+        return new MIPMap<RGBSpectrum>(Point2i(res, res), &texels[0]);
+    }();
+    return mipmap;
+}
+
+static std::vector<Point2f> MakeBenchLookupPoints(int n) {
+    RNG rng(6502);
+    std::vector<Point2f> st;
+    for (int i = 0; i < n; ++i)
+        st.push_back(Point2f(rng.UniformFloat(), rng.UniformFloat()));
+    return st;
+}
+
+// Trilinear MIPMap::Lookup() at a fixed filter width.
+static void BM_MIPMapLookupTrilinear(int64_t iters) {
+    MIPMap<RGBSpectrum> *mipmap = BenchMIPMap();
+    static std::vector<Point2f> st = MakeBenchLookupPoints(1024);
+    for (int64_t n = 0; n < iters; ++n) {
+        RGBSpectrum v = mipmap->Lookup(st[n % st.size()], 0.01f);
+        BenchUse(v);
+    }
+}
+PBRT_BENCHMARK(BM_MIPMapLookupTrilinear);
+
+// Anisotropic EWA MIPMap::Lookup() with a moderately eccentric footprint.
+static void BM_MIPMapLookupEWA(int64_t iters) {
+    MIPMap<RGBSpectrum> *mipmap = BenchMIPMap();
+    static std::vector<Point2f> st = MakeBenchLookupPoints(1024);
+    for (int64_t n = 0; n < iters; ++n) {
+        RGBSpectrum v = mipmap->Lookup(st[n % st.size()],
+                                       Vector2f(0.01f, 0.002f),
+                                       Vector2f(0.001f, 0.015f));
+        BenchUse(v);
+    }
+}
+PBRT_BENCHMARK(BM_MIPMapLookupEWA);
+
+// SobolSampler sample generation; each iteration generates eight 2D
+// sample dimensions and advances to the next sample vector.
+static void BM_SobolSampler(int64_t iters) {
+    static SobolSampler *sampler = []() {
+        SobolSampler *s = new SobolSampler(
+            1ll << 24, Bounds2i(Point2i(0, 0), Point2i(16, 16)));
+        s->StartPixel(Point2i(3, 7));
+        return s;
+    }();
+    for (int64_t n = 0; n < iters; ++n) {
+        for (int d = 0; d < 8; ++d) {
+            Point2f u = sampler->Get2D();
+            BenchUse(u);
+        }
+        if (!sampler->StartNextSample()) sampler->StartPixel(Point2i(3, 7));
+    }
+}
+PBRT_BENCHMARK(BM_SobolSampler);
+
+// FourierBSDF::f() against a synthetic measured-BSDF table, so the
+// benchmark doesn't depend on a .bsdf file being available on disk. The
+// table has the same shape as a real one (16 zenith angle cosines, eight
+// Fourier orders, one channel); only the coefficient values are made up.
+static FourierBSDFTable *MakeSyntheticFourierTable() {
+    FourierBSDFTable *t = new FourierBSDFTable;
+    t->eta = 1.5f;
+    t->mMax = 8;
+    t->nChannels = 1;
+    t->nMu = 16;
+    t->mu = new Float[t->nMu];
+    for (int i = 0; i < t->nMu; ++i)
+        t->mu[i] = -1 + 2 * Float(i) / (t->nMu - 1);
+    int nPairs = t->nMu * t->nMu;
+    t->m = new int[nPairs];
+    t->aOffset = new int[nPairs];
+    t->a = new Float[nPairs * t->mMax];
+    t->a0 = new Float[nPairs];
+    t->cdf = new Float[nPairs];
+    t->recip = new Float[t->mMax];
+    for (int k = 0; k < t->mMax; ++k)
+        t->recip[k] = k > 0 ? 1 / Float(k) : 0;
+    for (int i = 0; i < nPairs; ++i) {
+        t->m[i] = t->mMax;
+        t->aOffset[i] = i * t->mMax;
+        for (int k = 0; k < t->mMax; ++k)
+            t->a[i * t->mMax + k] =
+                (k == 0) ? 0.25f : 0.25f / ((k + 1) * (k + 1));
+        t->a0[i] = t->a[i * t->mMax];
+        t->cdf[i] = 0;
+    }
+    return t;
+}
+
+static void BM_FourierBSDFf(int64_t iters) {
+    static FourierBSDFTable *table = MakeSyntheticFourierTable();
+    static FourierBSDF bsdf(*table, TransportMode::Radiance);
+    static std::vector<Vector3f> dirs = []() {
+        RNG rng(1879);
+        std::vector<Vector3f> d;
+        for (int i = 0; i < 512; ++i) {
+            Vector3f w = UniformSampleSphere(
+                Point2f(rng.UniformFloat(), rng.UniformFloat()));
+            // Keep directions away from the horizon, where f() returns
+            // early and would skew the timing.
+            if (std::abs(w.z) < 0.1f) w.z = std::copysign(0.1f, w.z);
+            d.push_back(Normalize(w));
+        }
+        return d;
+    }();
+    for (int64_t n = 0; n < iters; ++n) {
+        const Vector3f &wo = dirs[n % dirs.size()];
+        const Vector3f &wi = dirs[(n + 257) % dirs.size()];
+        Spectrum f = bsdf.f(wo, wi);
+        BenchUse(f);
+    }
+}
+PBRT_BENCHMARK(BM_FourierBSDFf);
+
+// GridDensityMedium::Tr() through a 64^3 procedural density, using ratio
+// tracking with a fixed-seed sampler.
+static void BM_GridMediumTr(int64_t iters) {
+    static GridDensityMedium *medium = []() {
+        const int res = 64;
+        std::vector<Float> d(res * res * res);
+        for (int z = 0; z < res; ++z)
+            for (int y = 0; y < res; ++y)
+                for (int x = 0; x < res; ++x)
+                    d[(z * res + y) * res + x] =
+                        0.5f + 0.5f * std::sin(0.2f * x) * std::sin(0.3f * y) *
+                                   std::sin(0.15f * z);
+        return new GridDensityMedium(Spectrum(0.3f), Spectrum(0.7f), 0.f, res,
+                                     res, res, Transform(), &d[0]);
+    }();
+    static RandomSampler sampler(1, 1337);
+    static std::vector<Ray> rays = []() {
+        RNG rng(4004);
+        std::vector<Ray> r;
+        for (int i = 0; i < 256; ++i) {
+            Point3f o(rng.UniformFloat(), rng.UniformFloat(), -0.5f);
+            Vector3f dir = Normalize(Vector3f(0.2f * rng.UniformFloat() - 0.1f,
+                                              0.2f * rng.UniformFloat() - 0.1f,
+                                              1.f));
+            r.push_back(Ray(o, dir, 2.f));
+        }
+        return r;
+    }();
+    for (int64_t n = 0; n < iters; ++n) {
+        Spectrum tr = medium->Tr(rays[n % rays.size()], sampler);
+        BenchUse(tr);
+    }
+}
+PBRT_BENCHMARK(BM_GridMediumTr);
+
+}  // namespace pbrt
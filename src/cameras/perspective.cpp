@@ -39,6 +39,11 @@
 #include "light.h"
 #include "stats.h"
 
+#if defined(__AVX__) && !defined(PBRT_FLOAT_AS_DOUBLE)
+#include <immintrin.h>
+#define PBRT_PERSPECTIVE_HAVE_AVX
+#endif
+
 namespace pbrt {
 
 // PerspectiveCamera Method Definitions
@@ -143,6 +148,138 @@ Float PerspectiveCamera::GenerateRayDifferential(const CameraSample &sample,
     return 1;
 }
 
+void PerspectiveCamera::GenerateRaysN(const CameraSample *samples, int n,
+                                      RayDifferential *rays,
+                                      Float *weights) const {
+    ProfilePhase prof(Prof::GenerateCameraRay);
+    int i = 0;
+#if defined(PBRT_PERSPECTIVE_HAVE_AVX)
+    // Set up eight camera rays at a time: the raster-to-camera transform,
+    // focus and lens adjustments, and the differential setup are the same
+    // arithmetic for every sample, so they map directly onto 8-wide
+    // lanes.  Taking the finished rays to world space is left to the
+    // scalar _AnimatedTransform_ path at the end of the loop body.
+    const Matrix4x4 &rtc = RasterToCamera.GetMatrix();
+    auto normalize = [](__m256 *x, __m256 *y, __m256 *z) {
+        __m256 len = _mm256_sqrt_ps(_mm256_add_ps(
+            _mm256_add_ps(_mm256_mul_ps(*x, *x), _mm256_mul_ps(*y, *y)),
+            _mm256_mul_ps(*z, *z)));
+        *x = _mm256_div_ps(*x, len);
+        *y = _mm256_div_ps(*y, len);
+        *z = _mm256_div_ps(*z, len);
+    };
+    for (; i + 8 <= n; i += 8) {
+        // Gather film positions, times, and (if needed) lens samples
+        float fx[8], fy[8], lensX[8], lensY[8], tSample[8];
+        for (int j = 0; j < 8; ++j) {
+            fx[j] = samples[i + j].pFilm.x;
+            fy[j] = samples[i + j].pFilm.y;
+            tSample[j] = samples[i + j].time;
+            if (lensRadius > 0) {
+                Point2f pLens =
+                    lensRadius * ConcentricSampleDisk(samples[i + j].pLens);
+                lensX[j] = pLens.x;
+                lensY[j] = pLens.y;
+            } else
+                lensX[j] = lensY[j] = 0;
+        }
+
+        // Apply _RasterToCamera_ to the film points, including the
+        // perspective divide
+        __m256 x = _mm256_loadu_ps(fx), y = _mm256_loadu_ps(fy);
+        auto xform = [&](int row) {
+            return _mm256_add_ps(
+                _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(rtc.m[row][0]), x),
+                              _mm256_mul_ps(_mm256_set1_ps(rtc.m[row][1]), y)),
+                _mm256_set1_ps(rtc.m[row][3]));
+        };
+        __m256 invW = _mm256_div_ps(_mm256_set1_ps(1.f), xform(3));
+        __m256 pcx = _mm256_mul_ps(xform(0), invW);
+        __m256 pcy = _mm256_mul_ps(xform(1), invW);
+        __m256 pcz = _mm256_mul_ps(xform(2), invW);
+        __m256 dx = pcx, dy = pcy, dz = pcz;
+        normalize(&dx, &dy, &dz);
+
+        __m256 ox = _mm256_setzero_ps(), oy = _mm256_setzero_ps();
+        __m256 rxdx, rxdy, rxdz, rydx, rydy, rydz;
+        if (lensRadius > 0) {
+            // Refocus the rays and their differentials through the
+            // sampled lens points
+            ox = _mm256_loadu_ps(lensX);
+            oy = _mm256_loadu_ps(lensY);
+            __m256 fd = _mm256_set1_ps(focalDistance);
+            __m256 ft = _mm256_div_ps(fd, dz);
+            dx = _mm256_sub_ps(_mm256_mul_ps(ft, dx), ox);
+            dy = _mm256_sub_ps(_mm256_mul_ps(ft, dy), oy);
+            dz = _mm256_mul_ps(ft, dz);
+            normalize(&dx, &dy, &dz);
+            auto focusDiff = [&](const Vector3f &dCamera, __m256 *rdx,
+                                 __m256 *rdy, __m256 *rdz) {
+                *rdx = _mm256_add_ps(pcx, _mm256_set1_ps(dCamera.x));
+                *rdy = _mm256_add_ps(pcy, _mm256_set1_ps(dCamera.y));
+                *rdz = _mm256_add_ps(pcz, _mm256_set1_ps(dCamera.z));
+                normalize(rdx, rdy, rdz);
+                __m256 ftd = _mm256_div_ps(fd, *rdz);
+                *rdx = _mm256_sub_ps(_mm256_mul_ps(ftd, *rdx), ox);
+                *rdy = _mm256_sub_ps(_mm256_mul_ps(ftd, *rdy), oy);
+                *rdz = _mm256_mul_ps(ftd, *rdz);
+                normalize(rdx, rdy, rdz);
+            };
+            focusDiff(dxCamera, &rxdx, &rxdy, &rxdz);
+            focusDiff(dyCamera, &rydx, &rydy, &rydz);
+        } else {
+            rxdx = _mm256_add_ps(pcx, _mm256_set1_ps(dxCamera.x));
+            rxdy = _mm256_add_ps(pcy, _mm256_set1_ps(dxCamera.y));
+            rxdz = _mm256_add_ps(pcz, _mm256_set1_ps(dxCamera.z));
+            normalize(&rxdx, &rxdy, &rxdz);
+            rydx = _mm256_add_ps(pcx, _mm256_set1_ps(dyCamera.x));
+            rydy = _mm256_add_ps(pcy, _mm256_set1_ps(dyCamera.y));
+            rydz = _mm256_add_ps(pcz, _mm256_set1_ps(dyCamera.z));
+            normalize(&rydx, &rydy, &rydz);
+        }
+
+        // Interpolate ray times across the shutter interval
+        __m256 t = _mm256_loadu_ps(tSample);
+        __m256 time = _mm256_add_ps(
+            _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(1.f), t),
+                          _mm256_set1_ps(shutterOpen)),
+            _mm256_mul_ps(t, _mm256_set1_ps(shutterClose)));
+
+        // Scatter the lanes into the output rays and take each one to
+        // world space
+        float oxA[8], oyA[8], dxA[8], dyA[8], dzA[8], timeA[8];
+        float rxdxA[8], rxdyA[8], rxdzA[8], rydxA[8], rydyA[8], rydzA[8];
+        _mm256_storeu_ps(oxA, ox);
+        _mm256_storeu_ps(oyA, oy);
+        _mm256_storeu_ps(dxA, dx);
+        _mm256_storeu_ps(dyA, dy);
+        _mm256_storeu_ps(dzA, dz);
+        _mm256_storeu_ps(timeA, time);
+        _mm256_storeu_ps(rxdxA, rxdx);
+        _mm256_storeu_ps(rxdyA, rxdy);
+        _mm256_storeu_ps(rxdzA, rxdz);
+        _mm256_storeu_ps(rydxA, rydx);
+        _mm256_storeu_ps(rydyA, rydy);
+        _mm256_storeu_ps(rydzA, rydz);
+        for (int j = 0; j < 8; ++j) {
+            RayDifferential &ray = rays[i + j];
+            ray = RayDifferential(Point3f(oxA[j], oyA[j], 0),
+                                  Vector3f(dxA[j], dyA[j], dzA[j]));
+            ray.time = timeA[j];
+            ray.medium = medium;
+            ray.rxOrigin = ray.ryOrigin = ray.o;
+            ray.rxDirection = Vector3f(rxdxA[j], rxdyA[j], rxdzA[j]);
+            ray.ryDirection = Vector3f(rydxA[j], rydyA[j], rydzA[j]);
+            ray.hasDifferentials = true;
+            ray = CameraToWorld(ray);
+            weights[i + j] = 1;
+        }
+    }
+#endif  // PBRT_PERSPECTIVE_HAVE_AVX
+    for (; i < n; ++i)
+        weights[i] = GenerateRayDifferential(samples[i], &rays[i]);
+}
+
 Spectrum PerspectiveCamera::We(const Ray &ray, Point2f *pRaster2) const {
     // Interpolate camera matrix and check if $\w{}$ is forward-facing
     Transform c2w;
@@ -50,7 +50,7 @@ STAT_PERCENT("Camera/Rays vignetted by lens system", vignettedRays, totalRays);
 RealisticCamera::RealisticCamera(const AnimatedTransform &CameraToWorld,
                                  Float shutterOpen, Float shutterClose,
                                  Float apertureDiameter, Float focusDistance,
-                                 bool simpleWeighting,
+                                 bool simpleWeighting, bool lensProxy,
                                  std::vector<Float> &lensData, Film *film,
                                  const Medium *medium)
     : Camera(CameraToWorld, shutterOpen, shutterClose, film, medium),
@@ -81,14 +81,25 @@ RealisticCamera::RealisticCamera(const AnimatedTransform &CameraToWorld,
                               FocusDistance(elementInterfaces.back().thickness));
 
     // Compute exit pupil bounds at sampled points on the film
-    int nSamples = 64;
+    int nSamples = 256;
     exitPupilBounds.resize(nSamples);
+    if (lensProxy) {
+        exitPupilMasks.resize(nSamples);
+        exitPupilInteriorMasks.resize(nSamples);
+    }
     ParallelFor([&](int i) {
         Float r0 = (Float)i / nSamples * film->diagonal / 2;
         Float r1 = (Float)(i + 1) / nSamples * film->diagonal / 2;
         exitPupilBounds[i] = BoundExitPupil(r0, r1);
+        if (lensProxy)
+            ComputeExitPupilMasks(r0, r1, exitPupilBounds[i],
+                                  &exitPupilMasks[i],
+                                  &exitPupilInteriorMasks[i]);
     }, nSamples);
 
+    // Fit polynomial proxy for the lens system if requested
+    if (lensProxy) FitLensProxy();
+
     if (simpleWeighting)
         Warning("\"simpleweighting\" option with RealisticCamera no longer "
                 "necessarily matches regular camera images. Further, pixel "
@@ -533,8 +544,11 @@ Float RealisticCamera::FocusDistance(Float filmDistance) {
 
 Bounds2f RealisticCamera::BoundExitPupil(Float pFilmX0, Float pFilmX1) const {
     Bounds2f pupilBounds;
-    // Sample a collection of points on the rear lens to find exit pupil
-    const int nSamples = 1024 * 1024;
+    // Sample a collection of points on the rear lens to find exit pupil.
+    // The table has four times as many radial slots as it used to, so
+    // each (narrower) slot is sampled with a quarter as many rays to
+    // keep the total precomputation unchanged.
+    const int nSamples = 256 * 1024;
     int nExitingRays = 0;
 
     // Compute bounding box of projection of rear element on sampling plane
@@ -570,6 +584,241 @@ Bounds2f RealisticCamera::BoundExitPupil(Float pFilmX0, Float pFilmX1) const {
     return pupilBounds;
 }
 
+void RealisticCamera::ComputeExitPupilMasks(
+    Float r0, Float r1, const Bounds2f &b, std::array<uint32_t, 32> *passMask,
+    std::array<uint32_t, 32> *interiorMask) const {
+    // Rasterize which cells of the pupil bound _b_ pass rays from film
+    // radii in $[r0, r1]$ through the lens system.  Each cell is probed
+    // with a handful of rays at different film radii; _passMask_ marks
+    // cells where any probe got through, dilated by one cell so that
+    // cells straddling the pupil boundary stay marked, while
+    // _interiorMask_ marks cells where every probe got through, eroded
+    // by one cell so that only cells comfortably inside the pupil
+    // remain.
+    static const Point2f probes[] = {{.5f, .5f}, {.15f, .15f}, {.85f, .15f},
+                                     {.15f, .85f}, {.85f, .85f}};
+    PBRT_CONSTEXPR int nProbes = sizeof(probes) / sizeof(probes[0]);
+    std::array<uint32_t, 32> anyPass, allPass;
+    for (int y = 0; y < pupilMaskRes; ++y) {
+        anyPass[y] = allPass[y] = 0;
+        for (int x = 0; x < pupilMaskRes; ++x) {
+            int nPass = 0;
+            for (int s = 0; s < nProbes; ++s) {
+                Point3f pFilm(Lerp((s + 0.5f) / nProbes, r0, r1), 0, 0);
+                Point2f p = b.Lerp(Point2f((x + probes[s].x) / pupilMaskRes,
+                                           (y + probes[s].y) / pupilMaskRes));
+                if (TraceLensesFromFilm(
+                        Ray(pFilm, Point3f(p.x, p.y, LensRearZ()) - pFilm),
+                        nullptr))
+                    ++nPass;
+            }
+            if (nPass > 0) anyPass[y] |= 1u << x;
+            if (nPass == nProbes) allPass[y] |= 1u << x;
+        }
+    }
+    for (int y = 0; y < pupilMaskRes; ++y) {
+        uint32_t dil = anyPass[y] | (anyPass[y] << 1) | (anyPass[y] >> 1);
+        // Erosion leaves a bit set only if the cell and all eight of its
+        // neighbors pass; shifting in zeros at the row ends correctly
+        // drops the outermost columns, and the top and bottom rows are
+        // cleared below.
+        uint32_t ero = allPass[y] & (allPass[y] << 1) & (allPass[y] >> 1);
+        if (y > 0) {
+            dil |= anyPass[y - 1] | (anyPass[y - 1] << 1) |
+                   (anyPass[y - 1] >> 1);
+            ero &= allPass[y - 1] & (allPass[y - 1] << 1) &
+                   (allPass[y - 1] >> 1);
+        } else
+            ero = 0;
+        if (y + 1 < pupilMaskRes) {
+            dil |= anyPass[y + 1] | (anyPass[y + 1] << 1) |
+                   (anyPass[y + 1] >> 1);
+            ero &= allPass[y + 1] & (allPass[y + 1] << 1) &
+                   (allPass[y + 1] >> 1);
+        } else
+            ero = 0;
+        (*passMask)[y] = dil;
+        (*interiorMask)[y] = ero;
+    }
+}
+
+// Monomial exponents of total degree $\le 4$ in $(r, p_x, p_y)$, split by
+// the parity of the $p_y$ exponent: under reflection of the meridional
+// plane the $x$ components of the traced ray are even in $p_y$ and the
+// $y$ components odd, so each output is fit only over terms with the
+// matching symmetry.
+static const std::vector<std::array<int, 3>> &LensProxyTerms(bool oddPy) {
+    auto build = [](bool odd) {
+        std::vector<std::array<int, 3>> terms;
+        for (int i = 0; i <= 4; ++i)
+            for (int j = 0; i + j <= 4; ++j)
+                for (int k = odd ? 1 : 0; i + j + k <= 4; k += 2)
+                    terms.push_back({i, j, k});
+        return terms;
+    };
+    static const std::vector<std::array<int, 3>> even = build(false);
+    static const std::vector<std::array<int, 3>> odd = build(true);
+    return oddPy ? odd : even;
+}
+
+static Float EvalLensProxy(const std::vector<Float> &coeffs, bool oddPy,
+                           const Float rPow[5], const Float pxPow[5],
+                           const Float pyPow[5]) {
+    const std::vector<std::array<int, 3>> &terms = LensProxyTerms(oddPy);
+    Float v = 0;
+    for (size_t i = 0; i < terms.size(); ++i)
+        v += coeffs[i] * rPow[terms[i][0]] * pxPow[terms[i][1]] *
+             pyPow[terms[i][2]];
+    return v;
+}
+
+// Solve the $n \times n$ system $A x = b$ in place by Gaussian
+// elimination with partial pivoting; returns false if _A_ is singular.
+static bool SolveLinearSystem(std::vector<double> &A, std::vector<double> &b,
+                              int n) {
+    for (int col = 0; col < n; ++col) {
+        int pivot = col;
+        for (int row = col + 1; row < n; ++row)
+            if (std::abs(A[row * n + col]) > std::abs(A[pivot * n + col]))
+                pivot = row;
+        if (A[pivot * n + col] == 0) return false;
+        if (pivot != col) {
+            for (int j = 0; j < n; ++j)
+                std::swap(A[col * n + j], A[pivot * n + j]);
+            std::swap(b[col], b[pivot]);
+        }
+        for (int row = col + 1; row < n; ++row) {
+            double f = A[row * n + col] / A[col * n + col];
+            for (int j = col; j < n; ++j) A[row * n + j] -= f * A[col * n + j];
+            b[row] -= f * b[col];
+        }
+    }
+    for (int col = n - 1; col >= 0; --col) {
+        for (int row = 0; row < col; ++row) {
+            b[row] -= A[row * n + col] / A[col * n + col] * b[col];
+            A[row * n + col] = 0;
+        }
+        b[col] /= A[col * n + col];
+    }
+    return true;
+}
+
+void RealisticCamera::FitLensProxy() {
+    // Collect training rays: exact traces from sampled film radii through
+    // their exit pupil bounds, reduced to the meridional frame and
+    // expressed as position and direction on the front plane _proxyExitZ_.
+    proxyExitZ = LensFrontZ();
+    proxyRScale = 2 / film->diagonal;
+    proxyPScale = 1 / RearElementRadius();
+    struct ProxySample {
+        Float r, px, py;  // scaled inputs
+        Float x, y, dx, dy;
+    };
+    std::vector<ProxySample> samples, validation;
+    const int nR = 64, nP = 16;
+    for (int ir = 0; ir < nR; ++ir)
+        for (int ix = 0; ix < nP; ++ix)
+            for (int iy = 0; iy < nP; ++iy) {
+                // Trace an exact ray for this (radius, pupil cell) pair;
+                // odd cell diagonals are held out for validation
+                int s = (ir * nP + ix) * nP + iy;
+                Float r = (ir + RadicalInverse(0, s)) / nR * film->diagonal / 2;
+                int rIndex = std::min((int)exitPupilBounds.size() - 1,
+                                      (int)(r * proxyRScale *
+                                            exitPupilBounds.size()));
+                Point2f pLens = exitPupilBounds[rIndex].Lerp(
+                    Point2f((ix + RadicalInverse(1, s)) / nP,
+                            (iy + RadicalInverse(2, s)) / nP));
+                Point3f pFilm(r, 0, 0);
+                Ray rOut;
+                if (!TraceLensesFromFilm(
+                        Ray(pFilm, Point3f(pLens.x, pLens.y, LensRearZ()) -
+                                       pFilm),
+                        &rOut))
+                    continue;
+                Vector3f d = Normalize(rOut.d);
+                if (d.z <= 0) continue;
+                Float t = (proxyExitZ - rOut.o.z) / d.z;
+                ProxySample ps{r * proxyRScale, pLens.x * proxyPScale,
+                               pLens.y * proxyPScale, rOut.o.x + t * d.x,
+                               rOut.o.y + t * d.y, d.x, d.y};
+                if ((ix + iy) & 1)
+                    validation.push_back(ps);
+                else
+                    samples.push_back(ps);
+            }
+
+    // Solve the least-squares fit for each output via normal equations
+    auto fit = [&](bool oddPy, Float ProxySample::*field,
+                   std::vector<Float> *coeffs) {
+        const std::vector<std::array<int, 3>> &terms = LensProxyTerms(oddPy);
+        int n = terms.size();
+        std::vector<double> ATA(n * n, 0.), ATb(n, 0.);
+        std::vector<double> basis(n);
+        for (const ProxySample &ps : samples) {
+            Float rPow[5] = {1, ps.r, 0, 0, 0};
+            Float pxPow[5] = {1, ps.px, 0, 0, 0};
+            Float pyPow[5] = {1, ps.py, 0, 0, 0};
+            for (int i = 2; i < 5; ++i) {
+                rPow[i] = rPow[i - 1] * ps.r;
+                pxPow[i] = pxPow[i - 1] * ps.px;
+                pyPow[i] = pyPow[i - 1] * ps.py;
+            }
+            for (int i = 0; i < n; ++i)
+                basis[i] = rPow[terms[i][0]] * pxPow[terms[i][1]] *
+                           pyPow[terms[i][2]];
+            for (int i = 0; i < n; ++i) {
+                for (int j = 0; j < n; ++j) ATA[i * n + j] += basis[i] * basis[j];
+                ATb[i] += basis[i] * ps.*field;
+            }
+        }
+        if (!SolveLinearSystem(ATA, ATb, n)) return false;
+        coeffs->resize(n);
+        for (int i = 0; i < n; ++i) (*coeffs)[i] = (Float)ATb[i];
+        return true;
+    };
+    int nTerms = (int)LensProxyTerms(false).size();
+    if ((int)samples.size() < 5 * nTerms ||
+        !fit(false, &ProxySample::x, &proxyX) ||
+        !fit(true, &ProxySample::y, &proxyY) ||
+        !fit(false, &ProxySample::dx, &proxyDx) ||
+        !fit(true, &ProxySample::dy, &proxyDy)) {
+        Warning(
+            "Unable to fit lens proxy polynomials; falling back to exact "
+            "lens tracing.");
+        return;
+    }
+
+    // Validate the fit against the held-out exact traces
+    Float maxPosErr = 0, maxDirErr = 0;
+    for (const ProxySample &ps : validation) {
+        Float rPow[5] = {1, ps.r, 0, 0, 0};
+        Float pxPow[5] = {1, ps.px, 0, 0, 0};
+        Float pyPow[5] = {1, ps.py, 0, 0, 0};
+        for (int i = 2; i < 5; ++i) {
+            rPow[i] = rPow[i - 1] * ps.r;
+            pxPow[i] = pxPow[i - 1] * ps.px;
+            pyPow[i] = pyPow[i - 1] * ps.py;
+        }
+        maxPosErr = std::max(
+            maxPosErr,
+            std::abs(EvalLensProxy(proxyX, false, rPow, pxPow, pyPow) - ps.x) +
+                std::abs(EvalLensProxy(proxyY, true, rPow, pxPow, pyPow) -
+                         ps.y));
+        maxDirErr = std::max(
+            maxDirErr,
+            std::abs(EvalLensProxy(proxyDx, false, rPow, pxPow, pyPow) -
+                     ps.dx) +
+                std::abs(EvalLensProxy(proxyDy, true, rPow, pxPow, pyPow) -
+                         ps.dy));
+    }
+    LOG(INFO) << StringPrintf(
+        "Lens proxy fit: %d training samples, max validation error %g "
+        "(position, meters) / %g (direction)",
+        (int)samples.size(), maxPosErr, maxDirErr);
+    useProxy = true;
+}
+
 void RealisticCamera::RenderExitPupil(Float sx, Float sy,
                                       const char *filename) const {
     Point3f pFilm(sx, sy, 0);
@@ -612,7 +861,8 @@ void RealisticCamera::RenderExitPupil(Float sx, Float sy,
 
 Point3f RealisticCamera::SampleExitPupil(const Point2f &pFilm,
                                          const Point2f &lensSample,
-                                         Float *sampleBoundsArea) const {
+                                         Float *sampleBoundsArea,
+                                         PupilSampleClass *pupilClass) const {
     // Find exit pupil bound for sample distance from film center
     Float rFilm = std::sqrt(pFilm.x * pFilm.x + pFilm.y * pFilm.y);
     int rIndex = rFilm / (film->diagonal / 2) * exitPupilBounds.size();
@@ -620,6 +870,18 @@ Point3f RealisticCamera::SampleExitPupil(const Point2f &pFilm,
     Bounds2f pupilBounds = exitPupilBounds[rIndex];
     if (sampleBoundsArea) *sampleBoundsArea = pupilBounds.Area();
 
+    // Classify the sample's cell using the slot's transmission masks
+    if (pupilClass) {
+        int mx = std::min(pupilMaskRes - 1, (int)(lensSample.x * pupilMaskRes));
+        int my = std::min(pupilMaskRes - 1, (int)(lensSample.y * pupilMaskRes));
+        if (!((exitPupilMasks[rIndex][my] >> mx) & 1))
+            *pupilClass = PupilVignetted;
+        else if ((exitPupilInteriorMasks[rIndex][my] >> mx) & 1)
+            *pupilClass = PupilUnvignetted;
+        else
+            *pupilClass = PupilBoundary;
+    }
+
     // Generate sample point inside exit pupil bound
     Point2f pLens = pupilBounds.Lerp(lensSample);
 
@@ -687,11 +949,49 @@ Float RealisticCamera::GenerateRay(const CameraSample &sample, Ray *ray) const {
 
     // Trace ray from _pFilm_ through lens system
     Float exitPupilBoundsArea;
-    Point3f pRear = SampleExitPupil(Point2f(pFilm.x, pFilm.y), sample.pLens,
-                                    &exitPupilBoundsArea);
+    PupilSampleClass pupilClass = PupilBoundary;
+    Point3f pRear =
+        SampleExitPupil(Point2f(pFilm.x, pFilm.y), sample.pLens,
+                        &exitPupilBoundsArea, useProxy ? &pupilClass : nullptr);
     Ray rFilm(pFilm, pRear - pFilm, Infinity,
               Lerp(sample.time, shutterOpen, shutterClose));
-    if (!TraceLensesFromFilm(rFilm, ray)) {
+    if (useProxy && pupilClass == PupilVignetted) {
+        // The transmission mask guarantees the sample can't make it
+        // through the lens system; reject it without tracing.
+        ++vignettedRays;
+        return 0;
+    }
+    if (useProxy && pupilClass == PupilUnvignetted) {
+        // Evaluate the fitted lens proxy instead of tracing the lens
+        // system: rotate into the meridional frame, evaluate the
+        // polynomials, and rotate the resulting ray back.  Samples near
+        // the pupil boundary take the exact tracing path below so that
+        // hit-or-miss classification is never left to the proxy.
+        Float rFilmR = std::sqrt(pFilm.x * pFilm.x + pFilm.y * pFilm.y);
+        Float sinTheta = (rFilmR != 0) ? pFilm.y / rFilmR : 0;
+        Float cosTheta = (rFilmR != 0) ? pFilm.x / rFilmR : 1;
+        Float px = (cosTheta * pRear.x + sinTheta * pRear.y) * proxyPScale;
+        Float py = (-sinTheta * pRear.x + cosTheta * pRear.y) * proxyPScale;
+        Float r = rFilmR * proxyRScale;
+        Float rPow[5] = {1, r, 0, 0, 0};
+        Float pxPow[5] = {1, px, 0, 0, 0};
+        Float pyPow[5] = {1, py, 0, 0, 0};
+        for (int i = 2; i < 5; ++i) {
+            rPow[i] = rPow[i - 1] * r;
+            pxPow[i] = pxPow[i - 1] * px;
+            pyPow[i] = pyPow[i - 1] * py;
+        }
+        Float X = EvalLensProxy(proxyX, false, rPow, pxPow, pyPow);
+        Float Y = EvalLensProxy(proxyY, true, rPow, pxPow, pyPow);
+        Float DX = EvalLensProxy(proxyDx, false, rPow, pxPow, pyPow);
+        Float DY = EvalLensProxy(proxyDy, true, rPow, pxPow, pyPow);
+        Float DZ = std::sqrt(std::max((Float)0, 1 - DX * DX - DY * DY));
+        *ray = Ray(Point3f(cosTheta * X - sinTheta * Y,
+                           sinTheta * X + cosTheta * Y, proxyExitZ),
+                   Vector3f(cosTheta * DX - sinTheta * DY,
+                            sinTheta * DX + cosTheta * DY, DZ),
+                   Infinity, rFilm.time);
+    } else if (!TraceLensesFromFilm(rFilm, ray)) {
         ++vignettedRays;
         return 0;
     }
@@ -727,6 +1027,7 @@ RealisticCamera *CreateRealisticCamera(const ParamSet &params,
     Float apertureDiameter = params.FindOneFloat("aperturediameter", 1.0);
     Float focusDistance = params.FindOneFloat("focusdistance", 10.0);
     bool simpleWeighting = params.FindOneBool("simpleweighting", true);
+    bool lensProxy = params.FindOneBool("lensproxy", false);
     if (lensFile == "") {
         Error("No lens description file supplied!");
         return nullptr;
@@ -748,7 +1049,7 @@ RealisticCamera *CreateRealisticCamera(const ParamSet &params,
 
     return new RealisticCamera(cam2world, shutteropen, shutterclose,
                                apertureDiameter, focusDistance, simpleWeighting,
-                               lensData, film, medium);
+                               lensProxy, lensData, film, medium);
 }
 
 }  // namespace pbrt
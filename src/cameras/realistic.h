@@ -42,6 +42,7 @@
 #include "pbrt.h"
 #include "camera.h"
 #include "film.h"
+#include <array>
 
 namespace pbrt {
 
@@ -51,7 +52,7 @@ class RealisticCamera : public Camera {
     // RealisticCamera Public Methods
     RealisticCamera(const AnimatedTransform &CameraToWorld, Float shutterOpen,
                     Float shutterClose, Float apertureDiameter,
-                    Float focusDistance, bool simpleWeighting,
+                    Float focusDistance, bool simpleWeighting, bool lensProxy,
                     std::vector<Float> &lensData, Film *film,
                     const Medium *medium);
     Float GenerateRay(const CameraSample &sample, Ray *) const;
@@ -69,6 +70,25 @@ class RealisticCamera : public Camera {
     const bool simpleWeighting;
     std::vector<LensElementInterface> elementInterfaces;
     std::vector<Bounds2f> exitPupilBounds;
+    // Per-radius transmission masks over the exit pupil bounds: each
+    // radial slot of _exitPupilBounds_ stores two small bitmaps,
+    // _exitPupilMasks_ marking cells through which any probe ray passes
+    // the lens system (dilated, so a clear bit means the sample is
+    // definitely vignetted) and _exitPupilInteriorMasks_ marking cells
+    // wholly inside the pupil (eroded, so a set bit means the sample
+    // definitely passes).  Cells in neither are near the pupil boundary
+    // and must be traced exactly.  Only computed when the proxy is in
+    // use.
+    static PBRT_CONSTEXPR int pupilMaskRes = 32;
+    enum PupilSampleClass { PupilVignetted, PupilBoundary, PupilUnvignetted };
+    std::vector<std::array<uint32_t, 32>> exitPupilMasks,
+        exitPupilInteriorMasks;
+    // Degree-4 polynomial proxy of the film-to-scene lens mapping in the
+    // meridional frame, fitted once in the constructor; see
+    // FitLensProxy().
+    bool useProxy = false;
+    Float proxyExitZ, proxyRScale, proxyPScale;
+    std::vector<Float> proxyX, proxyY, proxyDx, proxyDy;
 
     // RealisticCamera Private Methods
     Float LensRearZ() const { return elementInterfaces.back().thickness; }
@@ -98,9 +118,14 @@ class RealisticCamera : public Camera {
     Float FocusBinarySearch(Float focusDistance);
     Float FocusDistance(Float filmDist);
     Bounds2f BoundExitPupil(Float pFilmX0, Float pFilmX1) const;
+    void ComputeExitPupilMasks(Float r0, Float r1, const Bounds2f &b,
+                               std::array<uint32_t, 32> *passMask,
+                               std::array<uint32_t, 32> *interiorMask) const;
     void RenderExitPupil(Float sx, Float sy, const char *filename) const;
     Point3f SampleExitPupil(const Point2f &pFilm, const Point2f &lensSample,
-                            Float *sampleBoundsArea) const;
+                            Float *sampleBoundsArea,
+                            PupilSampleClass *pupilClass = nullptr) const;
+    void FitLensProxy();
     void TestExitPupilBounds() const;
 };
 
@@ -32,13 +32,17 @@
 
 // core/api.cpp*
 #include "api.h"
+#include "asyncio.h"
+#include "benchmark.h"
 #include "parallel.h"
 #include "paramset.h"
 #include "spectrum.h"
 #include "scene.h"
 #include "film.h"
 #include "medium.h"
+#include "mipmap.h"
 #include "stats.h"
+#include "progressreporter.h"
 
 // API Additional Headers
 #include "accelerators/bvh.h"
@@ -54,11 +58,14 @@
 #include "filters/triangle.h"
 #include "integrators/bdpt.h"
 #include "integrators/directlighting.h"
+#include "integrators/guidedpath.h"
 #include "integrators/mlt.h"
 #include "integrators/ao.h"
 #include "integrators/path.h"
+#include "integrators/preview.h"
 #include "integrators/sppm.h"
 #include "integrators/volpath.h"
+#include "integrators/wavepath.h"
 #include "integrators/whitted.h"
 #include "lights/diffuse.h"
 #include "lights/distant.h"
@@ -81,16 +88,20 @@
 #include "materials/subsurface.h"
 #include "materials/translucent.h"
 #include "materials/uber.h"
+#include "samplers/bluenoise.h"
 #include "samplers/halton.h"
 #include "samplers/maxmin.h"
+#include "samplers/pmj02.h"
 #include "samplers/random.h"
 #include "samplers/sobol.h"
+#include "samplers/stateless.h"
 #include "samplers/stratified.h"
 #include "samplers/zerotwosequence.h"
 #include "shapes/cone.h"
 #include "shapes/curve.h"
 #include "shapes/cylinder.h"
 #include "shapes/disk.h"
+#include "shapes/displaced.h"
 #include "shapes/heightfield.h"
 #include "shapes/hyperboloid.h"
 #include "shapes/loopsubdiv.h"
@@ -115,7 +126,12 @@
 #include "media/grid.h"
 #include "media/homogeneous.h"
 
+#include <condition_variable>
+#include <deque>
+#include <sys/stat.h>
+#include <sys/types.h>
 #include <map>
+#include <thread>
 #include <stdio.h>
 
 namespace pbrt {
@@ -179,6 +195,10 @@ struct RenderOptions {
     std::map<std::string, std::shared_ptr<Medium>> namedMedia;
     std::vector<std::shared_ptr<Light>> lights;
     std::vector<std::shared_ptr<Primitive>> primitives;
+    // Instance uses are kept out of _primitives_ so that MakeScene() can put
+    // them in a small top-level BVH over a bottom-level BVH of the
+    // non-instanced geometry, rather than baking everything into one tree.
+    std::vector<std::shared_ptr<Primitive>> instanceUses;
     std::map<std::string, std::vector<std::shared_ptr<Primitive>>> instances;
     std::vector<std::shared_ptr<Primitive>> *currentInstance = nullptr;
     bool haveScatteringMedia = false;
@@ -239,6 +259,195 @@ struct GraphicsState {
     bool reverseOrientation = false;
 };
 
+static std::shared_ptr<Material> MakeMaterialImpl(
+    const std::string &name, const TextureParams &mp,
+    const GraphicsState::NamedMaterialMap &namedMaterials);
+std::shared_ptr<Texture<Float>> MakeFloatTexture(const std::string &name,
+                                                 const Transform &tex2world,
+                                                 const TextureParams &tp);
+std::shared_ptr<Texture<Spectrum>> MakeSpectrumTexture(
+    const std::string &name, const Transform &tex2world,
+    const TextureParams &tp);
+
+// Deferred material and texture instantiation: scenes routinely define far
+// more materials and textures than the camera ever sees, so instead of
+// building them during parsing, these wrappers capture the inputs --
+// ParamSets and (copy-on-write) snapshots of the texture and named-material
+// maps -- and build the real object on its first use from a shading thread.
+// Objects never touched by a shading thread are never built at all.
+class LazyMaterial : public Material {
+  public:
+    LazyMaterial(
+        const std::string &name, const ParamSet &geomParams,
+        const ParamSet &materialParams,
+        std::shared_ptr<GraphicsState::FloatTextureMap> floatTextures,
+        std::shared_ptr<GraphicsState::SpectrumTextureMap> spectrumTextures,
+        std::shared_ptr<GraphicsState::NamedMaterialMap> namedMaterials)
+        : name(name),
+          geomParams(geomParams),
+          materialParams(materialParams),
+          floatTextures(std::move(floatTextures)),
+          spectrumTextures(std::move(spectrumTextures)),
+          namedMaterials(std::move(namedMaterials)) {}
+    void ComputeScatteringFunctions(SurfaceInteraction *si, MemoryArena &arena,
+                                    TransportMode mode,
+                                    bool allowMultipleLobes) const {
+        std::call_once(created, [this]() {
+            TextureParams mp(geomParams, materialParams, *floatTextures,
+                             *spectrumTextures);
+            material = MakeMaterialImpl(name, mp, *namedMaterials);
+        });
+        if (material)
+            material->ComputeScatteringFunctions(si, arena, mode,
+                                                 allowMultipleLobes);
+    }
+
+  private:
+    const std::string name;
+    const ParamSet geomParams, materialParams;
+    std::shared_ptr<GraphicsState::FloatTextureMap> floatTextures;
+    std::shared_ptr<GraphicsState::SpectrumTextureMap> spectrumTextures;
+    std::shared_ptr<GraphicsState::NamedMaterialMap> namedMaterials;
+    mutable std::once_flag created;
+    mutable std::shared_ptr<Material> material;
+};
+
+class LazyFloatTexture : public Texture<Float> {
+  public:
+    LazyFloatTexture(
+        const std::string &type, const Transform &tex2world,
+        const ParamSet &params,
+        std::shared_ptr<GraphicsState::FloatTextureMap> floatTextures,
+        std::shared_ptr<GraphicsState::SpectrumTextureMap> spectrumTextures)
+        : type(type),
+          tex2world(tex2world),
+          params(params),
+          floatTextures(std::move(floatTextures)),
+          spectrumTextures(std::move(spectrumTextures)) {}
+    Float Evaluate(const SurfaceInteraction &si) const {
+        Create();
+        return texture ? texture->Evaluate(si) : 0.f;
+    }
+    // Builds the texture ahead of its first use; called from the texture
+    // preloading workers below.
+    void Preload() const { Create(); }
+
+  private:
+    void Create() const {
+        std::call_once(created, [this]() {
+            TextureParams tp(params, params, *floatTextures,
+                             *spectrumTextures);
+            texture = MakeFloatTexture(type, tex2world, tp);
+        });
+    }
+    const std::string type;
+    const Transform tex2world;
+    const ParamSet params;
+    std::shared_ptr<GraphicsState::FloatTextureMap> floatTextures;
+    std::shared_ptr<GraphicsState::SpectrumTextureMap> spectrumTextures;
+    mutable std::once_flag created;
+    mutable std::shared_ptr<Texture<Float>> texture;
+};
+
+class LazySpectrumTexture : public Texture<Spectrum> {
+  public:
+    LazySpectrumTexture(
+        const std::string &type, const Transform &tex2world,
+        const ParamSet &params,
+        std::shared_ptr<GraphicsState::FloatTextureMap> floatTextures,
+        std::shared_ptr<GraphicsState::SpectrumTextureMap> spectrumTextures)
+        : type(type),
+          tex2world(tex2world),
+          params(params),
+          floatTextures(std::move(floatTextures)),
+          spectrumTextures(std::move(spectrumTextures)) {}
+    Spectrum Evaluate(const SurfaceInteraction &si) const {
+        Create();
+        return texture ? texture->Evaluate(si) : Spectrum(0.f);
+    }
+    // See LazyFloatTexture::Preload().
+    void Preload() const { Create(); }
+
+  private:
+    void Create() const {
+        std::call_once(created, [this]() {
+            TextureParams tp(params, params, *floatTextures,
+                             *spectrumTextures);
+            texture = MakeSpectrumTexture(type, tex2world, tp);
+        });
+    }
+    const std::string type;
+    const Transform tex2world;
+    const ParamSet params;
+    std::shared_ptr<GraphicsState::FloatTextureMap> floatTextures;
+    std::shared_ptr<GraphicsState::SpectrumTextureMap> spectrumTextures;
+    mutable std::once_flag created;
+    mutable std::shared_ptr<Texture<Spectrum>> texture;
+};
+
+// Texture Preloading Pipeline
+// Image reads and MIPMap construction dominate startup for texture-heavy
+// scenes, so pbrtTexture() hands each texture's deferred creation to a small
+// worker pool, overlapping texture I/O with geometry parsing and the
+// aggregate build.  TexturePreloadJoin() blocks until the queue drains,
+// right before rendering starts; anything the workers haven't finished by
+// its first shading access is built there via the usual call_once path.
+static std::mutex preloadMutex;
+static std::condition_variable preloadCondition;
+static std::deque<std::function<void()>> preloadQueue;
+static std::vector<std::thread> preloadThreads;
+static int preloadOutstanding = 0;
+static bool preloadShutdown = false;
+
+static void preloadWorker() {
+    ProfilerWorkerThreadInit();
+    std::unique_lock<std::mutex> lock(preloadMutex);
+    while (!preloadShutdown) {
+        if (preloadQueue.empty())
+            preloadCondition.wait(lock);
+        else {
+            std::function<void()> work = std::move(preloadQueue.front());
+            preloadQueue.pop_front();
+            lock.unlock();
+            work();
+            lock.lock();
+            if (--preloadOutstanding == 0) preloadCondition.notify_all();
+        }
+    }
+    lock.unlock();
+    // Fold this thread's texture loading stats into the global totals.
+    ReportThreadStats();
+}
+
+static void TexturePreloadEnqueue(std::function<void()> work) {
+    std::lock_guard<std::mutex> lock(preloadMutex);
+    if (preloadThreads.empty()) {
+        int nThreads = std::max(1, NumSystemCores() - 1);
+        for (int i = 0; i < nThreads; ++i)
+            preloadThreads.push_back(std::thread(preloadWorker));
+    }
+    preloadQueue.push_back(std::move(work));
+    ++preloadOutstanding;
+    preloadCondition.notify_one();
+}
+
+static void TexturePreloadJoin() {
+    std::unique_lock<std::mutex> lock(preloadMutex);
+    preloadCondition.wait(lock, []() { return preloadOutstanding == 0; });
+}
+
+static void TexturePreloadShutdown() {
+    {
+        std::lock_guard<std::mutex> lock(preloadMutex);
+        if (preloadThreads.empty()) return;
+        preloadShutdown = true;
+    }
+    preloadCondition.notify_all();
+    for (std::thread &thread : preloadThreads) thread.join();
+    preloadThreads.clear();
+    preloadShutdown = false;
+}
+
 STAT_MEMORY_COUNTER("Memory/TransformCache", transformCacheBytes);
 STAT_PERCENT("Scene/TransformCache hits", nTransformCacheHits, nTransformCacheLookups);
 STAT_INT_DISTRIBUTION("Scene/Probes per TransformCache lookup", transformCacheProbes);
@@ -256,49 +465,72 @@ STAT_INT_DISTRIBUTION("Scene/Probes per TransformCache lookup", transformCachePr
 // The hash table size is always a power of two, allowing for the use of a
 // bitwise AND to turn hash values into table offsets.  Quadratic probing
 // is used when there is a hash collision.
+//
+// The cache is sharded so that concurrent lookups from parallel scene
+// construction don't serialize on a single lock: the low bits of a
+// transform's hash select one of _nShards_ independent sub-caches, each
+// with its own mutex, hash table, and arena.  Distinct transforms thus
+// only contend when they happen to land in the same shard.
 class TransformCache {
   public:
-    TransformCache()
-        : hashTable(512), hashTableOccupancy(0) {}
-
     // TransformCache Public Methods
     Transform *Lookup(const Transform &t) {
         ++nTransformCacheLookups;
 
-        int offset = Hash(t) & (hashTable.size() - 1);
+        uint64_t hash = Hash(t);
+        Shard &shard = shards[hash & (nShards - 1)];
+        // Probe within the shard using the hash bits not consumed by shard
+        // selection.
+        hash >>= shardBits;
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        int offset = hash & (shard.hashTable.size() - 1);
         int step = 1;
         while (true) {
             // Keep looking until we find the Transform or determine that
             // it's not present.
-            if (!hashTable[offset] || *hashTable[offset] == t)
+            if (!shard.hashTable[offset] || *shard.hashTable[offset] == t)
                 break;
             // Advance using quadratic probing.
-            offset = (offset + step * step) & (hashTable.size() - 1);
+            offset = (offset + step * step) & (shard.hashTable.size() - 1);
             ++step;
         }
         ReportValue(transformCacheProbes, step);
-        Transform *tCached = hashTable[offset];
+        Transform *tCached = shard.hashTable[offset];
         if (tCached)
             ++nTransformCacheHits;
         else {
-            tCached = arena.Alloc<Transform>();
+            tCached = shard.arena.Alloc<Transform>();
             *tCached = t;
-            Insert(tCached);
+            Insert(shard, hash, tCached);
         }
         return tCached;
     }
 
     void Clear() {
-        transformCacheBytes += arena.TotalAllocated() + hashTable.size() * sizeof(Transform *);
-        hashTable.clear();
-        hashTable.resize(512);
-        hashTableOccupancy = 0;
-        arena.Reset();
+        for (Shard &shard : shards) {
+            transformCacheBytes += shard.arena.TotalAllocated() +
+                                   shard.hashTable.size() * sizeof(Transform *);
+            shard.hashTable.clear();
+            shard.hashTable.resize(64);
+            shard.hashTableOccupancy = 0;
+            shard.arena.Reset();
+        }
     }
 
   private:
-    void Insert(Transform *tNew);
-    void Grow();
+    // TransformCache Private Data
+    static PBRT_CONSTEXPR int shardBits = 6;
+    static PBRT_CONSTEXPR int nShards = 1 << shardBits;
+    struct Shard {
+        std::mutex mutex;
+        std::vector<Transform *> hashTable{64};
+        size_t hashTableOccupancy = 0;
+        MemoryArena arena;
+    };
+    Shard shards[nShards];
+
+    void Insert(Shard &shard, uint64_t hash, Transform *tNew);
+    void Grow(Shard &shard);
 
     static uint64_t Hash(const Transform &t) {
         const char *ptr = (const char *)(&t.GetMatrix());
@@ -312,40 +544,38 @@ class TransformCache {
         }
         return hash;
     }
-
-    // TransformCache Private Data
-    std::vector<Transform *> hashTable;
-    int hashTableOccupancy;
-    MemoryArena arena;
 };
 
-void TransformCache::Insert(Transform *tNew) {
-    if (++hashTableOccupancy == hashTable.size() / 2)
-        Grow();
+void TransformCache::Insert(Shard &shard, uint64_t hash, Transform *tNew) {
+    if (++shard.hashTableOccupancy == shard.hashTable.size() / 2)
+        Grow(shard);
 
-    int baseOffset = Hash(*tNew) & (hashTable.size() - 1);
+    int baseOffset = hash & (shard.hashTable.size() - 1);
     for (int nProbes = 0;; ++nProbes) {
         // Quadratic probing.
-        int offset = (baseOffset + nProbes/2 + nProbes*nProbes/2) & (hashTable.size() - 1);
-        if (hashTable[offset] == nullptr) {
-            hashTable[offset] = tNew;
+        int offset = (baseOffset + nProbes/2 + nProbes*nProbes/2) &
+                     (shard.hashTable.size() - 1);
+        if (shard.hashTable[offset] == nullptr) {
+            shard.hashTable[offset] = tNew;
             return;
         }
     }
 }
 
-void TransformCache::Grow() {
-    std::vector<Transform *> newTable(2 * hashTable.size());
-    LOG(INFO) << "Growing transform cache hash table to " << newTable.size();
+void TransformCache::Grow(Shard &shard) {
+    std::vector<Transform *> newTable(2 * shard.hashTable.size());
+    LOG(INFO) << "Growing transform cache shard hash table to "
+              << newTable.size();
 
     // Insert current elements into newTable.
-    for (Transform *tEntry : hashTable) {
+    for (Transform *tEntry : shard.hashTable) {
         if (!tEntry) continue;
 
-        int baseOffset = Hash(*tEntry) & (hashTable.size() - 1);
+        int baseOffset = (Hash(*tEntry) >> shardBits) & (newTable.size() - 1);
         for (int nProbes = 0;; ++nProbes) {
             // Quadratic probing.
-            int offset = (baseOffset + nProbes/2 + nProbes*nProbes/2) & (hashTable.size() - 1);
+            int offset = (baseOffset + nProbes/2 + nProbes*nProbes/2) &
+                         (newTable.size() - 1);
             if (newTable[offset] == nullptr) {
                 newTable[offset] = tEntry;
                 break;
@@ -353,7 +583,7 @@ void TransformCache::Grow() {
         }
     }
 
-    std::swap(hashTable, newTable);
+    std::swap(shard.hashTable, newTable);
 }
 
 
@@ -371,6 +601,44 @@ static std::vector<uint32_t> pushedActiveTransformBits;
 static TransformCache transformCache;
 int catIndentCount = 0;
 
+// Session Mode Static Data
+// With "--session", pbrt stays alive after rendering and re-parses the
+// scene when a file changes.  Shapes whose geometric inputs (type,
+// parameters, transform, orientation) are unchanged from the previous parse
+// reuse their Shape and GeometricPrimitive objects -- only the material and
+// area light are rebound -- so that the primitive set, and in turn the
+// previous run's aggregate, can be reused when only lights or materials
+// were edited.
+struct SessionShapeRecord {
+    std::vector<std::shared_ptr<Shape>> shapes;
+    std::shared_ptr<std::vector<GeometricPrimitive>> geomPrims;
+    std::vector<std::shared_ptr<Primitive>> prims;
+};
+static std::multimap<uint64_t, SessionShapeRecord> sessionShapeCache;
+static std::multimap<uint64_t, SessionShapeRecord> sessionShapeCachePrev;
+
+static uint64_t SessionHash(const void *ptr, size_t size, uint64_t hash) {
+    const char *p = (const char *)ptr;
+    while (size > 0) {
+        hash ^= *p;
+        hash *= 1099511628211ull;
+        ++p;
+        --size;
+    }
+    return hash;
+}
+
+static uint64_t SessionShapeKey(const std::string &name,
+                                const ParamSet &params, const Transform &ctm,
+                                bool reverseOrientation) {
+    uint64_t hash = 14695981039346656037ull;
+    hash = SessionHash(name.data(), name.size(), hash);
+    std::string ps = params.ToString();
+    hash = SessionHash(ps.data(), ps.size(), hash);
+    hash = SessionHash(&ctm.GetMatrix(), sizeof(Matrix4x4), hash);
+    return SessionHash(&reverseOrientation, sizeof(bool), hash);
+}
+
 // API Forward Declarations
 std::vector<std::shared_ptr<Shape>> MakeShapes(const std::string &name,
                                                const Transform *ObjectToWorld,
@@ -422,6 +690,41 @@ std::vector<std::shared_ptr<Shape>> MakeShapes(const std::string &name,
                 func);                                               \
     } while (false) /* swallow trailing semicolon */
 
+STAT_COUNTER("Scene/Redundant plymesh loads avoided", nPlyMeshCacheHits);
+
+// Content-addressed PLY mesh cache: scenes -- vegetation-heavy ones
+// especially -- often reference the same PLY file from many Shape
+// statements.  Identical (file, transform, orientation, parameters)
+// combinations share one TriangleMesh and its Triangle shapes instead of
+// loading and storing the mesh again.  The file is addressed by resolved
+// path, size, and modification time, which identifies its contents without
+// re-reading a multi-GB mesh to hash it.
+static std::map<uint64_t, std::vector<std::shared_ptr<Shape>>> plyMeshCache;
+
+static bool PlyMeshCacheKey(const ParamSet &paramSet,
+                            const Transform &object2world,
+                            bool reverseOrientation, uint64_t *key) {
+    std::string filename = paramSet.FindOneFilename("filename", "");
+    if (filename.empty()) return false;
+    // Alpha textures resolve against the current texture maps, so shapes
+    // using them aren't shared.
+    if (paramSet.FindTexture("alpha") != "" ||
+        paramSet.FindTexture("shadowalpha") != "")
+        return false;
+    struct stat statBuffer;
+    if (stat(filename.c_str(), &statBuffer) != 0) return false;
+    uint64_t hash = 14695981039346656037ull;
+    hash = SessionHash(filename.data(), filename.size(), hash);
+    hash = SessionHash(&statBuffer.st_size, sizeof(statBuffer.st_size), hash);
+    hash = SessionHash(&statBuffer.st_mtime, sizeof(statBuffer.st_mtime),
+                       hash);
+    std::string ps = paramSet.ToString();
+    hash = SessionHash(ps.data(), ps.size(), hash);
+    hash = SessionHash(&object2world.GetMatrix(), sizeof(Matrix4x4), hash);
+    *key = SessionHash(&reverseOrientation, sizeof(bool), hash);
+    return true;
+}
+
 // Object Creation Function Definitions
 std::vector<std::shared_ptr<Shape>> MakeShapes(const std::string &name,
                                                const Transform *object2world,
@@ -515,9 +818,31 @@ std::vector<std::shared_ptr<Shape>> MakeShapes(const std::string &name,
             shapes = CreateTriangleMeshShape(object2world, world2object,
                                              reverseOrientation, paramSet,
                                              &*graphicsState.floatTextures);
-    } else if (name == "plymesh")
-        shapes = CreatePLYMesh(object2world, world2object, reverseOrientation,
-                               paramSet, &*graphicsState.floatTextures);
+    } else if (name == "plymesh") {
+        uint64_t cacheKey;
+        bool cacheable = PlyMeshCacheKey(paramSet, *object2world,
+                                         reverseOrientation, &cacheKey);
+        auto iter = cacheable ? plyMeshCache.find(cacheKey)
+                              : plyMeshCache.end();
+        if (iter != plyMeshCache.end()) {
+            ++nPlyMeshCacheHits;
+            // Touch the parameters CreatePLYMesh() would have read so they
+            // aren't reported as unused.
+            paramSet.FindOneFloat("alpha", 1.f);
+            paramSet.FindOneFloat("shadowalpha", 1.f);
+            paramSet.FindOneBool("compactattributes", false);
+            paramSet.FindOneBool("compactpositions", false);
+            shapes = iter->second;
+        } else {
+            shapes = CreatePLYMesh(object2world, world2object,
+                                   reverseOrientation, paramSet,
+                                   &*graphicsState.floatTextures);
+            if (cacheable) plyMeshCache[cacheKey] = shapes;
+        }
+    } else if (name == "displacedmesh")
+        shapes = CreateDisplacedMeshShape(object2world, world2object,
+                                          reverseOrientation, paramSet,
+                                          &*graphicsState.floatTextures);
     else if (name == "heightfield")
         shapes = CreateHeightfield(object2world, world2object,
                                    reverseOrientation, paramSet);
@@ -534,8 +859,9 @@ std::vector<std::shared_ptr<Shape>> MakeShapes(const std::string &name,
 
 STAT_COUNTER("Scene/Materials created", nMaterialsCreated);
 
-std::shared_ptr<Material> MakeMaterial(const std::string &name,
-                                       const TextureParams &mp) {
+static std::shared_ptr<Material> MakeMaterialImpl(
+    const std::string &name, const TextureParams &mp,
+    const GraphicsState::NamedMaterialMap &namedMaterials) {
     Material *material = nullptr;
     if (name == "" || name == "none")
         return nullptr;
@@ -557,21 +883,21 @@ std::shared_ptr<Material> MakeMaterial(const std::string &name,
         std::string m1 = mp.FindString("namedmaterial1", "");
         std::string m2 = mp.FindString("namedmaterial2", "");
         std::shared_ptr<Material> mat1, mat2;
-        if (graphicsState.namedMaterials->find(m1) ==
-            graphicsState.namedMaterials->end()) {
+        auto iter1 = namedMaterials.find(m1);
+        if (iter1 == namedMaterials.end()) {
             Error("Named material \"%s\" undefined.  Using \"matte\"",
                   m1.c_str());
-            mat1 = MakeMaterial("matte", mp);
+            mat1 = MakeMaterialImpl("matte", mp, namedMaterials);
         } else
-            mat1 = (*graphicsState.namedMaterials)[m1]->material;
+            mat1 = iter1->second->material;
 
-        if (graphicsState.namedMaterials->find(m2) ==
-            graphicsState.namedMaterials->end()) {
+        auto iter2 = namedMaterials.find(m2);
+        if (iter2 == namedMaterials.end()) {
             Error("Named material \"%s\" undefined.  Using \"matte\"",
                   m2.c_str());
-            mat2 = MakeMaterial("matte", mp);
+            mat2 = MakeMaterialImpl("matte", mp, namedMaterials);
         } else
-            mat2 = (*graphicsState.namedMaterials)[m2]->material;
+            mat2 = iter2->second->material;
 
         material = CreateMixMaterial(mp, mat1, mat2);
     } else if (name == "metal")
@@ -819,14 +1145,20 @@ std::shared_ptr<Sampler> MakeSampler(const std::string &name,
     Sampler *sampler = nullptr;
     if (name == "lowdiscrepancy" || name == "02sequence")
         sampler = CreateZeroTwoSequenceSampler(paramSet);
+    else if (name == "bluenoise")
+        sampler = CreateBlueNoiseSampler(paramSet);
     else if (name == "maxmindist")
         sampler = CreateMaxMinDistSampler(paramSet);
+    else if (name == "pmj02")
+        sampler = CreatePMJ02Sampler(paramSet);
     else if (name == "halton")
         sampler = CreateHaltonSampler(paramSet, film->GetSampleBounds());
     else if (name == "sobol")
         sampler = CreateSobolSampler(paramSet, film->GetSampleBounds());
     else if (name == "random")
         sampler = CreateRandomSampler(paramSet);
+    else if (name == "stateless")
+        sampler = CreateStatelessRandomSampler(paramSet);
     else if (name == "stratified")
         sampler = CreateStratifiedSampler(paramSet);
     else
@@ -870,6 +1202,17 @@ Film *MakeFilm(const std::string &name, const ParamSet &paramSet,
 // API Function Definitions
 void pbrtInit(const Options &opt) {
     PbrtOptions = opt;
+    // GPU offload needs a CUDA-enabled build; fall back to the CPU in
+    // other builds rather than failing the render.
+#ifndef PBRT_HAVE_CUDA
+    if (PbrtOptions.useGPU) {
+        Warning(
+            "pbrt was built without GPU support; ignoring --gpu and "
+            "rendering on the CPU.");
+        PbrtOptions.useGPU = false;
+        PbrtOptions.gpuValidate = false;
+    }
+#endif
     // API Initialization
     if (currentApiState != APIState::Uninitialized)
         Error("pbrtInit() has already been called.");
@@ -880,9 +1223,22 @@ void pbrtInit(const Options &opt) {
 
     // General \pbrt Initialization
     SampledSpectrum::Init();
+    InitPerfCounters();  // Counters must be opened before the worker
+                         // threads are launched so counts are inherited.
     ParallelInit();  // Threads must be launched before the profiler is
                      // initialized.
+    AsyncIOInit();
     InitProfiler();
+    PerfCountersBeginPhase("Scene construction");
+    BenchmarkBeginPhase("parse");
+
+    // Set up the memory budget and register the spillable subsystems
+    if (PbrtOptions.memoryBudgetMB > 0)
+        MemoryBudgetSetLimit((uint64_t)PbrtOptions.memoryBudgetMB * 1024 *
+                             1024);
+    MemoryBudgetRegister("Arena block pool", BlockPoolBytes, FreeBlockPool);
+    MemoryBudgetRegister("Texture MIP maps",
+                         []() { return MipMapLiveBytes().load(); });
 }
 
 void pbrtCleanup() {
@@ -892,8 +1248,13 @@ void pbrtCleanup() {
     else if (currentApiState == APIState::WorldBlock)
         Error("pbrtCleanup() called while inside world block.");
     currentApiState = APIState::Uninitialized;
+    TexturePreloadShutdown();
     ParallelCleanup();
+    AsyncIOCleanup();
+    FreeBlockPool();
     CleanupProfiler();
+    PerfCountersEndPhase();
+    CleanupPerfCounters();
 }
 
 void pbrtIdentity() {
@@ -1115,12 +1476,57 @@ void pbrtMediumInterface(const std::string &insideName,
                insideName.c_str(), outsideName.c_str());
 }
 
+// Scene partitioning asset records: every on-disk asset referenced while
+// parsing the world block, with the union of the world-space bounds of
+// the primitives that use it. Assets whose bounds can't be pinned down
+// at the point of reference (instanced geometry, environment maps) are
+// marked as needed everywhere and land in every region's manifest.
+struct PartitionAssetRecord {
+    Bounds3f bounds;
+    bool everywhere = false;
+};
+static std::map<std::string, PartitionAssetRecord> partitionAssets;
+// Texture name -> image file, for resolving the textures a shape's
+// material references by name to the files a farm node must load.
+static std::map<std::string, std::string> partitionTextureFiles;
+
+static void RecordPartitionAsset(const std::string &file, const Bounds3f &b,
+                                 bool everywhere) {
+    if (file.empty()) return;
+    PartitionAssetRecord &rec = partitionAssets[file];
+    if (everywhere)
+        rec.everywhere = true;
+    else
+        rec.bounds = Union(rec.bounds, b);
+}
+
+// Records the image files behind any textures the given ParamSet
+// references by name (procedural and constant textures have no file and
+// are skipped).
+void RecordPartitionTextures(const ParamSet &ps, const Bounds3f &b,
+                             bool everywhere) {
+    for (const auto &param : ps.textures)
+        for (int i = 0; i < param->nValues; ++i) {
+            auto iter = partitionTextureFiles.find(param->values[i]);
+            if (iter != partitionTextureFiles.end())
+                RecordPartitionAsset(iter->second, b, everywhere);
+        }
+}
+
 void pbrtWorldBegin() {
     VERIFY_OPTIONS("WorldBegin");
     currentApiState = APIState::WorldBlock;
+    if (PbrtOptions.sessionMode) {
+        // Retire the previous parse's shape cache; entries not reused by
+        // this parse are freed when the new world block ends.
+        sessionShapeCachePrev = std::move(sessionShapeCache);
+        sessionShapeCache.clear();
+    }
     for (int i = 0; i < MaxTransforms; ++i) curTransform[i] = Transform();
     activeTransformBits = AllTransformsBits;
     namedCoordinateSystems["world"] = curTransform;
+    partitionAssets.clear();
+    partitionTextureFiles.clear();
     if (PbrtOptions.cat || PbrtOptions.toPly)
         printf("\n\nWorldBegin\n\n");
 }
@@ -1197,16 +1603,26 @@ void pbrtTexture(const std::string &name, const std::string &type,
         return;
     }
 
-    TextureParams tp(params, params, *graphicsState.floatTextures,
-                     *graphicsState.spectrumTextures);
+    if (!PbrtOptions.partitionManifest.empty()) {
+        // Remember which image file backs this texture name; shapes that
+        // reference the texture resolve it to a manifest entry.
+        std::string filename = params.FindOneFilename("filename", "");
+        if (!filename.empty()) partitionTextureFiles[name] = filename;
+    }
     if (type == "float") {
         // Create _Float_ texture and store in _floatTextures_
         if (graphicsState.floatTextures->find(name) !=
             graphicsState.floatTextures->end())
             Warning("Texture \"%s\" being redefined", name.c_str());
         WARN_IF_ANIMATED_TRANSFORM("Texture");
-        std::shared_ptr<Texture<Float>> ft =
-            MakeFloatTexture(texname, curTransform[0], tp);
+        std::shared_ptr<LazyFloatTexture> ft =
+            std::make_shared<LazyFloatTexture>(texname, curTransform[0],
+                                               params,
+                                               graphicsState.floatTextures,
+                                               graphicsState.spectrumTextures);
+        // Start building the texture in the background; it is usually
+        // ready by the time rendering first needs it.
+        TexturePreloadEnqueue([ft]() { ft->Preload(); });
         if (ft) {
             // TODO: move this to be a GraphicsState method, also don't
             // provide direct floatTextures access?
@@ -1223,8 +1639,11 @@ void pbrtTexture(const std::string &name, const std::string &type,
             graphicsState.spectrumTextures->end())
             Warning("Texture \"%s\" being redefined", name.c_str());
         WARN_IF_ANIMATED_TRANSFORM("Texture");
-        std::shared_ptr<Texture<Spectrum>> st =
-            MakeSpectrumTexture(texname, curTransform[0], tp);
+        std::shared_ptr<LazySpectrumTexture> st =
+            std::make_shared<LazySpectrumTexture>(
+                texname, curTransform[0], params, graphicsState.floatTextures,
+                graphicsState.spectrumTextures);
+        TexturePreloadEnqueue([st]() { st->Preload(); });
         if (st) {
             if (graphicsState.spectrumTexturesShared) {
                 graphicsState.spectrumTextures =
@@ -1239,10 +1658,13 @@ void pbrtTexture(const std::string &name, const std::string &type,
 
 void pbrtMaterial(const std::string &name, const ParamSet &params) {
     VERIFY_WORLD("Material");
-    ParamSet emptyParams;
-    TextureParams mp(params, emptyParams, *graphicsState.floatTextures,
-                     *graphicsState.spectrumTextures);
-    std::shared_ptr<Material> mtl = MakeMaterial(name, mp);
+    // Record what's needed to make the material rather than making it now;
+    // it will only actually be created if a shading thread needs it.
+    std::shared_ptr<Material> mtl;
+    if (name != "" && name != "none")
+        mtl = std::make_shared<LazyMaterial>(
+            name, params, ParamSet(), graphicsState.floatTextures,
+            graphicsState.spectrumTextures, graphicsState.namedMaterials);
     graphicsState.currentMaterial =
         std::make_shared<MaterialInstance>(name, mtl, params);
 
@@ -1270,7 +1692,11 @@ void pbrtMakeNamedMaterial(const std::string &name, const ParamSet &params) {
         params.Print(catIndentCount);
         printf("\n");
     } else {
-        std::shared_ptr<Material> mtl = MakeMaterial(matName, mp);
+        std::shared_ptr<Material> mtl;
+        if (matName != "" && matName != "none")
+            mtl = std::make_shared<LazyMaterial>(
+                matName, params, ParamSet(), graphicsState.floatTextures,
+                graphicsState.spectrumTextures, graphicsState.namedMaterials);
         if (graphicsState.namedMaterials->find(name) !=
             graphicsState.namedMaterials->end())
             Warning("Named material \"%s\" redefined.", name.c_str());
@@ -1308,6 +1734,11 @@ void pbrtLightSource(const std::string &name, const ParamSet &params) {
         Error("LightSource: light type \"%s\" unknown.", name.c_str());
     else
         renderOptions->lights.push_back(lt);
+    if (!PbrtOptions.partitionManifest.empty())
+        // A light's image (environment or goniometric map, projection
+        // slide) can affect any pixel, so every region needs it.
+        RecordPartitionAsset(params.FindOneFilename("mapname", ""), Bounds3f(),
+                             true);
     if (PbrtOptions.cat || PbrtOptions.toPly) {
         printf("%*sLightSource \"%s\" ", catIndentCount, "", name.c_str());
         params.Print(catIndentCount);
@@ -1326,6 +1757,45 @@ void pbrtAreaLightSource(const std::string &name, const ParamSet &params) {
     }
 }
 
+// Attempts to satisfy a Shape directive from the session cache.  On a hit
+// the previous parse's primitives are appended (with freshly bound material
+// and area lights) and true is returned.  *cacheable and *sessionKey report
+// whether and under what key a freshly created shape should be cached.
+static bool SessionReuseShape(
+    const std::string &name, const ParamSet &params, const MediumInterface &mi,
+    bool *cacheable, uint64_t *sessionKey,
+    std::vector<std::shared_ptr<Primitive>> *prims,
+    std::vector<std::shared_ptr<AreaLight>> *areaLights) {
+    // Shapes inside object definitions or with participating media aren't
+    // cached: instance primitives don't go through the rebinding path, and
+    // Medium pointers don't survive a re-parse.
+    *cacheable = PbrtOptions.sessionMode && !renderOptions->currentInstance &&
+                 mi.inside == nullptr && mi.outside == nullptr;
+    if (!*cacheable) return false;
+    *sessionKey = SessionShapeKey(name, params, curTransform[0],
+                                  graphicsState.reverseOrientation);
+    auto iter = sessionShapeCachePrev.find(*sessionKey);
+    if (iter == sessionShapeCachePrev.end()) return false;
+    SessionShapeRecord record = std::move(iter->second);
+    sessionShapeCachePrev.erase(iter);
+    std::shared_ptr<Material> mtl = graphicsState.GetMaterialForShape(params);
+    params.ReportUnused();
+    for (size_t i = 0; i < record.shapes.size(); ++i) {
+        // Possibly create area light for reused shape
+        std::shared_ptr<AreaLight> area;
+        if (graphicsState.areaLight != "") {
+            area = MakeAreaLight(graphicsState.areaLight, curTransform[0], mi,
+                                 graphicsState.areaLightParams,
+                                 record.shapes[i]);
+            if (area) areaLights->push_back(area);
+        }
+        (*record.geomPrims)[i].SessionRebind(mtl, area);
+    }
+    prims->insert(prims->end(), record.prims.begin(), record.prims.end());
+    sessionShapeCache.emplace(*sessionKey, std::move(record));
+    return true;
+}
+
 void pbrtShape(const std::string &name, const ParamSet &params) {
     VERIFY_WORLD("Shape");
     std::vector<std::shared_ptr<Primitive>> prims;
@@ -1338,28 +1808,48 @@ void pbrtShape(const std::string &name, const ParamSet &params) {
 
     if (!curTransform.IsAnimated()) {
         // Initialize _prims_ and _areaLights_ for static shape
-
-        // Create shapes for shape _name_
-        Transform *ObjToWorld = transformCache.Lookup(curTransform[0]);
-        Transform *WorldToObj = transformCache.Lookup(Inverse(curTransform[0]));
-        std::vector<std::shared_ptr<Shape>> shapes =
-            MakeShapes(name, ObjToWorld, WorldToObj,
-                       graphicsState.reverseOrientation, params);
-        if (shapes.empty()) return;
-        std::shared_ptr<Material> mtl = graphicsState.GetMaterialForShape(params);
-        params.ReportUnused();
         MediumInterface mi = graphicsState.CreateMediumInterface();
-        prims.reserve(shapes.size());
-        for (auto s : shapes) {
-            // Possibly create area light for shape
-            std::shared_ptr<AreaLight> area;
-            if (graphicsState.areaLight != "") {
-                area = MakeAreaLight(graphicsState.areaLight, curTransform[0],
-                                     mi, graphicsState.areaLightParams, s);
-                if (area) areaLights.push_back(area);
+        bool sessionCacheable = false;
+        uint64_t sessionKey = 0;
+        if (!SessionReuseShape(name, params, mi, &sessionCacheable,
+                               &sessionKey, &prims, &areaLights)) {
+            // Create shapes for shape _name_
+            Transform *ObjToWorld = transformCache.Lookup(curTransform[0]);
+            Transform *WorldToObj =
+                transformCache.Lookup(Inverse(curTransform[0]));
+            std::vector<std::shared_ptr<Shape>> shapes =
+                MakeShapes(name, ObjToWorld, WorldToObj,
+                           graphicsState.reverseOrientation, params);
+            if (shapes.empty()) return;
+            std::shared_ptr<Material> mtl =
+                graphicsState.GetMaterialForShape(params);
+            params.ReportUnused();
+            // Allocate the shape's _GeometricPrimitive_s in a single block
+            // and alias their shared_ptrs to it, avoiding a separate
+            // allocation and control block per primitive; with
+            // multi-million triangle meshes that overhead (and the
+            // destructor storm at exit) is substantial.
+            auto geomPrims = std::make_shared<std::vector<GeometricPrimitive>>();
+            geomPrims->reserve(shapes.size());
+            for (auto s : shapes) {
+                // Possibly create area light for shape
+                std::shared_ptr<AreaLight> area;
+                if (graphicsState.areaLight != "") {
+                    area = MakeAreaLight(graphicsState.areaLight,
+                                         curTransform[0], mi,
+                                         graphicsState.areaLightParams, s);
+                    if (area) areaLights.push_back(area);
+                }
+                geomPrims->emplace_back(s, mtl, area, mi);
             }
-            prims.push_back(
-                std::make_shared<GeometricPrimitive>(s, mtl, area, mi));
+            prims.reserve(shapes.size());
+            for (size_t i = 0; i < geomPrims->size(); ++i)
+                prims.push_back(
+                    std::shared_ptr<Primitive>(geomPrims, &(*geomPrims)[i]));
+            if (sessionCacheable)
+                sessionShapeCache.emplace(
+                    sessionKey,
+                    SessionShapeRecord{std::move(shapes), geomPrims, prims});
         }
     } else {
         // Initialize _prims_ and _areaLights_ for animated shape
@@ -1378,10 +1868,14 @@ void pbrtShape(const std::string &name, const ParamSet &params) {
         std::shared_ptr<Material> mtl = graphicsState.GetMaterialForShape(params);
         params.ReportUnused();
         MediumInterface mi = graphicsState.CreateMediumInterface();
+        // As above, put the _GeometricPrimitive_s in one aliased block.
+        auto geomPrims = std::make_shared<std::vector<GeometricPrimitive>>();
+        geomPrims->reserve(shapes.size());
+        for (auto s : shapes) geomPrims->emplace_back(s, mtl, nullptr, mi);
         prims.reserve(shapes.size());
-        for (auto s : shapes)
+        for (size_t i = 0; i < geomPrims->size(); ++i)
             prims.push_back(
-                std::make_shared<GeometricPrimitive>(s, mtl, nullptr, mi));
+                std::shared_ptr<Primitive>(geomPrims, &(*geomPrims)[i]));
 
         // Create single _TransformedPrimitive_ for _prims_
 
@@ -1403,6 +1897,21 @@ void pbrtShape(const std::string &name, const ParamSet &params) {
         prims[0] = std::make_shared<TransformedPrimitive>(
             prims[0], animatedObjectToWorld);
     }
+    // Record the on-disk assets this shape pulls in for the partitioning
+    // preprocess, along with the world bounds they can affect. Shapes in
+    // an instance definition aren't in world space yet, so their assets
+    // are conservatively marked as needed everywhere.
+    if (!PbrtOptions.partitionManifest.empty()) {
+        bool everywhere = renderOptions->currentInstance != nullptr;
+        Bounds3f b;
+        if (!everywhere)
+            for (const auto &prim : prims) b = Union(b, prim->WorldBound());
+        RecordPartitionAsset(params.FindOneFilename("filename", ""), b,
+                             everywhere);
+        RecordPartitionTextures(params, b, everywhere);
+        RecordPartitionTextures(graphicsState.currentMaterial->params, b,
+                                everywhere);
+    }
     // Add _prims_ and _areaLights_ to scene or current instance
     if (renderOptions->currentInstance) {
         if (areaLights.size())
@@ -1482,9 +1991,11 @@ std::shared_ptr<Material> GraphicsState::GetMaterialForShape(
         // Only create a unique material for the shape if the shape's
         // parameters are (apparently) going to provide values for some of
         // the material parameters.
-        TextureParams mp(shapeParams, currentMaterial->params, *floatTextures,
-                         *spectrumTextures);
-        return MakeMaterial(currentMaterial->name, mp);
+        if (currentMaterial->name == "" || currentMaterial->name == "none")
+            return nullptr;
+        return std::make_shared<LazyMaterial>(
+            currentMaterial->name, shapeParams, currentMaterial->params,
+            floatTextures, spectrumTextures, namedMaterials);
     } else
         return currentMaterial->material;
 }
@@ -1584,7 +2095,87 @@ void pbrtObjectInstance(const std::string &name) {
         InstanceToWorld[1], renderOptions->transformEndTime);
     std::shared_ptr<Primitive> prim(
         std::make_shared<TransformedPrimitive>(in[0], animatedInstanceToWorld));
-    renderOptions->primitives.push_back(prim);
+    renderOptions->instanceUses.push_back(prim);
+}
+
+// Writes one manifest per screen region under the --partitionmanifest
+// base name: a crop window covering the region (in the form --cropwindow
+// takes) followed by the scene files whose projected bounds overlap the
+// region, dilated by a tenth of the image diagonal so nearby off-screen
+// geometry that shadows or reflects into the region is still included.
+// Assets whose bounds can't be projected land in every manifest.
+static void WritePartitionManifests() {
+    std::unique_ptr<Camera> camera(renderOptions->MakeCamera());
+    if (!camera) {
+        Error("Unable to create camera for partition manifests");
+        return;
+    }
+    const Film *film = camera->film;
+    Bounds2f image(Point2f(film->croppedPixelBounds.pMin),
+                   Point2f(film->croppedPixelBounds.pMax));
+    int nx = std::max(1, PbrtOptions.partitionGridX);
+    int ny = std::max(1, PbrtOptions.partitionGridY);
+
+    // Project each asset's world bounds to raster space once, up front.
+    struct ProjectedAsset {
+        const std::string *file;
+        Bounds2f raster;
+        bool everywhere;
+    };
+    std::vector<ProjectedAsset> projected;
+    projected.reserve(partitionAssets.size());
+    Float dilation = .1f * Distance(image.pMin, image.pMax);
+    int nEverywhere = 0;
+    for (const auto &entry : partitionAssets) {
+        ProjectedAsset pa;
+        pa.file = &entry.first;
+        pa.everywhere = entry.second.everywhere ||
+                        !camera->ProjectBounds(entry.second.bounds, &pa.raster);
+        if (pa.everywhere)
+            ++nEverywhere;
+        else
+            pa.raster = Expand(pa.raster, dilation);
+        projected.push_back(pa);
+    }
+
+    for (int y = 0; y < ny; ++y)
+        for (int x = 0; x < nx; ++x) {
+            Bounds2f region(
+                Point2f(Lerp(Float(x) / nx, image.pMin.x, image.pMax.x),
+                        Lerp(Float(y) / ny, image.pMin.y, image.pMax.y)),
+                Point2f(Lerp(Float(x + 1) / nx, image.pMin.x, image.pMax.x),
+                        Lerp(Float(y + 1) / ny, image.pMin.y, image.pMax.y)));
+            std::string filename =
+                StringPrintf("%s_r%d_%d.txt",
+                             PbrtOptions.partitionManifest.c_str(), x, y);
+            FILE *f = fopen(filename.c_str(), "w");
+            if (!f) {
+                Error("Unable to open partition manifest file \"%s\"",
+                      filename.c_str());
+                return;
+            }
+            fprintf(f, "# pbrt partition region %d,%d of a %dx%d grid\n", x, y,
+                    nx, ny);
+            fprintf(f, "cropwindow %.9g %.9g %.9g %.9g\n",
+                    region.pMin.x / film->fullResolution.x,
+                    region.pMax.x / film->fullResolution.x,
+                    region.pMin.y / film->fullResolution.y,
+                    region.pMax.y / film->fullResolution.y);
+            int nFiles = 0;
+            for (const auto &pa : projected)
+                if (pa.everywhere || Overlaps(pa.raster, region)) {
+                    fprintf(f, "%s\n", pa.file->c_str());
+                    ++nFiles;
+                }
+            fclose(f);
+            if (!PbrtOptions.quiet)
+                printf("Wrote partition manifest \"%s\" (%d of %d files)\n",
+                       filename.c_str(), nFiles, (int)projected.size());
+        }
+    if (!PbrtOptions.quiet && nEverywhere > 0)
+        printf("%d of %d files had unbounded extent and were assigned to "
+               "every region\n",
+               nEverywhere, (int)projected.size());
 }
 
 void pbrtWorldEnd() {
@@ -1603,9 +2194,21 @@ void pbrtWorldEnd() {
     // Create scene and render
     if (PbrtOptions.cat || PbrtOptions.toPly) {
         printf("%*sWorldEnd\n", catIndentCount, "");
+    } else if (!PbrtOptions.partitionManifest.empty()) {
+        // Partitioning preprocess: assign each screen region the assets
+        // whose projected bounds overlap it, then skip rendering; farm
+        // nodes re-run with a region's crop window and scene subset.
+        WritePartitionManifests();
     } else {
+        BenchmarkBeginPhase("accelerator build");
+        ProgressSetPhase("build");
         std::unique_ptr<Integrator> integrator(renderOptions->MakeIntegrator());
         std::unique_ptr<Scene> scene(renderOptions->MakeScene());
+        // Wait for any textures still loading in the background.
+        TexturePreloadJoin();
+        // No more textures will be created now that parsing is done, so
+        // release the shared decoded-image cache before rendering starts.
+        ClearDecodedImageCache();
 
         // This is kind of ugly; we directly override the current profiler
         // state to switch from parsing/scene construction related stuff to
@@ -1615,9 +2218,17 @@ void pbrtWorldEnd() {
         // place where that isn't the case.
         CHECK_EQ(CurrentProfilerState(), ProfToBits(Prof::SceneConstruction));
         ProfilerState = ProfToBits(Prof::IntegratorRender);
+        PerfCountersEndPhase();
+        PerfCountersBeginPhase("Rendering");
+        BenchmarkBeginPhase("render");
+        ProgressSetPhase("render");
 
         if (scene && integrator) integrator->Render(*scene);
+        ProgressSetPhase("complete");
 
+        BenchmarkEndPhase();
+        PerfCountersEndPhase();
+        PerfCountersBeginPhase("Scene construction");
         CHECK_EQ(CurrentProfilerState(), ProfToBits(Prof::IntegratorRender));
         ProfilerState = ProfToBits(Prof::SceneConstruction);
     }
@@ -1625,18 +2236,30 @@ void pbrtWorldEnd() {
     // Clean up after rendering. Do this before reporting stats so that
     // destructors can run and update stats as needed.
     graphicsState = GraphicsState();
-    transformCache.Clear();
     currentApiState = APIState::OptionsBlock;
-    ImageTexture<Float, Float>::ClearCache();
-    ImageTexture<RGBSpectrum, Spectrum>::ClearCache();
+    if (!PbrtOptions.sessionMode) {
+        // Session mode keeps these caches warm across re-parses: the shape
+        // cache's reused Shapes point into the transform cache's arena, and
+        // clearing the texture caches would re-read every image file.
+        transformCache.Clear();
+        // Cached PLY shapes hold pointers into the transform cache, so the
+        // mesh cache can't outlive it.
+        plyMeshCache.clear();
+        ImageTexture<Float, Float>::ClearCache();
+        ImageTexture<RGBSpectrum, Spectrum>::ClearCache();
+    }
     renderOptions.reset(new RenderOptions);
 
     if (!PbrtOptions.cat && !PbrtOptions.toPly) {
         MergeWorkerThreadStats();
         ReportThreadStats();
+        BenchmarkReport();
+        if (!PbrtOptions.profileOutFile.empty())
+            WriteProfilerTrace(PbrtOptions.profileOutFile);
         if (!PbrtOptions.quiet) {
             PrintStats(stdout);
             ReportProfilerResults(stdout);
+            if (PbrtOptions.texAccessReport) ReportTextureAccessStats(stdout);
             ClearStats();
             ClearProfiler();
         }
@@ -1649,9 +2272,69 @@ void pbrtWorldEnd() {
 }
 
 Scene *RenderOptions::MakeScene() {
-    std::shared_ptr<Primitive> accelerator =
-        MakeAccelerator(AcceleratorName, std::move(primitives), AcceleratorParams);
+    // When rendering an animated sequence as a series of world blocks, a BVH
+    // built with "bool refit" "true" is kept across frames and refit in
+    // place, rather than rebuilt, as long as the topology is unchanged.
+    static std::shared_ptr<BVHAccel> refitAccelerator;
+    // In session mode, when only lights or materials were edited the shape
+    // cache hands back the identical primitive objects, so the previous
+    // run's aggregate can be reused outright.
+    static std::vector<std::shared_ptr<Primitive>> sessionPrimitives;
+    static std::shared_ptr<Primitive> sessionAggregate;
+    std::shared_ptr<Primitive> accelerator;
+    std::vector<std::shared_ptr<Primitive>> sessionSnapshot;
+    // Aggregates over instanced scenes aren't cached for session reuse:
+    // the instance primitives aren't part of _primitives_, so the
+    // comparison below couldn't tell whether they changed.
+    bool sessionStorable = instanceUses.empty();
+    if (PbrtOptions.sessionMode && sessionAggregate && instanceUses.empty() &&
+        primitives == sessionPrimitives) {
+        LOG(INFO) << "Session: primitive set unchanged; reusing aggregate";
+        accelerator = sessionAggregate;
+        primitives.clear();
+    } else if (PbrtOptions.sessionMode) {
+        // Snapshot before the accelerator factories move from _primitives_.
+        sessionSnapshot = primitives;
+    }
+    if (accelerator) {
+        // Reused above; skip the accelerator construction paths.
+    } else if (!instanceUses.empty()) {
+        // Two-level structure for instanced scenes: the non-instanced
+        // geometry goes into one full-quality bottom-level BVH, which then
+        // joins the (BLAS-sharing) instance primitives under a small
+        // top-level BVH that is cheap to rebuild when instances move.
+        std::vector<std::shared_ptr<Primitive>> topLevelPrims =
+            std::move(instanceUses);
+        instanceUses.clear();
+        if (!primitives.empty()) {
+            std::shared_ptr<Primitive> bottom = MakeAccelerator(
+                AcceleratorName, std::move(primitives), AcceleratorParams);
+            if (!bottom) bottom = std::make_shared<BVHAccel>(primitives);
+            topLevelPrims.push_back(bottom);
+        }
+        accelerator = MakeAccelerator(AcceleratorName,
+                                      std::move(topLevelPrims),
+                                      AcceleratorParams);
+        if (!accelerator)
+            accelerator = std::make_shared<BVHAccel>(topLevelPrims);
+        refitAccelerator = nullptr;
+    } else if (refitAccelerator && AcceleratorName == "bvh" &&
+        refitAccelerator->Refit(primitives)) {
+        accelerator = refitAccelerator;
+        primitives.clear();
+    } else {
+        accelerator = MakeAccelerator(AcceleratorName, std::move(primitives),
+                                      AcceleratorParams);
+        std::shared_ptr<BVHAccel> bvh =
+            std::dynamic_pointer_cast<BVHAccel>(accelerator);
+        refitAccelerator = (bvh && bvh->CanRefit()) ? bvh : nullptr;
+    }
     if (!accelerator) accelerator = std::make_shared<BVHAccel>(primitives);
+    if (PbrtOptions.sessionMode && accelerator != sessionAggregate) {
+        // Remember this run's primitives and aggregate for next time.
+        sessionPrimitives = std::move(sessionSnapshot);
+        sessionAggregate = sessionStorable ? accelerator : nullptr;
+    }
     Scene *scene = new Scene(accelerator, lights);
     // Erase primitives and lights from _RenderOptions_
     primitives.clear();
@@ -1681,6 +2364,12 @@ Integrator *RenderOptions::MakeIntegrator() const {
             CreateDirectLightingIntegrator(IntegratorParams, sampler, camera);
     else if (IntegratorName == "path")
         integrator = CreatePathIntegrator(IntegratorParams, sampler, camera);
+    else if (IntegratorName == "guidedpath")
+        integrator =
+            CreateGuidedPathIntegrator(IntegratorParams, sampler, camera);
+    else if (IntegratorName == "wavepath")
+        integrator =
+            CreateWavefrontPathIntegrator(IntegratorParams, sampler, camera);
     else if (IntegratorName == "volpath")
         integrator = CreateVolPathIntegrator(IntegratorParams, sampler, camera);
     else if (IntegratorName == "bdpt") {
@@ -1691,6 +2380,8 @@ Integrator *RenderOptions::MakeIntegrator() const {
         integrator = CreateAOIntegrator(IntegratorParams, sampler, camera);
     } else if (IntegratorName == "sppm") {
         integrator = CreateSPPMIntegrator(IntegratorParams, camera);
+    } else if (IntegratorName == "preview") {
+        integrator = CreatePreviewIntegrator(IntegratorParams, camera);
     } else {
         Error("Integrator \"%s\" unknown.", IntegratorName.c_str());
         return nullptr;
@@ -0,0 +1,389 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+// core/asyncio.cpp*
+#include "asyncio.h"
+#include "parallel.h"
+#include "stats.h"
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <thread>
+#include <vector>
+
+#ifdef PBRT_IS_WINDOWS
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#ifdef PBRT_IS_LINUX
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+namespace pbrt {
+
+STAT_COUNTER("Disk/Async reads submitted", asyncReadsSubmitted);
+
+// AsyncIO Local Definitions
+// Synchronous positional read used when the service isn't running and by
+// the thread-pool fallback; loops over short reads.
+static bool SyncRead(int fd, char *dest, int64_t nBytes, int64_t offset) {
+#ifdef PBRT_IS_WINDOWS
+    // No pread() equivalent; serialize the seek and read.
+    static std::mutex readMutex;
+    std::lock_guard<std::mutex> lock(readMutex);
+    if (_lseeki64(fd, offset, SEEK_SET) != offset) return false;
+    while (nBytes > 0) {
+        int n = _read(fd, dest, (unsigned)std::min<int64_t>(nBytes, 1 << 30));
+        if (n <= 0) return false;
+        dest += n;
+        nBytes -= n;
+    }
+    return true;
+#else
+    while (nBytes > 0) {
+        ssize_t n = pread(fd, dest, (size_t)nBytes, (off_t)offset);
+        if (n <= 0) return false;
+        dest += n;
+        offset += n;
+        nBytes -= n;
+    }
+    return true;
+#endif
+}
+
+class AsyncIOService {
+  public:
+    virtual ~AsyncIOService() {}
+    virtual void Submit(AsyncReadHandle req) = 0;
+};
+
+// Fallback service: a few threads draining a queue of requests with
+// blocking positional reads.
+class ThreadPoolIOService : public AsyncIOService {
+  public:
+    ThreadPoolIOService() {
+        int nThreads = Clamp(NumSystemCores() / 4, 1, 4);
+        for (int i = 0; i < nThreads; ++i)
+            threads.push_back(std::thread(&ThreadPoolIOService::Worker, this));
+    }
+    ~ThreadPoolIOService() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            shutdown = true;
+        }
+        condition.notify_all();
+        for (std::thread &thread : threads) thread.join();
+    }
+    void Submit(AsyncReadHandle req) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(std::move(req));
+        }
+        condition.notify_one();
+    }
+
+  private:
+    void Worker() {
+        for (;;) {
+            AsyncReadHandle req;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(
+                    lock, [this]() { return shutdown || !queue.empty(); });
+                if (queue.empty()) return;
+                req = std::move(queue.front());
+                queue.pop_front();
+            }
+            req->Finish(SyncRead(req->fd, req->dest, req->nBytes, req->offset));
+        }
+    }
+
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<AsyncReadHandle> queue;
+    bool shutdown = false;
+};
+
+#ifdef PBRT_IS_LINUX
+// io_uring-backed service. The ring is owned by a single submitter thread
+// that moves requests from the submission queue into SQEs, waits for
+// completions, and resubmits short reads with their offset advanced, so
+// no userspace synchronization with the kernel beyond the ring's own
+// head/tail protocol is needed.
+class IOUringService : public AsyncIOService {
+  public:
+    // Returns nullptr if the kernel doesn't provide io_uring (or the
+    // syscall is restricted), in which case the caller should fall back
+    // to ThreadPoolIOService.
+    static IOUringService *Create() {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        int fd = (int)syscall(__NR_io_uring_setup, ringEntries, &params);
+        if (fd < 0) return nullptr;
+
+        size_t sqRingBytes =
+            params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        size_t cqRingBytes =
+            params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        size_t sqeBytes = params.sq_entries * sizeof(io_uring_sqe);
+        void *sqRing = mmap(0, sqRingBytes, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        void *cqRing = mmap(0, cqRingBytes, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        void *sqeMem = mmap(0, sqeBytes, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqRing == MAP_FAILED || cqRing == MAP_FAILED ||
+            sqeMem == MAP_FAILED) {
+            if (sqRing != MAP_FAILED) munmap(sqRing, sqRingBytes);
+            if (cqRing != MAP_FAILED) munmap(cqRing, cqRingBytes);
+            if (sqeMem != MAP_FAILED) munmap(sqeMem, sqeBytes);
+            close(fd);
+            return nullptr;
+        }
+        return new IOUringService(fd, params, sqRing, sqRingBytes, cqRing,
+                                  cqRingBytes, sqeMem, sqeBytes);
+    }
+    ~IOUringService() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            shutdown = true;
+        }
+        condition.notify_one();
+        submitter.join();
+        munmap(sqRing, sqRingBytes);
+        munmap(cqRing, cqRingBytes);
+        munmap(sqes, sqeBytes);
+        close(ringFd);
+    }
+    void Submit(AsyncReadHandle req) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(std::move(req));
+        }
+        condition.notify_one();
+    }
+
+  private:
+    // IOUringService Private Methods
+    IOUringService(int fd, const io_uring_params &params, void *sqRing,
+                   size_t sqRingBytes, void *cqRing, size_t cqRingBytes,
+                   void *sqeMem, size_t sqeBytes)
+        : ringFd(fd),
+          sqRing(sqRing),
+          sqRingBytes(sqRingBytes),
+          cqRing(cqRing),
+          cqRingBytes(cqRingBytes),
+          sqes((io_uring_sqe *)sqeMem),
+          sqeBytes(sqeBytes) {
+        char *sq = (char *)sqRing, *cq = (char *)cqRing;
+        sqHead = (unsigned *)(sq + params.sq_off.head);
+        sqTail = (unsigned *)(sq + params.sq_off.tail);
+        sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+        sqArray = (unsigned *)(sq + params.sq_off.array);
+        sqEntries = params.sq_entries;
+        cqHead = (unsigned *)(cq + params.cq_off.head);
+        cqTail = (unsigned *)(cq + params.cq_off.tail);
+        cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+        cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+        submitter = std::thread(&IOUringService::Run, this);
+    }
+    // Kernel-shared ring indices need acquire/release access.
+    static unsigned LoadAcquire(const unsigned *p) {
+        return reinterpret_cast<const std::atomic<unsigned> *>(p)->load(
+            std::memory_order_acquire);
+    }
+    static void StoreRelease(unsigned *p, unsigned value) {
+        reinterpret_cast<std::atomic<unsigned> *>(p)->store(
+            value, std::memory_order_release);
+    }
+    void Run();
+
+    // IOUringService Private Data
+    static PBRT_CONSTEXPR unsigned ringEntries = 128;
+    // A request being serviced; short reads come back here with _dest_,
+    // _nBytes_, and _offset_ advanced past the bytes already read.
+    struct Op {
+        AsyncReadHandle req;
+        char *dest;
+        int64_t nBytes, offset;
+    };
+    int ringFd;
+    void *sqRing, *cqRing;
+    size_t sqRingBytes, cqRingBytes, sqeBytes;
+    io_uring_sqe *sqes;
+    io_uring_cqe *cqes;
+    unsigned *sqHead, *sqTail, *sqArray, *cqHead, *cqTail;
+    unsigned sqMask, cqMask, sqEntries;
+    std::thread submitter;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<AsyncReadHandle> queue;
+    bool shutdown = false;
+};
+
+void IOUringService::Run() {
+    std::vector<Op *> ready;
+    unsigned inFlight = 0, tail = *sqTail;
+    for (;;) {
+        // Pull newly submitted requests, blocking only if the ring is idle
+        bool shuttingDown;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (ready.empty() && inFlight == 0)
+                condition.wait(
+                    lock, [this]() { return shutdown || !queue.empty(); });
+            for (AsyncReadHandle &req : queue)
+                ready.push_back(
+                    new Op{req, req->dest, req->nBytes, req->offset});
+            queue.clear();
+            shuttingDown = shutdown;
+        }
+        if (shuttingDown && ready.empty() && inFlight == 0) return;
+
+        // Fill available SQEs from _ready_
+        unsigned toSubmit = 0, head = LoadAcquire(sqHead);
+        while (!ready.empty() && tail - head < sqEntries) {
+            Op *op = ready.back();
+            ready.pop_back();
+            unsigned index = tail & sqMask;
+            io_uring_sqe *sqe = &sqes[index];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = op->req->fd;
+            sqe->addr = (uint64_t)(uintptr_t)op->dest;
+            sqe->len = (unsigned)std::min<int64_t>(op->nBytes, 0x7ffff000);
+            sqe->off = (uint64_t)op->offset;
+            sqe->user_data = (uint64_t)(uintptr_t)op;
+            sqArray[index] = index;
+            ++tail;
+            ++toSubmit;
+        }
+        StoreRelease(sqTail, tail);
+
+        // Submit, waiting for a completion if anything is in flight
+        unsigned minComplete = inFlight + toSubmit > 0 ? 1 : 0;
+        int ret = (int)syscall(__NR_io_uring_enter, ringFd, toSubmit,
+                               minComplete, IORING_ENTER_GETEVENTS, nullptr,
+                               (size_t)0);
+        if (ret < 0 && errno != EINTR)
+            LOG(FATAL) << "io_uring_enter: " << strerror(errno);
+        if (ret >= 0) inFlight += ret;
+
+        // Reap completions; short reads go back to _ready_
+        unsigned cqHeadLocal = *cqHead, cqTailValue = LoadAcquire(cqTail);
+        while (cqHeadLocal != cqTailValue) {
+            const io_uring_cqe &cqe = cqes[cqHeadLocal & cqMask];
+            Op *op = (Op *)(uintptr_t)cqe.user_data;
+            --inFlight;
+            if (cqe.res <= 0) {
+                // Error or end of file before all requested bytes
+                op->req->Finish(false);
+                delete op;
+            } else if ((int64_t)cqe.res < op->nBytes) {
+                op->dest += cqe.res;
+                op->offset += cqe.res;
+                op->nBytes -= cqe.res;
+                ready.push_back(op);
+            } else {
+                op->req->Finish(true);
+                delete op;
+            }
+            ++cqHeadLocal;
+        }
+        StoreRelease(cqHead, cqHeadLocal);
+    }
+}
+#endif  // PBRT_IS_LINUX
+
+static AsyncIOService *ioService = nullptr;
+static bool usingIOUring = false;
+
+// AsyncReadRequest Method Definitions
+bool AsyncReadRequest::Wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [this]() { return finished; });
+    return success;
+}
+
+bool AsyncReadRequest::IsFinished() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return finished;
+}
+
+void AsyncReadRequest::Finish(bool ok) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished = true;
+        success = ok;
+    }
+    condition.notify_all();
+}
+
+// AsyncIO Function Definitions
+AsyncReadHandle AsyncRead(int fd, void *dest, int64_t nBytes, int64_t offset) {
+    ++asyncReadsSubmitted;
+    AsyncReadHandle req(
+        new AsyncReadRequest(fd, (char *)dest, nBytes, offset));
+    if (!ioService)
+        req->Finish(SyncRead(fd, (char *)dest, nBytes, offset));
+    else
+        ioService->Submit(req);
+    return req;
+}
+
+void AsyncIOInit(bool forceThreadPool) {
+    CHECK(!ioService);
+#ifdef PBRT_IS_LINUX
+    if (!forceThreadPool) {
+        ioService = IOUringService::Create();
+        usingIOUring = ioService != nullptr;
+    }
+#endif
+    if (!ioService) ioService = new ThreadPoolIOService;
+    VLOG(1) << "Async I/O service using "
+            << (usingIOUring ? "io_uring" : "reader threads");
+}
+
+void AsyncIOCleanup() {
+    delete ioService;
+    ioService = nullptr;
+    usingIOUring = false;
+}
+
+bool AsyncIOUsingIOUring() { return usingIOUring; }
+
+}  // namespace pbrt
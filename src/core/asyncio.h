@@ -0,0 +1,102 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_CORE_ASYNCIO_H
+#define PBRT_CORE_ASYNCIO_H
+
+// core/asyncio.h*
+#include "pbrt.h"
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
+namespace pbrt {
+
+// AsyncIO Declarations
+class AsyncReadRequest;
+using AsyncReadHandle = std::shared_ptr<AsyncReadRequest>;
+
+// Handle for a positional read submitted to the async I/O service. The
+// handle is shared between the caller and the service until the read
+// finishes; the destination storage must stay valid at least that long.
+class AsyncReadRequest {
+  public:
+    // Block until the read has finished; returns true if all of the
+    // requested bytes were read. May be called from several threads, and
+    // repeatedly.
+    bool Wait();
+    // Return true if the read has finished, i.e. Wait() would not block.
+    bool IsFinished();
+
+  private:
+    // AsyncReadRequest Private Methods
+    friend AsyncReadHandle AsyncRead(int fd, void *dest, int64_t nBytes,
+                                     int64_t offset);
+    friend class IOUringService;
+    friend class ThreadPoolIOService;
+    AsyncReadRequest(int fd, char *dest, int64_t nBytes, int64_t offset)
+        : fd(fd), dest(dest), nBytes(nBytes), offset(offset) {}
+    void Finish(bool ok);
+
+    // AsyncReadRequest Private Data
+    const int fd;
+    char *dest;
+    int64_t nBytes, offset;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool finished = false, success = false;
+};
+
+// Read _nBytes_ bytes at absolute position _offset_ of _fd_ into _dest_
+// without blocking the calling thread; the file offset of _fd_ is not
+// used or modified, so many reads of one descriptor can be in flight at
+// once. If the service hasn't been initialized the read is performed
+// synchronously and an already-finished handle is returned.
+AsyncReadHandle AsyncRead(int fd, void *dest, int64_t nBytes, int64_t offset);
+
+// Start the async I/O service: io_uring where the kernel provides it, a
+// small pool of reader threads otherwise (or always, if _forceThreadPool_
+// is set--mostly useful for testing).
+void AsyncIOInit(bool forceThreadPool = false);
+void AsyncIOCleanup();
+// Returns true if reads are serviced by io_uring rather than the
+// thread-pool fallback.
+bool AsyncIOUsingIOUring();
+
+}  // namespace pbrt
+
+#endif  // PBRT_CORE_ASYNCIO_H
@@ -0,0 +1,170 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+// core/benchmark.cpp*
+#include "benchmark.h"
+#include <stdio.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include "error.h"
+#include "parallel.h"
+
+namespace pbrt {
+
+// Phase times are kept in registration order so the report is stable
+// across runs of the same build.
+struct BenchmarkPhase {
+    BenchmarkPhase(const std::string &name, double seconds)
+        : name(name), seconds(seconds) {}
+    std::string name;
+    double seconds;
+};
+static std::vector<BenchmarkPhase> benchmarkPhases;
+static const char *currentBenchmarkPhase = nullptr;
+static std::chrono::steady_clock::time_point currentPhaseStart;
+static bool benchmarkRegressed = false;
+
+// Allowed slowdown of the total time versus the baseline before the
+// benchmark is considered a regression.
+static const double benchmarkTolerance = 0.05;
+
+void BenchmarkRecordPhase(const char *name, double seconds) {
+    if (!PbrtOptions.benchmark) return;
+    for (BenchmarkPhase &p : benchmarkPhases)
+        if (p.name == name) {
+            p.seconds += seconds;
+            return;
+        }
+    benchmarkPhases.push_back(BenchmarkPhase(name, seconds));
+}
+
+void BenchmarkEndPhase() {
+    if (!currentBenchmarkPhase) return;
+    double elapsed = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - currentPhaseStart)
+                         .count();
+    BenchmarkRecordPhase(currentBenchmarkPhase, elapsed);
+    currentBenchmarkPhase = nullptr;
+}
+
+void BenchmarkBeginPhase(const char *name) {
+    if (!PbrtOptions.benchmark) return;
+    BenchmarkEndPhase();
+    // Register the phase now so the report lists phases in the order they
+    // started, not the order they finished.
+    BenchmarkRecordPhase(name, 0);
+    currentBenchmarkPhase = name;
+    currentPhaseStart = std::chrono::steady_clock::now();
+}
+
+// Pull the time for the given phase out of a baseline JSON file written
+// by a previous --benchmark run. The format is our own, so a full JSON
+// parser isn't warranted; we just scan for the quoted phase name and
+// read the number after the following colon.
+static bool FindBaselinePhase(const std::string &contents,
+                              const std::string &name, double *seconds) {
+    size_t pos = contents.find("\"" + name + "\"");
+    if (pos == std::string::npos) return false;
+    pos = contents.find(':', pos);
+    if (pos == std::string::npos) return false;
+    return sscanf(contents.c_str() + pos + 1, "%lf", seconds) == 1;
+}
+
+void BenchmarkReport() {
+    if (!PbrtOptions.benchmark) return;
+    BenchmarkEndPhase();
+
+    // The "imageio" phase is timed at its call sites inside the render
+    // phase, so the total is the sum of the top-level phases only.
+    double total = 0;
+    for (const BenchmarkPhase &p : benchmarkPhases)
+        if (p.name != "imageio") total += p.seconds;
+
+    // Write the phase times as JSON
+    std::string outFile = PbrtOptions.benchmarkOutFile;
+    FILE *f = outFile.empty() ? stdout : fopen(outFile.c_str(), "w");
+    if (!f) {
+        Error("Couldn't open benchmark output file \"%s\"", outFile.c_str());
+        f = stdout;
+    }
+    fprintf(f, "{\n  \"nThreads\": %d,\n  \"phases\": {\n", MaxThreadIndex());
+    for (const BenchmarkPhase &p : benchmarkPhases)
+        fprintf(f, "    \"%s\": %.4f,\n", p.name.c_str(), p.seconds);
+    fprintf(f, "    \"total\": %.4f\n  }\n}\n", total);
+    if (f != stdout) fclose(f);
+
+    // Compare against the stored baseline, if one was given
+    if (!PbrtOptions.benchmarkBaseline.empty()) {
+        std::ifstream in(PbrtOptions.benchmarkBaseline);
+        if (!in) {
+            Error("Couldn't open benchmark baseline file \"%s\"",
+                  PbrtOptions.benchmarkBaseline.c_str());
+            return;
+        }
+        std::stringstream ss;
+        ss << in.rdbuf();
+        std::string baseline = ss.str();
+
+        printf("Benchmark comparison vs. \"%s\":\n",
+               PbrtOptions.benchmarkBaseline.c_str());
+        for (const BenchmarkPhase &p : benchmarkPhases) {
+            double base;
+            if (!FindBaselinePhase(baseline, p.name, &base) || base == 0) {
+                printf("    %-20s %8.3f s  (no baseline)\n", p.name.c_str(),
+                       p.seconds);
+                continue;
+            }
+            printf("    %-20s %8.3f s  baseline %8.3f s  %+6.1f%%\n",
+                   p.name.c_str(), p.seconds, base,
+                   100 * (p.seconds - base) / base);
+        }
+        double baseTotal;
+        if (FindBaselinePhase(baseline, "total", &baseTotal) &&
+            baseTotal > 0) {
+            printf("    %-20s %8.3f s  baseline %8.3f s  %+6.1f%%\n", "total",
+                   total, baseTotal, 100 * (total - baseTotal) / baseTotal);
+            if (total > baseTotal * (1 + benchmarkTolerance)) {
+                printf(
+                    "    REGRESSION: total time is more than %.0f%% over "
+                    "the baseline\n",
+                    100 * benchmarkTolerance);
+                benchmarkRegressed = true;
+            }
+        }
+    }
+}
+
+bool BenchmarkRegressed() { return benchmarkRegressed; }
+
+}  // namespace pbrt
@@ -0,0 +1,74 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_CORE_BENCHMARK_H
+#define PBRT_CORE_BENCHMARK_H
+
+// core/benchmark.h*
+#include "pbrt.h"
+#include <string>
+
+namespace pbrt {
+
+// Scene-level benchmark mode (--benchmark): the render runs as a fixed
+// deterministic workload (pinned sample count and default thread count)
+// and its wall time is split into named phases. All of these functions
+// are no-ops unless _PbrtOptions.benchmark_ is set.
+
+// End the phase currently being timed (if any) and start timing a new
+// one. Re-entering a phase name accumulates into its previous total.
+void BenchmarkBeginPhase(const char *name);
+void BenchmarkEndPhase();
+
+// Add _seconds_ to the named phase directly, for work that is timed at
+// its call site (e.g. image output, which happens inside the render
+// phase).
+void BenchmarkRecordPhase(const char *name, double seconds);
+
+// Write the per-phase times as JSON (to _PbrtOptions.benchmarkOutFile_,
+// or stdout), and if a baseline file was given, print a comparison
+// against it.
+void BenchmarkReport();
+
+// True if the comparison against the baseline found a slowdown beyond
+// the gating tolerance; the main program turns this into a nonzero exit
+// status so farm rollouts can be gated on the benchmark.
+bool BenchmarkRegressed();
+
+}  // namespace pbrt
+
+#endif  // PBRT_CORE_BENCHMARK_H
@@ -35,7 +35,11 @@
 #include "bssrdf.h"
 #include "interpolation.h"
 #include "parallel.h"
+#include "primitive.h"
 #include "scene.h"
+#include "shape.h"
+#include <map>
+#include <mutex>
 
 namespace pbrt {
 
@@ -172,6 +176,7 @@ void ComputeBeamDiffusionBSSRDF(Float g, Float eta, BSSRDFTable *t) {
                                 &t->profile[i * t->nRadiusSamples],
                                 &t->profileCDF[i * t->nRadiusSamples]);
     }, t->nRhoSamples);
+    t->BuildRadiusIntervalGrid();
 }
 
 void SubsurfaceFromDiffuse(const BSSRDFTable &t, const Spectrum &rhoEff,
@@ -195,29 +200,88 @@ BSSRDFTable::BSSRDFTable(int nRhoSamples, int nRadiusSamples)
       rhoEff(new Float[nRhoSamples]),
       profileCDF(new Float[nRadiusSamples * nRhoSamples]) {}
 
+void BSSRDFTable::BuildRadiusIntervalGrid() {
+    if (nRadiusSamples < 3) return;
+    Float r1 = radiusSamples[1], rMax = radiusSamples[nRadiusSamples - 1];
+    if (!(r1 > 0 && rMax > r1)) return;
+    // The radius samples grow geometrically, so a uniform grid over the
+    // log of the radius covers every interval with a handful of cells.
+    radiusGridBase = std::log(r1);
+    int gridSize = 4 * nRadiusSamples;
+    radiusGridScale = gridSize / (std::log(rMax) - radiusGridBase);
+    radiusIntervalGrid.resize(gridSize);
+    for (int i = 0; i < gridSize; ++i) {
+        Float r = std::exp(radiusGridBase + i / radiusGridScale);
+        radiusIntervalGrid[i] = FindInterval(
+            nRadiusSamples, [&](int j) { return radiusSamples[j] <= r; });
+    }
+}
+
+int BSSRDFTable::RadiusInterval(Float rOptical) const {
+    if (radiusIntervalGrid.empty()) return -1;
+    if (rOptical <= radiusSamples[1]) return 0;
+    int cell =
+        Clamp((int)((std::log(rOptical) - radiusGridBase) * radiusGridScale),
+              0, (int)radiusIntervalGrid.size() - 1);
+    // The grid entry holds the interval containing the cell's left edge;
+    // walk forward over any further interval boundaries inside the cell.
+    int idx = radiusIntervalGrid[cell];
+    while (idx + 2 < nRadiusSamples && radiusSamples[idx + 1] <= rOptical)
+        ++idx;
+    return idx;
+}
+
+TabulatedBSSRDF::TabulatedBSSRDF(const SurfaceInteraction &po,
+                                 const Material *material, TransportMode mode,
+                                 Float eta, const Spectrum &sigma_a,
+                                 const Spectrum &sigma_s,
+                                 const BSSRDFTable &table)
+    : SeparableBSSRDF(po, eta, material, mode), table(table) {
+    sigma_t = sigma_a + sigma_s;
+    for (int c = 0; c < Spectrum::nSamples; ++c)
+        rho[c] = sigma_t[c] != 0 ? (sigma_s[c] / sigma_t[c]) : 0;
+
+    // Precompute the albedo-axis spline weights (and the interpolated
+    // effective albedo for Pdf_Sr()); _rho_ doesn't change after this.
+    for (int c = 0; c < Spectrum::nSamples; ++c) {
+        rhoValid[c] =
+            CatmullRomWeights(table.nRhoSamples, table.rhoSamples.get(),
+                              rho[c], &rhoOffset[c], rhoWeights[c]);
+        rhoEffInterp[c] = 0;
+        if (rhoValid[c])
+            for (int i = 0; i < 4; ++i)
+                if (rhoWeights[c][i] != 0)
+                    rhoEffInterp[c] +=
+                        table.rhoEff[rhoOffset[c] + i] * rhoWeights[c][i];
+    }
+}
+
 Spectrum TabulatedBSSRDF::Sr(Float r) const {
     Spectrum Sr(0.f);
     for (int ch = 0; ch < Spectrum::nSamples; ++ch) {
+        if (!rhoValid[ch]) continue;
         // Convert $r$ into unitless optical radius $r_{\roman{optical}}$
         Float rOptical = r * sigma_t[ch];
 
-        // Compute spline weights to interpolate BSSRDF on channel _ch_
-        int rhoOffset, radiusOffset;
-        Float rhoWeights[4], radiusWeights[4];
-        if (!CatmullRomWeights(table.nRhoSamples, table.rhoSamples.get(),
-                               rho[ch], &rhoOffset, rhoWeights) ||
-            !CatmullRomWeights(table.nRadiusSamples, table.radiusSamples.get(),
-                               rOptical, &radiusOffset, radiusWeights))
+        // Compute radius spline weights, starting the interval search
+        // from the table's O(1) grid lookup
+        int radiusOffset;
+        Float radiusWeights[4];
+        int radiusHint = table.RadiusInterval(rOptical);
+        if (!CatmullRomWeights(table.nRadiusSamples,
+                               table.radiusSamples.get(), rOptical,
+                               &radiusOffset, radiusWeights, &radiusHint))
             continue;
 
         // Set BSSRDF value _Sr[ch]_ using tensor spline interpolation
         Float sr = 0;
         for (int i = 0; i < 4; ++i) {
             for (int j = 0; j < 4; ++j) {
-                Float weight = rhoWeights[i] * radiusWeights[j];
+                Float weight = rhoWeights[ch][i] * radiusWeights[j];
                 if (weight != 0)
                     sr += weight *
-                          table.EvalProfile(rhoOffset + i, radiusOffset + j);
+                          table.EvalProfile(rhoOffset[ch] + i,
+                                            radiusOffset + j);
             }
         }
 
@@ -230,6 +294,176 @@ Spectrum TabulatedBSSRDF::Sr(Float r) const {
     return Sr.Clamp();
 }
 
+// SurfaceSampleOctree Local Constants
+static PBRT_CONSTEXPR int octreeMaxLeafShapes = 16;
+static PBRT_CONSTEXPR int octreeMaxDepth = 8;
+
+// SurfaceSampleOctree Method Definitions
+SurfaceSampleOctree::SurfaceSampleOctree(const Scene &scene,
+                                         const Material *material) {
+    // Collect every shape bound to _material_. A primitive that reports
+    // neither a material nor a shape (i.e., a TransformedPrimitive) may
+    // hide matching geometry that can't be enumerated in world space, so
+    // in that case the octree is marked unusable and Sample_Sp() falls
+    // back to probe rays.
+    bool complete = true;
+    scene.ForEachPrimitive([&](const Primitive &prim) {
+        if (prim.GetMaterial() == material) {
+            const Shape *shape = prim.GetShape();
+            if (!shape) {
+                complete = false;
+                return;
+            }
+            Float area = shape->Area();
+            if (area > 0)
+                entries.push_back(
+                    ShapeEntry{shape, shape->WorldBound(), area});
+        } else if (!prim.GetMaterial() && !prim.GetShape())
+            complete = false;
+    });
+    if (!complete || entries.empty()) {
+        entries.clear();
+        return;
+    }
+
+    // Recursively build octree nodes over the shape bounds
+    Bounds3f bound;
+    std::vector<int> entryIndices(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        entryIndices[i] = i;
+        bound = Union(bound, entries[i].bound);
+    }
+    BuildNode(entryIndices, bound, 0);
+    usable = true;
+}
+
+int SurfaceSampleOctree::BuildNode(std::vector<int> &entryIndices,
+                                   const Bounds3f &bound, int depth) {
+    int nodeIndex = nodes.size();
+    nodes.push_back(OctreeNode());
+    OctreeNode node;
+    for (int i = 0; i < 8; ++i) node.children[i] = -1;
+    node.firstEntry = node.nEntries = 0;
+    // Store the tight bound over the subtree's entries for traversal; the
+    // octant bound passed in is only used to partition the entries.
+    for (int i : entryIndices) node.bound = Union(node.bound, entries[i].bound);
+    if ((int)entryIndices.size() <= octreeMaxLeafShapes ||
+        depth == octreeMaxDepth) {
+        // Create leaf node referencing a span of _leafEntries_
+        node.firstEntry = leafEntries.size();
+        node.nEntries = entryIndices.size();
+        leafEntries.insert(leafEntries.end(), entryIndices.begin(),
+                           entryIndices.end());
+    } else {
+        // Partition entries into octants by bound centroid
+        Point3f mid = bound.Lerp(Point3f(.5f, .5f, .5f));
+        std::vector<int> child[8];
+        for (int i : entryIndices) {
+            Point3f c = entries[i].bound.Lerp(Point3f(.5f, .5f, .5f));
+            int o = (c.x > mid.x ? 1 : 0) | (c.y > mid.y ? 2 : 0) |
+                    (c.z > mid.z ? 4 : 0);
+            child[o].push_back(i);
+        }
+        for (int o = 0; o < 8; ++o) {
+            if (child[o].empty()) continue;
+            Bounds3f childBound(Point3f(o & 1 ? mid.x : bound.pMin.x,
+                                        o & 2 ? mid.y : bound.pMin.y,
+                                        o & 4 ? mid.z : bound.pMin.z),
+                                Point3f(o & 1 ? bound.pMax.x : mid.x,
+                                        o & 2 ? bound.pMax.y : mid.y,
+                                        o & 4 ? bound.pMax.z : mid.z));
+            node.children[o] = BuildNode(child[o], childBound, depth + 1);
+        }
+    }
+    nodes[nodeIndex] = node;
+    return nodeIndex;
+}
+
+Float SurfaceSampleOctree::Sample(const Point3f &p, Float rMax,
+                                  const SeparableBSSRDF &bssrdf, Float u1,
+                                  const Point2f &u2, Interaction *it) const {
+    if (!usable || rMax <= 0) return 0;
+    // Gather candidate shapes whose bounds come within _rMax_ of _p_
+    Float rMax2 = rMax * rMax;
+    std::vector<int> candidates;
+    int todo[64], todoOffset = 0;
+    todo[todoOffset++] = 0;
+    while (todoOffset > 0) {
+        const OctreeNode &node = nodes[todo[--todoOffset]];
+        if (DistanceSquared(p, node.bound) > rMax2) continue;
+        if (node.nEntries > 0) {
+            for (int i = 0; i < node.nEntries; ++i) {
+                int e = leafEntries[node.firstEntry + i];
+                if (DistanceSquared(p, entries[e].bound) <= rMax2)
+                    candidates.push_back(e);
+            }
+        } else
+            for (int o = 0; o < 8; ++o)
+                if (node.children[o] >= 0) todo[todoOffset++] = node.children[o];
+    }
+    if (candidates.empty()) return 0;
+
+    // Weight each candidate by its area times the profile at the nearest
+    // possible radius. The nearest-point distance never overestimates the
+    // true radius to any point on the shape, so past its peak the
+    // monotonically decreasing Sr() profile makes a zero weight imply the
+    // shape can't contribute, and skipping it doesn't introduce bias. The
+    // evaluation radius is clamped away from zero since tabulated profiles
+    // store $2 \pi r \, S_r(r)$ and so evaluate to zero exactly at $r=0$,
+    // which would starve the shape _p_ itself lies on.
+    std::vector<Float> weights(candidates.size());
+    Float sumWeights = 0;
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        const ShapeEntry &e = entries[candidates[i]];
+        Float d = std::sqrt(std::max((Float)0, DistanceSquared(p, e.bound)));
+        weights[i] =
+            e.area * bssrdf.Sr(std::max(d, (Float).005 * rMax)).y();
+        sumWeights += weights[i];
+    }
+    if (sumWeights <= 0) return 0;
+
+    // Select a shape proportionally to its weight and sample a point on it
+    int selected = candidates.size() - 1;
+    Float cum = u1 * sumWeights;
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        if (cum < weights[i]) {
+            selected = i;
+            break;
+        }
+        cum -= weights[i];
+    }
+    Float shapePdf;
+    *it = entries[candidates[selected]].shape->Sample(u2, &shapePdf);
+    if (shapePdf == 0) return 0;
+    return weights[selected] / sumWeights * shapePdf;
+}
+
+const SurfaceSampleOctree *GetSurfaceSampleOctree(const Scene &scene,
+                                                  const Material *material) {
+    using OctreeKey = std::pair<const Scene *, const Material *>;
+    static std::mutex octreeMutex;
+    static std::map<OctreeKey, std::unique_ptr<SurfaceSampleOctree>> octrees;
+    // Per-thread memo of the last lookup; BSSRDFs are created per
+    // intersection, so consecutive queries from one thread almost always
+    // repeat the same (scene, material) pair and can skip the lock.
+    static PBRT_THREAD_LOCAL const Scene *lastScene;
+    static PBRT_THREAD_LOCAL const Material *lastMaterial;
+    static PBRT_THREAD_LOCAL const SurfaceSampleOctree *lastOctree;
+    if (lastScene == &scene && lastMaterial == material) return lastOctree;
+    std::lock_guard<std::mutex> lock(octreeMutex);
+    OctreeKey key(&scene, material);
+    auto iter = octrees.find(key);
+    if (iter == octrees.end())
+        iter = octrees
+                   .emplace(key, std::unique_ptr<SurfaceSampleOctree>(
+                                     new SurfaceSampleOctree(scene, material)))
+                   .first;
+    lastScene = &scene;
+    lastMaterial = material;
+    lastOctree = iter->second.get();
+    return lastOctree;
+}
+
 Spectrum SeparableBSSRDF::Sample_S(const Scene &scene, Float u1,
                                    const Point2f &u2, MemoryArena &arena,
                                    SurfaceInteraction *si, Float *pdf) const {
@@ -248,6 +482,38 @@ Spectrum SeparableBSSRDF::Sample_Sp(const Scene &scene, Float u1,
                                     const Point2f &u2, MemoryArena &arena,
                                     SurfaceInteraction *pi, Float *pdf) const {
     ProfilePhase pp(Prof::BSSRDFEvaluation);
+    // Draw the sample point from the per-material surface octree when one is
+    // available, skipping the probe-ray intersection chains below
+    const SurfaceSampleOctree *octree = GetSurfaceSampleOctree(scene, material);
+    if (octree->Usable()) {
+        // Compute conservative search radius covering all spectral channels
+        Float rSearch = 0;
+        for (int ch = 0; ch < Spectrum::nSamples; ++ch)
+            rSearch = std::max(rSearch, Sample_Sr(ch, 0.999f));
+
+        // Sample a surface point near _po_ from the octree
+        Interaction it;
+        Float pdfArea = octree->Sample(po.p, rSearch, *this, u1, u2, &it);
+        if (pdfArea == 0) return Spectrum(0.f);
+
+        // Initialize _pi_ from the sampled surface point. The azimuthal
+        // orientation of the shading frame doesn't matter to the isotropic
+        // $\Sp$ profile, so an arbitrary one is synthesized from the normal.
+        *pi = SurfaceInteraction();
+        pi->p = it.p;
+        pi->pError = it.pError;
+        pi->n = it.n;
+        pi->time = po.time;
+        pi->mediumInterface = po.mediumInterface;
+        pi->shading.n = it.n;
+        Vector3f ssLocal, tsLocal;
+        CoordinateSystem(Vector3f(it.n), &ssLocal, &tsLocal);
+        pi->shading.dpdu = ssLocal;
+        pi->shading.dpdv = tsLocal;
+        *pdf = pdfArea;
+        return this->Sp(*pi);
+    }
+
     // Choose projection axis for BSSRDF sampling
     Vector3f vx, vy, vz;
     if (u1 < .5f) {
@@ -360,27 +626,28 @@ Float TabulatedBSSRDF::Sample_Sr(int ch, Float u) const {
 }
 
 Float TabulatedBSSRDF::Pdf_Sr(int ch, Float r) const {
+    if (!rhoValid[ch]) return 0.f;
     // Convert $r$ into unitless optical radius $r_{\roman{optical}}$
     Float rOptical = r * sigma_t[ch];
 
-    // Compute spline weights to interpolate BSSRDF density on channel _ch_
-    int rhoOffset, radiusOffset;
-    Float rhoWeights[4], radiusWeights[4];
-    if (!CatmullRomWeights(table.nRhoSamples, table.rhoSamples.get(), rho[ch],
-                           &rhoOffset, rhoWeights) ||
-        !CatmullRomWeights(table.nRadiusSamples, table.radiusSamples.get(),
-                           rOptical, &radiusOffset, radiusWeights))
+    // Compute radius spline weights via the table's O(1) interval grid;
+    // the albedo-axis weights were precomputed in the constructor.
+    int radiusOffset;
+    Float radiusWeights[4];
+    int radiusHint = table.RadiusInterval(rOptical);
+    if (!CatmullRomWeights(table.nRadiusSamples, table.radiusSamples.get(),
+                           rOptical, &radiusOffset, radiusWeights,
+                           &radiusHint))
         return 0.f;
 
     // Return BSSRDF profile density for channel _ch_
-    Float sr = 0, rhoEff = 0;
+    Float sr = 0, rhoEff = rhoEffInterp[ch];
     for (int i = 0; i < 4; ++i) {
-        if (rhoWeights[i] == 0) continue;
-        rhoEff += table.rhoEff[rhoOffset + i] * rhoWeights[i];
+        if (rhoWeights[ch][i] == 0) continue;
         for (int j = 0; j < 4; ++j) {
             if (radiusWeights[j] == 0) continue;
-            sr += table.EvalProfile(rhoOffset + i, radiusOffset + j) *
-                  rhoWeights[i] * radiusWeights[j];
+            sr += table.EvalProfile(rhoOffset[ch] + i, radiusOffset + j) *
+                  rhoWeights[ch][i] * radiusWeights[j];
         }
     }
 
@@ -119,12 +119,7 @@ class TabulatedBSSRDF : public SeparableBSSRDF {
     // TabulatedBSSRDF Public Methods
     TabulatedBSSRDF(const SurfaceInteraction &po, const Material *material,
                     TransportMode mode, Float eta, const Spectrum &sigma_a,
-                    const Spectrum &sigma_s, const BSSRDFTable &table)
-        : SeparableBSSRDF(po, eta, material, mode), table(table) {
-        sigma_t = sigma_a + sigma_s;
-        for (int c = 0; c < Spectrum::nSamples; ++c)
-            rho[c] = sigma_t[c] != 0 ? (sigma_s[c] / sigma_t[c]) : 0;
-    }
+                    const Spectrum &sigma_s, const BSSRDFTable &table);
     Spectrum Sr(Float distance) const;
     Float Pdf_Sr(int ch, Float distance) const;
     Float Sample_Sr(int ch, Float sample) const;
@@ -133,8 +128,62 @@ class TabulatedBSSRDF : public SeparableBSSRDF {
     // TabulatedBSSRDF Private Data
     const BSSRDFTable &table;
     Spectrum sigma_t, rho;
+    // Spline weights along the albedo axis, precomputed in the
+    // constructor since _rho_ is fixed for the lifetime of the BSSRDF;
+    // Sr() and Pdf_Sr() only search along the radius axis.
+    int rhoOffset[Spectrum::nSamples];
+    Float rhoWeights[Spectrum::nSamples][4];
+    Float rhoEffInterp[Spectrum::nSamples];
+    bool rhoValid[Spectrum::nSamples];
 };
 
+// SurfaceSampleOctree Declarations
+// An octree over the world-space bounds of every shape bound to a single
+// subsurface material. SeparableBSSRDF::Sample_Sp() draws its sample point
+// from this structure directly via Shape::Sample() rather than probing the
+// scene with chains of intersection tests, which dominate the cost of
+// subsurface-heavy scenes. Built lazily, once per material, on first use
+// and immutable (and so freely shared between threads) afterwards.
+class SurfaceSampleOctree {
+  public:
+    // SurfaceSampleOctree Public Methods
+    SurfaceSampleOctree(const Scene &scene, const Material *material);
+    bool Usable() const { return usable; }
+    // Samples a point on one of the material's shapes within _rMax_ of _p_,
+    // preferring shapes where _bssrdf_'s profile is large. Returns the
+    // sample's density with respect to surface area, or zero if no shape
+    // can contribute.
+    Float Sample(const Point3f &p, Float rMax, const SeparableBSSRDF &bssrdf,
+                 Float u1, const Point2f &u2, Interaction *it) const;
+
+  private:
+    // SurfaceSampleOctree Private Declarations
+    struct ShapeEntry {
+        const Shape *shape;
+        Bounds3f bound;
+        Float area;
+    };
+    struct OctreeNode {
+        Bounds3f bound;
+        int children[8];
+        int firstEntry, nEntries;
+    };
+
+    // SurfaceSampleOctree Private Methods
+    int BuildNode(std::vector<int> &entryIndices, const Bounds3f &bound,
+                  int depth);
+
+    // SurfaceSampleOctree Private Data
+    std::vector<ShapeEntry> entries;
+    std::vector<OctreeNode> nodes;
+    std::vector<int> leafEntries;
+    bool usable = false;
+};
+
+// Returns the (lazily built) octree for _material_'s geometry in _scene_.
+const SurfaceSampleOctree *GetSurfaceSampleOctree(const Scene &scene,
+                                                  const Material *material);
+
 struct BSSRDFTable {
     // BSSRDFTable Public Data
     const int nRhoSamples, nRadiusSamples;
@@ -142,9 +191,19 @@ struct BSSRDFTable {
     std::unique_ptr<Float[]> profile;
     std::unique_ptr<Float[]> rhoEff;
     std::unique_ptr<Float[]> profileCDF;
+    // Uniform grid over log optical radius mapping to the containing
+    // interval of _radiusSamples_, so spline weight lookups start from
+    // the right interval without a per-evaluation binary search. Built
+    // by BuildRadiusIntervalGrid() once _radiusSamples_ is filled in.
+    std::vector<int> radiusIntervalGrid;
+    Float radiusGridBase = 0, radiusGridScale = 0;
 
     // BSSRDFTable Public Methods
     BSSRDFTable(int nRhoSamples, int nRadiusSamples);
+    void BuildRadiusIntervalGrid();
+    // Returns _i_ such that $radiusSamples[i] \le r < radiusSamples[i+1]$
+    // in O(1), or -1 if the grid hasn't been built.
+    int RadiusInterval(Float rOptical) const;
     inline Float EvalProfile(int rhoIndex, int radiusIndex) const {
         return profile[rhoIndex * nRadiusSamples + radiusIndex];
     }
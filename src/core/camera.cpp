@@ -96,6 +96,14 @@ Float Camera::GenerateRayDifferential(const CameraSample &sample,
     return wt;
 }
 
+void Camera::GenerateRaysN(const CameraSample *samples, int n,
+                           RayDifferential *rays, Float *weights) const {
+    // Generate each ray independently; cameras with a vectorized ray
+    // setup override this method.
+    for (int i = 0; i < n; ++i)
+        weights[i] = GenerateRayDifferential(samples[i], &rays[i]);
+}
+
 Spectrum Camera::We(const Ray &ray, Point2f *raster) const {
     LOG(FATAL) << "Camera::We() is not implemented!";
     return Spectrum(0.f);
@@ -112,4 +120,50 @@ Spectrum Camera::Sample_Wi(const Interaction &ref, const Point2f &u,
     return Spectrum(0.f);
 }
 
+bool Camera::ProjectBounds(const Bounds3f &b, Bounds2f *raster) const {
+    // Cameras without a projective model can't bound the box's footprint.
+    return false;
+}
+
+bool ProjectiveCamera::ProjectBounds(const Bounds3f &b,
+                                     Bounds2f *raster) const {
+    if (b.pMin.x > b.pMax.x) return false;  // degenerate (empty) bounds
+    // Take the union of the corner projections at both ends of the
+    // shutter interval so that camera motion stays inside the bounds.
+    Bounds2f rb;
+    for (Float time : {shutterOpen, shutterClose}) {
+        Transform cameraToWorld;
+        CameraToWorld.Interpolate(time, &cameraToWorld);
+        Transform worldToRaster =
+            ScreenToRaster * CameraToScreen * Inverse(cameraToWorld);
+        for (int i = 0; i < 8; ++i) {
+            Point3f pCamera = Inverse(cameraToWorld)(b.Corner(i));
+            // A corner at or behind the lens plane projects to the wrong
+            // side of the image (or not at all); decline rather than
+            // report bounds that miss part of the box's footprint.
+            if (pCamera.z < 1e-4f) return false;
+            Point3f pRaster = worldToRaster(b.Corner(i));
+            rb = Union(rb, Point2f(pRaster.x, pRaster.y));
+        }
+    }
+    // Defocus blur spreads each point over the lens; widen the bounds by
+    // the worst-case circle of confusion at the near end of the box.
+    if (lensRadius > 0) {
+        Float zNear = Infinity;
+        for (int i = 0; i < 8; ++i) {
+            Transform cameraToWorld;
+            CameraToWorld.Interpolate(shutterOpen, &cameraToWorld);
+            zNear = std::min(zNear, Inverse(cameraToWorld)(b.Corner(i)).z);
+        }
+        // Project a lens-radius offset at the focal plane through the
+        // thin lens to raster space to get the blur radius in pixels.
+        Float blur = lensRadius * std::abs(focalDistance - zNear) / zNear;
+        Point3f o = (ScreenToRaster * CameraToScreen)(Point3f(0, 0, zNear));
+        Point3f e = (ScreenToRaster * CameraToScreen)(Point3f(blur, 0, zNear));
+        rb = Expand(rb, std::abs(e.x - o.x));
+    }
+    *raster = rb;
+    return true;
+}
+
 }  // namespace pbrt
@@ -56,11 +56,20 @@ class Camera {
     virtual Float GenerateRay(const CameraSample &sample, Ray *ray) const = 0;
     virtual Float GenerateRayDifferential(const CameraSample &sample,
                                           RayDifferential *rd) const;
+    virtual void GenerateRaysN(const CameraSample *samples, int n,
+                               RayDifferential *rays, Float *weights) const;
     virtual Spectrum We(const Ray &ray, Point2f *pRaster2 = nullptr) const;
     virtual void Pdf_We(const Ray &ray, Float *pdfPos, Float *pdfDir) const;
     virtual Spectrum Sample_Wi(const Interaction &ref, const Point2f &u,
                                Vector3f *wi, Float *pdf, Point2f *pRaster,
                                VisibilityTester *vis) const;
+    // Conservatively projects a world-space bounding box onto the image
+    // plane, returning the raster-space bounds it can cover. Returns
+    // false if no bounds can be claimed (e.g. part of the box may lie
+    // behind the camera); callers must then treat the box as potentially
+    // covering the whole image. Used by the scene partitioning
+    // preprocess; the base implementation always declines.
+    virtual bool ProjectBounds(const Bounds3f &b, Bounds2f *raster) const;
 
     // Camera Public Data
     AnimatedTransform CameraToWorld;
@@ -106,6 +115,7 @@ class ProjectiveCamera : public Camera {
         RasterToScreen = Inverse(ScreenToRaster);
         RasterToCamera = Inverse(CameraToScreen) * RasterToScreen;
     }
+    bool ProjectBounds(const Bounds3f &b, Bounds2f *raster) const;
 
   protected:
     // ProjectiveCamera Protected Data
@@ -285,6 +285,53 @@ inline bool Quadratic(EFloat A, EFloat B, EFloat C, EFloat *t0, EFloat *t1) {
     return true;
 }
 
+// Fast, non-conservative counterpart of Quadratic(): solves the quadratic
+// in plain floats, given conservative absolute error bounds for the
+// coefficients, and returns the roots together with a bound _tSlop_ on
+// their error.  A caller should accept the fast result only when it is
+// more than _tSlop_ away from every decision boundary it consults and
+// otherwise redo the solve with the exact EFloat version above; doing so
+// makes the common case cheap while preserving the robustness guarantees
+// of the conservative path.  Returns false when the discriminant is
+// within its own error bound of zero, so not even the existence of real
+// roots can be decided without the exact arithmetic.
+inline bool QuadraticFast(Float A, Float B, Float C, Float aErr, Float bErr,
+                          Float cErr, bool *hasRoots, Float *t0, Float *t1,
+                          Float *tSlop) {
+    // Find quadratic discriminant and conservative bound on its error
+    Float discrim = B * B - 4 * A * C;
+    Float discErr =
+        2 * std::abs(B) * bErr + 4 * (std::abs(A) * cErr + std::abs(C) * aErr) +
+        8 * MachineEpsilon * (B * B + std::abs(4 * A * C));
+    if (discrim < -discErr) {
+        *hasRoots = false;
+        return true;
+    }
+    if (discrim < discErr) return false;
+    *hasRoots = true;
+    Float rootDiscrim = std::sqrt(discrim);
+    // $\sqrt{}$ damps the error: _discrim_ exceeds _discErr_, so
+    // $\delta\sqrt{} \le \mathit{discErr} / \mathit{rootDiscrim}$
+    Float rootErr = discErr / rootDiscrim;
+
+    // Compute quadratic _t_ values and bound the error of each root
+    Float q;
+    if (B < 0)
+        q = -.5f * (B - rootDiscrim);
+    else
+        q = -.5f * (B + rootDiscrim);
+    Float qErr = .5f * (bErr + rootErr);
+    *t0 = q / A;
+    *t1 = C / q;
+    Float t0Err = (qErr + std::abs(*t0) * aErr) / std::abs(A);
+    Float t1Err = (cErr + std::abs(*t1) * qErr) / std::abs(q);
+    // Double the larger bound to absorb the rounding of the error
+    // expressions themselves
+    *tSlop = 2 * std::max(t0Err, t1Err);
+    if (*t0 > *t1) std::swap(*t0, *t1);
+    return true;
+}
+
 }  // namespace pbrt
 
 #endif  // PBRT_CORE_EFLOAT_H
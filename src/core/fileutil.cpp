@@ -33,6 +33,7 @@
 
 // core/fileutil.cpp*
 #include "fileutil.h"
+#include <zlib.h>
 #include <cstdlib>
 #include <climits>
 #ifndef PBRT_IS_WINDOWS
@@ -126,4 +127,22 @@ void SetSearchDirectory(const std::string &dirname) {
     searchDirectory = dirname;
 }
 
+bool DecompressFile(const std::string &filename, std::string *contents) {
+    gzFile f = gzopen(filename.c_str(), "rb");
+    if (!f) return false;
+    // Decompress in chunks; gzread() handles the gzip framing and returns
+    // the raw bytes as if the file were stored uncompressed.
+    char buf[256 * 1024];
+    int n;
+    while ((n = gzread(f, buf, sizeof(buf))) > 0)
+        contents->append(buf, n);
+    bool success = (n == 0);
+    if (!success) {
+        int errnum;
+        Error("%s: %s", filename.c_str(), gzerror(f, &errnum));
+    }
+    gzclose(f);
+    return success;
+}
+
 }  // namespace pbrt
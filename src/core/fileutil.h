@@ -60,6 +60,13 @@ inline bool HasExtension(const std::string &value, const std::string &ending) {
         [](char a, char b) { return std::tolower(a) == std::tolower(b); });
 }
 
+// gzip-compressed input support: scene and PLY files may be stored
+// compressed (".gz" suffix) and are decompressed on the fly when read.
+inline bool IsCompressedFile(const std::string &filename) {
+    return HasExtension(filename, ".gz");
+}
+bool DecompressFile(const std::string &filename, std::string *contents);
+
 }  // namespace pbrt
 
 #endif  // PBRT_CORE_FILEUTIL_H
@@ -33,9 +33,18 @@
 
 // core/film.cpp*
 #include "film.h"
+#include "benchmark.h"
 #include "paramset.h"
 #include "imageio.h"
+#include "parallel.h"
 #include "stats.h"
+#include <algorithm>
+#include <chrono>
+#ifndef PBRT_IS_WINDOWS
+#include <netdb.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif  // !PBRT_IS_WINDOWS
 
 namespace pbrt {
 
@@ -44,11 +53,23 @@ STAT_MEMORY_COUNTER("Memory/Film pixels", filmPixelMemory);
 // Film Method Definitions
 Film::Film(const Point2i &resolution, const Bounds2f &cropWindow,
            std::unique_ptr<Filter> filt, Float diagonal,
-           const std::string &filename, Float scale, Float maxSampleLuminance)
+           const std::string &filename, Float scale, Float maxSampleLuminance,
+           bool adaptiveSampling, Float adaptiveMaxError,
+           int adaptiveMinSamples, bool saveAOVs, bool halfPixels,
+           bool filterImportance, bool bucketMode, bool filterSplatOutliers,
+           const std::string &previousFrameFile, int temporalPriorSamples)
     : fullResolution(resolution),
       diagonal(diagonal * .001),
       filter(std::move(filt)),
       filename(filename),
+      adaptiveSampling(adaptiveSampling),
+      adaptiveMaxError(adaptiveMaxError),
+      adaptiveMinSamples(adaptiveMinSamples),
+      temporalPriorSamples(temporalPriorSamples),
+      saveAOVs(saveAOVs),
+      halfPixels(halfPixels),
+      filterImportance(filterImportance),
+      bucketMode(bucketMode),
       scale(scale),
       maxSampleLuminance(maxSampleLuminance) {
     // Compute film image bounds
@@ -60,10 +81,57 @@ Film::Film(const Point2i &resolution, const Bounds2f &cropWindow,
     LOG(INFO) << "Created film with full resolution " << resolution <<
         ". Crop window of " << cropWindow << " -> croppedPixelBounds " <<
         croppedPixelBounds;
+    // The adaptive splat outlier record is updated racily, so the clamp it
+    // applies depends on splat arrival order; deterministic mode leaves it
+    // off to keep splat values reproducible.
+    if (filterSplatOutliers && !PbrtOptions.deterministic) {
+        splatTopLuminance.reset(
+            new AtomicFloat[croppedPixelBounds.Area() * splatTopK]);
+        filmPixelMemory +=
+            croppedPixelBounds.Area() * splatTopK * sizeof(AtomicFloat);
+    }
+
+    // In bucket mode the crop window only restricts where camera samples
+    // are generated; pixel storage covers the full resolution so splats
+    // landing outside the crop are accumulated instead of clipped.
+    if (bucketMode) {
+        bucketSampleBounds = croppedPixelBounds;
+        croppedPixelBounds = Bounds2i(Point2i(0, 0), fullResolution);
+    }
+
+    // Allocate the per-pixel render cost plane if cost instrumentation
+    // was requested on the command line
+    if (PbrtOptions.costHeatmap) {
+        costPlane.reset(new AtomicFloat[croppedPixelBounds.Area()]);
+        filmPixelMemory += croppedPixelBounds.Area() * sizeof(AtomicFloat);
+    }
 
     // Allocate film image storage
-    pixels = std::unique_ptr<Pixel[]>(new Pixel[croppedPixelBounds.Area()]);
-    filmPixelMemory += croppedPixelBounds.Area() * sizeof(Pixel);
+    if (halfPixels) {
+        compactPixels =
+            AllocAlignedArray<CompactPixel>(croppedPixelBounds.Area());
+        filmPixelMemory += croppedPixelBounds.Area() * sizeof(CompactPixel);
+    } else {
+        pixels = AllocAlignedArray<Pixel>(croppedPixelBounds.Area());
+        filmPixelMemory += croppedPixelBounds.Area() * sizeof(Pixel);
+    }
+
+    // Allocate per-band mutexes for concurrent tile merging
+    nMergeShards = std::max(
+        1, (croppedPixelBounds.pMax.y - croppedPixelBounds.pMin.y +
+            mergeShardRows - 1) / mergeShardRows);
+    mergeMutexes.reset(new std::mutex[nMergeShards]);
+
+    // Allocate AOV planes if requested
+    if (saveAOVs) {
+        aovAlbedo.assign(3 * (size_t)croppedPixelBounds.Area(), 0);
+        aovNormal.assign(3 * (size_t)croppedPixelBounds.Area(), 0);
+        aovDepth.assign((size_t)croppedPixelBounds.Area(), 0);
+        filmPixelMemory += 7 * croppedPixelBounds.Area() * sizeof(Float);
+    }
+
+    // Load the previous frame's planes for temporal seeding if given
+    if (!previousFrameFile.empty()) LoadPreviousFrame(previousFrameFile);
 
     // Precompute filter weight table
     int offset = 0;
@@ -75,12 +143,94 @@ Film::Film(const Point2i &resolution, const Bounds2f &cropWindow,
             filterTable[offset] = filter->Evaluate(p);
         }
     }
+
+    // Build the filter's sampling distribution for filter importance
+    // sampling; the distribution tabulates |f| so filters with negative
+    // lobes sample sensibly (the sign is reapplied in AddSample()).
+    if (filterImportance) {
+        Float absTable[filterTableWidth * filterTableWidth];
+        for (int i = 0; i < filterTableWidth * filterTableWidth; ++i)
+            absTable[i] = std::abs(filterTable[i]);
+        filterDistribution.reset(
+            new Distribution2D(absTable, filterTableWidth, filterTableWidth));
+    }
+}
+
+// Insert _suffix_ before _filename_'s extension; the naming used for the
+// AOV images written alongside the beauty image.
+static std::string FilenameWithSuffix(const std::string &filename,
+                                      const char *suffix) {
+    size_t dot = filename.find_last_of('.');
+    if (dot == std::string::npos) return filename + suffix;
+    return filename.substr(0, dot) + suffix + filename.substr(dot);
+}
+
+void Film::LoadPreviousFrame(const std::string &file) {
+    Point2i res;
+    std::unique_ptr<RGBSpectrum[]> image = ReadImage(file, &res);
+    if (!image) {
+        Warning(
+            "Unable to read previous frame \"%s\"; temporal seeding "
+            "disabled.",
+            file.c_str());
+        return;
+    }
+    if (res != fullResolution) {
+        Warning(
+            "Previous frame \"%s\" resolution (%d, %d) doesn't match the "
+            "film's (%d, %d); temporal seeding disabled.",
+            file.c_str(), res.x, res.y, fullResolution.x, fullResolution.y);
+        return;
+    }
+    prevLuminance.resize((size_t)croppedPixelBounds.Area());
+    for (Point2i p : croppedPixelBounds)
+        prevLuminance[PixelOffset(p)] = image[p.y * res.x + p.x].y();
+
+    // Estimate each pixel's variance from its 3x3 neighborhood; the
+    // previous frame is a single converged value per pixel, so local
+    // contrast is the available stand-in for its sample variance.
+    prevVariance.resize(prevLuminance.size());
+    for (Point2i p : croppedPixelBounds) {
+        double sum = 0, sumSq = 0;
+        int n = 0;
+        for (int dy = -1; dy <= 1; ++dy)
+            for (int dx = -1; dx <= 1; ++dx) {
+                Point2i q = p + Vector2i(dx, dy);
+                if (!InsideExclusive(q, croppedPixelBounds)) continue;
+                double y = prevLuminance[PixelOffset(q)];
+                sum += y;
+                sumSq += y * y;
+                ++n;
+            }
+        double mean = sum / n;
+        prevVariance[PixelOffset(p)] =
+            (Float)std::max(0., sumSq / n - mean * mean);
+    }
+
+    // Load the previous frame's depth AOV for disocclusion gating if one
+    // was written next to it
+    std::string depthFile = FilenameWithSuffix(file, "_depth");
+    FILE *f = fopen(depthFile.c_str(), "rb");
+    if (f) {
+        fclose(f);
+        std::unique_ptr<RGBSpectrum[]> depth = ReadImage(depthFile, &res);
+        if (depth && res == fullResolution) {
+            prevDepth.resize(prevLuminance.size());
+            for (Point2i p : croppedPixelBounds)
+                prevDepth[PixelOffset(p)] = depth[p.y * res.x + p.x][0];
+        }
+    }
+    LOG(INFO) << "Loaded previous frame " << file << " for temporal seeding"
+              << (prevDepth.empty() ? " (no depth AOV found)"
+                                    : " with depth AOV");
 }
 
 Bounds2i Film::GetSampleBounds() const {
-    Bounds2f floatBounds(Floor(Point2f(croppedPixelBounds.pMin) +
+    const Bounds2i &sampleCrop =
+        bucketMode ? bucketSampleBounds : croppedPixelBounds;
+    Bounds2f floatBounds(Floor(Point2f(sampleCrop.pMin) +
                                Vector2f(0.5f, 0.5f) - filter->radius),
-                         Ceil(Point2f(croppedPixelBounds.pMax) -
+                         Ceil(Point2f(sampleCrop.pMax) -
                               Vector2f(0.5f, 0.5f) + filter->radius));
     return (Bounds2i)floatBounds;
 }
@@ -100,42 +250,444 @@ std::unique_ptr<FilmTile> Film::GetFilmTile(const Bounds2i &sampleBounds) {
     Point2i p1 = (Point2i)Floor(floatBounds.pMax - halfPixel + filter->radius) +
                  Point2i(1, 1);
     Bounds2i tilePixelBounds = Intersect(Bounds2i(p0, p1), croppedPixelBounds);
+    // A tile whose expanded bounds weren't clipped against the image is an
+    // interior tile: it holds the full filter footprint of every sample in
+    // _sampleBounds_, so FilmTile::AddSample() can skip the per-sample
+    // footprint clip. Only tiles along the image edge pay for it.
+    bool interiorTile = tilePixelBounds == Bounds2i(p0, p1);
     return std::unique_ptr<FilmTile>(new FilmTile(
         tilePixelBounds, filter->radius, filterTable, filterTableWidth,
-        maxSampleLuminance));
+        maxSampleLuminance, saveAOVs, filterDistribution.get(),
+        interiorTile));
+}
+
+// Half-precision conversion helpers for CompactPixel storage.
+static inline uint16_t FloatToHalf(float f) {
+    uint32_t bits = FloatToBits(f);
+    uint16_t sign = (bits >> 16) & 0x8000;
+    int32_t exp = ((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mant = bits & 0x7fffff;
+    if (exp <= 0) {
+        // Too small for a half denormal; flush to (signed) zero.
+        if (exp < -10) return sign;
+        // Denormal: shift the (implicit-one) mantissa into place, rounding
+        // to nearest.
+        mant |= 0x800000;
+        int shift = 14 - exp;
+        uint16_t h = sign | (mant >> shift);
+        if (mant & (1u << (shift - 1))) ++h;
+        return h;
+    } else if (exp >= 31)
+        return sign | 0x7c00;  // overflow (and infinity) -> infinity
+    // Normalized; round to nearest (a carry out of the mantissa correctly
+    // increments the exponent).
+    uint16_t h = sign | (exp << 10) | (mant >> 13);
+    if (mant & 0x1000) ++h;
+    return h;
+}
+
+static inline float HalfToFloat(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    uint32_t bits;
+    if (exp == 0) {
+        if (mant == 0)
+            bits = sign;
+        else {
+            // Denormal; normalize it.
+            exp = 127 - 15 + 1;
+            while (!(mant & 0x400)) {
+                mant <<= 1;
+                --exp;
+            }
+            bits = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+        }
+    } else if (exp == 31)
+        bits = sign | 0x7f800000 | (mant << 13);
+    else
+        bits = sign | ((exp - 15 + 127) << 23) | (mant << 13);
+    return BitsToFloat(bits);
+}
+
+// Add _v_ to the half-precision running sum *sum, keeping the rounding
+// error in the half-precision compensation term *comp (Kahan summation
+// against half rounding). The represented value is *sum - *comp.
+static inline void AddHalf(uint16_t *sum, uint16_t *comp, Float v) {
+    Float s = HalfToFloat(*sum);
+    Float y = v - HalfToFloat(*comp);
+    Float t = s + y;
+    *sum = FloatToHalf((float)t);
+    *comp = FloatToHalf((float)((HalfToFloat(*sum) - s) - y));
+}
+
+// Film framebuffer accessors; see CompactPixel in film.h.
+void Film::AddToPixel(int offset, const Float xyz[3],
+                      Float filterWeight) const {
+    if (halfPixels) {
+        CompactPixel &pixel = compactPixels[offset];
+        for (int c = 0; c < 3; ++c)
+            AddHalf(&pixel.xyz[c], &pixel.xyzC[c], xyz[c]);
+        AddHalf(&pixel.filterWeightSum, &pixel.weightC, filterWeight);
+    } else {
+        Pixel &pixel = pixels[offset];
+        for (int c = 0; c < 3; ++c) pixel.xyz[c] += xyz[c];
+        pixel.filterWeightSum += filterWeight;
+    }
+}
+
+void Film::AddSplatXYZ(int offset, const Float xyz[3]) const {
+    AtomicFloat *splat = halfPixels ? compactPixels[offset].splatXYZ
+                                    : pixels[offset].splatXYZ;
+    for (int c = 0; c < 3; ++c) splat[c].Add(xyz[c]);
+    if (displayDirty) {
+        int width = std::max(
+            1, croppedPixelBounds.pMax.x - croppedPixelBounds.pMin.x);
+        const_cast<Film *>(this)->MarkDisplayDirty((offset / width) /
+                                                   mergeShardRows);
+    }
+}
+
+void Film::SetPixelValues(int offset, const Float xyz[3],
+                          Float filterWeightSum,
+                          const Float splatXYZ[3]) const {
+    if (halfPixels) {
+        CompactPixel &pixel = compactPixels[offset];
+        for (int c = 0; c < 3; ++c) {
+            pixel.xyz[c] = FloatToHalf((float)xyz[c]);
+            pixel.xyzC[c] = 0;
+            pixel.splatXYZ[c] = splatXYZ[c];
+        }
+        pixel.filterWeightSum = FloatToHalf((float)filterWeightSum);
+        pixel.weightC = 0;
+    } else {
+        Pixel &pixel = pixels[offset];
+        for (int c = 0; c < 3; ++c) {
+            pixel.xyz[c] = xyz[c];
+            pixel.splatXYZ[c] = splatXYZ[c];
+        }
+        pixel.filterWeightSum = filterWeightSum;
+    }
+}
+
+void Film::GetPixelValues(int offset, Float xyz[3], Float *filterWeightSum,
+                          Float splatXYZ[3]) const {
+    if (halfPixels) {
+        CompactPixel &pixel = compactPixels[offset];
+        for (int c = 0; c < 3; ++c) {
+            xyz[c] = HalfToFloat(pixel.xyz[c]) - HalfToFloat(pixel.xyzC[c]);
+            splatXYZ[c] = pixel.splatXYZ[c];
+        }
+        *filterWeightSum = HalfToFloat(pixel.filterWeightSum) -
+                           HalfToFloat(pixel.weightC);
+    } else {
+        Pixel &pixel = pixels[offset];
+        for (int c = 0; c < 3; ++c) {
+            xyz[c] = pixel.xyz[c];
+            splatXYZ[c] = pixel.splatXYZ[c];
+        }
+        *filterWeightSum = pixel.filterWeightSum;
+    }
+}
+
+Float Film::PixelFilterWeightSum(int offset) const {
+    if (halfPixels)
+        return HalfToFloat(compactPixels[offset].filterWeightSum) -
+               HalfToFloat(compactPixels[offset].weightC);
+    return pixels[offset].filterWeightSum;
+}
+
+// Film::SplatBuffer Definitions
+struct Film::SplatBuffer {
+    // Power of two; the buffer is direct-mapped by pixel offset.
+    static PBRT_CONSTEXPR int bufferSize = 4096;
+    struct Entry {
+        int64_t pixelOffset = -1;
+        Float xyz[3];
+    };
+    Film *film = nullptr;
+    Entry entries[bufferSize];
+    // Deterministic mode logs every splat here instead of accumulating
+    // through _entries_; FlushSplatBuffers() sorts the union of the logs
+    // into a canonical order before applying it.
+    std::vector<Entry> log;
+};
+
+// One buffer per thread, allocated at the thread's first splat and then
+// reused (and rebound) across Films for the life of the process.
+PBRT_THREAD_LOCAL Film::SplatBuffer *Film::threadSplatBuffer;
+
+Film::SplatBuffer *Film::GetThreadSplatBuffer() {
+    SplatBuffer *buffer = threadSplatBuffer;
+    if (!buffer) {
+        buffer = new SplatBuffer;
+        threadSplatBuffer = buffer;
+    } else if (buffer->film) {
+        // The buffer is still bound to the previous render's film (which is
+        // necessarily alive: ~Film unbinds its buffers); hand any pending
+        // entries over and unregister before rebinding.
+        Film *previous = buffer->film;
+        previous->FlushSplatBuffers();
+        std::lock_guard<std::mutex> lock(previous->splatBufferMutex);
+        previous->splatBuffers.erase(
+            std::remove(previous->splatBuffers.begin(),
+                        previous->splatBuffers.end(), buffer),
+            previous->splatBuffers.end());
+    }
+    buffer->film = this;
+    std::lock_guard<std::mutex> lock(splatBufferMutex);
+    splatBuffers.push_back(buffer);
+    return buffer;
+}
+
+void Film::FlushSplatBuffers() {
+    std::lock_guard<std::mutex> lock(splatBufferMutex);
+    if (PbrtOptions.deterministic) {
+        // Gather every thread's splat log, sort the union into a canonical
+        // order (by pixel, then by value), and apply it serially: the
+        // resulting floating-point sums don't depend on which thread
+        // produced which splat or on the order threads flushed.
+        std::vector<SplatBuffer::Entry> all;
+        size_t total = 0;
+        for (SplatBuffer *buffer : splatBuffers) total += buffer->log.size();
+        all.reserve(total);
+        for (SplatBuffer *buffer : splatBuffers) {
+            all.insert(all.end(), buffer->log.begin(), buffer->log.end());
+            buffer->log.clear();
+            buffer->log.shrink_to_fit();
+        }
+        std::sort(all.begin(), all.end(),
+                  [](const SplatBuffer::Entry &a, const SplatBuffer::Entry &b) {
+                      if (a.pixelOffset != b.pixelOffset)
+                          return a.pixelOffset < b.pixelOffset;
+                      for (int i = 0; i < 3; ++i)
+                          if (a.xyz[i] != b.xyz[i]) return a.xyz[i] < b.xyz[i];
+                      return false;
+                  });
+        for (const SplatBuffer::Entry &entry : all)
+            AddSplatXYZ((int)entry.pixelOffset, entry.xyz);
+        return;
+    }
+    for (SplatBuffer *buffer : splatBuffers) {
+        for (int i = 0; i < SplatBuffer::bufferSize; ++i) {
+            SplatBuffer::Entry &entry = buffer->entries[i];
+            if (entry.pixelOffset < 0) continue;
+            AddSplatXYZ((int)entry.pixelOffset, entry.xyz);
+            entry.pixelOffset = -1;
+        }
+    }
+}
+
+void Film::ReleaseSplatBuffers() {
+    FlushSplatBuffers();
+    std::lock_guard<std::mutex> lock(splatBufferMutex);
+    for (SplatBuffer *buffer : splatBuffers) buffer->film = nullptr;
+    splatBuffers.clear();
+}
+
+std::vector<std::unique_lock<std::mutex>> Film::LockWholeFilm() {
+    std::vector<std::unique_lock<std::mutex>> locks;
+    locks.emplace_back(mutex);
+    for (int i = 0; i < nMergeShards; ++i)
+        locks.emplace_back(mergeMutexes[i]);
+    return locks;
 }
 
 void Film::Clear() {
+    // Discard splats still pending in the per-thread coalescing buffers so
+    // they can't leak into the cleared film later.
+    {
+        std::lock_guard<std::mutex> lock(splatBufferMutex);
+        for (SplatBuffer *buffer : splatBuffers) {
+            for (int i = 0; i < SplatBuffer::bufferSize; ++i)
+                buffer->entries[i].pixelOffset = -1;
+            buffer->log.clear();
+        }
+    }
+    Float zero[3] = {0, 0, 0};
+    for (Point2i p : croppedPixelBounds)
+        SetPixelValues(PixelOffset(p), zero, 0, zero);
+    std::fill(aovAlbedo.begin(), aovAlbedo.end(), 0);
+    std::fill(aovNormal.begin(), aovNormal.end(), 0);
+    std::fill(aovDepth.begin(), aovDepth.end(), 0);
+    if (splatTopLuminance)
+        for (int64_t i = 0; i < croppedPixelBounds.Area() * splatTopK; ++i)
+            splatTopLuminance[i] = 0;
+}
+
+// Film checkpoint layout: a small header followed by one record per pixel
+// of the cropped pixel bounds and then the per-tile completion flags. The
+// pixel records use plain Floats, so a checkpoint doesn't survive a change
+// of PBRT_FLOAT_AS_DOUBLE; the header guards against that.
+struct FilmCheckpointHeader {
+    uint32_t magic;      // 'pbcp'
+    uint32_t floatSize;  // sizeof(Float)
+    int32_t pMin[2], pMax[2];
+    uint64_t nTiles;
+};
+static PBRT_CONSTEXPR uint32_t filmCheckpointMagic = 0x70626370;
+
+bool Film::WriteCheckpoint(const std::string &filename,
+                           const std::vector<uint8_t> &tileCompleted) {
+    // Write to a temporary file and rename it over the old checkpoint so a
+    // render killed mid-write leaves the previous checkpoint intact.
+    std::string tmpFilename = filename + ".tmp";
+    FILE *f = fopen(tmpFilename.c_str(), "wb");
+    if (!f) {
+        Warning("Unable to open checkpoint file \"%s\" for writing",
+                tmpFilename.c_str());
+        return false;
+    }
+    FilmCheckpointHeader header;
+    header.magic = filmCheckpointMagic;
+    header.floatSize = sizeof(Float);
+    header.pMin[0] = croppedPixelBounds.pMin.x;
+    header.pMin[1] = croppedPixelBounds.pMin.y;
+    header.pMax[0] = croppedPixelBounds.pMax.x;
+    header.pMax[1] = croppedPixelBounds.pMax.y;
+    header.nTiles = tileCompleted.size();
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    {
+        // Note: splats pending in other threads' coalescing buffers aren't
+        // captured; a restored checkpoint loses at most a few thousand
+        // splats per thread, well inside checkpoint-granularity noise.
+        std::vector<std::unique_lock<std::mutex>> locks = LockWholeFilm();
+        for (Point2i p : croppedPixelBounds) {
+            Float record[7];
+            GetPixelValues(PixelOffset(p), record, &record[3], record + 4);
+            ok &= fwrite(record, sizeof(record), 1, f) == 1;
+        }
+    }
+    if (!tileCompleted.empty())
+        ok &= fwrite(&tileCompleted[0], sizeof(uint8_t), tileCompleted.size(),
+                     f) == tileCompleted.size();
+    ok &= fclose(f) == 0;
+    if (!ok || rename(tmpFilename.c_str(), filename.c_str()) != 0) {
+        Warning("Unable to write checkpoint file \"%s\"", filename.c_str());
+        remove(tmpFilename.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool Film::ReadCheckpoint(const std::string &filename,
+                          std::vector<uint8_t> *tileCompleted) {
+    FILE *f = fopen(filename.c_str(), "rb");
+    if (!f) return false;
+    FilmCheckpointHeader header;
+    if (fread(&header, sizeof(header), 1, f) != 1 ||
+        header.magic != filmCheckpointMagic ||
+        header.floatSize != sizeof(Float) ||
+        header.pMin[0] != croppedPixelBounds.pMin.x ||
+        header.pMin[1] != croppedPixelBounds.pMin.y ||
+        header.pMax[0] != croppedPixelBounds.pMax.x ||
+        header.pMax[1] != croppedPixelBounds.pMax.y) {
+        Warning("Checkpoint file \"%s\" doesn't match the current film; "
+                "ignoring it", filename.c_str());
+        fclose(f);
+        return false;
+    }
+    // Read everything before touching the film so a truncated checkpoint
+    // leaves it untouched.
+    int nPixels = croppedPixelBounds.Area();
+    std::vector<Float> records(7 * (size_t)nPixels);
+    std::vector<uint8_t> tiles(header.nTiles);
+    if ((nPixels > 0 &&
+         fread(&records[0], 7 * sizeof(Float), nPixels, f) !=
+             (size_t)nPixels) ||
+        (header.nTiles > 0 &&
+         fread(&tiles[0], sizeof(uint8_t), header.nTiles, f) !=
+             header.nTiles)) {
+        Warning("Premature end of file in checkpoint file \"%s\"",
+                filename.c_str());
+        fclose(f);
+        return false;
+    }
+    fclose(f);
+    std::vector<std::unique_lock<std::mutex>> locks = LockWholeFilm();
+    int offset = 0;
     for (Point2i p : croppedPixelBounds) {
-        Pixel &pixel = GetPixel(p);
-        for (int c = 0; c < 3; ++c)
-            pixel.splatXYZ[c] = pixel.xyz[c] = 0;
-        pixel.filterWeightSum = 0;
+        const Float *record = &records[7 * (size_t)offset];
+        SetPixelValues(PixelOffset(p), record, record[3], record + 4);
+        ++offset;
     }
+    *tileCompleted = std::move(tiles);
+    LOG(INFO) << "Restored film checkpoint from " << filename;
+    return true;
 }
 
 void Film::MergeFilmTile(std::unique_ptr<FilmTile> tile) {
     ProfilePhase p(Prof::MergeFilmTile);
     VLOG(1) << "Merging film tile " << tile->pixelBounds;
-    std::lock_guard<std::mutex> lock(mutex);
-    for (Point2i pixel : tile->GetPixelBounds()) {
-        // Merge _pixel_ into _Film::pixels_
-        const FilmTilePixel &tilePixel = tile->GetPixel(pixel);
-        Pixel &mergePixel = GetPixel(pixel);
-        Float xyz[3];
-        tilePixel.contribSum.ToXYZ(xyz);
-        for (int i = 0; i < 3; ++i) mergePixel.xyz[i] += xyz[i];
-        mergePixel.filterWeightSum += tilePixel.filterWeightSum;
+    // Lock and merge one band of rows at a time; tiles only contend where
+    // their (filter-extended) bounds overlap the same band.
+    Bounds2i bounds = tile->GetPixelBounds();
+    if (bounds.pMin.x >= bounds.pMax.x || bounds.pMin.y >= bounds.pMax.y)
+        return;
+    int shard0 = (bounds.pMin.y - croppedPixelBounds.pMin.y) / mergeShardRows;
+    int shard1 =
+        (bounds.pMax.y - 1 - croppedPixelBounds.pMin.y) / mergeShardRows;
+    for (int shard = shard0; shard <= shard1; ++shard) {
+        int y0 = std::max(bounds.pMin.y,
+                          croppedPixelBounds.pMin.y + shard * mergeShardRows);
+        int y1 = std::min(bounds.pMax.y, croppedPixelBounds.pMin.y +
+                                             (shard + 1) * mergeShardRows);
+        std::lock_guard<std::mutex> lock(mergeMutexes[shard]);
+        MarkDisplayDirty(shard);
+        int tileWidth = bounds.pMax.x - bounds.pMin.x;
+        int filmWidth = croppedPixelBounds.pMax.x - croppedPixelBounds.pMin.x;
+        for (int y = y0; y < y1; ++y)
+            for (int x = bounds.pMin.x; x < bounds.pMax.x; ++x) {
+                // Merge _pixel_ into _Film::pixels_
+                Point2i pixel(x, y);
+                const FilmTilePixel &tilePixel = tile->GetPixel(pixel);
+                Float xyz[3];
+                tilePixel.contribSum.ToXYZ(xyz);
+                AddToPixel(PixelOffset(pixel), xyz,
+                           tilePixel.filterWeightSum);
+
+                // Merge the tile's AOV planes into the film's
+                if (saveAOVs && !tile->aovDepth.empty()) {
+                    int to = (x - bounds.pMin.x) +
+                             (y - bounds.pMin.y) * tileWidth;
+                    int fo = (x - croppedPixelBounds.pMin.x) +
+                             (y - croppedPixelBounds.pMin.y) * filmWidth;
+                    for (int i = 0; i < 3; ++i) {
+                        aovAlbedo[3 * fo + i] += tile->aovAlbedo[3 * to + i];
+                        aovNormal[3 * fo + i] += tile->aovNormal[3 * to + i];
+                    }
+                    aovDepth[fo] += tile->aovDepth[to];
+                }
+            }
+    }
+}
+
+void Film::MergeFilmTileOrdered(std::unique_ptr<FilmTile> tile, int tileIndex,
+                                int tileCount) {
+    std::lock_guard<std::mutex> lock(orderedTileMutex);
+    pendingOrderedTiles[tileIndex] = std::move(tile);
+    // Apply every tile now at the head of the sequence. The mutex is held
+    // across the merges, which serializes them; that's the price of a
+    // reproducible accumulation order.
+    for (;;) {
+        auto iter = pendingOrderedTiles.find(nextOrderedTile);
+        if (iter == pendingOrderedTiles.end()) break;
+        std::unique_ptr<FilmTile> next = std::move(iter->second);
+        pendingOrderedTiles.erase(iter);
+        MergeFilmTile(std::move(next));
+        // Roll the sequence over for the next wave once every tile of this
+        // one has been merged.
+        if (++nextOrderedTile == tileCount) nextOrderedTile = 0;
     }
 }
 
 void Film::SetImage(const Spectrum *img) const {
     int nPixels = croppedPixelBounds.Area();
+    Float zero[3] = {0, 0, 0};
     for (int i = 0; i < nPixels; ++i) {
-        Pixel &p = pixels[i];
-        img[i].ToXYZ(p.xyz);
-        p.filterWeightSum = 1;
-        p.splatXYZ[0] = p.splatXYZ[1] = p.splatXYZ[2] = 0;
+        Float xyz[3];
+        img[i].ToXYZ(xyz);
+        SetPixelValues(i, xyz, 1, zero);
     }
 }
 
@@ -160,54 +712,512 @@ void Film::AddSplat(const Point2f &p, Spectrum v) {
     if (!InsideExclusive(pi, croppedPixelBounds)) return;
     if (v.y() > maxSampleLuminance)
         v *= maxSampleLuminance / v.y();
+    int width = croppedPixelBounds.pMax.x - croppedPixelBounds.pMin.x;
+    int64_t pixelOffset = (pi.x - croppedPixelBounds.pMin.x) +
+                          (pi.y - croppedPixelBounds.pMin.y) * (int64_t)width;
+    if (splatTopLuminance) {
+        // Adaptive outlier rejection: remember the pixel's _splatTopK_
+        // largest splat luminances; once all of the slots are filled, no
+        // splat may exceed the smallest of them by more than
+        // _outlierScale_.  A single firefly is clamped toward the energy
+        // the pixel's other bright splats vouch for, at the cost of a
+        // small, bounded darkening of genuinely hard caustics.
+        const Float outlierScale = 8;
+        AtomicFloat *top = &splatTopLuminance[pixelOffset * splatTopK];
+        Float y = v.y();
+        int minSlot = 0;
+        Float minVal = top[0];
+        for (int i = 1; i < splatTopK; ++i) {
+            Float ti = top[i];
+            if (ti < minVal) {
+                minVal = ti;
+                minSlot = i;
+            }
+        }
+        // A lost race just replaces a different small slot; the record
+        // only needs to be approximately the top k
+        if (y > minVal) top[minSlot] = y;
+        if (minVal > 0 && y > outlierScale * minVal)
+            v *= outlierScale * minVal / y;
+    }
     Float xyz[3];
     v.ToXYZ(xyz);
-    Pixel &pixel = GetPixel(pi);
-    for (int i = 0; i < 3; ++i) pixel.splatXYZ[i].Add(xyz[i]);
+
+    // Accumulate the splat in this thread's coalescing buffer; the shared
+    // AtomicFloats are only touched when a pixel's slot is evicted, so
+    // repeated splats near the same pixel (the common case for MLT
+    // mutations and BDPT light paths) stay thread-local.
+    SplatBuffer *buffer = threadSplatBuffer;
+    if (!buffer || buffer->film != this) buffer = GetThreadSplatBuffer();
+    if (PbrtOptions.deterministic) {
+        // Log the splat for the canonically ordered flush instead of
+        // accumulating it; see FlushSplatBuffers(). This trades memory
+        // proportional to the splat count for reproducibility.
+        SplatBuffer::Entry entry;
+        entry.pixelOffset = pixelOffset;
+        for (int i = 0; i < 3; ++i) entry.xyz[i] = xyz[i];
+        buffer->log.push_back(entry);
+        return;
+    }
+    SplatBuffer::Entry &entry =
+        buffer->entries[pixelOffset & (SplatBuffer::bufferSize - 1)];
+    if (entry.pixelOffset == pixelOffset) {
+        for (int i = 0; i < 3; ++i) entry.xyz[i] += xyz[i];
+        return;
+    }
+    if (entry.pixelOffset >= 0)
+        AddSplatXYZ((int)entry.pixelOffset, entry.xyz);
+    entry.pixelOffset = pixelOffset;
+    for (int i = 0; i < 3; ++i) entry.xyz[i] = xyz[i];
 }
 
 void Film::WriteImage(Float splatScale) {
+    // Accumulate the time spent writing images into the benchmark's
+    // "imageio" phase; the guard covers the early bucket-mode return too.
+    struct ImageIOTimer {
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        ~ImageIOTimer() {
+            BenchmarkRecordPhase(
+                "imageio", std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - start)
+                               .count());
+        }
+    } imageioTimer;
+
+    // Fold in splats still pending in the per-thread buffers; rendering is
+    // quiescent by the time the final image is written.
+    FlushSplatBuffers();
+
+    // In bucket mode, write the raw contribution buffer for "imgtool
+    // assemble" instead of an image.
+    if (bucketMode) {
+        std::string bucketFilename = filename;
+        size_t dot = bucketFilename.find_last_of('.');
+        if (dot != std::string::npos) bucketFilename.resize(dot);
+        bucketFilename += ".bucket";
+        WriteBucketFile(bucketFilename, splatScale);
+        return;
+    }
+
     // Convert image to RGB and compute final pixel values
     LOG(INFO) <<
         "Converting image to RGB and computing final weighted pixel values";
     std::unique_ptr<Float[]> rgb(new Float[3 * croppedPixelBounds.Area()]);
-    int offset = 0;
+    int width = croppedPixelBounds.pMax.x - croppedPixelBounds.pMin.x;
+    int height = croppedPixelBounds.pMax.y - croppedPixelBounds.pMin.y;
+    ParallelFor(
+        [&](int64_t row) {
+            int offset = row * width;
+            for (int x = croppedPixelBounds.pMin.x;
+                 x < croppedPixelBounds.pMax.x; ++x) {
+                // Convert pixel XYZ color to RGB
+                Float xyz[3], filterWeightSum, splatXYZ[3];
+                GetPixelValues(offset, xyz, &filterWeightSum, splatXYZ);
+                XYZToRGB(xyz, &rgb[3 * offset]);
+
+                // Normalize pixel with weight sum
+                if (filterWeightSum != 0) {
+                    Float invWt = (Float)1 / filterWeightSum;
+                    rgb[3 * offset] =
+                        std::max((Float)0, rgb[3 * offset] * invWt);
+                    rgb[3 * offset + 1] =
+                        std::max((Float)0, rgb[3 * offset + 1] * invWt);
+                    rgb[3 * offset + 2] =
+                        std::max((Float)0, rgb[3 * offset + 2] * invWt);
+                }
+
+                // Add splat value at pixel
+                Float splatRGB[3];
+                XYZToRGB(splatXYZ, splatRGB);
+                rgb[3 * offset] += splatScale * splatRGB[0];
+                rgb[3 * offset + 1] += splatScale * splatRGB[1];
+                rgb[3 * offset + 2] += splatScale * splatRGB[2];
+
+                // Scale pixel value by _scale_
+                rgb[3 * offset] *= scale;
+                rgb[3 * offset + 1] *= scale;
+                rgb[3 * offset + 2] *= scale;
+                ++offset;
+            }
+        },
+        height, 16);
+
+    // Write RGB image
+    LOG(INFO) << "Writing image " << filename << " with bounds " <<
+        croppedPixelBounds;
+    pbrt::WriteImage(filename, &rgb[0], croppedPixelBounds, fullResolution);
+
+    auto aovFilename = [this](const char *suffix) {
+        return FilenameWithSuffix(filename, suffix);
+    };
+
+    // Write AOV images alongside the beauty image
+    if (saveAOVs) {
+        int nPixels = croppedPixelBounds.Area();
+        std::unique_ptr<Float[]> plane(new Float[3 * nPixels]);
+        ParallelFor(
+            [&](int64_t offset) {
+                Float wt = PixelFilterWeightSum(offset);
+                Float invWt = (wt != 0) ? (Float)1 / wt : (Float)0;
+                for (int i = 0; i < 3; ++i)
+                    plane[3 * offset + i] = aovAlbedo[3 * offset + i] * invWt;
+            },
+            nPixels, 4096);
+        pbrt::WriteImage(aovFilename("_albedo"), &plane[0],
+                         croppedPixelBounds, fullResolution);
+        ParallelFor(
+            [&](int64_t offset) {
+                Float wt = PixelFilterWeightSum(offset);
+                Float invWt = (wt != 0) ? (Float)1 / wt : (Float)0;
+                for (int i = 0; i < 3; ++i)
+                    plane[3 * offset + i] = aovNormal[3 * offset + i] * invWt;
+            },
+            nPixels, 4096);
+        pbrt::WriteImage(aovFilename("_normal"), &plane[0],
+                         croppedPixelBounds, fullResolution);
+        ParallelFor(
+            [&](int64_t offset) {
+                Float wt = PixelFilterWeightSum(offset);
+                Float invWt = (wt != 0) ? (Float)1 / wt : (Float)0;
+                // Replicate depth across the three channels.
+                for (int i = 0; i < 3; ++i)
+                    plane[3 * offset + i] = aovDepth[offset] * invWt;
+            },
+            nPixels, 4096);
+        pbrt::WriteImage(aovFilename("_depth"), &plane[0],
+                         croppedPixelBounds, fullResolution);
+    }
+
+    // Write the render-cost heatmap if cost instrumentation is enabled
+    if (costPlane) {
+        int nPixels = croppedPixelBounds.Area();
+        Float maxCost = 0;
+        for (int offset = 0; offset < nPixels; ++offset)
+            maxCost = std::max(maxCost, (Float)costPlane[offset]);
+        LOG(INFO) << "Maximum per-pixel render cost " << maxCost;
+        // Map each pixel's cost, normalized by the maximum, through a
+        // blue-green-red ramp so the most expensive regions stand out.
+        std::unique_ptr<Float[]> plane(new Float[3 * nPixels]);
+        Float invMax = maxCost > 0 ? 1 / maxCost : 0;
+        for (int offset = 0; offset < nPixels; ++offset) {
+            Float t = costPlane[offset] * invMax;
+            Float *p = &plane[3 * offset];
+            if (t < .5f) {
+                p[0] = 0;
+                p[1] = 2 * t;
+                p[2] = 1 - 2 * t;
+            } else {
+                p[0] = 2 * t - 1;
+                p[1] = 2 - 2 * t;
+                p[2] = 0;
+            }
+        }
+        pbrt::WriteImage(aovFilename("_cost"), &plane[0], croppedPixelBounds,
+                         fullResolution);
+    }
+}
+
+bool Film::WriteBucketFile(const std::string &bucketFilename,
+                           Float splatScale) {
+    FILE *f = fopen(bucketFilename.c_str(), "wb");
+    if (!f) {
+        Error("Unable to open bucket file \"%s\" for writing",
+              bucketFilename.c_str());
+        return false;
+    }
+    FilmBucketHeader header;
+    header.magic = filmBucketMagic;
+    header.floatSize = sizeof(Float);
+    header.resolution[0] = fullResolution.x;
+    header.resolution[1] = fullResolution.y;
+    header.scale = scale;
+    header.splatScale = splatScale;
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
     for (Point2i p : croppedPixelBounds) {
-        // Convert pixel XYZ color to RGB
-        Pixel &pixel = GetPixel(p);
-        XYZToRGB(pixel.xyz, &rgb[3 * offset]);
+        Float record[7];
+        GetPixelValues(PixelOffset(p), record, &record[3], record + 4);
+        ok &= fwrite(record, sizeof(record), 1, f) == 1;
+    }
+    ok &= fclose(f) == 0;
+    if (!ok)
+        Error("Error writing bucket file \"%s\"", bucketFilename.c_str());
+    else
+        LOG(INFO) << "Wrote film bucket to " << bucketFilename;
+    return ok;
+}
+
+void Film::StartProgressivePreview(Float intervalSeconds) {
+    CHECK(!previewThread.joinable());
+    previewShutdown = false;
+    // Write the preview next to the final image: "foo.exr" -> "foo_preview.exr"
+    std::string previewFilename = filename;
+    size_t dot = previewFilename.rfind('.');
+    if (dot != std::string::npos)
+        previewFilename.insert(dot, "_preview");
+    else
+        previewFilename += "_preview";
+    previewThread = std::thread([this, intervalSeconds, previewFilename]() {
+        std::unique_lock<std::mutex> lock(previewMutex);
+        for (;;) {
+            previewCondition.wait_for(
+                lock, std::chrono::duration<Float>(intervalSeconds),
+                [this]() { return previewShutdown; });
+            if (previewShutdown) return;
+            lock.unlock();
+            WritePreviewImage(previewFilename);
+            lock.lock();
+        }
+    });
+}
+
+void Film::StopProgressivePreview() {
+    if (!previewThread.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(previewMutex);
+        previewShutdown = true;
+    }
+    previewCondition.notify_one();
+    previewThread.join();
+}
 
-        // Normalize pixel with weight sum
-        Float filterWeightSum = pixel.filterWeightSum;
+void Film::WritePreviewImage(const std::string &previewFilename) {
+    // Snapshot the pixel accumulators while holding the film mutex; the
+    // conversion and image write below work from the copy, so rendering
+    // threads are blocked for no longer than the copy takes.
+    int nPixels = croppedPixelBounds.Area();
+    std::vector<Float> snapshot(7 * (size_t)nPixels);
+    {
+        std::vector<std::unique_lock<std::mutex>> locks = LockWholeFilm();
+        int offset = 0;
+        for (Point2i p : croppedPixelBounds) {
+            Float *record = &snapshot[7 * (size_t)offset];
+            GetPixelValues(PixelOffset(p), record, &record[3], record + 4);
+            ++offset;
+        }
+    }
+
+    // Convert the snapshot to RGB as WriteImage() does and write it out
+    std::unique_ptr<Float[]> rgb(new Float[3 * nPixels]);
+    for (int offset = 0; offset < nPixels; ++offset) {
+        const Float *record = &snapshot[7 * (size_t)offset];
+        XYZToRGB(record, &rgb[3 * offset]);
+        Float filterWeightSum = record[3];
         if (filterWeightSum != 0) {
             Float invWt = (Float)1 / filterWeightSum;
-            rgb[3 * offset] = std::max((Float)0, rgb[3 * offset] * invWt);
-            rgb[3 * offset + 1] =
-                std::max((Float)0, rgb[3 * offset + 1] * invWt);
-            rgb[3 * offset + 2] =
-                std::max((Float)0, rgb[3 * offset + 2] * invWt);
+            for (int c = 0; c < 3; ++c)
+                rgb[3 * offset + c] =
+                    std::max((Float)0, rgb[3 * offset + c] * invWt);
         }
-
-        // Add splat value at pixel
         Float splatRGB[3];
-        Float splatXYZ[3] = {pixel.splatXYZ[0], pixel.splatXYZ[1],
-                             pixel.splatXYZ[2]};
-        XYZToRGB(splatXYZ, splatRGB);
-        rgb[3 * offset] += splatScale * splatRGB[0];
-        rgb[3 * offset + 1] += splatScale * splatRGB[1];
-        rgb[3 * offset + 2] += splatScale * splatRGB[2];
-
-        // Scale pixel value by _scale_
-        rgb[3 * offset] *= scale;
-        rgb[3 * offset + 1] *= scale;
-        rgb[3 * offset + 2] *= scale;
-        ++offset;
+        XYZToRGB(record + 4, splatRGB);
+        for (int c = 0; c < 3; ++c)
+            rgb[3 * offset + c] = (rgb[3 * offset + c] + splatRGB[c]) * scale;
     }
+    VLOG(1) << "Writing preview image " << previewFilename;
+    pbrt::WriteImage(previewFilename, &rgb[0], croppedPixelBounds,
+                     fullResolution);
+}
 
-    // Write RGB image
-    LOG(INFO) << "Writing image " << filename << " with bounds " <<
-        croppedPixelBounds;
-    pbrt::WriteImage(filename, &rgb[0], croppedPixelBounds, fullResolution);
+// Live display support. The display thread speaks the tev/"DisplayServer"
+// IPC protocol over TCP: each packet is a little-endian uint32 length
+// (including itself) followed by a type byte; "CreateImage" (type 4)
+// announces the image name, size, and channels, and "UpdateImage" (type 3)
+// carries one channel of a rectangle of float pixels. Only bands whose
+// dirty flag was set since the last pass are converted and sent.
+#ifndef PBRT_IS_WINDOWS
+static void DisplayAppend(std::vector<uint8_t> *buf, const void *ptr,
+                          size_t n) {
+    const uint8_t *p = (const uint8_t *)ptr;
+    buf->insert(buf->end(), p, p + n);
+}
+
+static void DisplayAppendString(std::vector<uint8_t> *buf,
+                                const std::string &s) {
+    DisplayAppend(buf, s.c_str(), s.size() + 1);
+}
+
+static void DisplayAppendInt32(std::vector<uint8_t> *buf, int32_t v) {
+    DisplayAppend(buf, &v, sizeof(v));
+}
+
+static bool DisplaySendPacket(int fd, const std::vector<uint8_t> &payload) {
+    uint32_t length = (uint32_t)payload.size() + 4;
+    uint8_t header[4] = {(uint8_t)(length), (uint8_t)(length >> 8),
+                         (uint8_t)(length >> 16), (uint8_t)(length >> 24)};
+    std::vector<uint8_t> packet;
+    packet.reserve(length);
+    DisplayAppend(&packet, header, 4);
+    DisplayAppend(&packet, payload.empty() ? nullptr : &payload[0],
+                  payload.size());
+    const uint8_t *p = &packet[0];
+    size_t n = packet.size();
+    while (n > 0) {
+        ssize_t r = write(fd, p, n);
+        if (r <= 0) return false;
+        p += r;
+        n -= r;
+    }
+    return true;
+}
+#endif  // !PBRT_IS_WINDOWS
+
+void Film::StartDisplayServer(const std::string &hostPort) {
+#ifdef PBRT_IS_WINDOWS
+    Error("--display isn't supported on Windows.");
+#else
+    CHECK(!displayThread.joinable());
+    size_t colon = hostPort.rfind(':');
+    if (colon == std::string::npos) {
+        Error("Expected \"host:port\" for --display, got \"%s\".",
+              hostPort.c_str());
+        return;
+    }
+    std::string host = hostPort.substr(0, colon);
+    struct addrinfo hints = {}, *addrs;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), hostPort.c_str() + colon + 1, &hints,
+                    &addrs) != 0) {
+        Error("Unable to resolve display server address \"%s\".",
+              hostPort.c_str());
+        return;
+    }
+    int fd = socket(addrs->ai_family, addrs->ai_socktype, addrs->ai_protocol);
+    if (fd < 0 || connect(fd, addrs->ai_addr, addrs->ai_addrlen) != 0) {
+        Error("Unable to connect to display server at \"%s\".",
+              hostPort.c_str());
+        freeaddrinfo(addrs);
+        if (fd >= 0) close(fd);
+        return;
+    }
+    freeaddrinfo(addrs);
+    LOG(INFO) << "Connected to display server at " << hostPort;
+
+    // Announce the image and its channels
+    std::vector<uint8_t> create;
+    create.push_back(4);  // CreateImage
+    create.push_back(1);  // grab focus
+    DisplayAppendString(&create, filename);
+    DisplayAppendInt32(&create,
+                       croppedPixelBounds.pMax.x - croppedPixelBounds.pMin.x);
+    DisplayAppendInt32(&create,
+                       croppedPixelBounds.pMax.y - croppedPixelBounds.pMin.y);
+    DisplayAppendInt32(&create, 3);
+    DisplayAppendString(&create, "R");
+    DisplayAppendString(&create, "G");
+    DisplayAppendString(&create, "B");
+    if (!DisplaySendPacket(fd, create)) {
+        Error("Unable to send to display server at \"%s\".",
+              hostPort.c_str());
+        close(fd);
+        return;
+    }
+    displayFd = fd;
+
+    // Start with every band dirty so the first pass sends the whole image
+    displayDirty.reset(new std::atomic<uint8_t>[nMergeShards]);
+    for (int i = 0; i < nMergeShards; ++i) displayDirty[i] = 1;
+    displayShutdown = false;
+    displayThread = std::thread([this]() {
+        std::unique_lock<std::mutex> lock(displayMutex);
+        for (;;) {
+            displayCondition.wait_for(lock, std::chrono::milliseconds(250),
+                                      [this]() { return displayShutdown; });
+            bool quit = displayShutdown;
+            lock.unlock();
+            // Send once more after shutdown so the viewer has the final
+            // state of every band.
+            bool ok = SendDisplayUpdates();
+            lock.lock();
+            if (quit || !ok) return;
+        }
+    });
+#endif  // PBRT_IS_WINDOWS
+}
+
+void Film::StopDisplayServer() {
+#ifndef PBRT_IS_WINDOWS
+    if (!displayThread.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(displayMutex);
+        displayShutdown = true;
+    }
+    displayCondition.notify_one();
+    displayThread.join();
+    close(displayFd);
+    displayFd = -1;
+    displayDirty.reset();
+#endif  // !PBRT_IS_WINDOWS
+}
+
+bool Film::SendDisplayUpdates() {
+#ifdef PBRT_IS_WINDOWS
+    return false;
+#else
+    int width = croppedPixelBounds.pMax.x - croppedPixelBounds.pMin.x;
+    int height = croppedPixelBounds.pMax.y - croppedPixelBounds.pMin.y;
+    static const char *channelNames[3] = {"R", "G", "B"};
+    for (int shard = 0; shard < nMergeShards; ++shard) {
+        if (!displayDirty[shard].exchange(0, std::memory_order_relaxed))
+            continue;
+        int y0 = shard * mergeShardRows;
+        int y1 = std::min(height, y0 + mergeShardRows);
+        int nRows = y1 - y0;
+        if (nRows <= 0 || width <= 0) continue;
+
+        // Snapshot the band's accumulators while holding its merge mutex
+        std::vector<Float> snapshot(7 * (size_t)width * nRows);
+        {
+            std::lock_guard<std::mutex> lock(mergeMutexes[shard]);
+            int i = 0;
+            for (int y = y0; y < y1; ++y)
+                for (int x = 0; x < width; ++x, ++i)
+                    GetPixelValues(y * width + x, &snapshot[7 * (size_t)i],
+                                   &snapshot[7 * (size_t)i + 3],
+                                   &snapshot[7 * (size_t)i + 4]);
+        }
+
+        // Convert the snapshot to RGB as WritePreviewImage() does
+        std::vector<float> channels[3];
+        for (int ch = 0; ch < 3; ++ch)
+            channels[ch].resize((size_t)width * nRows);
+        for (size_t i = 0; i < (size_t)width * nRows; ++i) {
+            const Float *record = &snapshot[7 * i];
+            Float rgb[3], splatRGB[3];
+            XYZToRGB(record, rgb);
+            Float filterWeightSum = record[3];
+            if (filterWeightSum != 0) {
+                Float invWt = (Float)1 / filterWeightSum;
+                for (int ch = 0; ch < 3; ++ch)
+                    rgb[ch] = std::max((Float)0, rgb[ch] * invWt);
+            }
+            XYZToRGB(record + 4, splatRGB);
+            for (int ch = 0; ch < 3; ++ch)
+                channels[ch][i] = (float)((rgb[ch] + splatRGB[ch]) * scale);
+        }
+
+        // Send one UpdateImage packet per channel for the band
+        for (int ch = 0; ch < 3; ++ch) {
+            std::vector<uint8_t> update;
+            update.push_back(3);  // UpdateImage
+            update.push_back(0);  // don't grab focus
+            DisplayAppendString(&update, filename);
+            DisplayAppendString(&update, channelNames[ch]);
+            DisplayAppendInt32(&update, 0);
+            DisplayAppendInt32(&update, y0);
+            DisplayAppendInt32(&update, width);
+            DisplayAppendInt32(&update, nRows);
+            DisplayAppend(&update, &channels[ch][0],
+                          channels[ch].size() * sizeof(float));
+            if (!DisplaySendPacket(displayFd, update)) {
+                Warning("Lost connection to display server; display "
+                        "updates disabled.");
+                return false;
+            }
+        }
+    }
+    return true;
+#endif  // PBRT_IS_WINDOWS
 }
 
 Film *CreateFilm(const ParamSet &params, std::unique_ptr<Filter> filter) {
@@ -247,8 +1257,21 @@ Film *CreateFilm(const ParamSet &params, std::unique_ptr<Filter> filter) {
     Float diagonal = params.FindOneFloat("diagonal", 35.);
     Float maxSampleLuminance = params.FindOneFloat("maxsampleluminance",
                                                    Infinity);
+    bool adaptiveSampling = params.FindOneBool("adaptivesampling", false);
+    Float adaptiveMaxError = params.FindOneFloat("adaptivemaxerror", .01f);
+    int adaptiveMinSamples = params.FindOneInt("adaptiveminsamples", 16);
+    bool saveAOVs = params.FindOneBool("aovs", false);
+    bool halfPixels = params.FindOneBool("halfprecision", false);
+    bool filterImportance = params.FindOneBool("filterimportance", false);
+    bool bucketMode = params.FindOneBool("bucket", false);
+    bool filterSplatOutliers = params.FindOneBool("filtersplatoutliers", false);
+    std::string previousFrame = params.FindOneFilename("previousframe", "");
+    int temporalPriorSamples = params.FindOneInt("temporalpriorsamples", 8);
     return new Film(Point2i(xres, yres), crop, std::move(filter), diagonal,
-                    filename, scale, maxSampleLuminance);
+                    filename, scale, maxSampleLuminance, adaptiveSampling,
+                    adaptiveMaxError, adaptiveMinSamples, saveAOVs,
+                    halfPixels, filterImportance, bucketMode,
+                    filterSplatOutliers, previousFrame, temporalPriorSamples);
 }
 
 }  // namespace pbrt
@@ -44,8 +44,22 @@
 #include "spectrum.h"
 #include "filter.h"
 #include "stats.h"
+#include "memory.h"
+#include "sampling.h"
+#include <condition_variable>
+#include <map>
+#include <thread>
 #include "parallel.h"
 
+// FilmTile::AddSample() updates each pixel's four accumulators with a
+// single SIMD multiply-add when the tile pixel layout is four packed
+// 32-bit floats (i.e., RGB spectra and single-precision Floats).
+#if defined(__SSE2__) && !defined(PBRT_FLOAT_AS_DOUBLE) && \
+    !defined(PBRT_SAMPLED_SPECTRUM)
+#include <immintrin.h>
+#define PBRT_FILM_TILE_SSE
+#endif
+
 namespace pbrt {
 
 // FilmTilePixel Declarations
@@ -54,6 +68,30 @@ struct FilmTilePixel {
     Float filterWeightSum = 0.f;
 };
 
+// AOVSample bundles the auxiliary values an integrator publishes with a
+// camera sample when the film is recording AOVs: the first hit's
+// (approximate) albedo, its shading normal, and the depth along the camera
+// ray. Pixels whose camera rays escape the scene leave all three zero.
+struct AOVSample {
+    Spectrum albedo;
+    Normal3f normal;
+    Float depth = 0;
+};
+
+// On-disk header for the contribution buffers written in bucket mode
+// (film "bool bucket"): the header is followed by one 7-Float record per
+// pixel of the full resolution (weighted XYZ sums, filter weight sum, and
+// splat XYZ sums), which "imgtool assemble" merges across shards. Records
+// use plain Floats, so buckets don't survive a change of
+// PBRT_FLOAT_AS_DOUBLE; the header guards against that.
+struct FilmBucketHeader {
+    uint32_t magic;      // 'pbbk'
+    uint32_t floatSize;  // sizeof(Float)
+    int32_t resolution[2];
+    double scale, splatScale;
+};
+static PBRT_CONSTEXPR uint32_t filmBucketMagic = 0x7062626b;
+
 // Film Declarations
 class Film {
   public:
@@ -61,15 +99,82 @@ class Film {
     Film(const Point2i &resolution, const Bounds2f &cropWindow,
          std::unique_ptr<Filter> filter, Float diagonal,
          const std::string &filename, Float scale,
-         Float maxSampleLuminance = Infinity);
+         Float maxSampleLuminance = Infinity,
+         bool adaptiveSampling = false, Float adaptiveMaxError = 0.01f,
+         int adaptiveMinSamples = 16, bool saveAOVs = false,
+         bool halfPixels = false, bool filterImportance = false,
+         bool bucketMode = false, bool filterSplatOutliers = false,
+         const std::string &previousFrameFile = "",
+         int temporalPriorSamples = 8);
+    ~Film() {
+        StopProgressivePreview();
+        StopDisplayServer();
+        ReleaseSplatBuffers();
+    }
     Bounds2i GetSampleBounds() const;
     Bounds2f GetPhysicalExtent() const;
     std::unique_ptr<FilmTile> GetFilmTile(const Bounds2i &sampleBounds);
     void MergeFilmTile(std::unique_ptr<FilmTile> tile);
+    // Deterministic-mode variant: tiles are applied to the film strictly
+    // in increasing _tileIndex_ order regardless of which thread finishes
+    // first, so pixel sums in filter-overlap regions accumulate in the
+    // same order at any thread count. Out-of-order tiles are buffered
+    // until their predecessors arrive; after _tileCount_ merges the
+    // sequence resets for the next wave.
+    void MergeFilmTileOrdered(std::unique_ptr<FilmTile> tile, int tileIndex,
+                              int tileCount);
     void SetImage(const Spectrum *img) const;
     void AddSplat(const Point2f &p, Spectrum v);
+    // Accumulate render cost (cycles) for _pPixel_; a no-op unless
+    // --costheatmap enabled the cost plane.
+    void AddPixelCost(const Point2i &pPixel, Float cost) {
+        if (costPlane && InsideExclusive(pPixel, croppedPixelBounds))
+            costPlane[PixelOffset(pPixel)].Add(cost);
+    }
     void WriteImage(Float splatScale = 1);
     void Clear();
+    // Checkpoint support for long renders: serialize the pixel accumulators
+    // (including splats) plus the caller's per-tile completion flags to
+    // _filename_, and restore them again. The write replaces any existing
+    // checkpoint atomically so a render killed mid-write loses at most one
+    // checkpoint interval.
+    bool WriteCheckpoint(const std::string &filename,
+                         const std::vector<uint8_t> &tileCompleted);
+    bool ReadCheckpoint(const std::string &filename,
+                        std::vector<uint8_t> *tileCompleted);
+    // Progressive preview: a background thread periodically snapshots the
+    // pixel accumulators (holding the film mutex only for the copy) and
+    // writes a preview image from the snapshot, so rendering threads never
+    // wait on image I/O. The preview is written next to _filename_ with a
+    // "_preview" suffix, where file-watching viewers (tev, it) pick it up.
+    void StartProgressivePreview(Float intervalSeconds);
+    void StopProgressivePreview();
+    // Live display: connect to a tev-style display server at _hostPort_
+    // ("host:port") and stream changed film regions to it while rendering.
+    // Only the bands of rows that merged a tile (or received splats) since
+    // the last update are converted and sent, so a mostly idle film costs
+    // nothing. See the protocol notes in film.cpp.
+    void StartDisplayServer(const std::string &hostPort);
+    void StopDisplayServer();
+    // Temporal accumulation across animation frames (film "string
+    // previousframe"): the previous frame's beauty image -- and its
+    // "_depth" AOV image, if one is found next to it -- seed the adaptive
+    // sampler's per-pixel statistics, so pixels that match the previous
+    // frame stop at fewer samples; see SamplerIntegrator::RenderTile().
+    bool HaveTemporalPrior() const { return !prevLuminance.empty(); }
+    Float PreviousLuminance(const Point2i &p) const {
+        return prevLuminance[PixelOffset(p)];
+    }
+    // Sample variance proxy for the previous frame's pixel, estimated from
+    // its 3x3 neighborhood at load time.
+    Float PreviousVariance(const Point2i &p) const {
+        return prevVariance[PixelOffset(p)];
+    }
+    // The previous frame's depth at _p_, or -1 if no depth AOV image was
+    // found next to the previous frame's image.
+    Float PreviousDepth(const Point2i &p) const {
+        return prevDepth.empty() ? -1 : prevDepth[PixelOffset(p)];
+    }
 
     // Film Public Data
     const Point2i fullResolution;
@@ -77,6 +182,39 @@ class Film {
     std::unique_ptr<Filter> filter;
     const std::string filename;
     Bounds2i croppedPixelBounds;
+    // Adaptive sampling parameters from the film description: when
+    // _adaptiveSampling_ is set, integrators may stop sampling a pixel --
+    // after at least _adaptiveMinSamples_ samples -- once the 95% confidence
+    // interval of its mean luminance falls below _adaptiveMaxError_ times
+    // the mean, leaving _sampler->samplesPerPixel_ as the per-pixel budget
+    // that only noisy pixels use in full.
+    const bool adaptiveSampling;
+    const Float adaptiveMaxError;
+    const int adaptiveMinSamples;
+    // Number of virtual samples a temporally seeded pixel's previous-frame
+    // value counts for in the adaptive termination test (film "integer
+    // temporalpriorsamples").
+    const int temporalPriorSamples;
+    // When set (film "bool aovs"), the film keeps albedo, normal, and depth
+    // planes alongside the beauty image and writes them as "_albedo",
+    // "_normal", and "_depth" images next to it for denoising.
+    const bool saveAOVs;
+    // When set (film "bool halfprecision"), the framebuffer stores radiance
+    // and filter weight sums as half-precision values with compensated
+    // summation, halving film memory for very large resolutions; see
+    // CompactPixel below.
+    const bool halfPixels;
+    // When set (film "bool filterimportance"), samples are assigned to a
+    // single pixel chosen by importance sampling the filter rather than
+    // being splatted over the full filter footprint; see
+    // FilmTile::AddSample().
+    const bool filterImportance;
+    // When set (film "bool bucket"), the film stores the full resolution --
+    // so splats landing outside this shard's crop window are kept rather
+    // than clipped -- restricts sampling to the crop, and writes a raw
+    // ".bucket" contribution buffer instead of an image; shards rendered
+    // with disjoint crops are merged by "imgtool assemble".
+    const bool bucketMode;
 
   private:
     // Film Private Data
@@ -87,21 +225,126 @@ class Film {
         AtomicFloat splatXYZ[3];
         Float pad;
     };
-    std::unique_ptr<Pixel[]> pixels;
+    AlignedUniquePtr<Pixel> pixels;
+    // Compact pixel used in place of Pixel when _halfPixels_ is set: the
+    // radiance and filter weight sums are stored as halfs together with
+    // half compensation terms (Kahan summation), which keeps the error
+    // bounded as per-pixel sample counts grow. Splats stay full-precision
+    // atomics--they're accumulated far more often than tile sums are
+    // merged, and atomic read-modify-write on halfs isn't available. 32
+    // bytes per pixel versus Pixel's 64.
+    struct CompactPixel {
+        CompactPixel() {
+            xyz[0] = xyz[1] = xyz[2] = 0;
+            xyzC[0] = xyzC[1] = xyzC[2] = 0;
+            filterWeightSum = weightC = 0;
+        }
+        uint16_t xyz[3], xyzC[3];
+        uint16_t filterWeightSum, weightC;
+        AtomicFloat splatXYZ[3];
+        uint32_t pad;
+    };
+    AlignedUniquePtr<CompactPixel> compactPixels;
+    // Tabulated distribution over |filterTable|, built when
+    // _filterImportance_ is set and sampled by the film's tiles.
+    std::unique_ptr<Distribution2D> filterDistribution;
+    // AOV planes, stored as separate arrays (rather than widening Pixel) so
+    // the beauty-path working set stays unchanged when AOVs are off and
+    // each plane streams cache-friendly when they're on. Weighted sums,
+    // normalized by the pixel's filterWeightSum at write time.
+    std::vector<Float> aovAlbedo, aovNormal;  // 3 * pixel count
+    std::vector<Float> aovDepth;              // pixel count
+    // Previous frame planes for temporal seeding, loaded by
+    // LoadPreviousFrame(); empty when no previous frame was given (or it
+    // couldn't be read). _prevDepth_ stays empty when the frame has no
+    // "_depth" AOV image alongside it.
+    std::vector<Float> prevLuminance, prevVariance, prevDepth;
+    void LoadPreviousFrame(const std::string &file);
+    // Per-pixel render cost accumulators (--costheatmap): integrators add
+    // the cycles spent computing each pixel's samples via AddPixelCost()
+    // and WriteImage() writes them as a normalized false-color "_cost"
+    // image.
+    std::unique_ptr<AtomicFloat[]> costPlane;  // pixel count
     static PBRT_CONSTEXPR int filterTableWidth = 16;
     Float filterTable[filterTableWidth * filterTableWidth];
+    // Tile merges lock only the horizontal bands of rows their bounds
+    // touch, so merges of distant tiles proceed concurrently instead of
+    // serializing on one film-wide mutex; whole-film operations
+    // (checkpoints, preview snapshots) take _mutex_ plus every band.
+    static PBRT_CONSTEXPR int mergeShardRows = 16;
+    std::unique_ptr<std::mutex[]> mergeMutexes;
+    int nMergeShards;
     std::mutex mutex;
     const Float scale;
     const Float maxSampleLuminance;
+    // Adaptive splat outlier rejection: a per-pixel record of the
+    // _splatTopK_ largest splat luminances seen so far; once a pixel's
+    // record is full, AddSplat() clamps splats that exceed the smallest
+    // recorded value by more than a fixed factor. (See AddSplat().)
+    static PBRT_CONSTEXPR int splatTopK = 8;
+    std::unique_ptr<AtomicFloat[]> splatTopLuminance;
+    // Per-thread splat coalescing: AddSplat() accumulates repeated splats
+    // to the same pixel in a small direct-mapped per-thread buffer and only
+    // touches the shared AtomicFloats on eviction, which removes most of
+    // the splat cache-line contention in BDPT/MLT renders at high thread
+    // counts. The registry tracks every thread's buffer so pending entries
+    // can be flushed before the image is written.
+    struct SplatBuffer;
+    static PBRT_THREAD_LOCAL SplatBuffer *threadSplatBuffer;
+    std::mutex splatBufferMutex;
+    std::vector<SplatBuffer *> splatBuffers;
+
+    // Ordered tile merging for deterministic mode (see
+    // MergeFilmTileOrdered()).
+    std::mutex orderedTileMutex;
+    std::map<int, std::unique_ptr<FilmTile>> pendingOrderedTiles;
+    int nextOrderedTile = 0;
+
+    std::thread previewThread;
+    std::mutex previewMutex;
+    std::condition_variable previewCondition;
+    bool previewShutdown = false;
+
+    // Display server state: one dirty flag per merge band, set by
+    // MergeFilmTile() and the splat eviction path and cleared by the
+    // display thread when it sends the band.
+    std::unique_ptr<std::atomic<uint8_t>[]> displayDirty;
+    std::thread displayThread;
+    std::mutex displayMutex;
+    std::condition_variable displayCondition;
+    bool displayShutdown = false;
+    int displayFd = -1;
 
     // Film Private Methods
-    Pixel &GetPixel(const Point2i &p) {
+    void WritePreviewImage(const std::string &previewFilename);
+    bool SendDisplayUpdates();
+    void MarkDisplayDirty(int shard) {
+        if (displayDirty)
+            displayDirty[shard].store(1, std::memory_order_relaxed);
+    }
+    SplatBuffer *GetThreadSplatBuffer();
+    void FlushSplatBuffers();
+    void ReleaseSplatBuffers();
+    std::vector<std::unique_lock<std::mutex>> LockWholeFilm();
+    bool WriteBucketFile(const std::string &bucketFilename, Float splatScale);
+    // In bucket mode, the crop window this shard actually samples;
+    // croppedPixelBounds covers the full resolution.
+    Bounds2i bucketSampleBounds;
+    int PixelOffset(const Point2i &p) const {
         CHECK(InsideExclusive(p, croppedPixelBounds));
         int width = croppedPixelBounds.pMax.x - croppedPixelBounds.pMin.x;
-        int offset = (p.x - croppedPixelBounds.pMin.x) +
-                     (p.y - croppedPixelBounds.pMin.y) * width;
-        return pixels[offset];
+        return (p.x - croppedPixelBounds.pMin.x) +
+               (p.y - croppedPixelBounds.pMin.y) * width;
     }
+    // Storage-mode-independent framebuffer accessors; each takes a
+    // PixelOffset() index and dispatches on _halfPixels_.
+    void AddToPixel(int offset, const Float xyz[3], Float filterWeight) const;
+    void AddSplatXYZ(int offset, const Float xyz[3]) const;
+    void SetPixelValues(int offset, const Float xyz[3], Float filterWeightSum,
+                        const Float splatXYZ[3]) const;
+    void GetPixelValues(int offset, Float xyz[3], Float *filterWeightSum,
+                        Float splatXYZ[3]) const;
+    Float PixelFilterWeightSum(int offset) const;
 };
 
 class FilmTile {
@@ -109,27 +352,90 @@ class FilmTile {
     // FilmTile Public Methods
     FilmTile(const Bounds2i &pixelBounds, const Vector2f &filterRadius,
              const Float *filterTable, int filterTableSize,
-             Float maxSampleLuminance)
+             Float maxSampleLuminance, bool saveAOVs = false,
+             const Distribution2D *filterSampler = nullptr,
+             bool interiorTile = false)
         : pixelBounds(pixelBounds),
           filterRadius(filterRadius),
           invFilterRadius(1 / filterRadius.x, 1 / filterRadius.y),
           filterTable(filterTable),
           filterTableSize(filterTableSize),
-          maxSampleLuminance(maxSampleLuminance) {
+          maxSampleLuminance(maxSampleLuminance),
+          interiorTile(interiorTile),
+          filterSampler(filterSampler),
+          rng((uint64_t)(uint32_t)pixelBounds.pMin.x << 32 |
+              (uint64_t)(uint32_t)pixelBounds.pMin.y) {
         pixels = std::vector<FilmTilePixel>(std::max(0, pixelBounds.Area()));
+        if (saveAOVs) {
+            aovAlbedo.assign(3 * pixels.size(), 0);
+            aovNormal.assign(3 * pixels.size(), 0);
+            aovDepth.assign(pixels.size(), 0);
+        }
     }
-    void AddSample(const Point2f &pFilm, Spectrum L,
-                   Float sampleWeight = 1.) {
+    void AddSample(const Point2f &pFilm, Spectrum L, Float sampleWeight = 1.,
+                   const AOVSample *aov = nullptr) {
         ProfilePhase _(Prof::AddFilmSample);
         if (L.y() > maxSampleLuminance)
             L *= maxSampleLuminance / L.y();
         // Compute sample's raster bounds
         Point2f pFilmDiscrete = pFilm - Vector2f(0.5f, 0.5f);
+
+        // Filter importance sampling: instead of splatting the sample over
+        // the full filter footprint, choose a single pixel with probability
+        // proportional to |filter| and deposit the sample there with unit
+        // weight (the sign of the filter's value at the sampled offset, for
+        // filters with negative lobes). The normalization by the pixel's
+        // filterWeightSum at image write time makes the estimator agree
+        // with the splatted one in expectation.
+        if (filterSampler) {
+            Float mapPdf;
+            Point2f u(rng.UniformFloat(), rng.UniformFloat());
+            Point2f q = filterSampler->SampleContinuous(u, &mapPdf);
+            // _q_ samples the table's positive quadrant; mirror it into the
+            // full (symmetric) filter extent.
+            Vector2f sampleOffset(q.x * filterRadius.x, q.y * filterRadius.y);
+            if (rng.UniformFloat() < .5f) sampleOffset.x = -sampleOffset.x;
+            if (rng.UniformFloat() < .5f) sampleOffset.y = -sampleOffset.y;
+            Point2i p =
+                (Point2i)Floor(pFilmDiscrete + sampleOffset +
+                               Vector2f(0.5f, 0.5f));
+            if (!InsideExclusive(p, pixelBounds)) return;
+            int qx = std::min((int)(q.x * filterTableSize),
+                              filterTableSize - 1);
+            int qy = std::min((int)(q.y * filterTableSize),
+                              filterTableSize - 1);
+            Float sign =
+                filterTable[qy * filterTableSize + qx] < 0 ? -1 : 1;
+            FilmTilePixel &pixel = GetPixel(p);
+            pixel.contribSum += L * sampleWeight * sign;
+            pixel.filterWeightSum += sign;
+            if (aov && !aovDepth.empty()) {
+                int width = pixelBounds.pMax.x - pixelBounds.pMin.x;
+                int po = (p.x - pixelBounds.pMin.x) +
+                         (p.y - pixelBounds.pMin.y) * width;
+                Float rgb[3];
+                aov->albedo.ToRGB(rgb);
+                for (int c = 0; c < 3; ++c) {
+                    aovAlbedo[3 * po + c] += sign * rgb[c];
+                    aovNormal[3 * po + c] += sign * aov->normal[c];
+                }
+                aovDepth[po] += sign * aov->depth;
+            }
+            return;
+        }
         Point2i p0 = (Point2i)Ceil(pFilmDiscrete - filterRadius);
         Point2i p1 =
             (Point2i)Floor(pFilmDiscrete + filterRadius) + Point2i(1, 1);
-        p0 = Max(p0, pixelBounds.pMin);
-        p1 = Min(p1, pixelBounds.pMax);
+        // Interior tiles (see Film::GetFilmTile()) hold the full filter
+        // footprint of every sample in their sample bounds, so the
+        // footprint never needs to be clipped against the tile.
+        if (!interiorTile) {
+            p0 = Max(p0, pixelBounds.pMin);
+            p1 = Min(p1, pixelBounds.pMax);
+        } else {
+            DCHECK(p0.x >= pixelBounds.pMin.x && p0.y >= pixelBounds.pMin.y &&
+                   p1.x <= pixelBounds.pMax.x && p1.y <= pixelBounds.pMax.y);
+        }
 
         // Loop over filter support and add sample to pixel arrays
 
@@ -146,6 +452,31 @@ class FilmTile {
                                 filterTableSize);
             ify[y - p0.y] = std::min((int)std::floor(fy), filterTableSize - 1);
         }
+#ifdef PBRT_FILM_TILE_SSE
+        // Each FilmTilePixel is four packed floats (RGB contribution plus
+        // filter weight), so the whole per-pixel update is one SIMD
+        // multiply-add; the weighted sample is splatted across each row of
+        // the footprint with one fused update per pixel. The AOV planes are
+        // laid out separately, so the (rare) AOV path stays scalar.
+        if (!aov || aovDepth.empty()) {
+            static_assert(sizeof(FilmTilePixel) == 4 * sizeof(float),
+                          "FilmTilePixel must pack into one SSE lane set");
+            Spectrum Lw = L * sampleWeight;
+            __m128 vL = _mm_setr_ps(Lw[0], Lw[1], Lw[2], 1.f);
+            for (int y = p0.y; y < p1.y; ++y) {
+                const Float *tableRow =
+                    filterTable + ify[y - p0.y] * filterTableSize;
+                float *px =
+                    reinterpret_cast<float *>(&GetPixel(Point2i(p0.x, y)));
+                for (int x = p0.x; x < p1.x; ++x, px += 4) {
+                    __m128 w = _mm_set1_ps(tableRow[ifx[x - p0.x]]);
+                    _mm_storeu_ps(
+                        px, _mm_add_ps(_mm_loadu_ps(px), _mm_mul_ps(vL, w)));
+                }
+            }
+            return;
+        }
+#endif  // PBRT_FILM_TILE_SSE
         for (int y = p0.y; y < p1.y; ++y) {
             for (int x = p0.x; x < p1.x; ++x) {
                 // Evaluate filter value at $(x,y)$ pixel
@@ -156,6 +487,21 @@ class FilmTile {
                 FilmTilePixel &pixel = GetPixel(Point2i(x, y));
                 pixel.contribSum += L * sampleWeight * filterWeight;
                 pixel.filterWeightSum += filterWeight;
+
+                // Accumulate the sample's AOV values into the tile planes
+                if (aov && !aovDepth.empty()) {
+                    int width = pixelBounds.pMax.x - pixelBounds.pMin.x;
+                    int po = (x - pixelBounds.pMin.x) +
+                             (y - pixelBounds.pMin.y) * width;
+                    Float rgb[3];
+                    aov->albedo.ToRGB(rgb);
+                    for (int c = 0; c < 3; ++c) {
+                        aovAlbedo[3 * po + c] += filterWeight * rgb[c];
+                        aovNormal[3 * po + c] +=
+                            filterWeight * aov->normal[c];
+                    }
+                    aovDepth[po] += filterWeight * aov->depth;
+                }
             }
         }
     }
@@ -182,7 +528,24 @@ class FilmTile {
     const Float *filterTable;
     const int filterTableSize;
     std::vector<FilmTilePixel> pixels;
+    // Tile-local AOV planes; empty unless the film is recording AOVs.
+    std::vector<Float> aovAlbedo, aovNormal, aovDepth;
     const Float maxSampleLuminance;
+    // True when the tile's pixel bounds contain the whole filter footprint
+    // of every sample in the sample bounds it was created for, so
+    // AddSample() can skip the per-sample footprint clip.
+    const bool interiorTile;
+    // Adaptive splat outlier rejection: a per-pixel record of the
+    // _splatTopK_ largest splat luminances seen so far; once a pixel's
+    // record is full, AddSplat() clamps splats that exceed the smallest
+    // recorded value by more than a fixed factor. (See AddSplat().)
+    static PBRT_CONSTEXPR int splatTopK = 8;
+    std::unique_ptr<AtomicFloat[]> splatTopLuminance;
+    // Filter importance sampling state: non-null when the film was created
+    // with "filterimportance"; the RNG supplies the sampling dimensions and
+    // is seeded from the tile's position.
+    const Distribution2D *filterSampler;
+    RNG rng;
     friend class Film;
 };
 
@@ -1474,6 +1474,36 @@ inline Float SphericalPhi(const Vector3f &v) {
     return (p < 0) ? (p + 2 * Pi) : p;
 }
 
+// Map a normalized direction to $[0,1]^2$ octahedral coordinates: project
+// onto the $|x|+|y|+|z|=1$ octahedron and unfold the lower hemisphere's
+// faces outward into the corners of the square. The mapping is equal-area
+// and arithmetic only--no inverse trigonometry--so lights resample their
+// spherical tables into this parameterization for cheap per-sample
+// lookups.
+inline Point2f OctahedralUV(const Vector3f &w) {
+    Float norm = std::abs(w.x) + std::abs(w.y) + std::abs(w.z);
+    Float x = w.x / norm, y = w.y / norm;
+    if (w.z < 0) {
+        Float xo = x;
+        x = (1 - std::abs(y)) * (xo >= 0 ? 1 : -1);
+        y = (1 - std::abs(xo)) * (y >= 0 ? 1 : -1);
+    }
+    return Point2f((x + 1) * .5f, (y + 1) * .5f);
+}
+
+// Inverse of OctahedralUV(); used once per texel at load to fill
+// octahedral maps.
+inline Vector3f OctahedralDirection(const Point2f &uv) {
+    Float x = 2 * uv.x - 1, y = 2 * uv.y - 1;
+    Float z = 1 - std::abs(x) - std::abs(y);
+    if (z < 0) {
+        Float xo = x;
+        x = (1 - std::abs(y)) * (xo >= 0 ? 1 : -1);
+        y = (1 - std::abs(xo)) * (y >= 0 ? 1 : -1);
+    }
+    return Normalize(Vector3f(x, y, z));
+}
+
 }  // namespace pbrt
 
 #endif  // PBRT_CORE_GEOMETRY_H
@@ -35,10 +35,17 @@
 #include "ext/lodepng.h"
 #include "ext/targa.h"
 #include "fileutil.h"
+#include "parallel.h"
 #include "spectrum.h"
 
 #include <ImfRgba.h>
 #include <ImfRgbaFile.h>
+#include <ImfThreading.h>
+
+#include <algorithm>
+#include <future>
+#include <mutex>
+#include <vector>
 
 namespace pbrt {
 
@@ -92,17 +99,21 @@ void WriteImage(const std::string &name, const Float *rgb,
         Vector2i resolution = outputBounds.Diagonal();
         std::unique_ptr<uint8_t[]> rgb8(
             new uint8_t[3 * resolution.x * resolution.y]);
-        uint8_t *dst = rgb8.get();
-        for (int y = 0; y < resolution.y; ++y) {
-            for (int x = 0; x < resolution.x; ++x) {
+        // The sRGB encoding pow() makes this loop surprisingly hot for
+        // large frames; convert rows in parallel.
+        ParallelFor(
+            [&](int64_t y) {
+                uint8_t *dst = rgb8.get() + 3 * y * resolution.x;
+                for (int x = 0; x < resolution.x; ++x) {
 #define TO_BYTE(v) (uint8_t) Clamp(255.f * GammaCorrect(v) + 0.5f, 0.f, 255.f)
-                dst[0] = TO_BYTE(rgb[3 * (y * resolution.x + x) + 0]);
-                dst[1] = TO_BYTE(rgb[3 * (y * resolution.x + x) + 1]);
-                dst[2] = TO_BYTE(rgb[3 * (y * resolution.x + x) + 2]);
+                    dst[0] = TO_BYTE(rgb[3 * (y * resolution.x + x) + 0]);
+                    dst[1] = TO_BYTE(rgb[3 * (y * resolution.x + x) + 1]);
+                    dst[2] = TO_BYTE(rgb[3 * (y * resolution.x + x) + 2]);
 #undef TO_BYTE
-                dst += 3;
-            }
-        }
+                    dst += 3;
+                }
+            },
+            resolution.y, 32);
 
         if (HasExtension(name, ".tga"))
             WriteImageTGA(name, rgb8.get(), resolution.x, resolution.y,
@@ -126,6 +137,11 @@ RGBSpectrum *ReadImageEXR(const std::string &name, int *width, int *height,
     using namespace Imf;
     using namespace Imath;
     try {
+        // Let IlmImf decompress scanline blocks on its own thread pool;
+        // the count only needs to be set once per process.
+        static std::once_flag exrThreads;
+        std::call_once(exrThreads,
+                       []() { setGlobalThreadCount(NumSystemCores()); });
         RgbaInputFile file(name.c_str());
         Box2i dw = file.dataWindow();
 
@@ -147,10 +163,19 @@ RGBSpectrum *ReadImageEXR(const std::string &name, int *width, int *height,
         file.readPixels(dw.min.y, dw.max.y);
 
         RGBSpectrum *ret = new RGBSpectrum[*width * *height];
-        for (int i = 0; i < *width * *height; ++i) {
-            Float frgb[3] = {pixels[i].r, pixels[i].g, pixels[i].b};
-            ret[i] = RGBSpectrum::FromRGB(frgb);
-        }
+        // Convert rows in parallel; half-to-float dominates this loop on
+        // large maps. (ParallelFor falls back to a serial loop if the
+        // thread pool isn't up yet.)
+        int w = *width;
+        ParallelFor(
+            [&](int64_t y) {
+                for (int x = 0; x < w; ++x) {
+                    const Rgba &p = pixels[y * w + x];
+                    Float frgb[3] = {p.r, p.g, p.b};
+                    ret[y * w + x] = RGBSpectrum::FromRGB(frgb);
+                }
+            },
+            *height, 32);
         LOG(INFO) << StringPrintf("Read EXR image %s (%d x %d)",
                                   name.c_str(), *width, *height);
         return ret;
@@ -167,25 +192,52 @@ static void WriteImageEXR(const std::string &name, const Float *pixels,
     using namespace Imf;
     using namespace Imath;
 
-    Rgba *hrgba = new Rgba[xRes * yRes];
-    for (int i = 0; i < xRes * yRes; ++i)
-        hrgba[i] = Rgba(pixels[3 * i], pixels[3 * i + 1], pixels[3 * i + 2]);
-
     // OpenEXR uses inclusive pixel bounds.
     Box2i displayWindow(V2i(0, 0), V2i(totalXRes - 1, totalYRes - 1));
     Box2i dataWindow(V2i(xOffset, yOffset),
                      V2i(xOffset + xRes - 1, yOffset + yRes - 1));
 
+    // Convert and write the image in bands of scanlines rather than all at
+    // once: this bounds the temporary half-precision buffer to two bands
+    // regardless of the image size and lets the serial EXR compression and
+    // I/O of one band overlap with the parallel conversion of the next one.
+    const int bandRows = std::min(yRes, 256);
+    std::vector<Rgba> bands[2] = {
+        std::vector<Rgba>((size_t)bandRows * xRes),
+        std::vector<Rgba>((size_t)bandRows * xRes)};
+
     try {
         RgbaOutputFile file(name.c_str(), displayWindow, dataWindow,
                             WRITE_RGB);
-        file.setFrameBuffer(hrgba - xOffset - yOffset * xRes, 1, xRes);
-        file.writePixels(yRes);
+        std::future<void> writeDone;
+        for (int y0 = 0, band = 0; y0 < yRes; y0 += bandRows, band ^= 1) {
+            int nRows = std::min(bandRows, yRes - y0);
+            Rgba *hrgba = bands[band].data();
+            // Convert this band's scanlines to half in parallel.  (This
+            // runs serially if the thread pool hasn't been started.)
+            ParallelFor(
+                [&](int64_t y) {
+                    const Float *src = pixels + 3 * (y0 + y) * xRes;
+                    Rgba *dst = hrgba + y * xRes;
+                    for (int x = 0; x < xRes; ++x, src += 3)
+                        dst[x] = Rgba(src[0], src[1], src[2]);
+                },
+                nRows, 16);
+            // Wait for the previous band to be written before reusing its
+            // buffer, then issue this band's write asynchronously.
+            if (writeDone.valid()) writeDone.get();
+            writeDone = std::async(
+                std::launch::async,
+                [&file, hrgba, xRes, xOffset, yOffset, y0, nRows]() {
+                    file.setFrameBuffer(
+                        hrgba - xOffset - (yOffset + y0) * xRes, 1, xRes);
+                    file.writePixels(nRows);
+                });
+        }
+        if (writeDone.valid()) writeDone.get();
     } catch (const std::exception &exc) {
         Error("Error writing \"%s\": %s", name.c_str(), exc.what());
     }
-
-    delete[] hrgba;
 }
 
 // TGA Function Definitions
@@ -230,23 +282,28 @@ static RGBSpectrum *ReadImageTGA(const std::string &name, int *width,
     *width = img.width;
     *height = img.height;
 
-    // "Unpack" the pixels (origin in the lower left corner).
-    // TGA pixels are in BGRA format.
+    // "Unpack" the pixels (origin in the lower left corner), converting
+    // rows in parallel. TGA pixels are in BGRA format.
     RGBSpectrum *ret = new RGBSpectrum[*width * *height];
-    RGBSpectrum *dst = ret;
-    for (int y = 0; y < *height; y++)
-        for (int x = 0; x < *width; x++) {
-            uint8_t *src = tga_find_pixel(&img, x, y);
-            if (tga_is_mono(&img))
-                *dst++ = RGBSpectrum(*src / 255.f);
-            else {
-                Float c[3];
-                c[2] = src[0] / 255.f;
-                c[1] = src[1] / 255.f;
-                c[0] = src[2] / 255.f;
-                *dst++ = RGBSpectrum::FromRGB(c);
+    int w = *width;
+    bool mono = tga_is_mono(&img);
+    ParallelFor(
+        [&](int64_t y) {
+            RGBSpectrum *dst = ret + y * w;
+            for (int x = 0; x < w; x++) {
+                uint8_t *src = tga_find_pixel(&img, x, y);
+                if (mono)
+                    *dst++ = RGBSpectrum(*src / 255.f);
+                else {
+                    Float c[3];
+                    c[2] = src[0] / 255.f;
+                    c[1] = src[1] / 255.f;
+                    c[0] = src[2] / 255.f;
+                    *dst++ = RGBSpectrum::FromRGB(c);
+                }
             }
-        }
+        },
+        *height, 32);
 
     tga_free_buffers(&img);
     LOG(INFO) << StringPrintf("Read TGA image %s (%d x %d)",
@@ -268,17 +325,25 @@ static RGBSpectrum *ReadImagePNG(const std::string &name, int *width,
     *width = w;
     *height = h;
 
+    // lodepng's inflate is a single zlib stream and can't be split
+    // across threads, but the 8-bit to float conversion can: tabulate
+    // the 256 possible values once and convert rows in parallel.
+    static Float byteToFloat[256];
+    static std::once_flag tableFlag;
+    std::call_once(tableFlag, []() {
+        for (int i = 0; i < 256; ++i) byteToFloat[i] = i / 255.f;
+    });
     RGBSpectrum *ret = new RGBSpectrum[*width * *height];
-    unsigned char *src = rgb;
-    for (unsigned int y = 0; y < h; ++y) {
-        for (unsigned int x = 0; x < w; ++x, src += 3) {
-            Float c[3];
-            c[0] = src[0] / 255.f;
-            c[1] = src[1] / 255.f;
-            c[2] = src[2] / 255.f;
-            ret[y * *width + x] = RGBSpectrum::FromRGB(c);
-        }
-    }
+    ParallelFor(
+        [&](int64_t y) {
+            unsigned char *src = rgb + y * w * 3;
+            for (unsigned int x = 0; x < w; ++x, src += 3) {
+                Float c[3] = {byteToFloat[src[0]], byteToFloat[src[1]],
+                              byteToFloat[src[2]]};
+                ret[y * w + x] = RGBSpectrum::FromRGB(c);
+            }
+        },
+        h, 32);
 
     free(rgb);
     LOG(INFO) << StringPrintf("Read PNG image %s (%d x %d)",
@@ -42,15 +42,183 @@
 #include "progressreporter.h"
 #include "camera.h"
 #include "stats.h"
+#include "texcache.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#ifndef PBRT_IS_WINDOWS
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif  // !PBRT_IS_WINDOWS
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#endif
 
 namespace pbrt {
 
+// Cheap per-sample cost counter for the --costheatmap mode: raw TSC
+// cycles on x86, nanoseconds of wall-clock time elsewhere.
+static inline uint64_t CostCycleCount() {
+#if defined(__i386__) || defined(__x86_64__)
+    return __rdtsc();
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
 STAT_COUNTER("Integrator/Camera rays traced", nCameraRays);
+STAT_COUNTER("Integrator/Samples saved by adaptive sampling",
+             nAdaptiveSamplesSaved);
+STAT_COUNTER("Integrator/Pixels seeded from previous frame",
+             nTemporalSeededPixels);
+STAT_INT_DISTRIBUTION("Integrator/Deferred shadow-ray batch size",
+                      shadowBatchSize);
+STAT_PERCENT("Integrator/Shadow rays skipped by visibility cache",
+             nShadowRaysSkipped, nShadowRayChances);
+
+// Lossy cache of shadow-ray occlusion statistics, indexed by a coarse
+// world-space voxel and the sampled light.  EstimateDirect() consults it
+// to Russian-roulette shadow rays toward lights that have been
+// consistently occluded from a region of space; traced rays'
+// contributions are scaled by the tracing probability, so the estimator
+// stays unbiased no matter what the cache returns.  Hash collisions just
+// blend statistics from unrelated (voxel, light) pairs, which can only
+// make the probabilities less effective, never incorrect.
+class LightVisibilityCache {
+  public:
+    LightVisibilityCache() : table(new std::atomic<uint32_t>[tableSize]) {
+        for (size_t i = 0; i < tableSize; ++i) table[i] = 0;
+    }
+    Float ShadowRayProbability(const Scene &scene, const Point3f &p,
+                               const Light *light) const {
+        uint32_t counts =
+            table[Slot(scene, p, light)].load(std::memory_order_relaxed);
+        uint32_t nAttempts = counts >> 16, nOccluded = counts & 0xffff;
+        // Always trace until enough statistics have accumulated, and
+        // never drop below a 1/16 tracing probability so that fully
+        // occluded statistics can't shut a light out entirely.
+        if (nAttempts < 16) return 1;
+        Float visible = Float(nAttempts - nOccluded + 1) / (nAttempts + 1);
+        return Clamp(visible, Float(1) / 16, Float(1));
+    }
+    void RecordShadowRay(const Scene &scene, const Point3f &p,
+                         const Light *light, bool occluded) {
+        std::atomic<uint32_t> &entry = table[Slot(scene, p, light)];
+        // Let the statistics freeze as the attempt count approaches
+        // saturation of its 16-bit field.
+        if ((entry.load(std::memory_order_relaxed) >> 16) >= 0xff00) return;
+        entry.fetch_add((1u << 16) + (occluded ? 1u : 0u),
+                        std::memory_order_relaxed);
+    }
+
+  private:
+    static size_t Slot(const Scene &scene, const Point3f &p,
+                       const Light *light) {
+        // Pack coarse voxel coordinates with the light's identity and mix
+        // the bits, following SpatialLightDistribution's hashing.
+        Vector3f offset = scene.WorldBound().Offset(p);
+        uint64_t h = uint64_t(uintptr_t(light));
+        for (int i = 0; i < 3; ++i)
+            h = (h << 6) | uint64_t(Clamp(int(offset[i] * 64), 0, 63));
+        h ^= (h >> 31);
+        h *= 0x7fb5d329728ea185;
+        h ^= (h >> 27);
+        h *= 0x81dadef4bc2dd44d;
+        h ^= (h >> 33);
+        return h & (tableSize - 1);
+    }
+
+    static PBRT_CONSTEXPR size_t tableSize = 1 << 20;
+    std::unique_ptr<std::atomic<uint32_t>[]> table;
+};
+
+static LightVisibilityCache &GetLightVisibilityCache() {
+    static LightVisibilityCache cache;
+    return cache;
+}
 
 // Integrator Method Definitions
 Integrator::~Integrator() {}
 
 // Integrator Utility Functions
+
+// Batched counterpart of EstimateDirect() for taking many samples of one
+// light at a surface shading point.  The per-sample loop in EstimateDirect()
+// pays a virtual BSDF::f(), a BSDF::Pdf(), and an occlusion query for every
+// light sample; here the surviving sample directions are gathered into an
+// array, the BSDF and its PDF are evaluated over the whole array with one
+// f_N() and one Pdf_N() call, the shadow rays are traced as a single
+// IntersectPN() batch, and the multiple importance sampling arithmetic runs
+// as a tight epilogue loop over the results.  The BSDF-sampling half of the
+// estimator is inherently one Sample_f() per sample; it reuses
+// EstimateDirect() with a zero-pdf light sample so only that half runs.
+static Spectrum EstimateDirectN(const SurfaceInteraction &isect,
+                                const Point2f *uScattering, const Light &light,
+                                int n, const LightLiSample *lightSamples,
+                                const Scene &scene, Sampler &sampler,
+                                MemoryArena &arena) {
+    BxDFType bsdfFlags = BxDFType(BSDF_ALL & ~BSDF_SPECULAR);
+    Spectrum Ld(0.f);
+    // Gather the light samples that can contribute into compact arrays
+    int *index = arena.Alloc<int>(n);
+    Vector3f *wi = arena.Alloc<Vector3f>(n);
+    int m = 0;
+    for (int k = 0; k < n; ++k)
+        if (lightSamples[k].pdf > 0 && !lightSamples[k].Li.IsBlack()) {
+            index[m] = k;
+            wi[m++] = lightSamples[k].wi;
+        }
+    if (m > 0) {
+        // Evaluate BSDF and scattering PDF over the direction array
+        Spectrum *f = arena.Alloc<Spectrum>(m);
+        Float *scatteringPdf = arena.Alloc<Float>(m);
+        isect.bsdf->f_N(isect.wo, wi, m, f, bsdfFlags);
+        for (int j = 0; j < m; ++j)
+            f[j] *= AbsDot(wi[j], isect.shading.n);
+        isect.bsdf->Pdf_N(isect.wo, wi, m, scatteringPdf, bsdfFlags);
+
+        // Trace the shadow rays for the non-black samples in one batch
+        Ray *rays = arena.Alloc<Ray>(m);
+        int *rayIndex = arena.Alloc<int>(m);
+        int nRays = 0;
+        for (int j = 0; j < m; ++j)
+            if (!f[j].IsBlack()) {
+                const VisibilityTester &vis = lightSamples[index[j]].vis;
+                rays[nRays] = vis.P0().SpawnRayTo(vis.P1());
+                rayIndex[nRays++] = j;
+            }
+        bool *occluded = arena.Alloc<bool>(nRays);
+        if (nRays > 0) scene.IntersectPN(RaySpan(rays, nRays), occluded);
+
+        // Fold the MIS weights into the unoccluded samples' contributions
+        for (int r = 0; r < nRays; ++r) {
+            if (occluded[r]) continue;
+            int j = rayIndex[r];
+            const LightLiSample &ls = lightSamples[index[j]];
+            Spectrum Lc = f[j] * ls.Li / ls.pdf;
+            if (!IsDeltaLight(light.flags))
+                Lc *= PowerHeuristic(1, ls.pdf, 1, scatteringPdf[j]);
+            Ld += Lc;
+        }
+    }
+
+    // Sample the BSDF for each sample's MIS counterpart strategy
+    if (!IsDeltaLight(light.flags)) {
+        LightLiSample bsdfOnly;
+        bsdfOnly.Li = Spectrum(0.f);
+        bsdfOnly.pdf = 0;
+        for (int k = 0; k < n; ++k)
+            Ld += EstimateDirect(isect, uScattering[k], light, Point2f(),
+                                 scene, sampler, arena, false, false, false,
+                                 nullptr, nullptr, Spectrum(1.f), &bsdfOnly);
+    }
+    return Ld;
+}
+
 Spectrum UniformSampleAllLights(const Interaction &it, const Scene &scene,
                                 MemoryArena &arena, Sampler &sampler,
                                 const std::vector<int> &nLightSamples,
@@ -70,21 +238,51 @@ Spectrum UniformSampleAllLights(const Interaction &it, const Scene &scene,
             L += EstimateDirect(it, uScattering, *light, uLight, scene, sampler,
                                 arena, handleMedia);
         } else {
-            // Estimate direct lighting using sample arrays
+            // Estimate direct lighting using sample arrays; take the
+            // light's samples in one batched call up front so lights with
+            // vectorized shape sampling can amortize their per-reference
+            // setup across the array.
+            std::vector<LightLiSample> lightSamples(nSamples);
+            light->Sample_LiN(it, uLightArray, nSamples, &lightSamples[0]);
             Spectrum Ld(0.f);
-            for (int k = 0; k < nSamples; ++k)
-                Ld += EstimateDirect(it, uScatteringArray[k], *light,
-                                     uLightArray[k], scene, sampler, arena,
-                                     handleMedia);
+            if (it.IsSurfaceInteraction() && !handleMedia)
+                // Evaluate the whole sample array through the batched
+                // direct-lighting kernel.
+                Ld = EstimateDirectN((const SurfaceInteraction &)it,
+                                     uScatteringArray, *light, nSamples,
+                                     &lightSamples[0], scene, sampler, arena);
+            else
+                for (int k = 0; k < nSamples; ++k)
+                    Ld += EstimateDirect(it, uScatteringArray[k], *light,
+                                         uLightArray[k], scene, sampler, arena,
+                                         handleMedia, false, false, nullptr,
+                                         nullptr, Spectrum(1.f),
+                                         &lightSamples[k]);
             L += Ld / nSamples;
         }
     }
     return L;
 }
 
+// ShadowRayQueue Method Definitions
+void ShadowRayQueue::Resolve(const Scene &scene) {
+    if (rays.empty()) return;
+    ProfilePhase p(Prof::DirectLighting);
+    ReportValue(shadowBatchSize, rays.size());
+    std::unique_ptr<bool[]> occluded(new bool[rays.size()]);
+    scene.IntersectPN(RaySpan(rays.data(), (int)rays.size()), occluded.get());
+    for (size_t i = 0; i < rays.size(); ++i)
+        if (!occluded[i]) *targets[i] += contributions[i];
+    rays.clear();
+    contributions.clear();
+    targets.clear();
+}
+
 Spectrum UniformSampleOneLight(const Interaction &it, const Scene &scene,
                                MemoryArena &arena, Sampler &sampler,
-                               bool handleMedia, const Distribution1D *lightDistrib) {
+                               bool handleMedia, const Distribution1D *lightDistrib,
+                               bool visibilityCache, ShadowRayQueue *shadowRays,
+                               Spectrum *Ldeferred, const Spectrum &beta) {
     ProfilePhase p(Prof::DirectLighting);
     // Randomly choose a single light to sample, _light_
     int nLights = int(scene.lights.size());
@@ -101,14 +299,19 @@ Spectrum UniformSampleOneLight(const Interaction &it, const Scene &scene,
     const std::shared_ptr<Light> &light = scene.lights[lightNum];
     Point2f uLight = sampler.Get2D();
     Point2f uScattering = sampler.Get2D();
-    return EstimateDirect(it, uScattering, *light, uLight,
-                          scene, sampler, arena, handleMedia) / lightPdf;
+    return EstimateDirect(it, uScattering, *light, uLight, scene, sampler,
+                          arena, handleMedia, false, visibilityCache,
+                          shadowRays, Ldeferred, beta / lightPdf) /
+           lightPdf;
 }
 
 Spectrum EstimateDirect(const Interaction &it, const Point2f &uScattering,
                         const Light &light, const Point2f &uLight,
                         const Scene &scene, Sampler &sampler,
-                        MemoryArena &arena, bool handleMedia, bool specular) {
+                        MemoryArena &arena, bool handleMedia, bool specular,
+                        bool visibilityCache, ShadowRayQueue *shadowRays,
+                        Spectrum *Ldeferred, const Spectrum &deferScale,
+                        const LightLiSample *lightSample) {
     BxDFType bsdfFlags =
         specular ? BSDF_ALL : BxDFType(BSDF_ALL & ~BSDF_SPECULAR);
     Spectrum Ld(0.f);
@@ -116,7 +319,22 @@ Spectrum EstimateDirect(const Interaction &it, const Point2f &uScattering,
     Vector3f wi;
     Float lightPdf = 0, scatteringPdf = 0;
     VisibilityTester visibility;
-    Spectrum Li = light.Sample_Li(it, uLight, &wi, &lightPdf, &visibility);
+    ShadowRayDescriptor shadow;
+    bool haveShadowDesc = false;
+    Spectrum Li;
+    if (lightSample) {
+        wi = lightSample->wi;
+        lightPdf = lightSample->pdf;
+        visibility = lightSample->vis;
+        Li = lightSample->Li;
+    } else if (!handleMedia) {
+        // The slim sampling path skips the VisibilityTester's Interaction
+        // copies; only the medium-aware Tr() path below needs the full
+        // tester.
+        Li = light.Sample_Li_Fast(it, uLight, &wi, &lightPdf, &shadow);
+        haveShadowDesc = true;
+    } else
+        Li = light.Sample_Li(it, uLight, &wi, &lightPdf, &visibility);
     VLOG(2) << "EstimateDirect uLight:" << uLight << " -> Li: " << Li << ", wi: "
             << wi << ", pdf: " << lightPdf;
     if (lightPdf > 0 && !Li.IsBlack()) {
@@ -142,12 +360,53 @@ Spectrum EstimateDirect(const Interaction &it, const Point2f &uScattering,
             if (handleMedia) {
                 Li *= visibility.Tr(scene, sampler);
                 VLOG(2) << "  after Tr, Li: " << Li;
+            } else if (shadowRays) {
+                // Defer the shadow ray: enqueue it with the contribution
+                // it stands to make so that the caller can resolve a whole
+                // batch of them with one coherent IntersectPN() pass and
+                // add the unoccluded rays' contributions to _Ldeferred_.
+                Spectrum Lc = f * Li / lightPdf;
+                if (!IsDeltaLight(light.flags))
+                    Lc *= PowerHeuristic(1, lightPdf, 1, scatteringPdf);
+                if (!Lc.IsBlack())
+                    shadowRays->Add(
+                        haveShadowDesc
+                            ? shadow.SpawnRayFrom(it)
+                            : visibility.P0().SpawnRayTo(visibility.P1()),
+                        deferScale * Lc, Ldeferred);
+                // The queued contribution replaces the immediate one
+                Li = Spectrum(0.f);
             } else {
-              if (!visibility.Unoccluded(scene)) {
+              // If enabled, consult the visibility cache and possibly skip
+              // the shadow ray by Russian roulette; traced rays report
+              // their outcome back and are reweighted by the tracing
+              // probability.
+              Float q = 1;
+              if (visibilityCache) {
+                  q = GetLightVisibilityCache().ShadowRayProbability(
+                      scene, it.p, &light);
+                  ++nShadowRayChances;
+              }
+              if (q < 1 && sampler.Get1D() >= q) {
+                ++nShadowRaysSkipped;
+                VLOG(2) << "  shadow ray skipped by visibility cache";
+                Li = Spectrum(0.f);
+              } else if (haveShadowDesc
+                             ? scene.IntersectP(shadow.SpawnRayFrom(it))
+                             : !visibility.Unoccluded(scene)) {
                 VLOG(2) << "  shadow ray blocked";
+                if (visibilityCache)
+                    GetLightVisibilityCache().RecordShadowRay(scene, it.p,
+                                                              &light, true);
                 Li = Spectrum(0.f);
-              } else
+              } else {
                 VLOG(2) << "  shadow ray unoccluded";
+                if (visibilityCache) {
+                    GetLightVisibilityCache().RecordShadowRay(scene, it.p,
+                                                              &light, false);
+                    Li /= q;
+                }
+              }
             }
 
             // Add light's contribution to reflected radiance
@@ -214,6 +473,180 @@ Spectrum EstimateDirect(const Interaction &it, const Point2f &uScattering,
     return Ld;
 }
 
+// A single-sample weighted reservoir over light samples, following the
+// resampled importance sampling formulation from Bitterli et al.,
+// "Spatiotemporal reservoir resampling for real-time ray tracing with
+// dynamic direct lighting" (2020).  A light sample is identified by the
+// light and the [0,1)^2 value given to Sample_Li(), so a reservoir can be
+// re-evaluated at a different shading point.
+struct LightReservoir {
+    const Light *light = nullptr;
+    Point2f uLight;
+    Float pHat = 0;
+    Float wSum = 0;
+    Float W = 0;
+    int M = 0;
+    void Update(const Light *l, const Point2f &u, Float targetPdf, Float w,
+                Float uRand) {
+        wSum += w;
+        ++M;
+        if (w > 0 && uRand * wSum < w) {
+            light = l;
+            uLight = u;
+            pHat = targetPdf;
+        }
+    }
+    void Finalize() { W = (pHat > 0 && M > 0) ? wSum / (M * pHat) : 0; }
+};
+
+// Recently shaded points kept per thread for reservoir reuse.  Because
+// tiles are rendered in scanline order, the last few points a thread
+// shaded are almost always nearby pixels of the same tile.
+struct ReuseRecord {
+    LightReservoir reservoir;
+    const Scene *scene = nullptr;
+    Normal3f n;
+};
+struct ReuseHistory {
+    static PBRT_CONSTEXPR int Size = 8;
+    ReuseRecord records[Size];
+    int next = 0;
+};
+static std::vector<ReuseHistory> &GetReuseHistories() {
+    static std::vector<ReuseHistory> histories(MaxThreadIndex());
+    return histories;
+}
+
+// Evaluate the reservoir target function for a light sample at _isect_:
+// the luminance of the unshadowed contribution.  Also returns the
+// contribution itself, the light's solid angle PDF, and the visibility
+// tester for the final shadow ray.
+static Float EvaluateLightSample(const SurfaceInteraction &isect,
+                                 const Light &light, const Point2f &uLight,
+                                 Float *lightPdf, Spectrum *contrib,
+                                 VisibilityTester *vis) {
+    Vector3f wi;
+    *contrib = Spectrum(0.f);
+    Spectrum Li = light.Sample_Li(isect, uLight, &wi, lightPdf, vis);
+    if (*lightPdf == 0 || Li.IsBlack()) return 0;
+    Spectrum f = isect.bsdf->f(isect.wo, wi,
+                               BxDFType(BSDF_ALL & ~BSDF_SPECULAR)) *
+                 AbsDot(wi, isect.shading.n);
+    if (f.IsBlack()) return 0;
+    *contrib = f * Li;
+    return contrib->y();
+}
+
+Spectrum ReservoirSampleOneLight(const SurfaceInteraction &isect,
+                                 const Scene &scene, MemoryArena &arena,
+                                 Sampler &sampler, int nCandidates,
+                                 const Distribution1D *lightDistrib) {
+    ProfilePhase p(Prof::DirectLighting);
+    int nLights = int(scene.lights.size());
+    if (nLights == 0 || !isect.bsdf) return Spectrum(0.f);
+
+    // Generate candidate light samples; each candidate's resampling
+    // weight is the target function over the PDF it was drawn with, so
+    // the surviving sample is approximately distributed by unshadowed
+    // contribution no matter how cheap the candidate distribution is.
+    // The candidates are generated in two passes so that all of their
+    // BSDF evaluations go through BSDF::f_N() as a single batch.
+    LightReservoir reservoir;
+    const Light **candLight = arena.Alloc<const Light *>(nCandidates, false);
+    Point2f *candU = arena.Alloc<Point2f>(nCandidates, false);
+    Vector3f *candWi = arena.Alloc<Vector3f>(nCandidates, false);
+    Spectrum *candLi = arena.Alloc<Spectrum>(nCandidates, false);
+    Spectrum *candF = arena.Alloc<Spectrum>(nCandidates, false);
+    Float *candLightPdf = arena.Alloc<Float>(nCandidates, false);
+    Float *candSelectPdf = arena.Alloc<Float>(nCandidates, false);
+    // Draw the candidates' sample values first, then select all of their
+    // lights in one batch; with many lights the distribution's alias
+    // table makes each selection a single table probe
+    Float *candSelectU = arena.Alloc<Float>(nCandidates, false);
+    int *candLightNum = arena.Alloc<int>(nCandidates, false);
+    for (int i = 0; i < nCandidates; ++i) {
+        candSelectU[i] = sampler.Get1D();
+        candU[i] = sampler.Get2D();
+    }
+    if (lightDistrib)
+        lightDistrib->SampleDiscreteN(candSelectU, nCandidates, candLightNum,
+                                      candSelectPdf);
+    else
+        for (int i = 0; i < nCandidates; ++i) {
+            candLightNum[i] =
+                std::min((int)(candSelectU[i] * nLights), nLights - 1);
+            candSelectPdf[i] = Float(1) / nLights;
+        }
+    for (int i = 0; i < nCandidates; ++i) {
+        candLight[i] = scene.lights[candLightNum[i]].get();
+        candWi[i] = Vector3f(0, 0, 1);
+        candLi[i] = Spectrum(0.f);
+        candLightPdf[i] = 0;
+        if (candSelectPdf[i] > 0) {
+            VisibilityTester vis;
+            candLi[i] = candLight[i]->Sample_Li(isect, candU[i], &candWi[i],
+                                                &candLightPdf[i], &vis);
+        }
+    }
+    isect.bsdf->f_N(isect.wo, candWi, nCandidates, candF,
+                    BxDFType(BSDF_ALL & ~BSDF_SPECULAR));
+    for (int i = 0; i < nCandidates; ++i) {
+        Float w = 0, pHat = 0;
+        if (candSelectPdf[i] > 0 && candLightPdf[i] > 0 &&
+            !candLi[i].IsBlack()) {
+            Spectrum contrib = candF[i] * AbsDot(candWi[i], isect.shading.n) *
+                               candLi[i];
+            pHat = contrib.y();
+            if (pHat > 0) w = pHat / (candSelectPdf[i] * candLightPdf[i]);
+        }
+        reservoir.Update(candLight[i], candU[i], pHat, w, sampler.Get1D());
+    }
+    reservoir.Finalize();
+
+    // Merge reservoirs from recently shaded points with similar shading
+    // normals, re-evaluating their samples' target functions here.  As
+    // with the original algorithm's biased variant, differences in
+    // visibility and geometry between the points introduce a small amount
+    // of bias in exchange for substantially lower variance.
+    LightReservoir combined = reservoir;
+    ReuseHistory &history = GetReuseHistories()[ThreadIndex];
+    for (const ReuseRecord &rec : history.records) {
+        if (rec.scene != &scene || !rec.reservoir.light) continue;
+        if (Dot(rec.n, isect.shading.n) < .9f) continue;
+        Float lightPdf;
+        Spectrum contrib;
+        VisibilityTester vis;
+        Float pHat =
+            EvaluateLightSample(isect, *rec.reservoir.light,
+                                rec.reservoir.uLight, &lightPdf, &contrib,
+                                &vis);
+        int M = std::min(rec.reservoir.M, 16 * nCandidates);
+        int MPrev = combined.M;
+        combined.Update(rec.reservoir.light, rec.reservoir.uLight, pHat,
+                        pHat * rec.reservoir.W * M, sampler.Get1D());
+        combined.M = MPrev + M;
+    }
+    combined.Finalize();
+
+    // Store this point's candidate reservoir (pre-reuse, to limit the
+    // length of reuse chains) for points shaded after it.
+    ReuseRecord &slot = history.records[history.next];
+    slot.reservoir = reservoir;
+    slot.scene = &scene;
+    slot.n = isect.shading.n;
+    history.next = (history.next + 1) % ReuseHistory::Size;
+
+    // Trace the single shadow ray for the surviving sample
+    if (!combined.light || combined.W <= 0) return Spectrum(0.f);
+    Float lightPdf;
+    Spectrum contrib;
+    VisibilityTester vis;
+    Float pHat = EvaluateLightSample(isect, *combined.light, combined.uLight,
+                                     &lightPdf, &contrib, &vis);
+    if (pHat <= 0 || !vis.Unoccluded(scene)) return Spectrum(0.f);
+    return contrib * combined.W;
+}
+
 std::unique_ptr<Distribution1D> ComputeLightPowerDistribution(
     const Scene &scene) {
     if (scene.lights.empty()) return nullptr;
@@ -225,113 +658,910 @@ std::unique_ptr<Distribution1D> ComputeLightPowerDistribution(
 }
 
 // SamplerIntegrator Method Definitions
-void SamplerIntegrator::Render(const Scene &scene) {
-    Preprocess(scene, *sampler);
-    // Render image tiles in parallel
+// SamplerIntegrator Method Definitions
+Sampler *SamplerIntegrator::TileSampler(int seed) {
+    std::unique_ptr<Sampler> &ts = threadSamplers[ThreadIndex];
+    if (!ts)
+        ts = sampler->Clone(seed);
+    else
+        ts->Reset(seed);
+    return ts.get();
+}
 
-    // Compute number of tiles, _nTiles_, to use for parallel rendering
+std::unique_ptr<FilmTile> SamplerIntegrator::RenderTile(
+    const Scene &scene, const Bounds2i &tileBounds, int seed,
+    int64_t sampleBegin, int64_t sampleEnd) {
+    // Allocate _MemoryArena_ for tile
+    MemoryArena arena;
+
+    // Get this worker thread's sampler instance for the tile
+    Sampler *tileSampler = TileSampler(seed);
+    LOG(INFO) << "Starting image tile " << tileBounds;
+
+    // Get _FilmTile_ for tile
+    std::unique_ptr<FilmTile> filmTile =
+        camera->film->GetFilmTile(tileBounds);
+
+    // Loop over pixels in tile to render them
+    for (Point2i pixel : tileBounds) {
+        {
+            ProfilePhase pp(Prof::StartPixel);
+            tileSampler->StartPixel(pixel);
+        }
+
+        // Do this check after the StartPixel() call; this keeps
+        // the usage of RNG values from (most) Samplers that use
+        // RNGs consistent, which improves reproducability /
+        // debugging.
+        if (!InsideExclusive(pixel, pixelBounds))
+            continue;
+
+        // Clamp the requested sample range to the sampler's count and jump
+        // to its first sample; SetSampleNumber() continues the pixel's
+        // sequence exactly where the previous wave stopped.
+        int64_t lastSample = tileSampler->samplesPerPixel;
+        if (sampleEnd >= 0) lastSample = std::min(lastSample, sampleEnd);
+        if (sampleBegin >= lastSample) continue;
+        if (sampleBegin > 0 && !tileSampler->SetSampleNumber(sampleBegin))
+            continue;
+
+        // Per-pixel running luminance statistics for adaptive sampling
+        // (Welford's online mean and sum of squared deviations).
+        // _nPixelSamples_ includes any virtual samples from temporal
+        // seeding below; _nRealSamples_ counts only this frame's.
+        int64_t nPixelSamples = 0, nRealSamples = 0;
+        double meanLuminance = 0, m2Luminance = 0;
+        bool seedPending =
+            camera->film->HaveTemporalPrior() &&
+            InsideExclusive(pixel, camera->film->croppedPixelBounds);
+        // Cycles this pixel's Li() calls cost, for the --costheatmap mode
+        uint64_t pixelCost = 0;
+        do {
+            // Initialize _CameraSample_ for current sample
+            CameraSample cameraSample =
+                tileSampler->GetCameraSample(pixel);
+
+            // Generate camera ray for current sample
+            RayDifferential ray;
+            Float rayWeight =
+                camera->GenerateRayDifferential(cameraSample, &ray);
+            ray.ScaleDifferentials(
+                1 / std::sqrt((Float)tileSampler->samplesPerPixel));
+            ++nCameraRays;
+
+            // Evaluate radiance along camera ray
+            Spectrum L(0.f);
+            if (rayWeight > 0) {
+                if (PbrtOptions.costHeatmap) {
+                    uint64_t costStart = CostCycleCount();
+                    L = Li(ray, scene, *tileSampler, arena);
+                    pixelCost += CostCycleCount() - costStart;
+                } else
+                    L = Li(ray, scene, *tileSampler, arena);
+            }
+
+            // Issue warning if unexpected radiance value returned
+            if (L.HasNaNs()) {
+                LOG(ERROR) << StringPrintf(
+                    "Not-a-number radiance value returned "
+                    "for pixel (%d, %d), sample %d. Setting to black.",
+                    pixel.x, pixel.y,
+                    (int)tileSampler->CurrentSampleNumber());
+                L = Spectrum(0.f);
+            } else if (L.y() < -1e-5) {
+                LOG(ERROR) << StringPrintf(
+                    "Negative luminance value, %f, returned "
+                    "for pixel (%d, %d), sample %d. Setting to black.",
+                    L.y(), pixel.x, pixel.y,
+                    (int)tileSampler->CurrentSampleNumber());
+                L = Spectrum(0.f);
+            } else if (std::isinf(L.y())) {
+                  LOG(ERROR) << StringPrintf(
+                    "Infinite luminance value returned "
+                    "for pixel (%d, %d), sample %d. Setting to black.",
+                    pixel.x, pixel.y,
+                    (int)tileSampler->CurrentSampleNumber());
+                L = Spectrum(0.f);
+            }
+            VLOG(1) << "Camera sample: " << cameraSample << " -> ray: " <<
+                ray << " -> L = " << L;
+
+            // Compute AOV values for camera ray if requested
+            AOVSample aov;
+            bool haveAOV = false;
+            if (camera->film->saveAOVs && rayWeight > 0) {
+                haveAOV = true;
+                RayDifferential aovRay(ray);
+                SurfaceInteraction isect;
+                if (scene.Intersect(aovRay, &isect)) {
+                    aov.depth = Distance(aovRay.o, isect.p);
+                    aov.normal = Faceforward(isect.shading.n, -aovRay.d);
+                    isect.ComputeScatteringFunctions(aovRay, arena);
+                    if (isect.bsdf) {
+                        // Use fixed sample points so the albedo estimate
+                        // is consistent across pixels.
+                        static const Point2f rhoSamples[4] = {
+                            Point2f(0.25f, 0.25f), Point2f(0.75f, 0.25f),
+                            Point2f(0.25f, 0.75f), Point2f(0.75f, 0.75f)};
+                        aov.albedo = isect.bsdf->rho(isect.wo, 4, rhoSamples);
+                    }
+                }
+            }
+
+            // Add camera ray's contribution to image
+            filmTile->AddSample(cameraSample.pFilm, L, rayWeight,
+                                haveAOV ? &aov : nullptr);
+
+            // Free _MemoryArena_ memory from computing image sample
+            // value
+            arena.Reset();
+
+            // Stop sampling this pixel early if its mean luminance has
+            // converged and adaptive sampling is enabled
+            if (camera->film->adaptiveSampling) {
+                // Seed the pixel's statistics from the previous frame
+                // before the first sample is folded in: where the first
+                // hit's depth agrees with the previous frame's depth AOV
+                // (or no depth plane is available), the previous frame's
+                // pixel stands in for _temporalPriorSamples_ virtual
+                // samples with its neighborhood variance, so temporally
+                // stable pixels reach the termination test sooner. The
+                // prior only affects when sampling stops; the film only
+                // ever accumulates this frame's samples. With no motion
+                // vector AOV, reuse is same-pixel and depth-gated, which
+                // covers small-motion animation and fails safe otherwise.
+                if (seedPending) {
+                    seedPending = false;
+                    Float prevDepth = camera->film->PreviousDepth(pixel);
+                    if (prevDepth < 0 ||
+                        (haveAOV && std::abs(aov.depth - prevDepth) <=
+                                        .05f * prevDepth)) {
+                        int nPrior = camera->film->temporalPriorSamples;
+                        nPixelSamples = nPrior;
+                        meanLuminance =
+                            camera->film->PreviousLuminance(pixel);
+                        m2Luminance =
+                            (double)camera->film->PreviousVariance(pixel) *
+                            std::max(1, nPrior - 1);
+                        ++nTemporalSeededPixels;
+                    }
+                }
+                ++nPixelSamples;
+                ++nRealSamples;
+                double y = L.y();
+                double delta = y - meanLuminance;
+                meanLuminance += delta / nPixelSamples;
+                m2Luminance += delta * (y - meanLuminance);
+                // Seeded pixels still take a minimum share of real
+                // samples before they may stop, so a stale prior can't
+                // shut a pixel off on its own.
+                if (nPixelSamples >= camera->film->adaptiveMinSamples &&
+                    nRealSamples >=
+                        (camera->film->adaptiveMinSamples + 3) / 4 &&
+                    meanLuminance > 0) {
+                    // Width of the mean's 95% confidence interval, from the
+                    // sample variance of the mean
+                    double error =
+                        1.96 * std::sqrt(m2Luminance / (nPixelSamples *
+                                                        (nPixelSamples - 1)));
+                    if (error <=
+                        camera->film->adaptiveMaxError * meanLuminance) {
+                        nAdaptiveSamplesSaved +=
+                            tileSampler->samplesPerPixel - nRealSamples;
+                        break;
+                    }
+                }
+            }
+        } while (tileSampler->StartNextSample() &&
+                 tileSampler->CurrentSampleNumber() < lastSample);
+
+        // Accumulate the pixel's cost into the film's heatmap plane
+        if (pixelCost > 0)
+            camera->film->AddPixelCost(pixel, (Float)pixelCost);
+    }
+    LOG(INFO) << "Finished image tile " << tileBounds;
+    return filmTile;
+}
+
+#ifndef PBRT_IS_WINDOWS
+// Distributed rendering support. The coordinator listens on a TCP port,
+// hands 16x16 film tiles to each connecting worker process, and merges the
+// returned tile pixels through the regular Film::MergeFilmTile path while
+// rendering tiles locally itself. Workers parse the same scene file (the
+// farm shares a filesystem), connect, and render whatever they're handed.
+// Tile and pixel records go over the wire as raw structs and Floats, which
+// assumes a homogeneous farm: same endianness and PBRT_FLOAT_AS_DOUBLE
+// setting on every node.
+struct DistTileMsg {
+    int32_t type;  // DistTile or DistDone
+    int32_t x0, y0, x1, y1;
+    int32_t seed;
+};
+static PBRT_CONSTEXPR int32_t DistTile = 1, DistDone = 2;
+
+static bool ReadFully(int fd, void *ptr, size_t n) {
+    uint8_t *p = (uint8_t *)ptr;
+    while (n > 0) {
+        ssize_t r = read(fd, p, n);
+        if (r <= 0) return false;
+        p += r;
+        n -= r;
+    }
+    return true;
+}
+
+static bool WriteFully(int fd, const void *ptr, size_t n) {
+    const uint8_t *p = (const uint8_t *)ptr;
+    while (n > 0) {
+        ssize_t r = write(fd, p, n);
+        if (r <= 0) return false;
+        p += r;
+        n -= r;
+    }
+    return true;
+}
+#endif  // !PBRT_IS_WINDOWS
+
+void SamplerIntegrator::RenderWorker(const Scene &scene) {
+#ifdef PBRT_IS_WINDOWS
+    Error("Distributed rendering isn't supported on Windows.");
+#else
+    // Connect to the coordinator at _host:port_
+    const std::string &spec = PbrtOptions.distWorkerAddress;
+    size_t colon = spec.rfind(':');
+    if (colon == std::string::npos) {
+        Error("Expected \"host:port\" for --distworker, got \"%s\".",
+              spec.c_str());
+        return;
+    }
+    std::string host = spec.substr(0, colon);
+    struct addrinfo hints = {}, *addrs;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), spec.c_str() + colon + 1, &hints, &addrs) !=
+        0) {
+        Error("Unable to resolve coordinator address \"%s\".", spec.c_str());
+        return;
+    }
+    int fd = socket(addrs->ai_family, addrs->ai_socktype, addrs->ai_protocol);
+    if (fd < 0 || connect(fd, addrs->ai_addr, addrs->ai_addrlen) != 0) {
+        Error("Unable to connect to coordinator at \"%s\".", spec.c_str());
+        freeaddrinfo(addrs);
+        return;
+    }
+    freeaddrinfo(addrs);
+    LOG(INFO) << "Connected to coordinator at " << spec;
+
+    // Render tiles from the coordinator until it says we're done
+    for (;;) {
+        DistTileMsg msg;
+        if (!ReadFully(fd, &msg, sizeof(msg)) || msg.type != DistTile) break;
+        Bounds2i tileBounds(Point2i(msg.x0, msg.y0), Point2i(msg.x1, msg.y1));
+        std::unique_ptr<FilmTile> filmTile =
+            RenderTile(scene, tileBounds, msg.seed);
+
+        // Send the tile's pixels back to the coordinator
+        Bounds2i tilePixelBounds = filmTile->GetPixelBounds();
+        std::vector<Float> data;
+        data.reserve((size_t)tilePixelBounds.Area() *
+                     (Spectrum::nSamples + 1));
+        for (Point2i p : tilePixelBounds) {
+            const FilmTilePixel &pixel = filmTile->GetPixel(p);
+            for (int c = 0; c < Spectrum::nSamples; ++c)
+                data.push_back(pixel.contribSum[c]);
+            data.push_back(pixel.filterWeightSum);
+        }
+        int32_t header[4] = {tilePixelBounds.pMin.x, tilePixelBounds.pMin.y,
+                             tilePixelBounds.pMax.x, tilePixelBounds.pMax.y};
+        if (!WriteFully(fd, header, sizeof(header)) ||
+            (!data.empty() &&
+             !WriteFully(fd, &data[0], data.size() * sizeof(Float))))
+            break;
+    }
+    close(fd);
+    LOG(INFO) << "Worker finished; coordinator closed the connection";
+#endif  // PBRT_IS_WINDOWS
+}
+
+void SamplerIntegrator::RenderCoordinator(const Scene &scene) {
+#ifdef PBRT_IS_WINDOWS
+    Error("Distributed rendering isn't supported on Windows.");
+#else
+    // The tiles are rendered on remote workers, so the local thread count
+    // and timing history that drive ChooseTileSize() don't apply; keep the
+    // fixed 16x16 tiling. (The tile bounds travel with each message, so
+    // the workers never recompute the decomposition.)
     Bounds2i sampleBounds = camera->film->GetSampleBounds();
     Vector2i sampleExtent = sampleBounds.Diagonal();
     const int tileSize = 16;
     Point2i nTiles((sampleExtent.x + tileSize - 1) / tileSize,
                    (sampleExtent.y + tileSize - 1) / tileSize);
-    ProgressReporter reporter(nTiles.x * nTiles.y, "Rendering");
-    {
-        ParallelFor2D([&](Point2i tile) {
-            // Render section of image corresponding to _tile_
-
-            // Allocate _MemoryArena_ for tile
-            MemoryArena arena;
+    int totalTiles = nTiles.x * nTiles.y;
+    auto tileBoundsFor = [&](int i) {
+        Point2i tile(i % nTiles.x, i / nTiles.x);
+        int x0 = sampleBounds.pMin.x + tile.x * tileSize;
+        int x1 = std::min(x0 + tileSize, sampleBounds.pMax.x);
+        int y0 = sampleBounds.pMin.y + tile.y * tileSize;
+        int y1 = std::min(y0 + tileSize, sampleBounds.pMax.y);
+        return Bounds2i(Point2i(x0, y0), Point2i(x1, y1));
+    };
 
-            // Get sampler instance for tile
-            int seed = tile.y * nTiles.x + tile.x;
-            std::unique_ptr<Sampler> tileSampler = sampler->Clone(seed);
+    // Shared tile queue; tiles that were in flight on a failed connection
+    // are pushed back for someone else to render.
+    std::mutex queueMutex;
+    std::vector<int> pendingTiles(totalTiles);
+    for (int i = 0; i < totalTiles; ++i) pendingTiles[i] = totalTiles - 1 - i;
+    std::atomic<int> tilesMerged{0};
+    ProgressReporter reporter(totalTiles, "Rendering");
+    auto takeTile = [&]() {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        if (pendingTiles.empty()) return -1;
+        int tileIndex = pendingTiles.back();
+        pendingTiles.pop_back();
+        return tileIndex;
+    };
+    auto requeueTile = [&](int tileIndex) {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        pendingTiles.push_back(tileIndex);
+    };
 
-            // Compute sample bounds for tile
-            int x0 = sampleBounds.pMin.x + tile.x * tileSize;
-            int x1 = std::min(x0 + tileSize, sampleBounds.pMax.x);
-            int y0 = sampleBounds.pMin.y + tile.y * tileSize;
-            int y1 = std::min(y0 + tileSize, sampleBounds.pMax.y);
-            Bounds2i tileBounds(Point2i(x0, y0), Point2i(x1, y1));
-            LOG(INFO) << "Starting image tile " << tileBounds;
+    // Listen for worker connections
+    int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(PbrtOptions.distCoordinatorPort);
+    if (listenFd < 0 || bind(listenFd, (sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(listenFd, 16) != 0) {
+        Error("Unable to listen on port %d.", PbrtOptions.distCoordinatorPort);
+        return;
+    }
+    LOG(INFO) << "Coordinating render on port "
+              << PbrtOptions.distCoordinatorPort;
 
-            // Get _FilmTile_ for tile
+    // Serve one connected worker: hand out tiles, merge results
+    auto serveWorker = [&](int fd) {
+        for (;;) {
+            int tileIndex = takeTile();
+            if (tileIndex < 0) {
+                DistTileMsg msg = {};
+                msg.type = DistDone;
+                WriteFully(fd, &msg, sizeof(msg));
+                break;
+            }
+            Bounds2i tileBounds = tileBoundsFor(tileIndex);
+            DistTileMsg msg = {DistTile, tileBounds.pMin.x, tileBounds.pMin.y,
+                               tileBounds.pMax.x, tileBounds.pMax.y,
+                               tileIndex};
             std::unique_ptr<FilmTile> filmTile =
                 camera->film->GetFilmTile(tileBounds);
+            Bounds2i tilePixelBounds = filmTile->GetPixelBounds();
+            int32_t header[4];
+            std::vector<Float> data((size_t)tilePixelBounds.Area() *
+                                    (Spectrum::nSamples + 1));
+            if (!WriteFully(fd, &msg, sizeof(msg)) ||
+                !ReadFully(fd, header, sizeof(header)) ||
+                (!data.empty() &&
+                 !ReadFully(fd, &data[0], data.size() * sizeof(Float)))) {
+                // The connection died with a tile in flight; put the tile
+                // back so it gets rendered by someone else.
+                requeueTile(tileIndex);
+                break;
+            }
+            if (header[0] != tilePixelBounds.pMin.x ||
+                header[1] != tilePixelBounds.pMin.y ||
+                header[2] != tilePixelBounds.pMax.x ||
+                header[3] != tilePixelBounds.pMax.y) {
+                Warning("Worker returned mismatched tile bounds; dropping "
+                        "the connection.");
+                requeueTile(tileIndex);
+                break;
+            }
+            size_t offset = 0;
+            for (Point2i p : tilePixelBounds) {
+                FilmTilePixel &pixel = filmTile->GetPixel(p);
+                Spectrum contrib;
+                for (int c = 0; c < Spectrum::nSamples; ++c)
+                    contrib[c] = data[offset++];
+                pixel.contribSum = contrib;
+                pixel.filterWeightSum = data[offset++];
+            }
+            camera->film->MergeFilmTile(std::move(filmTile));
+            ++tilesMerged;
+            reporter.Update();
+        }
+        close(fd);
+    };
+    std::mutex connectionMutex;
+    std::vector<std::thread> connectionThreads;
+    std::thread acceptThread([&]() {
+        for (;;) {
+            int fd = accept(listenFd, nullptr, nullptr);
+            if (fd < 0) break;  // the listening socket was shut down
+            LOG(INFO) << "Worker connected";
+            std::lock_guard<std::mutex> lock(connectionMutex);
+            connectionThreads.push_back(std::thread(serveWorker, fd));
+        }
+    });
+
+    // Render tiles locally while the workers chew on theirs
+    ParallelFor(
+        [&](int64_t) {
+            int tileIndex = takeTile();
+            if (tileIndex < 0) return;
+            std::unique_ptr<FilmTile> filmTile =
+                RenderTile(scene, tileBoundsFor(tileIndex), tileIndex);
+            camera->film->MergeFilmTile(std::move(filmTile));
+            ++tilesMerged;
+            reporter.Update();
+        },
+        totalTiles, 1);
+
+    // Wait for the remaining in-flight tiles, rendering any that come back
+    // from failed connections. A worker that hangs without dropping its
+    // connection will stall the render here, as it would any farm.
+    while (tilesMerged < totalTiles) {
+        int tileIndex = takeTile();
+        if (tileIndex < 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            continue;
+        }
+        std::unique_ptr<FilmTile> filmTile =
+            RenderTile(scene, tileBoundsFor(tileIndex), tileIndex);
+        camera->film->MergeFilmTile(std::move(filmTile));
+        ++tilesMerged;
+        reporter.Update();
+    }
+
+    // Shut down the listening socket and the per-connection threads
+    shutdown(listenFd, SHUT_RDWR);
+    close(listenFd);
+    acceptThread.join();
+    {
+        std::lock_guard<std::mutex> lock(connectionMutex);
+        for (std::thread &t : connectionThreads) t.join();
+    }
+    reporter.Done();
+    LOG(INFO) << "Rendering finished";
+    camera->film->WriteImage();
+#endif  // PBRT_IS_WINDOWS
+}
+
+// Relative spread (standard deviation over mean) of the previous frame's
+// measured per-tile render times; zero when no history is available.
+static Float TileCostVariation(const std::vector<Float> &tileSeconds) {
+    if (tileSeconds.empty()) return 0;
+    double sum = 0, sumSq = 0;
+    for (Float t : tileSeconds) {
+        sum += t;
+        sumSq += (double)t * t;
+    }
+    double mean = sum / tileSeconds.size();
+    if (mean <= 0) return 0;
+    double variance =
+        std::max(0., sumSq / tileSeconds.size() - mean * mean);
+    return (Float)(std::sqrt(variance) / mean);
+}
+
+// Choose the square tile edge for decomposing _sampleExtent_ into parallel
+// work. 16x16 is a good default, but cheap tiles (low sample counts)
+// amortize their fixed costs--sampler cloning, film tile allocation and
+// merging--poorly, and strongly uneven per-tile costs are easier to
+// balance from smaller pieces. _tileCostVariation_ comes from
+// TileCostVariation() above.
+static int ChooseTileSize(const Vector2i &sampleExtent, int64_t spp,
+                          Float tileCostVariation) {
+    int nThreads = std::max(1, MaxThreadIndex());
+    auto nTilesFor = [&](int ts) {
+        return (int64_t)((sampleExtent.x + ts - 1) / ts) *
+               ((sampleExtent.y + ts - 1) / ts);
+    };
+    int tileSize = 16;
+    if (spp <= 16 && tileCostVariation < .5f)
+        tileSize = 32;
+    else if (tileCostVariation > 1.5f)
+        tileSize = 8;
+    // Whatever the cost arguments suggest, keep a comfortable surplus of
+    // tiles per thread for load balancing, but don't decompose into so
+    // many pieces that per-tile overheads dominate.
+    while (tileSize < 64 && nTilesFor(tileSize) > 16384) tileSize *= 2;
+    while (tileSize > 8 && nTilesFor(tileSize) < 16 * nThreads) tileSize /= 2;
+    VLOG(1) << "Chose tile size " << tileSize << " (" << nTilesFor(tileSize)
+            << " tiles, " << nThreads << " threads, " << spp
+            << " spp, cost variation " << tileCostVariation << ")";
+    return tileSize;
+}
+
+void SamplerIntegrator::RenderProgressive(const Scene &scene) {
+    // Compute number of tiles, _nTiles_, to use for parallel rendering
+    Bounds2i sampleBounds = camera->film->GetSampleBounds();
+    Vector2i sampleExtent = sampleBounds.Diagonal();
+    // Deterministic mode keeps the traditional 16x16 tile; the adaptive
+    // size depends on the machine's thread count, which would change the
+    // tile seeds and merge order from machine to machine.
+    const int tileSize =
+        PbrtOptions.deterministic
+            ? 16
+            : ChooseTileSize(sampleExtent, sampler->samplesPerPixel, 0);
+    Point2i nTiles((sampleExtent.x + tileSize - 1) / tileSize,
+                   (sampleExtent.y + tileSize - 1) / tileSize);
+
+    // Start the progressive preview thread and display server connection,
+    // if requested
+    if (PbrtOptions.previewSeconds > 0)
+        camera->film->StartProgressivePreview(
+            (Float)PbrtOptions.previewSeconds);
+    if (!PbrtOptions.displayServer.empty())
+        camera->film->StartDisplayServer(PbrtOptions.displayServer);
 
-            // Loop over pixels in tile to render them
-            for (Point2i pixel : tileBounds) {
-                {
-                    ProfilePhase pp(Prof::StartPixel);
-                    tileSampler->StartPixel(pixel);
+    // Cover the film in doubling sample-count waves. Tiles reuse the same
+    // sampler seed every wave, so the wave's sample range continues each
+    // pixel's sequence exactly and the accumulated film after the last
+    // wave matches a non-progressive render at full sample count.
+    int64_t spp = sampler->samplesPerPixel;
+    int wave = 0;
+    // Texture tiles each film tile faulted in the previous wave; the next
+    // wave prefetches them before re-rendering the tile.
+    std::vector<std::vector<uint64_t>> waveTextureTiles(nTiles.x * nTiles.y),
+        prevWaveTextureTiles;
+    for (int64_t s0 = 0, s1 = 1; s0 < spp;
+         s0 = s1, s1 = std::min(2 * s1, spp), ++wave) {
+        ProgressReporter reporter(
+            nTiles.x * nTiles.y,
+            StringPrintf("Rendering (%" PRId64 " spp)", s1));
+        ParallelFor2D(
+            [&](Point2i tile) {
+                int seed = tile.y * nTiles.x + tile.x;
+                int x0 = sampleBounds.pMin.x + tile.x * tileSize;
+                int x1 = std::min(x0 + tileSize, sampleBounds.pMax.x);
+                int y0 = sampleBounds.pMin.y + tile.y * tileSize;
+                int y1 = std::min(y0 + tileSize, sampleBounds.pMax.y);
+                Bounds2i tileBounds(Point2i(x0, y0), Point2i(x1, y1));
+                TextureTileCache *texCache =
+                    PbrtOptions.texCacheMB > 0
+                        ? TextureTileCache::Instance()
+                        : nullptr;
+                if (texCache) {
+                    if (seed < (int)prevWaveTextureTiles.size())
+                        texCache->PrefetchAsync(prevWaveTextureTiles[seed]);
+                    texCache->RecordTileAccesses(&waveTextureTiles[seed]);
+                }
+                std::unique_ptr<FilmTile> filmTile =
+                    RenderTile(scene, tileBounds, seed, s0, s1);
+                if (texCache) {
+                    texCache->RecordTileAccesses(nullptr);
+                    std::vector<uint64_t> &texTiles = waveTextureTiles[seed];
+                    std::sort(texTiles.begin(), texTiles.end());
+                    texTiles.erase(
+                        std::unique(texTiles.begin(), texTiles.end()),
+                        texTiles.end());
                 }
+                if (PbrtOptions.deterministic)
+                    camera->film->MergeFilmTileOrdered(std::move(filmTile),
+                                                       seed,
+                                                       nTiles.x * nTiles.y);
+                else
+                    camera->film->MergeFilmTile(std::move(filmTile));
+                reporter.Update();
+            },
+            nTiles);
+        reporter.Done();
+
+        // Write the accumulated image so that stopping the render here
+        // leaves the best available result on disk
+        camera->film->WriteImage();
+        prevWaveTextureTiles.swap(waveTextureTiles);
+        for (std::vector<uint64_t> &texTiles : waveTextureTiles)
+            texTiles.clear();
+        LOG(INFO) << "Finished progressive wave " << wave << " (" << s1
+                  << " spp)";
+    }
+    camera->film->StopProgressivePreview();
+    camera->film->StopDisplayServer();
+    LOG(INFO) << "Rendering finished";
+}
+
+void SamplerIntegrator::Render(const Scene &scene) {
+    Preprocess(scene, *sampler);
+    // Size the per-worker sampler pool before any tiles are dispatched
+    threadSamplers.clear();
+    threadSamplers.resize(MaxThreadIndex());
+    // Hand off to the distributed paths when one was selected on the
+    // command line
+    if (!PbrtOptions.distWorkerAddress.empty()) {
+        RenderWorker(scene);
+        return;
+    }
+    if (PbrtOptions.distCoordinatorPort > 0) {
+        RenderCoordinator(scene);
+        return;
+    }
+    if (PbrtOptions.progressive) {
+        RenderProgressive(scene);
+        return;
+    }
+    // Render image tiles in parallel
+
+    // Compute number of tiles, _nTiles_, to use for parallel rendering
+    Bounds2i sampleBounds = camera->film->GetSampleBounds();
+    Vector2i sampleExtent = sampleBounds.Diagonal();
+    // Per-tile render times and texture working sets measured on the
+    // previous frame; declared up here because the measured times also
+    // drive the tile size choice.
+    static Point2i prevNTiles(0, 0);
+    static std::vector<Float> prevTileSeconds;
+    // Each tile's texture tile working set from the previous frame, fed to
+    // the texture cache's prefetch when the tile starts again.
+    static std::vector<std::vector<uint64_t>> prevTileTextureTiles;
+    // Deterministic mode keeps the traditional 16x16 tile: the adaptive
+    // size depends on the machine's thread count and the previous frame's
+    // timings, either of which would change the tile seeds and merge order
+    // from run to run.
+    const int tileSize =
+        PbrtOptions.deterministic
+            ? 16
+            : ChooseTileSize(sampleExtent, sampler->samplesPerPixel,
+                             TileCostVariation(prevTileSeconds));
+    Point2i nTiles((sampleExtent.x + tileSize - 1) / tileSize,
+                   (sampleExtent.y + tileSize - 1) / tileSize);
+    // Restore the film and completed-tile set from a checkpoint left by an
+    // interrupted run, if requested; completed tiles are skipped below since
+    // the restored film already holds their contributions.
+    std::string checkpointFilename = camera->film->filename + ".ckpt";
+    std::vector<uint8_t> tileCompleted(nTiles.x * nTiles.y, 0);
+    if (PbrtOptions.resume) {
+        std::vector<uint8_t> restored;
+        if (camera->film->ReadCheckpoint(checkpointFilename, &restored) &&
+            (int)restored.size() == nTiles.x * nTiles.y) {
+            tileCompleted = std::move(restored);
+        } else {
+            Warning("No usable checkpoint in \"%s\"; rendering from "
+                    "scratch.", checkpointFilename.c_str());
+            camera->film->Clear();
+        }
+    }
 
-                // Do this check after the StartPixel() call; this keeps
-                // the usage of RNG values from (most) Samplers that use
-                // RNGs consistent, which improves reproducability /
-                // debugging.
-                if (!InsideExclusive(pixel, pixelBounds))
-                    continue;
-
-                do {
-                    // Initialize _CameraSample_ for current sample
-                    CameraSample cameraSample =
-                        tileSampler->GetCameraSample(pixel);
-
-                    // Generate camera ray for current sample
-                    RayDifferential ray;
-                    Float rayWeight =
-                        camera->GenerateRayDifferential(cameraSample, &ray);
-                    ray.ScaleDifferentials(
-                        1 / std::sqrt((Float)tileSampler->samplesPerPixel));
-                    ++nCameraRays;
-
-                    // Evaluate radiance along camera ray
-                    Spectrum L(0.f);
-                    if (rayWeight > 0) L = Li(ray, scene, *tileSampler, arena);
-
-                    // Issue warning if unexpected radiance value returned
-                    if (L.HasNaNs()) {
-                        LOG(ERROR) << StringPrintf(
-                            "Not-a-number radiance value returned "
-                            "for pixel (%d, %d), sample %d. Setting to black.",
-                            pixel.x, pixel.y,
-                            (int)tileSampler->CurrentSampleNumber());
-                        L = Spectrum(0.f);
-                    } else if (L.y() < -1e-5) {
-                        LOG(ERROR) << StringPrintf(
-                            "Negative luminance value, %f, returned "
-                            "for pixel (%d, %d), sample %d. Setting to black.",
-                            L.y(), pixel.x, pixel.y,
-                            (int)tileSampler->CurrentSampleNumber());
-                        L = Spectrum(0.f);
-                    } else if (std::isinf(L.y())) {
-                          LOG(ERROR) << StringPrintf(
-                            "Infinite luminance value returned "
-                            "for pixel (%d, %d), sample %d. Setting to black.",
-                            pixel.x, pixel.y,
-                            (int)tileSampler->CurrentSampleNumber());
-                        L = Spectrum(0.f);
+    // Estimate relative per-tile cost so expensive tiles (hair, glass) can
+    // be dispatched first rather than discovered at the end of the render.
+    // The estimates come from the previous frame's measured per-tile times
+    // when the tiling matches (consecutive frames of an animation), and
+    // otherwise from a low-spp timing prepass whose radiance is discarded.
+    std::vector<Float> tileCost(nTiles.x * nTiles.y, (Float)1);
+    if (PbrtOptions.deterministic) {
+        // Deterministic mode keeps the uniform decomposition and uniform
+        // cost: the timing prepass, cost-driven tile splitting, and
+        // cost-sorted dispatch below all depend on measured times, which
+        // would change the tile seeds and merge order from run to run.
+    } else if (nTiles == prevNTiles &&
+        (int)prevTileSeconds.size() == nTiles.x * nTiles.y) {
+        tileCost = prevTileSeconds;
+    } else {
+        ParallelFor(
+            [&](int64_t i) {
+                if (tileCompleted[i]) {
+                    tileCost[i] = 0;
+                    return;
+                }
+                Point2i tile(i % nTiles.x, i / nTiles.x);
+                MemoryArena arena;
+                Sampler *tileSampler =
+                    TileSampler(nTiles.x * nTiles.y + (int)i);
+                int x0 = sampleBounds.pMin.x + tile.x * tileSize;
+                int x1 = std::min(x0 + tileSize, sampleBounds.pMax.x);
+                int y0 = sampleBounds.pMin.y + tile.y * tileSize;
+                int y1 = std::min(y0 + tileSize, sampleBounds.pMax.y);
+                auto startTime = std::chrono::steady_clock::now();
+                // Trace one camera sample at a sparse grid of the tile's
+                // pixels and use the elapsed time as its cost estimate.
+                for (int y = y0; y < y1; y += 8)
+                    for (int x = x0; x < x1; x += 8) {
+                        Point2i pixel(x, y);
+                        tileSampler->StartPixel(pixel);
+                        if (!InsideExclusive(pixel, pixelBounds)) continue;
+                        CameraSample cameraSample =
+                            tileSampler->GetCameraSample(pixel);
+                        RayDifferential ray;
+                        Float rayWeight =
+                            camera->GenerateRayDifferential(cameraSample, &ray);
+                        ray.ScaleDifferentials(
+                            1 /
+                            std::sqrt((Float)tileSampler->samplesPerPixel));
+                        if (rayWeight > 0)
+                            (void)Li(ray, scene, *tileSampler, arena);
+                        arena.Reset();
                     }
-                    VLOG(1) << "Camera sample: " << cameraSample << " -> ray: " <<
-                        ray << " -> L = " << L;
+                tileCost[i] = std::chrono::duration<Float>(
+                                  std::chrono::steady_clock::now() - startTime)
+                                  .count();
+            },
+            nTiles.x * nTiles.y);
+    }
+
+    // Build the tile work list, splitting tiles whose estimated cost is far
+    // above the median so that no single tile dominates the render tail.
+    struct TileWork {
+        Bounds2i bounds;
+        int tileIndex;
+        Float cost;
+    };
+    std::vector<TileWork> tileWork;
+    for (int i = 0; i < nTiles.x * nTiles.y; ++i) {
+        if (tileCompleted[i]) continue;
+        Point2i tile(i % nTiles.x, i / nTiles.x);
+        int x0 = sampleBounds.pMin.x + tile.x * tileSize;
+        int x1 = std::min(x0 + tileSize, sampleBounds.pMax.x);
+        int y0 = sampleBounds.pMin.y + tile.y * tileSize;
+        int y1 = std::min(y0 + tileSize, sampleBounds.pMax.y);
+        tileWork.push_back({Bounds2i(Point2i(x0, y0), Point2i(x1, y1)), i,
+                            std::max(tileCost[i], (Float)0)});
+    }
+    std::vector<Float> sortedCost = tileCost;
+    std::nth_element(sortedCost.begin(),
+                     sortedCost.begin() + sortedCost.size() / 2,
+                     sortedCost.end());
+    Float medianCost = sortedCost[sortedCost.size() / 2];
+    if (medianCost > 0)
+        for (size_t i = 0; i < tileWork.size(); ++i)
+            while (tileWork[i].cost > 4 * medianCost) {
+                // Halve the tile along its longer axis, splitting the cost
+                // estimate evenly between the two pieces.
+                Bounds2i b = tileWork[i].bounds;
+                Vector2i d = b.Diagonal();
+                if (std::max(d.x, d.y) < 8) break;
+                TileWork other = tileWork[i];
+                if (d.x >= d.y) {
+                    int mid = (b.pMin.x + b.pMax.x) / 2;
+                    tileWork[i].bounds.pMax.x = mid;
+                    other.bounds.pMin.x = mid;
+                } else {
+                    int mid = (b.pMin.y + b.pMax.y) / 2;
+                    tileWork[i].bounds.pMax.y = mid;
+                    other.bounds.pMin.y = mid;
+                }
+                tileWork[i].cost *= .5f;
+                other.cost *= .5f;
+                tileWork.push_back(other);
+            }
+
+    // Dispatch tiles in decreasing estimated-cost order so stragglers start
+    // early instead of anchoring the tail of the render. (In deterministic
+    // mode the work list stays in tile-index order.)
+    if (!PbrtOptions.deterministic)
+        std::sort(tileWork.begin(), tileWork.end(),
+                  [](const TileWork &a, const TileWork &b) {
+                      return a.cost > b.cost;
+                  });
+
+    // Per-base-tile bookkeeping so that a tile's film contributions are
+    // merged only once all of its split pieces have finished; checkpoints
+    // written below therefore never contain a partially rendered tile.
+    std::vector<int> remainingSubTiles(nTiles.x * nTiles.y, 0);
+    for (const TileWork &tw : tileWork) ++remainingSubTiles[tw.tileIndex];
+    std::vector<std::vector<std::unique_ptr<FilmTile>>> pendingSubTiles(
+        nTiles.x * nTiles.y);
+    std::mutex checkpointMutex;
+    auto lastCheckpoint = std::chrono::steady_clock::now();
 
-                    // Add camera ray's contribution to image
-                    filmTile->AddSample(cameraSample.pFilm, L, rayWeight);
+    // Start the progressive preview thread, if requested
+    if (PbrtOptions.previewSeconds > 0)
+        camera->film->StartProgressivePreview(
+            (Float)PbrtOptions.previewSeconds);
 
-                    // Free _MemoryArena_ memory from computing image sample
-                    // value
-                    arena.Reset();
-                } while (tileSampler->StartNextSample());
+    // Connect to the display server, if requested
+    if (!PbrtOptions.displayServer.empty())
+        camera->film->StartDisplayServer(PbrtOptions.displayServer);
+
+    // Per-tile times measured this frame, for seeding the next one.
+    std::vector<AtomicFloat> tileSeconds(nTiles.x * nTiles.y);
+    // Texture tiles faulted per work item this frame, for the next frame's
+    // prefetch.
+    std::vector<std::vector<uint64_t>> workTextureTiles(tileWork.size());
+    ProgressReporter reporter(tileWork.size(), "Rendering");
+    {
+        ParallelFor([&](int64_t workIndex) {
+            // Render section of image corresponding to _tile_
+            const TileWork &tw = tileWork[workIndex];
+            auto startTime = std::chrono::steady_clock::now();
+
+            // Kick off a prefetch of the texture tiles this film tile
+            // needed last frame and record the ones it faults now for the
+            // next frame
+            TextureTileCache *texCache =
+                PbrtOptions.texCacheMB > 0 ? TextureTileCache::Instance()
+                                           : nullptr;
+            if (texCache) {
+                if (tw.tileIndex < (int)prevTileTextureTiles.size())
+                    texCache->PrefetchAsync(
+                        prevTileTextureTiles[tw.tileIndex]);
+                texCache->RecordTileAccesses(&workTextureTiles[workIndex]);
             }
-            LOG(INFO) << "Finished image tile " << tileBounds;
 
-            // Merge image tile into _Film_
-            camera->film->MergeFilmTile(std::move(filmTile));
+            // Seed each work item's sampler from its position in the
+            // image, never from its rank in the work list: the list's
+            // order comes from a wall-clock timing prepass, so rank-based
+            // seeds would give two identical invocations different sample
+            // sequences. With position-derived seeds, cost-sorted
+            // dispatch (and checkpoint resume) only changes scheduling;
+            // --deterministic is needed only for its stable tiling and
+            // merge order.
+            Vector2i rel = tw.bounds.pMin - sampleBounds.pMin;
+            int seed = rel.y * sampleBounds.Diagonal().x + rel.x;
+            std::unique_ptr<FilmTile> filmTile =
+                RenderTile(scene, tw.bounds, seed);
+            if (texCache) texCache->RecordTileAccesses(nullptr);
+
+            // Merge image tile into _Film_ once the whole base tile is
+            // done, and write a checkpoint if enough time has passed since
+            // the last one
+            {
+                std::lock_guard<std::mutex> lock(checkpointMutex);
+                pendingSubTiles[tw.tileIndex].push_back(std::move(filmTile));
+                if (--remainingSubTiles[tw.tileIndex] == 0) {
+                    for (auto &subTile : pendingSubTiles[tw.tileIndex]) {
+                        // In deterministic mode there's one sub-tile per
+                        // work item and the work list is in tile-index
+                        // order, so _workIndex_ is the tile's rank among
+                        // the tiles actually rendered (tiles restored from
+                        // a checkpoint never enter the merge sequence).
+                        if (PbrtOptions.deterministic)
+                            camera->film->MergeFilmTileOrdered(
+                                std::move(subTile), (int)workIndex,
+                                (int)tileWork.size());
+                        else
+                            camera->film->MergeFilmTile(std::move(subTile));
+                    }
+                    pendingSubTiles[tw.tileIndex].clear();
+                    tileCompleted[tw.tileIndex] = 1;
+                    auto now = std::chrono::steady_clock::now();
+                    if (PbrtOptions.checkpointSeconds > 0 &&
+                        std::chrono::duration<Float>(now - lastCheckpoint)
+                                .count() > PbrtOptions.checkpointSeconds) {
+                        camera->film->WriteCheckpoint(checkpointFilename,
+                                                      tileCompleted);
+                        lastCheckpoint = now;
+                    }
+                }
+            }
+            Float elapsed = std::chrono::duration<Float>(
+                                std::chrono::steady_clock::now() - startTime)
+                                .count();
+            tileSeconds[tw.tileIndex].Add(elapsed);
+            // Feed the measured tile cost to the reporter so the ETA
+            // tracks the cost gradient across the image instead of
+            // assuming uniformly expensive tiles.
+            reporter.RecordWorkTime(elapsed);
             reporter.Update();
-        }, nTiles);
+        }, tileWork.size(), 1);
         reporter.Done();
     }
+    camera->film->StopProgressivePreview();
+    camera->film->StopDisplayServer();
+    // The render finished; drop the checkpoint so the next run starts clean.
+    if (PbrtOptions.checkpointSeconds > 0) remove(checkpointFilename.c_str());
+    // Remember this frame's measured tile times as the next frame's cost
+    // estimates.
+    prevNTiles = nTiles;
+    prevTileSeconds.resize(nTiles.x * nTiles.y);
+    for (int i = 0; i < nTiles.x * nTiles.y; ++i)
+        prevTileSeconds[i] = tileSeconds[i];
+    // Remember each tile's texture working set for the next frame's
+    // prefetch, merging the sets recorded by a tile's split pieces.
+    if (PbrtOptions.texCacheMB > 0) {
+        prevTileTextureTiles.assign(nTiles.x * nTiles.y,
+                                    std::vector<uint64_t>());
+        for (size_t i = 0; i < tileWork.size(); ++i) {
+            std::vector<uint64_t> &dest =
+                prevTileTextureTiles[tileWork[i].tileIndex];
+            dest.insert(dest.end(), workTextureTiles[i].begin(),
+                        workTextureTiles[i].end());
+        }
+        for (std::vector<uint64_t> &texTiles : prevTileTextureTiles) {
+            std::sort(texTiles.begin(), texTiles.end());
+            texTiles.erase(std::unique(texTiles.begin(), texTiles.end()),
+                           texTiles.end());
+        }
+    }
     LOG(INFO) << "Rendering finished";
 
     // Save final image after rendering
@@ -354,6 +1584,7 @@ Spectrum SamplerIntegrator::SpecularReflect(
         RayDifferential rd = isect.SpawnRay(wi);
         if (ray.hasDifferentials) {
             rd.hasDifferentials = true;
+            isect.EnsureDifferentials();
             rd.rxOrigin = isect.p + isect.dpdx;
             rd.ryOrigin = isect.p + isect.dpdy;
             // Compute differential reflected directions
@@ -370,8 +1601,14 @@ Spectrum SamplerIntegrator::SpecularReflect(
             rd.ryDirection =
                 wi - dwody + 2.f * Vector3f(Dot(wo, ns) * dndy + dDNdy * ns);
         }
-        return f * Li(rd, scene, sampler, arena, depth + 1) * AbsDot(wi, ns) /
-               pdf;
+        // The recursion's arena scratch (child BSDFs along the specular
+        // chain) is dead once its radiance is in hand; roll it back so a
+        // deep chain reuses one bounce's worth of arena rather than
+        // growing it for the rest of the tile.
+        MemoryArena::Checkpoint checkpoint = arena.GetCheckpoint();
+        Spectrum Li = this->Li(rd, scene, sampler, arena, depth + 1);
+        arena.RestoreCheckpoint(checkpoint);
+        return f * Li * AbsDot(wi, ns) / pdf;
     } else
         return Spectrum(0.f);
 }
@@ -392,6 +1629,7 @@ Spectrum SamplerIntegrator::SpecularTransmit(
         RayDifferential rd = isect.SpawnRay(wi);
         if (ray.hasDifferentials) {
             rd.hasDifferentials = true;
+            isect.EnsureDifferentials();
             rd.rxOrigin = p + isect.dpdx;
             rd.ryOrigin = p + isect.dpdy;
 
@@ -451,7 +1689,12 @@ Spectrum SamplerIntegrator::SpecularTransmit(
             rd.ryDirection =
                 wi - eta * dwody + Vector3f(mu * dndy + dmudy * ns);
         }
-        L = f * Li(rd, scene, sampler, arena, depth + 1) * AbsDot(wi, ns) / pdf;
+        // As in SpecularReflect(), release the recursion's arena scratch
+        // once its radiance has been computed
+        MemoryArena::Checkpoint checkpoint = arena.GetCheckpoint();
+        Spectrum Lt = Li(rd, scene, sampler, arena, depth + 1);
+        arena.RestoreCheckpoint(checkpoint);
+        L = f * Lt * AbsDot(wi, ns) / pdf;
     }
     return L;
 }
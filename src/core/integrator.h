@@ -57,6 +57,31 @@ class Integrator {
     virtual void Render(const Scene &scene) = 0;
 };
 
+// ShadowRayQueue Declarations
+// A per-tile queue of deferred shadow rays.  Instead of tracing each
+// occlusion ray inside EstimateDirect(), shading may enqueue the ray
+// together with its would-be contribution and a target to accumulate it
+// into; Resolve() then tests the whole batch with a single IntersectPN()
+// pass, so traversal runs back to back over many rays, and adds the
+// contributions of the unoccluded ones to their targets.
+class ShadowRayQueue {
+  public:
+    // ShadowRayQueue Public Methods
+    void Add(const Ray &ray, const Spectrum &contribution, Spectrum *L) {
+        rays.push_back(ray);
+        contributions.push_back(contribution);
+        targets.push_back(L);
+    }
+    void Resolve(const Scene &scene);
+    size_t Size() const { return rays.size(); }
+
+  private:
+    // ShadowRayQueue Private Data
+    std::vector<Ray> rays;
+    std::vector<Spectrum> contributions;
+    std::vector<Spectrum *> targets;
+};
+
 Spectrum UniformSampleAllLights(const Interaction &it, const Scene &scene,
                                 MemoryArena &arena, Sampler &sampler,
                                 const std::vector<int> &nLightSamples,
@@ -64,12 +89,31 @@ Spectrum UniformSampleAllLights(const Interaction &it, const Scene &scene,
 Spectrum UniformSampleOneLight(const Interaction &it, const Scene &scene,
                                MemoryArena &arena, Sampler &sampler,
                                bool handleMedia = false,
-                               const Distribution1D *lightDistrib = nullptr);
+                               const Distribution1D *lightDistrib = nullptr,
+                               bool visibilityCache = false,
+                               ShadowRayQueue *shadowRays = nullptr,
+                               Spectrum *Ldeferred = nullptr,
+                               const Spectrum &beta = Spectrum(1.f));
+// If _lightSample_ is non-null it is used in place of EstimateDirect()'s
+// own Sample_Li() call; UniformSampleAllLights() uses this to take a
+// light's samples in one batched Sample_LiN() call up front.
 Spectrum EstimateDirect(const Interaction &it, const Point2f &uShading,
                         const Light &light, const Point2f &uLight,
                         const Scene &scene, Sampler &sampler,
                         MemoryArena &arena, bool handleMedia = false,
-                        bool specular = false);
+                        bool specular = false, bool visibilityCache = false,
+                        ShadowRayQueue *shadowRays = nullptr,
+                        Spectrum *Ldeferred = nullptr,
+                        const Spectrum &deferScale = Spectrum(1.f),
+                        const LightLiSample *lightSample = nullptr);
+// Estimate direct lighting with reservoir-based resampled importance
+// sampling: _nCandidates_ unshadowed light samples compete for the single
+// shadow ray, and reservoirs from recently shaded, geometrically similar
+// points on the same thread are reused as additional candidates.
+Spectrum ReservoirSampleOneLight(const SurfaceInteraction &isect,
+                                 const Scene &scene, MemoryArena &arena,
+                                 Sampler &sampler, int nCandidates,
+                                 const Distribution1D *lightDistrib = nullptr);
 std::unique_ptr<Distribution1D> ComputeLightPowerDistribution(
     const Scene &scene);
 
@@ -98,11 +142,44 @@ class SamplerIntegrator : public Integrator {
   protected:
     // SamplerIntegrator Protected Data
     std::shared_ptr<const Camera> camera;
-
-  private:
-    // SamplerIntegrator Private Data
     std::shared_ptr<Sampler> sampler;
     const Bounds2i pixelBounds;
+
+    // SamplerIntegrator Protected Methods
+    // Render the pixels of _tileBounds_ into a fresh FilmTile; shared
+    // between the local tile loop and the distributed worker path.
+    // Virtual so that integrators that schedule a tile's rays differently
+    // (see WavefrontPathIntegrator) can substitute their own tile loop
+    // while keeping the parallel scheduling, checkpointing, and
+    // distributed-rendering machinery of Render(). The optional sample
+    // range renders only samples [_sampleBegin_, _sampleEnd_) of each
+    // pixel for the progressive waves below; -1 means all of them.
+    virtual std::unique_ptr<FilmTile> RenderTile(const Scene &scene,
+                                                 const Bounds2i &tileBounds,
+                                                 int seed,
+                                                 int64_t sampleBegin = 0,
+                                                 int64_t sampleEnd = -1);
+    // Return the calling worker thread's persistent sampler, cloned on
+    // the thread's first tile and Reset() for each subsequent one, so
+    // that tile startup doesn't reallocate the sampler's sample vectors.
+    // Render() sizes the pool before dispatching any tiles.
+    Sampler *TileSampler(int seed);
+    std::vector<std::unique_ptr<Sampler>> threadSamplers;
+
+  private:
+    // SamplerIntegrator Private Methods
+    // Distributed rendering: the coordinator hands film tiles to connected
+    // worker processes over TCP (rendering locally as well) and merges the
+    // returned tiles; workers parse the same scene file, connect, and
+    // render whatever they're handed.
+    void RenderCoordinator(const Scene &scene);
+    void RenderWorker(const Scene &scene);
+    // Progressive rendering: cover the whole film in doubling sample-count
+    // waves, accumulating into the film and writing the image after every
+    // wave, so an interrupted render leaves the best available result and
+    // each wave continues the sample sequences exactly where the previous
+    // one stopped.
+    void RenderProgressive(const Scene &scene);
 };
 
 }  // namespace pbrt
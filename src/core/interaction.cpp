@@ -92,7 +92,10 @@ void SurfaceInteraction::SetShadingGeometry(const Vector3f &dpdus,
 void SurfaceInteraction::ComputeScatteringFunctions(const RayDifferential &ray,
                                                     MemoryArena &arena,
                                                     bool allowMultipleLobes,
-                                                    TransportMode mode) {
+                                                    TransportMode mode,
+                                                    bool allowInlineStorage) {
+    inlineShadingAllowed = allowInlineStorage;
+    shadingStorageOffset = 0;
     ComputeDifferentials(ray);
     primitive->ComputeScatteringFunctions(this, arena, mode,
                                           allowMultipleLobes);
@@ -101,23 +104,45 @@ void SurfaceInteraction::ComputeScatteringFunctions(const RayDifferential &ray,
 void SurfaceInteraction::ComputeDifferentials(
     const RayDifferential &ray) const {
     if (ray.hasDifferentials) {
+        // Stash the auxiliary rays and defer the derivative solve to
+        // EnsureDifferentials()
+        rxOrigin = ray.rxOrigin;
+        ryOrigin = ray.ryOrigin;
+        rxDirection = ray.rxDirection;
+        ryDirection = ray.ryDirection;
+        differentialsComputed = false;
+    } else {
+        dudx = dvdx = 0;
+        dudy = dvdy = 0;
+        dpdx = dpdy = Vector3f(0, 0, 0);
+        differentialsComputed = true;
+    }
+}
+
+void SurfaceInteraction::ComputeDifferentialsNow() const {
+    differentialsComputed = true;
+    {
         // Estimate screen space change in $\pt{}$ and $(u,v)$
 
         // Compute auxiliary intersection points with plane
         Float d = Dot(n, Vector3f(p.x, p.y, p.z));
-        Float tx =
-            -(Dot(n, Vector3f(ray.rxOrigin)) - d) / Dot(n, ray.rxDirection);
+        Float tx = -(Dot(n, Vector3f(rxOrigin)) - d) / Dot(n, rxDirection);
         if (std::isinf(tx) || std::isnan(tx)) goto fail;
-        Point3f px = ray.rxOrigin + tx * ray.rxDirection;
-        Float ty =
-            -(Dot(n, Vector3f(ray.ryOrigin)) - d) / Dot(n, ray.ryDirection);
+        Point3f px = rxOrigin + tx * rxDirection;
+        Float ty = -(Dot(n, Vector3f(ryOrigin)) - d) / Dot(n, ryDirection);
         if (std::isinf(ty) || std::isnan(ty)) goto fail;
-        Point3f py = ray.ryOrigin + ty * ray.ryDirection;
+        Point3f py = ryOrigin + ty * ryDirection;
         dpdx = px - p;
         dpdy = py - p;
 
         // Compute $(u,v)$ offsets at auxiliary points
 
+        // Let shapes with precomputed UV derivative matrices answer
+        // directly; triangles with texture coordinates take this path.
+        if (shape && shape->ComputeUVDifferentials(dpdx, dpdy, &dudx, &dvdx,
+                                                   &dudy, &dvdy))
+            return;
+
         // Choose two dimensions to use for ray offset computation
         int dim[2];
         if (std::abs(n.x) > std::abs(n.y) && std::abs(n.x) > std::abs(n.z)) {
@@ -138,12 +163,12 @@ void SurfaceInteraction::ComputeDifferentials(
         Float By[2] = {py[dim[0]] - p[dim[0]], py[dim[1]] - p[dim[1]]};
         if (!SolveLinearSystem2x2(A, Bx, &dudx, &dvdx)) dudx = dvdx = 0;
         if (!SolveLinearSystem2x2(A, By, &dudy, &dvdy)) dudy = dvdy = 0;
-    } else {
-    fail:
-        dudx = dvdx = 0;
-        dudy = dvdy = 0;
-        dpdx = dpdy = Vector3f(0, 0, 0);
+        return;
     }
+fail:
+    dudx = dvdx = 0;
+    dudy = dvdy = 0;
+    dpdx = dpdy = Vector3f(0, 0, 0);
 }
 
 Spectrum SurfaceInteraction::Le(const Vector3f &w) const {
@@ -44,6 +44,8 @@
 #include "transform.h"
 #include "medium.h"
 #include "material.h"
+#include "memory.h"
+#include "spectrum.h"
 
 namespace pbrt {
 
@@ -127,12 +129,47 @@ class SurfaceInteraction : public Interaction {
     void SetShadingGeometry(const Vector3f &dpdu, const Vector3f &dpdv,
                             const Normal3f &dndu, const Normal3f &dndv,
                             bool orientationIsAuthoritative);
+    // _allowInlineStorage_ permits serving the material's BSDF and BxDF
+    // allocations from this interaction's inline storage; callers that keep
+    // _bsdf_ alive past the interaction itself (BDPT vertices, SPPM visible
+    // points) must pass false so those allocations come from _arena_.
     void ComputeScatteringFunctions(
         const RayDifferential &ray, MemoryArena &arena,
         bool allowMultipleLobes = false,
-        TransportMode mode = TransportMode::Radiance);
+        TransportMode mode = TransportMode::Radiance,
+        bool allowInlineStorage = true);
+    // Record the ray's differentials for this intersection; the screen
+    // space derivatives themselves are solved for lazily by
+    // EnsureDifferentials() the first time a texture lookup needs them, so
+    // hits shaded without textures never pay for the per-hit linear system.
     void ComputeDifferentials(const RayDifferential &r) const;
+    // Compute _dpdx_, _dudx_, and the other screen space derivatives from
+    // the recorded auxiliary rays if that hasn't happened yet for this
+    // intersection. Every consumer of the derivative members below calls
+    // this first.
+    void EnsureDifferentials() const {
+        if (!differentialsComputed) ComputeDifferentialsNow();
+    }
+    void ComputeDifferentialsNow() const;
     Spectrum Le(const Vector3f &w) const;
+    // Serve a shading-time allocation from the inline storage below,
+    // falling back to _arena_ once it is full or when inline storage was
+    // disallowed for this interaction. Materials allocate through the
+    // BSDF_ALLOC() macro rather than calling this directly.
+    void *AllocShading(size_t nBytes, MemoryArena &arena) {
+        nBytes = (nBytes + 15) & ~(size_t)15;
+        if (inlineShadingAllowed &&
+            shadingStorageOffset + (int)nBytes <= ShadingStorageSize) {
+            void *ret = shadingStorage + shadingStorageOffset;
+            shadingStorageOffset += (int)nBytes;
+            return ret;
+        }
+        return arena.Alloc(nBytes);
+    }
+    // Drop any memoized texture evaluations (see the cache below); code
+    // that copies an interaction and moves it to a different shading
+    // point must call this before evaluating textures through the copy.
+    void ClearTextureCache() const { nTexCacheUsed = 0; }
 
     // SurfaceInteraction Public Data
     Point2f uv;
@@ -149,13 +186,47 @@ class SurfaceInteraction : public Interaction {
     BSSRDF *bssrdf = nullptr;
     mutable Vector3f dpdx, dpdy;
     mutable Float dudx = 0, dvdx = 0, dudy = 0, dvdy = 0;
+    // Auxiliary rays stashed by ComputeDifferentials() for the deferred
+    // derivative solve; only valid while _differentialsComputed_ is false.
+    mutable Point3f rxOrigin, ryOrigin;
+    mutable Vector3f rxDirection, ryDirection;
+    mutable bool differentialsComputed = true;
 
     // Added after book publication. Shapes can optionally provide a face
     // index with an intersection point for use in Ptex texture lookups.
     // If Ptex isn't being used, then this value is ignored.
     int faceIndex = 0;
+
+    // Memoized texture evaluations for this shading point, keyed on the
+    // texture's address; see EvaluateMemoized() in texture.h. Layered
+    // materials evaluate the same underlying texture several times per
+    // intersection through different parameters and Scale/Mix wrappers,
+    // so the first few results are kept here. Float results are stored as
+    // constant spectra.
+    static PBRT_CONSTEXPR int TexCacheSize = 8;
+    mutable const void *texCacheKey[TexCacheSize];
+    mutable Spectrum texCacheValue[TexCacheSize];
+    mutable int nTexCacheUsed = 0;
+
+    // Inline storage for the BSDF, its BxDFs, and their Fresnel and
+    // microfacet helpers; sized to cover the common few-lobe materials so
+    // the hottest shading path doesn't touch the MemoryArena at all.
+    // Nothing allocated here is ever destroyed, matching the arena's
+    // semantics for the same objects.
+    static PBRT_CONSTEXPR int ShadingStorageSize = 512;
+    bool inlineShadingAllowed = true;
+    int shadingStorageOffset = 0;
+#ifdef PBRT_HAVE_ALIGNAS
+    alignas(16)
+#endif  // PBRT_HAVE_ALIGNAS
+    char shadingStorage[ShadingStorageSize];
 };
 
+// Allocate _Type_ from _si_'s inline shading storage if it fits (and is
+// allowed), and from _arena_ otherwise.
+#define BSDF_ALLOC(si, arena, Type) \
+    new ((si)->AllocShading(sizeof(Type), arena)) Type
+
 }  // namespace pbrt
 
 #endif  // PBRT_CORE_INTERACTION_H
@@ -33,6 +33,16 @@
 // core/interpolation.cpp*
 #include "interpolation.h"
 
+// Evaluate the Fourier cosine series four terms at a time: the identity
+// cos((k+4) phi) = 2 cos(4 phi) cos(k phi) - cos((k-4) phi) splits the
+// serial cosine recurrence into four independent interleaved
+// recurrences, one per SIMD lane.  The iterates stay in double
+// precision, matching the scalar recurrence.
+#if defined(__AVX__) && !defined(PBRT_FLOAT_AS_DOUBLE)
+#include <immintrin.h>
+#define PBRT_INTERP_HAVE_AVX
+#endif
+
 namespace pbrt {
 
 // Spline Interpolation Definitions
@@ -60,11 +70,30 @@ Float CatmullRom(int size, const Float *nodes, const Float *values, Float x) {
 
 bool CatmullRomWeights(int size, const Float *nodes, Float x, int *offset,
                        Float *weights) {
+    int hint = -1;
+    return CatmullRomWeights(size, nodes, x, offset, weights, &hint);
+}
+
+bool CatmullRomWeights(int size, const Float *nodes, Float x, int *offset,
+                       Float *weights, int *hint) {
     // Return _false_ if _x_ is out of bounds
     if (!(x >= nodes[0] && x <= nodes[size - 1])) return false;
 
-    // Search for the interval _idx_ containing _x_
-    int idx = FindInterval(size, [&](int i) { return nodes[i] <= x; });
+    // Search for the interval _idx_ containing _x_, trying the hinted
+    // interval and its neighbors before the binary search
+    int idx;
+    if (*hint >= 0 && *hint + 1 < size && nodes[*hint] <= x &&
+        x < nodes[*hint + 1])
+        idx = *hint;
+    else if (*hint >= 0 && *hint + 2 < size && nodes[*hint + 1] <= x &&
+             x < nodes[*hint + 2])
+        idx = *hint + 1;
+    else if (*hint >= 1 && *hint + 1 < size && nodes[*hint - 1] <= x &&
+             x < nodes[*hint])
+        idx = *hint - 1;
+    else
+        idx = FindInterval(size, [&](int i) { return nodes[i] <= x; });
+    *hint = idx;
     *offset = idx - 1;
     Float x0 = nodes[idx], x1 = nodes[idx + 1];
 
@@ -346,6 +375,46 @@ Float InvertCatmullRom(int n, const Float *x, const Float *values, Float u) {
 
 // Fourier Interpolation Definitions
 Float Fourier(const Float *a, int m, double cosPhi) {
+#ifdef PBRT_INTERP_HAVE_AVX
+    if (m >= 16) {
+        // Bootstrap the first eight cosine iterates with the scalar
+        // recurrence
+        double c[8] = {1, cosPhi};
+        double v = 0;
+        for (int k = 2; k < 8; ++k) c[k] = 2 * cosPhi * c[k - 1] - c[k - 2];
+        for (int k = 0; k < 8; ++k) v += a[k] * c[k];
+
+        // Run the four interleaved stride-4 recurrences, accumulating a
+        // lane-wise dot product with the coefficients
+        __m256d T = _mm256_set1_pd(2 * c[4]);
+        __m256d prev = _mm256_loadu_pd(c);
+        __m256d cur = _mm256_loadu_pd(c + 4);
+        __m256d accum = _mm256_setzero_pd();
+        int k = 8;
+        for (; k + 4 <= m; k += 4) {
+            __m256d next = _mm256_sub_pd(_mm256_mul_pd(T, cur), prev);
+            accum = _mm256_add_pd(
+                accum,
+                _mm256_mul_pd(_mm256_cvtps_pd(_mm_loadu_ps(&a[k])), next));
+            prev = cur;
+            cur = next;
+        }
+        double lanes[4], last[4];
+        _mm256_storeu_pd(lanes, accum);
+        _mm256_storeu_pd(last, cur);
+        v += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+
+        // Finish any leftover terms with the scalar recurrence
+        double cosKMinusTwoPhi = last[2], cosKMinusOnePhi = last[3];
+        for (; k < m; ++k) {
+            double cosKPhi = 2 * cosPhi * cosKMinusOnePhi - cosKMinusTwoPhi;
+            v += a[k] * cosKPhi;
+            cosKMinusTwoPhi = cosKMinusOnePhi;
+            cosKMinusOnePhi = cosKPhi;
+        }
+        return v;
+    }
+#endif  // PBRT_INTERP_HAVE_AVX
     double value = 0.0;
     // Initialize cosine iterates
     double cosKMinusOnePhi = cosPhi;
@@ -47,6 +47,13 @@ namespace pbrt {
 Float CatmullRom(int size, const Float *nodes, const Float *values, Float x);
 bool CatmullRomWeights(int size, const Float *nodes, Float x, int *offset,
                        Float *weights);
+// Variant taking an in/out interval hint: _*hint_ holds the interval
+// found by the caller's previous lookup (or -1), which is tried along
+// with its neighbors before falling back to the binary search.
+// Successive lookups from coherent shading work nearly always land in
+// the same or an adjacent interval.
+bool CatmullRomWeights(int size, const Float *nodes, Float x, int *offset,
+                       Float *weights, int *hint);
 Float SampleCatmullRom(int size, const Float *nodes, const Float *f,
                        const Float *cdf, Float sample, Float *fval = nullptr,
                        Float *pdf = nullptr);
@@ -37,6 +37,9 @@
 #include "sampling.h"
 #include "stats.h"
 #include "paramset.h"
+#include "parallel.h"
+#include "medium.h"
+#include "samplers/random.h"
 
 namespace pbrt {
 
@@ -63,6 +66,7 @@ bool VisibilityTester::Unoccluded(const Scene &scene) const {
 Spectrum VisibilityTester::Tr(const Scene &scene, Sampler &sampler) const {
     Ray ray(p0.SpawnRayTo(p1));
     Spectrum Tr(1.f);
+    bool useCache = false;
     while (true) {
         SurfaceInteraction isect;
         bool hitSurface = scene.Intersect(ray, &isect);
@@ -70,16 +74,122 @@ Spectrum VisibilityTester::Tr(const Scene &scene, Sampler &sampler) const {
         if (hitSurface && isect.primitive->GetMaterial() != nullptr)
             return Spectrum(0.0f);
 
-        // Update transmittance for current ray segment
-        if (ray.medium) Tr *= ray.medium->Tr(ray, sampler);
+        // Update transmittance for current ray segment; if the light
+        // provides a transmittance cache, keep walking for opaque
+        // occluders but look up all of the media's transmittance at once
+        // below.
+        if (ray.medium) {
+            if (trCache)
+                useCache = true;
+            else
+                Tr *= ray.medium->Tr(ray, sampler);
+        }
 
         // Generate next ray segment or return final transmittance
         if (!hitSurface) break;
         ray = isect.SpawnRayTo(p1);
     }
+    if (useCache) Tr *= trCache->Lookup(scene, p0.p);
     return Tr;
 }
 
+// TransmittanceCache Method Definitions
+void TransmittanceCache::Build(const Scene &scene) const {
+    bounds = scene.WorldBound();
+    grid.resize(res * res * res);
+    Float diag = bounds.Diagonal().Length();
+    ParallelFor([&](int64_t i) {
+        // Estimate transmittance from the centers of one x-row of cells
+        int y = i % res, z = i / res;
+        RandomSampler sampler(1, (int)i);
+        for (int x = 0; x < res; ++x) {
+            Point3f p = bounds.Lerp(Point3f((x + .5f) / res, (y + .5f) / res,
+                                            (z + .5f) / res));
+            // The medium at _p_ isn't known a priori, so start each march
+            // just outside the scene bounds, where there is none, and
+            // track media boundary crossings on the way in; transmittance
+            // is only accumulated past _p_.
+            const int nEstimates = 4;
+            Float tStart = 1.01f * diag;
+            Point3f pEnd = p + w * tStart;
+            Spectrum Tr(0.f);
+            for (int e = 0; e < nEstimates; ++e) {
+                Spectrum TrEst(1.f);
+                Ray ray(p - w * tStart, w, 2 * tStart);
+                bool past = false;
+                while (true) {
+                    SurfaceInteraction isect;
+                    bool hitSurface = scene.Intersect(ray, &isect);
+                    // Occluded queries return zero before ever consulting
+                    // the cache, so stop at opaque surfaces past _p_.
+                    if (past && hitSurface &&
+                        isect.primitive->GetMaterial() != nullptr)
+                        break;
+                    Float tp = Dot(p - ray.o, ray.d);
+                    if (!past && tp <= ray.tMax) {
+                        // This segment contains _p_; accumulate its
+                        // remainder only
+                        if (ray.medium && tp < ray.tMax) {
+                            Ray sub(p, w, ray.tMax - tp);
+                            sub.medium = ray.medium;
+                            TrEst *= ray.medium->Tr(sub, sampler);
+                        }
+                        past = true;
+                    } else if (past && ray.medium)
+                        TrEst *= ray.medium->Tr(ray, sampler);
+                    if (!hitSurface) break;
+                    ray = isect.SpawnRay(w);
+                    ray.tMax = Dot(pEnd - ray.o, ray.d);
+                }
+                Tr += TrEst;
+            }
+            grid[(z * res + y) * res + x] = Tr / nEstimates;
+        }
+    }, res * res);
+}
+
+Spectrum TransmittanceCache::Lookup(const Scene &scene,
+                                    const Point3f &p) const {
+    std::call_once(built, [&]() { Build(scene); });
+    // Trilinearly interpolate the cached transmittance at _p_
+    Vector3f o = bounds.Offset(p);
+    Point3f pg(o.x * res - .5f, o.y * res - .5f, o.z * res - .5f);
+    Point3i pi = (Point3i)Floor(pg);
+    Vector3f d = pg - (Point3f)pi;
+    auto g = [&](int x, int y, int z) -> const Spectrum & {
+        x = Clamp(x, 0, res - 1);
+        y = Clamp(y, 0, res - 1);
+        z = Clamp(z, 0, res - 1);
+        return grid[(z * res + y) * res + x];
+    };
+    Spectrum d00 = Lerp(d.x, g(pi.x, pi.y, pi.z), g(pi.x + 1, pi.y, pi.z));
+    Spectrum d10 =
+        Lerp(d.x, g(pi.x, pi.y + 1, pi.z), g(pi.x + 1, pi.y + 1, pi.z));
+    Spectrum d01 =
+        Lerp(d.x, g(pi.x, pi.y, pi.z + 1), g(pi.x + 1, pi.y, pi.z + 1));
+    Spectrum d11 =
+        Lerp(d.x, g(pi.x, pi.y + 1, pi.z + 1), g(pi.x + 1, pi.y + 1, pi.z + 1));
+    return Lerp(d.z, Lerp(d.y, d00, d10), Lerp(d.y, d01, d11));
+}
+
+void Light::Sample_LiN(const Interaction &ref, const Point2f *u, int n,
+                       LightLiSample *samples) const {
+    for (int i = 0; i < n; ++i)
+        samples[i].Li = Sample_Li(ref, u[i], &samples[i].wi, &samples[i].pdf,
+                                  &samples[i].vis);
+}
+
+Spectrum Light::Sample_Li_Fast(const Interaction &ref, const Point2f &u,
+                               Vector3f *wi, Float *pdf,
+                               ShadowRayDescriptor *shadow) const {
+    VisibilityTester vis;
+    Spectrum Li = Sample_Li(ref, u, wi, pdf, &vis);
+    shadow->p = vis.P1().p;
+    shadow->pError = vis.P1().pError;
+    shadow->n = vis.P1().n;
+    return Li;
+}
+
 Spectrum Light::Le(const RayDifferential &ray) const { return Spectrum(0.f); }
 
 AreaLight::AreaLight(const Transform &LightToWorld, const MediumInterface &medium,
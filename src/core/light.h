@@ -42,6 +42,7 @@
 #include "pbrt.h"
 #include "memory.h"
 #include "interaction.h"
+#include <mutex>
 
 namespace pbrt {
 
@@ -59,6 +60,9 @@ inline bool IsDeltaLight(int flags) {
 }
 
 // Light Declarations
+struct LightLiSample;
+struct ShadowRayDescriptor;
+
 class Light {
   public:
     // Light Interface
@@ -68,6 +72,20 @@ class Light {
     virtual Spectrum Sample_Li(const Interaction &ref, const Point2f &u,
                                Vector3f *wi, Float *pdf,
                                VisibilityTester *vis) const = 0;
+    // Slim variant of Sample_Li() for callers that only need the sampled
+    // direction, PDF, and radiance plus a compact description of the
+    // shadow ray; skips constructing a VisibilityTester and its two full
+    // Interaction copies. The default wraps Sample_Li(); the lights
+    // override it to fill the descriptor directly.
+    virtual Spectrum Sample_Li_Fast(const Interaction &ref, const Point2f &u,
+                                    Vector3f *wi, Float *pdf,
+                                    ShadowRayDescriptor *shadow) const;
+    // Batched version of Sample_Li() for taking many samples of one light
+    // from one shading point, as UniformSampleAllLights() does. The
+    // default loops over the single-sample method; area lights over
+    // shapes with batched sampling kernels override it.
+    virtual void Sample_LiN(const Interaction &ref, const Point2f *u, int n,
+                            LightLiSample *samples) const;
     virtual Spectrum Power() const = 0;
     virtual void Preprocess(const Scene &scene) {}
     virtual Spectrum Le(const RayDifferential &r) const;
@@ -88,12 +106,41 @@ class Light {
     const Transform LightToWorld, WorldToLight;
 };
 
+// TransmittanceCache Declarations
+// Cached medium transmittance toward a delta-direction light.  Shadow
+// rays toward such a light all leave the scene along the same direction,
+// so adjacent shading points re-march nearly identical transmittance
+// through any media they cross; the cache precomputes the beam
+// transmittance from each cell of a grid over the scene bounds out of
+// the scene along the light direction and answers lookups with a
+// trilinear interpolation instead of a stochastic Tr() march.  The grid
+// is built lazily the first time a shadow ray actually crosses a medium,
+// so scenes without media never pay for it.
+class TransmittanceCache {
+  public:
+    // TransmittanceCache Public Methods
+    TransmittanceCache(const Vector3f &w) : w(Normalize(w)) {}
+    Spectrum Lookup(const Scene &scene, const Point3f &p) const;
+
+  private:
+    // TransmittanceCache Private Methods
+    void Build(const Scene &scene) const;
+
+    // TransmittanceCache Private Data
+    const Vector3f w;
+    static PBRT_CONSTEXPR int res = 64;
+    mutable std::once_flag built;
+    mutable Bounds3f bounds;
+    mutable std::vector<Spectrum> grid;
+};
+
 class VisibilityTester {
   public:
     VisibilityTester() {}
     // VisibilityTester Public Methods
-    VisibilityTester(const Interaction &p0, const Interaction &p1)
-        : p0(p0), p1(p1) {}
+    VisibilityTester(const Interaction &p0, const Interaction &p1,
+                     const TransmittanceCache *trCache = nullptr)
+        : p0(p0), p1(p1), trCache(trCache) {}
     const Interaction &P0() const { return p0; }
     const Interaction &P1() const { return p1; }
     bool Unoccluded(const Scene &scene) const;
@@ -101,6 +148,35 @@ class VisibilityTester {
 
   private:
     Interaction p0, p1;
+    const TransmittanceCache *trCache = nullptr;
+};
+
+// Just enough information about a sampled point on a light to build the
+// shadow ray toward it: the point plus the error bounds and surface
+// normal used to offset the ray endpoints robustly (both zero for point
+// and infinite lights). Sample_Li_Fast() fills one of these in place of
+// a VisibilityTester.
+struct ShadowRayDescriptor {
+    Point3f p;
+    Vector3f pError;
+    Normal3f n;
+    // Spawn the shadow ray from _ref_ to the recorded point, with the
+    // endpoints offset exactly as Interaction::SpawnRayTo() offsets them.
+    Ray SpawnRayFrom(const Interaction &ref) const {
+        Point3f origin = OffsetRayOrigin(ref.p, ref.pError, ref.n, p - ref.p);
+        Point3f target = OffsetRayOrigin(p, pError, n, origin - p);
+        Vector3f d = target - origin;
+        return Ray(origin, d, 1 - ShadowEpsilon, ref.time, ref.GetMedium(d));
+    }
+};
+
+// A light sample produced ahead of time by Light::Sample_LiN() and
+// passed to EstimateDirect() in place of its own Sample_Li() call.
+struct LightLiSample {
+    Spectrum Li;
+    Vector3f wi;
+    Float pdf;
+    VisibilityTester vis;
 };
 
 class AreaLight : public Light {
@@ -36,10 +36,14 @@
 #include "lightdistrib.h"
 #include "lowdiscrepancy.h"
 #include "parallel.h"
+#include "camera.h"
+#include "film.h"
 #include "scene.h"
 #include "stats.h"
 #include "integrator.h"
+#include <algorithm>
 #include <numeric>
+#include <queue>
 
 namespace pbrt {
 
@@ -56,6 +60,9 @@ std::unique_ptr<LightDistribution> CreateLightSampleDistribution(
     else if (name == "spatial")
         return std::unique_ptr<LightDistribution>{
             new SpatialLightDistribution(scene)};
+    else if (name == "bvh")
+        return std::unique_ptr<LightDistribution>{
+            new BVHLightDistribution(scene)};
     else {
         Error(
             "Light sample distribution type \"%s\" unknown. Using \"spatial\".",
@@ -93,6 +100,14 @@ STAT_INT_DISTRIBUTION("SpatialLightDistribution/Hash probes per lookup", nProbes
 // packed coordinate value, which we use to represent
 static const uint64_t invalidPackedPos = 0xffffffffffffffff;
 
+SpatialLightDistribution::HashTable::HashTable(size_t size)
+    : size(size), nEntries(0), entries(new HashEntry[size]) {
+    for (size_t i = 0; i < size; ++i) {
+        entries[i].packedPos.store(invalidPackedPos);
+        entries[i].distribution.store(nullptr);
+    }
+}
+
 SpatialLightDistribution::SpatialLightDistribution(const Scene &scene,
                                                    int maxVoxels)
     : scene(scene) {
@@ -110,26 +125,35 @@ SpatialLightDistribution::SpatialLightDistribution(const Scene &scene,
         CHECK_LT(nVoxels[i], 1 << 20);
     }
 
-    hashTableSize = 4 * nVoxels[0] * nVoxels[1] * nVoxels[2];
-    hashTable.reset(new HashEntry[hashTableSize]);
-    for (int i = 0; i < hashTableSize; ++i) {
-        hashTable[i].packedPos.store(invalidPackedPos);
-        hashTable[i].distribution.store(nullptr);
-    }
+    // Start with a small table and let Grow() expand it on demand, up to
+    // four entries per voxel as before.
+    size_t nGridVoxels = size_t(nVoxels[0]) * nVoxels[1] * nVoxels[2];
+    maxTableSize = 4 * nGridVoxels;
+    size_t initialSize = std::min(maxTableSize, size_t(4096));
+    tables.push_back(std::unique_ptr<HashTable>(new HashTable(initialSize)));
+    currentTable.store(tables.back().get());
 
     LOG(INFO) << "SpatialLightDistribution: scene bounds " << b <<
         ", voxel res (" << nVoxels[0] << ", " << nVoxels[1] << ", " <<
         nVoxels[2] << ")";
 }
 
-SpatialLightDistribution::~SpatialLightDistribution() {
-    // Gather statistics about how well the computed distributions are across
-    // the buckets.
-    for (size_t i = 0; i < hashTableSize; ++i) {
-        HashEntry &entry = hashTable[i];
-        if (entry.distribution.load())
-            delete entry.distribution.load();
-    }
+SpatialLightDistribution::~SpatialLightDistribution() {}
+
+// Compute a hash value from the packed voxel coordinates.  We could just
+// take packedPos mod the hash table size, but since packedPos isn't
+// necessarily well distributed on its own, it's worthwhile to do a little
+// work to make sure that its bits values are individually fairly random.
+// For details of and motivation for the following, see:
+// http://zimbry.blogspot.ch/2011/09/better-bit-mixing-improving-on.html
+static uint64_t HashPackedPos(uint64_t packedPos) {
+    uint64_t hash = packedPos;
+    hash ^= (hash >> 31);
+    hash *= 0x7fb5d329728ea185;
+    hash ^= (hash >> 27);
+    hash *= 0x81dadef4bc2dd44d;
+    hash ^= (hash >> 33);
+    return hash;
 }
 
 const Distribution1D *SpatialLightDistribution::Lookup(const Point3f &p) const {
@@ -150,20 +174,11 @@ const Distribution1D *SpatialLightDistribution::Lookup(const Point3f &p) const {
     uint64_t packedPos = (uint64_t(pi[0]) << 40) | (uint64_t(pi[1]) << 20) | pi[2];
     CHECK_NE(packedPos, invalidPackedPos);
 
-    // Compute a hash value from the packed voxel coordinates.  We could
-    // just take packedPos mod the hash table size, but since packedPos
-    // isn't necessarily well distributed on its own, it's worthwhile to do
-    // a little work to make sure that its bits values are individually
-    // fairly random. For details of and motivation for the following, see:
-    // http://zimbry.blogspot.ch/2011/09/better-bit-mixing-improving-on.html
-    uint64_t hash = packedPos;
-    hash ^= (hash >> 31);
-    hash *= 0x7fb5d329728ea185;
-    hash ^= (hash >> 27);
-    hash *= 0x81dadef4bc2dd44d;
-    hash ^= (hash >> 33);
-    hash %= hashTableSize;
-    CHECK_GE(hash, 0);
+    // Take a snapshot of the current table; if the table is grown while
+    // we're probing, old tables stay alive and the claimer of any entry we
+    // may end up spinning on will still write its distribution there.
+    HashTable *table = currentTable.load(std::memory_order_acquire);
+    uint64_t hash = HashPackedPos(packedPos) % table->size;
 
     // Now, see if the hash table already has an entry for the voxel. We'll
     // use quadratic probing when the hash table entry is already used for
@@ -172,7 +187,7 @@ const Distribution1D *SpatialLightDistribution::Lookup(const Point3f &p) const {
     int nProbes = 0;
     while (true) {
         ++nProbes;
-        HashEntry &entry = hashTable[hash];
+        HashEntry &entry = table->entries[hash];
         // Does the hash table entry at offset |hash| match the current point?
         uint64_t entryPackedPos = entry.packedPos.load(std::memory_order_acquire);
         if (entryPackedPos == packedPos) {
@@ -203,8 +218,8 @@ const Distribution1D *SpatialLightDistribution::Lookup(const Point3f &p) const {
             // allocated for another voxel. Advance to the next entry with
             // quadratic probing.
             hash += step * step;
-            if (hash >= hashTableSize)
-                hash %= hashTableSize;
+            if (hash >= table->size)
+                hash %= table->size;
             ++step;
         } else {
             // We have found an invalid entry. (Though this may have
@@ -214,13 +229,23 @@ const Distribution1D *SpatialLightDistribution::Lookup(const Point3f &p) const {
             uint64_t invalid = invalidPackedPos;
             if (entry.packedPos.compare_exchange_weak(invalid, packedPos)) {
                 // Success; we've claimed this position for this voxel's
-                // distribution. Now compute the sampling distribution and
-                // add it to the hash table. As long as packedPos has been
-                // set but the entry's distribution pointer is nullptr, any
-                // other threads looking up the distribution for this voxel
-                // will spin wait until the distribution pointer is
-                // written.
+                // distribution.  If the table is now more than half full,
+                // grow it before starting on the (possibly slow)
+                // distribution computation.
+                if (table->nEntries.fetch_add(1) + 1 > table->size / 2)
+                    Grow();
+
+                // Now compute the sampling distribution and add it to the
+                // hash table. As long as packedPos has been set but the
+                // entry's distribution pointer is nullptr, any other
+                // threads looking up the distribution for this voxel will
+                // spin wait until the distribution pointer is written.
                 Distribution1D *dist = ComputeDistribution(pi);
+                {
+                    std::lock_guard<std::mutex> lock(distributionsMutex);
+                    distributions.push_back(
+                        std::unique_ptr<Distribution1D>(dist));
+                }
                 entry.distribution.store(dist, std::memory_order_release);
                 ReportValue(nProbesPerLookup, nProbes);
                 return dist;
@@ -229,6 +254,78 @@ const Distribution1D *SpatialLightDistribution::Lookup(const Point3f &p) const {
     }
 }
 
+void SpatialLightDistribution::Grow() const {
+    std::lock_guard<std::mutex> lock(growMutex);
+    HashTable *table = currentTable.load(std::memory_order_acquire);
+    // Another thread may have grown the table while we waited on the lock.
+    if (table->size >= maxTableSize ||
+        table->nEntries.load() <= table->size / 2)
+        return;
+
+    std::unique_ptr<HashTable> grown(
+        new HashTable(std::min(2 * table->size, maxTableSize)));
+
+    // Carry over the entries whose distributions are ready.  Entries whose
+    // distributions are still being computed stay behind in the old table,
+    // where their claimer will finish them; if those voxels are looked up
+    // again through the new table, their distributions are recomputed.
+    size_t nCopied = 0;
+    for (size_t i = 0; i < table->size; ++i) {
+        uint64_t packedPos = table->entries[i].packedPos.load();
+        Distribution1D *dist = table->entries[i].distribution.load();
+        if (packedPos == invalidPackedPos || dist == nullptr) continue;
+        uint64_t hash = HashPackedPos(packedPos) % grown->size;
+        int step = 1;
+        while (grown->entries[hash].packedPos.load() != invalidPackedPos) {
+            hash += step * step;
+            if (hash >= grown->size) hash %= grown->size;
+            ++step;
+        }
+        grown->entries[hash].packedPos.store(packedPos);
+        grown->entries[hash].distribution.store(dist);
+        ++nCopied;
+    }
+    grown->nEntries.store(nCopied);
+
+    LOG(INFO) << "SpatialLightDistribution: grew hash table to " <<
+        grown->size << " entries (" << nCopied << " carried over)";
+    currentTable.store(grown.get(), std::memory_order_release);
+    tables.push_back(std::move(grown));
+}
+
+void SpatialLightDistribution::Warmup(const Camera &camera) {
+    // Trace a coarse grid of camera rays and compute the sampling
+    // distributions for the voxels their hit points land in.  This way the
+    // render threads mostly find the first-bounce distributions already in
+    // the table, rather than all stampeding on the same handful of lazily
+    // computed voxels when rendering starts.
+    Bounds2f sampleBounds = (Bounds2f)camera.film->GetSampleBounds();
+    PBRT_CONSTEXPR int nWarmupRays = 64;
+    ParallelFor2D(
+        [&](Point2i p) {
+            CameraSample cs;
+            cs.pFilm = sampleBounds.Lerp(Point2f((p.x + .5f) / nWarmupRays,
+                                                 (p.y + .5f) / nWarmupRays));
+            cs.pLens = Point2f(.5f, .5f);
+            cs.time = .5f;
+            Ray ray;
+            if (camera.GenerateRay(cs, &ray) == 0) return;
+            SurfaceInteraction isect;
+            if (scene.Intersect(ray, &isect)) Lookup(isect.p);
+        },
+        Point2i(nWarmupRays, nWarmupRays));
+}
+
+Bounds3f SpatialLightDistribution::VoxelBounds(Point3i pi) const {
+    Point3f p0(Float(pi[0]) / Float(nVoxels[0]),
+               Float(pi[1]) / Float(nVoxels[1]),
+               Float(pi[2]) / Float(nVoxels[2]));
+    Point3f p1(Float(pi[0] + 1) / Float(nVoxels[0]),
+               Float(pi[1] + 1) / Float(nVoxels[1]),
+               Float(pi[2] + 1) / Float(nVoxels[2]));
+    return Bounds3f(scene.WorldBound().Lerp(p0), scene.WorldBound().Lerp(p1));
+}
+
 Distribution1D *
 SpatialLightDistribution::ComputeDistribution(Point3i pi) const {
     ProfilePhase _(Prof::LightDistribCreation);
@@ -237,14 +334,7 @@ SpatialLightDistribution::ComputeDistribution(Point3i pi) const {
 
     // Compute the world-space bounding box of the voxel corresponding to
     // |pi|.
-    Point3f p0(Float(pi[0]) / Float(nVoxels[0]),
-               Float(pi[1]) / Float(nVoxels[1]),
-               Float(pi[2]) / Float(nVoxels[2]));
-    Point3f p1(Float(pi[0] + 1) / Float(nVoxels[0]),
-               Float(pi[1] + 1) / Float(nVoxels[1]),
-               Float(pi[2] + 1) / Float(nVoxels[2]));
-    Bounds3f voxelBounds(scene.WorldBound().Lerp(p0),
-                         scene.WorldBound().Lerp(p1));
+    Bounds3f voxelBounds = VoxelBounds(pi);
 
     // Compute the sampling distribution. Sample a number of points inside
     // voxelBounds using a 3D Halton sequence; at each one, sample each
@@ -299,4 +389,194 @@ SpatialLightDistribution::ComputeDistribution(Point3i pi) const {
     return new Distribution1D(&lightContrib[0], int(lightContrib.size()));
 }
 
+///////////////////////////////////////////////////////////////////////////
+// BVHLightDistribution
+
+// Lights per BVH leaf node and the maximum number of clusters a voxel's
+// distribution is refined into.  A larger cut gives a more accurate
+// distribution at a higher per-voxel cost; 64 clusters is plenty to
+// single out the nearby lights that dominate a voxel's illumination.
+static PBRT_CONSTEXPR int lightsPerLeaf = 4;
+static PBRT_CONSTEXPR int maxLightCutSize = 64;
+
+BVHLightDistribution::BVHLightDistribution(const Scene &scene, int maxVoxels)
+    : SpatialLightDistribution(scene, maxVoxels) {
+    Point3f worldCenter;
+    scene.WorldBound().BoundingSphere(&worldCenter, &worldRadius);
+
+    // Estimate each light's spatial bounds and power.  Light doesn't
+    // expose its geometry, so bound the points that Sample_Li() returns
+    // for a spread of samples; that gives exact bounds for delta position
+    // lights and a usable proxy for area lights.  Lights at infinity have
+    // no meaningful bounds and are kept out of the tree.
+    lightPower.resize(scene.lights.size());
+    std::vector<Bounds3f> lightBounds(scene.lights.size());
+    std::vector<int> treeLights;
+    Interaction ref(worldCenter, Normal3f(), Vector3f(), Vector3f(1, 0, 0),
+                    0 /* time */, MediumInterface());
+    for (size_t i = 0; i < scene.lights.size(); ++i) {
+        const auto &light = scene.lights[i];
+        lightPower[i] = light->Power().y();
+        if (light->flags & ((int)LightFlags::DeltaDirection |
+                            (int)LightFlags::Infinite)) {
+            unboundedLights.push_back(int(i));
+            continue;
+        }
+        Bounds3f b;
+        bool sampled = false;
+        for (int j = 0; j < 16; ++j) {
+            Float pdf;
+            Vector3f wi;
+            VisibilityTester vis;
+            Point2f u(RadicalInverse(0, j), RadicalInverse(1, j));
+            Spectrum Li = light->Sample_Li(ref, u, &wi, &pdf, &vis);
+            if (pdf > 0) {
+                b = Union(b, Bounds3f(vis.P1().p));
+                sampled = true;
+            }
+        }
+        if (sampled) {
+            lightBounds[i] = b;
+            treeLights.push_back(int(i));
+        } else
+            unboundedLights.push_back(int(i));
+    }
+
+    if (!treeLights.empty()) {
+        nodes.reserve(2 * treeLights.size());
+        BuildTree(treeLights, 0, int(treeLights.size()), lightBounds,
+                  lightPower);
+        orderedLights = std::move(treeLights);
+    }
+    LOG(INFO) << "BVHLightDistribution: " << nodes.size() << " nodes over "
+              << orderedLights.size() << " lights, "
+              << unboundedLights.size() << " unbounded lights";
+}
+
+int BVHLightDistribution::BuildTree(std::vector<int> &lightIndices, int start,
+                                    int end,
+                                    const std::vector<Bounds3f> &bounds,
+                                    const std::vector<Float> &power) {
+    // Record this node's index and recurse before filling it in; child
+    // nodes are appended to _nodes_, which may reallocate.
+    int nodeIndex = int(nodes.size());
+    nodes.push_back(LightNode());
+
+    Bounds3f b;
+    Float p = 0;
+    for (int i = start; i < end; ++i) {
+        b = Union(b, bounds[lightIndices[i]]);
+        p += power[lightIndices[i]];
+    }
+
+    int secondChild = -1;
+    if (end - start > lightsPerLeaf) {
+        // Split the lights in half along the axis with the largest extent
+        // of their bounds centroids.
+        Bounds3f centroidBounds;
+        for (int i = start; i < end; ++i) {
+            const Bounds3f &lb = bounds[lightIndices[i]];
+            centroidBounds =
+                Union(centroidBounds, .5f * lb.pMin + .5f * lb.pMax);
+        }
+        int axis = centroidBounds.MaximumExtent();
+        int mid = (start + end) / 2;
+        std::nth_element(&lightIndices[start], &lightIndices[mid],
+                         &lightIndices[0] + end, [&](int l0, int l1) {
+                             return bounds[l0].pMin[axis] + bounds[l0].pMax[axis] <
+                                    bounds[l1].pMin[axis] + bounds[l1].pMax[axis];
+                         });
+        BuildTree(lightIndices, start, mid, bounds, power);
+        secondChild = BuildTree(lightIndices, mid, end, bounds, power);
+    }
+
+    LightNode &node = nodes[nodeIndex];
+    node.bounds = b;
+    node.power = p;
+    node.secondChild = secondChild;
+    node.firstLight = start;
+    node.nLights = end - start;
+    return nodeIndex;
+}
+
+Float BVHLightDistribution::Importance(const LightNode &node,
+                                       const Bounds3f &voxelBounds,
+                                       const Point3f &pc) const {
+    // Estimate the cluster's contribution to the voxel as its total power
+    // over the squared distance to the cluster's center.  The distance is
+    // not allowed to fall below the cluster's radius, which both bounds
+    // the error of treating the cluster as a point and keeps the estimate
+    // finite when the voxel is inside the cluster.
+    Point3f c = .5f * node.bounds.pMin + .5f * node.bounds.pMax;
+    Float r2 = .25f * DistanceSquared(node.bounds.pMin, node.bounds.pMax);
+    Float d2 = std::max(DistanceSquared(pc, c), r2);
+    d2 = std::max(d2, Float(1e-4) * worldRadius * worldRadius);
+    return node.power / d2;
+}
+
+Distribution1D *BVHLightDistribution::ComputeDistribution(Point3i pi) const {
+    ProfilePhase _(Prof::LightDistribCreation);
+    ++nCreated;
+    ++nDistributions;
+
+    Bounds3f voxelBounds = VoxelBounds(pi);
+    Point3f pc = voxelBounds.Lerp(Point3f(.5f, .5f, .5f));
+
+    std::vector<Float> lightContrib(scene.lights.size(), Float(0));
+    if (!nodes.empty()) {
+        // Refine a cut through the light tree, always splitting the
+        // cluster with the highest importance for the voxel until the cut
+        // reaches maxLightCutSize clusters or bottoms out in leaves.
+        using Cluster = std::pair<Float, int>;
+        std::priority_queue<Cluster> cut;
+        std::vector<Cluster> cutClusters;
+        cut.push({Importance(nodes[0], voxelBounds, pc), 0});
+        while (!cut.empty()) {
+            Cluster c = cut.top();
+            cut.pop();
+            const LightNode &node = nodes[c.second];
+            if (node.secondChild < 0 ||
+                int(cut.size() + cutClusters.size()) + 2 > maxLightCutSize)
+                cutClusters.push_back(c);
+            else {
+                cut.push({Importance(nodes[c.second + 1], voxelBounds, pc),
+                          c.second + 1});
+                cut.push({Importance(nodes[node.secondChild], voxelBounds, pc),
+                          node.secondChild});
+            }
+        }
+
+        // Distribute each cluster's importance over the lights it covers,
+        // proportionally to their power.
+        for (const Cluster &c : cutClusters) {
+            const LightNode &node = nodes[c.second];
+            for (int i = node.firstLight; i < node.firstLight + node.nLights;
+                 ++i) {
+                int lightIndex = orderedLights[i];
+                lightContrib[lightIndex] +=
+                    c.first * lightPower[lightIndex] / node.power;
+            }
+        }
+    }
+
+    // An infinite light's power estimate includes a factor of the world
+    // bounding sphere's area; dividing that back out puts unbounded lights
+    // on roughly the same incident-radiance scale as the tree's
+    // power-over-distance-squared importance.
+    for (int lightIndex : unboundedLights)
+        lightContrib[lightIndex] +=
+            lightPower[lightIndex] / (worldRadius * worldRadius);
+
+    // As in SpatialLightDistribution::ComputeDistribution(), leave no
+    // light with zero sampling probability.
+    Float sumContrib =
+        std::accumulate(lightContrib.begin(), lightContrib.end(), Float(0));
+    Float avgContrib = sumContrib / lightContrib.size();
+    Float minContrib = (avgContrib > 0) ? .001 * avgContrib : 1;
+    for (size_t i = 0; i < lightContrib.size(); ++i)
+        lightContrib[i] = std::max(lightContrib[i], minContrib);
+
+    return new Distribution1D(&lightContrib[0], int(lightContrib.size()));
+}
+
 }  // namespace pbrt
@@ -54,6 +54,12 @@ class LightDistribution {
     // Given a point |p| in space, this method returns a (hopefully
     // effective) sampling distribution for light sources at that point.
     virtual const Distribution1D *Lookup(const Point3f &p) const = 0;
+
+    // Optionally precompute sampling distributions for the parts of the
+    // scene the given camera can see, so that render threads don't all
+    // stall on the same lazy computations for the first bounces.  The
+    // default implementation does nothing.
+    virtual void Warmup(const Camera &camera) {}
 };
 
 std::unique_ptr<LightDistribution> CreateLightSampleDistribution(
@@ -102,26 +108,101 @@ class SpatialLightDistribution : public LightDistribution {
     SpatialLightDistribution(const Scene &scene, int maxVoxels = 64);
     ~SpatialLightDistribution();
     const Distribution1D *Lookup(const Point3f &p) const;
+    void Warmup(const Camera &camera);
 
-  private:
+  protected:
     // Compute the sampling distribution for the voxel with integer
-    // coordiantes given by "pi".
-    Distribution1D *ComputeDistribution(Point3i pi) const;
+    // coordiantes given by "pi".  Virtual so that subclasses can keep the
+    // lazy hash-table caching in Lookup() but estimate the per-voxel light
+    // importance differently.
+    virtual Distribution1D *ComputeDistribution(Point3i pi) const;
+
+    // World-space bounding box of the voxel with integer coordinates "pi".
+    Bounds3f VoxelBounds(Point3i pi) const;
 
     const Scene &scene;
     int nVoxels[3];
 
-    // The hash table is a fixed number of HashEntry structs (where we
-    // allocate more than enough entries in the SpatialLightDistribution
-    // constructor). During rendering, the table is allocated without
-    // locks, using atomic operations. (See the Lookup() method
-    // implementation for details.)
+  private:
+    // The hash table is an array of HashEntry structs.  During rendering,
+    // entries are claimed without locks, using atomic operations. (See the
+    // Lookup() method implementation for details.)  The table starts small
+    // and is replaced with a larger one when it becomes half full, so that
+    // scenes that only ever visit a fraction of the voxel grid don't pay
+    // for a table sized for all of it.
     struct HashEntry {
         std::atomic<uint64_t> packedPos;
         std::atomic<Distribution1D *> distribution;
     };
-    mutable std::unique_ptr<HashEntry[]> hashTable;
-    size_t hashTableSize;
+    struct HashTable {
+        HashTable(size_t size);
+        const size_t size;
+        // Number of entries claimed in this table; growth is triggered
+        // when it exceeds size / 2.
+        std::atomic<size_t> nEntries;
+        std::unique_ptr<HashEntry[]> entries;
+    };
+
+    // Replace the current hash table with one twice as large, carrying
+    // over the entries whose distributions have been computed.
+    void Grow() const;
+
+    // Every table ever allocated is kept alive here so that threads still
+    // probing (or spinning on) an old table across a Grow() remain valid;
+    // protected by growMutex.  currentTable always points at the newest.
+    mutable std::vector<std::unique_ptr<HashTable>> tables;
+    mutable std::atomic<HashTable *> currentTable;
+    mutable std::mutex growMutex;
+    size_t maxTableSize;
+
+    // Owns every Distribution1D ever computed; a distribution may be
+    // reachable from more than one table after growth, so they can't be
+    // deleted through the table entries.
+    mutable std::vector<std::unique_ptr<Distribution1D>> distributions;
+    mutable std::mutex distributionsMutex;
+};
+
+// A spatially-varying light distribution for scenes with very large
+// numbers of light sources.  Lights are organized into a BVH with
+// per-node bounds and total power; for each voxel, a cut through the
+// tree is refined adaptively so that only the clusters that matter for
+// that region of space are considered individually.  This makes the
+// per-voxel cost O(cut size * log n + n) rather than the O(samples * n)
+// light sampling loop in SpatialLightDistribution, which matters once
+// scenes have tens of thousands of emitters.
+class BVHLightDistribution : public SpatialLightDistribution {
+  public:
+    BVHLightDistribution(const Scene &scene, int maxVoxels = 64);
+
+  protected:
+    Distribution1D *ComputeDistribution(Point3i pi) const;
+
+  private:
+    struct LightNode {
+        Bounds3f bounds;
+        Float power;
+        // Interior nodes store the index of their second child (the first
+        // child immediately follows the node); leaves store a range into
+        // _orderedLights_.
+        int secondChild = -1;
+        int firstLight = 0, nLights = 0;
+    };
+    int BuildTree(std::vector<int> &lightIndices, int start, int end,
+                  const std::vector<Bounds3f> &bounds,
+                  const std::vector<Float> &power);
+    Float Importance(const LightNode &node, const Bounds3f &voxelBounds,
+                     const Point3f &pc) const;
+
+    std::vector<LightNode> nodes;
+    // Indices of the scene's lights, reordered so that each LightNode leaf
+    // covers a contiguous range.
+    std::vector<int> orderedLights;
+    std::vector<Float> lightPower;
+    // Infinite and distant lights have no useful spatial bounds and are
+    // kept out of the tree; they are given importance based on their power
+    // alone.
+    std::vector<int> unboundedLights;
+    Float worldRadius;
 };
 
 }  // namespace pbrt
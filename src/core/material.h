@@ -55,6 +55,12 @@ class Material {
                                             MemoryArena &arena,
                                             TransportMode mode,
                                             bool allowMultipleLobes) const = 0;
+    // Returns true if this material may attach a BSSRDF to an
+    // interaction. Conservative: the Scene uses it to record whether any
+    // subsurface scattering is possible at all, so that integrators can
+    // compile the BSSRDF sampling path out of their hot loops; see
+    // Scene::Features().
+    virtual bool HasSubsurfaceScattering() const { return false; }
     virtual ~Material();
     static void Bump(const std::shared_ptr<Texture<Float>> &d,
                      SurfaceInteraction *si);
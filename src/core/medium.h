@@ -80,6 +80,21 @@ class Medium {
     virtual Spectrum Sample(const Ray &ray, Sampler &sampler,
                             MemoryArena &arena,
                             MediumInteraction *mi) const = 0;
+    // Place a scattering vertex at the caller-chosen parametric distance
+    // _t_ along _ray_ (e.g. equiangularly about a light) and return
+    // sigma_s times the transmittance to it -- the unweighted measurement
+    // contribution; the caller divides by its own placement pdf.  Media
+    // without analytic transmittance return black.
+    virtual Spectrum SampleAt(const Ray &ray, Float t, MemoryArena &arena,
+                              MediumInteraction *mi) const {
+        return Spectrum(0.f);
+    }
+    // Return the pdf per unit parametric distance with which Sample()
+    // places its vertex at _t_, averaged over spectral channels the same
+    // way Sample() selects its channel, or 0 when no analytic expression
+    // exists; integrators need this to combine Sample()'s vertex
+    // placement with other strategies via MIS.
+    virtual Float Pdf_Sample(const Ray &ray, Float t) const { return 0; }
 };
 
 // HenyeyGreenstein Declarations
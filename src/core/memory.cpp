@@ -33,11 +33,137 @@
 
 // core/memory.cpp*
 #include "memory.h"
+#include "stats.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
 
 namespace pbrt {
 
+STAT_MEMORY_COUNTER("Memory/Huge-page backed allocations", hugePageBytes);
+STAT_COUNTER("Memory/Budget spills triggered", nBudgetSpills);
+
+#if defined(__linux__)
+// Allocations of at least this size get their own 2MB-aligned anonymous
+// mapping with transparent huge pages requested, which cuts TLB misses when
+// traversing multi-GB BVH node and mesh attribute arrays.  The mapped size
+// is remembered so that FreeAligned() knows to munmap() rather than free().
+static PBRT_CONSTEXPR size_t hugePageSize = 2 * 1024 * 1024;
+static std::mutex hugeAllocMutex;
+static std::unordered_map<void *, size_t> hugeAllocations;
+
+static void *AllocHugePages(size_t size) {
+    // Round the mapping up to a huge page multiple and over-map by one huge
+    // page so the start address can be aligned to a 2MB boundary; the kernel
+    // only backs aligned, page-multiple ranges with huge pages.
+    size_t mapped = (size + hugePageSize - 1) & ~(hugePageSize - 1);
+    void *base = mmap(nullptr, mapped + hugePageSize, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) return nullptr;
+    uintptr_t start =
+        ((uintptr_t)base + hugePageSize - 1) & ~(hugePageSize - 1);
+    size_t headTrim = start - (uintptr_t)base;
+    if (headTrim > 0) munmap(base, headTrim);
+    if (hugePageSize - headTrim > 0)
+        munmap((void *)(start + mapped), hugePageSize - headTrim);
+#if defined(MADV_HUGEPAGE)
+    // Transparent huge pages degrade gracefully if none are available,
+    // unlike MAP_HUGETLB, which requires preallocated hugetlbfs pages.
+    madvise((void *)start, mapped, MADV_HUGEPAGE);
+#endif
+    hugePageBytes += mapped;
+    std::lock_guard<std::mutex> lock(hugeAllocMutex);
+    hugeAllocations[(void *)start] = mapped;
+    return (void *)start;
+}
+#endif  // __linux__
+
+// Memory Budget Manager Definitions
+struct BudgetSubsystem {
+    std::string name;
+    std::function<uint64_t()> liveBytes;
+    std::function<uint64_t()> spill;
+};
+static std::mutex budgetMutex;
+static std::vector<BudgetSubsystem> budgetSubsystems;
+static std::atomic<uint64_t> budgetLimit{0};
+
+void MemoryBudgetSetLimit(uint64_t bytes) { budgetLimit = bytes; }
+
+void MemoryBudgetRegister(const std::string &name,
+                          std::function<uint64_t()> liveBytes,
+                          std::function<uint64_t()> spill) {
+    std::lock_guard<std::mutex> lock(budgetMutex);
+    // Re-registration (e.g. pbrtInit() after pbrtCleanup()) replaces the
+    // existing entry rather than duplicating it.
+    for (BudgetSubsystem &subsystem : budgetSubsystems)
+        if (subsystem.name == name) {
+            subsystem.liveBytes = std::move(liveBytes);
+            subsystem.spill = std::move(spill);
+            return;
+        }
+    budgetSubsystems.push_back({name, std::move(liveBytes), std::move(spill)});
+}
+
+void MemoryBudgetCheck() {
+    uint64_t limit = budgetLimit.load(std::memory_order_relaxed);
+    if (limit == 0) return;
+    // Spill callbacks free memory and may allocate transiently; don't
+    // re-enter the budget check (and its mutex) from inside one.
+    static PBRT_THREAD_LOCAL bool inBudgetCheck;
+    if (inBudgetCheck) return;
+    inBudgetCheck = true;
+    std::lock_guard<std::mutex> lock(budgetMutex);
+    uint64_t spillAt = limit - limit / 10;
+    uint64_t total = 0;
+    std::vector<std::pair<uint64_t, size_t>> usage;
+    for (size_t i = 0; i < budgetSubsystems.size(); ++i) {
+        uint64_t bytes = budgetSubsystems[i].liveBytes();
+        total += bytes;
+        usage.push_back({bytes, i});
+    }
+    if (total >= spillAt) {
+        ++nBudgetSpills;
+        // Ask the largest consumers to spill until back under the
+        // threshold or out of candidates.
+        std::sort(usage.begin(), usage.end(),
+                  std::greater<std::pair<uint64_t, size_t>>());
+        for (const auto &u : usage) {
+            if (total < spillAt) break;
+            const BudgetSubsystem &subsystem = budgetSubsystems[u.second];
+            if (!subsystem.spill) continue;
+            uint64_t freed = subsystem.spill();
+            if (freed > 0) {
+                LOG(INFO) << "Memory budget: spilled " << freed
+                          << " bytes from " << subsystem.name;
+                total -= std::min(freed, total);
+            }
+        }
+        if (total >= limit)
+            Warning(
+                "Live memory (%.0f MB) exceeds the %.0f MB budget and no "
+                "further registered memory can be spilled.",
+                total / (1024. * 1024.), limit / (1024. * 1024.));
+    }
+    inBudgetCheck = false;
+}
+
 // Memory Allocation Functions
 void *AllocAligned(size_t size) {
+    // Large allocations are where budget overruns happen; check (and
+    // possibly spill) before making one.
+    if (size >= 2 * 1024 * 1024) MemoryBudgetCheck();
+#if defined(__linux__)
+    if (size >= hugePageSize) {
+        void *ptr = AllocHugePages(size);
+        if (ptr) return ptr;
+    }
+#endif
 #if defined(PBRT_HAVE__ALIGNED_MALLOC)
     return _aligned_malloc(size, PBRT_L1_CACHE_LINE_SIZE);
 #elif defined(PBRT_HAVE_POSIX_MEMALIGN)
@@ -51,6 +177,17 @@ void *AllocAligned(size_t size) {
 
 void FreeAligned(void *ptr) {
     if (!ptr) return;
+#if defined(__linux__)
+    {
+        std::lock_guard<std::mutex> lock(hugeAllocMutex);
+        auto iter = hugeAllocations.find(ptr);
+        if (iter != hugeAllocations.end()) {
+            munmap(ptr, iter->second);
+            hugeAllocations.erase(iter);
+            return;
+        }
+    }
+#endif
 #if defined(PBRT_HAVE__ALIGNED_MALLOC)
     _aligned_free(ptr);
 #else
@@ -58,4 +195,111 @@ void FreeAligned(void *ptr) {
 #endif
 }
 
+// MemoryArena Statistics
+STAT_INT_DISTRIBUTION("Memory/Arena bytes used between resets",
+                      arenaBytesUsed);
+STAT_INT_DISTRIBUTION("Memory/Arena allocation size", arenaAllocSize);
+
+void ReportArenaUsage(int64_t maxAllocated, int64_t allocSum,
+                      int64_t allocCount, int64_t allocMin, int64_t allocMax) {
+    ReportValue(arenaBytesUsed, maxAllocated);
+    // The arena pre-aggregates its allocation sizes, so merge them into
+    // the distribution wholesale rather than via ReportValue() per
+    // allocation.
+    arenaAllocSizesum += allocSum;
+    arenaAllocSizecount += allocCount;
+    arenaAllocSizemin = std::min(arenaAllocSizemin, allocMin);
+    arenaAllocSizemax = std::max(arenaAllocSizemax, allocMax);
+}
+
+// MemoryArena Block Pool
+// Blocks of the arenas' size classes are kept on global lock-free free
+// lists, one per class, rather than being returned to the system when an
+// arena is destroyed. Each free block stores the link to the next free
+// block in its own first bytes, so the pool needs no allocation of its own.
+static PBRT_CONSTEXPR size_t poolBlockSizes[] = {
+    SmallArenaBlockSize, DefaultArenaBlockSize, LargeArenaBlockSize};
+static PBRT_CONSTEXPR int nPoolClasses =
+    sizeof(poolBlockSizes) / sizeof(poolBlockSizes[0]);
+static std::atomic<uint8_t *> blockPoolHead[nPoolClasses];
+static std::atomic<uint64_t> nPoolBlocks[nPoolClasses];
+
+static inline int PoolClass(size_t size) {
+    for (int i = 0; i < nPoolClasses; ++i)
+        if (size == poolBlockSizes[i]) return i;
+    return -1;
+}
+
+static inline uint8_t *&NextPoolBlock(uint8_t *block) {
+    return *(uint8_t **)block;
+}
+
+uint8_t *AllocBlockPooled(size_t size) {
+    int c = PoolClass(size);
+    if (c >= 0) {
+        // Detach the entire free list with a single exchange; taking it
+        // wholesale (rather than popping one node with compare-exchange)
+        // sidesteps the ABA problem of Treiber-stack pops.
+        uint8_t *list = blockPoolHead[c].exchange(nullptr,
+                                                  std::memory_order_acquire);
+        if (list) {
+            uint8_t *block = list;
+            uint8_t *rest = NextPoolBlock(list);
+            if (rest) {
+                // Reattach the remaining blocks; pushing a list is ABA-safe
+                // since the old head is only stored, never dereferenced.
+                uint8_t *tail = rest;
+                while (NextPoolBlock(tail)) tail = NextPoolBlock(tail);
+                uint8_t *head =
+                    blockPoolHead[c].load(std::memory_order_relaxed);
+                do {
+                    NextPoolBlock(tail) = head;
+                } while (!blockPoolHead[c].compare_exchange_weak(
+                    head, rest, std::memory_order_release,
+                    std::memory_order_relaxed));
+            }
+            --nPoolBlocks[c];
+            return block;
+        }
+    }
+    return AllocAligned<uint8_t>(size);
+}
+
+void FreeBlockPooled(size_t size, uint8_t *block) {
+    if (!block) return;
+    int c = PoolClass(size);
+    if (c < 0) {
+        FreeAligned(block);
+        return;
+    }
+    uint8_t *head = blockPoolHead[c].load(std::memory_order_relaxed);
+    do {
+        NextPoolBlock(block) = head;
+    } while (!blockPoolHead[c].compare_exchange_weak(
+        head, block, std::memory_order_release, std::memory_order_relaxed));
+    ++nPoolBlocks[c];
+}
+
+uint64_t FreeBlockPool() {
+    uint64_t freed = 0;
+    for (int c = 0; c < nPoolClasses; ++c) {
+        uint8_t *list = blockPoolHead[c].exchange(nullptr);
+        while (list) {
+            uint8_t *next = NextPoolBlock(list);
+            FreeAligned(list);
+            list = next;
+            --nPoolBlocks[c];
+            freed += poolBlockSizes[c];
+        }
+    }
+    return freed;
+}
+
+uint64_t BlockPoolBytes() {
+    uint64_t bytes = 0;
+    for (int c = 0; c < nPoolClasses; ++c)
+        bytes += nPoolBlocks[c] * poolBlockSizes[c];
+    return bytes;
+}
+
 }  // namespace pbrt
@@ -40,8 +40,10 @@
 
 // core/memory.h*
 #include "pbrt.h"
+#include <functional>
 #include <list>
 #include <cstddef>
+#include <memory>
 
 namespace pbrt {
 
@@ -54,6 +56,63 @@ T *AllocAligned(size_t count) {
 }
 
 void FreeAligned(void *);
+// unique_ptr-compatible ownership of AllocAligned() arrays, so that large
+// structures (mesh attributes, film pixels) go through AllocAligned()'s
+// huge-page path instead of operator new[].
+struct FreeAlignedDeleter {
+    void operator()(void *ptr) const { FreeAligned(ptr); }
+};
+template <typename T>
+using AlignedUniquePtr = std::unique_ptr<T[], FreeAlignedDeleter>;
+template <typename T>
+AlignedUniquePtr<T> AllocAlignedArray(size_t count) {
+    T *ptr = AllocAligned<T>(count);
+    for (size_t i = 0; i < count; ++i) new (&ptr[i]) T();
+    return AlignedUniquePtr<T>(ptr);
+}
+// _MemoryArena_ block size classes. The "Memory/Arena" statistics (see
+// ReportArenaUsage() below) showed per-reset usage clustering around three
+// regimes, so rather than a single block size, callers pick the class
+// nearest their measured high-water mark: tile shading and per-mutation
+// scratch fit comfortably in the default, the parser's per-directive
+// strings rarely exceed a few KB, and accelerator builds allocate nodes by
+// the megabyte. The block pool keeps a free list per class, so sticking to
+// these sizes keeps tuned arenas on the pooled path.
+static PBRT_CONSTEXPR size_t SmallArenaBlockSize = 16384;
+static PBRT_CONSTEXPR size_t DefaultArenaBlockSize = 262144;
+static PBRT_CONSTEXPR size_t LargeArenaBlockSize = 4 * 1024 * 1024;
+
+// Global pool of _MemoryArena_ blocks. Arenas draw blocks from the pool and
+// return them when they're destroyed, so block reuse crosses tile and
+// thread boundaries instead of each arena churning through malloc. The pool
+// keeps one free list per block size class above; blocks of other sizes
+// bypass it. The free lists are lock-free; see memory.cpp.
+uint8_t *AllocBlockPooled(size_t size);
+void FreeBlockPooled(size_t size, uint8_t *block);
+uint64_t FreeBlockPool();
+uint64_t BlockPoolBytes();
+
+// Merges one arena's usage since its last statistics flush into the
+// "Memory/Arena" distributions; MemoryArena calls this from Reset() and
+// its destructor with pre-aggregated values so that Alloc() doesn't pay
+// for a function call per allocation.
+void ReportArenaUsage(int64_t maxAllocated, int64_t allocSum,
+                      int64_t allocCount, int64_t allocMin, int64_t allocMax);
+
+// Memory budget manager: subsystems register a callback that reports their
+// live bytes and, optionally, a spill callback that releases whatever can
+// safely be dropped and returns the number of bytes freed. When a budget
+// has been set (--memorybudget) and registered usage crosses 90% of it,
+// spill callbacks run from the largest consumer down. Only registered
+// subsystems are visible to the manager, so this is cooperative rather than
+// airtight, but it lets the big consumers -- BVH nodes, mip pyramids,
+// cached arena blocks -- yield memory instead of each assuming it owns the
+// machine.
+void MemoryBudgetSetLimit(uint64_t bytes);
+void MemoryBudgetRegister(const std::string &name,
+                          std::function<uint64_t()> liveBytes,
+                          std::function<uint64_t()> spill = nullptr);
+void MemoryBudgetCheck();
 class
 #ifdef PBRT_HAVE_ALIGNAS
 alignas(PBRT_L1_CACHE_LINE_SIZE)
@@ -61,11 +120,15 @@ alignas(PBRT_L1_CACHE_LINE_SIZE)
     MemoryArena {
   public:
     // MemoryArena Public Methods
-    MemoryArena(size_t blockSize = 262144) : blockSize(blockSize) {}
+    MemoryArena(size_t blockSize = DefaultArenaBlockSize)
+        : blockSize(blockSize) {}
     ~MemoryArena() {
-        FreeAligned(currentBlock);
-        for (auto &block : usedBlocks) FreeAligned(block.second);
-        for (auto &block : availableBlocks) FreeAligned(block.second);
+        FlushStats();
+        FreeBlockPooled(currentAllocSize, currentBlock);
+        for (auto &block : usedBlocks)
+            FreeBlockPooled(block.first, block.second);
+        for (auto &block : availableBlocks)
+            FreeBlockPooled(block.first, block.second);
     }
     void *Alloc(size_t nBytes) {
         // Round up _nBytes_ to minimum machine alignment
@@ -81,6 +144,15 @@ alignas(PBRT_L1_CACHE_LINE_SIZE)
         static_assert(IsPowerOf2(align), "Minimum alignment not a power of two");
 #endif
         nBytes = (nBytes + align - 1) & ~(align - 1);
+
+        // Update arena usage statistics
+        ++allocCount;
+        allocSum += nBytes;
+        allocMin = std::min(allocMin, (int64_t)nBytes);
+        allocMax = std::max(allocMax, (int64_t)nBytes);
+        bytesAllocated += nBytes;
+        maxAllocated = std::max(maxAllocated, bytesAllocated);
+
         if (currentBlockPos + nBytes > currentAllocSize) {
             // Add current block to _usedBlocks_ list
             if (currentBlock) {
@@ -104,7 +176,7 @@ alignas(PBRT_L1_CACHE_LINE_SIZE)
             }
             if (!currentBlock) {
                 currentAllocSize = std::max(nBytes, blockSize);
-                currentBlock = AllocAligned<uint8_t>(currentAllocSize);
+                currentBlock = AllocBlockPooled(currentAllocSize);
             }
             currentBlockPos = 0;
         }
@@ -120,9 +192,58 @@ alignas(PBRT_L1_CACHE_LINE_SIZE)
         return ret;
     }
     void Reset() {
+        FlushStats();
         currentBlockPos = 0;
         availableBlocks.splice(availableBlocks.begin(), usedBlocks);
     }
+    // Nested arena scopes: a _Checkpoint_ marks the allocation position so
+    // everything allocated after it can be released with
+    // RestoreCheckpoint() while earlier allocations stay live. Recursive
+    // integrators release each bounce's scratch this way, bounding the
+    // arena to one bounce's worth of memory instead of growing it to the
+    // deepest chain seen by the tile. Checkpoints must be restored in
+    // LIFO order and do not survive Reset().
+    struct Checkpoint {
+        uint8_t *block;
+        size_t blockPos;
+        size_t nUsedBlocks;
+        size_t bytesAllocated;
+    };
+    Checkpoint GetCheckpoint() const {
+        return {currentBlock, currentBlockPos, usedBlocks.size(),
+                bytesAllocated};
+    }
+    void RestoreCheckpoint(const Checkpoint &c) {
+        // Released allocations no longer count as live, though the
+        // high-water mark they set stands.
+        bytesAllocated = c.bytesAllocated;
+        if (currentBlock == c.block) {
+            currentBlockPos = c.blockPos;
+            return;
+        }
+        // The active block changed since the checkpoint; the checkpoint's
+        // block (if any) was retired to the back of _usedBlocks_. Recycle
+        // the blocks filled since, then reinstate it as the active block.
+        if (currentBlock) {
+            availableBlocks.push_back(
+                std::make_pair(currentAllocSize, currentBlock));
+            currentBlock = nullptr;
+            currentAllocSize = 0;
+        }
+        while (usedBlocks.size() > c.nUsedBlocks) {
+            std::pair<size_t, uint8_t *> block = usedBlocks.back();
+            usedBlocks.pop_back();
+            if (block.second == c.block) {
+                currentAllocSize = block.first;
+                currentBlock = block.second;
+                currentBlockPos = c.blockPos;
+                return;
+            }
+            availableBlocks.push_back(block);
+        }
+        // The checkpoint was taken before the arena's first allocation
+        currentBlockPos = 0;
+    }
     size_t TotalAllocated() const {
         size_t total = currentAllocSize;
         for (const auto &alloc : usedBlocks) total += alloc.first;
@@ -133,11 +254,30 @@ alignas(PBRT_L1_CACHE_LINE_SIZE)
   private:
     MemoryArena(const MemoryArena &) = delete;
     MemoryArena &operator=(const MemoryArena &) = delete;
+
+    // MemoryArena Private Methods
+    void FlushStats() {
+        if (allocCount > 0)
+            ReportArenaUsage((int64_t)maxAllocated, allocSum, allocCount,
+                             allocMin, allocMax);
+        bytesAllocated = maxAllocated = 0;
+        allocSum = allocCount = 0;
+        allocMin = std::numeric_limits<int64_t>::max();
+        allocMax = std::numeric_limits<int64_t>::lowest();
+    }
+
     // MemoryArena Private Data
     const size_t blockSize;
     size_t currentBlockPos = 0, currentAllocSize = 0;
     uint8_t *currentBlock = nullptr;
     std::list<std::pair<size_t, uint8_t *>> usedBlocks, availableBlocks;
+    // Usage gathered since the last FlushStats(); _maxAllocated_ is the
+    // high-water mark of live bytes, which is the number to compare
+    // against _blockSize_ when tuning a call site.
+    size_t bytesAllocated = 0, maxAllocated = 0;
+    int64_t allocSum = 0, allocCount = 0;
+    int64_t allocMin = std::numeric_limits<int64_t>::max();
+    int64_t allocMax = std::numeric_limits<int64_t>::lowest();
 };
 
 template <typename T, int logBlockSize>
@@ -149,9 +289,7 @@ class BlockedArray {
         int nAlloc = RoundUp(uRes) * RoundUp(vRes);
         data = AllocAligned<T>(nAlloc);
         for (int i = 0; i < nAlloc; ++i) new (&data[i]) T();
-        if (d)
-            for (int v = 0; v < vRes; ++v)
-                for (int u = 0; u < uRes; ++u) (*this)(u, v) = d[v * uRes + u];
+        if (d) CopyIn(d);
     }
     PBRT_CONSTEXPR int BlockSize() const { return 1 << logBlockSize; }
     int RoundUp(int x) const {
@@ -179,10 +317,36 @@ class BlockedArray {
         offset += BlockSize() * ov + ou;
         return data[offset];
     }
-    void GetLinearArray(T *a) const {
-        for (int v = 0; v < vRes; ++v)
-            for (int u = 0; u < uRes; ++u) *a++ = (*this)(u, v);
+    // Bulk copy between the tiled layout and a linear uRes x vRes array.
+    // Each block row is a contiguous span both linearly and in the tiled
+    // layout, so the copies run as block-width blits (which the compiler
+    // vectorizes) instead of per-texel address computations.
+    void CopyIn(const T *d) {
+        for (int v = 0; v < vRes; ++v) {
+            int bv = Block(v), ov = Offset(v);
+            for (int u0 = 0; u0 < uRes; u0 += BlockSize()) {
+                int count = std::min(BlockSize(), uRes - u0);
+                T *dst = data +
+                         BlockSize() * BlockSize() * (uBlocks * bv + Block(u0)) +
+                         BlockSize() * ov;
+                std::copy(d + v * uRes + u0, d + v * uRes + u0 + count, dst);
+            }
+        }
+    }
+    void CopyOut(T *a) const {
+        for (int v = 0; v < vRes; ++v) {
+            int bv = Block(v), ov = Offset(v);
+            for (int u0 = 0; u0 < uRes; u0 += BlockSize()) {
+                int count = std::min(BlockSize(), uRes - u0);
+                const T *src =
+                    data +
+                    BlockSize() * BlockSize() * (uBlocks * bv + Block(u0)) +
+                    BlockSize() * ov;
+                std::copy(src, src + count, a + v * uRes + u0);
+            }
+        }
     }
+    void GetLinearArray(T *a) const { CopyOut(a); }
 
   private:
     // BlockedArray Private Data
@@ -34,6 +34,11 @@
 #include "microfacet.h"
 #include "reflection.h"
 
+#if defined(__AVX__) && !defined(PBRT_FLOAT_AS_DOUBLE)
+#include <immintrin.h>
+#define PBRT_MICROFACET_HAVE_AVX
+#endif
+
 namespace pbrt {
 
 // Microfacet Utility Functions
@@ -183,6 +188,112 @@ Float TrowbridgeReitzDistribution::Lambda(const Vector3f &w) const {
     return (-1 + std::sqrt(1.f + alpha2Tan2Theta)) / 2;
 }
 
+void MicrofacetDistribution::D_N(const Vector3f *wh, int n,
+                                 Float *Dout) const {
+    for (int i = 0; i < n; ++i) Dout[i] = D(wh[i]);
+}
+
+void MicrofacetDistribution::Lambda_N(const Vector3f *w, int n,
+                                      Float *out) const {
+    for (int i = 0; i < n; ++i) out[i] = Lambda(w[i]);
+}
+
+void MicrofacetDistribution::G_N(const Vector3f &wo, const Vector3f *wi, int n,
+                                 Float *Gout) const {
+    for (int i = 0; i < n; ++i) Gout[i] = G(wo, wi[i]);
+}
+
+void TrowbridgeReitzDistribution::G_N(const Vector3f &wo, const Vector3f *wi,
+                                      int n, Float *Gout) const {
+    Float lambdaO = Lambda(wo);
+    Lambda_N(wi, n, Gout);
+    for (int i = 0; i < n; ++i) Gout[i] = 1 / (1 + lambdaO + Gout[i]);
+}
+
+#if defined(PBRT_MICROFACET_HAVE_AVX)
+void TrowbridgeReitzDistribution::D_N(const Vector3f *wh, int n,
+                                      Float *Dout) const {
+    // For unit _wh_, $\cos^2\phi\,\tan^2\theta = x^2/z^2$ (and likewise
+    // in $y$), so the scalar expression in D() reduces to pure
+    // per-component arithmetic that vectorizes across eight normals.
+    __m256 ax2 = _mm256_set1_ps(alphax * alphax);
+    __m256 ay2 = _mm256_set1_ps(alphay * alphay);
+    __m256 invNorm = _mm256_set1_ps(1 / (Pi * alphax * alphay));
+    __m256 one = _mm256_set1_ps(1.f);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        float xs[8], ys[8], zs[8];
+        for (int j = 0; j < 8; ++j) {
+            xs[j] = wh[i + j].x;
+            ys[j] = wh[i + j].y;
+            zs[j] = wh[i + j].z;
+        }
+        __m256 x = _mm256_loadu_ps(xs), y = _mm256_loadu_ps(ys),
+               z = _mm256_loadu_ps(zs);
+        __m256 z2 = _mm256_mul_ps(z, z);
+        __m256 e = _mm256_div_ps(
+            _mm256_add_ps(_mm256_div_ps(_mm256_mul_ps(x, x), ax2),
+                          _mm256_div_ps(_mm256_mul_ps(y, y), ay2)),
+            z2);
+        __m256 onePlusE = _mm256_add_ps(one, e);
+        __m256 d = _mm256_div_ps(
+            invNorm, _mm256_mul_ps(_mm256_mul_ps(z2, z2),
+                                   _mm256_mul_ps(onePlusE, onePlusE)));
+        // Grazing normals with $z = 0$ produce NaNs above; D() defines
+        // them to be zero.
+        d = _mm256_and_ps(d,
+                          _mm256_cmp_ps(z2, _mm256_setzero_ps(), _CMP_NEQ_OQ));
+        _mm256_storeu_ps(&Dout[i], d);
+    }
+    for (; i < n; ++i) Dout[i] = D(wh[i]);
+}
+
+void TrowbridgeReitzDistribution::Lambda_N(const Vector3f *w, int n,
+                                           Float *out) const {
+    // As in D_N(), $\alpha^2 \tan^2\theta = (x^2 \alpha_x^2 +
+    // y^2 \alpha_y^2) / z^2$ for unit _w_.
+    __m256 ax2 = _mm256_set1_ps(alphax * alphax);
+    __m256 ay2 = _mm256_set1_ps(alphay * alphay);
+    __m256 one = _mm256_set1_ps(1.f);
+    __m256 half = _mm256_set1_ps(0.5f);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        float xs[8], ys[8], zs[8];
+        for (int j = 0; j < 8; ++j) {
+            xs[j] = w[i + j].x;
+            ys[j] = w[i + j].y;
+            zs[j] = w[i + j].z;
+        }
+        __m256 x = _mm256_loadu_ps(xs), y = _mm256_loadu_ps(ys),
+               z = _mm256_loadu_ps(zs);
+        __m256 z2 = _mm256_mul_ps(z, z);
+        __m256 a2t2 = _mm256_div_ps(
+            _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(x, x), ax2),
+                          _mm256_mul_ps(_mm256_mul_ps(y, y), ay2)),
+            z2);
+        __m256 lambda = _mm256_mul_ps(
+            half,
+            _mm256_sub_ps(_mm256_sqrt_ps(_mm256_add_ps(one, a2t2)), one));
+        // Grazing directions have an infinite tangent; Lambda() returns
+        // zero for them.
+        lambda = _mm256_and_ps(
+            lambda, _mm256_cmp_ps(z2, _mm256_setzero_ps(), _CMP_NEQ_OQ));
+        _mm256_storeu_ps(&out[i], lambda);
+    }
+    for (; i < n; ++i) out[i] = Lambda(w[i]);
+}
+#else
+void TrowbridgeReitzDistribution::D_N(const Vector3f *wh, int n,
+                                      Float *Dout) const {
+    MicrofacetDistribution::D_N(wh, n, Dout);
+}
+
+void TrowbridgeReitzDistribution::Lambda_N(const Vector3f *w, int n,
+                                           Float *out) const {
+    MicrofacetDistribution::Lambda_N(w, n, out);
+}
+#endif  // PBRT_MICROFACET_HAVE_AVX
+
 std::string BeckmannDistribution::ToString() const {
     return StringPrintf("[ BeckmannDistribution alphax: %f alphay: %f ]",
                         alphax, alphay);
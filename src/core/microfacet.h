@@ -51,6 +51,13 @@ class MicrofacetDistribution {
     virtual ~MicrofacetDistribution();
     virtual Float D(const Vector3f &wh) const = 0;
     virtual Float Lambda(const Vector3f &w) const = 0;
+    // Batch variants used by BSDF::f_N(); the defaults loop over the
+    // scalar methods, and distributions with vectorizable closed forms
+    // override them.
+    virtual void D_N(const Vector3f *wh, int n, Float *Dout) const;
+    virtual void Lambda_N(const Vector3f *w, int n, Float *out) const;
+    virtual void G_N(const Vector3f &wo, const Vector3f *wi, int n,
+                     Float *Gout) const;
     Float G1(const Vector3f &w) const {
         //    if (Dot(w, wh) * CosTheta(w) < 0.) return 0.;
         return 1 / (1 + Lambda(w));
@@ -112,6 +119,10 @@ class TrowbridgeReitzDistribution : public MicrofacetDistribution {
           alphax(std::max(Float(0.001), alphax)),
           alphay(std::max(Float(0.001), alphay)) {}
     Float D(const Vector3f &wh) const;
+    void D_N(const Vector3f *wh, int n, Float *Dout) const;
+    void Lambda_N(const Vector3f *w, int n, Float *out) const;
+    void G_N(const Vector3f &wo, const Vector3f *wi, int n,
+             Float *Gout) const;
     Vector3f Sample_wh(const Vector3f &wo, const Point2f &u) const;
     std::string ToString() const;
 
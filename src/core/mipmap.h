@@ -42,15 +42,35 @@
 #include "pbrt.h"
 #include "spectrum.h"
 #include "texture.h"
+#include "texcache.h"
 #include "stats.h"
+#include "memory.h"
 #include "parallel.h"
+#include <atomic>
+#include <cstring>
+
+// Use AVX for the EWA filter's inner loop when available; the kernel
+// assumes 32-bit floats.
+#if defined(__AVX__) && !defined(PBRT_FLOAT_AS_DOUBLE)
+#define PBRT_MIPMAP_HAVE_AVX 1
+#include <immintrin.h>
+#endif
 
 namespace pbrt {
 
 STAT_COUNTER("Texture/EWA lookups", nEWALookups);
 STAT_COUNTER("Texture/Trilinear lookups", nTrilerpLookups);
+STAT_COUNTER("Texture/Texels fetched", nTexelFetches);
 STAT_MEMORY_COUNTER("Memory/Texture MIP maps", mipMapMemory);
 
+// Live (currently allocated) pyramid bytes across all MIPMap
+// instantiations, for the memory budget manager; unlike the stat above
+// this is queryable at any time and decreases when maps are freed.
+inline std::atomic<uint64_t> &MipMapLiveBytes() {
+    static std::atomic<uint64_t> bytes{0};
+    return bytes;
+}
+
 // MIPMap Helper Declarations
 enum class ImageWrap { Repeat, Black, Clamp };
 struct ResampleWeight {
@@ -58,19 +78,120 @@ struct ResampleWeight {
     Float weight[4];
 };
 
+// Pre-mipped texture files (".txp", written by "imgtool maketx") hold a
+// _TxpHeader_ followed by each MIP level's texels as RGB float32 triples in
+// row-major order, finest level first, so that loading one is a single
+// read-only file mapping with no resampling or filtering work at startup.
+struct TxpHeader {
+    static PBRT_CONSTEXPR uint32_t Magic = 0x30707874;  // "txp0"
+    uint32_t magic;
+    int32_t resolution[2];  // power-of-two extent of the finest level
+    int32_t nLevels;
+    int32_t wrapMode;  // ImageWrap the pyramid was resampled with
+    int32_t flags;     // reserved for future texel formats; must be zero
+};
+
+// A mapped .txp file; _levels_[i] points at level _i_'s texels within
+// _mapping_, which keeps the file mapped while referenced.
+struct TxpFile {
+    TxpHeader header;
+    std::vector<const float *> levels;
+    std::shared_ptr<const void> mapping;
+};
+
+inline bool ReadTxpFile(const std::string &filename, TxpFile *txp) {
+    size_t size;
+    txp->mapping = MapFileReadOnly(filename, &size);
+    if (!txp->mapping) return false;
+    if (size < sizeof(TxpHeader)) {
+        Error("%s: truncated .txp file", filename.c_str());
+        return false;
+    }
+    memcpy(&txp->header, txp->mapping.get(), sizeof(TxpHeader));
+    const TxpHeader &h = txp->header;
+    if (h.magic != TxpHeader::Magic) {
+        Error("%s: not a .txp file", filename.c_str());
+        return false;
+    }
+    if (h.resolution[0] <= 0 || h.resolution[1] <= 0 ||
+        !IsPowerOf2(h.resolution[0]) || !IsPowerOf2(h.resolution[1]) ||
+        h.nLevels !=
+            1 + Log2Int(std::max(h.resolution[0], h.resolution[1])) ||
+        h.flags != 0) {
+        Error("%s: invalid or unsupported .txp header", filename.c_str());
+        return false;
+    }
+
+    // Compute the level pointers and check the file covers all the levels
+    const char *ptr = (const char *)txp->mapping.get() + sizeof(TxpHeader);
+    size_t needed = sizeof(TxpHeader);
+    for (int i = 0; i < h.nLevels; ++i) {
+        int w = std::max(1, h.resolution[0] >> i);
+        int ht = std::max(1, h.resolution[1] >> i);
+        txp->levels.push_back((const float *)ptr);
+        size_t levelBytes = 3 * sizeof(float) * (size_t)w * ht;
+        ptr += levelBytes;
+        needed += levelBytes;
+    }
+    if (size < needed) {
+        Error("%s: truncated .txp file", filename.c_str());
+        txp->levels.clear();
+        return false;
+    }
+    return true;
+}
+
+// Block Compression Declarations
+
+// A 4x4 block of block-compressed texels; each texel is reconstructed by
+// interpolating between the block's two endpoint texels with its 4-bit
+// index. RGBSpectrum blocks are 32 bytes (2 bytes per texel, a 6x
+// reduction over raw storage); Float blocks are 16 (1 byte per texel).
+template <typename T>
+struct CompressedTexelBlock {
+    T endpoints[2];
+    uint8_t indices[8];  // 16 texels, 4 bits each, row-major in the block
+};
+
+inline Float TexelDot(Float a, Float b) { return a * b; }
+template <int n>
+inline Float TexelDot(const CoefficientSpectrum<n> &a,
+                      const CoefficientSpectrum<n> &b) {
+    Float d = 0;
+    for (int i = 0; i < n; ++i) d += a[i] * b[i];
+    return d;
+}
+
 // MIPMap Declarations
 template <typename T>
 class MIPMap {
   public:
     // MIPMap Public Methods
     MIPMap(const Point2i &resolution, const T *data, bool doTri = false,
-           Float maxAniso = 8.f, ImageWrap wrapMode = ImageWrap::Repeat);
+           Float maxAniso = 8.f, ImageWrap wrapMode = ImageWrap::Repeat,
+           bool compress = false);
+    MIPMap(const Point2i &resolution, std::vector<const T *> levels,
+           std::shared_ptr<const void> owner, size_t ownedBytes,
+           bool doTri = false, Float maxAniso = 8.f,
+           ImageWrap wrapMode = ImageWrap::Repeat);
+    ~MIPMap() { MipMapLiveBytes() -= residentBytes; }
     int Width() const { return resolution[0]; }
     int Height() const { return resolution[1]; }
     int Levels() const { return pyramid.size(); }
+    // Label this map's --texreport access record (typically with the
+    // image filename); a no-op unless the report is enabled.
+    void SetAccessName(const std::string &name) {
+        if (accessRecord) accessRecord->name = name;
+    }
     const T &Texel(int level, int s, int t) const;
     T Lookup(const Point2f &st, Float width = 0.f) const;
     T Lookup(const Point2f &st, Vector2f dstdx, Vector2f dstdy) const;
+    // Trilinearly filtered lookup that also returns the exact (s, t)
+    // partial derivatives of the filtered reconstruction, computed from
+    // the same four texels per level as the value itself; bump mapping
+    // uses this to get the displacement and its gradient in one lookup.
+    T LookupWithGradient(const Point2f &st, Vector2f dstdx, Vector2f dstdy,
+                         T *dfds, T *dfdt) const;
 
   private:
     // MIPMap Private Methods
@@ -100,7 +221,11 @@ class MIPMap {
         return v.Clamp(0.f, Infinity);
     }
     T triangle(int level, const Point2f &st) const;
+    T triangleWithGradient(int level, const Point2f &st, T *dfds,
+                           T *dfdt) const;
     T EWA(int level, Point2f st, Vector2f dst0, Vector2f dst1) const;
+    void compressLevels();
+    const T &compressedTexel(int level, int s, int t) const;
 
     // MIPMap Private Data
     const bool doTrilinear;
@@ -108,6 +233,23 @@ class MIPMap {
     const ImageWrap wrapMode;
     Point2i resolution;
     std::vector<std::unique_ptr<BlockedArray<T>>> pyramid;
+    // Per-level resolution and, for levels paged out to the tiled texture
+    // cache, the cache plane id (-1 for resident levels, whose _pyramid_
+    // entry is non-null).
+    std::vector<Point2i> levelRes;
+    std::vector<int> levelPlane;
+    // Pre-filtered levels adopted from a .txp file; when a level's entry is
+    // non-null it takes priority over _pyramid_ and the tile cache, and
+    // _levelOwner_ keeps the backing storage (the file mapping, or a
+    // converted copy of it) alive for the map's lifetime.
+    std::vector<const T *> levelData;
+    std::shared_ptr<const void> levelOwner;
+    // Optional block-compressed storage (the "encoding" texture
+    // parameter); when present it replaces the pyramid entirely and
+    // Texel() decodes blocks through a small per-thread ring.
+    std::vector<std::unique_ptr<CompressedTexelBlock<T>[]>> compressedLevels;
+    TextureAccessRecord *accessRecord = nullptr;
+    size_t residentBytes = 0;
     static PBRT_CONSTEXPR int WeightLUTSize = 128;
     static Float weightLut[WeightLUTSize];
 };
@@ -115,7 +257,7 @@ class MIPMap {
 // MIPMap Method Definitions
 template <typename T>
 MIPMap<T>::MIPMap(const Point2i &res, const T *img, bool doTrilinear,
-                  Float maxAnisotropy, ImageWrap wrapMode)
+                  Float maxAnisotropy, ImageWrap wrapMode, bool compress)
     : doTrilinear(doTrilinear),
       maxAnisotropy(maxAnisotropy),
       wrapMode(wrapMode),
@@ -184,16 +326,21 @@ MIPMap<T>::MIPMap(const Point2i &res, const T *img, bool doTrilinear,
     // Initialize levels of MIPMap from image
     int nLevels = 1 + Log2Int(std::max(resolution[0], resolution[1]));
     pyramid.resize(nLevels);
+    levelRes.resize(nLevels);
+    levelPlane.assign(nLevels, -1);
+    levelData.assign(nLevels, nullptr);
 
     // Initialize most detailed level of MIPMap
     pyramid[0].reset(
         new BlockedArray<T>(resolution[0], resolution[1],
                             resampledImage ? resampledImage.get() : img));
+    levelRes[0] = resolution;
     for (int i = 1; i < nLevels; ++i) {
         // Initialize $i$th MIPMap level from $i-1$st level
         int sRes = std::max(1, pyramid[i - 1]->uSize() / 2);
         int tRes = std::max(1, pyramid[i - 1]->vSize() / 2);
         pyramid[i].reset(new BlockedArray<T>(sRes, tRes));
+        levelRes[i] = Point2i(sRes, tRes);
 
         // Filter four texels from finer level of pyramid
         ParallelFor([&](int t) {
@@ -206,6 +353,39 @@ MIPMap<T>::MIPMap(const Point2i &res, const T *img, bool doTrilinear,
         }, tRes, 16);
     }
 
+    // Page large levels out to the tiled texture cache, if enabled. The
+    // coarse levels stay resident: they are touched by almost every lookup
+    // and together cost little more than the threshold itself. Only the
+    // resident remainder counts against the render's memory.
+    if (PbrtOptions.texAccessReport)
+        accessRecord = RegisterTextureAccess(resolution, levelRes, sizeof(T));
+    residentBytes = (4 * (size_t)resolution[0] * resolution[1] * sizeof(T)) / 3;
+
+    // Optionally re-encode the pyramid as block-compressed texels; this
+    // frees the pyramid and recomputes _residentBytes_. Compressed maps
+    // are already several times smaller than raw storage and aren't paged.
+    if (compress) compressLevels();
+    if (PbrtOptions.texCacheMB > 0 && compressedLevels.empty()) {
+        PBRT_CONSTEXPR size_t residentLevelBytes = 64 * 1024;
+        for (int i = 0; i < nLevels; ++i) {
+            size_t levelBytes =
+                (size_t)levelRes[i].x * levelRes[i].y * sizeof(T);
+            if (levelBytes <= residentLevelBytes) continue;
+            // Copy the level to row-major order and hand it to the cache
+            std::unique_ptr<T[]> rowMajor(
+                new T[(size_t)levelRes[i].x * levelRes[i].y]);
+            for (int t = 0; t < levelRes[i].y; ++t)
+                for (int s = 0; s < levelRes[i].x; ++s)
+                    rowMajor[(size_t)t * levelRes[i].x + s] =
+                        (*pyramid[i])(s, t);
+            levelPlane[i] = TextureTileCache::Instance()->AddPlane(
+                rowMajor.get(), levelRes[i].x, levelRes[i].y, sizeof(T));
+            if (levelPlane[i] < 0) break;
+            pyramid[i].reset();
+            residentBytes -= std::min(residentBytes, levelBytes);
+        }
+    }
+
     // Initialize EWA filter weights if needed
     if (weightLut[0] == 0.) {
         for (int i = 0; i < WeightLUTSize; ++i) {
@@ -214,31 +394,188 @@ MIPMap<T>::MIPMap(const Point2i &res, const T *img, bool doTrilinear,
             weightLut[i] = std::exp(-alpha * r2) - std::exp(-alpha);
         }
     }
-    mipMapMemory += (4 * resolution[0] * resolution[1] * sizeof(T)) / 3;
+    mipMapMemory += residentBytes;
+    MipMapLiveBytes() += residentBytes;
+    MemoryBudgetCheck();
+}
+
+// Wrap pre-filtered MIP levels read from a .txp file; _levels_[i] points at
+// level _i_'s texels in row-major order and _owner_ keeps that storage alive
+// for the map's lifetime. No resampling or filtering happens here.
+// _ownedBytes_ is the heap memory the levels actually cost: zero when they
+// alias a read-only file mapping (those pages are clean and reclaimable by
+// the OS, so they don't count against the render's memory), or the size of
+// the converted copy otherwise.
+template <typename T>
+MIPMap<T>::MIPMap(const Point2i &res, std::vector<const T *> levels,
+                  std::shared_ptr<const void> owner, size_t ownedBytes,
+                  bool doTrilinear, Float maxAnisotropy, ImageWrap wrapMode)
+    : doTrilinear(doTrilinear),
+      maxAnisotropy(maxAnisotropy),
+      wrapMode(wrapMode),
+      resolution(res),
+      levelData(std::move(levels)),
+      levelOwner(std::move(owner)) {
+    ProfilePhase _(Prof::MIPMapCreation);
+    int nLevels = (int)levelData.size();
+    pyramid.resize(nLevels);
+    levelRes.resize(nLevels);
+    levelPlane.assign(nLevels, -1);
+    for (int i = 0; i < nLevels; ++i)
+        levelRes[i] = Point2i(std::max(1, resolution[0] >> i),
+                              std::max(1, resolution[1] >> i));
+    if (PbrtOptions.texAccessReport)
+        accessRecord = RegisterTextureAccess(resolution, levelRes, sizeof(T));
+    residentBytes = ownedBytes;
+
+    // Initialize EWA filter weights if needed
+    if (weightLut[0] == 0.) {
+        for (int i = 0; i < WeightLUTSize; ++i) {
+            Float alpha = 2;
+            Float r2 = Float(i) / Float(WeightLUTSize - 1);
+            weightLut[i] = std::exp(-alpha * r2) - std::exp(-alpha);
+        }
+    }
+    mipMapMemory += residentBytes;
+    MipMapLiveBytes() += residentBytes;
+    MemoryBudgetCheck();
 }
 
 template <typename T>
 const T &MIPMap<T>::Texel(int level, int s, int t) const {
     CHECK_LT(level, pyramid.size());
-    const BlockedArray<T> &l = *pyramid[level];
+    ++nTexelFetches;
+    const Point2i &res = levelRes[level];
     // Compute texel $(s,t)$ accounting for boundary conditions
     switch (wrapMode) {
     case ImageWrap::Repeat:
-        s = Mod(s, l.uSize());
-        t = Mod(t, l.vSize());
+        s = Mod(s, res.x);
+        t = Mod(t, res.y);
         break;
     case ImageWrap::Clamp:
-        s = Clamp(s, 0, l.uSize() - 1);
-        t = Clamp(t, 0, l.vSize() - 1);
+        s = Clamp(s, 0, res.x - 1);
+        t = Clamp(t, 0, res.y - 1);
         break;
     case ImageWrap::Black: {
         static const T black = 0.f;
-        if (s < 0 || s >= (int)l.uSize() || t < 0 || t >= (int)l.vSize())
-            return black;
+        if (s < 0 || s >= res.x || t < 0 || t >= res.y) return black;
         break;
     }
     }
-    return l(s, t);
+    // Pre-mipped files reference their level storage directly
+    if (levelData[level]) return levelData[level][(size_t)t * res.x + s];
+    // Decode block-compressed levels through the per-thread block ring
+    if (!compressedLevels.empty()) return compressedTexel(level, s, t);
+    // Fetch paged-out levels through the tiled texture cache
+    if (!pyramid[level]) {
+        PBRT_CONSTEXPR int tileSize = TextureTileCache::TileSize;
+        const T *tile = (const T *)TextureTileCache::Instance()->GetTile(
+            levelPlane[level], s >> TextureTileCache::TileSizeLog2,
+            t >> TextureTileCache::TileSizeLog2);
+        return tile[(t & (tileSize - 1)) * tileSize + (s & (tileSize - 1))];
+    }
+    return (*pyramid[level])(s, t);
+}
+
+// Re-encode every pyramid level as 4x4 blocks of compressed texels and
+// free the raw storage. For each block the most distant pair of its
+// texels becomes the endpoints (a range fit, as in BC1/BC4 encoders) and
+// each texel stores the 4-bit quantization of its projection onto the
+// endpoint segment.
+template <typename T>
+void MIPMap<T>::compressLevels() {
+    compressedLevels.resize(pyramid.size());
+    residentBytes = 0;
+    for (size_t i = 0; i < pyramid.size(); ++i) {
+        int nbx = (levelRes[i].x + 3) / 4, nby = (levelRes[i].y + 3) / 4;
+        compressedLevels[i].reset(
+            new CompressedTexelBlock<T>[(size_t)nbx * nby]);
+        residentBytes += (size_t)nbx * nby * sizeof(CompressedTexelBlock<T>);
+        ParallelFor([&](int by) {
+            T texels[16];
+            for (int bx = 0; bx < nbx; ++bx) {
+                // Gather the block's texels, clamping at the level's edges
+                for (int j = 0; j < 16; ++j) {
+                    int s = std::min(4 * bx + (j & 3), levelRes[i].x - 1);
+                    int t = std::min(4 * by + (j >> 2), levelRes[i].y - 1);
+                    texels[j] = (*pyramid[i])(s, t);
+                }
+
+                // Choose the most distant pair of texels as endpoints
+                CompressedTexelBlock<T> &block =
+                    compressedLevels[i][(size_t)by * nbx + bx];
+                int e0 = 0, e1 = 0;
+                Float maxDist2 = -1;
+                for (int a = 0; a < 16; ++a)
+                    for (int b = a; b < 16; ++b) {
+                        T d = texels[a] - texels[b];
+                        Float dist2 = TexelDot(d, d);
+                        if (dist2 > maxDist2) {
+                            maxDist2 = dist2;
+                            e0 = a;
+                            e1 = b;
+                        }
+                    }
+                block.endpoints[0] = texels[e0];
+                block.endpoints[1] = texels[e1];
+
+                // Project each texel onto the endpoint segment and
+                // quantize the parameter to four bits
+                T d = block.endpoints[1] - block.endpoints[0];
+                Float len2 = TexelDot(d, d);
+                memset(block.indices, 0, sizeof(block.indices));
+                for (int j = 0; j < 16; ++j) {
+                    int q = 0;
+                    if (len2 > 0) {
+                        T offset = texels[j] - block.endpoints[0];
+                        q = Clamp(
+                            (int)(TexelDot(offset, d) / len2 * 15 + 0.5f), 0,
+                            15);
+                    }
+                    block.indices[j / 2] |= q << (4 * (j & 1));
+                }
+            }
+        }, nby, 16);
+        pyramid[i].reset();
+    }
+}
+
+template <typename T>
+const T &MIPMap<T>::compressedTexel(int level, int s, int t) const {
+    // Decoded blocks are kept in a small per-thread ring; like the texture
+    // tile cache's thread tables, the ring is deep enough that references
+    // handed out earlier in the same filtering expression (the four taps
+    // of a bilerp) aren't overwritten before they're consumed.
+    struct DecodedBlock {
+        const void *map = nullptr;
+        int level, block;
+        T texels[16];
+    };
+    PBRT_CONSTEXPR int nRing = 8;
+    static PBRT_THREAD_LOCAL DecodedBlock *ring;
+    static PBRT_THREAD_LOCAL int ringNext;
+    if (!ring) ring = new DecodedBlock[nRing];
+
+    int nbx = (levelRes[level].x + 3) / 4;
+    int b = (t / 4) * nbx + (s / 4);
+    for (int i = 0; i < nRing; ++i)
+        if (ring[i].map == this && ring[i].level == level &&
+            ring[i].block == b)
+            return ring[i].texels[(t & 3) * 4 + (s & 3)];
+
+    // Decode the block into the ring's next entry
+    DecodedBlock &entry = ring[ringNext];
+    ringNext = (ringNext + 1) % nRing;
+    entry.map = this;
+    entry.level = level;
+    entry.block = b;
+    const CompressedTexelBlock<T> &block = compressedLevels[level][b];
+    T d = block.endpoints[1] - block.endpoints[0];
+    for (int j = 0; j < 16; ++j) {
+        int q = (block.indices[j / 2] >> (4 * (j & 1))) & 0xf;
+        entry.texels[j] = block.endpoints[0] + (q * (Float)(1. / 15)) * d;
+    }
+    return entry.texels[(t & 3) * 4 + (s & 3)];
 }
 
 template <typename T>
@@ -260,12 +597,59 @@ T MIPMap<T>::Lookup(const Point2f &st, Float width) const {
     }
 }
 
+template <typename T>
+T MIPMap<T>::triangleWithGradient(int level, const Point2f &st, T *dfds,
+                                  T *dfdt) const {
+    level = Clamp(level, 0, Levels() - 1);
+    Float s = st[0] * levelRes[level].x - 0.5f;
+    Float t = st[1] * levelRes[level].y - 0.5f;
+    int s0 = std::floor(s), t0 = std::floor(t);
+    if (accessRecord) NoteTextureAccess(accessRecord, level, s0, t0);
+    Float ds = s - s0, dt = t - t0;
+    T t00 = Texel(level, s0, t0), t01 = Texel(level, s0, t0 + 1);
+    T t10 = Texel(level, s0 + 1, t0), t11 = Texel(level, s0 + 1, t0 + 1);
+    *dfds = ((1 - dt) * (t10 - t00) + dt * (t11 - t01)) *
+            (Float)levelRes[level].x;
+    *dfdt = ((1 - ds) * (t01 - t00) + ds * (t11 - t10)) *
+            (Float)levelRes[level].y;
+    return (1 - ds) * (1 - dt) * t00 + (1 - ds) * dt * t01 +
+           ds * (1 - dt) * t10 + ds * dt * t11;
+}
+
+template <typename T>
+T MIPMap<T>::LookupWithGradient(const Point2f &st, Vector2f dstdx,
+                                Vector2f dstdy, T *dfds, T *dfdt) const {
+    ++nTrilerpLookups;
+    ProfilePhase p(Prof::TexFiltTrilerp);
+    // Compute MIPMap level exactly as the trilinear Lookup() does
+    Float width =
+        std::max(std::max(std::abs(dstdx[0]), std::abs(dstdx[1])),
+                 std::max(std::abs(dstdy[0]), std::abs(dstdy[1])));
+    Float level = Levels() - 1 + Log2(std::max(width, (Float)1e-8));
+    if (level < 0)
+        return triangleWithGradient(0, st, dfds, dfdt);
+    else if (level >= Levels() - 1) {
+        *dfds = *dfdt = T(0.f);
+        return Texel(Levels() - 1, 0, 0);
+    } else {
+        int iLevel = std::floor(level);
+        Float delta = level - iLevel;
+        T g0s, g0t, g1s, g1t;
+        T f = Lerp(delta, triangleWithGradient(iLevel, st, &g0s, &g0t),
+                   triangleWithGradient(iLevel + 1, st, &g1s, &g1t));
+        *dfds = Lerp(delta, g0s, g1s);
+        *dfdt = Lerp(delta, g0t, g1t);
+        return f;
+    }
+}
+
 template <typename T>
 T MIPMap<T>::triangle(int level, const Point2f &st) const {
     level = Clamp(level, 0, Levels() - 1);
-    Float s = st[0] * pyramid[level]->uSize() - 0.5f;
-    Float t = st[1] * pyramid[level]->vSize() - 0.5f;
+    Float s = st[0] * levelRes[level].x - 0.5f;
+    Float t = st[1] * levelRes[level].y - 0.5f;
     int s0 = std::floor(s), t0 = std::floor(t);
+    if (accessRecord) NoteTextureAccess(accessRecord, level, s0, t0);
     Float ds = s - s0, dt = t - t0;
     return (1 - ds) * (1 - dt) * Texel(level, s0, t0) +
            (1 - ds) * dt * Texel(level, s0, t0 + 1) +
@@ -306,12 +690,14 @@ template <typename T>
 T MIPMap<T>::EWA(int level, Point2f st, Vector2f dst0, Vector2f dst1) const {
     if (level >= Levels()) return Texel(Levels() - 1, 0, 0);
     // Convert EWA coordinates to appropriate scale for level
-    st[0] = st[0] * pyramid[level]->uSize() - 0.5f;
-    st[1] = st[1] * pyramid[level]->vSize() - 0.5f;
-    dst0[0] *= pyramid[level]->uSize();
-    dst0[1] *= pyramid[level]->vSize();
-    dst1[0] *= pyramid[level]->uSize();
-    dst1[1] *= pyramid[level]->vSize();
+    st[0] = st[0] * levelRes[level].x - 0.5f;
+    st[1] = st[1] * levelRes[level].y - 0.5f;
+    if (accessRecord)
+        NoteTextureAccess(accessRecord, level, (int)st[0], (int)st[1]);
+    dst0[0] *= levelRes[level].x;
+    dst0[1] *= levelRes[level].y;
+    dst1[0] *= levelRes[level].x;
+    dst1[1] *= levelRes[level].y;
 
     // Compute ellipse coefficients to bound EWA filter region
     Float A = dst0[1] * dst0[1] + dst1[1] * dst1[1] + 1;
@@ -336,7 +722,42 @@ T MIPMap<T>::EWA(int level, Point2f st, Vector2f dst0, Vector2f dst1) const {
     Float sumWts = 0;
     for (int it = t0; it <= t1; ++it) {
         Float tt = it - st[1];
-        for (int is = s0; is <= s1; ++is) {
+        int is = s0;
+#ifdef PBRT_MIPMAP_HAVE_AVX
+        // Evaluate the ellipse inclusion test and squared radii for eight
+        // texels of the row at a time, then fetch and accumulate only the
+        // texels inside the ellipse. The fetches stay scalar through
+        // Texel(), which handles wrap modes and paged-out levels.
+        const __m256 laneOffsets =
+            _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+        const __m256 av = _mm256_set1_ps(A);
+        const __m256 bttv = _mm256_set1_ps(B * tt);
+        const __m256 ctt2v = _mm256_set1_ps(C * tt * tt);
+        for (; is + 7 <= s1; is += 8) {
+            __m256 ssv =
+                _mm256_add_ps(_mm256_set1_ps(is - st[0]), laneOffsets);
+            __m256 r2v = _mm256_add_ps(
+                _mm256_add_ps(
+                    _mm256_mul_ps(_mm256_mul_ps(av, ssv), ssv),
+                    _mm256_mul_ps(bttv, ssv)),
+                ctt2v);
+            int mask = _mm256_movemask_ps(
+                _mm256_cmp_ps(r2v, _mm256_set1_ps(1.f), _CMP_LT_OQ));
+            if (mask == 0) continue;
+            alignas(32) float r2Lane[8];
+            _mm256_store_ps(r2Lane, r2v);
+            while (mask) {
+                int lane = CountTrailingZeros(mask);
+                mask &= mask - 1;
+                int index = std::min((int)(r2Lane[lane] * WeightLUTSize),
+                                     WeightLUTSize - 1);
+                Float weight = weightLut[index];
+                sum += Texel(level, is + lane, it) * weight;
+                sumWts += weight;
+            }
+        }
+#endif
+        for (; is <= s1; ++is) {
             Float ss = is - st[0];
             // Compute squared radius and filter texel if inside ellipse
             Float r2 = A * ss * ss + B * ss * tt + C * tt * tt;
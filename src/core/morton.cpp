@@ -0,0 +1,155 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+// core/morton.cpp*
+#include "morton.h"
+#include "parallel.h"
+#include <algorithm>
+
+namespace pbrt {
+
+// Morton Curve Method Definitions
+
+// Below this size the per-chunk bookkeeping of the parallel radix sort
+// costs more than it saves and each pass runs serially.
+static PBRT_CONSTEXPR size_t parallelSortThreshold = 64 * 1024;
+void RadixSort(std::vector<MortonPrimitive> *v) {
+    std::vector<MortonPrimitive> tempVector(v->size());
+    PBRT_CONSTEXPR int bitsPerPass = 6;
+    PBRT_CONSTEXPR int nBits = 30;
+    static_assert((nBits % bitsPerPass) == 0,
+                  "Radix sort bitsPerPass must evenly divide nBits");
+    PBRT_CONSTEXPR int nPasses = nBits / bitsPerPass;
+    PBRT_CONSTEXPR int nBuckets = 1 << bitsPerPass;
+    PBRT_CONSTEXPR int bitMask = (1 << bitsPerPass) - 1;
+    size_t n = v->size();
+
+    // Choose a chunk decomposition for parallel passes: several chunks per
+    // thread for load balance, but large enough that each chunk's counting
+    // and scatter loops amortize their bucket tables.
+    int nChunks = 1;
+    if (n >= parallelSortThreshold && MaxThreadIndex() > 1)
+        nChunks = std::min<int>(4 * MaxThreadIndex(),
+                                n / (parallelSortThreshold / 4));
+    size_t chunkSize = (n + nChunks - 1) / nChunks;
+    std::vector<int> chunkCount(nChunks * nBuckets);
+
+    for (int pass = 0; pass < nPasses; ++pass) {
+        // Perform one pass of radix sort, sorting _bitsPerPass_ bits
+        int lowBit = pass * bitsPerPass;
+
+        // Set in and out vector pointers for radix sort pass
+        std::vector<MortonPrimitive> &in = (pass & 1) ? tempVector : *v;
+        std::vector<MortonPrimitive> &out = (pass & 1) ? *v : tempVector;
+
+        if (nChunks == 1) {
+            // Count number of zero bits in array for current radix sort bit
+            int bucketCount[nBuckets] = {0};
+            for (const MortonPrimitive &mp : in) {
+                int bucket = (mp.mortonCode >> lowBit) & bitMask;
+                CHECK_GE(bucket, 0);
+                CHECK_LT(bucket, nBuckets);
+                ++bucketCount[bucket];
+            }
+
+            // Compute starting index in output array for each bucket
+            int outIndex[nBuckets];
+            outIndex[0] = 0;
+            for (int i = 1; i < nBuckets; ++i)
+                outIndex[i] = outIndex[i - 1] + bucketCount[i - 1];
+
+            // Store sorted values in output array
+            for (const MortonPrimitive &mp : in) {
+                int bucket = (mp.mortonCode >> lowBit) & bitMask;
+                out[outIndex[bucket]++] = mp;
+            }
+            continue;
+        }
+
+        // Count each chunk's bucket occupancy in parallel
+        ParallelFor([&](int c) {
+            int *count = &chunkCount[c * nBuckets];
+            std::fill(count, count + nBuckets, 0);
+            size_t cEnd = std::min(n, (c + 1) * chunkSize);
+            for (size_t i = c * chunkSize; i < cEnd; ++i)
+                ++count[(in[i].mortonCode >> lowBit) & bitMask];
+        }, nChunks);
+
+        // Convert the counts to per-chunk output offsets with an exclusive
+        // scan in bucket-major order; chunks scatter in index order within
+        // each bucket, so the sort stays stable.
+        int offset = 0;
+        for (int b = 0; b < nBuckets; ++b)
+            for (int c = 0; c < nChunks; ++c) {
+                int count = chunkCount[c * nBuckets + b];
+                chunkCount[c * nBuckets + b] = offset;
+                offset += count;
+            }
+
+        // Scatter each chunk to its precomputed bucket offsets in parallel
+        ParallelFor([&](int c) {
+            int *outIndex = &chunkCount[c * nBuckets];
+            size_t cEnd = std::min(n, (c + 1) * chunkSize);
+            for (size_t i = c * chunkSize; i < cEnd; ++i) {
+                int bucket = (in[i].mortonCode >> lowBit) & bitMask;
+                out[outIndex[bucket]++] = in[i];
+            }
+        }, nChunks);
+    }
+    // Copy final result from _tempVector_, if needed
+    if (nPasses & 1) std::swap(*v, tempVector);
+}
+
+void MortonReorder(const Point3f *p, int n, std::vector<int> *order) {
+    order->resize(n);
+    if (n <= 1) {
+        for (int i = 0; i < n; ++i) (*order)[i] = i;
+        return;
+    }
+    // Compute bounding box of the batch's positions
+    Bounds3f bounds(p[0]);
+    for (int i = 1; i < n; ++i) bounds = Union(bounds, Point3f(p[i]));
+
+    // Quantize positions into Morton codes within _bounds_
+    std::vector<MortonPrimitive> mortonItems(n);
+    PBRT_CONSTEXPR int mortonBits = 10;
+    PBRT_CONSTEXPR int mortonScale = 1 << mortonBits;
+    for (int i = 0; i < n; ++i) {
+        mortonItems[i].primitiveIndex = i;
+        mortonItems[i].mortonCode =
+            EncodeMorton3(bounds.Offset(p[i]) * mortonScale);
+    }
+    RadixSort(&mortonItems);
+    for (int i = 0; i < n; ++i) (*order)[i] = mortonItems[i].primitiveIndex;
+}
+
+}  // namespace pbrt
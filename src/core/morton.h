@@ -0,0 +1,103 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_CORE_MORTON_H
+#define PBRT_CORE_MORTON_H
+
+// core/morton.h*
+#include "pbrt.h"
+#include "geometry.h"
+#include <vector>
+
+namespace pbrt {
+
+// Morton Curve Declarations
+// Interleaving a batch of work items' 3D positions into Morton codes and
+// sorting by them brings spatially nearby items together, which pays off
+// wherever batches are processed against spatial data structures: BVH
+// construction, secondary-ray traversal, SPPM visible points, and BSSRDF
+// probes all touch nearby nodes for nearby positions.
+inline uint32_t LeftShift3(uint32_t x) {
+    CHECK_LE(x, (1 << 10));
+    if (x == (1 << 10)) --x;
+#ifdef PBRT_HAVE_BINARY_CONSTANTS
+    x = (x | (x << 16)) & 0b00000011000000000000000011111111;
+    // x = ---- --98 ---- ---- ---- ---- 7654 3210
+    x = (x | (x << 8)) & 0b00000011000000001111000000001111;
+    // x = ---- --98 ---- ---- 7654 ---- ---- 3210
+    x = (x | (x << 4)) & 0b00000011000011000011000011000011;
+    // x = ---- --98 ---- 76-- --54 ---- 32-- --10
+    x = (x | (x << 2)) & 0b00001001001001001001001001001001;
+    // x = ---- 9--8 --7- -6-- 5--4 --3- -2-- 1--0
+#else
+    x = (x | (x << 16)) & 0x30000ff;
+    // x = ---- --98 ---- ---- ---- ---- 7654 3210
+    x = (x | (x << 8)) & 0x300f00f;
+    // x = ---- --98 ---- ---- 7654 ---- ---- 3210
+    x = (x | (x << 4)) & 0x30c30c3;
+    // x = ---- --98 ---- 76-- --54 ---- 32-- --10
+    x = (x | (x << 2)) & 0x9249249;
+    // x = ---- 9--8 --7- -6-- 5--4 --3- -2-- 1--0
+#endif  // PBRT_HAVE_BINARY_CONSTANTS
+    return x;
+}
+
+inline uint32_t EncodeMorton3(const Vector3f &v) {
+    CHECK_GE(v.x, 0);
+    CHECK_GE(v.y, 0);
+    CHECK_GE(v.z, 0);
+    return (LeftShift3(v.z) << 2) | (LeftShift3(v.y) << 1) | LeftShift3(v.x);
+}
+
+struct MortonPrimitive {
+    int primitiveIndex;
+    uint32_t mortonCode;
+};
+
+// Stable radix sort by _mortonCode_; arrays above an internal threshold
+// are sorted with parallel per-chunk counting and scatter passes.
+void RadixSort(std::vector<MortonPrimitive> *v);
+
+// Fills _order_ with the indices $0 \ldots n-1$ rearranged so that the
+// corresponding positions lie along a Morton curve through their bounding
+// box. Callers then process (or permute) their batch in that order;
+// _order_ is reused across calls without reallocating.
+void MortonReorder(const Point3f *p, int n, std::vector<int> *order);
+
+}  // namespace pbrt
+
+#endif  // PBRT_CORE_MORTON_H
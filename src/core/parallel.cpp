@@ -35,18 +35,59 @@
 #include "parallel.h"
 #include "memory.h"
 #include "stats.h"
-#include <list>
 #include <thread>
+#include <vector>
 #include <condition_variable>
+#if defined(__linux__)
+#include <sched.h>
+#endif
 
 namespace pbrt {
 
+STAT_COUNTER("Scheduler/Work items stolen", nWorkItemsStolen);
+
 // Parallel Local Definitions
 static std::vector<std::thread> threads;
-static bool shutdownThreads = false;
+// True when the pool's threads are pinned one-per-core; set in
+// ParallelInit().
+static bool pinWorkerThreads = false;
+
+// Pin the calling thread to a single core. Cores are assigned in index
+// order, which on multi-socket machines fills one socket before spilling
+// onto the next; threads stop migrating across sockets, and their
+// allocations (MemoryArena blocks in particular) stay on the local NUMA
+// node under the kernel's first-touch policy.
+static void pinThreadToCore(int tIndex) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(tIndex % NumSystemCores(), &set);
+    sched_setaffinity(0, sizeof(set), &set);
+#endif
+}
+static std::atomic<bool> shutdownThreads{false};
 class ParallelForLoop;
-static ParallelForLoop *workList = nullptr;
-static std::mutex workListMutex;
+struct ParallelWork;
+class WorkStealingDeque;
+static std::vector<WorkStealingDeque> *threadDeques = nullptr;
+
+// True for the main thread and the pool's workers, which each own one of
+// _threadDeques_. Threads created elsewhere (image I/O helpers, the
+// progressive preview writer) inherit ThreadIndex 0 but must not touch
+// deque 0--its push/pop end is single-owner--so parallel entry points fall
+// back to serial execution when this is false.
+static PBRT_THREAD_LOCAL bool threadRegistered;
+
+// Number of pushed work items that haven't been taken by any thread yet;
+// lets idle workers sleep only when all of the deques are empty.
+static std::atomic<int> pendingWorkItems{0};
+
+// Idle workers sleep on _sleepCondition_; pushing work wakes them, but only
+// when _numSleepingWorkers_ says there's someone to wake, so the common
+// all-busy case doesn't touch the mutex.
+static std::mutex sleepMutex;
+static std::condition_variable sleepCondition;
+static std::atomic<int> numSleepingWorkers{0};
 
 // Bookkeeping variables to help with the implementation of
 // MergeWorkerThreadStats().
@@ -83,17 +124,173 @@ class ParallelForLoop {
     const int64_t maxIndex;
     const int chunkSize;
     uint64_t profilerState;
-    int64_t nextIndex = 0;
-    int activeWorkers = 0;
-    ParallelForLoop *next = nullptr;
     int nX = -1;
+    // Count of iterations that have finished running; the loop is done when
+    // it reaches _maxIndex_, at which point no thread touches the loop again.
+    std::atomic<int64_t> iterationsCompleted{0};
 
     // ParallelForLoop Private Methods
     bool Finished() const {
-        return nextIndex >= maxIndex && activeWorkers == 0;
+        return iterationsCompleted.load(std::memory_order_acquire) == maxIndex;
+    }
+};
+
+// A schedulable unit of work: either a range of a parallel loop's iteration
+// space or a task spawned through a ParallelTaskGroup.
+struct ParallelWork {
+    ParallelWork(ParallelForLoop *loop, int64_t start, int64_t end)
+        : loop(loop), start(start), end(end) {}
+    ParallelWork(std::function<void()> task, std::atomic<int64_t> *nPending,
+                 uint64_t profilerState)
+        : task(std::move(task)),
+          nPending(nPending),
+          profilerState(profilerState) {}
+    ParallelForLoop *loop = nullptr;
+    int64_t start = 0, end = 0;
+    std::function<void()> task;
+    std::atomic<int64_t> *nPending = nullptr;
+    uint64_t profilerState = 0;
+};
+
+// Fixed-capacity Chase-Lev work-stealing deque: the owning thread pushes
+// and pops work at the bottom without contention, while other threads steal
+// the oldest (and, for loops, largest) items from the top with a single
+// CAS. Fences follow Lê et al., "Correct and Efficient Work-Stealing for
+// Weak Memory Models".
+class WorkStealingDeque {
+  public:
+    // WorkStealingDeque Public Methods
+    bool Push(ParallelWork *w) {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        if (b - t >= capacity) return false;
+        entries[b % capacity].store(w, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+    ParallelWork *Pop() {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+        ParallelWork *w = nullptr;
+        if (t <= b) {
+            w = entries[b % capacity].load(std::memory_order_relaxed);
+            if (t == b) {
+                // Last item; race against stealers for it.
+                if (!top.compare_exchange_strong(t, t + 1,
+                                                 std::memory_order_seq_cst,
+                                                 std::memory_order_relaxed))
+                    w = nullptr;
+                bottom.store(b + 1, std::memory_order_relaxed);
+            }
+        } else
+            bottom.store(b + 1, std::memory_order_relaxed);
+        return w;
+    }
+    ParallelWork *Steal() {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b) return nullptr;
+        ParallelWork *w = entries[t % capacity].load(std::memory_order_acquire);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                         std::memory_order_relaxed))
+            return nullptr;
+        return w;
     }
+
+  private:
+    // WorkStealingDeque Private Data
+    static PBRT_CONSTEXPR int capacity = 4096;
+    std::atomic<ParallelWork *> entries[capacity];
+    std::atomic<int64_t> top{0}, bottom{0};
 };
 
+// Push _w_ onto the current thread's deque, waking sleeping workers; returns
+// false (without taking ownership of _w_) if the deque is full.
+static bool pushWork(ParallelWork *w) {
+    if (!(*threadDeques)[ThreadIndex].Push(w)) return false;
+    pendingWorkItems.fetch_add(1, std::memory_order_release);
+    if (numSleepingWorkers.load(std::memory_order_acquire) > 0) {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        sleepCondition.notify_all();
+    }
+    return true;
+}
+
+// Pop from the current thread's deque, or failing that steal from the other
+// threads'; returns nullptr if no work is available anywhere.
+static ParallelWork *findWork() {
+    int tIndex = ThreadIndex;
+    ParallelWork *w = (*threadDeques)[tIndex].Pop();
+    if (!w) {
+        // Start each thread's victim scan at a different deque so thieves
+        // don't all converge on the same one.
+        int nDeques = (int)threadDeques->size();
+        for (int i = 1; i < nDeques && !w; ++i)
+            w = (*threadDeques)[(tIndex + i) % nDeques].Steal();
+        if (w) ++nWorkItemsStolen;
+    }
+    if (w) pendingWorkItems.fetch_add(-1, std::memory_order_relaxed);
+    return w;
+}
+
+// Run the iterations of _loop_ in _[start, end)_, repeatedly splitting off
+// the second half of the remaining range for other threads to steal until
+// what's left is a single chunk. The owner thus works through small local
+// pieces while idle threads steal large untouched ranges.
+static void runLoopRange(ParallelForLoop &loop, int64_t start, int64_t end) {
+    while (start < end) {
+        if (end - start > loop.chunkSize) {
+            int64_t mid = start + (end - start) / 2;
+            ParallelWork *w = new ParallelWork(&loop, mid, end);
+            if (pushWork(w)) {
+                end = mid;
+                continue;
+            }
+            // The deque was full; run the whole range here instead.
+            delete w;
+        }
+
+        // Run loop indices in _[start, end)_
+        uint64_t oldState = ProfilerState;
+        ProfilerState = loop.profilerState;
+        for (int64_t index = start; index < end; ++index) {
+            if (loop.func1D) {
+                loop.func1D(index);
+            }
+            // Handle other types of loops
+            else {
+                CHECK(loop.func2D);
+                loop.func2D(Point2i(index % loop.nX, index / loop.nX));
+            }
+        }
+        ProfilerState = oldState;
+
+        // Update _loop_ to reflect completion of iterations. This is the
+        // last touch of _loop_ for this range, so once the count reaches
+        // _maxIndex_ the caller is free to destroy the loop.
+        loop.iterationsCompleted.fetch_add(end - start,
+                                           std::memory_order_release);
+        start = end;
+    }
+}
+
+static void executeWork(ParallelWork *w) {
+    if (w->loop) {
+        runLoopRange(*w->loop, w->start, w->end);
+    } else {
+        uint64_t oldState = ProfilerState;
+        ProfilerState = w->profilerState;
+        w->task();
+        ProfilerState = oldState;
+        w->nPending->fetch_add(-1, std::memory_order_release);
+    }
+    delete w;
+}
+
 void Barrier::Wait() {
     std::unique_lock<std::mutex> lock(mutex);
     CHECK_GT(count, 0);
@@ -107,11 +304,11 @@ void Barrier::Wait() {
         cv.wait(lock, [this] { return count == 0; });
 }
 
-static std::condition_variable workListCondition;
-
 static void workerThreadFunc(int tIndex, std::shared_ptr<Barrier> barrier) {
     LOG(INFO) << "Started execution in worker thread " << tIndex;
     ThreadIndex = tIndex;
+    threadRegistered = true;
+    if (pinWorkerThreads) pinThreadToCore(tIndex);
 
     // Give the profiler a chance to do per-thread initialization for
     // the worker thread before the profiling system actually stops running.
@@ -126,7 +323,6 @@ static void workerThreadFunc(int tIndex, std::shared_ptr<Barrier> barrier) {
     // the threads have cleared it.
     barrier.reset();
 
-    std::unique_lock<std::mutex> lock(workListMutex);
     while (!shutdownThreads) {
         if (reportWorkerStats) {
             ReportThreadStats();
@@ -134,47 +330,24 @@ static void workerThreadFunc(int tIndex, std::shared_ptr<Barrier> barrier) {
                 // Once all worker threads have merged their stats, wake up
                 // the main thread.
                 reportDoneCondition.notify_one();
-            // Now sleep again.
-            workListCondition.wait(lock);
-        } else if (!workList) {
-            // Sleep until there are more tasks to run
-            workListCondition.wait(lock);
+            // Wait until the main thread has gathered this round of reports
+            // before looking for work again, so this thread doesn't report
+            // twice for one request.
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            sleepCondition.wait(lock, []() {
+                return !reportWorkerStats || shutdownThreads;
+            });
+        } else if (ParallelWork *w = findWork()) {
+            executeWork(w);
         } else {
-            // Get work from _workList_ and run loop iterations
-            ParallelForLoop &loop = *workList;
-
-            // Run a chunk of loop iterations for _loop_
-
-            // Find the set of loop iterations to run next
-            int64_t indexStart = loop.nextIndex;
-            int64_t indexEnd =
-                std::min(indexStart + loop.chunkSize, loop.maxIndex);
-
-            // Update _loop_ to reflect iterations this thread will run
-            loop.nextIndex = indexEnd;
-            if (loop.nextIndex == loop.maxIndex) workList = loop.next;
-            loop.activeWorkers++;
-
-            // Run loop indices in _[indexStart, indexEnd)_
-            lock.unlock();
-            for (int64_t index = indexStart; index < indexEnd; ++index) {
-                uint64_t oldState = ProfilerState;
-                ProfilerState = loop.profilerState;
-                if (loop.func1D) {
-                    loop.func1D(index);
-                }
-                // Handle other types of loops
-                else {
-                    CHECK(loop.func2D);
-                    loop.func2D(Point2i(index % loop.nX, index / loop.nX));
-                }
-                ProfilerState = oldState;
-            }
-            lock.lock();
-
-            // Update _loop_ to reflect completion of iterations
-            loop.activeWorkers--;
-            if (loop.Finished()) workListCondition.notify_all();
+            // Nothing to pop or steal anywhere; sleep until work is pushed.
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            ++numSleepingWorkers;
+            sleepCondition.wait(lock, []() {
+                return pendingWorkItems.load(std::memory_order_acquire) > 0 ||
+                       shutdownThreads || reportWorkerStats;
+            });
+            --numSleepingWorkers;
         }
     }
     LOG(INFO) << "Exiting worker thread " << tIndex;
@@ -185,56 +358,27 @@ void ParallelFor(std::function<void(int64_t)> func, int64_t count,
                  int chunkSize) {
     CHECK(threads.size() > 0 || MaxThreadIndex() == 1);
 
-    // Run iterations immediately if not using threads or if _count_ is small
-    if (threads.empty() || count < chunkSize) {
+    // Run iterations immediately if not using threads, if _count_ is small,
+    // or if the calling thread doesn't own a work deque.
+    if (threads.empty() || !threadRegistered || count < chunkSize) {
         for (int64_t i = 0; i < count; ++i) func(i);
         return;
     }
 
-    // Create and enqueue _ParallelForLoop_ for this loop
+    // Run the loop's full range; it's split adaptively as it executes, with
+    // the split-off pieces landing in this thread's deque for others to
+    // steal.
     ParallelForLoop loop(std::move(func), count, chunkSize,
                          CurrentProfilerState());
-    workListMutex.lock();
-    loop.next = workList;
-    workList = &loop;
-    workListMutex.unlock();
+    runLoopRange(loop, 0, count);
 
-    // Notify worker threads of work to be done
-    std::unique_lock<std::mutex> lock(workListMutex);
-    workListCondition.notify_all();
-
-    // Help out with parallel loop iterations in the current thread
+    // Help with outstanding work--possibly from other loops or spawned
+    // tasks--until all of this loop's iterations have completed.
     while (!loop.Finished()) {
-        // Run a chunk of loop iterations for _loop_
-
-        // Find the set of loop iterations to run next
-        int64_t indexStart = loop.nextIndex;
-        int64_t indexEnd = std::min(indexStart + loop.chunkSize, loop.maxIndex);
-
-        // Update _loop_ to reflect iterations this thread will run
-        loop.nextIndex = indexEnd;
-        if (loop.nextIndex == loop.maxIndex) workList = loop.next;
-        loop.activeWorkers++;
-
-        // Run loop indices in _[indexStart, indexEnd)_
-        lock.unlock();
-        for (int64_t index = indexStart; index < indexEnd; ++index) {
-            uint64_t oldState = ProfilerState;
-            ProfilerState = loop.profilerState;
-            if (loop.func1D) {
-                loop.func1D(index);
-            }
-            // Handle other types of loops
-            else {
-                CHECK(loop.func2D);
-                loop.func2D(Point2i(index % loop.nX, index / loop.nX));
-            }
-            ProfilerState = oldState;
-        }
-        lock.lock();
-
-        // Update _loop_ to reflect completion of iterations
-        loop.activeWorkers--;
+        if (ParallelWork *w = findWork())
+            executeWork(w);
+        else
+            std::this_thread::yield();
     }
 }
 
@@ -247,54 +391,50 @@ int MaxThreadIndex() {
 void ParallelFor2D(std::function<void(Point2i)> func, const Point2i &count) {
     CHECK(threads.size() > 0 || MaxThreadIndex() == 1);
 
-    if (threads.empty() || count.x * count.y <= 1) {
+    if (threads.empty() || !threadRegistered || count.x * count.y <= 1) {
         for (int y = 0; y < count.y; ++y)
             for (int x = 0; x < count.x; ++x) func(Point2i(x, y));
         return;
     }
 
     ParallelForLoop loop(std::move(func), count, CurrentProfilerState());
-    {
-        std::lock_guard<std::mutex> lock(workListMutex);
-        loop.next = workList;
-        workList = &loop;
-    }
+    runLoopRange(loop, 0, loop.maxIndex);
 
-    std::unique_lock<std::mutex> lock(workListMutex);
-    workListCondition.notify_all();
-
-    // Help out with parallel loop iterations in the current thread
+    // Help with outstanding work until all of this loop's iterations have
+    // completed.
     while (!loop.Finished()) {
-        // Run a chunk of loop iterations for _loop_
-
-        // Find the set of loop iterations to run next
-        int64_t indexStart = loop.nextIndex;
-        int64_t indexEnd = std::min(indexStart + loop.chunkSize, loop.maxIndex);
-
-        // Update _loop_ to reflect iterations this thread will run
-        loop.nextIndex = indexEnd;
-        if (loop.nextIndex == loop.maxIndex) workList = loop.next;
-        loop.activeWorkers++;
-
-        // Run loop indices in _[indexStart, indexEnd)_
-        lock.unlock();
-        for (int64_t index = indexStart; index < indexEnd; ++index) {
-            uint64_t oldState = ProfilerState;
-            ProfilerState = loop.profilerState;
-            if (loop.func1D) {
-                loop.func1D(index);
-            }
-            // Handle other types of loops
-            else {
-                CHECK(loop.func2D);
-                loop.func2D(Point2i(index % loop.nX, index / loop.nX));
-            }
-            ProfilerState = oldState;
-        }
-        lock.lock();
+        if (ParallelWork *w = findWork())
+            executeWork(w);
+        else
+            std::this_thread::yield();
+    }
+}
+
+void ParallelTaskGroup::Run(std::function<void()> task) {
+    // Run the task immediately if not using threads or if the calling
+    // thread doesn't own a work deque to push it through.
+    if (threads.empty() || !threadRegistered) {
+        task();
+        return;
+    }
+    nPending.fetch_add(1, std::memory_order_release);
+    ParallelWork *w =
+        new ParallelWork(std::move(task), &nPending, CurrentProfilerState());
+    if (!pushWork(w)) {
+        // The deque was full; run the task here instead.
+        executeWork(w);
+    }
+}
 
-        // Update _loop_ to reflect completion of iterations
-        loop.activeWorkers--;
+void ParallelTaskGroup::Wait() {
+    while (nPending.load(std::memory_order_acquire) > 0) {
+        // Only a deque owner may help execute work while waiting; other
+        // threads just yield until the pool finishes the group's tasks.
+        ParallelWork *w = threadRegistered ? findWork() : nullptr;
+        if (w)
+            executeWork(w);
+        else
+            std::this_thread::yield();
     }
 }
 
@@ -306,6 +446,17 @@ void ParallelInit() {
     CHECK_EQ(threads.size(), 0);
     int nThreads = MaxThreadIndex();
     ThreadIndex = 0;
+    threadRegistered = true;
+
+    // Pin threads only when the pool spans the whole machine; with fewer
+    // threads the user is sharing the box and pinning would pile every pbrt
+    // process onto the same cores.
+    pinWorkerThreads = (nThreads == NumSystemCores());
+    if (pinWorkerThreads) pinThreadToCore(0);
+
+    // Allocate the per-thread work-stealing deques before any worker can
+    // look for work.
+    threadDeques = new std::vector<WorkStealingDeque>(nThreads);
 
     // Create a barrier so that we can be sure all worker threads get past
     // their call to ProfilerWorkerThreadInit() before we return from this
@@ -322,34 +473,48 @@ void ParallelInit() {
 }
 
 void ParallelCleanup() {
-    if (threads.empty()) return;
+    if (threads.empty()) {
+        delete threadDeques;
+        threadDeques = nullptr;
+        return;
+    }
 
     {
-        std::lock_guard<std::mutex> lock(workListMutex);
+        std::lock_guard<std::mutex> lock(sleepMutex);
         shutdownThreads = true;
-        workListCondition.notify_all();
+        sleepCondition.notify_all();
     }
 
     for (std::thread &thread : threads) thread.join();
     threads.erase(threads.begin(), threads.end());
     shutdownThreads = false;
+    delete threadDeques;
+    threadDeques = nullptr;
 }
 
 void MergeWorkerThreadStats() {
-    std::unique_lock<std::mutex> lock(workListMutex);
-    std::unique_lock<std::mutex> doneLock(reportDoneMutex);
+    std::unique_lock<std::mutex> lock(reportDoneMutex);
     // Set up state so that the worker threads will know that we would like
     // them to report their thread-specific stats when they wake up.
     reportWorkerStats = true;
     reporterCount = threads.size();
 
     // Wake up the worker threads.
-    workListCondition.notify_all();
+    {
+        std::lock_guard<std::mutex> sleepLock(sleepMutex);
+        sleepCondition.notify_all();
+    }
 
     // Wait for all of them to merge their stats.
     reportDoneCondition.wait(lock, []() { return reporterCount == 0; });
 
     reportWorkerStats = false;
+
+    // Release the workers parked until the report round was over.
+    {
+        std::lock_guard<std::mutex> sleepLock(sleepMutex);
+        sleepCondition.notify_all();
+    }
 }
 
 }  // namespace pbrt
@@ -101,10 +101,149 @@ class Barrier {
 void ParallelFor(std::function<void(int64_t)> func, int64_t count,
                  int chunkSize = 1);
 extern PBRT_THREAD_LOCAL int ThreadIndex;
+
+// Runs independent tasks on the same worker pool as ParallelFor(), so
+// nested parallelism (e.g. an accelerator build kicked off from rendering)
+// shares the pool's threads rather than oversubscribing the machine. Wait()
+// helps run queued work while waiting, so it's safe to call from inside a
+// parallel loop body or another task.
+class ParallelTaskGroup {
+  public:
+    // ParallelTaskGroup Public Methods
+    ~ParallelTaskGroup() { Wait(); }
+    void Run(std::function<void()> task);
+    void Wait();
+
+  private:
+    // ParallelTaskGroup Private Data
+    std::atomic<int64_t> nPending{0};
+};
+
 void ParallelFor2D(std::function<void(Point2i)> func, const Point2i &count);
 int MaxThreadIndex();
 int NumSystemCores();
 
+// Parallel scan and reduction primitives. These run on the ParallelFor()
+// worker pool (and degrade to plain serial loops for small inputs or when
+// the pool isn't running) and are shared infrastructure for counted bin
+// layouts, radix sorts, and stream compaction.
+
+// Returns op(identity, v[0], ..., v[count-1]); _op_ must be associative.
+template <typename T, typename Op>
+T ParallelReduce(const T *v, int64_t count, T identity, Op op) {
+    if (count < 4096 || MaxThreadIndex() == 1) {
+        T result = identity;
+        for (int64_t i = 0; i < count; ++i) result = op(result, v[i]);
+        return result;
+    }
+    // Reduce fixed-size chunks in parallel, then combine the per-chunk
+    // results serially
+    PBRT_CONSTEXPR int64_t chunkSize = 4096;
+    int64_t nChunks = (count + chunkSize - 1) / chunkSize;
+    std::vector<T> chunkResult(nChunks, identity);
+    ParallelFor(
+        [&](int64_t c) {
+            T result = identity;
+            int64_t end = std::min((c + 1) * chunkSize, count);
+            for (int64_t i = c * chunkSize; i < end; ++i)
+                result = op(result, v[i]);
+            chunkResult[c] = result;
+        },
+        nChunks);
+    T result = identity;
+    for (int64_t c = 0; c < nChunks; ++c) result = op(result, chunkResult[c]);
+    return result;
+}
+
+// Writes the exclusive prefix sum of _v_ into _out_, which may alias _v_,
+// and returns the total.
+template <typename T>
+T ParallelExclusiveScan(const T *v, int64_t count, T *out) {
+    if (count < 4096 || MaxThreadIndex() == 1) {
+        T running = T(0);
+        for (int64_t i = 0; i < count; ++i) {
+            T value = v[i];
+            out[i] = running;
+            running += value;
+        }
+        return running;
+    }
+    // Sum fixed-size chunks in parallel, scan the per-chunk sums serially
+    // to get each chunk's starting offset, then scan within the chunks in
+    // parallel
+    PBRT_CONSTEXPR int64_t chunkSize = 4096;
+    int64_t nChunks = (count + chunkSize - 1) / chunkSize;
+    std::vector<T> chunkSum(nChunks);
+    ParallelFor(
+        [&](int64_t c) {
+            T sum = T(0);
+            int64_t end = std::min((c + 1) * chunkSize, count);
+            for (int64_t i = c * chunkSize; i < end; ++i) sum += v[i];
+            chunkSum[c] = sum;
+        },
+        nChunks);
+    T running = T(0);
+    for (int64_t c = 0; c < nChunks; ++c) {
+        T sum = chunkSum[c];
+        chunkSum[c] = running;
+        running += sum;
+    }
+    ParallelFor(
+        [&](int64_t c) {
+            T prefix = chunkSum[c];
+            int64_t end = std::min((c + 1) * chunkSize, count);
+            for (int64_t i = c * chunkSize; i < end; ++i) {
+                T value = v[i];
+                out[i] = prefix;
+                prefix += value;
+            }
+        },
+        nChunks);
+    return running;
+}
+
+// Stable-partitions _v_ into _out_, which must not alias _v_: the elements
+// satisfying _pred_ come first, the rest after, both in their original
+// order. Returns the number of elements satisfying _pred_.
+template <typename T, typename Pred>
+int64_t ParallelPartition(const T *v, int64_t count, T *out, Pred pred) {
+    if (count < 4096 || MaxThreadIndex() == 1) {
+        int64_t nTrue = 0;
+        for (int64_t i = 0; i < count; ++i)
+            if (pred(v[i])) ++nTrue;
+        int64_t trueOffset = 0, falseOffset = nTrue;
+        for (int64_t i = 0; i < count; ++i)
+            out[pred(v[i]) ? trueOffset++ : falseOffset++] = v[i];
+        return nTrue;
+    }
+    // Count each chunk's passing elements, scan the counts to find where
+    // each chunk's passing and failing elements start in _out_, then
+    // scatter in parallel
+    PBRT_CONSTEXPR int64_t chunkSize = 4096;
+    int64_t nChunks = (count + chunkSize - 1) / chunkSize;
+    std::vector<int64_t> chunkTrue(nChunks);
+    ParallelFor(
+        [&](int64_t c) {
+            int64_t n = 0;
+            int64_t end = std::min((c + 1) * chunkSize, count);
+            for (int64_t i = c * chunkSize; i < end; ++i)
+                if (pred(v[i])) ++n;
+            chunkTrue[c] = n;
+        },
+        nChunks);
+    int64_t nTrue = ParallelExclusiveScan(&chunkTrue[0], nChunks, &chunkTrue[0]);
+    ParallelFor(
+        [&](int64_t c) {
+            int64_t trueOffset = chunkTrue[c];
+            int64_t falseOffset = nTrue + c * chunkSize - chunkTrue[c];
+            int64_t end = std::min((c + 1) * chunkSize, count);
+            for (int64_t i = c * chunkSize; i < end; ++i)
+                out[pred(v[i]) ? trueOffset++ : falseOffset++] = v[i];
+        },
+        nChunks);
+    return nTrue;
+}
+
 void ParallelInit();
 void ParallelCleanup();
 void MergeWorkerThreadStats();
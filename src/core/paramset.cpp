@@ -35,26 +35,111 @@
 #include "paramset.h"
 #include "floatfile.h"
 #include "textures/constant.h"
+#include <algorithm>
+#include <mutex>
+#include <set>
+#include <unordered_map>
 
 namespace pbrt {
 
+// ParamSet Method Definitions
+const std::string &InternedString(const std::string &s) {
+    static std::mutex mutex;
+    static std::set<std::string> strings;
+    std::lock_guard<std::mutex> lock(mutex);
+    return *strings.insert(s).first;
+}
+
+// Type tags for lookup index entries, one per typed item vector.
+enum {
+    ParamTypeBool,
+    ParamTypeInt,
+    ParamTypeFloat,
+    ParamTypePoint2f,
+    ParamTypeVector2f,
+    ParamTypePoint3f,
+    ParamTypeVector3f,
+    ParamTypeNormal3f,
+    ParamTypeSpectrum,
+    ParamTypeString,
+    ParamTypeTexture
+};
+
+// Below this many total items the linear scans win and no index is built;
+// hand-written parameter lists hold only a few entries each.
+static PBRT_CONSTEXPR int paramSetIndexThreshold = 16;
+
+void ParamSet::BuildLookupIndex() const {
+    lookupIndexDirty = false;
+    lookupIndex.clear();
+    size_t nItems = bools.size() + ints.size() + floats.size() +
+                    point2fs.size() + vector2fs.size() + point3fs.size() +
+                    vector3fs.size() + normals.size() + spectra.size() +
+                    strings.size() + textures.size();
+    if (nItems <= paramSetIndexThreshold) return;
+    lookupIndex.reserve(nItems);
+#define INDEX_PARAMS(vec, type)                     \
+    for (uint32_t i = 0; i < (vec).size(); ++i)     \
+    lookupIndex.push_back(IndexEntry{&(vec)[i]->name, uint32_t(type), i})
+    INDEX_PARAMS(bools, ParamTypeBool);
+    INDEX_PARAMS(ints, ParamTypeInt);
+    INDEX_PARAMS(floats, ParamTypeFloat);
+    INDEX_PARAMS(point2fs, ParamTypePoint2f);
+    INDEX_PARAMS(vector2fs, ParamTypeVector2f);
+    INDEX_PARAMS(point3fs, ParamTypePoint3f);
+    INDEX_PARAMS(vector3fs, ParamTypeVector3f);
+    INDEX_PARAMS(normals, ParamTypeNormal3f);
+    INDEX_PARAMS(spectra, ParamTypeSpectrum);
+    INDEX_PARAMS(strings, ParamTypeString);
+    INDEX_PARAMS(textures, ParamTypeTexture);
+#undef INDEX_PARAMS
+    std::sort(lookupIndex.begin(), lookupIndex.end(),
+              [](const IndexEntry &a, const IndexEntry &b) {
+                  return *a.name < *b.name;
+              });
+}
+
+// Finds the item with the given name in one of the typed vectors, through
+// the sorted index when one has been built and by linear scan otherwise.
+template <typename T>
+const ParamSetItem<T> *ParamSet::FindItem(
+    const std::vector<std::shared_ptr<ParamSetItem<T>>> &vec, int type,
+    const std::string &name) const {
+    if (lookupIndexDirty) BuildLookupIndex();
+    if (!lookupIndex.empty()) {
+        auto iter = std::lower_bound(
+            lookupIndex.begin(), lookupIndex.end(), name,
+            [](const IndexEntry &e, const std::string &n) {
+                return *e.name < n;
+            });
+        // The same name may appear in several typed vectors; scan the
+        // equal range for the requested type.
+        for (; iter != lookupIndex.end() && *iter->name == name; ++iter)
+            if (iter->type == (uint32_t)type) return vec[iter->slot].get();
+        return nullptr;
+    }
+    for (const auto &v : vec)
+        if (v->name == name) return v.get();
+    return nullptr;
+}
+
 // ParamSet Macros
 #define ADD_PARAM_TYPE(T, vec) \
     (vec).emplace_back(new ParamSetItem<T>(name, std::move(values), nValues));
-#define LOOKUP_PTR(vec)             \
-    for (const auto &v : vec)       \
-        if (v->name == name) {      \
-            *nValues = v->nValues;  \
-            v->lookedUp = true;     \
-            return v->values.get(); \
-        }                           \
+#define LOOKUP_PTR(vec, type)                           \
+    const auto *item = FindItem(vec, type, name);       \
+    if (item) {                                         \
+        *nValues = item->nValues;                       \
+        item->lookedUp = true;                          \
+        return item->values.get();                      \
+    }                                                   \
     return nullptr
-#define LOOKUP_ONE(vec)                           \
-    for (const auto &v : vec)                     \
-        if (v->name == name && v->nValues == 1) { \
-            v->lookedUp = true;                   \
-            return v->values[0];                  \
-        }                                         \
+#define LOOKUP_ONE(vec, type)                           \
+    const auto *item = FindItem(vec, type, name);       \
+    if (item && item->nValues == 1) {                   \
+        item->lookedUp = true;                          \
+        return item->values[0];                         \
+    }                                                   \
     return d
 
 // ParamSet Methods
@@ -65,6 +150,24 @@ void ParamSet::AddFloat(const std::string &name,
         new ParamSetItem<Float>(name, std::move(values), nValues));
 }
 
+void ParamSet::AddFloat(const std::string &name, const Float *values,
+                        int nValues) {
+    EraseFloat(name);
+    floats.emplace_back(new ParamSetItem<Float>(name, values, nValues));
+}
+
+void ParamSet::AddInt(const std::string &name, const int *values,
+                      int nValues) {
+    EraseInt(name);
+    ints.emplace_back(new ParamSetItem<int>(name, values, nValues));
+}
+
+void ParamSet::AddBool(const std::string &name, const bool *values,
+                       int nValues) {
+    EraseBool(name);
+    bools.emplace_back(new ParamSetItem<bool>(name, values, nValues));
+}
+
 void ParamSet::AddInt(const std::string &name, std::unique_ptr<int[]> values,
                       int nValues) {
     EraseInt(name);
@@ -112,6 +215,15 @@ void ParamSet::AddRGBSpectrum(const std::string &name,
     EraseSpectrum(name);
     CHECK_EQ(nValues % 3, 0);
     nValues /= 3;
+    if (nValues <= ParamSetValues<Spectrum>::nInline) {
+        // Common case ("rgb Kd [...]" and friends): build the spectra on the
+        // stack and let the item store them inline.
+        Spectrum s[ParamSetValues<Spectrum>::nInline];
+        for (int i = 0; i < nValues; ++i)
+            s[i] = Spectrum::FromRGB(&values[3 * i]);
+        spectra.emplace_back(new ParamSetItem<Spectrum>(name, s, nValues));
+        return;
+    }
     std::unique_ptr<Spectrum[]> s(new Spectrum[nValues]);
     for (int i = 0; i < nValues; ++i) s[i] = Spectrum::FromRGB(&values[3 * i]);
     std::shared_ptr<ParamSetItem<Spectrum>> psi(
@@ -131,6 +243,51 @@ void ParamSet::AddXYZSpectrum(const std::string &name,
     spectra.push_back(psi);
 }
 
+// Resampling a "spectrum" parameter to the renderer's representation
+// sorts the samples and runs O(n) interpolation per coefficient; scenes
+// with measured materials repeat the same tables across thousands of
+// parameters, so the results are cached keyed by a hash of the raw sample
+// data, alongside the per-file cache in AddSampledSpectrumFiles(). Hash
+// collisions are resolved by comparing the stored samples. Like
+// _cachedSpectra_, the cache is only touched from the parsing thread.
+struct SampledSpectrumCacheEntry {
+    std::vector<Float> samples;
+    Spectrum s;
+};
+static std::unordered_map<uint64_t, std::vector<SampledSpectrumCacheEntry>>
+    sampledSpectrumCache;
+
+static uint64_t HashSpectrumSamples(const Float *values, int nValues) {
+    const char *ptr = (const char *)values;
+    size_t size = nValues * sizeof(Float);
+    uint64_t hash = 14695981039346656037ull;
+    while (size > 0) {
+        hash ^= *ptr;
+        hash *= 1099511628211ull;
+        ++ptr;
+        --size;
+    }
+    return hash;
+}
+
+static const Spectrum *LookupSampledSpectrum(uint64_t hash,
+                                             const Float *values,
+                                             int nValues) {
+    auto iter = sampledSpectrumCache.find(hash);
+    if (iter == sampledSpectrumCache.end()) return nullptr;
+    for (const SampledSpectrumCacheEntry &entry : iter->second)
+        if (entry.samples.size() == (size_t)nValues &&
+            std::equal(entry.samples.begin(), entry.samples.end(), values))
+            return &entry.s;
+    return nullptr;
+}
+
+static void CacheSampledSpectrum(uint64_t hash, const Float *values,
+                                 int nValues, const Spectrum &s) {
+    sampledSpectrumCache[hash].push_back(
+        {std::vector<Float>(values, values + nValues), s});
+}
+
 void ParamSet::AddBlackbodySpectrum(const std::string &name,
                                     std::unique_ptr<Float[]> values,
                                     int nValues) {
@@ -140,9 +297,20 @@ void ParamSet::AddBlackbodySpectrum(const std::string &name,
     std::unique_ptr<Spectrum[]> s(new Spectrum[nValues]);
     std::unique_ptr<Float[]> v(new Float[nCIESamples]);
     for (int i = 0; i < nValues; ++i) {
-        BlackbodyNormalized(CIE_lambda, nCIESamples, values[2 * i], v.get());
-        s[i] = values[2 * i + 1] *
-               Spectrum::FromSampled(CIE_lambda, v.get(), nCIESamples);
+        // Cache the normalized blackbody spectrum per temperature; the
+        // scale is applied afterwards.
+        uint64_t hash = HashSpectrumSamples(&values[2 * i], 1);
+        const Spectrum *cached =
+            LookupSampledSpectrum(hash, &values[2 * i], 1);
+        if (!cached) {
+            BlackbodyNormalized(CIE_lambda, nCIESamples, values[2 * i],
+                                v.get());
+            CacheSampledSpectrum(
+                hash, &values[2 * i], 1,
+                Spectrum::FromSampled(CIE_lambda, v.get(), nCIESamples));
+            cached = LookupSampledSpectrum(hash, &values[2 * i], 1);
+        }
+        s[i] = values[2 * i + 1] * *cached;
     }
     std::shared_ptr<ParamSetItem<Spectrum>> psi(
         new ParamSetItem<Spectrum>(name, std::move(s), nValues));
@@ -155,14 +323,22 @@ void ParamSet::AddSampledSpectrum(const std::string &name,
     EraseSpectrum(name);
     CHECK_EQ(nValues % 2, 0);
     nValues /= 2;
-    std::unique_ptr<Float[]> wl(new Float[nValues]);
-    std::unique_ptr<Float[]> v(new Float[nValues]);
-    for (int i = 0; i < nValues; ++i) {
-        wl[i] = values[2 * i];
-        v[i] = values[2 * i + 1];
-    }
     std::unique_ptr<Spectrum[]> s(new Spectrum[1]);
-    s[0] = Spectrum::FromSampled(wl.get(), v.get(), nValues);
+    uint64_t hash = HashSpectrumSamples(values.get(), 2 * nValues);
+    const Spectrum *cached =
+        LookupSampledSpectrum(hash, values.get(), 2 * nValues);
+    if (cached)
+        s[0] = *cached;
+    else {
+        std::unique_ptr<Float[]> wl(new Float[nValues]);
+        std::unique_ptr<Float[]> v(new Float[nValues]);
+        for (int i = 0; i < nValues; ++i) {
+            wl[i] = values[2 * i];
+            v[i] = values[2 * i + 1];
+        }
+        s[0] = Spectrum::FromSampled(wl.get(), v.get(), nValues);
+        CacheSampledSpectrum(hash, values.get(), 2 * nValues, s[0]);
+    }
     std::shared_ptr<ParamSetItem<Spectrum>> psi(
         new ParamSetItem<Spectrum>(name, std::move(s), 1));
     spectra.push_back(psi);
@@ -224,6 +400,7 @@ void ParamSet::AddTexture(const std::string &name, const std::string &value) {
 }
 
 bool ParamSet::EraseInt(const std::string &n) {
+    lookupIndexDirty = true;
     for (size_t i = 0; i < ints.size(); ++i)
         if (ints[i]->name == n) {
             ints.erase(ints.begin() + i);
@@ -233,6 +410,7 @@ bool ParamSet::EraseInt(const std::string &n) {
 }
 
 bool ParamSet::EraseBool(const std::string &n) {
+    lookupIndexDirty = true;
     for (size_t i = 0; i < bools.size(); ++i)
         if (bools[i]->name == n) {
             bools.erase(bools.begin() + i);
@@ -242,6 +420,7 @@ bool ParamSet::EraseBool(const std::string &n) {
 }
 
 bool ParamSet::EraseFloat(const std::string &n) {
+    lookupIndexDirty = true;
     for (size_t i = 0; i < floats.size(); ++i)
         if (floats[i]->name == n) {
             floats.erase(floats.begin() + i);
@@ -251,6 +430,7 @@ bool ParamSet::EraseFloat(const std::string &n) {
 }
 
 bool ParamSet::ErasePoint2f(const std::string &n) {
+    lookupIndexDirty = true;
     for (size_t i = 0; i < point2fs.size(); ++i)
         if (point2fs[i]->name == n) {
             point2fs.erase(point2fs.begin() + i);
@@ -260,6 +440,7 @@ bool ParamSet::ErasePoint2f(const std::string &n) {
 }
 
 bool ParamSet::EraseVector2f(const std::string &n) {
+    lookupIndexDirty = true;
     for (size_t i = 0; i < vector2fs.size(); ++i)
         if (vector2fs[i]->name == n) {
             vector2fs.erase(vector2fs.begin() + i);
@@ -269,6 +450,7 @@ bool ParamSet::EraseVector2f(const std::string &n) {
 }
 
 bool ParamSet::ErasePoint3f(const std::string &n) {
+    lookupIndexDirty = true;
     for (size_t i = 0; i < point3fs.size(); ++i)
         if (point3fs[i]->name == n) {
             point3fs.erase(point3fs.begin() + i);
@@ -278,6 +460,7 @@ bool ParamSet::ErasePoint3f(const std::string &n) {
 }
 
 bool ParamSet::EraseVector3f(const std::string &n) {
+    lookupIndexDirty = true;
     for (size_t i = 0; i < vector3fs.size(); ++i)
         if (vector3fs[i]->name == n) {
             vector3fs.erase(vector3fs.begin() + i);
@@ -287,6 +470,7 @@ bool ParamSet::EraseVector3f(const std::string &n) {
 }
 
 bool ParamSet::EraseNormal3f(const std::string &n) {
+    lookupIndexDirty = true;
     for (size_t i = 0; i < normals.size(); ++i)
         if (normals[i]->name == n) {
             normals.erase(normals.begin() + i);
@@ -296,6 +480,7 @@ bool ParamSet::EraseNormal3f(const std::string &n) {
 }
 
 bool ParamSet::EraseSpectrum(const std::string &n) {
+    lookupIndexDirty = true;
     for (size_t i = 0; i < spectra.size(); ++i)
         if (spectra[i]->name == n) {
             spectra.erase(spectra.begin() + i);
@@ -305,6 +490,7 @@ bool ParamSet::EraseSpectrum(const std::string &n) {
 }
 
 bool ParamSet::EraseString(const std::string &n) {
+    lookupIndexDirty = true;
     for (size_t i = 0; i < strings.size(); ++i)
         if (strings[i]->name == n) {
             strings.erase(strings.begin() + i);
@@ -314,6 +500,7 @@ bool ParamSet::EraseString(const std::string &n) {
 }
 
 bool ParamSet::EraseTexture(const std::string &n) {
+    lookupIndexDirty = true;
     for (size_t i = 0; i < textures.size(); ++i)
         if (textures[i]->name == n) {
             textures.erase(textures.begin() + i);
@@ -323,108 +510,97 @@ bool ParamSet::EraseTexture(const std::string &n) {
 }
 
 Float ParamSet::FindOneFloat(const std::string &name, Float d) const {
-    for (const auto &f : floats)
-        if (f->name == name && f->nValues == 1) {
-            f->lookedUp = true;
-            return f->values[0];
-        }
-    return d;
+    LOOKUP_ONE(floats, ParamTypeFloat);
 }
 
-const Float *ParamSet::FindFloat(const std::string &name, int *n) const {
-    for (const auto &f : floats)
-        if (f->name == name) {
-            *n = f->nValues;
-            f->lookedUp = true;
-            return f->values.get();
-        }
-    return nullptr;
+const Float *ParamSet::FindFloat(const std::string &name, int *nValues) const {
+    LOOKUP_PTR(floats, ParamTypeFloat);
 }
 
 const int *ParamSet::FindInt(const std::string &name, int *nValues) const {
-    LOOKUP_PTR(ints);
+    LOOKUP_PTR(ints, ParamTypeInt);
 }
 
 const bool *ParamSet::FindBool(const std::string &name, int *nValues) const {
-    LOOKUP_PTR(bools);
+    LOOKUP_PTR(bools, ParamTypeBool);
 }
 
 int ParamSet::FindOneInt(const std::string &name, int d) const {
-    LOOKUP_ONE(ints);
+    LOOKUP_ONE(ints, ParamTypeInt);
 }
 
 bool ParamSet::FindOneBool(const std::string &name, bool d) const {
-    LOOKUP_ONE(bools);
+    LOOKUP_ONE(bools, ParamTypeBool);
 }
 
 const Point2f *ParamSet::FindPoint2f(const std::string &name,
                                      int *nValues) const {
-    LOOKUP_PTR(point2fs);
+    LOOKUP_PTR(point2fs, ParamTypePoint2f);
 }
 
 Point2f ParamSet::FindOnePoint2f(const std::string &name,
                                  const Point2f &d) const {
-    LOOKUP_ONE(point2fs);
+    LOOKUP_ONE(point2fs, ParamTypePoint2f);
 }
 
 const Vector2f *ParamSet::FindVector2f(const std::string &name,
                                        int *nValues) const {
-    LOOKUP_PTR(vector2fs);
+    LOOKUP_PTR(vector2fs, ParamTypeVector2f);
 }
 
 Vector2f ParamSet::FindOneVector2f(const std::string &name,
                                    const Vector2f &d) const {
-    LOOKUP_ONE(vector2fs);
+    LOOKUP_ONE(vector2fs, ParamTypeVector2f);
 }
 
 const Point3f *ParamSet::FindPoint3f(const std::string &name,
                                      int *nValues) const {
-    LOOKUP_PTR(point3fs);
+    LOOKUP_PTR(point3fs, ParamTypePoint3f);
 }
 
 Point3f ParamSet::FindOnePoint3f(const std::string &name,
                                  const Point3f &d) const {
-    LOOKUP_ONE(point3fs);
+    LOOKUP_ONE(point3fs, ParamTypePoint3f);
 }
 
 const Vector3f *ParamSet::FindVector3f(const std::string &name,
                                        int *nValues) const {
-    LOOKUP_PTR(vector3fs);
+    LOOKUP_PTR(vector3fs, ParamTypeVector3f);
 }
 
 Vector3f ParamSet::FindOneVector3f(const std::string &name,
                                    const Vector3f &d) const {
-    LOOKUP_ONE(vector3fs);
+    LOOKUP_ONE(vector3fs, ParamTypeVector3f);
 }
 
 const Normal3f *ParamSet::FindNormal3f(const std::string &name,
                                        int *nValues) const {
-    LOOKUP_PTR(normals);
+    LOOKUP_PTR(normals, ParamTypeNormal3f);
 }
 
 Normal3f ParamSet::FindOneNormal3f(const std::string &name,
                                    const Normal3f &d) const {
-    LOOKUP_ONE(normals);
+    LOOKUP_ONE(normals, ParamTypeNormal3f);
 }
 
 const Spectrum *ParamSet::FindSpectrum(const std::string &name,
                                        int *nValues) const {
-    LOOKUP_PTR(spectra);
+    LOOKUP_PTR(spectra, ParamTypeSpectrum);
 }
 
 Spectrum ParamSet::FindOneSpectrum(const std::string &name,
                                    const Spectrum &d) const {
-    LOOKUP_ONE(spectra);
+    LOOKUP_ONE(spectra, ParamTypeSpectrum);
 }
 
 const std::string *ParamSet::FindString(const std::string &name,
                                         int *nValues) const {
-    LOOKUP_PTR(strings);
+    LOOKUP_PTR(strings, ParamTypeString);
 }
 
 std::string ParamSet::FindOneString(const std::string &name,
                                     const std::string &d) const {
-    LOOKUP_ONE(strings);
+    LOOKUP_ONE(strings, ParamTypeString);
 }
 
 std::string ParamSet::FindOneFilename(const std::string &name,
@@ -437,7 +613,7 @@ std::string ParamSet::FindOneFilename(const std::string &name,
 
 std::string ParamSet::FindTexture(const std::string &name) const {
     std::string d = "";
-    LOOKUP_ONE(textures);
+    LOOKUP_ONE(textures, ParamTypeTexture);
 }
 
 void ParamSet::ReportUnused() const {
@@ -459,6 +635,8 @@ void ParamSet::ReportUnused() const {
 }
 
 void ParamSet::Clear() {
+    lookupIndexDirty = true;
+    lookupIndex.clear();
 #define DEL_PARAMS(name) (name).erase((name).begin(), (name).end())
     DEL_PARAMS(ints);
     DEL_PARAMS(bools);
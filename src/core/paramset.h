@@ -49,15 +49,27 @@
 
 namespace pbrt {
 
+// Return a reference to a canonical, never-deallocated copy of _s_.
+// Parameter names repeat endlessly across a scene file ("P", "N", "uv",
+// "filename", ...); storing one interned copy per distinct name saves a
+// string allocation per ParamSetItem.
+const std::string &InternedString(const std::string &s);
+
 // ParamSet Declarations
 class ParamSet {
   public:
     // ParamSet Public Methods
-    ParamSet() {}
+    ParamSet() : lookupIndexDirty(true) {}
     void AddFloat(const std::string &, std::unique_ptr<Float[]> v,
                   int nValues = 1);
     void AddInt(const std::string &, std::unique_ptr<int[]> v, int nValues);
     void AddBool(const std::string &, std::unique_ptr<bool[]> v, int nValues);
+    // Overloads that copy from caller-owned storage; with the items' inline
+    // small-array storage these add short parameter lists without any heap
+    // allocation.
+    void AddFloat(const std::string &, const Float *v, int nValues = 1);
+    void AddInt(const std::string &, const int *v, int nValues);
+    void AddBool(const std::string &, const bool *v, int nValues);
     void AddPoint2f(const std::string &, std::unique_ptr<Point2f[]> v,
                     int nValues);
     void AddVector2f(const std::string &, std::unique_ptr<Vector2f[]> v,
@@ -123,6 +135,26 @@ class ParamSet {
   private:
     friend class TextureParams;
     friend bool shapeMaySetMaterialParameters(const ParamSet &ps);
+    friend void RecordPartitionTextures(const ParamSet &ps,
+                                        const Bounds3<Float> &b,
+                                        bool everywhere);
+
+    // Sorted lookup index over the items of all eleven typed vectors,
+    // built lazily once the set holds more than a handful of parameters:
+    // shape and material factories call dozens of Find*s per object, and
+    // the linear scans turn quadratic for parameter-heavy sets. Entries
+    // hold pointers to the items' interned names, so building the index
+    // copies no strings. Any mutation marks the index dirty and the next
+    // lookup rebuilds it.
+    struct IndexEntry {
+        const std::string *name;
+        uint32_t type, slot;
+    };
+    template <typename T>
+    const ParamSetItem<T> *FindItem(
+        const std::vector<std::shared_ptr<ParamSetItem<T>>> &vec, int type,
+        const std::string &name) const;
+    void BuildLookupIndex() const;
 
     // ParamSet Private Data
     std::vector<std::shared_ptr<ParamSetItem<bool>>> bools;
@@ -136,18 +168,54 @@ class ParamSet {
     std::vector<std::shared_ptr<ParamSetItem<Spectrum>>> spectra;
     std::vector<std::shared_ptr<ParamSetItem<std::string>>> strings;
     std::vector<std::shared_ptr<ParamSetItem<std::string>>> textures;
+    mutable std::vector<IndexEntry> lookupIndex;
+    mutable bool lookupIndexDirty;
     static std::map<std::string, Spectrum> cachedSpectra;
 };
 
+// Storage for a ParamSetItem's values: arrays of up to four elements are
+// kept inline in the item, so the single-valued parameters that dominate
+// scene files don't hold (or, via the copying Add* overloads, ever make) a
+// heap allocation.
+template <typename T>
+class ParamSetValues {
+  public:
+    ParamSetValues(std::unique_ptr<T[]> v, int n) {
+        if (n <= nInline)
+            for (int i = 0; i < n; ++i) inlineValues[i] = std::move(v[i]);
+        else
+            heapValues = std::move(v);
+    }
+    ParamSetValues(const T *v, int n) {
+        if (n <= nInline)
+            for (int i = 0; i < n; ++i) inlineValues[i] = v[i];
+        else {
+            heapValues.reset(new T[n]);
+            for (int i = 0; i < n; ++i) heapValues[i] = v[i];
+        }
+    }
+    const T *get() const {
+        return heapValues ? heapValues.get() : inlineValues;
+    }
+    const T &operator[](int i) const { return get()[i]; }
+
+    static PBRT_CONSTEXPR int nInline = 4;
+
+  private:
+    T inlineValues[nInline];
+    std::unique_ptr<T[]> heapValues;
+};
+
 template <typename T>
 struct ParamSetItem {
     // ParamSetItem Public Methods
     ParamSetItem(const std::string &name, std::unique_ptr<T[]> val,
                  int nValues = 1);
+    ParamSetItem(const std::string &name, const T *v, int nValues = 1);
 
     // ParamSetItem Data
-    const std::string name;
-    const std::unique_ptr<T[]> values;
+    const std::string &name;
+    const ParamSetValues<T> values;
     const int nValues;
     mutable bool lookedUp = false;
 };
@@ -156,7 +224,12 @@ struct ParamSetItem {
 template <typename T>
 ParamSetItem<T>::ParamSetItem(const std::string &name, std::unique_ptr<T[]> v,
                               int nValues)
-    : name(name), values(std::move(v)), nValues(nValues) {}
+    : name(InternedString(name)), values(std::move(v), nValues),
+      nValues(nValues) {}
+
+template <typename T>
+ParamSetItem<T>::ParamSetItem(const std::string &name, const T *v, int nValues)
+    : name(InternedString(name)), values(v, nValues), nValues(nValues) {}
 
 // TextureParams Declarations
 class TextureParams {
@@ -32,9 +32,11 @@
 
 // core/parser.cpp*
 #include "parser.h"
+#include "progressreporter.h"
 #include "api.h"
 #include "fileutil.h"
 #include "memory.h"
+#include "parallel.h"
 #include "paramset.h"
 #include "stats.h"
 
@@ -50,9 +52,12 @@
 #elif defined(PBRT_IS_WINDOWS)
 #include <windows.h>  // Windows file mapping API
 #endif
+#include <deque>
 #include <functional>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <utility>
 #include <vector>
@@ -67,6 +72,21 @@ static std::string toString(string_view s) {
 
 STAT_MEMORY_COUNTER("Memory/Tokenizer buffers", tokenizerMemory);
 
+// Binary Scene Format Declarations
+// A .pbb file (written with --toformat-binary) holds the scene's token
+// stream pre-tokenized: strings and directives are stored length-prefixed
+// and returned as string_views directly into the memory-mapped file, and
+// numbers are stored as binary doubles, so loading skips both lexing and
+// strto[df]() entirely. Include directives are inlined at conversion time.
+// Each record is one byte of record type ('S' or 'N') followed by its
+// payload; numbers are handed to the parser via _binTokenNumber_ and a
+// one-byte marker token that parseNumber() recognizes.
+static const char binMagic[4] = {'P', 'B', 'B', '\0'};
+static PBRT_CONSTEXPR uint32_t binVersion = 1;
+static PBRT_CONSTEXPR char binNumberMarker = '\x01';
+static const char binNumberMarkerToken[1] = {binNumberMarker};
+static PBRT_THREAD_LOCAL double binTokenNumber;
+
 static char decodeEscaped(int ch) {
     switch (ch) {
     case EOF:
@@ -95,9 +115,24 @@ static char decodeEscaped(int ch) {
     return 0;  // NOTREACHED
 }
 
+// The files read by the in-progress pbrtParseFile() call; session mode
+// ("--session") watches them for edits between renders. Guarded by a mutex
+// since the include pre-lexing workers also open files.
+static std::mutex parsedFilenamesMutex;
+static std::vector<std::string> parsedFilenames;
+
+std::vector<std::string> GetParsedFilenames() {
+    std::lock_guard<std::mutex> lock(parsedFilenamesMutex);
+    return parsedFilenames;
+}
+
 std::unique_ptr<Tokenizer> Tokenizer::CreateFromFile(
     const std::string &filename,
     std::function<void(const char *)> errorCallback) {
+    if (filename != "-") {
+        std::lock_guard<std::mutex> lock(parsedFilenamesMutex);
+        parsedFilenames.push_back(AbsolutePath(filename));
+    }
     if (filename == "-") {
         // Handle stdin by slurping everything into a string.
         std::string str;
@@ -108,6 +143,24 @@ std::unique_ptr<Tokenizer> Tokenizer::CreateFromFile(
             new Tokenizer(std::move(str), std::move(errorCallback)));
     }
 
+    if (IsCompressedFile(filename)) {
+        // Compressed scenes can't be lexed from a mapping; decompress into
+        // memory and tokenize from there. (Compressed Include files are
+        // decompressed on the pre-lexing worker threads, overlapping
+        // decompression with the rest of the scene load.)
+        std::string str;
+        if (!DecompressFile(filename, &str)) {
+            errorCallback(
+                StringPrintf("%s: unable to decompress", filename.c_str())
+                    .c_str());
+            return nullptr;
+        }
+        std::unique_ptr<Tokenizer> t(
+            new Tokenizer(std::move(str), std::move(errorCallback)));
+        t->loc = Loc(filename);
+        return t;
+    }
+
 #ifdef PBRT_HAVE_MMAP
     int fd = open(filename.c_str(), O_RDONLY);
     if (fd == -1) {
@@ -212,6 +265,7 @@ Tokenizer::Tokenizer(std::string str,
     pos = contents.data();
     end = pos + contents.size();
     tokenizerMemory += contents.size();
+    CheckBinaryHeader();
 }
 
 #if defined(PBRT_HAVE_MMAP) || defined(PBRT_IS_WINDOWS)
@@ -223,6 +277,7 @@ Tokenizer::Tokenizer(void *ptr, size_t len, std::string filename,
       unmapLength(len) {
     pos = (const char *)ptr;
     end = pos + len;
+    CheckBinaryHeader();
 }
 #endif
 
@@ -249,7 +304,98 @@ Tokenizer::~Tokenizer() {
 #endif
 }
 
+void Tokenizer::CheckBinaryHeader() {
+    if (end - pos >= 8 && memcmp(pos, binMagic, sizeof(binMagic)) == 0) {
+        uint32_t version;
+        memcpy(&version, pos + sizeof(binMagic), sizeof(version));
+        if (version != binVersion) {
+            errorCallback(StringPrintf("binary scene file version %u is not "
+                                       "supported; re-run --toformat-binary",
+                                       version)
+                              .c_str());
+            pos = end;
+            return;
+        }
+        binary = true;
+        pos += 8;
+    }
+}
+
+string_view Tokenizer::NextBinary() {
+    if (pos == end) return {};
+    char kind = *pos++;
+    if (kind == 'N') {
+        if (end - pos < (ptrdiff_t)sizeof(double)) {
+            errorCallback("truncated binary scene file");
+            pos = end;
+            return {};
+        }
+        memcpy(&binTokenNumber, pos, sizeof(double));
+        pos += sizeof(double);
+        return {binNumberMarkerToken, 1};
+    } else if (kind == 'S') {
+        uint32_t len;
+        if (end - pos < (ptrdiff_t)sizeof(len)) {
+            errorCallback("truncated binary scene file");
+            pos = end;
+            return {};
+        }
+        memcpy(&len, pos, sizeof(len));
+        pos += sizeof(len);
+        if (end - pos < (ptrdiff_t)len) {
+            errorCallback("truncated binary scene file");
+            pos = end;
+            return {};
+        }
+        string_view token{pos, len};
+        pos += len;
+        return token;
+    }
+    errorCallback("corrupt binary scene file");
+    pos = end;
+    return {};
+}
+
+// Pre-lexed Include Definitions
+struct PreLexedFile {
+    struct Token {
+        const char *ptr;
+        uint32_t len;
+        bool isNumber;
+        double number;
+    };
+    std::unique_ptr<Tokenizer> tokenizer;  // keeps the mapping alive
+    std::vector<Token> tokens;
+    // Stable copies of quoted strings, whose views from Next() may point
+    // into the tokenizer's transient escape buffer.
+    std::deque<std::string> strings;
+};
+
+std::unique_ptr<Tokenizer> Tokenizer::CreateFromPreLexed(
+    std::unique_ptr<PreLexedFile> preLexed, const std::string &filename) {
+    return std::unique_ptr<Tokenizer>(
+        new Tokenizer(std::move(preLexed), filename));
+}
+
+Tokenizer::Tokenizer(std::unique_ptr<PreLexedFile> preLexed,
+                     const std::string &filename)
+    : loc(filename), preLexed(std::move(preLexed)) {
+    pos = end = nullptr;
+}
+
+string_view Tokenizer::NextPreLexed() {
+    if (preLexedPos == preLexed->tokens.size()) return {};
+    const PreLexedFile::Token &tok = preLexed->tokens[preLexedPos++];
+    if (tok.isNumber) {
+        binTokenNumber = tok.number;
+        return {binNumberMarkerToken, 1};
+    }
+    return {tok.ptr, tok.len};
+}
+
 string_view Tokenizer::Next() {
+    if (preLexed) return NextPreLexed();
+    if (binary) return NextBinary();
     while (true) {
         const char *tokenStart = pos;
         int ch = getChar();
@@ -320,6 +466,10 @@ string_view Tokenizer::Next() {
 }
 
 static double parseNumber(string_view str) {
+    // Binary scene files carry numbers pre-parsed; the tokenizer returns the
+    // marker token and leaves the value in _binTokenNumber_.
+    if (str.size() == 1 && str[0] == binNumberMarker) return binTokenNumber;
+
     // Fast path for a single digit
     if (str.size() == 1) {
         if (!(str[0] >= '0' && str[0] <= '9')) {
@@ -329,6 +479,82 @@ static double parseNumber(string_view str) {
         return str[0] - '0';
     }
 
+    // Fast path: decode the common numeric forms -- an optional sign,
+    // digits with an optional fraction, and an optional exponent -- with
+    // integer arithmetic. When the mantissa fits in 15 digits and the
+    // decimal exponent is within +/-22, scaling by an exact power of ten
+    // rounds once and so matches strtod() bit for bit (Clinger's fast
+    // path); anything outside that (hex floats, inf/nan, very long
+    // mantissas) falls through to strtod() below. This skips the copy,
+    // locale, and overflow machinery of strto[df]() for essentially every
+    // number in a mesh-heavy scene.
+    {
+        const char *p = str.data(), *pEnd = p + str.size();
+        bool negative = false;
+        if (*p == '+' || *p == '-') {
+            negative = (*p == '-');
+            ++p;
+        }
+        uint64_t mantissa = 0;
+        int nDigits = 0, exp10 = 0;
+        bool anyDigits = false;
+        while (p < pEnd && *p == '0') {
+            ++p;
+            anyDigits = true;
+        }
+        while (p < pEnd && *p >= '0' && *p <= '9') {
+            if (nDigits < 19) {
+                mantissa = 10 * mantissa + (*p - '0');
+                ++nDigits;
+            } else
+                ++exp10;
+            ++p;
+            anyDigits = true;
+        }
+        if (p < pEnd && *p == '.') {
+            ++p;
+            if (mantissa == 0)
+                while (p < pEnd && *p == '0') {
+                    --exp10;
+                    ++p;
+                    anyDigits = true;
+                }
+            while (p < pEnd && *p >= '0' && *p <= '9') {
+                if (nDigits < 19) {
+                    mantissa = 10 * mantissa + (*p - '0');
+                    ++nDigits;
+                    --exp10;
+                }
+                ++p;
+                anyDigits = true;
+            }
+        }
+        if (anyDigits && p < pEnd && (*p == 'e' || *p == 'E')) {
+            ++p;
+            bool expNegative = false;
+            if (p < pEnd && (*p == '+' || *p == '-')) {
+                expNegative = (*p == '-');
+                ++p;
+            }
+            int expValue = 0;
+            const char *expStart = p;
+            while (p < pEnd && *p >= '0' && *p <= '9' && expValue < 1000)
+                expValue = 10 * expValue + (*p++ - '0');
+            if (p == expStart) p = nullptr;  // malformed; use strtod()'s error
+            else exp10 += expNegative ? -expValue : expValue;
+        }
+        if (p == pEnd && anyDigits && nDigits <= 15 && exp10 >= -22 &&
+            exp10 <= 22) {
+            static const double pow10[23] = {
+                1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+            double value = (double)mantissa;
+            value = exp10 < 0 ? value / pow10[-exp10] : value * pow10[exp10];
+            return negative ? -value : value;
+        }
+    }
+
     // Copy to a buffer so we can NUL-terminate it, as strto[idf]() expect.
     char buf[64];
     char *bufp = buf;
@@ -383,7 +609,9 @@ static string_view dequoteString(string_view str) {
 }
 
 struct ParamListItem {
-    std::string name;
+    // The declaration string (type and name), stored in the parse-scoped
+    // arena along with the values below; nothing here outlives AddParam().
+    const char *name = nullptr;
     double *doubleValues = nullptr;
     const char **stringValues = nullptr;
     size_t size = 0;
@@ -410,30 +638,30 @@ enum {
     PARAM_TYPE_TEXTURE
 };
 
-static bool lookupType(const std::string &decl, int *type, std::string &sname) {
+static bool lookupType(const char *decl, int *type, std::string &sname) {
     *type = 0;
+    const char *declEnd = decl + strlen(decl);
     // Skip leading space
-    auto skipSpace = [&decl](std::string::const_iterator iter) {
-        while (iter != decl.end() && (*iter == ' ' || *iter == '\t')) ++iter;
+    auto skipSpace = [declEnd](const char *iter) {
+        while (iter != declEnd && (*iter == ' ' || *iter == '\t')) ++iter;
         return iter;
     };
     // Skip to the next whitespace character (or the end of the string).
-    auto skipToSpace = [&decl](std::string::const_iterator iter) {
-        while (iter != decl.end() && *iter != ' ' && *iter != '\t') ++iter;
+    auto skipToSpace = [declEnd](const char *iter) {
+        while (iter != declEnd && *iter != ' ' && *iter != '\t') ++iter;
         return iter;
     };
 
-    auto typeBegin = skipSpace(decl.begin());
-    if (typeBegin == decl.end()) {
-        Error("Parameter \"%s\" doesn't have a type declaration?!",
-              decl.c_str());
+    auto typeBegin = skipSpace(decl);
+    if (typeBegin == declEnd) {
+        Error("Parameter \"%s\" doesn't have a type declaration?!", decl);
         return false;
     }
 
     // Find end of type declaration
     auto typeEnd = skipToSpace(typeBegin);
 
-    string_view typeStr(&(*typeBegin), size_t(typeEnd - typeBegin));
+    string_view typeStr(typeBegin, size_t(typeEnd - typeBegin));
     if (typeStr == "float")
         *type = PARAM_TYPE_FLOAT;
     else if (typeStr == "integer")
@@ -469,13 +697,13 @@ static bool lookupType(const std::string &decl, int *type, std::string &sname) {
     else if (typeStr == "spectrum")
         *type = PARAM_TYPE_SPECTRUM;
     else {
-        Error("Unable to decode type from \"%s\"", decl.c_str());
+        Error("Unable to decode type from \"%s\"", decl);
         return false;
     }
 
     auto nameBegin = skipSpace(typeEnd);
-    if (nameBegin == decl.end()) {
-        Error("Unable to find parameter name from \"%s\"", decl.c_str());
+    if (nameBegin == declEnd) {
+        Error("Unable to find parameter name from \"%s\"", decl);
         return false;
     }
     auto nameEnd = skipToSpace(nameBegin);
@@ -548,6 +776,15 @@ static void AddParam(ParamSet &ps, const ParamListItem &item,
         int nItems = item.size;
         if (type == PARAM_TYPE_INT) {
             // parser doesn't handle ints, so convert from doubles here....
+            if (nItems <= ParamSetValues<int>::nInline) {
+                // Short lists convert on the stack and are stored inline in
+                // the ParamSetItem; no allocations at all.
+                int idata[ParamSetValues<int>::nInline];
+                for (int j = 0; j < nItems; ++j)
+                    idata[j] = int(item.doubleValues[j]);
+                ps.AddInt(name, idata, nItems);
+                return;
+            }
             int nAlloc = nItems;
             std::unique_ptr<int[]> idata(new int[nAlloc]);
             for (int j = 0; j < nAlloc; ++j)
@@ -556,7 +793,13 @@ static void AddParam(ParamSet &ps, const ParamListItem &item,
         } else if (type == PARAM_TYPE_BOOL) {
             // strings -> bools
             int nAlloc = item.size;
-            std::unique_ptr<bool[]> bdata(new bool[nAlloc]);
+            bool inlineData[ParamSetValues<bool>::nInline];
+            std::unique_ptr<bool[]> heapData;
+            bool *bdata = inlineData;
+            if (nAlloc > ParamSetValues<bool>::nInline) {
+                heapData.reset(new bool[nAlloc]);
+                bdata = heapData.get();
+            }
             for (int j = 0; j < nAlloc; ++j) {
                 std::string s(item.stringValues[j]);
                 if (s == "true")
@@ -567,12 +810,22 @@ static void AddParam(ParamSet &ps, const ParamListItem &item,
                     Warning(
                         "Value \"%s\" unknown for Boolean parameter \"%s\"."
                         "Using \"false\".",
-                        s.c_str(), item.name.c_str());
+                        s.c_str(), item.name);
                     bdata[j] = false;
                 }
             }
-            ps.AddBool(name, std::move(bdata), nItems);
+            if (heapData)
+                ps.AddBool(name, std::move(heapData), nItems);
+            else
+                ps.AddBool(name, bdata, nItems);
         } else if (type == PARAM_TYPE_FLOAT) {
+            if (nItems <= ParamSetValues<Float>::nInline) {
+                Float fdata[ParamSetValues<Float>::nInline];
+                for (int i = 0; i < nItems; ++i)
+                    fdata[i] = item.doubleValues[i];
+                ps.AddFloat(name, fdata, nItems);
+                return;
+            }
             std::unique_ptr<Float[]> floats(new Float[nItems]);
             for (int i = 0; i < nItems; ++i) floats[i] = item.doubleValues[i];
             ps.AddFloat(name, std::move(floats), nItems);
@@ -581,7 +834,7 @@ static void AddParam(ParamSet &ps, const ParamListItem &item,
                 Warning(
                     "Excess values given with point2 parameter \"%s\". "
                     "Ignoring last one of them.",
-                    item.name.c_str());
+                    item.name);
             std::unique_ptr<Point2f[]> pts(new Point2f[nItems / 2]);
             for (int i = 0; i < nItems / 2; ++i) {
                 pts[i].x = item.doubleValues[2 * i];
@@ -593,7 +846,7 @@ static void AddParam(ParamSet &ps, const ParamListItem &item,
                 Warning(
                     "Excess values given with vector2 parameter \"%s\". "
                     "Ignoring last one of them.",
-                    item.name.c_str());
+                    item.name);
             std::unique_ptr<Vector2f[]> vecs(new Vector2f[nItems / 2]);
             for (int i = 0; i < nItems / 2; ++i) {
                 vecs[i].x = item.doubleValues[2 * i];
@@ -605,7 +858,7 @@ static void AddParam(ParamSet &ps, const ParamListItem &item,
                 Warning(
                     "Excess values given with point3 parameter \"%s\". "
                     "Ignoring last %d of them.",
-                    item.name.c_str(), nItems % 3);
+                    item.name, nItems % 3);
             std::unique_ptr<Point3f[]> pts(new Point3f[nItems / 3]);
             for (int i = 0; i < nItems / 3; ++i) {
                 pts[i].x = item.doubleValues[3 * i];
@@ -618,7 +871,7 @@ static void AddParam(ParamSet &ps, const ParamListItem &item,
                 Warning(
                     "Excess values given with vector3 parameter \"%s\". "
                     "Ignoring last %d of them.",
-                    item.name.c_str(), nItems % 3);
+                    item.name, nItems % 3);
             std::unique_ptr<Vector3f[]> vecs(new Vector3f[nItems / 3]);
             for (int j = 0; j < nItems / 3; ++j) {
                 vecs[j].x = item.doubleValues[3 * j];
@@ -631,7 +884,7 @@ static void AddParam(ParamSet &ps, const ParamListItem &item,
                 Warning(
                     "Excess values given with \"normal\" parameter \"%s\". "
                     "Ignoring last %d of them.",
-                    item.name.c_str(), nItems % 3);
+                    item.name, nItems % 3);
             std::unique_ptr<Normal3f[]> normals(new Normal3f[nItems / 3]);
             for (int j = 0; j < nItems / 3; ++j) {
                 normals[j].x = item.doubleValues[3 * j];
@@ -644,7 +897,7 @@ static void AddParam(ParamSet &ps, const ParamListItem &item,
                 Warning(
                     "Excess RGB values given with parameter \"%s\". "
                     "Ignoring last %d of them",
-                    item.name.c_str(), nItems % 3);
+                    item.name, nItems % 3);
                 nItems -= nItems % 3;
             }
             std::unique_ptr<Float[]> floats(new Float[nItems]);
@@ -655,7 +908,7 @@ static void AddParam(ParamSet &ps, const ParamListItem &item,
                 Warning(
                     "Excess XYZ values given with parameter \"%s\". "
                     "Ignoring last %d of them",
-                    item.name.c_str(), nItems % 3);
+                    item.name, nItems % 3);
                 nItems -= nItems % 3;
             }
             std::unique_ptr<Float[]> floats(new Float[nItems]);
@@ -666,7 +919,7 @@ static void AddParam(ParamSet &ps, const ParamListItem &item,
                 Warning(
                     "Excess value given with blackbody parameter \"%s\". "
                     "Ignoring extra one.",
-                    item.name.c_str());
+                    item.name);
                 nItems -= nItems % 2;
             }
             std::unique_ptr<Float[]> floats(new Float[nItems]);
@@ -681,7 +934,7 @@ static void AddParam(ParamSet &ps, const ParamListItem &item,
                         "Non-even number of values given with sampled "
                         "spectrum "
                         "parameter \"%s\". Ignoring extra.",
-                        item.name.c_str());
+                        item.name);
                     nItems -= nItems % 2;
                 }
                 std::unique_ptr<Float[]> floats(new Float[nItems]);
@@ -705,7 +958,7 @@ static void AddParam(ParamSet &ps, const ParamListItem &item,
                     name.c_str());
         }
     } else
-        Warning("Type of parameter \"%s\" is unknown", item.name.c_str());
+        Warning("Type of parameter \"%s\" is unknown", item.name);
 }
 
 template <typename Next, typename Unget>
@@ -722,7 +975,11 @@ ParamSet parseParams(Next nextToken, Unget ungetToken, MemoryArena &arena,
         }
 
         ParamListItem item;
-        item.name = toString(dequoteString(decl));
+        string_view name = dequoteString(decl);
+        char *nameBuf = arena.Alloc<char>(name.size() + 1);
+        memcpy(nameBuf, name.data(), name.size());
+        nameBuf[name.size()] = '\0';
+        item.name = nameBuf;
         size_t nAlloc = 0;
 
         auto addVal = [&](string_view val) {
@@ -780,6 +1037,70 @@ ParamSet parseParams(Next nextToken, Unget ungetToken, MemoryArena &arena,
     return ps;
 }
 
+STAT_COUNTER("Scene/Include files pre-lexed", nPreLexedIncludes);
+
+// Tokenize _filename_ completely, parsing its numbers along the way; runs
+// on worker threads ahead of the serial directive pass. Returns nullptr if
+// the file couldn't be opened (the error surfaces when the serial pass
+// falls back to opening it itself).
+static std::unique_ptr<PreLexedFile> preLexFile(const std::string &filename) {
+    auto tokError = [](const char *msg) { Error("%s", msg); };
+    std::unique_ptr<PreLexedFile> file(new PreLexedFile);
+    file->tokenizer = Tokenizer::CreateFromFile(filename, tokError);
+    if (!file->tokenizer) return nullptr;
+    auto looksLikeNumber = [](string_view tok) {
+        return tok[0] == '+' || tok[0] == '-' || tok[0] == '.' ||
+               (tok[0] >= '0' && tok[0] <= '9');
+    };
+    while (true) {
+        string_view tok = file->tokenizer->Next();
+        if (tok.empty()) break;
+        if (tok[0] == '#') continue;
+        PreLexedFile::Token t;
+        t.isNumber = false;
+        if (tok.size() == 1 && tok[0] == binNumberMarker) {
+            // Pre-lexing a binary (.pbb) include; the number is already
+            // decoded.
+            t.isNumber = true;
+            t.number = binTokenNumber;
+        } else if (looksLikeNumber(tok)) {
+            t.isNumber = true;
+            t.number = parseNumber(tok);
+        } else if (tok[0] == '"') {
+            // Quoted strings may point into the tokenizer's transient
+            // escape buffer; keep a stable copy.
+            file->strings.push_back(toString(tok));
+            t.ptr = file->strings.back().data();
+            t.len = file->strings.back().size();
+        } else {
+            t.ptr = tok.data();
+            t.len = tok.size();
+        }
+        file->tokens.push_back(t);
+    }
+    ++nPreLexedIncludes;
+    return file;
+}
+
+// Scan the (copied) remaining input of the current file for Include
+// directives, without applying anything; only a directive-position token
+// can be a bare Include, so matching the token is sufficient.
+static std::vector<std::string> findIncludeFilenames(string_view remaining) {
+    std::vector<std::string> filenames;
+    auto ignoreError = [](const char *) {};
+    std::unique_ptr<Tokenizer> t = Tokenizer::CreateFromString(
+        std::string(remaining.data(), remaining.size()), ignoreError);
+    bool wasInclude = false;
+    while (true) {
+        string_view tok = t->Next();
+        if (tok.empty()) break;
+        if (wasInclude && isQuotedString(tok))
+            filenames.push_back(toString(dequoteString(tok)));
+        wasInclude = (tok == "Include");
+    }
+    return filenames;
+}
+
 extern int catIndentCount;
 
 // Parsing Global Interface
@@ -834,7 +1155,15 @@ static void parse(std::unique_ptr<Tokenizer> t) {
         ungetTokenSet = true;
     };
 
-    MemoryArena arena;
+    // Per-directive parameter storage; reset after each directive. Small
+    // blocks suffice for typical directives, and the rare huge parameter
+    // arrays (mesh vertex data) get their own exact-size blocks anyway.
+    MemoryArena arena(SmallArenaBlockSize);
+
+    // Include files pre-lexed by worker threads, keyed by resolved
+    // filename; filled once, when the first Include directive is seen.
+    std::map<std::string, std::unique_ptr<PreLexedFile>> preLexedIncludes;
+    bool preLexScanDone = false;
 
     // Helper function for pbrt API entrypoints that take a single string
     // parameter and a ParamSet (e.g. pbrtShape()).
@@ -923,9 +1252,45 @@ static void parse(std::unique_ptr<Tokenizer> t) {
                     printf("%*sInclude \"%s\"\n", catIndentCount, "", filename.c_str());
                 else {
                     filename = AbsolutePath(ResolveFilename(filename));
-                    auto tokError = [](const char *msg) { Error("%s", msg); };
-                    std::unique_ptr<Tokenizer> tinc =
-                        Tokenizer::CreateFromFile(filename, tokError);
+                    // The first time an Include is seen, scan the rest of
+                    // the current file for the other Include directives and
+                    // pre-lex all of those files on worker threads; the
+                    // directives themselves are still applied serially, in
+                    // order, as each file's turn comes.
+                    if (!preLexScanDone) {
+                        preLexScanDone = true;
+                        if (!fileStack.back()->IsBinary()) {
+                            std::vector<std::string> filenames;
+                            filenames.push_back(filename);
+                            for (const std::string &fn : findIncludeFilenames(
+                                     fileStack.back()->RemainingInput()))
+                                filenames.push_back(
+                                    AbsolutePath(ResolveFilename(fn)));
+                            std::vector<std::unique_ptr<PreLexedFile>>
+                                preLexed(filenames.size());
+                            ParallelFor(
+                                [&](int64_t i) {
+                                    preLexed[i] = preLexFile(filenames[i]);
+                                },
+                                filenames.size());
+                            for (size_t i = 0; i < filenames.size(); ++i)
+                                if (preLexed[i])
+                                    preLexedIncludes[filenames[i]] =
+                                        std::move(preLexed[i]);
+                        }
+                    }
+                    std::unique_ptr<Tokenizer> tinc;
+                    auto iter = preLexedIncludes.find(filename);
+                    if (iter != preLexedIncludes.end() && iter->second) {
+                        tinc = Tokenizer::CreateFromPreLexed(
+                            std::move(iter->second), filename);
+                        preLexedIncludes.erase(iter);
+                    } else {
+                        auto tokError = [](const char *msg) {
+                            Error("%s", msg);
+                        };
+                        tinc = Tokenizer::CreateFromFile(filename, tokError);
+                    }
                     if (tinc) {
                         fileStack.push_back(std::move(tinc));
                         parserLoc = &fileStack.back()->loc;
@@ -1091,13 +1456,81 @@ static void parse(std::unique_ptr<Tokenizer> t) {
     }
 }
 
+// Transcode the token stream from _t_ (inlining Include directives and
+// dropping comments) into the binary scene format at _outFilename_.
+static void convertToBinary(std::unique_ptr<Tokenizer> t,
+                            const std::string &outFilename) {
+    FILE *f = fopen(outFilename.c_str(), "wb");
+    if (!f) {
+        Error("%s: %s", outFilename.c_str(), strerror(errno));
+        return;
+    }
+    fwrite(binMagic, sizeof(binMagic), 1, f);
+    fwrite(&binVersion, sizeof(binVersion), 1, f);
+
+    // Directives and parameter declarations never start with a character
+    // that can begin a number, so the first character classifies the token.
+    auto looksLikeNumber = [](string_view tok) {
+        return tok[0] == '+' || tok[0] == '-' || tok[0] == '.' ||
+               (tok[0] >= '0' && tok[0] <= '9');
+    };
+
+    std::vector<std::unique_ptr<Tokenizer>> fileStack;
+    fileStack.push_back(std::move(t));
+    while (!fileStack.empty()) {
+        string_view tok = fileStack.back()->Next();
+        if (tok.empty()) {
+            fileStack.pop_back();
+        } else if (tok[0] == '#') {
+            // Comments aren't preserved in the binary format.
+        } else if (tok == "Include") {
+            string_view fn = fileStack.back()->Next();
+            std::string filename = toString(dequoteString(fn));
+            filename = AbsolutePath(ResolveFilename(filename));
+            auto tokError = [](const char *msg) { Error("%s", msg); };
+            std::unique_ptr<Tokenizer> tinc =
+                Tokenizer::CreateFromFile(filename, tokError);
+            if (tinc) fileStack.push_back(std::move(tinc));
+        } else if (tok.size() == 1 && tok[0] == binNumberMarker) {
+            // Already-binary input (e.g. an Include of a .pbb file).
+            fputc('N', f);
+            fwrite(&binTokenNumber, sizeof(double), 1, f);
+        } else if (looksLikeNumber(tok)) {
+            double d = parseNumber(tok);
+            fputc('N', f);
+            fwrite(&d, sizeof(double), 1, f);
+        } else {
+            uint32_t len = tok.size();
+            fputc('S', f);
+            fwrite(&len, sizeof(len), 1, f);
+            fwrite(tok.data(), 1, len, f);
+        }
+    }
+    if (fclose(f) != 0)
+        Error("%s: %s", outFilename.c_str(), strerror(errno));
+}
+
 void pbrtParseFile(std::string filename) {
+    ProgressSetPhase("parse");
     if (filename != "-") SetSearchDirectory(DirectoryContaining(filename));
+    {
+        std::lock_guard<std::mutex> lock(parsedFilenamesMutex);
+        parsedFilenames.clear();
+    }
 
     auto tokError = [](const char *msg) { Error("%s", msg); exit(1); };
     std::unique_ptr<Tokenizer> t =
         Tokenizer::CreateFromFile(filename, tokError);
     if (!t) return;
+    if (PbrtOptions.toBinary) {
+        // Replace the extension (if any) with ".pbb" next to the input.
+        std::string outFilename = filename;
+        size_t dot = outFilename.find_last_of('.');
+        if (dot != std::string::npos) outFilename.resize(dot);
+        outFilename += ".pbb";
+        convertToBinary(std::move(t), outFilename);
+        return;
+    }
     parse(std::move(t));
 }
 
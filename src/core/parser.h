@@ -60,6 +60,11 @@ struct Loc {
 // If not nullptr, stores the current file location of the parser.
 extern Loc *parserLoc;
 
+// Returns the absolute paths of the scene files read by the most recent
+// pbrtParseFile() call (the given file plus any Includes); used by session
+// mode to watch the scene for edits.
+std::vector<std::string> GetParsedFilenames();
+
 // Reimplement enough of absl/std::string_view as needed for the below
 // (Bringing on the abseil dependency at this point just for this seems
 // excessive.)
@@ -99,6 +104,11 @@ class string_view {
     size_t length;
 };
 
+// A pre-lexed include file: the complete token stream of one file,
+// tokenized -- and its numbers parsed -- on a worker thread ahead of the
+// serial directive pass. See the include handling in parser.cpp.
+struct PreLexedFile;
+
 // Tokenizer converts a single pbrt scene file into a series of tokens.
 class Tokenizer {
   public:
@@ -107,6 +117,8 @@ class Tokenizer {
         std::function<void(const char *)> errorCallback);
     static std::unique_ptr<Tokenizer> CreateFromString(
         std::string str, std::function<void(const char *)> errorCallback);
+    static std::unique_ptr<Tokenizer> CreateFromPreLexed(
+        std::unique_ptr<PreLexedFile> preLexed, const std::string &filename);
 
     ~Tokenizer();
 
@@ -114,15 +126,29 @@ class Tokenizer {
     // string_view is not guaranteed to be valid after next call to Next().
     string_view Next();
 
+    // Remaining (unconsumed) input; used by the include pre-lexing pass to
+    // scan ahead for further Include directives.
+    string_view RemainingInput() const { return {pos, size_t(end - pos)}; }
+    bool IsBinary() const { return binary; }
+
     Loc loc;
 
   private:
     Tokenizer(std::string str, std::function<void(const char *)> errorCallback);
+    Tokenizer(std::unique_ptr<PreLexedFile> preLexed,
+              const std::string &filename);
 #if defined(PBRT_HAVE_MMAP) || defined(PBRT_IS_WINDOWS)
     Tokenizer(void *ptr, size_t len, std::string filename,
               std::function<void(const char *)> errorCallback);
 #endif
 
+    // Binary scene (.pbb) support: CheckBinaryHeader() is called by the
+    // constructors and switches the tokenizer into binary mode if the input
+    // starts with the .pbb magic; NextBinary() then decodes the next token
+    // record in place of the lexer.
+    void CheckBinaryHeader();
+    string_view NextBinary();
+
     int getChar() {
         if (pos == end) return EOF;
         int ch = *pos++;
@@ -168,6 +194,15 @@ class Tokenizer {
     // thence, string_views from previous calls to Next() must be invalid
     // after a subsequent call, since we may reuse sEscaped.)
     std::string sEscaped;
+
+    // True if the input is a binary scene (.pbb) file; see parser.cpp.
+    bool binary = false;
+
+    // If this file was pre-lexed on a worker thread, Next() consumes the
+    // tokens from _preLexed_ (via NextPreLexed()) instead of lexing.
+    std::unique_ptr<PreLexedFile> preLexed;
+    size_t preLexedPos = 0;
+    string_view NextPreLexed();
 };
 
 }  // namespace pbrt
@@ -154,6 +154,7 @@ class VisibilityTester;
 class AreaLight;
 struct Distribution1D;
 class Distribution2D;
+class Hierarchical2DWarp;
 #ifdef PBRT_FLOAT_AS_DOUBLE
   typedef double Float;
 #else
@@ -162,7 +163,10 @@ class Distribution2D;
 class RNG;
 class ProgressReporter;
 class MemoryArena;
-template <typename T, int logBlockSize = 2>
+// Default the 2D tile edge so a block spans roughly four cache lines
+// regardless of the element type: 8x8 for small (<= 4 byte) texels, 4x4 for
+// larger ones such as RGBSpectrum.
+template <typename T, int logBlockSize = (sizeof(T) <= 4 ? 3 : 2)>
 class BlockedArray;
 struct Matrix4x4;
 class ParamSet;
@@ -177,8 +181,82 @@ struct Options {
     }
     int nThreads = 0;
     bool quickRender = false;
+    // Restore the film and completed-tile set from a checkpoint file left
+    // by an earlier, interrupted run of the same scene.
+    bool resume = false;
+    // Seconds between render checkpoints; zero disables checkpointing.
+    int checkpointSeconds = 300;
+    // Distributed rendering: port this process should coordinate on, and
+    // the host:port of the coordinator a worker process should serve.
+    int distCoordinatorPort = 0;
+    std::string distWorkerAddress;
+    // Seconds between progressive preview image writes; zero disables the
+    // preview thread.
+    int previewSeconds = 0;
+    // host:port of a tev-style display server to stream the in-progress
+    // image to; empty disables the display thread.
+    std::string displayServer;
+    // File to periodically (re)write with one JSON object describing the
+    // current run phase, fraction complete, and ETA, for farm schedulers
+    // to poll; empty disables it.
+    std::string progressFile;
+    // Memory budget in megabytes; when registered subsystem usage nears
+    // this limit, spillable memory is released. Zero disables the budget.
+    int memoryBudgetMB = 0;
+    // Size in megabytes of the tiled texture cache; when nonzero, large
+    // MIP map levels are spilled to disk and paged back in per tile on
+    // demand instead of staying resident for the whole render.
+    int texCacheMB = 0;
+    // Render in doubling sample-count waves over the whole film, writing
+    // the accumulated image after every wave.
+    bool progressive = false;
+    // Record which MIP levels and tiles of each image texture are
+    // actually sampled and print a per-texture report after rendering.
+    bool texAccessReport = false;
+    // Base filename for structured profiler output; when nonempty, the
+    // render additionally writes <name>.trace.json (a per-thread timeline
+    // in Chrome trace_event format) and <name>.folded.txt (collapsed
+    // stacks for flamegraph tools).
+    std::string profileOutFile;
+    // Accumulate the cycles each pixel's Li() calls cost during rendering
+    // and write a normalized false-color "_cost" image next to the beauty
+    // image, so slow regions of the frame can be located visually.
+    bool costHeatmap = false;
+    // Sample hardware performance counters (cycles, instructions, cache
+    // and branch misses) per render phase via perf_event_open and include
+    // them in the statistics output. Linux only.
+    bool perfCounters = false;
+    // Run BVH traversal and wavefront shading on the GPU, with the CPU
+    // keeping parsing, sampling, and film duties. Requires a CUDA-enabled
+    // build (PBRT_HAVE_CUDA); other builds warn and clear the flag at
+    // pbrtInit() so the render proceeds on the CPU.
+    bool useGPU = false;
+    // With useGPU, also run the CPU intersection path and compare the
+    // device's results against it, reporting any mismatches.
+    bool gpuValidate = false;
+    // Render as a fixed deterministic benchmark workload (pinned sample
+    // count and default thread count), report phase-separated wall times
+    // as JSON, and optionally compare them against a stored baseline.
+    bool benchmark = false;
+    std::string benchmarkOutFile;
+    std::string benchmarkBaseline;
+    // Strict deterministic rendering: sampler seeds derive from tile
+    // identity, film tiles merge in tile-index order, and splats are
+    // accumulated in a canonical order, so the final image is
+    // bit-identical at any thread count.
+    bool deterministic = false;
+    // Scene partitioning preprocess for render-farm cache residency:
+    // split the image into a partitionGridX by partitionGridY grid of
+    // screen regions and, instead of rendering, write one manifest per
+    // region (named <partitionManifest>_rX_Y.txt) listing the region's
+    // crop window and the geometry and texture files whose bounds can
+    // affect it, so each farm node only loads a fraction of the scene.
+    // An empty partitionManifest disables the mode.
+    std::string partitionManifest;
+    int partitionGridX = 1, partitionGridY = 1;
     bool quiet = false;
-    bool cat = false, toPly = false;
+    bool cat = false, toPly = false, toBinary = false;
+    bool sessionMode = false;
     std::string imageFile;
     // x0, x1, y0, y1
     Float cropWindow[2][2];
@@ -36,6 +36,9 @@
 #include "light.h"
 #include "interaction.h"
 #include "stats.h"
+#include <map>
+#include <mutex>
+#include <tuple>
 
 namespace pbrt {
 
@@ -43,6 +46,38 @@ STAT_MEMORY_COUNTER("Memory/Primitives", primitiveMemory);
 
 // Primitive Method Definitions
 Primitive::~Primitive() {}
+
+void Primitive::IntersectN(const RaySpan &rays, SurfaceInteraction *isects,
+                           bool *hits) const {
+    for (int i = 0; i < rays.n; ++i) hits[i] = Intersect(rays[i], &isects[i]);
+}
+
+void Primitive::IntersectPN(const RaySpan &rays, bool *hits) const {
+    for (int i = 0; i < rays.n; ++i) hits[i] = IntersectP(rays[i]);
+}
+
+bool Primitive::IntersectCompact(const Ray &r, CompactHit *hit) const {
+    // Fallback for primitives without a native compact path: run the full
+    // intersection and discard the interaction; ComputeInteraction()
+    // recovers it by re-intersecting this primitive.
+    SurfaceInteraction isect;
+    if (!Intersect(r, &isect)) return false;
+    hit->primitive = this;
+    hit->t = r.tMax;
+    hit->hitCoord = Point2f(0, 0);
+    return true;
+}
+
+void Primitive::ComputeInteraction(const Ray &r, const CompactHit &hit,
+                                   SurfaceInteraction *isect) const {
+    // Re-intersect with an open-ended ray; the nearest hit is the one
+    // IntersectCompact() recorded.
+    Ray ray = r;
+    ray.tMax = Infinity;
+    if (!Intersect(ray, isect))
+        LOG(FATAL) << "Primitive::ComputeInteraction() failed to recover a "
+                      "previously found intersection";
+}
 const AreaLight *Aggregate::GetAreaLight() const {
     LOG(FATAL) <<
         "Aggregate::GetAreaLight() method"
@@ -67,17 +102,28 @@ void Aggregate::ComputeScatteringFunctions(SurfaceInteraction *isect,
 }
 
 // TransformedPrimitive Method Definitions
+STAT_COUNTER("Scene/Compact rigid instance transforms", nCompactTransforms);
+
 TransformedPrimitive::TransformedPrimitive(std::shared_ptr<Primitive> &primitive,
                                            const AnimatedTransform &PrimitiveToWorld)
-    : primitive(primitive), PrimitiveToWorld(PrimitiveToWorld) {
-    primitiveMemory += sizeof(*this);
+    : primitive(primitive) {
+    // Keep only the compact encoding when the transform is static and
+    // rigid; otherwise store the full AnimatedTransform.
+    if (PrimitiveToWorld.IsAnimated() ||
+        !CompactRigidTransform::FromTransform(PrimitiveToWorld.StartTransform(),
+                                              &rigidPrimitiveToWorld))
+        animatedPrimitiveToWorld.reset(new AnimatedTransform(PrimitiveToWorld));
+    else
+        ++nCompactTransforms;
+    primitiveMemory += sizeof(*this) +
+                       (animatedPrimitiveToWorld ? sizeof(AnimatedTransform) : 0);
 }
 
 bool TransformedPrimitive::Intersect(const Ray &r,
                                      SurfaceInteraction *isect) const {
     // Compute _ray_ after transformation by _PrimitiveToWorld_
     Transform InterpolatedPrimToWorld;
-    PrimitiveToWorld.Interpolate(r.time, &InterpolatedPrimToWorld);
+    InterpolateTransform(r.time, &InterpolatedPrimToWorld);
     Ray ray = Inverse(InterpolatedPrimToWorld)(r);
     if (!primitive->Intersect(ray, isect)) return false;
     r.tMax = ray.tMax;
@@ -90,20 +136,42 @@ bool TransformedPrimitive::Intersect(const Ray &r,
 
 bool TransformedPrimitive::IntersectP(const Ray &r) const {
     Transform InterpolatedPrimToWorld;
-    PrimitiveToWorld.Interpolate(r.time, &InterpolatedPrimToWorld);
+    InterpolateTransform(r.time, &InterpolatedPrimToWorld);
     Transform InterpolatedWorldToPrim = Inverse(InterpolatedPrimToWorld);
     return primitive->IntersectP(InterpolatedWorldToPrim(r));
 }
 
+// PrimitiveAttributes Method Definitions
+std::vector<PrimitiveAttributes> primitiveAttributesTable;
+
+uint32_t DedupPrimitiveAttributes(const std::shared_ptr<Material> &material,
+                                  const std::shared_ptr<AreaLight> &areaLight,
+                                  const MediumInterface &mediumInterface) {
+    using AttributeKey = std::tuple<const Material *, const AreaLight *,
+                                    const Medium *, const Medium *>;
+    static std::map<AttributeKey, uint32_t> attributeIndices;
+    static std::mutex attributeMutex;
+    AttributeKey key(material.get(), areaLight.get(), mediumInterface.inside,
+                     mediumInterface.outside);
+    std::lock_guard<std::mutex> lock(attributeMutex);
+    auto iter = attributeIndices.find(key);
+    if (iter != attributeIndices.end()) return iter->second;
+    primitiveAttributesTable.push_back(
+        PrimitiveAttributes{material, areaLight, mediumInterface});
+    primitiveMemory += sizeof(PrimitiveAttributes);
+    uint32_t index = (uint32_t)(primitiveAttributesTable.size() - 1);
+    attributeIndices[key] = index;
+    return index;
+}
+
 // GeometricPrimitive Method Definitions
 GeometricPrimitive::GeometricPrimitive(const std::shared_ptr<Shape> &shape,
                                        const std::shared_ptr<Material> &material,
                                        const std::shared_ptr<AreaLight> &areaLight,
                                        const MediumInterface &mediumInterface)
     : shape(shape),
-    material(material),
-    areaLight(areaLight),
-    mediumInterface(mediumInterface) {
+    attributesIndex(
+        DedupPrimitiveAttributes(material, areaLight, mediumInterface)) {
     primitiveMemory += sizeof(*this);
 }
 
@@ -122,25 +190,57 @@ bool GeometricPrimitive::Intersect(const Ray &r,
     CHECK_GE(Dot(isect->n, isect->shading.n), 0.);
     // Initialize _SurfaceInteraction::mediumInterface_ after _Shape_
     // intersection
-    if (mediumInterface.IsMediumTransition())
-        isect->mediumInterface = mediumInterface;
+    const MediumInterface &mi =
+        GetPrimitiveAttributes(attributesIndex).mediumInterface;
+    if (mi.IsMediumTransition())
+        isect->mediumInterface = mi;
     else
         isect->mediumInterface = MediumInterface(r.medium);
     return true;
 }
 
+bool GeometricPrimitive::IntersectCompact(const Ray &r,
+                                          CompactHit *hit) const {
+    Float tHit;
+    Point2f hitCoord;
+    if (!shape->IntersectCompact(r, &tHit, &hitCoord)) return false;
+    r.tMax = tHit;
+    hit->primitive = this;
+    hit->t = tHit;
+    hit->hitCoord = hitCoord;
+    return true;
+}
+
+void GeometricPrimitive::ComputeInteraction(const Ray &r,
+                                            const CompactHit &hit,
+                                            SurfaceInteraction *isect) const {
+    shape->ComputeInteraction(r, hit.t, hit.hitCoord, isect);
+    isect->primitive = this;
+    CHECK_GE(Dot(isect->n, isect->shading.n), 0.);
+    // Initialize _SurfaceInteraction::mediumInterface_ after _Shape_
+    // intersection
+    const MediumInterface &mi =
+        GetPrimitiveAttributes(attributesIndex).mediumInterface;
+    if (mi.IsMediumTransition())
+        isect->mediumInterface = mi;
+    else
+        isect->mediumInterface = MediumInterface(r.medium);
+}
+
 const AreaLight *GeometricPrimitive::GetAreaLight() const {
-    return areaLight.get();
+    return GetPrimitiveAttributes(attributesIndex).areaLight.get();
 }
 
 const Material *GeometricPrimitive::GetMaterial() const {
-    return material.get();
+    return GetPrimitiveAttributes(attributesIndex).material.get();
 }
 
 void GeometricPrimitive::ComputeScatteringFunctions(
     SurfaceInteraction *isect, MemoryArena &arena, TransportMode mode,
     bool allowMultipleLobes) const {
     ProfilePhase p(Prof::ComputeScatteringFuncs);
+    const Material *material =
+        GetPrimitiveAttributes(attributesIndex).material.get();
     if (material)
         material->ComputeScatteringFunctions(isect, arena, mode,
                                              allowMultipleLobes);
@@ -44,19 +44,86 @@
 #include "material.h"
 #include "medium.h"
 #include "transform.h"
+#include <functional>
 
 namespace pbrt {
 
+// RaySpan Declarations
+// RaySpan is a non-owning view of a contiguous batch of rays; batched
+// traversal updates the rays' _tMax_ values in place, exactly as the
+// single-ray interface does.
+struct RaySpan {
+    RaySpan(Ray *rays, int n) : rays(rays), n(n) {}
+    Ray &operator[](int i) const { return rays[i]; }
+    Ray *rays;
+    int n;
+};
+
+// CompactHit Declarations
+// CompactHit records an intersection as just the primitive, the hit
+// distance, and the shape's parametric hit coordinates (barycentrics for
+// triangles). Batched pipelines stream these ~32-byte records through the
+// intersection stage instead of full SurfaceInteractions and reconstruct
+// the interaction with Primitive::ComputeInteraction() only for the hits
+// that survive to shading.
+struct CompactHit {
+    const Primitive *primitive = nullptr;
+    Float t = 0;
+    Point2f hitCoord;
+};
+
 // Primitive Declarations
 class Primitive {
   public:
     // Primitive Interface
     virtual ~Primitive();
     virtual Bounds3f WorldBound() const = 0;
+    // Bounds at a single time inside the shutter interval. The default
+    // returns the full-interval WorldBound(); primitives with time-varying
+    // bounds override this so accelerators can store tighter per-time
+    // bounds for motion blur.
+    virtual Bounds3f WorldBoundAtTime(Float time) const {
+        return WorldBound();
+    }
     virtual bool Intersect(const Ray &r, SurfaceInteraction *) const = 0;
     virtual bool IntersectP(const Ray &r) const = 0;
+    // Compact intersection interface; see CompactHit. The defaults fall
+    // back to the full intersection, recording the hit against this
+    // primitive and reconstructing by re-intersecting it, so instanced and
+    // non-triangle primitives stay correct without a native compact path.
+    virtual bool IntersectCompact(const Ray &r, CompactHit *hit) const;
+    virtual void ComputeInteraction(const Ray &r, const CompactHit &hit,
+                                    SurfaceInteraction *isect) const;
+    // Batched intersection; the default implementations loop over the span
+    // with the single-ray methods, but aggregates may override them with
+    // traversal that amortizes work across coherent rays. _hits[i]_ records
+    // whether _rays[i]_ hit anything; _isects_ is indexed in step with the
+    // span.
+    virtual void IntersectN(const RaySpan &rays, SurfaceInteraction *isects,
+                            bool *hits) const;
+    virtual void IntersectPN(const RaySpan &rays, bool *hits) const;
+    // Returns true when IntersectPN() amortizes work across the batch
+    // (forwarded from Shape::HasBatchedIntersectP()); batched traversal
+    // only gathers leaf rays into spans for primitives that report it.
+    virtual bool HasBatchedIntersectP() const { return false; }
+    // Forwarded from Shape::GetTriangleVertices() for primitives that wrap
+    // a shape directly; accelerators use it to pre-gather leaf triangles
+    // into SoA bundles for SIMD intersection tests.
+    virtual bool GetTriangleVertices(Point3f p[3]) const { return false; }
     virtual const AreaLight *GetAreaLight() const = 0;
     virtual const Material *GetMaterial() const = 0;
+    // Invokes _callback_ for every non-aggregate primitive below this one;
+    // aggregates override this to recurse into their children. Used to
+    // build per-material acceleration structures after scene construction.
+    virtual void ForEachPrimitive(
+        const std::function<void(const Primitive &)> &callback) const {
+        callback(*this);
+    }
+    // Returns the (world-space) shape a primitive directly wraps so that
+    // callers can sample its surface; returns nullptr for primitives that
+    // don't wrap a shape, including TransformedPrimitive, whose shape
+    // isn't in world space.
+    virtual const Shape *GetShape() const { return nullptr; }
     virtual void ComputeScatteringFunctions(SurfaceInteraction *isect,
                                             MemoryArena &arena,
                                             TransportMode mode,
@@ -64,28 +131,75 @@ class Primitive {
 };
 
 // GeometricPrimitive Declarations
+// PrimitiveAttributes Declarations
+// Flyweight for the per-primitive state that is shared by nearly every
+// primitive in a scene: scenes with many millions of primitives use only
+// a handful of distinct material / area light / medium combinations, so
+// GeometricPrimitive stores a 32-bit index into this deduplicated table
+// instead of three shared_ptrs and a MediumInterface of its own. The
+// table is append-only and read-only once parsing finishes, so lookups
+// during rendering need no lock; entries persist across session-mode
+// re-parses (primitives reused from the session cache keep their
+// indices valid).
+struct PrimitiveAttributes {
+    std::shared_ptr<Material> material;
+    std::shared_ptr<AreaLight> areaLight;
+    MediumInterface mediumInterface;
+};
+// Returns the index of the table entry with the given combination,
+// appending one if it hasn't been seen before. Thread-safe.
+uint32_t DedupPrimitiveAttributes(const std::shared_ptr<Material> &material,
+                                  const std::shared_ptr<AreaLight> &areaLight,
+                                  const MediumInterface &mediumInterface);
+extern std::vector<PrimitiveAttributes> primitiveAttributesTable;
+inline const PrimitiveAttributes &GetPrimitiveAttributes(uint32_t index) {
+    return primitiveAttributesTable[index];
+}
+
 class GeometricPrimitive : public Primitive {
   public:
     // GeometricPrimitive Public Methods
     virtual Bounds3f WorldBound() const;
     virtual bool Intersect(const Ray &r, SurfaceInteraction *isect) const;
     virtual bool IntersectP(const Ray &r) const;
+    bool IntersectCompact(const Ray &r, CompactHit *hit) const;
+    void ComputeInteraction(const Ray &r, const CompactHit &hit,
+                            SurfaceInteraction *isect) const;
+    void IntersectPN(const RaySpan &rays, bool *hits) const {
+        shape->IntersectPN(rays.rays, rays.n, hits);
+    }
+    bool HasBatchedIntersectP() const {
+        return shape->HasBatchedIntersectP();
+    }
     GeometricPrimitive(const std::shared_ptr<Shape> &shape,
                        const std::shared_ptr<Material> &material,
                        const std::shared_ptr<AreaLight> &areaLight,
                        const MediumInterface &mediumInterface);
     const AreaLight *GetAreaLight() const;
     const Material *GetMaterial() const;
+    bool GetTriangleVertices(Point3f p[3]) const {
+        return shape->GetTriangleVertices(p);
+    }
+    const Shape *GetShape() const { return shape.get(); }
     void ComputeScatteringFunctions(SurfaceInteraction *isect,
                                     MemoryArena &arena, TransportMode mode,
                                     bool allowMultipleLobes) const;
+    // Session-mode delta reload support: when a primitive (and the
+    // aggregate referencing it) is reused across a scene re-parse, the
+    // freshly parsed material and area light are bound in place. Must only
+    // be called between renders.
+    void SessionRebind(const std::shared_ptr<Material> &m,
+                       const std::shared_ptr<AreaLight> &a) {
+        attributesIndex = DedupPrimitiveAttributes(
+            m, a, GetPrimitiveAttributes(attributesIndex).mediumInterface);
+    }
 
   private:
     // GeometricPrimitive Private Data
     std::shared_ptr<Shape> shape;
-    std::shared_ptr<Material> material;
-    std::shared_ptr<AreaLight> areaLight;
-    MediumInterface mediumInterface;
+    // Index of this primitive's material / area light / medium
+    // combination in the shared attribute table
+    uint32_t attributesIndex;
 };
 
 // TransformedPrimitive Declarations
@@ -106,13 +220,33 @@ class TransformedPrimitive : public Primitive {
             "called";
     }
     Bounds3f WorldBound() const {
-        return PrimitiveToWorld.MotionBounds(primitive->WorldBound());
+        if (animatedPrimitiveToWorld)
+            return animatedPrimitiveToWorld->MotionBounds(
+                primitive->WorldBound());
+        return rigidPrimitiveToWorld.ToTransform()(primitive->WorldBound());
+    }
+    Bounds3f WorldBoundAtTime(Float time) const {
+        Transform interpolated;
+        InterpolateTransform(time, &interpolated);
+        return interpolated(primitive->WorldBound());
     }
 
   private:
+    // TransformedPrimitive Private Methods
+    void InterpolateTransform(Float time, Transform *t) const {
+        if (animatedPrimitiveToWorld)
+            animatedPrimitiveToWorld->Interpolate(time, t);
+        else
+            *t = rigidPrimitiveToWorld.ToTransform();
+    }
+
     // TransformedPrimitive Private Data
     std::shared_ptr<Primitive> primitive;
-    const AnimatedTransform PrimitiveToWorld;
+    // Static rigid instance transforms (the overwhelmingly common case)
+    // are stored only in compact form; the full AnimatedTransform is
+    // kept on the heap when the transform is animated or not rigid.
+    CompactRigidTransform rigidPrimitiveToWorld;
+    std::unique_ptr<AnimatedTransform> animatedPrimitiveToWorld;
 };
 
 // Aggregate Declarations
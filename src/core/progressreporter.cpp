@@ -47,15 +47,66 @@ namespace pbrt {
 
 static int TerminalWidth();
 
+// The current run phase and the active reporter, for the progress file.
+// A single reporter is live at a time (the rendering one); phases
+// without a reporter are written with indeterminate progress.
+static std::mutex progressMutex;
+static std::string progressPhase = "startup";
+static ProgressReporter *activeReporter = nullptr;
+
+// Writes the machine-readable progress file named by --progressfile: one
+// JSON object with the current phase and, when a reporter is live, its
+// fraction complete, elapsed seconds, and ETA. The file is written to a
+// temporary name and renamed so a polling scheduler never reads a
+// partial file.
+void WriteProgressFile() {
+    if (PbrtOptions.progressFile.empty()) return;
+    std::lock_guard<std::mutex> lock(progressMutex);
+    std::string tmpName = PbrtOptions.progressFile + ".tmp";
+    FILE *f = fopen(tmpName.c_str(), "w");
+    if (!f) return;
+    if (activeReporter) {
+        Float seconds = activeReporter->ElapsedMS() / 1000.f;
+        Float percentDone = Float(activeReporter->workDone.load()) /
+                            Float(activeReporter->totalWork);
+        Float estRemaining =
+            activeReporter->EstimatedRemaining(seconds, percentDone);
+        fprintf(f,
+                "{ \"phase\": \"%s\", \"progress\": %.4f, "
+                "\"elapsedSeconds\": %.1f, \"etaSeconds\": %.1f }\n",
+                progressPhase.c_str(), percentDone, seconds,
+                std::isinf(estRemaining) ? -1.f
+                                         : std::max((Float)0., estRemaining));
+    } else
+        fprintf(f, "{ \"phase\": \"%s\", \"progress\": -1 }\n",
+                progressPhase.c_str());
+    fclose(f);
+    rename(tmpName.c_str(), PbrtOptions.progressFile.c_str());
+}
+
+void ProgressSetPhase(const std::string &phase) {
+    {
+        std::lock_guard<std::mutex> lock(progressMutex);
+        progressPhase = phase;
+    }
+    WriteProgressFile();
+}
+
 // ProgressReporter Method Definitions
 ProgressReporter::ProgressReporter(int64_t totalWork, const std::string &title)
     : totalWork(std::max((int64_t)1, totalWork)),
       title(title),
       startTime(std::chrono::system_clock::now()) {
     workDone = 0;
+    workTimeUS = 0;
+    recentCostUS = 0;
     exitThread = false;
+    {
+        std::lock_guard<std::mutex> lock(progressMutex);
+        activeReporter = this;
+    }
     // Launch thread to periodically update progress bar
-    if (!PbrtOptions.quiet) {
+    if (!PbrtOptions.quiet || !PbrtOptions.progressFile.empty()) {
         // We need to temporarily disable the profiler before launching
         // the update thread here, through the time the thread calls
         // ProfilerWorkerThreadInit(). Otherwise, there's a potential
@@ -80,12 +131,36 @@ ProgressReporter::ProgressReporter(int64_t totalWork, const std::string &title)
 }
 
 ProgressReporter::~ProgressReporter() {
-    if (!PbrtOptions.quiet) {
+    if (!PbrtOptions.quiet || !PbrtOptions.progressFile.empty()) {
         workDone = totalWork;
         exitThread = true;
         updateThread.join();
-        printf("\n");
+        if (!PbrtOptions.quiet) printf("\n");
     }
+    WriteProgressFile();
+    std::lock_guard<std::mutex> lock(progressMutex);
+    activeReporter = nullptr;
+}
+
+Float ProgressReporter::EstimatedRemaining(Float elapsedSeconds,
+                                           Float percentDone) const {
+    int64_t done = workDone.load();
+    int64_t doneUS = workTimeUS.load();
+    if (doneUS > 0 && done > 0 && done < totalWork && elapsedSeconds > 0) {
+        // Cost-weighted model: recent per-item cost predicts the
+        // remaining work-seconds; observed throughput (work-seconds
+        // retired per wall second, which accounts for the worker thread
+        // count) converts them to wall time.
+        Float recentCost;
+        {
+            std::lock_guard<std::mutex> lock(timingMutex);
+            recentCost = recentCostUS * 1e-6f;
+        }
+        Float throughput = doneUS * 1e-6f / elapsedSeconds;
+        return (totalWork - done) * recentCost / throughput;
+    }
+    // Without timings, fall back to assuming uniformly costly ticks
+    return elapsedSeconds / percentDone - elapsedSeconds;
 }
 
 void ProgressReporter::PrintBar() {
@@ -103,8 +178,10 @@ void ProgressReporter::PrintBar() {
     *s++ = ']';
     *s++ = ' ';
     *s++ = '\0';
-    fputs(buf.get(), stdout);
-    fflush(stdout);
+    if (!PbrtOptions.quiet) {
+        fputs(buf.get(), stdout);
+        fflush(stdout);
+    }
 
     std::chrono::milliseconds sleepDuration(250);
     int iterCount = 0;
@@ -124,6 +201,9 @@ void ProgressReporter::PrintBar() {
             // After 15m, jump up to 5s intervals
             sleepDuration *= 5;
 
+        WriteProgressFile();
+        if (PbrtOptions.quiet) continue;
+
         Float percentDone = Float(workDone) / Float(totalWork);
         int plussesNeeded = std::round(totalPlusses * percentDone);
         while (plussesPrinted < plussesNeeded) {
@@ -134,7 +214,7 @@ void ProgressReporter::PrintBar() {
 
         // Update elapsed time and estimated time to completion
         Float seconds = ElapsedMS() / 1000.f;
-        Float estRemaining = seconds / percentDone - seconds;
+        Float estRemaining = EstimatedRemaining(seconds, percentDone);
         if (percentDone == 1.f)
             printf(" (%.1fs)       ", seconds);
         else if (!std::isinf(estRemaining))
@@ -42,10 +42,17 @@
 #include "pbrt.h"
 #include <atomic>
 #include <chrono>
+#include <mutex>
 #include <thread>
 
 namespace pbrt {
 
+// Records which phase of the run (parse, build, render, ...) is under
+// way, for the progress bar's label and the machine-readable progress
+// file written when --progressfile is given, which farm schedulers poll
+// to make preemption decisions.
+void ProgressSetPhase(const std::string &phase);
+
 // ProgressReporter Declarations
 class ProgressReporter {
   public:
@@ -53,9 +60,23 @@ class ProgressReporter {
     ProgressReporter(int64_t totalWork, const std::string &title);
     ~ProgressReporter();
     void Update(int64_t num = 1) {
-        if (num == 0 || PbrtOptions.quiet) return;
+        if (num == 0) return;
         workDone += num;
     }
+    // Feeds the measured wall-clock cost of completed work items. Once
+    // timings arrive, the ETA switches from assuming uniform ticks to a
+    // cost-weighted model: a moving average of recent per-item cost
+    // predicts the remaining work-seconds, and the observed throughput
+    // (work-seconds retired per wall second) converts them to wall time,
+    // so expensive late tiles no longer make the estimate collapse.
+    void RecordWorkTime(Float seconds) {
+        workTimeUS += (int64_t)(seconds * 1e6);
+        std::lock_guard<std::mutex> lock(timingMutex);
+        if (recentCostUS == 0)
+            recentCostUS = seconds * 1e6;
+        else
+            recentCostUS += .05f * (seconds * 1e6 - recentCostUS);
+    }
     Float ElapsedMS() const {
         std::chrono::system_clock::time_point now =
             std::chrono::system_clock::now();
@@ -70,12 +91,21 @@ class ProgressReporter {
   private:
     // ProgressReporter Private Methods
     void PrintBar();
+    Float EstimatedRemaining(Float elapsedSeconds, Float percentDone) const;
+
+    friend void WriteProgressFile();
 
     // ProgressReporter Private Data
     const int64_t totalWork;
     const std::string title;
     const std::chrono::system_clock::time_point startTime;
     std::atomic<int64_t> workDone;
+    // Total measured cost of completed work items, in microseconds, and
+    // an exponentially weighted average of recent per-item cost; zero
+    // until RecordWorkTime() is first called.
+    std::atomic<int64_t> workTimeUS;
+    Float recentCostUS;
+    mutable std::mutex timingMutex;
     std::atomic<bool> exitThread;
     std::thread updateThread;
 };
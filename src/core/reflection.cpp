@@ -237,6 +237,42 @@ Spectrum MicrofacetReflection::f(const Vector3f &wo, const Vector3f &wi) const {
            (4 * cosThetaI * cosThetaO);
 }
 
+void MicrofacetReflection::f_N(const Vector3f &wo, const Vector3f *wi, int n,
+                               Spectrum *out) const {
+    // The per-direction D and G evaluations go through the
+    // distribution's batch entry points, which share the terms that
+    // only depend on _wo_ across all of the directions.
+    Float cosThetaO = AbsCosTheta(wo);
+    for (int i = 0; i < n; i += 8) {
+        int m = std::min(8, n - i);
+        Vector3f wh[8];
+        Float Dv[8], Gv[8];
+        bool degenerate[8];
+        for (int j = 0; j < m; ++j) {
+            Vector3f whUnnorm = wi[i + j] + wo;
+            degenerate[j] =
+                cosThetaO == 0 || AbsCosTheta(wi[i + j]) == 0 ||
+                (whUnnorm.x == 0 && whUnnorm.y == 0 && whUnnorm.z == 0);
+            wh[j] = degenerate[j] ? Vector3f(0, 0, 1) : Normalize(whUnnorm);
+        }
+        distribution->D_N(wh, m, Dv);
+        distribution->G_N(wo, wi + i, m, Gv);
+        for (int j = 0; j < m; ++j) {
+            if (degenerate[j]) {
+                out[i + j] = Spectrum(0.f);
+                continue;
+            }
+            // For the Fresnel call, make sure that wh is in the same
+            // hemisphere as the surface normal, so that TIR is handled
+            // correctly.
+            Spectrum F = fresnel->Evaluate(
+                Dot(wi[i + j], Faceforward(wh[j], Vector3f(0, 0, 1))));
+            out[i + j] = R * Dv[j] * Gv[j] * F /
+                         (4 * AbsCosTheta(wi[i + j]) * cosThetaO);
+        }
+    }
+}
+
 std::string MicrofacetReflection::ToString() const {
     return std::string("[ MicrofacetReflection R: ") + R.ToString() +
            std::string(" distribution: ") + distribution->ToString() +
@@ -377,7 +413,14 @@ std::string FourierBSDF::ToString() const {
 
 bool FourierBSDFTable::GetWeightsAndOffset(Float cosTheta, int *offset,
                                            Float weights[4]) const {
-    return CatmullRomWeights(nMu, mu, cosTheta, offset, weights);
+    // Remember the interval found by this thread's previous lookup;
+    // successive evaluations during shading come from nearly identical
+    // zenith angles, so the hint usually skips the binary search over
+    // the mu grid.  (Bounds are revalidated against this table, so a
+    // hint left by a different table is at worst ignored.)
+    static PBRT_THREAD_LOCAL int intervalHint = -1;
+    return CatmullRomWeights(nMu, mu, cosTheta, offset, weights,
+                             &intervalHint);
 }
 
 Spectrum BxDF::Sample_f(const Vector3f &wo, Vector3f *wi, const Point2f &u,
@@ -692,6 +735,32 @@ Spectrum BSDF::f(const Vector3f &woW, const Vector3f &wiW,
     return f;
 }
 
+void BSDF::f_N(const Vector3f &woW, const Vector3f *wiW, int n, Spectrum *out,
+               BxDFType flags) const {
+    ProfilePhase pp(Prof::BSDFEvaluation);
+    Vector3f wo = WorldToLocal(woW);
+    for (int i = 0; i < n; ++i) out[i] = Spectrum(0.f);
+    if (wo.z == 0) return;
+    for (int i = 0; i < n; i += 8) {
+        int m = std::min(8, n - i);
+        Vector3f wi[8];
+        bool reflect[8];
+        Spectrum partial[8];
+        for (int j = 0; j < m; ++j) {
+            wi[j] = WorldToLocal(wiW[i + j]);
+            reflect[j] = Dot(wiW[i + j], ng) * Dot(woW, ng) > 0;
+        }
+        for (int c = 0; c < nBxDFs; ++c) {
+            if (!bxdfs[c]->MatchesFlags(flags)) continue;
+            bxdfs[c]->f_N(wo, wi, m, partial);
+            for (int j = 0; j < m; ++j)
+                if ((reflect[j] && (bxdfs[c]->type & BSDF_REFLECTION)) ||
+                    (!reflect[j] && (bxdfs[c]->type & BSDF_TRANSMISSION)))
+                    out[i + j] += partial[j];
+        }
+    }
+}
+
 Spectrum BSDF::rho(int nSamples, const Point2f *samples1,
                    const Point2f *samples2, BxDFType flags) const {
     Spectrum ret(0.f);
@@ -795,6 +864,32 @@ Float BSDF::Pdf(const Vector3f &woWorld, const Vector3f &wiWorld,
     return v;
 }
 
+void BSDF::Pdf_N(const Vector3f &woW, const Vector3f *wiW, int n, Float *pdf,
+                 BxDFType flags) const {
+    ProfilePhase pp(Prof::BSDFPdf);
+    for (int i = 0; i < n; ++i) pdf[i] = 0.f;
+    if (nBxDFs == 0) return;
+    Vector3f wo = WorldToLocal(woW);
+    if (wo.z == 0) return;
+    int matchingComps = 0;
+    for (int c = 0; c < nBxDFs; ++c)
+        if (bxdfs[c]->MatchesFlags(flags)) ++matchingComps;
+    if (matchingComps == 0) return;
+    for (int i = 0; i < n; i += 8) {
+        int m = std::min(8, n - i);
+        Vector3f wi[8];
+        Float partial[8];
+        for (int j = 0; j < m; ++j) wi[j] = WorldToLocal(wiW[i + j]);
+        for (int c = 0; c < nBxDFs; ++c) {
+            if (!bxdfs[c]->MatchesFlags(flags)) continue;
+            bxdfs[c]->Pdf_N(wo, wi, m, partial);
+            for (int j = 0; j < m; ++j) pdf[i + j] += partial[j];
+        }
+    }
+    if (matchingComps > 1)
+        for (int i = 0; i < n; ++i) pdf[i] /= matchingComps;
+}
+
 std::string BSDF::ToString() const {
     std::string s = StringPrintf("[ BSDF eta: %f nBxDFs: %d", eta, nBxDFs);
     for (int i = 0; i < nBxDFs; ++i)
@@ -185,6 +185,11 @@ class BSDF {
     }
     Spectrum f(const Vector3f &woW, const Vector3f &wiW,
                BxDFType flags = BSDF_ALL) const;
+    // Batch counterpart of f(): evaluates _n_ world-space directions
+    // _wiW_ against a single _woW_ in one call so that microfacet
+    // distribution terms can be computed several lanes at a time.
+    void f_N(const Vector3f &woW, const Vector3f *wiW, int n, Spectrum *out,
+             BxDFType flags = BSDF_ALL) const;
     Spectrum rho(int nSamples, const Point2f *samples1, const Point2f *samples2,
                  BxDFType flags = BSDF_ALL) const;
     Spectrum rho(const Vector3f &wo, int nSamples, const Point2f *samples,
@@ -194,6 +199,11 @@ class BSDF {
                       BxDFType *sampledType = nullptr) const;
     Float Pdf(const Vector3f &wo, const Vector3f &wi,
               BxDFType flags = BSDF_ALL) const;
+    // Batch counterpart of Pdf(): computes the PDFs of _n_ world-space
+    // directions _wiW_ against a single _woW_ in one call, amortizing
+    // the local frame transform and the per-component dispatch.
+    void Pdf_N(const Vector3f &woW, const Vector3f *wiW, int n, Float *pdf,
+               BxDFType flags = BSDF_ALL) const;
     std::string ToString() const;
 
     // BSDF Public Data
@@ -225,6 +235,13 @@ class BxDF {
     BxDF(BxDFType type) : type(type) {}
     bool MatchesFlags(BxDFType t) const { return (type & t) == type; }
     virtual Spectrum f(const Vector3f &wo, const Vector3f &wi) const = 0;
+    // Evaluate the BxDF for _n_ directions _wi_ against a single _wo_.
+    // The default loops over f(); microfacet models override it to
+    // batch their distribution evaluations.
+    virtual void f_N(const Vector3f &wo, const Vector3f *wi, int n,
+                     Spectrum *out) const {
+        for (int i = 0; i < n; ++i) out[i] = f(wo, wi[i]);
+    }
     virtual Spectrum Sample_f(const Vector3f &wo, Vector3f *wi,
                               const Point2f &sample, Float *pdf,
                               BxDFType *sampledType = nullptr) const;
@@ -233,6 +250,11 @@ class BxDF {
     virtual Spectrum rho(int nSamples, const Point2f *samples1,
                          const Point2f *samples2) const;
     virtual Float Pdf(const Vector3f &wo, const Vector3f &wi) const;
+    // Compute the PDFs of _n_ directions _wi_ against a single _wo_.
+    virtual void Pdf_N(const Vector3f &wo, const Vector3f *wi, int n,
+                       Float *pdf) const {
+        for (int i = 0; i < n; ++i) pdf[i] = Pdf(wo, wi[i]);
+    }
     virtual std::string ToString() const = 0;
 
     // BxDF Public Data
@@ -447,6 +469,8 @@ class MicrofacetReflection : public BxDF {
           distribution(distribution),
           fresnel(fresnel) {}
     Spectrum f(const Vector3f &wo, const Vector3f &wi) const;
+    void f_N(const Vector3f &wo, const Vector3f *wi, int n,
+             Spectrum *out) const;
     Spectrum Sample_f(const Vector3f &wo, Vector3f *wi, const Point2f &u,
                       Float *pdf, BxDFType *sampledType) const;
     Float Pdf(const Vector3f &wo, const Vector3f &wi) const;
@@ -125,6 +125,46 @@ class RNG {
     uint64_t state, inc;
 };
 
+// Counter-based random numbers: where RNG draws values from a serially
+// advanced stream, CounterRNG hashes an explicit counter, so any value of
+// a keyed stream can be computed directly with no state at all. Batched
+// and wavefront code can therefore address random numbers by (pixel,
+// sample, dimension) and evaluate samples in any order, on any number of
+// threads, with bitwise identical results.
+class CounterRNG {
+  public:
+    // CounterRNG Public Methods
+    CounterRNG() : key(0) {}
+    explicit CounterRNG(uint64_t key) : key(key) {}
+    uint32_t UniformUInt32(uint64_t counter) const {
+        return (uint32_t)(MixBits(key ^ MixBits(counter)) >> 32);
+    }
+    Float UniformFloat(uint64_t counter) const {
+#ifndef PBRT_HAVE_HEX_FP_CONSTANTS
+        return std::min(
+            OneMinusEpsilon,
+            Float(UniformUInt32(counter) * 2.3283064365386963e-10f));
+#else
+        return std::min(OneMinusEpsilon,
+                        Float(UniformUInt32(counter) * 0x1p-32f));
+#endif
+    }
+
+    // The finalizing mixer from splitmix64: invertible, so distinct
+    // counters never collide before the key is folded in.
+    static uint64_t MixBits(uint64_t v) {
+        v ^= v >> 31;
+        v *= 0x7fb5d329728ea185ULL;
+        v ^= v >> 27;
+        v *= 0x81dadef4bc2dd44dULL;
+        v ^= v >> 33;
+        return v;
+    }
+
+    // CounterRNG Public Data
+    uint64_t key;
+};
+
 // RNG Inline Method Definitions
 inline RNG::RNG() : state(PCG32_DEFAULT_STATE), inc(PCG32_DEFAULT_STREAM) {}
 inline void RNG::SetSequence(uint64_t initseq) {
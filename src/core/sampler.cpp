@@ -97,12 +97,39 @@ const Point2f *Sampler::Get2DArray(int n) {
     return &sampleArray2D[array2DOffset++][currentPixelSampleIndex * n];
 }
 
-PixelSampler::PixelSampler(int64_t samplesPerPixel, int nSampledDimensions)
-    : Sampler(samplesPerPixel) {
+STAT_COUNTER("Sampler/Dimension overflows (uniform fallback)",
+             nUniformFallbackDims);
+STAT_COUNTER("Sampler/Dimension overflows (padded)", nPaddedDims);
+STAT_INT_DISTRIBUTION("Sampler/Overflowing dimension index", overflowDimension);
+
+PixelSampler::PixelSampler(int64_t samplesPerPixel, int nSampledDimensions,
+                           bool padDimensions)
+    : Sampler(samplesPerPixel), padDimensions(padDimensions) {
     for (int i = 0; i < nSampledDimensions; ++i) {
         samples1D.push_back(std::vector<Float>(samplesPerPixel));
         samples2D.push_back(std::vector<Point2f>(samplesPerPixel));
     }
+    samples1DGenerated.assign(nSampledDimensions, 0);
+    samples2DGenerated.assign(nSampledDimensions, 0);
+}
+
+void PixelSampler::StartPixel(const Point2i &p) {
+    // Mark all dimensions ungenerated; they're filled on first use
+    std::fill(samples1DGenerated.begin(), samples1DGenerated.end(), 0);
+    std::fill(samples2DGenerated.begin(), samples2DGenerated.end(), 0);
+    Sampler::StartPixel(p);
+}
+
+// Uniform random fallbacks, matching what Get1D()/Get2D() return for
+// dimensions past _samples1D_/_samples2D_
+void PixelSampler::GenerateDimension1D(int dim) {
+    for (size_t i = 0; i < samples1D[dim].size(); ++i)
+        samples1D[dim][i] = rng.UniformFloat();
+}
+
+void PixelSampler::GenerateDimension2D(int dim) {
+    for (size_t i = 0; i < samples2D[dim].size(); ++i)
+        samples2D[dim][i] = Point2f(rng.UniformFloat(), rng.UniformFloat());
 }
 
 bool PixelSampler::StartNextSample() {
@@ -118,19 +145,50 @@ bool PixelSampler::SetSampleNumber(int64_t sampleNum) {
 Float PixelSampler::Get1D() {
     ProfilePhase _(Prof::GetSample);
     CHECK_LT(currentPixelSampleIndex, samplesPerPixel);
-    if (current1DDimension < samples1D.size())
-        return samples1D[current1DDimension++][currentPixelSampleIndex];
-    else
-        return rng.UniformFloat();
+    if (current1DDimension >= samples1D.size()) {
+        // The precomputed dimensions are exhausted (deep paths reach
+        // here). Record the overflow so it shows up in the statistics;
+        // the dimension index is a proxy for the integrator depth at
+        // which stratification was lost.
+        ReportValue(overflowDimension, current1DDimension);
+        if (!padDimensions) {
+            ++nUniformFallbackDims;
+            return rng.UniformFloat();
+        }
+        // Padded mode: append a fresh dimension and let the sampler's
+        // own GenerateDimension1D() stratify it below. Subsequent pixels
+        // reuse (and regenerate) the appended dimension.
+        ++nPaddedDims;
+        samples1D.push_back(std::vector<Float>(samplesPerPixel));
+        samples1DGenerated.push_back(0);
+    }
+    if (!samples1DGenerated[current1DDimension]) {
+        GenerateDimension1D(current1DDimension);
+        samples1DGenerated[current1DDimension] = 1;
+    }
+    return samples1D[current1DDimension++][currentPixelSampleIndex];
 }
 
 Point2f PixelSampler::Get2D() {
     ProfilePhase _(Prof::GetSample);
     CHECK_LT(currentPixelSampleIndex, samplesPerPixel);
-    if (current2DDimension < samples2D.size())
-        return samples2D[current2DDimension++][currentPixelSampleIndex];
-    else
-        return Point2f(rng.UniformFloat(), rng.UniformFloat());
+    if (current2DDimension >= samples2D.size()) {
+        // See PixelSampler::Get1D() for what happens past the
+        // precomputed dimensions.
+        ReportValue(overflowDimension, current2DDimension);
+        if (!padDimensions) {
+            ++nUniformFallbackDims;
+            return Point2f(rng.UniformFloat(), rng.UniformFloat());
+        }
+        ++nPaddedDims;
+        samples2D.push_back(std::vector<Point2f>(samplesPerPixel));
+        samples2DGenerated.push_back(0);
+    }
+    if (!samples2DGenerated[current2DDimension]) {
+        GenerateDimension2D(current2DDimension);
+        samples2DGenerated[current2DDimension] = 1;
+    }
+    return samples2D[current2DDimension++][currentPixelSampleIndex];
 }
 
 void GlobalSampler::StartPixel(const Point2i &p) {
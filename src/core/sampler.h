@@ -63,6 +63,12 @@ class Sampler {
     const Point2f *Get2DArray(int n);
     virtual bool StartNextSample();
     virtual std::unique_ptr<Sampler> Clone(int seed) = 0;
+    // Return the sampler to the state a fresh Clone(seed) would have, so
+    // that one instance per worker thread can be reused across tiles
+    // without reallocating its sample vectors. The default covers
+    // deterministic samplers, which carry no state across tiles that
+    // StartPixel() doesn't reinitialize.
+    virtual void Reset(int seed) {}
     virtual bool SetSampleNumber(int64_t sampleNum);
     std::string StateString() const {
       return StringPrintf("(%d,%d), sample %" PRId64, currentPixel.x,
@@ -89,17 +95,34 @@ class Sampler {
 class PixelSampler : public Sampler {
   public:
     // PixelSampler Public Methods
-    PixelSampler(int64_t samplesPerPixel, int nSampledDimensions);
+    PixelSampler(int64_t samplesPerPixel, int nSampledDimensions,
+                 bool padDimensions = false);
+    void StartPixel(const Point2i &p);
     bool StartNextSample();
     bool SetSampleNumber(int64_t);
     Float Get1D();
     Point2f Get2D();
+    void Reset(int seed) { rng.SetSequence(seed); }
 
   protected:
+    // PixelSampler Protected Methods
+    // Fill _samples1D[dim]_ (resp. _samples2D[dim]_) with the pixel's
+    // values for one dimension. Called by Get1D()/Get2D() the first time
+    // each dimension is consumed in a pixel, so pixels whose paths all
+    // terminate early never pay for generating the deeper dimensions.
+    virtual void GenerateDimension1D(int dim);
+    virtual void GenerateDimension2D(int dim);
+
     // PixelSampler Protected Data
     std::vector<std::vector<Float>> samples1D;
     std::vector<std::vector<Point2f>> samples2D;
     int current1DDimension = 0, current2DDimension = 0;
+    std::vector<char> samples1DGenerated, samples2DGenerated;
+    // When set, Get1D()/Get2D() grow _samples1D_/_samples2D_ on demand
+    // past _nSampledDimensions_ so that deep paths keep consuming the
+    // sampler's own stratified dimensions instead of silently degrading
+    // to uniform randoms; see PixelSampler::Get1D().
+    const bool padDimensions;
     RNG rng;
 };
 
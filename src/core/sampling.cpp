@@ -34,6 +34,7 @@
 // core/sampling.cpp*
 #include "sampling.h"
 #include "geometry.h"
+#include "parallel.h"
 #include "shape.h"
 
 namespace pbrt {
@@ -156,6 +157,92 @@ Point2f UniformSampleTriangle(const Point2f &u) {
     return Point2f(1 - su0, u[1] * su0);
 }
 
+Distribution1D Distribution1D::BuildParallel(const Float *f, int n) {
+    Distribution1D d;
+    d.func.assign(f, f + n);
+    d.cdf.resize(n + 1);
+    d.cdf[0] = 0;
+
+    // Sum each chunk of the function in parallel, scan the chunk totals
+    // serially, and then fill each chunk's CDF entries in parallel
+    const int chunkSize = 4096;
+    int nChunks = (n + chunkSize - 1) / chunkSize;
+    std::vector<double> chunkStart(nChunks);
+    ParallelFor(
+        [&](int64_t c) {
+            int begin = c * chunkSize, end = std::min(n, (int)(begin + chunkSize));
+            double sum = 0;
+            for (int i = begin; i < end; ++i) sum += d.func[i] / n;
+            chunkStart[c] = sum;
+        },
+        nChunks);
+    double total = 0;
+    for (int c = 0; c < nChunks; ++c) {
+        double sum = chunkStart[c];
+        chunkStart[c] = total;
+        total += sum;
+    }
+    d.funcInt = total;
+    ParallelFor(
+        [&](int64_t c) {
+            int begin = c * chunkSize, end = std::min(n, (int)(begin + chunkSize));
+            if (total == 0) {
+                for (int i = begin; i < end; ++i)
+                    d.cdf[i + 1] = Float(i + 1) / Float(n);
+            } else {
+                double sum = chunkStart[c];
+                for (int i = begin; i < end; ++i) {
+                    sum += d.func[i] / n;
+                    d.cdf[i + 1] = sum / total;
+                }
+            }
+        },
+        nChunks);
+    if (total > 0) d.cdf[n] = 1;
+    if (n >= aliasThreshold) d.aliasTable = AliasTable(&d.func[0], n);
+    return d;
+}
+
+// AliasTable Method Definitions
+AliasTable::AliasTable(const Float *weights, int n) : bins(n) {
+    // Normalize the weights to a pmf; an all-zero input degenerates to
+    // the uniform distribution, matching _Distribution1D_'s handling
+    double sum = 0;
+    for (int i = 0; i < n; ++i) sum += weights[i];
+    for (int i = 0; i < n; ++i)
+        bins[i].pdf = sum > 0 ? Float(weights[i] / sum) : Float(1) / n;
+
+    // Partition the outcomes by whether their column holds less or more
+    // than the average probability mass
+    std::vector<int> small, large;
+    for (int i = 0; i < n; ++i) {
+        bins[i].q = n * bins[i].pdf;
+        bins[i].alias = i;
+        if (bins[i].q < 1)
+            small.push_back(i);
+        else
+            large.push_back(i);
+    }
+
+    // Fill each under-full column with the overflow of an over-full
+    // outcome; the donor may itself drop below average and change lists
+    while (!small.empty() && !large.empty()) {
+        int s = small.back(), l = large.back();
+        small.pop_back();
+        bins[s].alias = l;
+        bins[l].q -= 1 - bins[s].q;
+        if (bins[l].q < 1) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+
+    // Outcomes left on either list hold exactly average mass up to
+    // floating-point round-off; their columns are entirely their own
+    for (int i : small) bins[i].q = 1;
+    for (int i : large) bins[i].q = 1;
+}
+
 Distribution2D::Distribution2D(const Float *func, int nu, int nv) {
     pConditionalV.reserve(nv);
     for (int v = 0; v < nv; ++v) {
@@ -170,4 +257,98 @@ Distribution2D::Distribution2D(const Float *func, int nu, int nv) {
     pMarginal.reset(new Distribution1D(&marginalFunc[0], nv));
 }
 
+Hierarchical2DWarp::Hierarchical2DWarp(const Float *func, int nu, int nv) {
+    CHECK(IsPowerOf2(nu) && IsPowerOf2(nv));
+    // Copy the function into the finest pyramid level, then repeatedly sum
+    // 2x2 (or 2x1 / 1x2, once one dimension has reached a single texel)
+    // blocks until a single texel holds the function's integral.
+    levelNu.push_back(nu);
+    levelNv.push_back(nv);
+    pyramid.push_back(std::vector<Float>(func, func + size_t(nu) * nv));
+    while (nu > 1 || nv > 1) {
+        int pnu = nu, pnv = nv;
+        const std::vector<Float> &prev = pyramid.back();
+        nu = std::max(1, nu / 2);
+        nv = std::max(1, nv / 2);
+        std::vector<Float> level(size_t(nu) * nv);
+        for (int y = 0; y < nv; ++y)
+            for (int x = 0; x < nu; ++x) {
+                Float sum = 0;
+                for (int dy = 0; dy < pnv / nv; ++dy)
+                    for (int dx = 0; dx < pnu / nu; ++dx)
+                        sum += prev[(y * (pnv / nv) + dy) * pnu +
+                                    x * (pnu / nu) + dx];
+                level[y * nu + x] = sum;
+            }
+        levelNu.push_back(nu);
+        levelNv.push_back(nv);
+        pyramid.push_back(std::move(level));
+    }
+}
+
+Point2f Hierarchical2DWarp::SampleContinuous(const Point2f &u,
+                                             Float *pdf) const {
+    Float funcInt = pyramid.back()[0];
+    if (funcInt == 0) {
+        *pdf = 0;
+        return u;
+    }
+
+    // Descend the pyramid from the single-texel level, at each level
+    // choosing among the current texel's children with probability
+    // proportional to their sums and remapping the random sample to cover
+    // the chosen child.
+    Point2f uRemapped = u;
+    int x = 0, y = 0;
+    for (int level = int(pyramid.size()) - 2; level >= 0; --level) {
+        int cx = levelNu[level] > levelNu[level + 1] ? 2 : 1;
+        int cy = levelNv[level] > levelNv[level + 1] ? 2 : 1;
+        x *= cx;
+        y *= cy;
+        if (cx == 2) {
+            // Choose between the two columns of children by their sums
+            Float wLeft = Texel(level, x, y) +
+                          (cy == 2 ? Texel(level, x, y + 1) : 0);
+            Float wRight = Texel(level, x + 1, y) +
+                           (cy == 2 ? Texel(level, x + 1, y + 1) : 0);
+            Float pLeft = wLeft / (wLeft + wRight);
+            if (uRemapped.x < pLeft)
+                uRemapped.x = std::min(uRemapped.x / pLeft, OneMinusEpsilon);
+            else {
+                ++x;
+                uRemapped.x = std::min((uRemapped.x - pLeft) / (1 - pLeft),
+                                       OneMinusEpsilon);
+            }
+        }
+        if (cy == 2) {
+            // Choose between the chosen column's two children
+            Float wBelow = Texel(level, x, y);
+            Float wAbove = Texel(level, x, y + 1);
+            Float pBelow = wBelow / (wBelow + wAbove);
+            if (uRemapped.y < pBelow)
+                uRemapped.y = std::min(uRemapped.y / pBelow, OneMinusEpsilon);
+            else {
+                ++y;
+                uRemapped.y = std::min((uRemapped.y - pBelow) / (1 - pBelow),
+                                       OneMinusEpsilon);
+            }
+        }
+    }
+
+    // The probability of reaching texel (x, y) telescopes to its value
+    // over the function's integral; the position within the texel is
+    // uniform.
+    *pdf = Texel(0, x, y) * levelNu[0] * levelNv[0] / funcInt;
+    return Point2f((x + uRemapped.x) / levelNu[0],
+                   (y + uRemapped.y) / levelNv[0]);
+}
+
+Float Hierarchical2DWarp::Pdf(const Point2f &p) const {
+    Float funcInt = pyramid.back()[0];
+    if (funcInt == 0) return 0;
+    int x = Clamp(int(p.x * levelNu[0]), 0, levelNu[0] - 1);
+    int y = Clamp(int(p.y * levelNv[0]), 0, levelNv[0] - 1);
+    return Texel(0, x, y) * levelNu[0] * levelNv[0] / funcInt;
+}
+
 }  // namespace pbrt
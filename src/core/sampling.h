@@ -52,8 +52,60 @@ void StratifiedSample1D(Float *samples, int nsamples, RNG &rng,
 void StratifiedSample2D(Point2f *samples, int nx, int ny, RNG &rng,
                         bool jitter = true);
 void LatinHypercube(Float *samples, int nSamples, int nDim, RNG &rng);
+
+// AliasTable Declarations
+
+// Walker/Vose alias table for O(1) discrete sampling: each of the _n_
+// equal-width columns holds part of its own outcome's probability mass
+// plus the overflow of one "alias" outcome, so drawing a sample takes a
+// single table probe instead of a binary search over a CDF.
+class AliasTable {
+  public:
+    // AliasTable Public Methods
+    AliasTable() {}
+    AliasTable(const Float *weights, int n);
+    bool Empty() const { return bins.empty(); }
+    int Count() const { return (int)bins.size(); }
+    // Returns an index distributed according to the weights; _uRemapped_
+    // receives the part of _u_ not used for the selection, rescaled to be
+    // uniform in $[0,1)$ again.
+    int Sample(Float u, Float *pdf = nullptr,
+               Float *uRemapped = nullptr) const {
+        int offset = std::min((int)(u * Count()), Count() - 1);
+        Float up = std::min(u * Count() - offset, OneMinusEpsilon);
+        if (up < bins[offset].q) {
+            if (pdf) *pdf = bins[offset].pdf;
+            if (uRemapped)
+                *uRemapped = std::min(up / bins[offset].q, OneMinusEpsilon);
+            return offset;
+        } else {
+            int alias = bins[offset].alias;
+            if (pdf) *pdf = bins[alias].pdf;
+            if (uRemapped)
+                *uRemapped = std::min(
+                    (up - bins[offset].q) / (1 - bins[offset].q),
+                    OneMinusEpsilon);
+            return alias;
+        }
+    }
+    Float PDF(int index) const { return bins[index].pdf; }
+
+  private:
+    // AliasTable Private Data
+    struct Bin {
+        Float q, pdf;
+        int alias;
+    };
+    std::vector<Bin> bins;
+};
+
 struct Distribution1D {
     // Distribution1D Public Methods
+    // Build the same distribution as the constructor, but compute the
+    // CDF with a parallel chunked prefix sum; worthwhile for the very
+    // large tabulated functions (e.g. MLT bootstrap weights), where the
+    // serial scan is measurable.
+    static Distribution1D BuildParallel(const Float *f, int n);
     Distribution1D(const Float *f, int n) : func(f, f + n), cdf(n + 1) {
         // Compute integral of step function at $x_i$
         cdf[0] = 0;
@@ -66,6 +118,11 @@ struct Distribution1D {
         } else {
             for (int i = 1; i < n + 1; ++i) cdf[i] /= funcInt;
         }
+
+        // Build an alias table for large distributions, where discrete
+        // sampling by CDF binary search is measurable (e.g. selecting
+        // among the per-triangle lights of emissive meshes)
+        if (n >= aliasThreshold) aliasTable = AliasTable(&func[0], n);
     }
     int Count() const { return (int)func.size(); }
     Float SampleContinuous(Float u, Float *pdf, int *off = nullptr) const {
@@ -89,6 +146,14 @@ struct Distribution1D {
     }
     int SampleDiscrete(Float u, Float *pdf = nullptr,
                        Float *uRemapped = nullptr) const {
+        // O(1) alias-table selection for large distributions
+        if (!aliasTable.Empty()) {
+            int offset = aliasTable.Sample(u, nullptr, uRemapped);
+            if (pdf)
+                *pdf = (funcInt > 0) ? func[offset] / (funcInt * Count()) : 0;
+            return offset;
+        }
+
         // Find surrounding CDF segments and _offset_
         int offset = FindInterval((int)cdf.size(),
                                   [&](int index) { return cdf[index] <= u; });
@@ -98,6 +163,13 @@ struct Distribution1D {
         if (uRemapped) CHECK(*uRemapped >= 0.f && *uRemapped <= 1.f);
         return offset;
     }
+    // Sample _n_ independent indices at once; with the alias table active
+    // this is a tight loop of O(1) probes with no binary searches.
+    void SampleDiscreteN(const Float *u, int n, int *offset,
+                         Float *pdf = nullptr) const {
+        for (int i = 0; i < n; ++i)
+            offset[i] = SampleDiscrete(u[i], pdf ? &pdf[i] : nullptr);
+    }
     Float DiscretePDF(int index) const {
         CHECK(index >= 0 && index < Count());
         return func[index] / (funcInt * Count());
@@ -106,6 +178,16 @@ struct Distribution1D {
     // Distribution1D Public Data
     std::vector<Float> func, cdf;
     Float funcInt;
+
+  private:
+    // Distribution1D Private Data
+    // Discrete sampling switches to an alias table above this count; the
+    // CDF binary search is cheap enough below it.
+    static PBRT_CONSTEXPR int aliasThreshold = 1024;
+    AliasTable aliasTable;
+
+    // For BuildParallel()
+    Distribution1D() : funcInt(0) {}
 };
 
 Point2f RejectionSampleDisk(RNG &rng);
@@ -146,6 +228,34 @@ class Distribution2D {
     std::unique_ptr<Distribution1D> pMarginal;
 };
 
+// Samples a piecewise-constant 2D function by hierarchical warping over a
+// sum pyramid rather than with tabulated CDFs.  Where Distribution2D
+// stores roughly three times the function in CDF tables and does two
+// binary searches per sample, this stores a 4/3-size pyramid and samples
+// with a couple of reads per pyramid level, so it's the better choice for
+// very large functions such as high-resolution environment maps.
+class Hierarchical2DWarp {
+  public:
+    // Hierarchical2DWarp Public Methods
+    Hierarchical2DWarp(const Float *func, int nu, int nv);
+    Point2f SampleContinuous(const Point2f &u, Float *pdf) const;
+    Float Pdf(const Point2f &p) const;
+
+  private:
+    // Hierarchical2DWarp Private Methods
+    Float Texel(int level, int x, int y) const {
+        return pyramid[level][y * levelNu[level] + x];
+    }
+
+    // Hierarchical2DWarp Private Data
+    // pyramid[0] holds the function at full resolution; each successive
+    // level halves each dimension that is still greater than one, with
+    // each texel storing the sum of its children, down to a single texel
+    // holding the integral of the whole function.
+    std::vector<std::vector<Float>> pyramid;
+    std::vector<int> levelNu, levelNv;
+};
+
 // Sampling Inline Functions
 template <typename T>
 void Shuffle(T *samp, int count, int nDimensions, RNG &rng) {
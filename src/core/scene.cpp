@@ -48,12 +48,29 @@ bool Scene::Intersect(const Ray &ray, SurfaceInteraction *isect) const {
     return aggregate->Intersect(ray, isect);
 }
 
+bool Scene::IntersectCompact(const Ray &ray, CompactHit *hit) const {
+    ++nIntersectionTests;
+    DCHECK_NE(ray.d, Vector3f(0,0,0));
+    return aggregate->IntersectCompact(ray, hit);
+}
+
 bool Scene::IntersectP(const Ray &ray) const {
     ++nShadowTests;
     DCHECK_NE(ray.d, Vector3f(0,0,0));
     return aggregate->IntersectP(ray);
 }
 
+void Scene::IntersectN(const RaySpan &rays, SurfaceInteraction *isects,
+                       bool *hits) const {
+    nIntersectionTests += rays.n;
+    aggregate->IntersectN(rays, isects, hits);
+}
+
+void Scene::IntersectPN(const RaySpan &rays, bool *hits) const {
+    nShadowTests += rays.n;
+    aggregate->IntersectPN(rays, hits);
+}
+
 bool Scene::IntersectTr(Ray ray, Sampler &sampler, SurfaceInteraction *isect,
                         Spectrum *Tr) const {
     *Tr = Spectrum(1.f);
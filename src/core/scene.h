@@ -46,6 +46,17 @@
 
 namespace pbrt {
 
+// SceneFeatures Declarations
+// Optional scene features, recorded once at Scene construction;
+// integrators dispatch on the mask to Li() specializations with the
+// corresponding dead branches compiled out. See PathIntegrator::Li().
+enum SceneFeatures {
+    SceneHasMedia = 1 << 0,
+    SceneHasAreaLights = 1 << 1,
+    SceneHasInfiniteLights = 1 << 2,
+    SceneHasSubsurface = 1 << 3,
+};
+
 // Scene Declarations
 class Scene {
   public:
@@ -60,12 +71,41 @@ class Scene {
             if (light->flags & (int)LightFlags::Infinite)
                 infiniteLights.push_back(light);
         }
+
+        // Record which optional features the scene uses. The deduplicated
+        // attribute table covers every GeometricPrimitive (it may also
+        // hold entries from earlier session-mode parses, which can only
+        // over-report features and cost a little optimization, never
+        // correctness).
+        for (const PrimitiveAttributes &attrs : primitiveAttributesTable) {
+            if (attrs.mediumInterface.inside || attrs.mediumInterface.outside)
+                features |= SceneHasMedia;
+            if (attrs.areaLight) features |= SceneHasAreaLights;
+            if (attrs.material && attrs.material->HasSubsurfaceScattering())
+                features |= SceneHasSubsurface;
+        }
+        for (const auto &light : lights)
+            if (light->mediumInterface.inside || light->mediumInterface.outside)
+                features |= SceneHasMedia;
+        if (!infiniteLights.empty()) features |= SceneHasInfiniteLights;
     }
+    // Returns the bitwise or of the _SceneFeatures_ this scene uses.
+    int Features() const { return features; }
     const Bounds3f &WorldBound() const { return worldBound; }
     bool Intersect(const Ray &ray, SurfaceInteraction *isect) const;
     bool IntersectP(const Ray &ray) const;
+    bool IntersectCompact(const Ray &ray, CompactHit *hit) const;
+    void IntersectN(const RaySpan &rays, SurfaceInteraction *isects,
+                    bool *hits) const;
+    void IntersectPN(const RaySpan &rays, bool *hits) const;
     bool IntersectTr(Ray ray, Sampler &sampler, SurfaceInteraction *isect,
                      Spectrum *transmittance) const;
+    // Invokes _callback_ for every non-aggregate primitive in the scene;
+    // see Primitive::ForEachPrimitive().
+    void ForEachPrimitive(
+        const std::function<void(const Primitive &)> &callback) const {
+        aggregate->ForEachPrimitive(callback);
+    }
 
     // Scene Public Data
     std::vector<std::shared_ptr<Light>> lights;
@@ -77,6 +117,7 @@ class Scene {
     // Scene Private Data
     std::shared_ptr<Primitive> aggregate;
     Bounds3f worldBound;
+    int features = 0;
 };
 
 }  // namespace pbrt
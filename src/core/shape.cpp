@@ -69,6 +69,17 @@ Interaction Shape::Sample(const Interaction &ref, const Point2f &u,
     return intr;
 }
 
+void Shape::IntersectPN(const Ray *rays, int n, bool *hits,
+                        bool testAlphaTexture) const {
+    for (int i = 0; i < n; ++i)
+        hits[i] = IntersectP(rays[i], testAlphaTexture);
+}
+
+void Shape::SampleN(const Interaction &ref, const Point2f *u, int n,
+                    Interaction *its, Float *pdf) const {
+    for (int i = 0; i < n; ++i) its[i] = Sample(ref, u[i], &pdf[i]);
+}
+
 Float Shape::Pdf(const Interaction &ref, const Vector3f &wi) const {
     // Intersect sample ray with area light geometry
     Ray ray = ref.SpawnRay(wi);
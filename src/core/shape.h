@@ -63,6 +63,56 @@ class Shape {
                             bool testAlphaTexture = true) const {
         return Intersect(ray, nullptr, nullptr, testAlphaTexture);
     }
+    // If the shape is a triangle, store its world-space vertex positions in
+    // _p_ and return true; accelerators use this to pre-gather leaf
+    // triangles into SoA bundles for SIMD intersection tests.
+    virtual bool GetTriangleVertices(Point3f p[3]) const { return false; }
+    // Compute the screen space $(u,v)$ derivatives for a hit on this shape
+    // from the position derivatives _dpdx_ and _dpdy_ and return true, or
+    // return false to have SurfaceInteraction fall back to its generic
+    // per-hit linear solve. Triangle answers from per-triangle UV
+    // derivative matrices precomputed in its mesh.
+    virtual bool ComputeUVDifferentials(const Vector3f &dpdx,
+                                        const Vector3f &dpdy, Float *dudx,
+                                        Float *dvdx, Float *dudy,
+                                        Float *dvdy) const {
+        return false;
+    }
+    // Batched occlusion test; _hits[i]_ records whether _rays[i]_
+    // intersects the shape. The default loops over the single-ray method;
+    // the quadrics override it with SIMD kernels that cull definite
+    // misses eight rays at a time for the batched traversal leaf path.
+    virtual void IntersectPN(const Ray *rays, int n, bool *hits,
+                             bool testAlphaTexture = true) const;
+    // Returns true when IntersectPN() amortizes work across the batch,
+    // so that traversal only pays for gathering rays into a span when the
+    // shape can take advantage of it.
+    virtual bool HasBatchedIntersectP() const { return false; }
+    // Compact intersection for batched pipelines: find the nearest hit but
+    // record only the hit distance and the shape's parametric hit
+    // coordinates instead of building a SurfaceInteraction;
+    // ComputeInteraction() reconstructs the full interaction later for
+    // hits that survive to shading. The defaults fall back to the full
+    // test; Triangle records barycentric coordinates and reconstructs
+    // from them directly.
+    virtual bool IntersectCompact(const Ray &ray, Float *tHit,
+                                  Point2f *hitCoord,
+                                  bool testAlphaTexture = true) const {
+        SurfaceInteraction isect;
+        if (!Intersect(ray, tHit, &isect, testAlphaTexture)) return false;
+        *hitCoord = Point2f(0, 0);
+        return true;
+    }
+    virtual void ComputeInteraction(const Ray &ray, Float tHit,
+                                    const Point2f &hitCoord,
+                                    SurfaceInteraction *isect) const {
+        // Re-run the full test with an open-ended ray; the nearest hit is
+        // the one IntersectCompact() reported.
+        Ray r = ray;
+        r.tMax = Infinity;
+        Float t;
+        Intersect(r, &t, isect);
+    }
     virtual Float Area() const = 0;
     // Sample a point on the surface of the shape and return the PDF with
     // respect to area on the surface.
@@ -75,6 +125,14 @@ class Shape {
                                Float *pdf) const;
     virtual Float Pdf(const Interaction &ref, const Vector3f &wi) const;
 
+    // Batched version of Sample() from a reference point, for taking many
+    // light samples from one shading point at once. The default loops
+    // over the single-sample method; Sphere overrides it with a kernel
+    // that hoists the per-reference setup out of the loop and evaluates
+    // the cone sampling eight samples at a time.
+    virtual void SampleN(const Interaction &ref, const Point2f *u, int n,
+                         Interaction *its, Float *pdf) const;
+
     // Returns the solid angle subtended by the shape w.r.t. the reference
     // point p, given in world space. Some shapes compute this value in
     // closed-form, while the default implementation uses Monte Carlo
@@ -42,12 +42,30 @@
 #include "pbrt.h"
 #include "stringprint.h"
 
+// Use SSE for the spectral reduction loops in ToXYZ() and y().  The
+// element-wise coefficient operators vectorize on their own, but
+// reductions don't without permission to reassociate floating-point
+// sums, so those two are written with explicit partial sums.
+#if defined(__SSE2__) && !defined(PBRT_FLOAT_AS_DOUBLE)
+#include <immintrin.h>
+#define PBRT_SPECTRUM_HAVE_SSE
+#endif
+
 namespace pbrt {
 
 // Spectrum Utility Declarations
 static const int sampledLambdaStart = 400;
 static const int sampledLambdaEnd = 700;
+// Number of SampledSpectrum coefficients; overridable at build time so
+// spectral builds that can't afford the full 60-coefficient resolution
+// can compile with a handful (e.g. 8 or 16) of wider bands instead,
+// trading spectral resolution for close-to-RGB shading cost while still
+// avoiding RGB metamerism.
+#ifdef PBRT_N_SPECTRAL_SAMPLES
+static const int nSpectralSamples = PBRT_N_SPECTRAL_SAMPLES;
+#else
 static const int nSpectralSamples = 60;
+#endif
 extern bool SpectrumSamplesSorted(const Float *lambda, const Float *vals,
                                   int n);
 extern void SortSpectrumSamples(Float *lambda, Float *vals, int n);
@@ -130,6 +148,26 @@ class CoefficientSpectrum {
         for (int i = 0; i < nSpectrumSamples; ++i) c[i] += s2.c[i];
         return *this;
     }
+    // Fused in-place updates, used on the integrators' radiance and path
+    // throughput accumulators. Expressions like "L += beta * Ld" and
+    // "beta *= f * w" otherwise materialize their products in temporaries,
+    // a measurable copy cost with SampledSpectrum's coefficient count.
+    CoefficientSpectrum &AddScaled(const CoefficientSpectrum &s, Float w) {
+        DCHECK(!s.HasNaNs() && !std::isnan(w));
+        for (int i = 0; i < nSpectrumSamples; ++i) c[i] += s.c[i] * w;
+        return *this;
+    }
+    CoefficientSpectrum &AddScaled(const CoefficientSpectrum &s,
+                                   const CoefficientSpectrum &w) {
+        DCHECK(!s.HasNaNs() && !w.HasNaNs());
+        for (int i = 0; i < nSpectrumSamples; ++i) c[i] += s.c[i] * w.c[i];
+        return *this;
+    }
+    CoefficientSpectrum &MulScaled(const CoefficientSpectrum &s, Float w) {
+        DCHECK(!s.HasNaNs() && !std::isnan(w));
+        for (int i = 0; i < nSpectrumSamples; ++i) c[i] *= s.c[i] * w;
+        return *this;
+    }
     CoefficientSpectrum operator+(const CoefficientSpectrum &s2) const {
         DCHECK(!s2.HasNaNs());
         CoefficientSpectrum ret = *this;
@@ -379,7 +417,27 @@ class SampledSpectrum : public CoefficientSpectrum<nSpectralSamples> {
     }
     void ToXYZ(Float xyz[3]) const {
         xyz[0] = xyz[1] = xyz[2] = 0.f;
-        for (int i = 0; i < nSpectralSamples; ++i) {
+        int i = 0;
+#ifdef PBRT_SPECTRUM_HAVE_SSE
+        // Accumulate four-wide partial sums for all three curves at once,
+        // then reduce them horizontally
+        __m128 xv = _mm_setzero_ps(), yv = _mm_setzero_ps(),
+               zv = _mm_setzero_ps();
+        for (; i + 4 <= nSpectralSamples; i += 4) {
+            __m128 cv = _mm_loadu_ps(&c[i]);
+            xv = _mm_add_ps(xv, _mm_mul_ps(_mm_loadu_ps(&X.c[i]), cv));
+            yv = _mm_add_ps(yv, _mm_mul_ps(_mm_loadu_ps(&Y.c[i]), cv));
+            zv = _mm_add_ps(zv, _mm_mul_ps(_mm_loadu_ps(&Z.c[i]), cv));
+        }
+        Float xs[4], ys[4], zs[4];
+        _mm_storeu_ps(xs, xv);
+        _mm_storeu_ps(ys, yv);
+        _mm_storeu_ps(zs, zv);
+        xyz[0] = (xs[0] + xs[1]) + (xs[2] + xs[3]);
+        xyz[1] = (ys[0] + ys[1]) + (ys[2] + ys[3]);
+        xyz[2] = (zs[0] + zs[1]) + (zs[2] + zs[3]);
+#endif  // PBRT_SPECTRUM_HAVE_SSE
+        for (; i < nSpectralSamples; ++i) {
             xyz[0] += X.c[i] * c[i];
             xyz[1] += Y.c[i] * c[i];
             xyz[2] += Z.c[i] * c[i];
@@ -392,7 +450,17 @@ class SampledSpectrum : public CoefficientSpectrum<nSpectralSamples> {
     }
     Float y() const {
         Float yy = 0.f;
-        for (int i = 0; i < nSpectralSamples; ++i) yy += Y.c[i] * c[i];
+        int i = 0;
+#ifdef PBRT_SPECTRUM_HAVE_SSE
+        __m128 yv = _mm_setzero_ps();
+        for (; i + 4 <= nSpectralSamples; i += 4)
+            yv = _mm_add_ps(
+                yv, _mm_mul_ps(_mm_loadu_ps(&Y.c[i]), _mm_loadu_ps(&c[i])));
+        Float ys[4];
+        _mm_storeu_ps(ys, yv);
+        yy = (ys[0] + ys[1]) + (ys[2] + ys[3]);
+#endif  // PBRT_SPECTRUM_HAVE_SSE
+        for (; i < nSpectralSamples; ++i) yy += Y.c[i] * c[i];
         return yy * Float(sampledLambdaEnd - sampledLambdaStart) /
                Float(CIE_Y_integral * nSpectralSamples);
     }
@@ -37,14 +37,25 @@
 #include <array>
 #include <atomic>
 #include <cinttypes>
+#include <atomic>
+#include <deque>
 #include <functional>
 #include <mutex>
 #include <type_traits>
+#include "error.h"
 #include "parallel.h"
 #include "stringprint.h"
 #ifdef PBRT_HAVE_ITIMER
 #include <sys/time.h>
+#include <time.h>
 #endif  // PBRT_HAVE_ITIMER
+#ifdef PBRT_IS_LINUX
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif  // PBRT_IS_LINUX
 
 namespace pbrt {
 
@@ -52,6 +63,107 @@ namespace pbrt {
 std::vector<std::function<void(StatsAccumulator &)>> *StatRegisterer::funcs;
 static StatsAccumulator statsAccumulator;
 
+// A statistic's running totals across all thread flushes. Every field is
+// an atomic so concurrent ReportThreadStats() calls never take a lock;
+// sums and counts merge with fetch-add, extrema with compare-exchange
+// loops. Slots live in a deque so their addresses stay stable as new
+// statistics are registered.
+struct StatSlot {
+    StatSlot(const char *title, StatSlotKind kind) : title(title), kind(kind) {}
+    const std::string title;
+    const StatSlotKind kind;
+    std::atomic<int64_t> sum{0}, count{0};
+    std::atomic<int64_t> min{std::numeric_limits<int64_t>::max()};
+    std::atomic<int64_t> max{std::numeric_limits<int64_t>::lowest()};
+    // Float distributions keep their values in doubles
+    std::atomic<double> dsum{0};
+    std::atomic<double> dmin{std::numeric_limits<double>::max()};
+    std::atomic<double> dmax{std::numeric_limits<double>::lowest()};
+};
+static std::deque<StatSlot> statSlots;
+static std::mutex statSlotAllocMutex;
+
+template <typename T>
+static void AtomicUpdateMin(std::atomic<T> &m, T v) {
+    T old = m.load(std::memory_order_relaxed);
+    while (v < old && !m.compare_exchange_weak(old, v)) {
+    }
+}
+
+template <typename T>
+static void AtomicUpdateMax(std::atomic<T> &m, T v) {
+    T old = m.load(std::memory_order_relaxed);
+    while (v > old && !m.compare_exchange_weak(old, v)) {
+    }
+}
+
+static void AtomicAddDouble(std::atomic<double> &d, double v) {
+    double old = d.load(std::memory_order_relaxed);
+    while (!d.compare_exchange_weak(old, old + v)) {
+    }
+}
+
+int AllocStatSlot(const char *title, StatSlotKind kind) {
+    // Cold path: runs once per statistic, on its first nonzero flush
+    std::lock_guard<std::mutex> lock(statSlotAllocMutex);
+    statSlots.emplace_back(title, kind);
+    return (int)statSlots.size() - 1;
+}
+
+void StatSlotAccumulate(int slot, int64_t sum, int64_t count, int64_t min,
+                        int64_t max) {
+    StatSlot &s = statSlots[slot];
+    s.sum += sum;
+    s.count += count;
+    AtomicUpdateMin(s.min, min);
+    AtomicUpdateMax(s.max, max);
+}
+
+void StatSlotAccumulateFloat(int slot, double sum, int64_t count, double min,
+                             double max) {
+    StatSlot &s = statSlots[slot];
+    AtomicAddDouble(s.dsum, sum);
+    s.count += count;
+    AtomicUpdateMin(s.dmin, min);
+    AtomicUpdateMax(s.dmax, max);
+}
+
+// Folds the slot totals into the string-keyed printing accumulator and
+// resets them; only runs when the statistics are printed or cleared, so
+// the map churn is off any hot path.
+static void FoldStatSlots(StatsAccumulator &accum) {
+    std::lock_guard<std::mutex> lock(statSlotAllocMutex);
+    for (StatSlot &s : statSlots) {
+        switch (s.kind) {
+        case StatSlotKind::Counter:
+            accum.ReportCounter(s.title, s.sum.exchange(0));
+            break;
+        case StatSlotKind::MemoryCounter:
+            accum.ReportMemoryCounter(s.title, s.sum.exchange(0));
+            break;
+        case StatSlotKind::IntDistribution:
+            accum.ReportIntDistribution(
+                s.title, s.sum.exchange(0), s.count.exchange(0),
+                s.min.exchange(std::numeric_limits<int64_t>::max()),
+                s.max.exchange(std::numeric_limits<int64_t>::lowest()));
+            break;
+        case StatSlotKind::FloatDistribution:
+            accum.ReportFloatDistribution(
+                s.title, s.dsum.exchange(0), s.count.exchange(0),
+                s.dmin.exchange(std::numeric_limits<double>::max()),
+                s.dmax.exchange(std::numeric_limits<double>::lowest()));
+            break;
+        case StatSlotKind::Percentage:
+            accum.ReportPercentage(s.title, s.sum.exchange(0),
+                                   s.count.exchange(0));
+            break;
+        case StatSlotKind::Ratio:
+            accum.ReportRatio(s.title, s.sum.exchange(0), s.count.exchange(0));
+            break;
+        }
+    }
+}
+
 // For a given profiler state (i.e., a set of "on" bits corresponding to
 // profiling categories that are active), ProfileSample stores a count of
 // the number of times that state has been active when the timer interrupt
@@ -71,14 +183,39 @@ static std::array<ProfileSample, profileHashSize> profileSamples;
 
 static std::chrono::system_clock::time_point profileStartTime;
 
+// When structured profile output has been requested via
+// _PbrtOptions.profileOutFile_, each profiling interrupt additionally
+// appends a timestamped sample to a preallocated buffer so that the
+// per-thread timeline can be reconstructed afterwards.  The buffer is
+// sized up front since the signal handler can't allocate; at the 100 Hz
+// sampling rate it covers hours of render time for typical thread
+// counts.
+struct ProfileTraceSample {
+    uint64_t profilerState;
+    int64_t ns;  // since profiling started
+    int threadIndex;
+};
+static const int maxProfileTraceSamples = 1 << 21;
+static std::vector<ProfileTraceSample> profileTrace;
+static std::atomic<int> profileTraceCount{0};
+static bool profileTraceEnabled = false;
+static int64_t profileTraceStartNs;
+
 #ifdef PBRT_HAVE_ITIMER
+static int64_t ProfileTraceNowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 static void ReportProfileSample(int, siginfo_t *, void *);
 #endif  // PBRT_HAVE_ITIMER
 
 // Statistics Definitions
 void ReportThreadStats() {
-    static std::mutex mutex;
-    std::lock_guard<std::mutex> lock(mutex);
+    // Each callback reduces its thread-local values into the statistic's
+    // integer-indexed atomic slot, so concurrent flushes from worker
+    // threads proceed without any lock.
     StatRegisterer::CallCallbacks(statsAccumulator);
 }
 
@@ -86,9 +223,15 @@ void StatRegisterer::CallCallbacks(StatsAccumulator &accum) {
     for (auto func : *funcs) func(accum);
 }
 
-void PrintStats(FILE *dest) { statsAccumulator.Print(dest); }
+void PrintStats(FILE *dest) {
+    FoldStatSlots(statsAccumulator);
+    statsAccumulator.Print(dest);
+}
 
-void ClearStats() { statsAccumulator.Clear(); }
+void ClearStats() {
+    FoldStatSlots(statsAccumulator);
+    statsAccumulator.Clear();
+}
 
 static void getCategoryAndTitle(const std::string &str, std::string *category,
                                 std::string *title) {
@@ -215,6 +358,16 @@ void InitProfiler() {
 
     ClearProfiler();
 
+    // Allocate the profile timeline buffer now if structured profile
+    // output was requested; the signal handler can't do it later.
+    profileTraceEnabled = !PbrtOptions.profileOutFile.empty();
+    if (profileTraceEnabled && profileTrace.empty())
+        profileTrace.resize(maxProfileTraceSamples);
+    profileTraceCount = 0;
+#ifdef PBRT_HAVE_ITIMER
+    profileTraceStartNs = ProfileTraceNowNs();
+#endif
+
     profileStartTime = std::chrono::system_clock::now();
 // Set timer to periodically interrupt the system for profiling
 #ifdef PBRT_HAVE_ITIMER
@@ -278,6 +431,100 @@ void CleanupProfiler() {
     profilerRunning = false;
 }
 
+#ifdef PBRT_IS_LINUX
+// Hardware performance counters, sampled at render-phase boundaries. Each
+// event gets its own fd; the counters are opened with _inherit_ set so
+// that counts from the worker threads (which are launched afterwards) are
+// summed into the value read here, and therefore can't be grouped, since
+// the kernel doesn't support inherited group reads.
+struct PerfCounterEvent {
+    const char *name;
+    int fd;
+    uint64_t phaseStart;
+};
+static std::vector<PerfCounterEvent> perfCounterEvents;
+static const char *perfCounterPhase = nullptr;
+
+static uint64_t ReadPerfCounter(int fd) {
+    uint64_t value = 0;
+    if (read(fd, &value, sizeof(value)) != sizeof(value)) value = 0;
+    return value;
+}
+
+void InitPerfCounters() {
+    if (!PbrtOptions.perfCounters) return;
+    static const struct {
+        const char *name;
+        uint64_t config;
+    } hwEvents[] = {
+        {"CPU cycles", PERF_COUNT_HW_CPU_CYCLES},
+        {"Instructions", PERF_COUNT_HW_INSTRUCTIONS},
+        {"Cache references", PERF_COUNT_HW_CACHE_REFERENCES},
+        {"Cache misses", PERF_COUNT_HW_CACHE_MISSES},
+        {"Branches", PERF_COUNT_HW_BRANCH_INSTRUCTIONS},
+        {"Branch misses", PERF_COUNT_HW_BRANCH_MISSES},
+    };
+    for (const auto &e : hwEvents) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = e.config;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        int fd = syscall(__NR_perf_event_open, &attr, 0 /* this process */,
+                         -1 /* any CPU */, -1 /* no group */, 0);
+        if (fd < 0) {
+            Warning(
+                "Hardware counter \"%s\" is unavailable (%s); continuing "
+                "without it.",
+                e.name, strerror(errno));
+            continue;
+        }
+        perfCounterEvents.push_back(PerfCounterEvent{e.name, fd, 0});
+    }
+}
+
+void PerfCountersBeginPhase(const char *phaseName) {
+    if (perfCounterEvents.empty()) return;
+    perfCounterPhase = phaseName;
+    for (PerfCounterEvent &e : perfCounterEvents)
+        e.phaseStart = ReadPerfCounter(e.fd);
+}
+
+void PerfCountersEndPhase() {
+    if (!perfCounterPhase) return;
+    for (PerfCounterEvent &e : perfCounterEvents)
+        statsAccumulator.ReportCounter(
+            StringPrintf("Hardware counters/%s: %s", perfCounterPhase,
+                         e.name),
+            ReadPerfCounter(e.fd) - e.phaseStart);
+    perfCounterPhase = nullptr;
+}
+
+void CleanupPerfCounters() {
+    for (PerfCounterEvent &e : perfCounterEvents) close(e.fd);
+    perfCounterEvents.clear();
+}
+
+#else
+
+void InitPerfCounters() {
+    if (PbrtOptions.perfCounters)
+        Warning(
+            "Hardware performance counters are only supported on Linux; "
+            "ignoring --perfcounters.");
+}
+
+void PerfCountersBeginPhase(const char *) {}
+
+void PerfCountersEndPhase() {}
+
+void CleanupPerfCounters() {}
+
+#endif  // PBRT_IS_LINUX
+
 #ifdef PBRT_HAVE_ITIMER
 static void ReportProfileSample(int, siginfo_t *, void *) {
     if (profilerSuspendCount > 0) return;
@@ -295,6 +542,19 @@ static void ReportProfileSample(int, siginfo_t *, void *) {
     CHECK_NE(count, profileHashSize) << "Profiler hash table filled up!";
     profileSamples[h].profilerState = ProfilerState;
     ++profileSamples[h].count;
+
+    // Record a timestamped sample for the exported timeline, if enabled.
+    // Slots are claimed with an atomic increment so concurrent handlers
+    // in different threads never write the same entry; samples past the
+    // end of the buffer are dropped.
+    if (profileTraceEnabled) {
+        int slot = profileTraceCount.fetch_add(1, std::memory_order_relaxed);
+        if (slot < maxProfileTraceSamples) {
+            profileTrace[slot].profilerState = ProfilerState;
+            profileTrace[slot].ns = ProfileTraceNowNs() - profileTraceStartNs;
+            profileTrace[slot].threadIndex = ThreadIndex;
+        }
+    }
 }
 #endif  // PBRT_HAVE_ITIMER
 
@@ -391,4 +651,81 @@ void ReportProfilerResults(FILE *dest) {
 #endif
 }
 
+void WriteProfilerTrace(const std::string &outBaseName) {
+#ifdef PBRT_HAVE_ITIMER
+    PBRT_CONSTEXPR int NumProfCategories = (int)Prof::NumProfCategories;
+    auto stackString = [NumProfCategories](uint64_t state, char sep) {
+        std::string s;
+        for (int b = 0; b < NumProfCategories; ++b)
+            if (state & (1ull << b)) {
+                if (!s.empty()) s += sep;
+                s += ProfNames[b];
+            }
+        return s;
+    };
+
+    // Write the aggregated samples as collapsed stacks: one line per
+    // distinct category stack with its sample count, the input format of
+    // flamegraph tools.
+    std::string foldedName = outBaseName + ".folded.txt";
+    FILE *folded = fopen(foldedName.c_str(), "w");
+    if (!folded) {
+        Error("%s: couldn't open profile output file.", foldedName.c_str());
+        return;
+    }
+    for (const ProfileSample &ps : profileSamples) {
+        if (ps.count == 0) continue;
+        fprintf(folded, "%s %" PRIu64 "\n",
+                stackString(ps.profilerState, ';').c_str(),
+                (uint64_t)ps.count);
+    }
+    fclose(folded);
+
+    // Write the per-thread timeline as Chrome trace_event JSON.  Each
+    // recorded sample becomes a complete ("X") event extending to the
+    // next sample on the same thread, clamped to a few sampling periods
+    // so that gaps where a thread wasn't running stay visible.
+    int nTrace = std::min((int)profileTraceCount, maxProfileTraceSamples);
+    if ((int)profileTraceCount > maxProfileTraceSamples)
+        Warning(
+            "Profile timeline buffer filled up; the exported trace is "
+            "truncated (%d of %d samples).",
+            maxProfileTraceSamples, (int)profileTraceCount);
+    std::vector<ProfileTraceSample> samples(profileTrace.begin(),
+                                            profileTrace.begin() + nTrace);
+    std::sort(samples.begin(), samples.end(),
+              [](const ProfileTraceSample &a, const ProfileTraceSample &b) {
+                  return a.threadIndex != b.threadIndex
+                             ? a.threadIndex < b.threadIndex
+                             : a.ns < b.ns;
+              });
+    std::string traceName = outBaseName + ".trace.json";
+    FILE *trace = fopen(traceName.c_str(), "w");
+    if (!trace) {
+        Error("%s: couldn't open profile output file.", traceName.c_str());
+        return;
+    }
+    fprintf(trace, "{\"traceEvents\":[\n");
+    for (size_t i = 0; i < samples.size(); ++i) {
+        const ProfileTraceSample &s = samples[i];
+        int64_t dur = 10000000;  // one 100 Hz sampling period, in ns
+        if (i + 1 < samples.size() &&
+            samples[i + 1].threadIndex == s.threadIndex)
+            dur = std::min(samples[i + 1].ns - s.ns, 3 * dur);
+        // Name the event after the innermost active category; the full
+        // stack goes in the event arguments.
+        int nameIndex = Log2Int(s.profilerState);
+        fprintf(trace,
+                "%s{\"name\":\"%s\",\"cat\":\"pbrt\",\"ph\":\"X\","
+                "\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":%d,"
+                "\"args\":{\"stack\":\"%s\"}}",
+                i > 0 ? ",\n" : "", ProfNames[nameIndex], s.ns / 1e3,
+                dur / 1e3, s.threadIndex,
+                stackString(s.profilerState, '/').c_str());
+    }
+    fprintf(trace, "\n]}\n");
+    fclose(trace);
+#endif
+}
+
 }  // namespace pbrt
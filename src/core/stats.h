@@ -72,6 +72,27 @@ void PrintStats(FILE *dest);
 void ClearStats();
 void ReportThreadStats();
 
+// Integer-indexed merge slots for the statistics macros below. Each
+// statistic resolves its title to a dense slot index once (on the first
+// thread flush); after that, merging a thread's accumulations is a
+// handful of wait-free atomic adds and compare-exchange min/max updates
+// with no mutex and no string hashing, so per-tile reporting doesn't
+// serialize worker threads. The string titles are only revisited when
+// the totals are folded into the printing accumulator.
+enum class StatSlotKind {
+    Counter,
+    MemoryCounter,
+    IntDistribution,
+    FloatDistribution,
+    Percentage,
+    Ratio
+};
+int AllocStatSlot(const char *title, StatSlotKind kind);
+void StatSlotAccumulate(int slot, int64_t sum, int64_t count, int64_t min,
+                        int64_t max);
+void StatSlotAccumulateFloat(int slot, double sum, int64_t count, double min,
+                             double max);
+
 class StatsAccumulator {
   public:
     // StatsAccumulator Public Methods
@@ -276,23 +297,43 @@ void SuspendProfiler();
 void ResumeProfiler();
 void ProfilerWorkerThreadInit();
 void ReportProfilerResults(FILE *dest);
+// Write the per-thread profile timeline recorded when
+// _PbrtOptions.profileOutFile_ is set as Chrome trace_event JSON, and the
+// aggregated samples as collapsed stacks for flamegraph tools.
+void WriteProfilerTrace(const std::string &outBaseName);
 void ClearProfiler();
 void CleanupProfiler();
 
+// Optional hardware performance counters (--perfcounters). The counters
+// are opened before the worker threads are launched so that per-thread
+// counts are inherited, snapshotted at render-phase boundaries, and folded
+// into the statistics output alongside the software counters. Linux only;
+// the functions are no-ops elsewhere.
+void InitPerfCounters();
+void PerfCountersBeginPhase(const char *phaseName);
+void PerfCountersEndPhase();
+void CleanupPerfCounters();
+
 // Statistics Macros
-#define STAT_COUNTER(title, var)                           \
-    static PBRT_THREAD_LOCAL int64_t var;                  \
-    static void STATS_FUNC##var(StatsAccumulator &accum) { \
-        accum.ReportCounter(title, var);                   \
-        var = 0;                                           \
-    }                                                      \
+#define STAT_COUNTER(title, var)                                          \
+    static PBRT_THREAD_LOCAL int64_t var;                                 \
+    static void STATS_FUNC##var(StatsAccumulator &) {                     \
+        if (var == 0) return;                                             \
+        static const int slot =                                           \
+            AllocStatSlot(title, StatSlotKind::Counter);                  \
+        StatSlotAccumulate(slot, var, 0, 0, 0);                           \
+        var = 0;                                                          \
+    }                                                                     \
     static StatRegisterer STATS_REG##var(STATS_FUNC##var)
-#define STAT_MEMORY_COUNTER(title, var)                    \
-    static PBRT_THREAD_LOCAL int64_t var;                  \
-    static void STATS_FUNC##var(StatsAccumulator &accum) { \
-        accum.ReportMemoryCounter(title, var);             \
-        var = 0;                                           \
-    }                                                      \
+#define STAT_MEMORY_COUNTER(title, var)                                   \
+    static PBRT_THREAD_LOCAL int64_t var;                                 \
+    static void STATS_FUNC##var(StatsAccumulator &) {                     \
+        if (var == 0) return;                                             \
+        static const int slot =                                           \
+            AllocStatSlot(title, StatSlotKind::MemoryCounter);            \
+        StatSlotAccumulate(slot, var, 0, 0, 0);                           \
+        var = 0;                                                          \
+    }                                                                     \
     static StatRegisterer STATS_REG##var(STATS_FUNC##var)
 
 #ifndef PBRT_HAVE_CONSTEXPR
@@ -307,34 +348,40 @@ void CleanupProfiler();
 #define STATS_DBL_T_MAX std::numeric_limits<double>::lowest()
 #endif
 
-#define STAT_INT_DISTRIBUTION(title, var)                                  \
-    static PBRT_THREAD_LOCAL int64_t var##sum;                             \
-    static PBRT_THREAD_LOCAL int64_t var##count;                           \
-    static PBRT_THREAD_LOCAL int64_t var##min = (STATS_INT64_T_MIN);       \
-    static PBRT_THREAD_LOCAL int64_t var##max = (STATS_INT64_T_MAX);       \
-    static void STATS_FUNC##var(StatsAccumulator &accum) {                 \
-        accum.ReportIntDistribution(title, var##sum, var##count, var##min, \
-                                    var##max);                             \
-        var##sum = 0;                                                      \
-        var##count = 0;                                                    \
-        var##min = std::numeric_limits<int64_t>::max();                    \
-        var##max = std::numeric_limits<int64_t>::lowest();                 \
-    }                                                                      \
+#define STAT_INT_DISTRIBUTION(title, var)                                 \
+    static PBRT_THREAD_LOCAL int64_t var##sum;                            \
+    static PBRT_THREAD_LOCAL int64_t var##count;                          \
+    static PBRT_THREAD_LOCAL int64_t var##min = (STATS_INT64_T_MIN);      \
+    static PBRT_THREAD_LOCAL int64_t var##max = (STATS_INT64_T_MAX);      \
+    static void STATS_FUNC##var(StatsAccumulator &) {                     \
+        if (var##count == 0) return;                                      \
+        static const int slot =                                           \
+            AllocStatSlot(title, StatSlotKind::IntDistribution);          \
+        StatSlotAccumulate(slot, var##sum, var##count, var##min,          \
+                           var##max);                                     \
+        var##sum = 0;                                                     \
+        var##count = 0;                                                   \
+        var##min = std::numeric_limits<int64_t>::max();                   \
+        var##max = std::numeric_limits<int64_t>::lowest();                \
+    }                                                                     \
     static StatRegisterer STATS_REG##var(STATS_FUNC##var)
 
-#define STAT_FLOAT_DISTRIBUTION(title, var)                                  \
-    static PBRT_THREAD_LOCAL double var##sum;                                \
-    static PBRT_THREAD_LOCAL int64_t var##count;                             \
-    static PBRT_THREAD_LOCAL double var##min = (STATS_DBL_T_MIN);            \
-    static PBRT_THREAD_LOCAL double var##max = (STATS_DBL_T_MAX);            \
-    static void STATS_FUNC##var(StatsAccumulator &accum) {                   \
-        accum.ReportFloatDistribution(title, var##sum, var##count, var##min, \
-                                      var##max);                             \
-        var##sum = 0;                                                        \
-        var##count = 0;                                                      \
-        var##min = std::numeric_limits<double>::max();                       \
-        var##max = std::numeric_limits<double>::lowest();                    \
-    }                                                                        \
+#define STAT_FLOAT_DISTRIBUTION(title, var)                               \
+    static PBRT_THREAD_LOCAL double var##sum;                             \
+    static PBRT_THREAD_LOCAL int64_t var##count;                          \
+    static PBRT_THREAD_LOCAL double var##min = (STATS_DBL_T_MIN);         \
+    static PBRT_THREAD_LOCAL double var##max = (STATS_DBL_T_MAX);         \
+    static void STATS_FUNC##var(StatsAccumulator &) {                     \
+        if (var##count == 0) return;                                      \
+        static const int slot =                                           \
+            AllocStatSlot(title, StatSlotKind::FloatDistribution);        \
+        StatSlotAccumulateFloat(slot, var##sum, var##count, var##min,     \
+                                var##max);                                \
+        var##sum = 0;                                                     \
+        var##count = 0;                                                   \
+        var##min = std::numeric_limits<double>::max();                    \
+        var##max = std::numeric_limits<double>::lowest();                 \
+    }                                                                     \
     static StatRegisterer STATS_REG##var(STATS_FUNC##var)
 
 #define ReportValue(var, value)                                   \
@@ -345,20 +392,26 @@ void CleanupProfiler();
         var##max = std::max(var##max, decltype(var##min)(value)); \
     } while (0)
 
-#define STAT_PERCENT(title, numVar, denomVar)                 \
-    static PBRT_THREAD_LOCAL int64_t numVar, denomVar;        \
-    static void STATS_FUNC##numVar(StatsAccumulator &accum) { \
-        accum.ReportPercentage(title, numVar, denomVar);      \
-        numVar = denomVar = 0;                                \
-    }                                                         \
+#define STAT_PERCENT(title, numVar, denomVar)                             \
+    static PBRT_THREAD_LOCAL int64_t numVar, denomVar;                    \
+    static void STATS_FUNC##numVar(StatsAccumulator &) {                  \
+        if (numVar == 0 && denomVar == 0) return;                         \
+        static const int slot =                                           \
+            AllocStatSlot(title, StatSlotKind::Percentage);               \
+        StatSlotAccumulate(slot, numVar, denomVar, 0, 0);                 \
+        numVar = denomVar = 0;                                            \
+    }                                                                     \
     static StatRegisterer STATS_REG##numVar(STATS_FUNC##numVar)
 
-#define STAT_RATIO(title, numVar, denomVar)                   \
-    static PBRT_THREAD_LOCAL int64_t numVar, denomVar;        \
-    static void STATS_FUNC##numVar(StatsAccumulator &accum) { \
-        accum.ReportRatio(title, numVar, denomVar);           \
-        numVar = denomVar = 0;                                \
-    }                                                         \
+#define STAT_RATIO(title, numVar, denomVar)                               \
+    static PBRT_THREAD_LOCAL int64_t numVar, denomVar;                    \
+    static void STATS_FUNC##numVar(StatsAccumulator &) {                  \
+        if (numVar == 0 && denomVar == 0) return;                         \
+        static const int slot =                                           \
+            AllocStatSlot(title, StatSlotKind::Ratio);                    \
+        StatSlotAccumulate(slot, numVar, denomVar, 0, 0);                 \
+        numVar = denomVar = 0;                                            \
+    }                                                                     \
     static StatRegisterer STATS_REG##numVar(STATS_FUNC##numVar)
 
 }  // namespace pbrt
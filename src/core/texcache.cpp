@@ -0,0 +1,444 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+// core/texcache.cpp*
+#include "texcache.h"
+#include "asyncio.h"
+#include "stats.h"
+#include <cerrno>
+#include <cstring>
+#ifdef PBRT_HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#elif defined(PBRT_IS_WINDOWS)
+#include <windows.h>  // Windows file mapping API
+#endif
+
+namespace pbrt {
+
+// File Mapping Definitions
+std::shared_ptr<const void> MapFileReadOnly(const std::string &filename,
+                                            size_t *size) {
+#ifdef PBRT_HAVE_MMAP
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1) {
+        Error("%s: %s", filename.c_str(), strerror(errno));
+        return nullptr;
+    }
+
+    struct stat stat;
+    if (fstat(fd, &stat) != 0) {
+        Error("%s: %s", filename.c_str(), strerror(errno));
+        close(fd);
+        return nullptr;
+    }
+
+    size_t len = stat.st_size;
+    void *ptr = mmap(0, len, PROT_READ, MAP_FILE | MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        Error("%s: %s", filename.c_str(), strerror(errno));
+        return nullptr;
+    }
+
+    *size = len;
+    return std::shared_ptr<const void>(
+        ptr, [len](const void *p) { munmap(const_cast<void *>(p), len); });
+#elif defined(PBRT_IS_WINDOWS)
+    HANDLE fileHandle =
+        CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, 0,
+                    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (fileHandle == INVALID_HANDLE_VALUE) {
+        Error("%s: unable to open file", filename.c_str());
+        return nullptr;
+    }
+
+    LARGE_INTEGER liLen;
+    if (!GetFileSizeEx(fileHandle, &liLen)) {
+        Error("%s: unable to get file size", filename.c_str());
+        CloseHandle(fileHandle);
+        return nullptr;
+    }
+
+    HANDLE mapping = CreateFileMapping(fileHandle, 0, PAGE_READONLY, 0, 0, 0);
+    CloseHandle(fileHandle);
+    if (mapping == 0) {
+        Error("%s: unable to create file mapping", filename.c_str());
+        return nullptr;
+    }
+
+    LPVOID ptr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (ptr == nullptr) {
+        Error("%s: unable to map file", filename.c_str());
+        return nullptr;
+    }
+
+    *size = (size_t)liLen.QuadPart;
+    return std::shared_ptr<const void>(
+        ptr, [](const void *p) { UnmapViewOfFile(const_cast<void *>(p)); });
+#else
+    FILE *f = fopen(filename.c_str(), "rb");
+    if (!f) {
+        Error("%s: %s", filename.c_str(), strerror(errno));
+        return nullptr;
+    }
+
+    if (fseek(f, 0, SEEK_END) != 0) {
+        Error("%s: %s", filename.c_str(), strerror(errno));
+        fclose(f);
+        return nullptr;
+    }
+    long len = ftell(f);
+    std::shared_ptr<char> data(new char[len], std::default_delete<char[]>());
+    if (fseek(f, 0, SEEK_SET) != 0 ||
+        fread(data.get(), 1, len, f) != (size_t)len) {
+        Error("%s: %s", filename.c_str(), strerror(errno));
+        fclose(f);
+        return nullptr;
+    }
+    fclose(f);
+
+    *size = len;
+    return data;
+#endif
+}
+
+STAT_COUNTER("Texture/Tile cache disk reads", tileDiskReads);
+STAT_COUNTER("Texture/Tiles prefetched", tilesPrefetched);
+STAT_PERCENT("Texture/Tile cache lock-free hits", hotTileHits, tileLookups);
+
+// TextureTileCache Local Definitions
+// A resident tile; shared_ptrs keep evicted tiles alive while per-thread
+// tables still reference them.
+struct TextureTile {
+    std::unique_ptr<char[]> data;
+    std::list<uint64_t>::iterator lruIt;
+    size_t bytes;
+    // Set while the prefetch thread's read of the tile is in flight;
+    // lookups that land on the tile before then wait on it.
+    AsyncReadHandle pendingRead;
+};
+
+// Per-thread direct-mapped table of recently used tiles; hits are resolved
+// without touching the cache mutex. _retired_ holds the last few pins
+// displaced from the table so that texel references handed out earlier in
+// the same filtering expression can't dangle when a colliding tile lands
+// in their slot.
+struct ThreadTileTable {
+    struct Entry {
+        uint64_t key = 0;
+        const void *data = nullptr;
+        std::shared_ptr<TextureTile> pin;
+    };
+    static PBRT_CONSTEXPR int tableSize = 64;
+    static PBRT_CONSTEXPR int nRetired = 8;
+    Entry entries[tableSize];
+    std::shared_ptr<TextureTile> retired[nRetired];
+    int retiredPos = 0;
+};
+
+static PBRT_THREAD_LOCAL ThreadTileTable *threadTileTable;
+
+// Destination for the calling thread's recorded tile faults; see
+// RecordTileAccesses().
+static PBRT_THREAD_LOCAL std::vector<uint64_t> *recordedTileAccesses;
+
+static inline uint64_t TileKey(int planeId, int tileX, int tileY) {
+    // + 1 so that no valid tile collides with the tables' empty-entry key
+    return ((uint64_t)planeId << 40 | (uint64_t)tileY << 20 |
+            (uint64_t)tileX) +
+           1;
+}
+
+static inline int TileTableSlot(uint64_t key) {
+    return (key * 0x9E3779B97F4A7C15ull) >> 58;
+}
+
+// TextureTileCache Method Definitions
+TextureTileCache *TextureTileCache::Instance() {
+    static TextureTileCache cache;
+    return &cache;
+}
+
+TextureTileCache::TextureTileCache()
+    : maxBytes(std::max(1, PbrtOptions.texCacheMB) * size_t(1024 * 1024)) {
+    file = tmpfile();
+    if (!file)
+        Warning(
+            "Unable to create texture cache backing file; textures will "
+            "stay resident.");
+    else
+#ifdef PBRT_IS_WINDOWS
+        fd = _fileno(file);
+#else
+        fd = fileno(file);
+#endif
+}
+
+TextureTileCache::~TextureTileCache() {
+    if (prefetchThread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(prefetchMutex);
+            shutdownPrefetch = true;
+        }
+        prefetchCondition.notify_one();
+        prefetchThread.join();
+    }
+    if (file) fclose(file);
+}
+
+ThreadTileTable *TextureTileCache::GetThreadTileTable() {
+    ThreadTileTable *table = threadTileTable;
+    if (!table) {
+        table = new ThreadTileTable;
+        threadTileTable = table;
+        std::lock_guard<std::mutex> lock(mutex);
+        threadTables.emplace_back(table);
+    }
+    return table;
+}
+
+int TextureTileCache::AddPlane(const void *rowMajorTexels, int width,
+                               int height, int texelBytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!file) return -1;
+    PlaneDesc desc;
+    desc.width = width;
+    desc.height = height;
+    desc.texelBytes = texelBytes;
+    desc.nTilesX = (width + TileSize - 1) / TileSize;
+    desc.nTilesY = (height + TileSize - 1) / TileSize;
+    desc.tileBytes = (size_t)TileSize * TileSize * texelBytes;
+    desc.fileOffset =
+        planes.empty()
+            ? 0
+            : planes.back().fileOffset + (int64_t)planes.back().nTilesX *
+                                             planes.back().nTilesY *
+                                             planes.back().tileBytes;
+#ifdef PBRT_IS_WINDOWS
+    if (_fseeki64(file, desc.fileOffset, SEEK_SET) != 0) return -1;
+#else
+    if (fseeko(file, desc.fileOffset, SEEK_SET) != 0) return -1;
+#endif
+
+    // Gather the plane's texels into tiled order and append them to the
+    // backing file; edge tiles are zero-padded to full size.
+    const char *texels = (const char *)rowMajorTexels;
+    std::unique_ptr<char[]> tile(new char[desc.tileBytes]);
+    for (int ty = 0; ty < desc.nTilesY; ++ty)
+        for (int tx = 0; tx < desc.nTilesX; ++tx) {
+            memset(tile.get(), 0, desc.tileBytes);
+            int nRows = std::min(TileSize, height - ty * TileSize);
+            int rowBytes =
+                std::min(TileSize, width - tx * TileSize) * texelBytes;
+            for (int row = 0; row < nRows; ++row)
+                memcpy(tile.get() + (size_t)row * TileSize * texelBytes,
+                       texels + ((size_t)(ty * TileSize + row) * width +
+                                 tx * TileSize) *
+                                    texelBytes,
+                       rowBytes);
+            if (fwrite(tile.get(), desc.tileBytes, 1, file) != 1) {
+                Warning(
+                    "Error writing texture cache backing file; textures "
+                    "will stay resident.");
+                return -1;
+            }
+        }
+    // Flush the plane's tiles so subsequent positional reads of _fd_ see
+    // them rather than the stdio buffer.
+    fflush(file);
+    planes.push_back(desc);
+    return (int)planes.size() - 1;
+}
+
+const void *TextureTileCache::GetTile(int planeId, int tileX, int tileY) {
+    ++tileLookups;
+    uint64_t key = TileKey(planeId, tileX, tileY);
+    ThreadTileTable *table = GetThreadTileTable();
+    ThreadTileTable::Entry &entry = table->entries[TileTableSlot(key)];
+    if (entry.key == key) {
+        ++hotTileHits;
+        return entry.data;
+    }
+
+    // Thread-table miss; look the tile up in the shared cache, reading it
+    // from disk and evicting least recently used tiles if needed
+    if (recordedTileAccesses) recordedTileAccesses->push_back(key);
+    std::shared_ptr<TextureTile> tile = LookupTile(key);
+
+    // Install the tile in the thread's table, retiring the displaced pin
+    table->retired[table->retiredPos] = std::move(entry.pin);
+    table->retiredPos = (table->retiredPos + 1) % ThreadTileTable::nRetired;
+    entry.key = key;
+    entry.data = tile->data.get();
+    entry.pin = std::move(tile);
+    return entry.data;
+}
+
+std::shared_ptr<TextureTile> TextureTileCache::LookupTile(uint64_t key) {
+    int planeId = (int)((key - 1) >> 40);
+    int tileX = (int)((key - 1) & 0xfffff);
+    int tileY = (int)(((key - 1) >> 20) & 0xfffff);
+    std::shared_ptr<TextureTile> tile;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = tiles.find(key);
+    if (it != tiles.end()) {
+        tile = it->second;
+        // The prefetch thread may still have the tile's read in flight
+        if (tile->pendingRead) {
+            if (!tile->pendingRead->Wait())
+                LOG(FATAL) << "Error reading texture cache backing file";
+            tile->pendingRead = nullptr;
+        }
+        lruOrder.splice(lruOrder.begin(), lruOrder, tile->lruIt);
+    } else {
+        // Read the tile's storage from the backing file
+        ++tileDiskReads;
+        const PlaneDesc &desc = planes[planeId];
+        tile = std::make_shared<TextureTile>();
+        tile->bytes = desc.tileBytes;
+        tile->data.reset(new char[desc.tileBytes]);
+        int64_t offset =
+            desc.fileOffset +
+            ((int64_t)tileY * desc.nTilesX + tileX) * desc.tileBytes;
+        if (!AsyncRead(fd, tile->data.get(), desc.tileBytes, offset)->Wait())
+            LOG(FATAL) << "Error reading texture cache backing file";
+        residentBytes += desc.tileBytes;
+        lruOrder.push_front(key);
+        tile->lruIt = lruOrder.begin();
+        tiles[key] = tile;
+
+        // Evict tiles past the cache budget
+        while (residentBytes > maxBytes && lruOrder.size() > 1) {
+            uint64_t evictKey = lruOrder.back();
+            lruOrder.pop_back();
+            auto evictIt = tiles.find(evictKey);
+            residentBytes -= evictIt->second->bytes;
+            tiles.erase(evictIt);
+        }
+    }
+    return tile;
+}
+
+void TextureTileCache::PrefetchTiles(const std::vector<uint64_t> &keys) {
+    // Issue reads for all of the batch's missing tiles before waiting on
+    // any of them; _pending_ also keeps their storage alive should one be
+    // evicted below while its read is still in flight.
+    std::vector<std::shared_ptr<TextureTile>> pending;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (uint64_t key : keys) {
+            ++tilesPrefetched;
+            auto it = tiles.find(key);
+            if (it != tiles.end()) {
+                lruOrder.splice(lruOrder.begin(), lruOrder,
+                                it->second->lruIt);
+                continue;
+            }
+            ++tileDiskReads;
+            int planeId = (int)((key - 1) >> 40);
+            int tileX = (int)((key - 1) & 0xfffff);
+            int tileY = (int)(((key - 1) >> 20) & 0xfffff);
+            const PlaneDesc &desc = planes[planeId];
+            std::shared_ptr<TextureTile> tile =
+                std::make_shared<TextureTile>();
+            tile->bytes = desc.tileBytes;
+            tile->data.reset(new char[desc.tileBytes]);
+            int64_t offset =
+                desc.fileOffset +
+                ((int64_t)tileY * desc.nTilesX + tileX) * desc.tileBytes;
+            tile->pendingRead =
+                AsyncRead(fd, tile->data.get(), desc.tileBytes, offset);
+            residentBytes += desc.tileBytes;
+            lruOrder.push_front(key);
+            tile->lruIt = lruOrder.begin();
+            tiles[key] = tile;
+            pending.push_back(std::move(tile));
+        }
+        while (residentBytes > maxBytes && lruOrder.size() > 1) {
+            uint64_t evictKey = lruOrder.back();
+            lruOrder.pop_back();
+            auto evictIt = tiles.find(evictKey);
+            residentBytes -= evictIt->second->bytes;
+            tiles.erase(evictIt);
+        }
+    }
+
+    // Wait for the batch without the cache mutex so GetTile() misses
+    // aren't held up behind it
+    for (const std::shared_ptr<TextureTile> &tile : pending) {
+        AsyncReadHandle read;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            read = tile->pendingRead;
+        }
+        if (!read) continue;  // a lookup already waited on it
+        if (!read->Wait())
+            LOG(FATAL) << "Error reading texture cache backing file";
+        std::lock_guard<std::mutex> lock(mutex);
+        if (tile->pendingRead == read) tile->pendingRead = nullptr;
+    }
+}
+
+void TextureTileCache::RecordTileAccesses(std::vector<uint64_t> *accessed) {
+    recordedTileAccesses = accessed;
+}
+
+void TextureTileCache::PrefetchAsync(std::vector<uint64_t> tileKeys) {
+    if (tileKeys.empty()) return;
+    std::lock_guard<std::mutex> lock(prefetchMutex);
+    if (!prefetchThread.joinable())
+        prefetchThread = std::thread([this]() {
+            for (;;) {
+                std::vector<uint64_t> keys;
+                {
+                    std::unique_lock<std::mutex> lock(prefetchMutex);
+                    prefetchCondition.wait(lock, [this]() {
+                        return shutdownPrefetch || !prefetchQueue.empty();
+                    });
+                    if (shutdownPrefetch) return;
+                    keys = std::move(prefetchQueue.front());
+                    prefetchQueue.pop_front();
+                }
+                PrefetchTiles(keys);
+                ReportThreadStats();
+            }
+        });
+    prefetchQueue.push_back(std::move(tileKeys));
+    prefetchCondition.notify_one();
+}
+
+}  // namespace pbrt
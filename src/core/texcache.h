@@ -0,0 +1,155 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_CORE_TEXCACHE_H
+#define PBRT_CORE_TEXCACHE_H
+
+// core/texcache.h*
+#include "pbrt.h"
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace pbrt {
+struct TextureTile;
+struct ThreadTileTable;
+
+// Map _filename_ read-only, returning storage that stays valid until the
+// last reference to it goes away; on platforms without memory mapping the
+// whole file is read into allocated memory instead. Returns nullptr (with
+// an error reported) if the file can't be opened or mapped.
+std::shared_ptr<const void> MapFileReadOnly(const std::string &filename,
+                                            size_t *size);
+
+// TextureTileCache Declarations
+
+// TextureTileCache spills image planes (in practice, large MIP map levels)
+// to a temporary file in a tiled layout and pages individual tiles back in
+// on first touch, keeping at most _PbrtOptions.texCacheMB_ megabytes of
+// tiles resident under LRU replacement. Lookups that touch a tile a thread
+// has used recently are resolved from a small per-thread direct-mapped
+// table without taking any lock; only misses take the cache mutex and
+// possibly read from disk. Texel types are opaque to the cache: planes are
+// registered with their texel size and tiles are returned as raw storage.
+//
+// Tiles a thread's table pins stay allocated after eviction until the
+// thread replaces them, so the configured budget is a target rather than a
+// hard limit (it can be exceeded by a few tiles per thread).
+class TextureTileCache {
+  public:
+    // TextureTileCache Public Methods
+    // The process-wide cache, created on first use with the budget from
+    // _PbrtOptions.texCacheMB_.
+    static TextureTileCache *Instance();
+    // Write _width_ x _height_ texels of _texelBytes_ each, given in
+    // row-major order, to the backing file in tiled layout and return a
+    // plane id for lookups, or -1 if the backing file couldn't be created
+    // (in which case the caller should keep its storage resident).
+    int AddPlane(const void *rowMajorTexels, int width, int height,
+                 int texelBytes);
+    // Return the storage of the given tile of a plane; the pointer stays
+    // valid at least until the calling thread's next GetTile() call chain
+    // replaces the tile in its table.
+    const void *GetTile(int planeId, int tileX, int tileY);
+    // Route the calling thread's subsequent tile faults into _accessed_
+    // (pass nullptr to stop). Integrators record each film tile's texture
+    // working set this way and hand it back to PrefetchAsync() before
+    // re-rendering the tile.
+    void RecordTileAccesses(std::vector<uint64_t> *accessed);
+    // Page the given tiles (keys recorded by RecordTileAccesses()) into
+    // the shared cache on a background thread, so a film tile's texture
+    // working set from the previous wave or frame is read back from disk
+    // while the tile renders its first samples instead of one fault at a
+    // time. Already-resident tiles just move to the front of the LRU list.
+    void PrefetchAsync(std::vector<uint64_t> tileKeys);
+
+    // TextureTileCache Public Data
+    // Tiles are square with _TileSize_ texels per side; edge tiles are
+    // zero-padded to full size so tile indexing never depends on the
+    // plane's extent.
+    static PBRT_CONSTEXPR int TileSize = 32;
+    static PBRT_CONSTEXPR int TileSizeLog2 = 5;
+
+  private:
+    // TextureTileCache Private Methods
+    TextureTileCache();
+    ~TextureTileCache();
+    ThreadTileTable *GetThreadTileTable();
+    // Locked lookup shared by GetTile() and the prefetch thread: returns
+    // the resident tile for _key_, reading it from the backing file and
+    // evicting past the budget if needed.
+    std::shared_ptr<TextureTile> LookupTile(uint64_t key);
+    // Batched variant of LookupTile() used by the prefetch thread: all of
+    // the missing tiles' reads are submitted to the async I/O service
+    // before any is waited on, so their storage latencies overlap.
+    void PrefetchTiles(const std::vector<uint64_t> &keys);
+
+    // TextureTileCache Private Data
+    struct PlaneDesc {
+        int64_t fileOffset;
+        int width, height, texelBytes;
+        int nTilesX, nTilesY;
+        size_t tileBytes;
+    };
+    FILE *file = nullptr;
+    // Descriptor of _file_, used for positional reads through the async
+    // I/O service; tile reads never touch the FILE's own offset.
+    int fd = -1;
+    size_t maxBytes, residentBytes = 0;
+    std::vector<PlaneDesc> planes;
+    std::unordered_map<uint64_t, std::shared_ptr<TextureTile>> tiles;
+    std::list<uint64_t> lruOrder;
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadTileTable>> threadTables;
+    // Prefetch thread state; the thread is started on the first
+    // PrefetchAsync() call and drains _prefetchQueue_ until destruction.
+    std::thread prefetchThread;
+    std::mutex prefetchMutex;
+    std::condition_variable prefetchCondition;
+    std::deque<std::vector<uint64_t>> prefetchQueue;
+    bool shutdownPrefetch = false;
+};
+
+}  // namespace pbrt
+
+#endif  // PBRT_CORE_TEXCACHE_H
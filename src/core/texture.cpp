@@ -34,9 +34,28 @@
 // core/texture.cpp*
 #include "texture.h"
 #include "shape.h"
+#include "stats.h"
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Use AVX2 for the batched noise kernels when available (the lattice hash
+// needs integer gathers); the kernels assume 32-bit floats.
+#if defined(__AVX2__) && !defined(PBRT_FLOAT_AS_DOUBLE)
+#define PBRT_TEXTURE_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
 
 namespace pbrt {
 
+STAT_PERCENT("Texture/Memoized evaluations reused", texMemoHits,
+             texMemoLookups);
+
+void ReportTextureMemoLookup(bool hit) {
+    ++texMemoLookups;
+    if (hit) ++texMemoHits;
+}
+
 // Texture Inline Functions
 inline Float SmoothStep(Float min, Float max, Float value) {
     Float v = Clamp((value - min) / (max - min), 0, 1);
@@ -93,6 +112,7 @@ UVMapping2D::UVMapping2D(Float su, Float sv, Float du, Float dv)
 Point2f UVMapping2D::Map(const SurfaceInteraction &si, Vector2f *dstdx,
                          Vector2f *dstdy) const {
     // Compute texture differentials for 2D identity mapping
+    si.EnsureDifferentials();
     *dstdx = Vector2f(su * si.dudx, sv * si.dvdx);
     *dstdy = Vector2f(su * si.dudy, sv * si.dvdy);
     return Point2f(su * si.uv[0] + du, sv * si.uv[1] + dv);
@@ -102,6 +122,7 @@ Point2f SphericalMapping2D::Map(const SurfaceInteraction &si, Vector2f *dstdx,
                                 Vector2f *dstdy) const {
     Point2f st = sphere(si.p);
     // Compute texture coordinate differentials for sphere $(u,v)$ mapping
+    si.EnsureDifferentials();
     const Float delta = .1f;
     Point2f stDeltaX = sphere(si.p + delta * si.dpdx);
     *dstdx = (stDeltaX - st) / delta;
@@ -130,6 +151,7 @@ Point2f CylindricalMapping2D::Map(const SurfaceInteraction &si, Vector2f *dstdx,
                                   Vector2f *dstdy) const {
     Point2f st = cylinder(si.p);
     // Compute texture coordinate differentials for cylinder $(u,v)$ mapping
+    si.EnsureDifferentials();
     const Float delta = .01f;
     Point2f stDeltaX = cylinder(si.p + delta * si.dpdx);
     *dstdx = (stDeltaX - st) / delta;
@@ -149,6 +171,7 @@ Point2f CylindricalMapping2D::Map(const SurfaceInteraction &si, Vector2f *dstdx,
 Point2f PlanarMapping2D::Map(const SurfaceInteraction &si, Vector2f *dstdx,
                              Vector2f *dstdy) const {
     Vector3f vec(si.p);
+    si.EnsureDifferentials();
     *dstdx = Vector2f(Dot(si.dpdx, vs), Dot(si.dpdx, vt));
     *dstdy = Vector2f(Dot(si.dpdy, vs), Dot(si.dpdy, vt));
     return Point2f(ds + Dot(vec, vs), dt + Dot(vec, vt));
@@ -156,6 +179,7 @@ Point2f PlanarMapping2D::Map(const SurfaceInteraction &si, Vector2f *dstdx,
 
 Point3f IdentityMapping3D::Map(const SurfaceInteraction &si, Vector3f *dpdx,
                                Vector3f *dpdy) const {
+    si.EnsureDifferentials();
     *dpdx = WorldToTexture(si.dpdx);
     *dpdy = WorldToTexture(si.dpdy);
     return WorldToTexture(si.p);
@@ -250,6 +274,186 @@ Float Turbulence(const Point3f &p, const Vector3f &dpdx, const Vector3f &dpdy,
     return sum;
 }
 
+#ifdef PBRT_TEXTURE_HAVE_AVX2
+// Eight-wide _Grad()_: three chained gathers from the permutation table
+// compute the lattice hashes, and blends select and sign the gradient
+// components exactly as the scalar branches do.
+static inline __m256 Grad8(__m256i x, __m256i y, __m256i z, __m256 dx,
+                           __m256 dy, __m256 dz) {
+    __m256i h = _mm256_i32gather_epi32(NoisePerm, x, 4);
+    h = _mm256_i32gather_epi32(NoisePerm, _mm256_add_epi32(h, y), 4);
+    h = _mm256_i32gather_epi32(NoisePerm, _mm256_add_epi32(h, z), 4);
+    h = _mm256_and_si256(h, _mm256_set1_epi32(15));
+    __m256i is12or13 =
+        _mm256_or_si256(_mm256_cmpeq_epi32(h, _mm256_set1_epi32(12)),
+                        _mm256_cmpeq_epi32(h, _mm256_set1_epi32(13)));
+    __m256 uSel = _mm256_castsi256_ps(_mm256_or_si256(
+        _mm256_cmpgt_epi32(_mm256_set1_epi32(8), h), is12or13));
+    __m256 vSel = _mm256_castsi256_ps(_mm256_or_si256(
+        _mm256_cmpgt_epi32(_mm256_set1_epi32(4), h), is12or13));
+    __m256 u = _mm256_blendv_ps(dy, dx, uSel);
+    __m256 v = _mm256_blendv_ps(dz, dy, vSel);
+    // Negate _u_ where bit 0 of the hash is set and _v_ where bit 1 is,
+    // by flipping the lanes' sign bits
+    __m256 uSign = _mm256_castsi256_ps(
+        _mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(1)), 31));
+    __m256 vSign = _mm256_castsi256_ps(
+        _mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(2)), 30));
+    return _mm256_add_ps(_mm256_xor_ps(u, uSign), _mm256_xor_ps(v, vSign));
+}
+
+static inline __m256 NoiseWeight8(__m256 t) {
+    __m256 t3 = _mm256_mul_ps(_mm256_mul_ps(t, t), t);
+    __m256 t4 = _mm256_mul_ps(t3, t);
+    return _mm256_add_ps(
+        _mm256_sub_ps(
+            _mm256_mul_ps(_mm256_set1_ps(6), _mm256_mul_ps(t4, t)),
+            _mm256_mul_ps(_mm256_set1_ps(15), t4)),
+        _mm256_mul_ps(_mm256_set1_ps(10), t3));
+}
+
+// Lerp with the same association as the scalar Lerp()
+static inline __m256 Lerp8(__m256 t, __m256 v1, __m256 v2) {
+    return _mm256_add_ps(
+        _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(1), t), v1),
+        _mm256_mul_ps(t, v2));
+}
+
+static void Noise8(const float x[8], const float y[8], const float z[8],
+                   float out[8]) {
+    // Compute noise cell coordinates and offsets for the eight points
+    __m256 xv = _mm256_loadu_ps(x), yv = _mm256_loadu_ps(y),
+           zv = _mm256_loadu_ps(z);
+    __m256 fx = _mm256_floor_ps(xv), fy = _mm256_floor_ps(yv),
+           fz = _mm256_floor_ps(zv);
+    __m256 dx = _mm256_sub_ps(xv, fx), dy = _mm256_sub_ps(yv, fy),
+           dz = _mm256_sub_ps(zv, fz);
+    __m256i mask = _mm256_set1_epi32(NoisePermSize - 1);
+    __m256i ix = _mm256_and_si256(_mm256_cvtps_epi32(fx), mask);
+    __m256i iy = _mm256_and_si256(_mm256_cvtps_epi32(fy), mask);
+    __m256i iz = _mm256_and_si256(_mm256_cvtps_epi32(fz), mask);
+
+    // Compute gradient weights
+    __m256i one = _mm256_set1_epi32(1);
+    __m256i ix1 = _mm256_add_epi32(ix, one), iy1 = _mm256_add_epi32(iy, one),
+            iz1 = _mm256_add_epi32(iz, one);
+    __m256 m1 = _mm256_set1_ps(1);
+    __m256 dx1 = _mm256_sub_ps(dx, m1), dy1 = _mm256_sub_ps(dy, m1),
+           dz1 = _mm256_sub_ps(dz, m1);
+    __m256 w000 = Grad8(ix, iy, iz, dx, dy, dz);
+    __m256 w100 = Grad8(ix1, iy, iz, dx1, dy, dz);
+    __m256 w010 = Grad8(ix, iy1, iz, dx, dy1, dz);
+    __m256 w110 = Grad8(ix1, iy1, iz, dx1, dy1, dz);
+    __m256 w001 = Grad8(ix, iy, iz1, dx, dy, dz1);
+    __m256 w101 = Grad8(ix1, iy, iz1, dx1, dy, dz1);
+    __m256 w011 = Grad8(ix, iy1, iz1, dx, dy1, dz1);
+    __m256 w111 = Grad8(ix1, iy1, iz1, dx1, dy1, dz1);
+
+    // Compute trilinear interpolation of weights
+    __m256 wx = NoiseWeight8(dx), wy = NoiseWeight8(dy),
+           wz = NoiseWeight8(dz);
+    __m256 x00 = Lerp8(wx, w000, w100);
+    __m256 x10 = Lerp8(wx, w010, w110);
+    __m256 x01 = Lerp8(wx, w001, w101);
+    __m256 x11 = Lerp8(wx, w011, w111);
+    __m256 y0 = Lerp8(wy, x00, x10);
+    __m256 y1 = Lerp8(wy, x01, x11);
+    _mm256_storeu_ps(out, Lerp8(wz, y0, y1));
+}
+#endif  // PBRT_TEXTURE_HAVE_AVX2
+
+void NoiseN(const Point3f p[], int n, Float out[]) {
+    int i = 0;
+#ifdef PBRT_TEXTURE_HAVE_AVX2
+    for (; i + 8 <= n; i += 8) {
+        float x[8], y[8], z[8];
+        for (int j = 0; j < 8; ++j) {
+            x[j] = p[i + j].x;
+            y[j] = p[i + j].y;
+            z[j] = p[i + j].z;
+        }
+        Noise8(x, y, z, out + i);
+    }
+#endif
+    for (; i < n; ++i) out[i] = Noise(p[i]);
+}
+
+// Shared octave scan for FBmN() and TurbulenceN(): every point's integer
+// octaves are summed through eight-wide noise batches (taking each
+// point's antialiased octave count into account), and the per-point
+// fractional remainder -- whose scale differs point to point -- is left
+// to the scalar _remainder_ callback.
+template <typename AccumFunc, typename RemainderFunc>
+static void NoiseOctaveScan(const Point3f p[], const Vector3f dpdx[],
+                            const Vector3f dpdy[], int n, Float omega,
+                            int maxOctaves, Float out[], AccumFunc accum,
+                            RemainderFunc remainder) {
+    // Compute each point's number of octaves for antialiased noise
+    std::vector<Float> nOctaves(n);
+    int maxInt = 0;
+    for (int i = 0; i < n; ++i) {
+        Float len2 =
+            std::max(dpdx[i].LengthSquared(), dpdy[i].LengthSquared());
+        nOctaves[i] = Clamp(-1 - .5f * Log2(len2), 0, maxOctaves);
+        maxInt = std::max(maxInt, (int)std::floor(nOctaves[i]));
+        out[i] = 0;
+    }
+
+    // Sum the batch's octaves of noise
+    std::vector<Point3f> scaled(n);
+    std::vector<Float> noise(n);
+    Float lambda = 1, o = 1;
+    for (int octave = 0; octave < maxInt; ++octave) {
+        for (int i = 0; i < n; ++i) scaled[i] = lambda * p[i];
+        NoiseN(scaled.data(), n, noise.data());
+        for (int i = 0; i < n; ++i)
+            if (octave < (int)std::floor(nOctaves[i]))
+                out[i] += o * accum(noise[i]);
+        lambda *= 1.99f;
+        o *= omega;
+    }
+
+    // Add each point's fractional octave contribution
+    for (int i = 0; i < n; ++i) {
+        int nInt = std::floor(nOctaves[i]);
+        Float lam = 1, oo = 1;
+        for (int j = 0; j < nInt; ++j) {
+            lam *= 1.99f;
+            oo *= omega;
+        }
+        out[i] += remainder(lam * p[i], oo, nOctaves[i] - nInt, nInt);
+    }
+}
+
+void FBmN(const Point3f p[], const Vector3f dpdx[], const Vector3f dpdy[],
+          int n, Float omega, int maxOctaves, Float out[]) {
+    NoiseOctaveScan(
+        p, dpdx, dpdy, n, omega, maxOctaves, out,
+        [](Float noise) { return noise; },
+        [](const Point3f &p, Float o, Float nPartial, int) {
+            return o * SmoothStep(.3f, .7f, nPartial) * Noise(p);
+        });
+}
+
+void TurbulenceN(const Point3f p[], const Vector3f dpdx[],
+                 const Vector3f dpdy[], int n, Float omega, int maxOctaves,
+                 Float out[]) {
+    NoiseOctaveScan(
+        p, dpdx, dpdy, n, omega, maxOctaves, out,
+        [](Float noise) { return std::abs(noise); },
+        [omega, maxOctaves](const Point3f &p, Float o, Float nPartial,
+                            int nInt) {
+            // Account for contributions of clamped octaves in turbulence
+            Float sum = o * Lerp(SmoothStep(.3f, .7f, nPartial), 0.2,
+                                 std::abs(Noise(p)));
+            for (int i = nInt; i < maxOctaves; ++i) {
+                sum += o * 0.2f;
+                o *= omega;
+            }
+            return sum;
+        });
+}
+
 // Texture Function Definitions
 Float Lanczos(Float x, Float tau) {
     x = std::abs(x);
@@ -261,4 +465,114 @@ Float Lanczos(Float x, Float tau) {
     return s * lanczos;
 }
 
+// Texture Access Instrumentation Definitions
+static std::vector<std::unique_ptr<TextureAccessRecord>> accessRecords;
+static std::mutex accessRecordMutex;
+
+TextureAccessRecord *RegisterTextureAccess(
+    const Point2i &resolution, const std::vector<Point2i> &levelRes,
+    int texelBytes) {
+    std::unique_ptr<TextureAccessRecord> rec(new TextureAccessRecord);
+    rec->resolution = resolution;
+    rec->texelBytes = texelBytes;
+    rec->levelRes = levelRes;
+    rec->levelLookups =
+        std::vector<std::atomic<uint64_t>>(levelRes.size());
+    for (const Point2i &res : levelRes) {
+        int nTiles = ((res.x + 31) >> 5) * ((res.y + 31) >> 5);
+        int nWords = (nTiles + 63) >> 6;
+        rec->tileTouched.emplace_back(new std::atomic<uint64_t>[nWords]());
+    }
+    std::lock_guard<std::mutex> lock(accessRecordMutex);
+    accessRecords.push_back(std::move(rec));
+    return accessRecords.back().get();
+}
+
+void ReportTextureAccessStats(FILE *dest) {
+    std::lock_guard<std::mutex> lock(accessRecordMutex);
+    if (accessRecords.empty()) return;
+    fprintf(dest, "Texture access report\n");
+    for (const auto &rec : accessRecords) {
+        uint64_t totalLookups = 0;
+        int finest = (int)rec->levelRes.size();
+        for (int i = 0; i < (int)rec->levelRes.size(); ++i) {
+            uint64_t n = rec->levelLookups[i].load(std::memory_order_relaxed);
+            totalLookups += n;
+            if (n > 0) finest = std::min(finest, i);
+        }
+        fprintf(dest, "  %s (%dx%d)\n", rec->name.c_str(),
+                rec->resolution.x, rec->resolution.y);
+        if (totalLookups == 0) {
+            fprintf(dest, "    never sampled\n");
+            continue;
+        }
+        fprintf(dest, "    lookups per level:");
+        for (int i = 0; i < (int)rec->levelRes.size(); ++i)
+            fprintf(dest, " %llu",
+                    (unsigned long long)rec->levelLookups[i].load(
+                        std::memory_order_relaxed));
+        fprintf(dest, "\n");
+
+        // Report the tile coverage of the finest level actually sampled
+        // and the memory the unsampled finer levels cost
+        const Point2i &res = rec->levelRes[finest];
+        int nTiles = ((res.x + 31) >> 5) * ((res.y + 31) >> 5);
+        int touched = 0;
+        for (int w = 0; w < (nTiles + 63) >> 6; ++w) {
+            uint64_t bits =
+                rec->tileTouched[finest][w].load(std::memory_order_relaxed);
+            while (bits) {
+                ++touched;
+                bits &= bits - 1;
+            }
+        }
+        fprintf(dest,
+                "    finest level sampled: %d (%dx%d), %.1f%% of its tiles "
+                "touched\n",
+                finest, res.x, res.y, 100. * touched / nTiles);
+        size_t wastedBytes = 0;
+        for (int i = 0; i < finest; ++i)
+            wastedBytes += (size_t)rec->levelRes[i].x * rec->levelRes[i].y *
+                           rec->texelBytes;
+        if (wastedBytes > 0)
+            fprintf(dest, "    unsampled finer levels: %.1f MB\n",
+                    wastedBytes / (1024. * 1024.));
+    }
+}
+
+template <typename T>
+void Texture<T>::EvaluateN(const SurfaceInteraction si[], int n,
+                           T *out) const {
+    for (int i = 0; i < n; ++i) out[i] = Evaluate(si[i]);
+}
+
+template <typename T>
+T Texture<T>::EvaluateWithGradient(const SurfaceInteraction &si, Float du,
+                                   Float dv, T *dfdu, T *dfdv) const {
+    T f = Evaluate(si);
+    SurfaceInteraction siEval = si;
+
+    // Shift _siEval_ _du_ in the $u$ direction and difference
+    siEval.p = si.p + du * si.shading.dpdu;
+    siEval.uv = si.uv + Vector2f(du, 0.f);
+    siEval.n = Normalize((Normal3f)Cross(si.shading.dpdu, si.shading.dpdv) +
+                         du * si.dndu);
+    // _siEval_ copied _si_'s memoized texture evaluations, which are for
+    // the unshifted point; drop them before each shifted evaluation.
+    siEval.ClearTextureCache();
+    *dfdu = (Evaluate(siEval) - f) / du;
+
+    // Shift _siEval_ _dv_ in the $v$ direction and difference
+    siEval.p = si.p + dv * si.shading.dpdv;
+    siEval.uv = si.uv + Vector2f(0.f, dv);
+    siEval.n = Normalize((Normal3f)Cross(si.shading.dpdu, si.shading.dpdv) +
+                         dv * si.dndv);
+    siEval.ClearTextureCache();
+    *dfdv = (Evaluate(siEval) - f) / dv;
+    return f;
+}
+
+template class Texture<Float>;
+template class Texture<Spectrum>;
+
 }  // namespace pbrt
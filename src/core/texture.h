@@ -44,6 +44,12 @@
 #include "geometry.h"
 #include "transform.h"
 #include "memory.h"
+#include "interaction.h"
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
 
 namespace pbrt {
 
@@ -54,6 +60,9 @@ class TextureMapping2D {
     virtual ~TextureMapping2D();
     virtual Point2f Map(const SurfaceInteraction &si, Vector2f *dstdx,
                         Vector2f *dstdy) const = 0;
+    // Returns true when Map() depends on the interaction only through
+    // si.uv; see Texture::IsUVDriven().
+    virtual bool IsUVMapping() const { return false; }
 };
 
 class UVMapping2D : public TextureMapping2D {
@@ -62,6 +71,7 @@ class UVMapping2D : public TextureMapping2D {
     UVMapping2D(Float su = 1, Float sv = 1, Float du = 0, Float dv = 0);
     Point2f Map(const SurfaceInteraction &si, Vector2f *dstdx,
                 Vector2f *dstdy) const;
+    bool IsUVMapping() const { return true; }
 
   private:
     const Float su, sv, du, dv;
@@ -136,9 +146,78 @@ class Texture {
   public:
     // Texture Interface
     virtual T Evaluate(const SurfaceInteraction &) const = 0;
+    // Evaluate the texture at _n_ interactions at once. The default
+    // implementation just loops; procedural textures override it with
+    // batched SIMD kernels for shading paths that queue interactions.
+    virtual void EvaluateN(const SurfaceInteraction si[], int n,
+                           T *out) const;
+    // Evaluate the texture and its partial derivatives with respect to
+    // the surface's (u, v) parameterization, differenced over the offsets
+    // _du_ and _dv_; Material::Bump() uses this in place of three
+    // separate offset evaluations. The default implementation evaluates
+    // the texture at the correspondingly shifted interactions; image and
+    // constant textures override it to answer from a single lookup.
+    virtual T EvaluateWithGradient(const SurfaceInteraction &si, Float du,
+                                   Float dv, T *dfdu, T *dfdv) const;
+    // Returns true when Evaluate() depends on the interaction only
+    // through si.uv. TriangleMesh's packed alpha-cutout masks point
+    // sample the alpha texture over the UV domain alone, which is only
+    // valid for such textures; anything that reads si.p (planar,
+    // spherical, or 3D mappings, procedural solid textures) must answer
+    // false, the conservative default.
+    virtual bool IsUVDriven() const { return false; }
     virtual ~Texture() {}
 };
 
+// EvaluateN()'s default implementation needs the complete
+// SurfaceInteraction type, so it lives in texture.cpp with these
+// instantiations.
+extern template class Texture<Float>;
+extern template class Texture<Spectrum>;
+
+// Feeds the "Texture/Memoized evaluations reused" statistic; see
+// EvaluateMemoized() below.
+void ReportTextureMemoLookup(bool hit);
+
+// Adapters between a texture's result type and the Spectrum-valued
+// per-interaction cache; Float results are stored as constant spectra.
+template <typename T>
+struct TexCacheValue;
+template <>
+struct TexCacheValue<Float> {
+    static Spectrum Store(Float v) { return Spectrum(v); }
+    static Float Load(const Spectrum &s) { return s[0]; }
+};
+template <>
+struct TexCacheValue<Spectrum> {
+    static const Spectrum &Store(const Spectrum &v) { return v; }
+    static const Spectrum &Load(const Spectrum &s) { return s; }
+};
+
+// Evaluates _tex_ at _si_ through the interaction's small memoization
+// cache, so a texture referenced several times per shading point -- the
+// same map bound to multiple material parameters, or shared underneath
+// Scale/Mix wrappers -- is only evaluated once. Materials and wrapper
+// textures call this in place of Evaluate() for their texture inputs.
+template <typename T>
+inline T EvaluateMemoized(const std::shared_ptr<Texture<T>> &tex,
+                          const SurfaceInteraction &si) {
+    const void *key = (const void *)tex.get();
+    for (int i = 0; i < si.nTexCacheUsed; ++i)
+        if (si.texCacheKey[i] == key) {
+            ReportTextureMemoLookup(true);
+            return TexCacheValue<T>::Load(si.texCacheValue[i]);
+        }
+    ReportTextureMemoLookup(false);
+    T value = tex->Evaluate(si);
+    if (si.nTexCacheUsed < SurfaceInteraction::TexCacheSize) {
+        si.texCacheKey[si.nTexCacheUsed] = key;
+        si.texCacheValue[si.nTexCacheUsed] = TexCacheValue<T>::Store(value);
+        ++si.nTexCacheUsed;
+    }
+    return value;
+}
+
 Float Lanczos(Float, Float tau = 2);
 Float Noise(Float x, Float y = .5f, Float z = .5f);
 Float Noise(const Point3f &p);
@@ -147,6 +226,46 @@ Float FBm(const Point3f &p, const Vector3f &dpdx, const Vector3f &dpdy,
 Float Turbulence(const Point3f &p, const Vector3f &dpdx, const Vector3f &dpdy,
                  Float omega, int octaves);
 
+// Texture access instrumentation, enabled with --texreport: each MIPMap
+// registers a record and notes the MIP level and 32x32-texel tile of
+// every filtered lookup, and ReportTextureAccessStats() prints a
+// per-texture report of the finest level actually sampled and the
+// residency it wasted, to guide downresing assets offline.
+struct TextureAccessRecord {
+    std::string name = "(unnamed MIP map)";
+    Point2i resolution;
+    int texelBytes;
+    std::vector<Point2i> levelRes;
+    std::vector<std::atomic<uint64_t>> levelLookups;
+    // One bit per 32x32-texel tile, per level
+    std::vector<std::unique_ptr<std::atomic<uint64_t>[]>> tileTouched;
+};
+
+TextureAccessRecord *RegisterTextureAccess(
+    const Point2i &resolution, const std::vector<Point2i> &levelRes,
+    int texelBytes);
+void ReportTextureAccessStats(FILE *dest);
+
+inline void NoteTextureAccess(TextureAccessRecord *rec, int level, int s,
+                              int t) {
+    rec->levelLookups[level].fetch_add(1, std::memory_order_relaxed);
+    const Point2i &res = rec->levelRes[level];
+    s = Clamp(s, 0, res.x - 1);
+    t = Clamp(t, 0, res.y - 1);
+    int tile = (t >> 5) * ((res.x + 31) >> 5) + (s >> 5);
+    rec->tileTouched[level][tile >> 6].fetch_or(1ull << (tile & 63),
+                                                std::memory_order_relaxed);
+}
+
+// Batched variants evaluating _n_ points at once; with AVX2 the noise
+// lattice hashes and gradients are computed eight points per instruction.
+void NoiseN(const Point3f p[], int n, Float out[]);
+void FBmN(const Point3f p[], const Vector3f dpdx[], const Vector3f dpdy[],
+          int n, Float omega, int octaves, Float out[]);
+void TurbulenceN(const Point3f p[], const Vector3f dpdx[],
+                 const Vector3f dpdy[], int n, Float omega, int octaves,
+                 Float out[]);
+
 }  // namespace pbrt
 
 #endif  // PBRT_CORE_TEXTURE_H
@@ -287,6 +287,15 @@ SurfaceInteraction Transform::operator()(const SurfaceInteraction &si) const {
     ret.dvdy = si.dvdy;
     ret.dpdx = t(si.dpdx);
     ret.dpdy = t(si.dpdy);
+    // Carry over the deferred-differential state, transforming the stashed
+    // auxiliary rays in case the solve hasn't run yet
+    ret.differentialsComputed = si.differentialsComputed;
+    if (!si.differentialsComputed) {
+        ret.rxOrigin = t(si.rxOrigin);
+        ret.ryOrigin = t(si.ryOrigin);
+        ret.rxDirection = t(si.rxDirection);
+        ret.ryDirection = t(si.ryDirection);
+    }
     ret.bsdf = si.bsdf;
     ret.bssrdf = si.bssrdf;
     ret.primitive = si.primitive;
@@ -1246,4 +1255,59 @@ Bounds3f AnimatedTransform::BoundPointMotion(const Point3f &p) const {
     return bounds;
 }
 
+// CompactRigidTransform Method Definitions
+bool CompactRigidTransform::FromTransform(const Transform &t,
+                                          CompactRigidTransform *crt) {
+    const Matrix4x4 &m = t.GetMatrix();
+    // Reject matrices with a perspective component
+    if (m.m[3][0] != 0 || m.m[3][1] != 0 || m.m[3][2] != 0 || m.m[3][3] != 1)
+        return false;
+
+    // The upper 3x3 of a rigid transform with uniform scale $s$ is $sR$
+    // with $R$ a rotation, so every column has length $s$; a reflection
+    // would need a negative scale, which the encoding doesn't represent.
+    Float s = std::sqrt(m.m[0][0] * m.m[0][0] + m.m[1][0] * m.m[1][0] +
+                        m.m[2][0] * m.m[2][0]);
+    if (s == 0) return false;
+    Matrix4x4 r;
+    for (int i = 0; i < 3; ++i)
+        for (int j = 0; j < 3; ++j) r.m[i][j] = m.m[i][j] / s;
+    crt->rotation = Quaternion(Transform(r, Transpose(r)));
+    crt->translation = Vector3f(m.m[0][3], m.m[1][3], m.m[2][3]);
+    crt->scale = s;
+
+    // Accept the encoding only if it reproduces the matrix; shear,
+    // non-uniform scale, and reflections all fail this test.
+    Matrix4x4 re = crt->ToTransform().GetMatrix();
+    Float maxCoeff = 0;
+    for (int i = 0; i < 4; ++i)
+        for (int j = 0; j < 4; ++j)
+            maxCoeff = std::max(maxCoeff, std::abs(m.m[i][j]));
+    for (int i = 0; i < 4; ++i)
+        for (int j = 0; j < 4; ++j)
+            if (std::abs(re.m[i][j] - m.m[i][j]) > 1e-4f * maxCoeff)
+                return false;
+    return true;
+}
+
+Transform CompactRigidTransform::ToTransform() const {
+    Transform r = rotation.ToTransform();
+    Matrix4x4 m = r.GetMatrix(), mInv = Transpose(r.GetMatrix());
+    // Compose $T R S$; the inverse $S^{-1} R^{-1} T^{-1}$ comes from the
+    // same pieces rather than a general matrix inversion.
+    Float invS = 1 / scale;
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            m.m[i][j] *= scale;
+            mInv.m[i][j] *= invS;
+        }
+        m.m[i][3] = translation[i];
+    }
+    for (int i = 0; i < 3; ++i)
+        mInv.m[i][3] = -(mInv.m[i][0] * translation.x +
+                         mInv.m[i][1] * translation.y +
+                         mInv.m[i][2] * translation.z);
+    return Transform(m, mInv);
+}
+
 }  // namespace pbrt
@@ -424,6 +424,8 @@ class AnimatedTransform {
     bool HasScale() const {
         return startTransform->HasScale() || endTransform->HasScale();
     }
+    bool IsAnimated() const { return actuallyAnimated; }
+    const Transform &StartTransform() const { return *startTransform; }
     Bounds3f MotionBounds(const Bounds3f &b) const;
     Bounds3f BoundPointMotion(const Point3f &p) const;
 
@@ -448,6 +450,28 @@ class AnimatedTransform {
     DerivativeTerm c1[3], c2[3], c3[3], c4[3], c5[3];
 };
 
+// CompactRigidTransform Declarations
+// Rotation quaternion + translation + uniform scale encoding of a rigid
+// transform: eight floats instead of the thirty-two a Transform stores.
+// TransformedPrimitive keeps instance transforms in this form when they
+// are rigid and reconstitutes the matrices (with the inverse derived
+// analytically from the same pieces) on demand.
+class CompactRigidTransform {
+  public:
+    // CompactRigidTransform Public Methods
+    CompactRigidTransform() : scale(1) {}
+    // Attempts to encode _t_; returns false if the matrix has
+    // perspective, shear, non-uniform scale, or a reflection.
+    static bool FromTransform(const Transform &t, CompactRigidTransform *crt);
+    Transform ToTransform() const;
+
+  private:
+    // CompactRigidTransform Private Data
+    Quaternion rotation;
+    Vector3f translation;
+    Float scale;
+};
+
 }  // namespace pbrt
 
 #endif  // PBRT_CORE_TRANSFORM_H
@@ -355,13 +355,28 @@ static int ply_read_header_magic(p_ply ply) {
  * ---------------------------------------------------------------------- */
 p_ply ply_open(const char *name, p_ply_error_cb error_cb, long idata,
                void *pdata) {
-    FILE *fp = NULL;
+    FILE *fp;
+    assert(name);
+    fp = fopen(name, "rb");
+    if (!fp) {
+        p_ply ply = ply_alloc();
+        if (error_cb == NULL) error_cb = ply_error_cb;
+        error_cb(ply, "Unable to open file");
+        free(ply);
+        return NULL;
+    }
+    return ply_open_from_file(fp, error_cb, idata, pdata);
+}
+
+p_ply ply_open_from_file(FILE *fp, p_ply_error_cb error_cb, long idata,
+                         void *pdata) {
     p_ply ply = ply_alloc();
     if (error_cb == NULL) error_cb = ply_error_cb;
     if (!ply) {
         error_cb(NULL, "Out of memory");
         return NULL;
     }
+    assert(fp);
     ply->idata = idata;
     ply->pdata = pdata;
     ply->io_mode = PLY_READ;
@@ -371,13 +386,6 @@ p_ply ply_open(const char *name, p_ply_error_cb error_cb, long idata,
         free(ply);
         return NULL;
     }
-    assert(name);
-    fp = fopen(name, "rb");
-    if (!fp) {
-        error_cb(ply, "Unable to open file");
-        free(ply);
-        return NULL;
-    }
     ply->fp = fp;
     return ply;
 }
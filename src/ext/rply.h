@@ -16,6 +16,8 @@
  * at the end of this file.
  * ---------------------------------------------------------------------- */
 
+#include <stdio.h>
+
 #define RPLY_VERSION "RPly 1.1.3"
 #define RPLY_COPYRIGHT "Copyright (C) 2003-2013 Diego Nehab"
 #define RPLY_AUTHORS "Diego Nehab"
@@ -86,6 +88,19 @@ int ply_get_ply_user_data(p_ply ply, void **pdata, long *idata);
 p_ply ply_open(const char *name, p_ply_error_cb error_cb, long idata,
                void *pdata);
 
+/* ----------------------------------------------------------------------
+ * Opens a PLY file for reading from an already-open file handle, which
+ * the returned handle takes ownership of.
+ *
+ * fp: file pointer open for reading in binary mode
+ * error_cb: error callback function
+ * idata,pdata: contextual information available to users
+ *
+ * Returns 1 if successful, 0 otherwise
+ * ---------------------------------------------------------------------- */
+p_ply ply_open_from_file(FILE *fp, p_ply_error_cb error_cb, long idata,
+               void *pdata);
+
 /* ----------------------------------------------------------------------
  * Reads and parses the header of a PLY file returned by ply_open
  *
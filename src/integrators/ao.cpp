@@ -78,7 +78,13 @@ Spectrum AOIntegrator::Li(const RayDifferential &r, const Scene &scene,
         Vector3f s = Normalize(isect.dpdu);
         Vector3f t = Cross(isect.n, s);
 
+        // Generate the full batch of hemisphere directions before tracing
+        // any rays; occlusion rays leaving a single point are perfectly
+        // coherent, so resolving them all with one IntersectPN() pass keeps
+        // BVH traversal in cache rather than interleaving it with sampling.
         const Point2f *u = sampler.Get2DArray(nSamples);
+        Ray *rays = arena.Alloc<Ray>(nSamples, false);
+        Float *weights = arena.Alloc<Float>(nSamples, false);
         for (int i = 0; i < nSamples; ++i) {
             Vector3f wi;
             Float pdf;
@@ -95,9 +101,15 @@ Spectrum AOIntegrator::Li(const RayDifferential &r, const Scene &scene,
                           s.y * wi.x + t.y * wi.y + n.y * wi.z,
                           s.z * wi.x + t.z * wi.y + n.z * wi.z);
 
-            if (!scene.IntersectP(isect.SpawnRay(wi)))
-                L += Dot(wi, n) / (pdf * nSamples);
+            rays[i] = isect.SpawnRay(wi);
+            weights[i] = Dot(wi, n) / (pdf * nSamples);
         }
+
+        // Resolve the batch with one bulk-occlusion pass
+        bool *occluded = arena.Alloc<bool>(nSamples, false);
+        scene.IntersectPN(RaySpan(rays, nSamples), occluded);
+        for (int i = 0; i < nSamples; ++i)
+            if (!occluded[i]) L += weights[i];
     }
     return L;
 }
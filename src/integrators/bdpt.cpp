@@ -32,6 +32,7 @@
 
 // integrators/bdpt.cpp*
 #include "integrators/bdpt.h"
+#include "samplers/random.h"
 #include "film.h"
 #include "filters/box.h"
 #include "integrator.h"
@@ -178,7 +179,10 @@ int RandomWalk(const Scene &scene, RayDifferential ray, Sampler &sampler,
 
             // Compute scattering functions for _mode_ and skip over medium
             // boundaries
-            isect.ComputeScatteringFunctions(ray, arena, true, mode);
+            // The vertex keeps _isect.bsdf_ alive across the whole path, so its
+            // allocations must come from _arena_, not the interaction itself.
+            isect.ComputeScatteringFunctions(ray, arena, true, mode,
+                                             /*allowInlineStorage=*/false);
             if (!isect.bsdf) {
                 ray = isect.SpawnRay(ray.d);
                 continue;
@@ -355,6 +359,32 @@ void BDPTIntegrator::Render(const Scene &scene) {
             Bounds2i tileBounds(Point2i(x0, y0), Point2i(x1, y1));
             LOG(INFO) << "Starting image tile " << tileBounds;
 
+            // Generate the tile's shared pool of light subpaths, if
+            // enabled; the tile's camera subpaths connect against these
+            // instead of each tracing its own.  Pool paths sample their
+            // own shutter times, so scenes with animated geometry see
+            // slightly mismatched camera and light path times.
+            MemoryArena lightPoolArena;
+            std::vector<std::pair<Vertex *, int>> lightPathPool;
+            const Distribution1D *poolLightDistr = nullptr;
+            RNG rng(seed);
+            if (lightPathsPerTile > 0) {
+                RandomSampler poolSampler(1, seed);
+                poolSampler.StartPixel(Point2i(tile.x, tile.y));
+                poolLightDistr = lightDistribution->Lookup(Point3f(0, 0, 0));
+                for (int i = 0; i < lightPathsPerTile; ++i) {
+                    Vertex *lightVertices =
+                        lightPoolArena.Alloc<Vertex>(maxDepth + 1);
+                    Float time = Lerp(poolSampler.Get1D(),
+                                      camera->shutterOpen,
+                                      camera->shutterClose);
+                    int nLight = GenerateLightSubpath(
+                        scene, poolSampler, lightPoolArena, maxDepth + 1,
+                        time, *poolLightDistr, lightToIndex, lightVertices);
+                    lightPathPool.push_back({lightVertices, nLight});
+                }
+            }
+
             std::unique_ptr<FilmTile> filmTile =
                 camera->film->GetFilmTile(tileBounds);
             for (Point2i pPixel : tileBounds) {
@@ -367,56 +397,93 @@ void BDPTIntegrator::Render(const Scene &scene) {
 
                     // Trace the camera subpath
                     Vertex *cameraVertices = arena.Alloc<Vertex>(maxDepth + 2);
-                    Vertex *lightVertices = arena.Alloc<Vertex>(maxDepth + 1);
                     int nCamera = GenerateCameraSubpath(
                         scene, *tileSampler, arena, maxDepth + 2, *camera,
                         pFilm, cameraVertices);
-                    // Get a distribution for sampling the light at the
-                    // start of the light subpath. Because the light path
-                    // follows multiple bounces, basing the sampling
-                    // distribution on any of the vertices of the camera
-                    // path is unlikely to be a good strategy. We use the
-                    // PowerLightDistribution by default here, which
-                    // doesn't use the point passed to it.
-                    const Distribution1D *lightDistr =
-                        lightDistribution->Lookup(cameraVertices[0].p());
-                    // Now trace the light subpath
-                    int nLight = GenerateLightSubpath(
-                        scene, *tileSampler, arena, maxDepth + 1,
-                        cameraVertices[0].time(), *lightDistr, lightToIndex,
-                        lightVertices);
 
-                    // Execute all BDPT connection strategies
+                    // Execute the $(s, t)$ connection strategy, scale the
+                    // path's contribution by _scale_, and update _L_
                     Spectrum L(0.f);
-                    for (int t = 1; t <= nCamera; ++t) {
-                        for (int s = 0; s <= nLight; ++s) {
-                            int depth = t + s - 2;
-                            if ((s == 1 && t == 1) || depth < 0 ||
-                                depth > maxDepth)
-                                continue;
-                            // Execute the $(s, t)$ connection strategy and
-                            // update _L_
-                            Point2f pFilmNew = pFilm;
-                            Float misWeight = 0.f;
-                            Spectrum Lpath = ConnectBDPT(
-                                scene, lightVertices, cameraVertices, s, t,
-                                *lightDistr, lightToIndex, *camera, *tileSampler,
-                                &pFilmNew, &misWeight);
-                            VLOG(2) << "Connect bdpt s: " << s <<", t: " << t <<
-                                ", Lpath: " << Lpath << ", misWeight: " << misWeight;
-                            if (visualizeStrategies || visualizeWeights) {
-                                Spectrum value;
-                                if (visualizeStrategies)
-                                    value =
-                                        misWeight == 0 ? 0 : Lpath / misWeight;
-                                if (visualizeWeights) value = Lpath;
-                                weightFilms[BufferIndex(s, t)]->AddSplat(
-                                    pFilmNew, value);
+                    auto RunStrategy = [&](Vertex *lightVertices, int s,
+                                           int t, const Distribution1D &distr,
+                                           Float scale) {
+                        Point2f pFilmNew = pFilm;
+                        Float misWeight = 0.f;
+                        Spectrum Lpath = ConnectBDPT(
+                            scene, lightVertices, cameraVertices, s, t, distr,
+                            lightToIndex, *camera, *tileSampler, &pFilmNew,
+                            &misWeight);
+                        VLOG(2) << "Connect bdpt s: " << s << ", t: " << t
+                                << ", Lpath: " << Lpath
+                                << ", misWeight: " << misWeight;
+                        if (visualizeStrategies || visualizeWeights) {
+                            Spectrum value;
+                            if (visualizeStrategies)
+                                value = misWeight == 0 ? 0 : Lpath / misWeight;
+                            if (visualizeWeights) value = Lpath;
+                            weightFilms[BufferIndex(s, t)]->AddSplat(pFilmNew,
+                                                                     value);
+                        }
+                        if (t != 1)
+                            L += scale * Lpath;
+                        else
+                            film->AddSplat(pFilmNew, scale * Lpath);
+                    };
+
+                    if (lightPathsPerTile > 0) {
+                        // The $s = 0$ strategies use no light subpath;
+                        // execute them once
+                        for (int t = 2; t <= nCamera; ++t)
+                            if (t - 2 <= maxDepth)
+                                RunStrategy(nullptr, 0, t, *poolLightDistr, 1);
+
+                        // Average the remaining strategies over
+                        // _nLightConnections_ cached light subpaths; each
+                        // connection is an independent unbiased estimator,
+                        // so the average is too
+                        Float invN = (Float)1 / nLightConnections;
+                        for (int j = 0; j < nLightConnections; ++j) {
+                            const auto &lightPath = lightPathPool
+                                [rng.UniformUInt32(lightPathPool.size())];
+                            for (int t = 1; t <= nCamera; ++t) {
+                                for (int s = 1; s <= lightPath.second; ++s) {
+                                    int depth = t + s - 2;
+                                    if ((s == 1 && t == 1) || depth < 0 ||
+                                        depth > maxDepth)
+                                        continue;
+                                    RunStrategy(lightPath.first, s, t,
+                                                *poolLightDistr, invN);
+                                }
+                            }
+                        }
+                    } else {
+                        // Get a distribution for sampling the light at the
+                        // start of the light subpath. Because the light path
+                        // follows multiple bounces, basing the sampling
+                        // distribution on any of the vertices of the camera
+                        // path is unlikely to be a good strategy. We use the
+                        // PowerLightDistribution by default here, which
+                        // doesn't use the point passed to it.
+                        const Distribution1D *lightDistr =
+                            lightDistribution->Lookup(cameraVertices[0].p());
+                        // Now trace the light subpath
+                        Vertex *lightVertices =
+                            arena.Alloc<Vertex>(maxDepth + 1);
+                        int nLight = GenerateLightSubpath(
+                            scene, *tileSampler, arena, maxDepth + 1,
+                            cameraVertices[0].time(), *lightDistr,
+                            lightToIndex, lightVertices);
+
+                        // Execute all BDPT connection strategies
+                        for (int t = 1; t <= nCamera; ++t) {
+                            for (int s = 0; s <= nLight; ++s) {
+                                int depth = t + s - 2;
+                                if ((s == 1 && t == 1) || depth < 0 ||
+                                    depth > maxDepth)
+                                    continue;
+                                RunStrategy(lightVertices, s, t, *lightDistr,
+                                            1);
                             }
-                            if (t != 1)
-                                L += Lpath;
-                            else
-                                film->AddSplat(pFilmNew, Lpath);
                         }
                     }
                     VLOG(2) << "Add film sample pFilm: " << pFilm << ", L: " << L <<
@@ -425,7 +492,11 @@ void BDPTIntegrator::Render(const Scene &scene) {
                     arena.Reset();
                 } while (tileSampler->StartNextSample());
             }
-            film->MergeFilmTile(std::move(filmTile));
+            if (PbrtOptions.deterministic)
+                film->MergeFilmTileOrdered(std::move(filmTile), seed,
+                                           nXTiles * nYTiles);
+            else
+                film->MergeFilmTile(std::move(filmTile));
             reporter.Update();
             LOG(INFO) << "Finished image tile " << tileBounds;
         }, Point2i(nXTiles, nYTiles));
@@ -564,8 +635,12 @@ BDPTIntegrator *CreateBDPTIntegrator(const ParamSet &params,
 
     std::string lightStrategy = params.FindOneString("lightsamplestrategy",
                                                      "power");
+    int lightPathsPerTile = params.FindOneInt("lightpathspertile", 0);
+    int nLightConnections =
+        std::max(1, params.FindOneInt("lightconnections", 1));
     return new BDPTIntegrator(sampler, camera, maxDepth, visualizeStrategies,
-                              visualizeWeights, pixelBounds, lightStrategy);
+                              visualizeWeights, pixelBounds, lightStrategy,
+                              lightPathsPerTile, nLightConnections);
 }
 
 }  // namespace pbrt
@@ -132,14 +132,17 @@ class BDPTIntegrator : public Integrator {
                    std::shared_ptr<const Camera> camera, int maxDepth,
                    bool visualizeStrategies, bool visualizeWeights,
                    const Bounds2i &pixelBounds,
-                   const std::string &lightSampleStrategy = "power")
+                   const std::string &lightSampleStrategy = "power",
+                   int lightPathsPerTile = 0, int nLightConnections = 1)
         : sampler(sampler),
           camera(camera),
           maxDepth(maxDepth),
           visualizeStrategies(visualizeStrategies),
           visualizeWeights(visualizeWeights),
           pixelBounds(pixelBounds),
-          lightSampleStrategy(lightSampleStrategy) {}
+          lightSampleStrategy(lightSampleStrategy),
+          lightPathsPerTile(lightPathsPerTile),
+          nLightConnections(nLightConnections) {}
     void Render(const Scene &scene);
 
   private:
@@ -151,6 +154,12 @@ class BDPTIntegrator : public Integrator {
     const bool visualizeWeights;
     const Bounds2i pixelBounds;
     const std::string lightSampleStrategy;
+    // When positive, each tile generates this many light subpaths up
+    // front and every camera subpath connects against _nLightConnections_
+    // of them instead of tracing its own, amortizing light transport work
+    // across the tile's pixels.
+    const int lightPathsPerTile;
+    const int nLightConnections;
 };
 
 struct Vertex {
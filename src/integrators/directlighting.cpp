@@ -83,6 +83,9 @@ Spectrum DirectLightingIntegrator::Li(const RayDifferential &ray,
         if (strategy == LightStrategy::UniformSampleAll)
             L += UniformSampleAllLights(isect, scene, arena, sampler,
                                         nLightSamples);
+        else if (strategy == LightStrategy::ReservoirSampleOne)
+            L += ReservoirSampleOneLight(isect, scene, arena, sampler,
+                                         nLightCandidates);
         else
             L += UniformSampleOneLight(isect, scene, arena, sampler);
     }
@@ -104,6 +107,8 @@ DirectLightingIntegrator *CreateDirectLightingIntegrator(
         strategy = LightStrategy::UniformSampleOne;
     else if (st == "all")
         strategy = LightStrategy::UniformSampleAll;
+    else if (st == "restir")
+        strategy = LightStrategy::ReservoirSampleOne;
     else {
         Warning(
             "Strategy \"%s\" for direct lighting unknown. "
@@ -125,8 +130,9 @@ DirectLightingIntegrator *CreateDirectLightingIntegrator(
                 Error("Degenerate \"pixelbounds\" specified.");
         }
     }
+    int nLightCandidates = params.FindOneInt("lightcandidates", 32);
     return new DirectLightingIntegrator(strategy, maxDepth, camera, sampler,
-                                        pixelBounds);
+                                        pixelBounds, nLightCandidates);
 }
 
 }  // namespace pbrt
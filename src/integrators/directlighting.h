@@ -46,7 +46,11 @@
 namespace pbrt {
 
 // LightStrategy Declarations
-enum class LightStrategy { UniformSampleAll, UniformSampleOne };
+enum class LightStrategy {
+    UniformSampleAll,
+    UniformSampleOne,
+    ReservoirSampleOne
+};
 
 // DirectLightingIntegrator Declarations
 class DirectLightingIntegrator : public SamplerIntegrator {
@@ -55,10 +59,12 @@ class DirectLightingIntegrator : public SamplerIntegrator {
     DirectLightingIntegrator(LightStrategy strategy, int maxDepth,
                              std::shared_ptr<const Camera> camera,
                              std::shared_ptr<Sampler> sampler,
-                             const Bounds2i &pixelBounds)
+                             const Bounds2i &pixelBounds,
+                             int nLightCandidates = 32)
         : SamplerIntegrator(camera, sampler, pixelBounds),
           strategy(strategy),
-          maxDepth(maxDepth) {}
+          maxDepth(maxDepth),
+          nLightCandidates(nLightCandidates) {}
     Spectrum Li(const RayDifferential &ray, const Scene &scene,
                 Sampler &sampler, MemoryArena &arena, int depth) const;
     void Preprocess(const Scene &scene, Sampler &sampler);
@@ -67,6 +73,9 @@ class DirectLightingIntegrator : public SamplerIntegrator {
     // DirectLightingIntegrator Private Data
     const LightStrategy strategy;
     const int maxDepth;
+    // Candidate light samples per shading point for the
+    // ReservoirSampleOne strategy.
+    const int nLightCandidates;
     std::vector<int> nLightSamples;
 };
 
@@ -0,0 +1,589 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+// integrators/guidedpath.cpp*
+#include "integrators/guidedpath.h"
+#include "bssrdf.h"
+#include "camera.h"
+#include "film.h"
+#include "interaction.h"
+#include "parallel.h"
+#include "paramset.h"
+#include "scene.h"
+#include "stats.h"
+#include "samplers/random.h"
+
+#include <atomic>
+
+namespace pbrt {
+
+STAT_INT_DISTRIBUTION("Integrator/Path length", pathLength);
+STAT_COUNTER("Integrator/Guided directional tree nodes", nDTreeNodes);
+STAT_COUNTER("Integrator/Guided spatial tree leaves", nSTreeLeaves);
+STAT_PERCENT("Integrator/Guided bounces", nGuidedBounces, nGuidableBounces);
+
+// SD-Tree Local Definitions
+
+// Directions are stored in the unit square under the cylindrical
+// equal-area map, so a uniform density over $[0,1)^2$ corresponds to a
+// uniform density over the sphere and the quadtree's area fractions are
+// solid angle fractions.
+static Point2f DirToCanonical(const Vector3f &d) {
+    Float cosTheta = Clamp(d.z, -1, 1);
+    Float phi = std::atan2(d.y, d.x);
+    if (phi < 0) phi += 2 * Pi;
+    return Point2f(std::min(phi * Inv2Pi, OneMinusEpsilon),
+                   std::min((cosTheta + 1) / 2, OneMinusEpsilon));
+}
+
+static Vector3f CanonicalToDir(const Point2f &u) {
+    Float cosTheta = 2 * u.y - 1;
+    Float sinTheta = std::sqrt(std::max((Float)0, 1 - cosTheta * cosTheta));
+    Float phi = 2 * Pi * u.x;
+    return Vector3f(sinTheta * std::cos(phi), sinTheta * std::sin(phi),
+                    cosTheta);
+}
+
+// A quadtree over the unit square of directions; each node stores the
+// flux recorded in its four quadrants, and quadrants holding more than a
+// small fraction of the total flux are subdivided when the tree is
+// refined.  Recording is lock-free so rendering threads can keep training
+// the distribution while others sample from it.
+struct DTreeNode {
+    DTreeNode() {}
+    DTreeNode(const DTreeNode &other) {
+        for (int i = 0; i < 4; ++i) {
+            sum[i] = Float(other.sum[i]);
+            children[i] = other.children[i];
+        }
+    }
+    AtomicFloat sum[4];
+    // Index of the quadrant's interior child node, or zero for a leaf
+    // quadrant (the root can never be a child).
+    uint16_t children[4] = {0, 0, 0, 0};
+};
+
+class DTree {
+  public:
+    // DTree Public Methods
+    DTree() : nodes(1) {}
+    DTree(const DTree &other) : nodes(other.nodes) {}
+    Float Total() const {
+        Float total = 0;
+        for (int i = 0; i < 4; ++i) total += nodes[0].sum[i];
+        return total;
+    }
+    void Record(Point2f u, Float flux) {
+        int node = 0;
+        while (true) {
+            int x = u.x < .5f ? 0 : 1, y = u.y < .5f ? 0 : 1;
+            u.x = x ? 2 * u.x - 1 : 2 * u.x;
+            u.y = y ? 2 * u.y - 1 : 2 * u.y;
+            int q = x + 2 * y;
+            nodes[node].sum[q].Add(flux);
+            int c = nodes[node].children[q];
+            if (c == 0) return;
+            node = c;
+        }
+    }
+    Point2f SampleCanonical(Point2f u, Float *pdf) const;
+    Float PdfCanonical(Point2f u) const;
+    // Solid-angle density of sampling direction _w_; the equal-area map
+    // makes this the canonical density over $4\pi$.
+    Float PdfW(const Vector3f &w) const {
+        return PdfCanonical(DirToCanonical(w)) * Inv4Pi;
+    }
+    void Refine(Float rho);
+    size_t Nodes() const { return nodes.size(); }
+
+  private:
+    // DTree Private Data
+    static const int maxDepth = 16;
+    std::vector<DTreeNode> nodes;
+};
+
+Point2f DTree::SampleCanonical(Point2f u, Float *pdf) const {
+    *pdf = 1;
+    int node = 0;
+    Point2f lo(0, 0);
+    Float scale = 1;
+    while (true) {
+        const DTreeNode &n = nodes[node];
+        Float w[4], total = 0;
+        for (int i = 0; i < 4; ++i) total += w[i] = n.sum[i];
+        // Finish uniformly within an unpopulated region
+        if (total <= 0)
+            return Point2f(lo.x + scale * u.x, lo.y + scale * u.y);
+
+        // Choose between the node's two columns, then between the chosen
+        // column's two quadrants, remapping _u_ each time
+        int x, y;
+        Float pLeft = (w[0] + w[2]) / total;
+        if (u.x < pLeft) {
+            x = 0;
+            u.x = std::min(u.x / pLeft, OneMinusEpsilon);
+        } else {
+            x = 1;
+            u.x = std::min((u.x - pLeft) / (1 - pLeft), OneMinusEpsilon);
+        }
+        Float pDown = w[x] / (w[x] + w[x + 2]);
+        if (u.y < pDown) {
+            y = 0;
+            u.y = std::min(u.y / pDown, OneMinusEpsilon);
+        } else {
+            y = 1;
+            u.y = std::min((u.y - pDown) / (1 - pDown), OneMinusEpsilon);
+        }
+        int q = x + 2 * y;
+        *pdf *= 4 * w[q] / total;
+        scale *= .5f;
+        lo.x += x * scale;
+        lo.y += y * scale;
+        int c = n.children[q];
+        if (c == 0)
+            return Point2f(lo.x + scale * u.x, lo.y + scale * u.y);
+        node = c;
+    }
+}
+
+Float DTree::PdfCanonical(Point2f u) const {
+    Float pdf = 1;
+    int node = 0;
+    while (true) {
+        const DTreeNode &n = nodes[node];
+        Float w[4], total = 0;
+        for (int i = 0; i < 4; ++i) total += w[i] = n.sum[i];
+        if (total <= 0) return pdf;
+        int x = u.x < .5f ? 0 : 1, y = u.y < .5f ? 0 : 1;
+        u.x = x ? 2 * u.x - 1 : 2 * u.x;
+        u.y = y ? 2 * u.y - 1 : 2 * u.y;
+        int q = x + 2 * y;
+        if (w[q] <= 0) return 0;
+        pdf *= 4 * w[q] / total;
+        int c = n.children[q];
+        if (c == 0) return pdf;
+        node = c;
+    }
+}
+
+void DTree::Refine(Float rho) {
+    // Rebuild the tree's structure from its current flux: quadrants with
+    // more than a _rho_ fraction of the total flux get (or keep) an
+    // interior child, and existing children that fell below the threshold
+    // are collapsed.  Fresh children start with their parent quadrant's
+    // flux spread evenly.
+    Float total = Total();
+    std::vector<DTreeNode> newNodes(1);
+    struct BuildItem {
+        int oldNode, newNode, depth;
+    };
+    std::vector<BuildItem> todo = {{0, 0, 0}};
+    while (!todo.empty()) {
+        BuildItem item = todo.back();
+        todo.pop_back();
+        for (int q = 0; q < 4; ++q) {
+            Float s = nodes[item.oldNode].sum[q];
+            newNodes[item.newNode].sum[q] = s;
+            if (!(total > 0 && s > rho * total) ||
+                item.depth + 1 >= maxDepth || newNodes.size() >= 65535)
+                continue;
+            int newChild = (int)newNodes.size();
+            newNodes.emplace_back();
+            newNodes[item.newNode].children[q] = (uint16_t)newChild;
+            int oldChild = nodes[item.oldNode].children[q];
+            if (oldChild != 0)
+                todo.push_back({oldChild, newChild, item.depth + 1});
+            else
+                for (int i = 0; i < 4; ++i) newNodes[newChild].sum[i] = s / 4;
+        }
+    }
+    nodes = std::move(newNodes);
+}
+
+// STree Declarations
+
+// A binary tree over the scene bounds, splitting in the middle of a
+// round-robin axis; each leaf holds a DTree over the directions of the
+// flux recorded in its region.  Leaves that have accumulated enough
+// records are split during refinement, with both halves inheriting a
+// copy of the leaf's directional tree.
+struct STreeNode {
+    STreeNode() {}
+    STreeNode(STreeNode &&other)
+        : axis(other.axis), dtree(std::move(other.dtree)) {
+        children[0] = other.children[0];
+        children[1] = other.children[1];
+        nRecords.store(other.nRecords.load(std::memory_order_relaxed),
+                       std::memory_order_relaxed);
+    }
+    int axis = 0;
+    int children[2] = {-1, -1};
+    std::unique_ptr<DTree> dtree;
+    std::atomic<int64_t> nRecords{0};
+};
+
+class STree {
+  public:
+    // STree Public Methods
+    STree(const Bounds3f &bounds) : bounds(bounds) {
+        nodes.emplace_back();
+        nodes[0].dtree.reset(new DTree);
+    }
+    DTree *Lookup(const Point3f &p) { return nodes[LeafIndex(p)].dtree.get(); }
+    void Record(const Point3f &p, const Point2f &uDir, Float flux) {
+        STreeNode &leaf = nodes[LeafIndex(p)];
+        leaf.dtree->Record(uDir, flux);
+        leaf.nRecords.fetch_add(1, std::memory_order_relaxed);
+    }
+    void Refine(int64_t maxRecords, Float rho);
+
+  private:
+    // STree Private Methods
+    int LeafIndex(const Point3f &p) const {
+        Vector3f offset = bounds.Offset(p);
+        Float t[3];
+        for (int i = 0; i < 3; ++i)
+            t[i] = Clamp(offset[i], (Float)0, OneMinusEpsilon);
+        int node = 0;
+        while (nodes[node].children[0] >= 0) {
+            int axis = nodes[node].axis;
+            if (t[axis] < .5f) {
+                t[axis] *= 2;
+                node = nodes[node].children[0];
+            } else {
+                t[axis] = 2 * t[axis] - 1;
+                node = nodes[node].children[1];
+            }
+        }
+        return node;
+    }
+
+    // STree Private Data
+    const Bounds3f bounds;
+    std::vector<STreeNode> nodes;
+};
+
+void STree::Refine(int64_t maxRecords, Float rho) {
+    // Split leaves whose regions are seeing many records so the
+    // directional distribution can vary over smaller regions of space
+    size_t nOriginal = nodes.size();
+    for (size_t i = 0; i < nOriginal; ++i) {
+        if (nodes[i].children[0] >= 0 ||
+            nodes[i].nRecords.load(std::memory_order_relaxed) <= maxRecords)
+            continue;
+        int c0 = (int)nodes.size(), c1 = c0 + 1;
+        nodes.emplace_back();
+        nodes.emplace_back();
+        int64_t half = nodes[i].nRecords.load(std::memory_order_relaxed) / 2;
+        nodes[c0].axis = nodes[c1].axis = (nodes[i].axis + 1) % 3;
+        nodes[c0].dtree.reset(new DTree(*nodes[i].dtree));
+        nodes[c1].dtree = std::move(nodes[i].dtree);
+        nodes[c0].nRecords = half;
+        nodes[c1].nRecords = half;
+        nodes[i].children[0] = c0;
+        nodes[i].children[1] = c1;
+    }
+
+    // Refine every leaf's directional tree and refresh the statistics
+    nDTreeNodes = nSTreeLeaves = 0;
+    for (STreeNode &node : nodes) {
+        if (!node.dtree) continue;
+        node.dtree->Refine(rho);
+        ++nSTreeLeaves;
+        nDTreeNodes += node.dtree->Nodes();
+    }
+}
+
+// GuidedPathIntegrator Method Definitions
+GuidedPathIntegrator::GuidedPathIntegrator(
+    int maxDepth, std::shared_ptr<const Camera> camera,
+    std::shared_ptr<Sampler> sampler, const Bounds2i &pixelBounds,
+    Float rrThreshold, const std::string &lightSampleStrategy,
+    Float bsdfSampleFraction, int nTrainingIterations)
+    : PathIntegrator(maxDepth, camera, sampler, pixelBounds, rrThreshold,
+                     lightSampleStrategy),
+      bsdfSampleFraction(bsdfSampleFraction),
+      nTrainingIterations(nTrainingIterations) {}
+
+GuidedPathIntegrator::~GuidedPathIntegrator() {}
+
+void GuidedPathIntegrator::Preprocess(const Scene &scene, Sampler &sampler) {
+    PathIntegrator::Preprocess(scene, sampler);
+    sdTree.reset(new STree(scene.WorldBound()));
+
+    // Train the SD-tree with prepass iterations of doubling size; Li()
+    // records every completed path's incident radiance into the tree, so
+    // training is just rendering a low-resolution image repeatedly and
+    // refining the tree between iterations.  The first iteration samples
+    // the BSDF alone (the tree holds no flux yet); later ones already
+    // guide, so the training sample distribution improves along with the
+    // tree.
+    const int res = 64;
+    Bounds2f sampleBounds = (Bounds2f)camera->film->GetSampleBounds();
+    for (int iter = 0; iter < nTrainingIterations; ++iter) {
+        int spp = 1 << iter;
+        ParallelFor2D(
+            [&](Point2i cell) {
+                MemoryArena arena;
+                RandomSampler tileSampler(spp,
+                                          iter * res * res +
+                                              cell.y * res + cell.x);
+                tileSampler.StartPixel(cell);
+                do {
+                    CameraSample cs;
+                    Point2f u = tileSampler.Get2D();
+                    cs.pFilm = sampleBounds.Lerp(Point2f(
+                        (cell.x + u.x) / res, (cell.y + u.y) / res));
+                    cs.pLens = tileSampler.Get2D();
+                    cs.time = tileSampler.Get1D();
+                    RayDifferential ray;
+                    if (camera->GenerateRayDifferential(cs, &ray) > 0)
+                        Li(ray, scene, tileSampler, arena, 0);
+                    arena.Reset();
+                } while (tileSampler.StartNextSample());
+            },
+            Point2i(res, res));
+        sdTree->Refine(int64_t(4000 * std::sqrt((Float)spp)), .01f);
+    }
+}
+
+Spectrum GuidedPathIntegrator::Li(const RayDifferential &r, const Scene &scene,
+                                  Sampler &sampler, MemoryArena &arena,
+                                  int depth) const {
+    ProfilePhase p(Prof::SamplerIntegratorLi);
+    Spectrum L(0.f), beta(1.f);
+    RayDifferential ray(r);
+    bool specularBounce = false;
+    int bounces;
+    Float etaScale = 1;
+
+    // Per-vertex training records: position, sampled direction in the
+    // canonical square, the (mixture) solid-angle density it was drawn
+    // with (negative when the bounce can't be guided), and the path
+    // throughput after the bounce.  _pathL_ holds the absolute luminance
+    // first visible at each vertex, so the radiance a vertex received
+    // from the rest of its path is a suffix sum over it.
+    std::vector<Point3f> vertexP;
+    std::vector<Point2f> vertexUDir;
+    std::vector<Float> vertexPdfW, vertexBetaY;
+    std::vector<Float> pathL;
+
+    for (bounces = 0;; ++bounces) {
+        // Intersect _ray_ with scene and store intersection in _isect_
+        SurfaceInteraction isect;
+        bool foundIntersection = scene.Intersect(ray, &isect);
+
+        // Possibly add emitted light at intersection
+        if (bounces == 0 || specularBounce) {
+            Spectrum Le(0.f);
+            if (foundIntersection)
+                Le = isect.Le(-ray.d);
+            else
+                for (const auto &light : scene.infiniteLights)
+                    Le += light->Le(ray);
+            if (!Le.IsBlack()) {
+                L.AddScaled(Le, beta);
+                if ((int)pathL.size() < bounces + 1)
+                    pathL.resize(bounces + 1, 0);
+                pathL[bounces] += beta.y() * Le.y();
+            }
+        }
+
+        // Terminate path if ray escaped or _maxDepth_ was reached
+        if (!foundIntersection || bounces >= maxDepth) break;
+
+        // Compute scattering functions and skip over medium boundaries
+        isect.ComputeScatteringFunctions(ray, arena, true);
+        if (!isect.bsdf) {
+            ray = isect.SpawnRay(ray.d);
+            bounces--;
+            continue;
+        }
+
+        const Distribution1D *distrib = lightDistribution->Lookup(isect.p);
+
+        // Sample illumination from lights to find path contribution.
+        // (But skip this for perfectly specular BSDFs.)
+        if (isect.bsdf->NumComponents(BxDFType(BSDF_ALL & ~BSDF_SPECULAR)) >
+            0) {
+            Spectrum Ld = beta * UniformSampleOneLight(isect, scene, arena,
+                                                       sampler, false,
+                                                       distrib);
+            CHECK_GE(Ld.y(), 0.f);
+            L += Ld;
+            if (!Ld.IsBlack()) {
+                if ((int)pathL.size() < bounces + 1)
+                    pathL.resize(bounces + 1, 0);
+                pathL[bounces] += Ld.y();
+            }
+        }
+
+        // Sample a new path direction from the BSDF/guiding mixture
+        Vector3f wo = -ray.d, wi;
+        Float pdf;
+        BxDFType flags = BSDF_ALL;
+        Spectrum f;
+        DTree *dtree = sdTree ? sdTree->Lookup(isect.p) : nullptr;
+        bool guidable =
+            dtree && dtree->Total() > 0 &&
+            isect.bsdf->NumComponents(BxDFType(BSDF_ALL & ~BSDF_SPECULAR)) >
+                0;
+        if (guidable) ++nGuidableBounces;
+        if (guidable && sampler.Get1D() >= bsdfSampleFraction) {
+            // Sample the guiding distribution and combine the densities
+            // with the balance heuristic over the one-sample mixture
+            ++nGuidedBounces;
+            Float guidePdfCanonical;
+            Point2f uDir = dtree->SampleCanonical(sampler.Get2D(),
+                                                  &guidePdfCanonical);
+            wi = CanonicalToDir(uDir);
+            f = isect.bsdf->f(wo, wi);
+            flags = BxDFType(BSDF_ALL & ~BSDF_SPECULAR);
+            pdf = bsdfSampleFraction * isect.bsdf->Pdf(wo, wi) +
+                  (1 - bsdfSampleFraction) * guidePdfCanonical * Inv4Pi;
+        } else {
+            f = isect.bsdf->Sample_f(wo, &wi, sampler.Get2D(), &pdf, BSDF_ALL,
+                                     &flags);
+            if (guidable && !f.IsBlack() && pdf > 0) {
+                if (flags & BSDF_SPECULAR)
+                    // The guiding distribution can never produce a delta
+                    // direction, so its mixture weight is zero
+                    pdf *= bsdfSampleFraction;
+                else
+                    pdf = bsdfSampleFraction * pdf +
+                          (1 - bsdfSampleFraction) * dtree->PdfW(wi);
+            }
+        }
+        if (f.IsBlack() || pdf == 0.f) break;
+        beta.MulScaled(f, AbsDot(wi, isect.shading.n) / pdf);
+        CHECK_GE(beta.y(), 0.f);
+        DCHECK(!std::isinf(beta.y()));
+        specularBounce = (flags & BSDF_SPECULAR) != 0;
+        if ((flags & BSDF_SPECULAR) && (flags & BSDF_TRANSMISSION)) {
+            Float eta = isect.bsdf->eta;
+            etaScale *= (Dot(wo, isect.n) > 0) ? (eta * eta) : 1 / (eta * eta);
+        }
+        ray = isect.SpawnRay(wi);
+
+        // Record the bounce for training; delta directions train nothing
+        vertexP.push_back(isect.p);
+        vertexUDir.push_back(DirToCanonical(wi));
+        vertexPdfW.push_back(specularBounce ? -1 : pdf);
+        vertexBetaY.push_back(beta.y());
+        if ((int)pathL.size() < bounces + 1) pathL.resize(bounces + 1, 0);
+
+        // Account for subsurface scattering, if applicable
+        if (isect.bssrdf && (flags & BSDF_TRANSMISSION)) {
+            // Importance sample the BSSRDF
+            SurfaceInteraction pi;
+            Spectrum S = isect.bssrdf->Sample_S(
+                scene, sampler.Get1D(), sampler.Get2D(), arena, &pi, &pdf);
+            if (S.IsBlack() || pdf == 0) break;
+            beta.MulScaled(S, 1 / pdf);
+            // The recorded direction no longer matches the transported
+            // radiance once the path re-emerges elsewhere
+            vertexPdfW.back() = -1;
+
+            // Account for the direct subsurface scattering component
+            Spectrum Ld = beta * UniformSampleOneLight(
+                                     pi, scene, arena, sampler, false,
+                                     lightDistribution->Lookup(pi.p));
+            L += Ld;
+            if (!Ld.IsBlack()) pathL[bounces] += Ld.y();
+
+            // Account for the indirect subsurface scattering component
+            Spectrum f = pi.bsdf->Sample_f(pi.wo, &wi, sampler.Get2D(), &pdf,
+                                           BSDF_ALL, &flags);
+            if (f.IsBlack() || pdf == 0) break;
+            beta.MulScaled(f, AbsDot(wi, pi.shading.n) / pdf);
+            specularBounce = (flags & BSDF_SPECULAR) != 0;
+            ray = pi.SpawnRay(wi);
+        }
+
+        // Possibly terminate the path with Russian roulette.
+        // Factor out radiance scaling due to refraction in rrBeta.
+        Spectrum rrBeta = beta * etaScale;
+        if (rrBeta.MaxComponentValue() < rrThreshold && bounces > 3) {
+            Float q = std::max((Float).05, 1 - rrBeta.MaxComponentValue());
+            if (sampler.Get1D() < q) break;
+            beta /= 1 - q;
+            DCHECK(!std::isinf(beta.y()));
+        }
+    }
+
+    // Deposit the path's radiance into the SD-tree: the incident radiance
+    // along vertex _k_'s sampled direction is the luminance found beyond
+    // it, relative to the throughput after its bounce, and each sample is
+    // weighted by the reciprocal of the density it was drawn with
+    if (sdTree) {
+        for (int k = (int)vertexP.size() - 1; k >= 0; --k) {
+            Float suffix = 0;
+            for (size_t i = k + 1; i < pathL.size(); ++i) suffix += pathL[i];
+            if (vertexPdfW[k] > 0 && vertexBetaY[k] > 0 && suffix > 0)
+                sdTree->Record(vertexP[k], vertexUDir[k],
+                               suffix / vertexBetaY[k] / vertexPdfW[k]);
+        }
+    }
+    ReportValue(pathLength, bounces);
+    return L;
+}
+
+GuidedPathIntegrator *CreateGuidedPathIntegrator(
+    const ParamSet &params, std::shared_ptr<Sampler> sampler,
+    std::shared_ptr<const Camera> camera) {
+    int maxDepth = params.FindOneInt("maxdepth", 5);
+    int np;
+    const int *pb = params.FindInt("pixelbounds", &np);
+    Bounds2i pixelBounds = camera->film->GetSampleBounds();
+    if (pb) {
+        if (np != 4)
+            Error("Expected four values for \"pixelbounds\" parameter. Got %d.",
+                  np);
+        else {
+            pixelBounds = Intersect(pixelBounds,
+                                    Bounds2i{{pb[0], pb[2]}, {pb[1], pb[3]}});
+            if (pixelBounds.Area() == 0)
+                Error("Degenerate \"pixelbounds\" specified.");
+        }
+    }
+    Float rrThreshold = params.FindOneFloat("rrthreshold", 1.);
+    std::string lightStrategy =
+        params.FindOneString("lightsamplestrategy", "spatial");
+    Float bsdfSampleFraction =
+        Clamp(params.FindOneFloat("bsdfsamplefraction", .5), .1f, 1.f);
+    int nTrainingIterations = params.FindOneInt("trainingiterations", 3);
+    return new GuidedPathIntegrator(maxDepth, camera, sampler, pixelBounds,
+                                    rrThreshold, lightStrategy,
+                                    bsdfSampleFraction, nTrainingIterations);
+}
+
+}  // namespace pbrt
@@ -0,0 +1,96 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_INTEGRATORS_GUIDEDPATH_H
+#define PBRT_INTEGRATORS_GUIDEDPATH_H
+
+// integrators/guidedpath.h*
+#include "pbrt.h"
+#include "integrator.h"
+#include "path.h"
+
+namespace pbrt {
+
+class STree;
+
+// GuidedPathIntegrator Declarations
+
+// GuidedPathIntegrator computes the same estimator as PathIntegrator but
+// importance samples scattered directions from a learned approximation of
+// the incident radiance field in addition to the BSDF, following Mueller
+// et al., "Practical path guiding for efficient light-transport
+// simulation" (2017).  The radiance field is stored in an SD-tree: a
+// binary tree over the scene bounds whose leaves hold directional
+// quadtrees of incident flux.  The tree is trained from the integrator's
+// own completed paths--first by a sequence of prepass iterations of
+// doubling size in Preprocess(), with the tree refined between
+// iterations, and then continuously while rendering--and each bounce
+// draws its direction from a one-sample MIS mixture of the BSDF and the
+// leaf quadtree.  Scenes dominated by hard-to-find indirect light (e.g.
+// illumination through doorways) converge dramatically faster.
+class GuidedPathIntegrator : public PathIntegrator {
+  public:
+    // GuidedPathIntegrator Public Methods
+    GuidedPathIntegrator(int maxDepth, std::shared_ptr<const Camera> camera,
+                         std::shared_ptr<Sampler> sampler,
+                         const Bounds2i &pixelBounds, Float rrThreshold = 1,
+                         const std::string &lightSampleStrategy = "spatial",
+                         Float bsdfSampleFraction = .5,
+                         int nTrainingIterations = 3);
+    ~GuidedPathIntegrator();
+
+    void Preprocess(const Scene &scene, Sampler &sampler);
+    Spectrum Li(const RayDifferential &ray, const Scene &scene,
+                Sampler &sampler, MemoryArena &arena, int depth) const;
+
+  private:
+    // GuidedPathIntegrator Private Data
+    // Probability of sampling the BSDF rather than the guiding
+    // distribution at each bounce; the two are combined with one-sample
+    // multiple importance sampling.
+    const Float bsdfSampleFraction;
+    const int nTrainingIterations;
+    std::unique_ptr<STree> sdTree;
+};
+
+GuidedPathIntegrator *CreateGuidedPathIntegrator(
+    const ParamSet &params, std::shared_ptr<Sampler> sampler,
+    std::shared_ptr<const Camera> camera);
+
+}  // namespace pbrt
+
+#endif  // PBRT_INTEGRATORS_GUIDEDPATH_H
@@ -54,6 +54,13 @@ static const int cameraStreamIndex = 0;
 static const int lightStreamIndex = 1;
 static const int connectionStreamIndex = 2;
 static const int nSampleStreams = 3;
+// Fraction of small steps that freeze the camera sample stream so the
+// chain's camera subpath can be reused from the per-chain cache; the
+// light and connection streams still mutate, so those proposals explore
+// illumination at a fixed image position.
+static const Float cameraFreezeProbability = 0.3f;
+
+STAT_COUNTER("Integrator/Camera subpaths reused", cameraSubpathsReused);
 
 // MLTSampler Method Definitions
 Float MLTSampler::Get1D() {
@@ -73,6 +80,12 @@ std::unique_ptr<Sampler> MLTSampler::Clone(int seed) {
 void MLTSampler::StartIteration() {
     currentIteration++;
     largeStep = rng.UniformFloat() < largeStepProbability;
+    // Some small steps freeze the camera stream: its samples keep their
+    // current-state values, so the camera subpath is unchanged and the
+    // integrator can reuse it. The proposal mixture stays symmetric, so
+    // the acceptance probability is unaffected.
+    freezeCameraStream = !largeStep && cameraFreezeProbability > 0 &&
+                         rng.UniformFloat() < cameraFreezeProbability;
 }
 
 void MLTSampler::Accept() {
@@ -90,6 +103,11 @@ void MLTSampler::EnsureReady(int index) {
         Xi.lastModificationIteration = lastLargeStepIteration;
     }
 
+    // Leave frozen camera-stream samples at their current-state values;
+    // nothing is modified, so there's nothing to back up or restore
+    if (freezeCameraStream && index % streamCount == cameraStreamIndex)
+        return;
+
     // Apply remaining sequence of mutations to _sample_
     Xi.Backup();
     if (largeStep) {
@@ -126,28 +144,48 @@ void MLTSampler::StartStream(int index) {
 Spectrum MLTIntegrator::L(const Scene &scene, MemoryArena &arena,
                           const std::unique_ptr<Distribution1D> &lightDistr,
                           const std::unordered_map<const Light *, size_t> &lightToIndex,
-                          MLTSampler &sampler, int depth, Point2f *pRaster) {
+                          MLTSampler &sampler, int depth, Point2f *pRaster,
+                          CameraSubpathCache *cache) {
     sampler.StartStream(cameraStreamIndex);
-    // Determine the number of available strategies and pick a specific one
-    int s, t, nStrategies;
-    if (depth == 0) {
-        nStrategies = 1;
-        s = 0;
-        t = 2;
+    int s, t, nStrategies = depth == 0 ? 1 : depth + 2;
+    Vertex *cameraVertices;
+    if (cache && cache->Valid() && sampler.CameraStreamFrozen()) {
+        // The frozen camera stream would reproduce the current state's
+        // camera subpath exactly, so reuse the cached one
+        ++cameraSubpathsReused;
+        s = cache->S();
+        t = cache->T();
+        *pRaster = cache->PRaster();
+        cameraVertices = cache->Vertices();
+        cache->NoteReused();
     } else {
-        nStrategies = depth + 2;
-        s = std::min((int)(sampler.Get1D() * nStrategies), nStrategies - 1);
-        t = nStrategies - s;
+        // Determine the number of available strategies and pick a specific
+        // one
+        if (depth == 0) {
+            s = 0;
+            t = 2;
+        } else {
+            s = std::min((int)(sampler.Get1D() * nStrategies),
+                         nStrategies - 1);
+            t = nStrategies - s;
+        }
+
+        // Generate a camera subpath with exactly _t_ vertices; a cached
+        // chain traces into the cache's spare arena so the subpath can
+        // outlive this mutation if it's accepted
+        MemoryArena &pathArena = cache ? cache->ProposalArena() : arena;
+        Vertex *vertices = pathArena.Alloc<Vertex>(t);
+        Bounds2f sampleBounds = (Bounds2f)camera->film->GetSampleBounds();
+        *pRaster = sampleBounds.Lerp(sampler.Get2D());
+        if (GenerateCameraSubpath(scene, sampler, pathArena, t, *camera,
+                                  *pRaster, vertices) != t) {
+            if (cache) cache->NoteFailed();
+            return Spectrum(0.f);
+        }
+        if (cache) cache->NoteTraced(vertices, s, t, *pRaster);
+        cameraVertices = vertices;
     }
 
-    // Generate a camera subpath with exactly _t_ vertices
-    Vertex *cameraVertices = arena.Alloc<Vertex>(t);
-    Bounds2f sampleBounds = (Bounds2f)camera->film->GetSampleBounds();
-    *pRaster = sampleBounds.Lerp(sampler.Get2D());
-    if (GenerateCameraSubpath(scene, sampler, arena, t, *camera, *pRaster,
-                              cameraVertices) != t)
-        return Spectrum(0.f);
-
     // Generate a light subpath with exactly _s_ vertices
     sampler.StartStream(lightStreamIndex);
     Vertex *lightVertices = arena.Alloc<Vertex>(s);
@@ -198,7 +236,8 @@ void MLTIntegrator::Render(const Scene &scene) {
         }, nBootstrap, chunkSize);
         progress.Done();
     }
-    Distribution1D bootstrap(&bootstrapWeights[0], nBootstrapSamples);
+    Distribution1D bootstrap =
+        Distribution1D::BuildParallel(&bootstrapWeights[0], nBootstrapSamples);
     Float b = bootstrap.funcInt * (maxDepth + 1);
 
     // Run _nChains_ Markov chains in parallel
@@ -209,11 +248,16 @@ void MLTIntegrator::Render(const Scene &scene) {
         const int progressFrequency = 32768;
         ProgressReporter progress(nTotalMutations / progressFrequency,
                                   "Rendering");
+        // Chains claim mutations from a shared budget in fixed-size blocks
+        // rather than running a precomputed count each; per-mutation cost
+        // varies widely with path depth, so fast chains keep mutating
+        // instead of idling while slow ones finish.  The total number of
+        // mutations performed is exactly _nTotalMutations_, so the
+        // normalization below is unchanged.
+        std::atomic<int64_t> nextMutation(0);
+        const int64_t mutationBlockSize = 16384;
         ParallelFor([&](int i) {
-            int64_t nChainMutations =
-                std::min((i + 1) * nTotalMutations / nChains, nTotalMutations) -
-                i * nTotalMutations / nChains;
-            // Follow {i}th Markov chain for _nChainMutations_
+            // Follow {i}th Markov chain until the mutation budget runs out
             MemoryArena arena;
 
             // Select initial state from the set of bootstrap samples
@@ -223,40 +267,60 @@ void MLTIntegrator::Render(const Scene &scene) {
 
             // Initialize local variables for selected state
             MLTSampler sampler(mutationsPerPixel, bootstrapIndex, sigma,
-                               largeStepProbability, nSampleStreams);
+                               largeStepProbability, nSampleStreams,
+                               cameraFreezeProbability);
+            CameraSubpathCache subpathCache;
             Point2f pCurrent;
             Spectrum LCurrent =
-                L(scene, arena, lightDistr, lightToIndex, sampler, depth, &pCurrent);
-
-            // Run the Markov chain for _nChainMutations_ steps
-            for (int64_t j = 0; j < nChainMutations; ++j) {
-                sampler.StartIteration();
-                Point2f pProposed;
-                Spectrum LProposed =
-                    L(scene, arena, lightDistr, lightToIndex, sampler, depth, &pProposed);
-                // Compute acceptance probability for proposed sample
-                Float accept = std::min((Float)1, LProposed.y() / LCurrent.y());
-
-                // Splat both current and proposed samples to _film_
-                if (accept > 0)
-                    film.AddSplat(pProposed,
-                                  LProposed * accept / LProposed.y());
-                film.AddSplat(pCurrent, LCurrent * (1 - accept) / LCurrent.y());
-
-                // Accept or reject the proposal
-                if (rng.UniformFloat() < accept) {
-                    pCurrent = pProposed;
-                    LCurrent = LProposed;
-                    sampler.Accept();
-                    ++acceptedMutations;
-                } else
-                    sampler.Reject();
-                ++totalMutations;
-                if ((i * nTotalMutations / nChains + j) % progressFrequency ==
-                    0)
-                    progress.Update();
-                arena.Reset();
+                L(scene, arena, lightDistr, lightToIndex, sampler, depth,
+                  &pCurrent, &subpathCache);
+            subpathCache.Accept();
+
+            // Accumulated current-state contribution not yet splatted; a
+            // run of rejections splats the same raster position every
+            // iteration, so batch those up and flush when the chain moves.
+            Spectrum pendingL(0.f);
+
+            // Run the Markov chain over blocks of the mutation budget
+            while (true) {
+                int64_t begin = nextMutation.fetch_add(mutationBlockSize);
+                if (begin >= nTotalMutations) break;
+                int64_t end =
+                    std::min(begin + mutationBlockSize, nTotalMutations);
+                for (int64_t j = begin; j < end; ++j) {
+                    sampler.StartIteration();
+                    Point2f pProposed;
+                    Spectrum LProposed =
+                        L(scene, arena, lightDistr, lightToIndex, sampler,
+                          depth, &pProposed, &subpathCache);
+                    // Compute acceptance probability for proposed sample
+                    Float accept = std::min((Float)1, LProposed.y() / LCurrent.y());
+
+                    // Splat both current and proposed samples to _film_
+                    if (accept > 0)
+                        film.AddSplat(pProposed,
+                                      LProposed * accept / LProposed.y());
+                    pendingL += LCurrent * (1 - accept) / LCurrent.y();
+
+                    // Accept or reject the proposal
+                    if (rng.UniformFloat() < accept) {
+                        if (!pendingL.IsBlack()) film.AddSplat(pCurrent, pendingL);
+                        pendingL = Spectrum(0.f);
+                        pCurrent = pProposed;
+                        LCurrent = LProposed;
+                        sampler.Accept();
+                        subpathCache.Accept();
+                        ++acceptedMutations;
+                    } else {
+                        sampler.Reject();
+                        subpathCache.Reject();
+                    }
+                    ++totalMutations;
+                    if (j % progressFrequency == 0) progress.Update();
+                    arena.Reset();
+                }
             }
+            if (!pendingL.IsBlack()) film.AddSplat(pCurrent, pendingL);
         }, nChains);
         progress.Done();
     }
@@ -44,6 +44,7 @@
 #include "sampler.h"
 #include "spectrum.h"
 #include "film.h"
+#include "memory.h"
 #include "rng.h"
 #include <unordered_map>
 
@@ -54,11 +55,13 @@ class MLTSampler : public Sampler {
   public:
     // MLTSampler Public Methods
     MLTSampler(int mutationsPerPixel, int rngSequenceIndex, Float sigma,
-               Float largeStepProbability, int streamCount)
+               Float largeStepProbability, int streamCount,
+               Float cameraFreezeProbability = 0)
         : Sampler(mutationsPerPixel),
           rng(rngSequenceIndex),
           sigma(sigma),
           largeStepProbability(largeStepProbability),
+          cameraFreezeProbability(cameraFreezeProbability),
           streamCount(streamCount) {}
     Float Get1D();
     Point2f Get2D();
@@ -68,6 +71,9 @@ class MLTSampler : public Sampler {
     void Reject();
     void StartStream(int index);
     int GetNextIndex() { return streamIndex + streamCount * sampleIndex++; }
+    // True if the running small step leaves the camera sample stream at
+    // its current-state values, so the camera subpath is unchanged.
+    bool CameraStreamFrozen() const { return freezeCameraStream; }
 
   protected:
     // MLTSampler Private Declarations
@@ -94,15 +100,75 @@ class MLTSampler : public Sampler {
 
     // MLTSampler Private Data
     RNG rng;
-    const Float sigma, largeStepProbability;
+    const Float sigma, largeStepProbability, cameraFreezeProbability;
     const int streamCount;
     std::vector<PrimarySample> X;
     int64_t currentIteration = 0;
     bool largeStep = true;
+    bool freezeCameraStream = false;
     int64_t lastLargeStepIteration = 0;
     int streamIndex, sampleIndex;
 };
 
+// CameraSubpathCache Declarations
+struct Vertex;
+
+// Per-chain cache of the current state's camera subpath. A small step
+// that freezes the camera sample stream (see MLTSampler::StartIteration())
+// would re-trace exactly the same subpath, so MLTIntegrator::L() reuses
+// the cached vertices for it; any other proposal traces into the spare
+// arena, and the cache adopts its subpath if the chain accepts.
+class CameraSubpathCache {
+  public:
+    // CameraSubpathCache Public Methods
+    bool Valid() const { return currentValid; }
+    Vertex *Vertices() const { return vertices[current]; }
+    int S() const { return s[current]; }
+    int T() const { return t[current]; }
+    Point2f PRaster() const { return pRaster[current]; }
+    // Arena to trace a proposal's subpath into; its storage stays alive
+    // at least until the proposal is rejected or a later one is accepted.
+    MemoryArena &ProposalArena() { return arenas[current ^ 1]; }
+    void NoteTraced(Vertex *v, int ps, int pt, const Point2f &p) {
+        vertices[current ^ 1] = v;
+        s[current ^ 1] = ps;
+        t[current ^ 1] = pt;
+        pRaster[current ^ 1] = p;
+        proposal = ProposalState::Traced;
+    }
+    void NoteFailed() { proposal = ProposalState::Failed; }
+    void NoteReused() { proposal = ProposalState::ReusedCurrent; }
+    void Accept() {
+        if (proposal == ProposalState::Traced) {
+            current ^= 1;
+            currentValid = true;
+            arenas[current ^ 1].Reset();
+        } else if (proposal == ProposalState::Failed)
+            // Only a chain's initial state can land here (failed
+            // proposals have zero radiance and are always rejected); it
+            // has no subpath to cache. A reused proposal is the current
+            // subpath, so nothing changes for it.
+            currentValid = false;
+        proposal = ProposalState::None;
+    }
+    void Reject() {
+        if (proposal != ProposalState::ReusedCurrent)
+            arenas[current ^ 1].Reset();
+        proposal = ProposalState::None;
+    }
+
+  private:
+    // CameraSubpathCache Private Data
+    enum class ProposalState { None, Traced, Failed, ReusedCurrent };
+    MemoryArena arenas[2];
+    Vertex *vertices[2] = {nullptr, nullptr};
+    int s[2], t[2];
+    Point2f pRaster[2];
+    int current = 0;
+    bool currentValid = false;
+    ProposalState proposal = ProposalState::None;
+};
+
 // MLT Declarations
 class MLTIntegrator : public Integrator {
   public:
@@ -121,7 +187,8 @@ class MLTIntegrator : public Integrator {
     Spectrum L(const Scene &scene, MemoryArena &arena,
                const std::unique_ptr<Distribution1D> &lightDistr,
                const std::unordered_map<const Light *, size_t> &lightToIndex,
-               MLTSampler &sampler, int k, Point2f *pRaster);
+               MLTSampler &sampler, int k, Point2f *pRaster,
+               CameraSubpathCache *cache = nullptr);
 
   private:
     // MLTIntegrator Private Data
@@ -36,34 +36,219 @@
 #include "camera.h"
 #include "film.h"
 #include "interaction.h"
+#include "parallel.h"
 #include "paramset.h"
 #include "scene.h"
 #include "stats.h"
+#include "samplers/random.h"
 
 namespace pbrt {
 
 STAT_PERCENT("Integrator/Zero-radiance paths", zeroRadiancePaths, totalPaths);
 STAT_INT_DISTRIBUTION("Integrator/Path length", pathLength);
 
+// AdjointRadianceCache Declarations
+
+// Voxelized estimate of the luminance of the radiance arriving at points
+// in the scene, built from a low-resolution camera prepass.  Li() uses it
+// to drive Russian roulette by the expected remaining contribution of a
+// path rather than by its throughput alone (after Vorba and Krivanek,
+// "Adjoint-driven Russian roulette and splitting in light transport
+// simulation", 2016): paths in dark regions terminate sooner, and paths
+// with energetic regions ahead of them survive longer.
+class AdjointRadianceCache {
+  public:
+    // AdjointRadianceCache Public Methods
+    AdjointRadianceCache(const Scene &scene, const Camera &camera,
+                         LightDistribution &lightDistribution, int maxDepth);
+    // Return the cached estimate of the luminance arriving at _p_, or the
+    // scene-wide average where the prepass left no samples.
+    Float Lookup(const Point3f &p) const {
+        int index = VoxelIndex(p);
+        int n = count[index].load(std::memory_order_relaxed);
+        return n > 0 ? Float(sum[index]) / n : average;
+    }
+
+  private:
+    // AdjointRadianceCache Private Methods
+    int VoxelIndex(const Point3f &p) const {
+        Vector3f offset = worldBound.Offset(p);
+        int v[3];
+        for (int i = 0; i < 3; ++i)
+            v[i] = Clamp(int(offset[i] * cacheRes), 0, cacheRes - 1);
+        return (v[2] * cacheRes + v[1]) * cacheRes + v[0];
+    }
+    void Deposit(const Point3f &p, Float L) {
+        int index = VoxelIndex(p);
+        sum[index].Add(L);
+        count[index].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // AdjointRadianceCache Private Data
+    static const int cacheRes = 32;
+    const Bounds3f worldBound;
+    std::vector<AtomicFloat> sum;
+    std::vector<std::atomic<int>> count;
+    Float average = 0;
+};
+
+// AdjointRadianceCache Method Definitions
+AdjointRadianceCache::AdjointRadianceCache(const Scene &scene,
+                                           const Camera &camera,
+                                           LightDistribution &lightDistribution,
+                                           int maxDepth)
+    : worldBound(scene.WorldBound()),
+      sum(cacheRes * cacheRes * cacheRes),
+      count(cacheRes * cacheRes * cacheRes) {
+    // Trace a low-resolution prepass over the film, recording at each
+    // path vertex the luminance the rest of the path carried back to it.
+    // Direct lighting at the prepass vertices supplies the radiance, which
+    // is where nearly all of the adjoint's magnitude comes from; emission
+    // hit through specular chains is ignored.
+    const int res = 64, spp = 4;
+    Bounds2f sampleBounds = (Bounds2f)camera.film->GetSampleBounds();
+    ParallelFor2D(
+        [&](Point2i cell) {
+            MemoryArena arena;
+            RandomSampler sampler(spp, cell.y * res + cell.x);
+            sampler.StartPixel(cell);
+            do {
+                // Generate the prepass camera ray for _cell_
+                CameraSample cs;
+                Point2f u = sampler.Get2D();
+                cs.pFilm = sampleBounds.Lerp(Point2f(
+                    (cell.x + u.x) / res, (cell.y + u.y) / res));
+                cs.pLens = sampler.Get2D();
+                cs.time = sampler.Get1D();
+                RayDifferential ray;
+                if (camera.GenerateRayDifferential(cs, &ray) == 0) continue;
+
+                // Trace the prepass path, recording each vertex's
+                // position, throughput luminance, and direct lighting
+                Spectrum beta(1.f);
+                std::vector<Point3f> vertexP;
+                std::vector<Float> vertexBetaY, contribY;
+                for (int bounces = 0; bounces < maxDepth; ++bounces) {
+                    SurfaceInteraction isect;
+                    if (!scene.Intersect(ray, &isect)) {
+                        // Credit escaped radiance to the last vertex
+                        Spectrum Le(0.f);
+                        for (const auto &light : scene.infiniteLights)
+                            Le += light->Le(ray);
+                        if (!contribY.empty() && !Le.IsBlack())
+                            contribY.back() += beta.y() * Le.y();
+                        break;
+                    }
+                    isect.ComputeScatteringFunctions(ray, arena, true);
+                    if (!isect.bsdf) {
+                        ray = isect.SpawnRay(ray.d);
+                        --bounces;
+                        continue;
+                    }
+                    vertexP.push_back(isect.p);
+                    vertexBetaY.push_back(beta.y());
+                    Spectrum Ld = UniformSampleOneLight(
+                        isect, scene, arena, sampler, false,
+                        lightDistribution.Lookup(isect.p));
+                    contribY.push_back(beta.y() * Ld.y());
+
+                    // Sample the BSDF to continue the prepass path
+                    Vector3f wo = -ray.d, wi;
+                    Float pdf;
+                    BxDFType flags;
+                    Spectrum f = isect.bsdf->Sample_f(
+                        wo, &wi, sampler.Get2D(), &pdf, BSDF_ALL, &flags);
+                    if (f.IsBlack() || pdf == 0) break;
+                    beta.MulScaled(f, AbsDot(wi, isect.shading.n) / pdf);
+                    ray = isect.SpawnRay(wi);
+                }
+
+                // Deposit suffix sums: the radiance arriving at vertex
+                // _k_ is everything the path scattered from _k_ onward,
+                // measured relative to the throughput at _k_
+                Float suffix = 0;
+                for (int k = (int)vertexP.size() - 1; k >= 0; --k) {
+                    suffix += contribY[k];
+                    if (vertexBetaY[k] > 0)
+                        Deposit(vertexP[k], suffix / vertexBetaY[k]);
+                }
+                arena.Reset();
+            } while (sampler.StartNextSample());
+        },
+        Point2i(res, res));
+
+    // Compute the scene-wide average for voxels the prepass never reached
+    double total = 0;
+    int64_t n = 0;
+    for (size_t i = 0; i < sum.size(); ++i) {
+        total += Float(sum[i]);
+        n += count[i].load(std::memory_order_relaxed);
+    }
+    average = n > 0 ? Float(total / n) : 0;
+}
+
 // PathIntegrator Method Definitions
 PathIntegrator::PathIntegrator(int maxDepth,
                                std::shared_ptr<const Camera> camera,
                                std::shared_ptr<Sampler> sampler,
                                const Bounds2i &pixelBounds, Float rrThreshold,
-                               const std::string &lightSampleStrategy)
+                               const std::string &lightSampleStrategy,
+                               bool visibilityCache, int lightCandidates,
+                               bool adjointRR, Float clampIndirect)
     : SamplerIntegrator(camera, sampler, pixelBounds),
       maxDepth(maxDepth),
       rrThreshold(rrThreshold),
-      lightSampleStrategy(lightSampleStrategy) {}
+      lightSampleStrategy(lightSampleStrategy),
+      visibilityCache(visibilityCache),
+      lightCandidates(lightCandidates),
+      adjointRR(adjointRR),
+      clampIndirect(clampIndirect) {}
+
+PathIntegrator::~PathIntegrator() {}
 
 void PathIntegrator::Preprocess(const Scene &scene, Sampler &sampler) {
     lightDistribution =
         CreateLightSampleDistribution(lightSampleStrategy, scene);
+    lightDistribution->Warmup(*camera);
+    if (adjointRR)
+        radianceCache.reset(new AdjointRadianceCache(
+            scene, *camera, *lightDistribution, maxDepth));
 }
 
 Spectrum PathIntegrator::Li(const RayDifferential &r, const Scene &scene,
                             Sampler &sampler, MemoryArena &arena,
                             int depth) const {
+    // Dispatch to the LiImpl() specialization for the scene's feature
+    // mask; each combination compiles its unused branches out entirely.
+    switch (scene.Features() & (SceneHasAreaLights | SceneHasInfiniteLights |
+                                SceneHasSubsurface)) {
+    case 0:
+        return LiImpl<0>(r, scene, sampler, arena, depth);
+    case SceneHasAreaLights:
+        return LiImpl<SceneHasAreaLights>(r, scene, sampler, arena, depth);
+    case SceneHasInfiniteLights:
+        return LiImpl<SceneHasInfiniteLights>(r, scene, sampler, arena, depth);
+    case SceneHasAreaLights | SceneHasInfiniteLights:
+        return LiImpl<SceneHasAreaLights | SceneHasInfiniteLights>(
+            r, scene, sampler, arena, depth);
+    case SceneHasSubsurface:
+        return LiImpl<SceneHasSubsurface>(r, scene, sampler, arena, depth);
+    case SceneHasAreaLights | SceneHasSubsurface:
+        return LiImpl<SceneHasAreaLights | SceneHasSubsurface>(
+            r, scene, sampler, arena, depth);
+    case SceneHasInfiniteLights | SceneHasSubsurface:
+        return LiImpl<SceneHasInfiniteLights | SceneHasSubsurface>(
+            r, scene, sampler, arena, depth);
+    default:
+        return LiImpl<SceneHasAreaLights | SceneHasInfiniteLights |
+                      SceneHasSubsurface>(r, scene, sampler, arena, depth);
+    }
+}
+
+template <int features>
+Spectrum PathIntegrator::LiImpl(const RayDifferential &r, const Scene &scene,
+                                Sampler &sampler, MemoryArena &arena,
+                                int depth) const {
     ProfilePhase p(Prof::SamplerIntegratorLi);
     Spectrum L(0.f), beta(1.f);
     RayDifferential ray(r);
@@ -77,6 +262,16 @@ Spectrum PathIntegrator::Li(const RayDifferential &r, const Scene &scene,
     // avoid terminating refracted rays that are about to be refracted back
     // out of a medium and thus have their beta value increased.
     Float etaScale = 1;
+    // Expected luminance of this pixel for adjoint-driven Russian
+    // roulette, recorded at the path's first visible point
+    Float adjointRef = 0;
+    // Clamp the luminance of indirect contributions if requested; the
+    // directly visible bounce is always left alone
+    auto ClampLi = [&](Spectrum c) {
+        if (clampIndirect > 0 && bounces > 0 && c.y() > clampIndirect)
+            c *= clampIndirect / c.y();
+        return c;
+    };
 
     for (bounces = 0;; ++bounces) {
         // Find next path vertex and accumulate contribution
@@ -91,24 +286,35 @@ Spectrum PathIntegrator::Li(const RayDifferential &r, const Scene &scene,
         if (bounces == 0 || specularBounce) {
             // Add emitted light at path vertex or from the environment
             if (foundIntersection) {
-                L += beta * isect.Le(-ray.d);
-                VLOG(2) << "Added Le -> L = " << L;
-            } else {
+                if (features & SceneHasAreaLights) {
+                    L += ClampLi(beta * isect.Le(-ray.d));
+                    VLOG(2) << "Added Le -> L = " << L;
+                }
+            } else if (features & SceneHasInfiniteLights) {
                 for (const auto &light : scene.infiniteLights)
-                    L += beta * light->Le(ray);
+                    L += ClampLi(beta * light->Le(ray));
                 VLOG(2) << "Added infinite area lights -> L = " << L;
             }
         }
+        if (bounces == 0 && foundIntersection && radianceCache)
+            adjointRef = radianceCache->Lookup(isect.p);
 
         // Terminate path if ray escaped or _maxDepth_ was reached
         if (!foundIntersection || bounces >= maxDepth) break;
 
-        // Compute scattering functions and skip over medium boundaries
+        // Compute scattering functions and skip over medium boundaries.
+        // Everything this bounce allocates from the arena (its BSDF, any
+        // BSSRDF probe interaction) is dead once the next ray has been
+        // sampled, so the checkpoint taken here is rolled back at the
+        // bottom of the loop; the arena then stays one bounce deep
+        // instead of growing with the path length.
+        MemoryArena::Checkpoint checkpoint = arena.GetCheckpoint();
         isect.ComputeScatteringFunctions(ray, arena, true);
         if (!isect.bsdf) {
             VLOG(2) << "Skipping intersection due to null bsdf";
             ray = isect.SpawnRay(ray.d);
             bounces--;
+            arena.RestoreCheckpoint(checkpoint);
             continue;
         }
 
@@ -119,12 +325,18 @@ Spectrum PathIntegrator::Li(const RayDifferential &r, const Scene &scene,
         if (isect.bsdf->NumComponents(BxDFType(BSDF_ALL & ~BSDF_SPECULAR)) >
             0) {
             ++totalPaths;
-            Spectrum Ld = beta * UniformSampleOneLight(isect, scene, arena,
-                                                       sampler, false, distrib);
+            Spectrum Ld =
+                lightCandidates > 0
+                    ? beta * ReservoirSampleOneLight(isect, scene, arena,
+                                                     sampler, lightCandidates,
+                                                     distrib)
+                    : beta * UniformSampleOneLight(isect, scene, arena,
+                                                   sampler, false, distrib,
+                                                   visibilityCache);
             VLOG(2) << "Sampled direct lighting Ld = " << Ld;
             if (Ld.IsBlack()) ++zeroRadiancePaths;
             CHECK_GE(Ld.y(), 0.f);
-            L += Ld;
+            L += ClampLi(Ld);
         }
 
         // Sample BSDF to get new path direction
@@ -135,7 +347,7 @@ Spectrum PathIntegrator::Li(const RayDifferential &r, const Scene &scene,
                                           BSDF_ALL, &flags);
         VLOG(2) << "Sampled BSDF, f = " << f << ", pdf = " << pdf;
         if (f.IsBlack() || pdf == 0.f) break;
-        beta *= f * AbsDot(wi, isect.shading.n) / pdf;
+        beta.MulScaled(f, AbsDot(wi, isect.shading.n) / pdf);
         VLOG(2) << "Updated beta = " << beta;
         CHECK_GE(beta.y(), 0.f);
         DCHECK(!std::isinf(beta.y()));
@@ -150,24 +362,28 @@ Spectrum PathIntegrator::Li(const RayDifferential &r, const Scene &scene,
         ray = isect.SpawnRay(wi);
 
         // Account for subsurface scattering, if applicable
-        if (isect.bssrdf && (flags & BSDF_TRANSMISSION)) {
+        if ((features & SceneHasSubsurface) && isect.bssrdf &&
+            (flags & BSDF_TRANSMISSION)) {
             // Importance sample the BSSRDF
             SurfaceInteraction pi;
             Spectrum S = isect.bssrdf->Sample_S(
                 scene, sampler.Get1D(), sampler.Get2D(), arena, &pi, &pdf);
             DCHECK(!std::isinf(beta.y()));
             if (S.IsBlack() || pdf == 0) break;
-            beta *= S / pdf;
+            beta.MulScaled(S, 1 / pdf);
 
             // Account for the direct subsurface scattering component
-            L += beta * UniformSampleOneLight(pi, scene, arena, sampler, false,
-                                              lightDistribution->Lookup(pi.p));
+            L += ClampLi(beta *
+                         UniformSampleOneLight(pi, scene, arena, sampler,
+                                               false,
+                                               lightDistribution->Lookup(pi.p),
+                                               visibilityCache));
 
             // Account for the indirect subsurface scattering component
             Spectrum f = pi.bsdf->Sample_f(pi.wo, &wi, sampler.Get2D(), &pdf,
                                            BSDF_ALL, &flags);
             if (f.IsBlack() || pdf == 0) break;
-            beta *= f * AbsDot(wi, pi.shading.n) / pdf;
+            beta.MulScaled(f, AbsDot(wi, pi.shading.n) / pdf);
             DCHECK(!std::isinf(beta.y()));
             specularBounce = (flags & BSDF_SPECULAR) != 0;
             ray = pi.SpawnRay(wi);
@@ -177,11 +393,23 @@ Spectrum PathIntegrator::Li(const RayDifferential &r, const Scene &scene,
         // Factor out radiance scaling due to refraction in rrBeta.
         Spectrum rrBeta = beta * etaScale;
         if (rrBeta.MaxComponentValue() < rrThreshold && bounces > 3) {
-            Float q = std::max((Float).05, 1 - rrBeta.MaxComponentValue());
+            Float q;
+            if (radianceCache && adjointRef > 0)
+                // Survive in proportion to the path's expected remaining
+                // contribution--its throughput times the cached radiance
+                // ahead of it--relative to the expected pixel luminance
+                q = 1 - Clamp(rrBeta.y() * radianceCache->Lookup(isect.p) /
+                                  adjointRef,
+                              (Float).05, (Float)1);
+            else
+                q = std::max((Float).05, 1 - rrBeta.MaxComponentValue());
             if (sampler.Get1D() < q) break;
             beta /= 1 - q;
             DCHECK(!std::isinf(beta.y()));
         }
+
+        // Release this bounce's arena scratch before the next one
+        arena.RestoreCheckpoint(checkpoint);
     }
     ReportValue(pathLength, bounces);
     return L;
@@ -208,8 +436,13 @@ PathIntegrator *CreatePathIntegrator(const ParamSet &params,
     Float rrThreshold = params.FindOneFloat("rrthreshold", 1.);
     std::string lightStrategy =
         params.FindOneString("lightsamplestrategy", "spatial");
+    bool visibilityCache = params.FindOneBool("visibilitycache", false);
+    int lightCandidates = params.FindOneInt("lightcandidates", 0);
+    bool adjointRR = params.FindOneBool("adjointrr", false);
+    Float clampIndirect = params.FindOneFloat("clampindirect", 0);
     return new PathIntegrator(maxDepth, camera, sampler, pixelBounds,
-                              rrThreshold, lightStrategy);
+                              rrThreshold, lightStrategy, visibilityCache,
+                              lightCandidates, adjointRR, clampIndirect);
 }
 
 }  // namespace pbrt
@@ -45,6 +45,8 @@
 
 namespace pbrt {
 
+class AdjointRadianceCache;
+
 // PathIntegrator Declarations
 class PathIntegrator : public SamplerIntegrator {
   public:
@@ -52,18 +54,46 @@ class PathIntegrator : public SamplerIntegrator {
     PathIntegrator(int maxDepth, std::shared_ptr<const Camera> camera,
                    std::shared_ptr<Sampler> sampler,
                    const Bounds2i &pixelBounds, Float rrThreshold = 1,
-                   const std::string &lightSampleStrategy = "spatial");
+                   const std::string &lightSampleStrategy = "spatial",
+                   bool visibilityCache = false, int lightCandidates = 0,
+                   bool adjointRR = false, Float clampIndirect = 0);
+    ~PathIntegrator();
 
     void Preprocess(const Scene &scene, Sampler &sampler);
     Spectrum Li(const RayDifferential &ray, const Scene &scene,
                 Sampler &sampler, MemoryArena &arena, int depth) const;
 
-  private:
-    // PathIntegrator Private Data
+  protected:
+    // The path-tracing loop, specialized on the scene's feature mask so
+    // that the branches for features the scene doesn't use (area light
+    // emission, infinite lights, subsurface scattering) compile away;
+    // Li() dispatches on Scene::Features(). See SceneFeatures.
+    template <int features>
+    Spectrum LiImpl(const RayDifferential &ray, const Scene &scene,
+                    Sampler &sampler, MemoryArena &arena, int depth) const;
+
+    // PathIntegrator Protected Data
     const int maxDepth;
     const Float rrThreshold;
     const std::string lightSampleStrategy;
+    // Russian-roulette shadow rays toward lights that cached occlusion
+    // statistics say are almost always blocked; see LightVisibilityCache.
+    const bool visibilityCache;
+    // When positive, estimate direct lighting at surface vertices with
+    // ReservoirSampleOneLight() over this many candidates instead of
+    // UniformSampleOneLight().
+    const int lightCandidates;
+    // Drive Russian roulette by the expected remaining contribution of
+    // the path, estimated from a prepass radiance cache, instead of by
+    // the path throughput alone; see AdjointRadianceCache.
+    const bool adjointRR;
+    // When positive, indirect contributions (everything found after the
+    // first bounce) are clamped to this luminance before being added to
+    // the path's radiance, trading a little energy in hard caustics for
+    // firefly-free frames at production sample counts.
+    const Float clampIndirect;
     std::unique_ptr<LightDistribution> lightDistribution;
+    std::unique_ptr<AdjointRadianceCache> radianceCache;
 };
 
 PathIntegrator *CreatePathIntegrator(const ParamSet &params,
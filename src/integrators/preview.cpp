@@ -0,0 +1,166 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+
+// integrators/preview.cpp*
+#include "integrators/preview.h"
+#include "interaction.h"
+#include "lightdistrib.h"
+#include "parallel.h"
+#include "paramset.h"
+#include "samplers/random.h"
+#include "scene.h"
+#include "stats.h"
+
+namespace pbrt {
+
+STAT_COUNTER("Integrator/Preview frames accumulated", nPreviewFrames);
+
+// Frame-to-frame accumulation for session mode: the film and the
+// integrator are recreated for every session frame, so the running
+// average lives here and carries across scene re-parses. It is reset
+// whenever the image resolution changes.
+static std::vector<Spectrum> previewAccum;
+static Point2i previewAccumRes;
+static int previewAccumFrames = 0;
+
+// PreviewIntegrator Method Definitions
+Spectrum PreviewIntegrator::Li(const RayDifferential &ray, const Scene &scene,
+                               Sampler &sampler, MemoryArena &arena,
+                               const LightDistribution &lightDistrib) const {
+    ProfilePhase p(Prof::SamplerIntegratorLi);
+    Spectrum L(0.f);
+    RayDifferential r = ray;
+    SurfaceInteraction isect;
+    // Find the first surface with a BSDF, skipping over medium boundaries
+    // (which scatter nothing); the preview never follows scattered
+    // bounces, so everything past next-event estimation is left out.
+    for (int i = 0; i < 8; ++i) {
+        if (!scene.Intersect(r, &isect)) {
+            for (const auto &light : scene.infiniteLights) L += light->Le(r);
+            return L;
+        }
+        L += isect.Le(-r.d);
+        isect.ComputeScatteringFunctions(r, arena);
+        if (isect.bsdf) break;
+        r = RayDifferential(isect.SpawnRay(r.d));
+    }
+    if (!isect.bsdf) return L;
+
+    // Sample one light for the only scattering event
+    const Distribution1D *distrib = lightDistrib.Lookup(isect.p);
+    L += UniformSampleOneLight(isect, scene, arena, sampler, false, distrib);
+    return L;
+}
+
+void PreviewIntegrator::Render(const Scene &scene) {
+    ProfilePhase p(Prof::IntegratorRender);
+    // The power distribution builds in time proportional to the light
+    // count, unlike "spatial", which would dominate time-to-first-pixel.
+    std::unique_ptr<LightDistribution> lightDistribution =
+        CreateLightSampleDistribution("power", scene);
+    Film *film = camera->film;
+    const Bounds2i bounds = film->croppedPixelBounds;
+    const int width = bounds.Diagonal().x, height = bounds.Diagonal().y;
+    const int nPixels = bounds.Area();
+    if (previewAccumRes != Point2i(width, height)) {
+        previewAccum.assign(nPixels, Spectrum(0.f));
+        previewAccumRes = Point2i(width, height);
+        previewAccumFrames = 0;
+    }
+
+    // Render coarse-to-fine: one sample per 4x4 block, then per 2x2
+    // block, then per pixel, flooding each block with its sample's value.
+    // The coarse passes are pushed to the film as soon as they finish so
+    // the first image appears after 1/16 of the frame's work.
+    std::vector<Spectrum> frame(nPixels);
+    for (int block = 4; block >= 1; block >>= 1) {
+        const int bx = (width + block - 1) / block;
+        const int by = (height + block - 1) / block;
+        ParallelFor(
+            [&](int64_t row) {
+                MemoryArena arena;
+                for (int col = 0; col < bx; ++col) {
+                    // Take the block's sample through its center pixel
+                    Point2i pixel =
+                        Min(bounds.pMin + Vector2i(col * block + block / 2,
+                                                   (int)row * block + block / 2),
+                            bounds.pMax - Vector2i(1, 1));
+                    RandomSampler sampler(
+                        1, (previewAccumFrames * by + (int)row) * bx + col);
+                    sampler.StartPixel(pixel);
+                    CameraSample cs = sampler.GetCameraSample(pixel);
+                    RayDifferential ray;
+                    Float rayWeight = camera->GenerateRayDifferential(cs, &ray);
+                    Spectrum L(0.f);
+                    if (rayWeight > 0)
+                        L = rayWeight *
+                            Li(ray, scene, sampler, arena, *lightDistribution);
+                    if (L.HasNaNs() || L.y() < 0) L = Spectrum(0.f);
+                    arena.Reset();
+
+                    // Flood the block with the sample's value
+                    int x0 = col * block, y0 = (int)row * block;
+                    for (int y = y0; y < std::min(y0 + block, height); ++y)
+                        for (int x = x0; x < std::min(x0 + block, width); ++x)
+                            frame[x + y * width] = L;
+                }
+            },
+            by, std::max(1, 16 / block));
+        if (block > 1) film->SetImage(&frame[0]);
+    }
+
+    // Blend the frame into the running average; capping the weight lets
+    // session edits fade out of old samples within _maxAccumFrames_
+    previewAccumFrames = std::min(previewAccumFrames + 1, maxAccumFrames);
+    Float alpha = (Float)1 / previewAccumFrames;
+    ParallelFor(
+        [&](int64_t i) {
+            previewAccum[i] = Lerp(alpha, previewAccum[i], frame[i]);
+        },
+        nPixels, 4096);
+    ++nPreviewFrames;
+    film->SetImage(&previewAccum[0]);
+    film->WriteImage();
+}
+
+Integrator *CreatePreviewIntegrator(const ParamSet &params,
+                                    std::shared_ptr<const Camera> camera) {
+    int maxAccumFrames = params.FindOneInt("maxaccumframes", 32);
+    if (maxAccumFrames < 1) {
+        Warning("\"maxaccumframes\" must be at least one; using 1.");
+        maxAccumFrames = 1;
+    }
+    return new PreviewIntegrator(camera, maxAccumFrames);
+}
+
+}  // namespace pbrt
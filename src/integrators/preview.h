@@ -0,0 +1,83 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_INTEGRATORS_PREVIEW_H
+#define PBRT_INTEGRATORS_PREVIEW_H
+
+// integrators/preview.h*
+#include "pbrt.h"
+#include "integrator.h"
+#include "camera.h"
+#include "film.h"
+#include "lightdistrib.h"
+
+namespace pbrt {
+
+// PreviewIntegrator Declarations
+// Fast-convergence preview for interactive session mode: one sample per
+// pixel shaded with next-event estimation only, rendered coarse-to-fine
+// (a quarter-resolution image is pushed to the film before refinement
+// subdivides it), with successive session frames blended into a running
+// average so a stationary view keeps converging. Scheduled for
+// time-to-first-pixel rather than throughput.
+class PreviewIntegrator : public Integrator {
+  public:
+    // PreviewIntegrator Public Methods
+    PreviewIntegrator(std::shared_ptr<const Camera> camera,
+                      int maxAccumFrames)
+        : camera(camera), maxAccumFrames(maxAccumFrames) {}
+    void Render(const Scene &scene);
+
+  private:
+    // PreviewIntegrator Private Methods
+    Spectrum Li(const RayDifferential &ray, const Scene &scene,
+                Sampler &sampler, MemoryArena &arena,
+                const LightDistribution &lightDistrib) const;
+
+    // PreviewIntegrator Private Data
+    std::shared_ptr<const Camera> camera;
+    // Cap on the accumulation weight so that scene edits in session mode
+    // fade out of the running average instead of persisting indefinitely.
+    const int maxAccumFrames;
+};
+
+Integrator *CreatePreviewIntegrator(const ParamSet &params,
+                                    std::shared_ptr<const Camera> camera);
+
+}  // namespace pbrt
+
+#endif  // PBRT_INTEGRATORS_PREVIEW_H
@@ -58,6 +58,12 @@ STAT_INT_DISTRIBUTION(
     gridCellsPerVisiblePoint);
 STAT_MEMORY_COUNTER("Memory/SPPM Pixels", pixelMemoryBytes);
 STAT_FLOAT_DISTRIBUTION("Memory/SPPM BSDF and Grid Memory", memoryArenaMB);
+STAT_COUNTER("Stochastic Progressive Photon Mapping/Grid full rebuilds",
+             gridFullRebuilds);
+STAT_COUNTER(
+    "Stochastic Progressive Photon Mapping/Visible points re-binned "
+    "incrementally",
+    gridPixelsRebinned);
 
 // SPPM Local Definitions
 struct SPPMPixel {
@@ -84,9 +90,55 @@ struct SPPMPixel {
     Spectrum tau;
 };
 
-struct SPPMPixelListNode {
-    SPPMPixel *pixel;
-    SPPMPixelListNode *next;
+// The visible-point grid is stored as a counted, contiguous layout: a
+// parallel counting pass sizes each cell, a prefix sum assigns each cell
+// a contiguous range, and a second pass scatters the visible points into
+// structure-of-arrays bins.  The photon-lookup inner loop then streams
+// through a cell's positions and squared radii with no pointer chasing,
+// touching an SPPMPixel only for photons that actually land inside a
+// visible point's radius.
+//
+// The grid persists across SPPM iterations: with a static camera the
+// visible points only jitter within their pixels and the search radii
+// shrink slowly, so most points land in the same cells every iteration.
+// Build() leaves each cell some slack capacity and records which entries
+// each pixel owns; Update() then overwrites the entries of points whose
+// cell footprint is unchanged in place and re-bins only the points that
+// moved cells, falling back to a full rebuild when the grid's geometry is
+// no longer usable.
+struct VisiblePointGrid {
+    // VisiblePointGrid Public Methods
+    void Build(const SPPMPixel *pixels, int nPixels);
+    bool Update(const SPPMPixel *pixels, int nPixels);
+
+    // VisiblePointGrid Public Data
+    // Geometry the grid was last built for
+    Bounds3f bounds;
+    int res[3] = {1, 1, 1};
+    int baseRes = 0;
+    int hashSize = 0;
+    // Cell _h_'s live entries occupy [cellStart[h], cellEnd[h]); the slack
+    // up to cellStart[h+1] lets Update() re-bin moved points in place.
+    std::vector<int> cellStart;       // _hashSize_ + 1 entries
+    std::vector<int> cellEnd;
+    std::vector<Float> px, py, pz, r2;
+    std::vector<int> pixelIndex;
+    // Incremental update state: the cell of each entry, the entries each
+    // pixel owns (non-negative for the main arrays, ~index into the
+    // overflow arrays below), and the cell footprint each pixel was
+    // binned with.
+    std::vector<int> entryCell;
+    std::vector<std::vector<int>> pixelEntries;
+    std::vector<Point3i> pixelCellMin, pixelCellMax;
+    std::vector<uint8_t> pixelInGrid;
+    // Overflow bins for re-binned entries that didn't fit in their cell's
+    // slack. The photon lookup scans this short list only for cells
+    // flagged in _cellHasOverflow_; Update() forces a full rebuild--which
+    // compacts the overflow back into the cells--once it grows past a
+    // small fraction of the grid.
+    std::vector<int> overflowCell, overflowPixelIndex;
+    std::vector<Float> overflowPx, overflowPy, overflowPz, overflowR2;
+    std::vector<uint8_t> cellHasOverflow;
 };
 
 static bool ToGrid(const Point3f &p, const Bounds3f &bounds,
@@ -107,6 +159,303 @@ inline unsigned int hash(const Point3i &p, int hashSize) {
            hashSize;
 }
 
+void VisiblePointGrid::Build(const SPPMPixel *pixels, int nPixels) {
+    hashSize = nPixels;
+    // Compute grid bounds for SPPM visible points
+    bounds = Bounds3f();
+    Float maxRadius = 0.;
+    for (int i = 0; i < nPixels; ++i) {
+        const SPPMPixel &pixel = pixels[i];
+        if (pixel.vp.beta.IsBlack()) continue;
+        Bounds3f vpBound = Expand(Bounds3f(pixel.vp.p), pixel.radius);
+        bounds = Union(bounds, vpBound);
+        maxRadius = std::max(maxRadius, pixel.radius);
+    }
+    // Pad the bounds by a cell width so that points jittering outward on
+    // the next iterations stay inside and Update() isn't forced into a
+    // full rebuild by whichever point happens to define the bounds
+    bounds = Expand(bounds, maxRadius);
+
+    // Compute resolution of SPPM grid in each dimension
+    Vector3f diag = bounds.Diagonal();
+    Float maxDiag = MaxComponent(diag);
+    baseRes = (int)(maxDiag / maxRadius);
+    CHECK_GT(baseRes, 0);
+    for (int i = 0; i < 3; ++i)
+        res[i] = std::max((int)(baseRes * diag[i] / maxDiag), 1);
+
+    // Count the visible points overlapping each grid cell and record each
+    // pixel's cell footprint for later incremental updates
+    pixelCellMin.resize(nPixels);
+    pixelCellMax.resize(nPixels);
+    pixelInGrid.assign(nPixels, 0);
+    pixelEntries.resize(nPixels);
+    std::vector<std::atomic<int>> cellCount(hashSize);
+    ParallelFor([&](int pixelIndex) {
+        pixelEntries[pixelIndex].clear();
+        const SPPMPixel &pixel = pixels[pixelIndex];
+        if (!pixel.vp.beta.IsBlack()) {
+            // Count pixel's visible point in applicable grid cells
+            Float radius = pixel.radius;
+            Point3i pMin, pMax;
+            ToGrid(pixel.vp.p - Vector3f(radius, radius, radius), bounds,
+                   res, &pMin);
+            ToGrid(pixel.vp.p + Vector3f(radius, radius, radius), bounds,
+                   res, &pMax);
+            pixelCellMin[pixelIndex] = pMin;
+            pixelCellMax[pixelIndex] = pMax;
+            pixelInGrid[pixelIndex] = 1;
+            for (int z = pMin.z; z <= pMax.z; ++z)
+                for (int y = pMin.y; y <= pMax.y; ++y)
+                    for (int x = pMin.x; x <= pMax.x; ++x)
+                        cellCount[hash(Point3i(x, y, z), hashSize)]
+                            .fetch_add(1, std::memory_order_relaxed);
+            ReportValue(gridCellsPerVisiblePoint,
+                        (1 + pMax.x - pMin.x) * (1 + pMax.y - pMin.y) *
+                            (1 + pMax.z - pMin.z));
+        }
+    }, nPixels, 4096);
+
+    // Convert the counts to per-cell capacities--each non-empty cell gets
+    // ~25% slack for Update() to re-bin moved points into--assign each
+    // cell a contiguous range with a parallel prefix sum, and repurpose
+    // _cellCount_ as the cells' scatter cursors
+    cellStart.resize(hashSize + 1);
+    cellEnd.assign(hashSize, 0);
+    ParallelFor([&](int64_t h) {
+        int count = cellCount[h].load(std::memory_order_relaxed);
+        cellStart[h] = count + (count > 0 ? std::max(2, count / 4) : 0);
+    }, hashSize, 4096);
+    int totalCapacity = ParallelExclusiveScan(&cellStart[0], hashSize,
+                                              &cellStart[0]);
+    cellStart[hashSize] = totalCapacity;
+    ParallelFor([&](int64_t h) {
+        cellCount[h].store(cellStart[h], std::memory_order_relaxed);
+    }, hashSize, 4096);
+
+    // Scatter the visible points into their cells' SoA bins
+    px.resize(totalCapacity);
+    py.resize(totalCapacity);
+    pz.resize(totalCapacity);
+    r2.resize(totalCapacity);
+    pixelIndex.resize(totalCapacity);
+    entryCell.resize(totalCapacity);
+    ParallelFor([&](int pi) {
+        const SPPMPixel &pixel = pixels[pi];
+        if (!pixel.vp.beta.IsBlack()) {
+            Float radius = pixel.radius;
+            const Point3i &pMin = pixelCellMin[pi], &pMax = pixelCellMax[pi];
+            for (int z = pMin.z; z <= pMax.z; ++z)
+                for (int y = pMin.y; y <= pMax.y; ++y)
+                    for (int x = pMin.x; x <= pMax.x; ++x) {
+                        int h = hash(Point3i(x, y, z), hashSize);
+                        int i = cellCount[h].fetch_add(
+                            1, std::memory_order_relaxed);
+                        px[i] = pixel.vp.p.x;
+                        py[i] = pixel.vp.p.y;
+                        pz[i] = pixel.vp.p.z;
+                        r2[i] = radius * radius;
+                        pixelIndex[i] = pi;
+                        entryCell[i] = h;
+                        pixelEntries[pi].push_back(i);
+                    }
+        }
+    }, nPixels, 4096);
+    for (int h = 0; h < hashSize; ++h)
+        cellEnd[h] = cellCount[h].load(std::memory_order_relaxed);
+
+    // A fresh build compacts everything into the cells; clear the overflow
+    overflowCell.clear();
+    overflowPixelIndex.clear();
+    overflowPx.clear();
+    overflowPy.clear();
+    overflowPz.clear();
+    overflowR2.clear();
+    cellHasOverflow.assign(hashSize, 0);
+}
+
+bool VisiblePointGrid::Update(const SPPMPixel *pixels, int nPixels) {
+    if (baseRes == 0 || hashSize != nPixels) return false;
+    // The grid's geometry must still be usable: every visible point's
+    // radius-expanded bound inside _bounds_ (photons outside the bounds
+    // are rejected before the cell lookup), and the cells not yet more
+    // than twice the largest (monotonically shrinking) search radius.
+    Float maxRadius = 0.;
+    for (int i = 0; i < nPixels; ++i) {
+        const SPPMPixel &pixel = pixels[i];
+        if (pixel.vp.beta.IsBlack()) continue;
+        Bounds3f vpBound = Expand(Bounds3f(pixel.vp.p), pixel.radius);
+        if (!Inside(vpBound.pMin, bounds) || !Inside(vpBound.pMax, bounds))
+            return false;
+        maxRadius = std::max(maxRadius, pixel.radius);
+    }
+    if (maxRadius == 0) return false;
+    if (MaxComponent(bounds.Diagonal()) / baseRes > 2 * maxRadius)
+        return false;
+    // Rebuild once the overflow bins have accumulated enough entries that
+    // their linear scans start to matter in the photon lookup
+    if ((int)overflowCell.size() > hashSize / 64) return false;
+
+    // Update points whose cell footprint is unchanged in place (all of a
+    // pixel's entries carry the same position and squared radius, so no
+    // per-cell matching is needed) and collect the points that moved
+    std::vector<int> moved(nPixels);
+    std::atomic<int> nMoved{0};
+    ParallelFor([&](int pi) {
+        const SPPMPixel &pixel = pixels[pi];
+        if (pixel.vp.beta.IsBlack()) {
+            if (pixelInGrid[pi])
+                moved[nMoved.fetch_add(1, std::memory_order_relaxed)] = pi;
+            return;
+        }
+        Float radius = pixel.radius;
+        Point3i pMin, pMax;
+        ToGrid(pixel.vp.p - Vector3f(radius, radius, radius), bounds, res,
+               &pMin);
+        ToGrid(pixel.vp.p + Vector3f(radius, radius, radius), bounds, res,
+               &pMax);
+        if (pixelInGrid[pi] && pMin == pixelCellMin[pi] &&
+            pMax == pixelCellMax[pi]) {
+            for (int e : pixelEntries[pi]) {
+                if (e >= 0) {
+                    px[e] = pixel.vp.p.x;
+                    py[e] = pixel.vp.p.y;
+                    pz[e] = pixel.vp.p.z;
+                    r2[e] = radius * radius;
+                } else {
+                    int o = ~e;
+                    overflowPx[o] = pixel.vp.p.x;
+                    overflowPy[o] = pixel.vp.p.y;
+                    overflowPz[o] = pixel.vp.p.z;
+                    overflowR2[o] = radius * radius;
+                }
+            }
+        } else {
+            moved[nMoved.fetch_add(1, std::memory_order_relaxed)] = pi;
+        }
+    }, nPixels, 4096);
+    int nm = nMoved.load();
+    // A full parallel rebuild beats re-binning most of the image serially
+    if (nm > 2 * nPixels / 3) return false;
+    gridPixelsRebinned += nm;
+
+    // Re-bin the moved points. All removals run before any insertion so
+    // that the inserts see every cell at its lowest occupancy; a removal
+    // swaps the cell's last entry into the vacated slot.
+    for (int mi = 0; mi < nm; ++mi) {
+        int pi = moved[mi];
+        while (!pixelEntries[pi].empty()) {
+            int e = pixelEntries[pi].back();
+            pixelEntries[pi].pop_back();
+            if (e >= 0) {
+                int h = entryCell[e];
+                int last = --cellEnd[h];
+                if (e != last) {
+                    px[e] = px[last];
+                    py[e] = py[last];
+                    pz[e] = pz[last];
+                    r2[e] = r2[last];
+                    pixelIndex[e] = pixelIndex[last];
+                    entryCell[e] = entryCell[last];
+                    // Patch the swapped entry's owner record. (Under hash
+                    // collisions the owner can be _pi_ itself; that's
+                    // fine, since the patched record is only consumed
+                    // afterwards.)
+                    std::vector<int> &owner = pixelEntries[pixelIndex[e]];
+                    for (size_t k = 0; k < owner.size(); ++k)
+                        if (owner[k] == last) {
+                            owner[k] = e;
+                            break;
+                        }
+                }
+            } else {
+                // Remove an overflow entry the same way, then recompute
+                // its cell's overflow flag
+                int o = ~e;
+                int h = overflowCell[o];
+                int last = (int)overflowCell.size() - 1;
+                if (o != last) {
+                    overflowCell[o] = overflowCell[last];
+                    overflowPixelIndex[o] = overflowPixelIndex[last];
+                    overflowPx[o] = overflowPx[last];
+                    overflowPy[o] = overflowPy[last];
+                    overflowPz[o] = overflowPz[last];
+                    overflowR2[o] = overflowR2[last];
+                    std::vector<int> &owner =
+                        pixelEntries[overflowPixelIndex[o]];
+                    for (size_t k = 0; k < owner.size(); ++k)
+                        if (owner[k] == ~last) {
+                            owner[k] = ~o;
+                            break;
+                        }
+                }
+                overflowCell.pop_back();
+                overflowPixelIndex.pop_back();
+                overflowPx.pop_back();
+                overflowPy.pop_back();
+                overflowPz.pop_back();
+                overflowR2.pop_back();
+                cellHasOverflow[h] = 0;
+                for (int k = 0; k < (int)overflowCell.size(); ++k)
+                    if (overflowCell[k] == h) {
+                        cellHasOverflow[h] = 1;
+                        break;
+                    }
+            }
+        }
+        pixelInGrid[pi] = 0;
+    }
+
+    // Insert the moved points' new footprints into the cells' slack. A
+    // full cell forces a rebuild; Build() overwrites everything a partial
+    // update leaves behind.
+    for (int mi = 0; mi < nm; ++mi) {
+        int pi = moved[mi];
+        const SPPMPixel &pixel = pixels[pi];
+        if (pixel.vp.beta.IsBlack()) continue;
+        Float radius = pixel.radius;
+        Point3i pMin, pMax;
+        ToGrid(pixel.vp.p - Vector3f(radius, radius, radius), bounds, res,
+               &pMin);
+        ToGrid(pixel.vp.p + Vector3f(radius, radius, radius), bounds, res,
+               &pMax);
+        for (int z = pMin.z; z <= pMax.z; ++z)
+            for (int y = pMin.y; y <= pMax.y; ++y)
+                for (int x = pMin.x; x <= pMax.x; ++x) {
+                    int h = hash(Point3i(x, y, z), hashSize);
+                    if (cellEnd[h] < cellStart[h + 1]) {
+                        int e = cellEnd[h]++;
+                        px[e] = pixel.vp.p.x;
+                        py[e] = pixel.vp.p.y;
+                        pz[e] = pixel.vp.p.z;
+                        r2[e] = radius * radius;
+                        pixelIndex[e] = pi;
+                        entryCell[e] = h;
+                        pixelEntries[pi].push_back(e);
+                    } else {
+                        // The cell's slack is used up; spill the entry to
+                        // the overflow bins
+                        int o = (int)overflowCell.size();
+                        overflowCell.push_back(h);
+                        overflowPixelIndex.push_back(pi);
+                        overflowPx.push_back(pixel.vp.p.x);
+                        overflowPy.push_back(pixel.vp.p.y);
+                        overflowPz.push_back(pixel.vp.p.z);
+                        overflowR2.push_back(radius * radius);
+                        cellHasOverflow[h] = 1;
+                        pixelEntries[pi].push_back(~o);
+                    }
+                }
+        pixelCellMin[pi] = pMin;
+        pixelCellMax[pi] = pMax;
+        pixelInGrid[pi] = 1;
+        ReportValue(gridCellsPerVisiblePoint,
+                    (1 + pMax.x - pMin.x) * (1 + pMax.y - pMin.y) *
+                        (1 + pMax.z - pMin.z));
+    }
+    return true;
+}
+
 // SPPM Method Definitions
 void SPPMIntegrator::Render(const Scene &scene) {
     ProfilePhase p(Prof::IntegratorRender);
@@ -131,6 +480,9 @@ void SPPMIntegrator::Render(const Scene &scene) {
                    (pixelExtent.y + tileSize - 1) / tileSize);
     ProgressReporter progress(2 * nIterations, "Rendering");
     std::vector<MemoryArena> perThreadArenas(MaxThreadIndex());
+    // The visible-point grid persists across iterations so that most
+    // iterations can update it incrementally instead of rebuilding it
+    VisiblePointGrid grid;
     for (int iter = 0; iter < nIterations; ++iter) {
         // Generate SPPM visible points
         {
@@ -184,7 +536,12 @@ void SPPMIntegrator::Render(const Scene &scene) {
                         // Process SPPM camera ray intersection
 
                         // Compute BSDF at SPPM camera ray intersection
-                        isect.ComputeScatteringFunctions(ray, arena, true);
+                        // The visible point stores _isect.bsdf_ past this scope, so its
+                        // allocations must come from _arena_, not the
+                        // interaction itself.
+                        isect.ComputeScatteringFunctions(
+                            ray, arena, true, TransportMode::Radiance,
+                            /*allowInlineStorage=*/false);
                         if (!isect.bsdf) {
                             ray = isect.SpawnRay(ray.d);
                             --depth;
@@ -238,66 +595,17 @@ void SPPMIntegrator::Render(const Scene &scene) {
         }
         progress.Update();
 
-        // Create grid of all SPPM visible points
-        int gridRes[3];
-        Bounds3f gridBounds;
-        // Allocate grid for SPPM visible points
-        const int hashSize = nPixels;
-        std::vector<std::atomic<SPPMPixelListNode *>> grid(hashSize);
+        // Create grid of all SPPM visible points. Update() re-bins only
+        // the points that changed cells since the previous iteration;
+        // it declines--forcing a full rebuild--when the radii have shrunk
+        // out of the grid's resolution, a point left the grid bounds, or
+        // enough points moved that a parallel rebuild is cheaper.
         {
             ProfilePhase _(Prof::SPPMGridConstruction);
-
-            // Compute grid bounds for SPPM visible points
-            Float maxRadius = 0.;
-            for (int i = 0; i < nPixels; ++i) {
-                const SPPMPixel &pixel = pixels[i];
-                if (pixel.vp.beta.IsBlack()) continue;
-                Bounds3f vpBound = Expand(Bounds3f(pixel.vp.p), pixel.radius);
-                gridBounds = Union(gridBounds, vpBound);
-                maxRadius = std::max(maxRadius, pixel.radius);
+            if (!grid.Update(pixels.get(), nPixels)) {
+                ++gridFullRebuilds;
+                grid.Build(pixels.get(), nPixels);
             }
-
-            // Compute resolution of SPPM grid in each dimension
-            Vector3f diag = gridBounds.Diagonal();
-            Float maxDiag = MaxComponent(diag);
-            int baseGridRes = (int)(maxDiag / maxRadius);
-            CHECK_GT(baseGridRes, 0);
-            for (int i = 0; i < 3; ++i)
-                gridRes[i] = std::max((int)(baseGridRes * diag[i] / maxDiag), 1);
-
-            // Add visible points to SPPM grid
-            ParallelFor([&](int pixelIndex) {
-                MemoryArena &arena = perThreadArenas[ThreadIndex];
-                SPPMPixel &pixel = pixels[pixelIndex];
-                if (!pixel.vp.beta.IsBlack()) {
-                    // Add pixel's visible point to applicable grid cells
-                    Float radius = pixel.radius;
-                    Point3i pMin, pMax;
-                    ToGrid(pixel.vp.p - Vector3f(radius, radius, radius),
-                           gridBounds, gridRes, &pMin);
-                    ToGrid(pixel.vp.p + Vector3f(radius, radius, radius),
-                           gridBounds, gridRes, &pMax);
-                    for (int z = pMin.z; z <= pMax.z; ++z)
-                        for (int y = pMin.y; y <= pMax.y; ++y)
-                            for (int x = pMin.x; x <= pMax.x; ++x) {
-                                // Add visible point to grid cell $(x, y, z)$
-                                int h = hash(Point3i(x, y, z), hashSize);
-                                SPPMPixelListNode *node =
-                                    arena.Alloc<SPPMPixelListNode>();
-                                node->pixel = &pixel;
-
-                                // Atomically add _node_ to the start of
-                                // _grid[h]_'s linked list
-                                node->next = grid[h];
-                                while (grid[h].compare_exchange_weak(
-                                           node->next, node) == false)
-                                    ;
-                            }
-                    ReportValue(gridCellsPerVisiblePoint,
-                                (1 + pMax.x - pMin.x) * (1 + pMax.y - pMin.y) *
-                                    (1 + pMax.z - pMin.z));
-                }
-            }, nPixels, 4096);
         }
 
         // Trace photons and accumulate contributions
@@ -349,22 +657,27 @@ void SPPMIntegrator::Render(const Scene &scene) {
                     if (depth > 0) {
                         // Add photon contribution to nearby visible points
                         Point3i photonGridIndex;
-                        if (ToGrid(isect.p, gridBounds, gridRes,
+                        if (ToGrid(isect.p, grid.bounds, grid.res,
                                    &photonGridIndex)) {
-                            int h = hash(photonGridIndex, hashSize);
+                            int h = hash(photonGridIndex, grid.hashSize);
                             // Add photon contribution to visible points in
-                            // _grid[h]_
-                            for (SPPMPixelListNode *node =
-                                     grid[h].load(std::memory_order_relaxed);
-                                 node != nullptr; node = node->next) {
-                                ++visiblePointsChecked;
-                                SPPMPixel &pixel = *node->pixel;
-                                Float radius = pixel.radius;
-                                if (DistanceSquared(pixel.vp.p, isect.p) >
-                                    radius * radius)
+                            // cell _h_; the distance test streams through
+                            // the cell's SoA bin and only accepted photons
+                            // touch an SPPMPixel
+                            int begin = grid.cellStart[h];
+                            int end = grid.cellEnd[h];
+                            visiblePointsChecked += end - begin;
+                            for (int entry = begin; entry < end; ++entry) {
+                                Float dx = grid.px[entry] - isect.p.x;
+                                Float dy = grid.py[entry] - isect.p.y;
+                                Float dz = grid.pz[entry] - isect.p.z;
+                                if (dx * dx + dy * dy + dz * dz >
+                                    grid.r2[entry])
                                     continue;
                                 // Update _pixel_ $\Phi$ and $M$ for nearby
                                 // photon
+                                SPPMPixel &pixel =
+                                    pixels[grid.pixelIndex[entry]];
                                 Vector3f wi = -photonRay.d;
                                 Spectrum Phi =
                                     beta * pixel.vp.bsdf->f(pixel.vp.wo, wi);
@@ -372,6 +685,32 @@ void SPPMIntegrator::Render(const Scene &scene) {
                                     pixel.Phi[i].Add(Phi[i]);
                                 ++pixel.M;
                             }
+                            // Scan the cell's spilled entries, if any;
+                            // incremental grid updates occasionally park a
+                            // re-binned point in the (short) overflow bins
+                            if (grid.cellHasOverflow[h]) {
+                                int nOverflow = (int)grid.overflowCell.size();
+                                visiblePointsChecked += nOverflow;
+                                for (int o = 0; o < nOverflow; ++o) {
+                                    if (grid.overflowCell[o] != h) continue;
+                                    Float dx = grid.overflowPx[o] - isect.p.x;
+                                    Float dy = grid.overflowPy[o] - isect.p.y;
+                                    Float dz = grid.overflowPz[o] - isect.p.z;
+                                    if (dx * dx + dy * dy + dz * dz >
+                                        grid.overflowR2[o])
+                                        continue;
+                                    SPPMPixel &pixel =
+                                        pixels[grid.overflowPixelIndex[o]];
+                                    Vector3f wi = -photonRay.d;
+                                    Spectrum Phi =
+                                        beta *
+                                        pixel.vp.bsdf->f(pixel.vp.wo, wi);
+                                    for (int i = 0; i < Spectrum::nSamples;
+                                         ++i)
+                                        pixel.Phi[i].Add(Phi[i]);
+                                    ++pixel.M;
+                                }
+                            }
                         }
                     }
                     // Sample new photon ray direction
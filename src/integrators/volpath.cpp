@@ -46,10 +46,58 @@ STAT_INT_DISTRIBUTION("Integrator/Path length", pathLength);
 STAT_COUNTER("Integrator/Volume interactions", volumeInteractions);
 STAT_COUNTER("Integrator/Surface interactions", surfaceInteractions);
 
+// VolPath Local Definitions
+// Sample a parametric distance along _ray_ in [0, _tMax_] with density
+// proportional to the reciprocal squared distance to _pivot_
+// ("equiangular sampling", Kulla and Fajardo 2012), returning the
+// distance and its pdf per unit parametric distance.
+static Float SampleEquiangular(const Ray &ray, Float tMax,
+                               const Point3f &pivot, Float u, Float *pdf) {
+    // Decompose _pivot_ into its projection _delta_ along the ray and its
+    // perpendicular distance _D_; work in arc length so angles are
+    // meaningful.
+    Float dLength = ray.d.Length();
+    Vector3f dn = ray.d / dLength;
+    Float sMax = tMax * dLength;
+    Float delta = Dot(pivot - ray.o, dn);
+    Float D = (pivot - (ray.o + delta * dn)).Length();
+    D = std::max(D, (Float)1e-6f * std::max((Float)1, std::abs(delta)));
+    Float thetaA = std::atan2(-delta, D);
+    Float thetaB = std::atan2(sMax - delta, D);
+    if (thetaB - thetaA < 1e-7f) {
+        *pdf = 0;
+        return 0;
+    }
+    Float s = Clamp(delta + D * std::tan(Lerp(u, thetaA, thetaB)), (Float)0,
+                    sMax);
+    *pdf = dLength * D /
+           ((thetaB - thetaA) * (D * D + (s - delta) * (s - delta)));
+    return s / dLength;
+}
+
+// Return the pdf with which SampleEquiangular() produces the parametric
+// distance _t_.
+static Float EquiangularPdf(const Ray &ray, Float tMax, const Point3f &pivot,
+                            Float t) {
+    Float dLength = ray.d.Length();
+    Vector3f dn = ray.d / dLength;
+    Float sMax = tMax * dLength;
+    Float delta = Dot(pivot - ray.o, dn);
+    Float D = (pivot - (ray.o + delta * dn)).Length();
+    D = std::max(D, (Float)1e-6f * std::max((Float)1, std::abs(delta)));
+    Float thetaA = std::atan2(-delta, D);
+    Float thetaB = std::atan2(sMax - delta, D);
+    if (thetaB - thetaA < 1e-7f) return 0;
+    Float s = Clamp(t * dLength, (Float)0, sMax);
+    return dLength * D /
+           ((thetaB - thetaA) * (D * D + (s - delta) * (s - delta)));
+}
+
 // VolPathIntegrator Method Definitions
 void VolPathIntegrator::Preprocess(const Scene &scene, Sampler &sampler) {
     lightDistribution =
         CreateLightSampleDistribution(lightSampleStrategy, scene);
+    lightDistribution->Warmup(*camera);
 }
 
 Spectrum VolPathIntegrator::Li(const RayDifferential &r, const Scene &scene,
@@ -76,6 +124,7 @@ Spectrum VolPathIntegrator::Li(const RayDifferential &r, const Scene &scene,
 
         // Sample the participating medium, if present
         MediumInteraction mi;
+        Spectrum betaSegment = beta;
         if (ray.medium) beta *= ray.medium->Sample(ray, sampler, arena, &mi);
         if (beta.IsBlack()) break;
 
@@ -88,8 +137,77 @@ Spectrum VolPathIntegrator::Li(const RayDifferential &r, const Scene &scene,
             // Handle scattering at point in medium for volumetric path tracer
             const Distribution1D *lightDistrib =
                 lightDistribution->Lookup(mi.p);
-            L += beta * UniformSampleOneLight(mi, scene, arena, sampler, true,
-                                              lightDistrib);
+            // Estimate direct lighting with MIS between the medium's own
+            // distance sampling and equiangular sampling about the chosen
+            // light: transmittance-proportional distances rarely land
+            // near a light embedded in the medium, while equiangular
+            // placement is poor in optically thick media, and the balance
+            // heuristic keeps whichever strategy fits.  Media without an
+            // analytic distance pdf (the density grid) keep the
+            // single-vertex estimate below.
+            Float tScatter =
+                Dot(mi.p - ray.o, ray.d) / ray.d.LengthSquared();
+            Float distancePdf = ray.medium->Pdf_Sample(ray, tScatter);
+            bool sampledEquiangular = false;
+            if (distancePdf > 0 && scene.lights.size() > 0) {
+                // Choose one light and one pivot point on it, shared by
+                // both vertex placement strategies
+                Float lightPdf;
+                int lightNum =
+                    lightDistrib->SampleDiscrete(sampler.Get1D(), &lightPdf);
+                const std::shared_ptr<Light> &light = scene.lights[lightNum];
+                Vector3f wiPivot;
+                Float pivotPdf;
+                VisibilityTester pivotVis;
+                // Note: the pivot's radiance sample may be black -- a
+                // vertex outside a spotlight's cone, or facing the back
+                // of a one-sided emitter -- but a pivot position still
+                // exists, and the estimator pair below must run whenever
+                // one does. Gating it on the radiance value would add the
+                // equiangular integral only with the probability that the
+                // distance-sampled vertex sees the light, with nothing
+                // compensating: systematically darker than the true
+                // integral.
+                light->Sample_Li(mi, sampler.Get2D(), &wiPivot, &pivotPdf,
+                                 &pivotVis);
+                if (lightPdf > 0 && pivotPdf > 0) {
+                    sampledEquiangular = true;
+                    Point3f pivot = pivotVis.P1().p;
+
+                    // Add weighted direct lighting at distance-sampled vertex
+                    Float wDistance =
+                        distancePdf /
+                        (distancePdf +
+                         EquiangularPdf(ray, ray.tMax, pivot, tScatter));
+                    L += beta * wDistance *
+                         EstimateDirect(mi, sampler.Get2D(), *light,
+                                        sampler.Get2D(), scene, sampler,
+                                        arena, true) /
+                         lightPdf;
+
+                    // Add weighted direct lighting at equiangular vertex
+                    Float equiPdf;
+                    Float tEqui = SampleEquiangular(
+                        ray, ray.tMax, pivot, sampler.Get1D(), &equiPdf);
+                    if (equiPdf > 0) {
+                        MediumInteraction miEqui;
+                        Spectrum betaEqui =
+                            ray.medium->SampleAt(ray, tEqui, arena, &miEqui);
+                        Float wEqui =
+                            equiPdf /
+                            (equiPdf + ray.medium->Pdf_Sample(ray, tEqui));
+                        if (!betaEqui.IsBlack())
+                            L += betaSegment * betaEqui * wEqui / equiPdf *
+                                 EstimateDirect(miEqui, sampler.Get2D(),
+                                                *light, sampler.Get2D(),
+                                                scene, sampler, arena, true) /
+                                 lightPdf;
+                    }
+                }
+            }
+            if (!sampledEquiangular)
+                L += beta * UniformSampleOneLight(mi, scene, arena, sampler,
+                                                  true, lightDistrib);
 
             Vector3f wo = -ray.d, wi;
             mi.phase->Sample_p(wo, &wi, sampler.Get2D());
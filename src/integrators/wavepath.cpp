@@ -0,0 +1,404 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+// integrators/wavepath.cpp*
+#include "integrators/wavepath.h"
+#include "bssrdf.h"
+#include "camera.h"
+#include "film.h"
+#include "interaction.h"
+#include "morton.h"
+#include "paramset.h"
+#include "scene.h"
+#include "stats.h"
+
+#include <algorithm>
+
+namespace pbrt {
+
+STAT_INT_DISTRIBUTION("Integrator/Wavefront path length", wavePathLength);
+STAT_INT_DISTRIBUTION("Integrator/Wavefront shading batch size",
+                      waveBatchSize);
+
+// WavefrontPathIntegrator Method Definitions
+WavefrontPathIntegrator::WavefrontPathIntegrator(
+    int maxDepth, std::shared_ptr<const Camera> camera,
+    std::shared_ptr<Sampler> sampler, const Bounds2i &pixelBounds,
+    Float rrThreshold, const std::string &lightSampleStrategy)
+    : PathIntegrator(maxDepth, camera, sampler, pixelBounds, rrThreshold,
+                     lightSampleStrategy) {
+    if (camera->film->adaptiveSampling)
+        Warning("The \"wavepath\" integrator renders all of a tile's "
+                "samples together and ignores \"adaptivesampling\".");
+    if (camera->film->saveAOVs)
+        Warning("The \"wavepath\" integrator doesn't record AOVs; use the "
+                "\"path\" integrator for AOV renders.");
+}
+
+std::unique_ptr<FilmTile> WavefrontPathIntegrator::RenderTile(
+    const Scene &scene, const Bounds2i &tileBounds, int seed,
+    int64_t sampleBegin, int64_t sampleEnd) {
+    // Allocate _MemoryArena_ for tile
+    MemoryArena arena;
+    LOG(INFO) << "Starting image tile " << tileBounds << " (wavefront)";
+
+    // Get _FilmTile_ for tile
+    std::unique_ptr<FilmTile> filmTile = camera->film->GetFilmTile(tileBounds);
+
+    // Get one sampler instance per pixel: the tile's pixels advance through
+    // the wavefront stages together, so each needs its own dimension
+    // sequence rather than sharing one sequentially-used clone.
+    std::vector<Point2i> pixels;
+    std::vector<std::unique_ptr<Sampler>> samplers;
+    for (Point2i pixel : tileBounds) {
+        std::unique_ptr<Sampler> pixelSampler = sampler->Clone(seed);
+        {
+            ProfilePhase pp(Prof::StartPixel);
+            pixelSampler->StartPixel(pixel);
+        }
+        if (!InsideExclusive(pixel, pixelBounds)) continue;
+        // Jump to the first sample of the requested range (progressive
+        // waves); the sequence continues exactly across waves.
+        if (sampleBegin > 0) pixelSampler->SetSampleNumber(sampleBegin);
+        pixels.push_back(pixel);
+        samplers.push_back(std::move(pixelSampler));
+    }
+    if (sampleEnd < 0) sampleEnd = sampler->samplesPerPixel;
+    sampleEnd = std::min(sampleEnd, (int64_t)sampler->samplesPerPixel);
+
+    // The per-path state carried across wavefront stages; one WavePath per
+    // pixel of the tile, reused for each sample.
+    struct WavePath {
+        // The traversal stages carry only the lean base Ray; the camera
+        // ray's differentials stay behind in _cameraRays_ and are attached
+        // at shading time.
+        Ray ray;
+        Spectrum L, beta;
+        Point2f pFilm;
+        Float rayWeight = 0;
+        Float etaScale = 1;
+        int bounces = 0;
+        bool specularBounce = false;
+        int pixel = 0;  // index into _pixels_/_samplers_
+        CompactHit hit;
+        SurfaceInteraction isect;
+    };
+    std::vector<WavePath> paths(pixels.size());
+    std::vector<CameraSample> cameraSamples(pixels.size());
+    std::vector<RayDifferential> cameraRays(pixels.size());
+    std::vector<Float> cameraWeights(pixels.size());
+    std::vector<int> active, shadeQueue, stillActive, mortonOrder, reordered;
+    std::vector<Point3f> rayOrigins;
+    // Shadow rays from direct lighting are queued during shading and
+    // resolved in one coherent batch per bounce; see ShadowRayQueue.
+    ShadowRayQueue shadowRays;
+
+    for (int64_t sampleNum = sampleBegin; sampleNum < sampleEnd;
+         ++sampleNum) {
+        // Generate this wave's camera rays, one per pixel, as a batch
+        active.clear();
+        for (size_t i = 0; i < pixels.size(); ++i)
+            cameraSamples[i] = samplers[i]->GetCameraSample(pixels[i]);
+        camera->GenerateRaysN(&cameraSamples[0], (int)pixels.size(),
+                              &cameraRays[0], &cameraWeights[0]);
+        for (size_t i = 0; i < pixels.size(); ++i) {
+            WavePath &wp = paths[i];
+            wp.L = Spectrum(0.f);
+            wp.beta = Spectrum(1.f);
+            wp.pFilm = cameraSamples[i].pFilm;
+            wp.etaScale = 1;
+            wp.bounces = 0;
+            wp.specularBounce = false;
+            wp.pixel = (int)i;
+            wp.rayWeight = cameraWeights[i];
+            cameraRays[i].ScaleDifferentials(
+                1 / std::sqrt((Float)sampler->samplesPerPixel));
+            wp.ray = cameraRays[i];
+            if (wp.rayWeight > 0) active.push_back((int)i);
+        }
+
+        // Trace and shade the wave's paths one bounce at a time
+        while (!active.empty()) {
+            // Restore spatial coherence for secondary bounces: BSDF
+            // sampling scatters the rays, so sort them along a Morton
+            // curve through their origins and nearby rays traverse nearby
+            // parts of the scene together. Camera rays are already
+            // coherent in film order.
+            if (active.size() > 1 && paths[active[0]].bounces > 0) {
+                rayOrigins.clear();
+                for (int idx : active)
+                    rayOrigins.push_back(paths[idx].ray.o);
+                MortonReorder(&rayOrigins[0], (int)rayOrigins.size(),
+                              &mortonOrder);
+                reordered.clear();
+                for (int i : mortonOrder) reordered.push_back(active[i]);
+                active.swap(reordered);
+            }
+
+            // Intersect the wave's rays as a batch and handle escaped rays
+            shadeQueue.clear();
+            for (int idx : active) {
+                WavePath &wp = paths[idx];
+                bool foundIntersection =
+                    scene.IntersectCompact(wp.ray, &wp.hit);
+
+                // Reconstruct the full interaction only for hits that
+                // survive to shading or whose emission is needed; the
+                // intersection stage itself carries just the CompactHit
+                bool survives = foundIntersection && wp.bounces < maxDepth;
+                if (foundIntersection &&
+                    (survives || wp.bounces == 0 || wp.specularBounce))
+                    wp.hit.primitive->ComputeInteraction(wp.ray, wp.hit,
+                                                         &wp.isect);
+
+                // Possibly add emitted light at intersection
+                if (wp.bounces == 0 || wp.specularBounce) {
+                    if (foundIntersection)
+                        wp.L.AddScaled(wp.isect.Le(-wp.ray.d), wp.beta);
+                    else
+                        for (const auto &light : scene.infiniteLights)
+                            wp.L.AddScaled(light->Le(wp.ray), wp.beta);
+                }
+
+                // Terminate path if ray escaped or _maxDepth_ was reached
+                if (!foundIntersection || wp.bounces >= maxDepth) {
+                    ReportValue(wavePathLength, wp.bounces);
+                    continue;
+                }
+                shadeQueue.push_back(idx);
+            }
+
+            // Sort the surviving hits by material so each material's
+            // shading code and textures stay hot across its whole batch
+            std::sort(shadeQueue.begin(), shadeQueue.end(),
+                      [&](int a, int b) {
+                          const Material *ma =
+                              paths[a].isect.primitive->GetMaterial();
+                          const Material *mb =
+                              paths[b].isect.primitive->GetMaterial();
+                          return ma != mb ? ma < mb : a < b;
+                      });
+            for (size_t i = 0; i < shadeQueue.size();) {
+                const Material *m =
+                    paths[shadeQueue[i]].isect.primitive->GetMaterial();
+                size_t j = i + 1;
+                while (j < shadeQueue.size() &&
+                       paths[shadeQueue[j]].isect.primitive->GetMaterial() ==
+                           m)
+                    ++j;
+                ReportValue(waveBatchSize, j - i);
+                i = j;
+            }
+
+            // Shade the material-sorted batch; each path samples direct
+            // lighting and a new direction exactly as PathIntegrator::Li
+            stillActive.clear();
+            for (int idx : shadeQueue) {
+                WavePath &wp = paths[idx];
+                Sampler &pathSampler = *samplers[wp.pixel];
+
+                // Compute scattering functions and skip over medium
+                // boundaries (which don't count as bounces). Only now are
+                // the camera ray's differentials reattached from the side
+                // table; bounce rays never carry any.
+                RayDifferential rayDiff(wp.ray);
+                if (wp.bounces == 0) {
+                    const RayDifferential &cameraRay = cameraRays[wp.pixel];
+                    if (cameraRay.hasDifferentials) {
+                        rayDiff.hasDifferentials = true;
+                        rayDiff.rxOrigin = cameraRay.rxOrigin;
+                        rayDiff.ryOrigin = cameraRay.ryOrigin;
+                        rayDiff.rxDirection = cameraRay.rxDirection;
+                        rayDiff.ryDirection = cameraRay.ryDirection;
+                    }
+                }
+                wp.isect.ComputeScatteringFunctions(rayDiff, arena, true);
+                if (!wp.isect.bsdf) {
+                    wp.ray = wp.isect.SpawnRay(wp.ray.d);
+                    stillActive.push_back(idx);
+                    continue;
+                }
+
+                const Distribution1D *distrib =
+                    lightDistribution->Lookup(wp.isect.p);
+
+                // Sample illumination from lights to find path
+                // contribution. (But skip this for perfectly specular
+                // BSDFs.)
+                if (wp.isect.bsdf->NumComponents(
+                        BxDFType(BSDF_ALL & ~BSDF_SPECULAR)) > 0)
+                    // The light sample's shadow ray is deferred into
+                    // _shadowRays_; the returned Spectrum holds only the
+                    // BSDF-sampling MIS term.
+                    wp.L.AddScaled(
+                        UniformSampleOneLight(wp.isect, scene, arena,
+                                              pathSampler, false, distrib,
+                                              false, &shadowRays, &wp.L,
+                                              wp.beta),
+                        wp.beta);
+
+                // Sample BSDF to get new path direction
+                Vector3f wo = -wp.ray.d, wi;
+                Float pdf;
+                BxDFType flags;
+                Spectrum f = wp.isect.bsdf->Sample_f(
+                    wo, &wi, pathSampler.Get2D(), &pdf, BSDF_ALL, &flags);
+                if (f.IsBlack() || pdf == 0.f) {
+                    ReportValue(wavePathLength, wp.bounces);
+                    continue;
+                }
+                wp.beta.MulScaled(f, AbsDot(wi, wp.isect.shading.n) / pdf);
+                wp.specularBounce = (flags & BSDF_SPECULAR) != 0;
+                if ((flags & BSDF_SPECULAR) && (flags & BSDF_TRANSMISSION)) {
+                    Float eta = wp.isect.bsdf->eta;
+                    wp.etaScale *= (Dot(wo, wp.isect.n) > 0)
+                                       ? (eta * eta)
+                                       : 1 / (eta * eta);
+                }
+                wp.ray = wp.isect.SpawnRay(wi);
+
+                // Account for subsurface scattering, if applicable
+                if (wp.isect.bssrdf && (flags & BSDF_TRANSMISSION)) {
+                    // Importance sample the BSSRDF
+                    SurfaceInteraction pi;
+                    Spectrum S = wp.isect.bssrdf->Sample_S(
+                        scene, pathSampler.Get1D(), pathSampler.Get2D(),
+                        arena, &pi, &pdf);
+                    if (S.IsBlack() || pdf == 0) {
+                        ReportValue(wavePathLength, wp.bounces);
+                        continue;
+                    }
+                    wp.beta.MulScaled(S, 1 / pdf);
+
+                    // Account for the direct subsurface scattering
+                    // component
+                    wp.L.AddScaled(
+                        UniformSampleOneLight(pi, scene, arena, pathSampler,
+                                              false,
+                                              lightDistribution->Lookup(pi.p),
+                                              false, &shadowRays, &wp.L,
+                                              wp.beta),
+                        wp.beta);
+
+                    // Account for the indirect subsurface scattering
+                    // component
+                    Spectrum f = pi.bsdf->Sample_f(pi.wo, &wi,
+                                                   pathSampler.Get2D(), &pdf,
+                                                   BSDF_ALL, &flags);
+                    if (f.IsBlack() || pdf == 0) {
+                        ReportValue(wavePathLength, wp.bounces);
+                        continue;
+                    }
+                    wp.beta.MulScaled(f, AbsDot(wi, pi.shading.n) / pdf);
+                    wp.specularBounce = (flags & BSDF_SPECULAR) != 0;
+                    wp.ray = pi.SpawnRay(wi);
+                }
+
+                // Possibly terminate the path with Russian roulette,
+                // factoring out radiance scaling due to refraction
+                Spectrum rrBeta = wp.beta * wp.etaScale;
+                if (rrBeta.MaxComponentValue() < rrThreshold &&
+                    wp.bounces > 3) {
+                    Float q = std::max((Float).05,
+                                       1 - rrBeta.MaxComponentValue());
+                    if (pathSampler.Get1D() < q) {
+                        ReportValue(wavePathLength, wp.bounces);
+                        continue;
+                    }
+                    wp.beta /= 1 - q;
+                }
+                ++wp.bounces;
+                stillActive.push_back(idx);
+            }
+
+            // Resolve the bounce's deferred shadow rays with a bulk
+            // occlusion test and apply the unoccluded contributions
+            shadowRays.Resolve(scene);
+            active.swap(stillActive);
+        }
+
+        // Add the wave's contributions to the film tile
+        for (size_t i = 0; i < pixels.size(); ++i) {
+            WavePath &wp = paths[i];
+            Spectrum L = wp.L;
+            if (L.HasNaNs()) {
+                LOG(ERROR) << StringPrintf(
+                    "Not-a-number radiance value returned for pixel (%d, "
+                    "%d), sample %d. Setting to black.",
+                    pixels[i].x, pixels[i].y, (int)sampleNum);
+                L = Spectrum(0.f);
+            } else if (L.y() < -1e-5 || std::isinf(L.y())) {
+                LOG(ERROR) << StringPrintf(
+                    "Invalid luminance value, %f, returned for pixel (%d, "
+                    "%d), sample %d. Setting to black.",
+                    L.y(), pixels[i].x, pixels[i].y, (int)sampleNum);
+                L = Spectrum(0.f);
+            }
+            filmTile->AddSample(wp.pFilm, L, wp.rayWeight);
+        }
+
+        // Free _MemoryArena_ memory from computing the wave's values
+        arena.Reset();
+        if (sampleNum + 1 < sampler->samplesPerPixel)
+            for (auto &pixelSampler : samplers)
+                pixelSampler->StartNextSample();
+    }
+    LOG(INFO) << "Finished image tile " << tileBounds;
+    return filmTile;
+}
+
+WavefrontPathIntegrator *CreateWavefrontPathIntegrator(
+    const ParamSet &params, std::shared_ptr<Sampler> sampler,
+    std::shared_ptr<const Camera> camera) {
+    int maxDepth = params.FindOneInt("maxdepth", 5);
+    int np;
+    const int *pb = params.FindInt("pixelbounds", &np);
+    Bounds2i pixelBounds = camera->film->GetSampleBounds();
+    if (pb) {
+        if (np != 4)
+            Error("Expected four values for \"pixelbounds\" parameter. Got %d.",
+                  np);
+        else {
+            pixelBounds = Intersect(pixelBounds,
+                                    Bounds2i{{pb[0], pb[2]}, {pb[1], pb[3]}});
+            if (pixelBounds.Area() == 0)
+                Error("Degenerate \"pixelbounds\" specified.");
+        }
+    }
+    Float rrThreshold = params.FindOneFloat("rrthreshold", 1.);
+    std::string lightStrategy =
+        params.FindOneString("lightsamplestrategy", "spatial");
+    return new WavefrontPathIntegrator(maxDepth, camera, sampler, pixelBounds,
+                                       rrThreshold, lightStrategy);
+}
+
+}  // namespace pbrt
@@ -0,0 +1,81 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_INTEGRATORS_WAVEPATH_H
+#define PBRT_INTEGRATORS_WAVEPATH_H
+
+// integrators/wavepath.h*
+#include "pbrt.h"
+#include "integrator.h"
+#include "path.h"
+
+namespace pbrt {
+
+// WavefrontPathIntegrator Declarations
+
+// WavefrontPathIntegrator computes the same estimator as PathIntegrator
+// but schedules a tile's rays breadth-first: all of a tile's camera rays
+// for one sample are generated together, intersected as a batch, and the
+// resulting hits are shaded in material-sorted order before the next
+// bounce's rays are traced. Traversal then runs back to back over many
+// rays and each material's shading code and textures stay hot across its
+// whole batch, instead of BSDF evaluation and BVH traversal interleaving
+// per ray as in the depth-first Li() path.
+class WavefrontPathIntegrator : public PathIntegrator {
+  public:
+    // WavefrontPathIntegrator Public Methods
+    WavefrontPathIntegrator(int maxDepth,
+                            std::shared_ptr<const Camera> camera,
+                            std::shared_ptr<Sampler> sampler,
+                            const Bounds2i &pixelBounds, Float rrThreshold = 1,
+                            const std::string &lightSampleStrategy = "spatial");
+
+  protected:
+    // WavefrontPathIntegrator Protected Methods
+    std::unique_ptr<FilmTile> RenderTile(const Scene &scene,
+                                         const Bounds2i &tileBounds, int seed,
+                                         int64_t sampleBegin,
+                                         int64_t sampleEnd) override;
+};
+
+WavefrontPathIntegrator *CreateWavefrontPathIntegrator(
+    const ParamSet &params, std::shared_ptr<Sampler> sampler,
+    std::shared_ptr<const Camera> camera);
+
+}  // namespace pbrt
+
+#endif  // PBRT_INTEGRATORS_WAVEPATH_H
@@ -80,6 +80,46 @@ Spectrum DiffuseAreaLight::Sample_Li(const Interaction &ref, const Point2f &u,
     return L(pShape, -*wi);
 }
 
+Spectrum DiffuseAreaLight::Sample_Li_Fast(const Interaction &ref,
+                                          const Point2f &u, Vector3f *wi,
+                                          Float *pdf,
+                                          ShadowRayDescriptor *shadow) const {
+    ProfilePhase _(Prof::LightSample);
+    Interaction pShape = shape->Sample(ref, u, pdf);
+    if (*pdf == 0 || (pShape.p - ref.p).LengthSquared() == 0) {
+        *pdf = 0;
+        return 0.f;
+    }
+    *wi = Normalize(pShape.p - ref.p);
+    shadow->p = pShape.p;
+    shadow->pError = pShape.pError;
+    shadow->n = pShape.n;
+    return L(pShape, -*wi);
+}
+
+void DiffuseAreaLight::Sample_LiN(const Interaction &ref, const Point2f *u,
+                                  int n, LightLiSample *samples) const {
+    ProfilePhase _(Prof::LightSample);
+    // Sample the shape once for the whole batch so shapes with batched
+    // kernels can amortize their per-reference-point setup.
+    std::vector<Interaction> pShape(n);
+    std::vector<Float> pdf(n);
+    shape->SampleN(ref, u, n, &pShape[0], &pdf[0]);
+    for (int i = 0; i < n; ++i) {
+        LightLiSample &s = samples[i];
+        pShape[i].mediumInterface = mediumInterface;
+        s.pdf = pdf[i];
+        if (s.pdf == 0 || (pShape[i].p - ref.p).LengthSquared() == 0) {
+            s.pdf = 0;
+            s.Li = Spectrum(0.f);
+            continue;
+        }
+        s.wi = Normalize(pShape[i].p - ref.p);
+        s.vis = VisibilityTester(ref, pShape[i]);
+        s.Li = L(pShape[i], -s.wi);
+    }
+}
+
 Float DiffuseAreaLight::Pdf_Li(const Interaction &ref,
                                const Vector3f &wi) const {
     ProfilePhase _(Prof::LightPdf);
@@ -59,6 +59,11 @@ class DiffuseAreaLight : public AreaLight {
     Spectrum Power() const;
     Spectrum Sample_Li(const Interaction &ref, const Point2f &u, Vector3f *wo,
                        Float *pdf, VisibilityTester *vis) const;
+    Spectrum Sample_Li_Fast(const Interaction &ref, const Point2f &u,
+                            Vector3f *wi, Float *pdf,
+                            ShadowRayDescriptor *shadow) const;
+    void Sample_LiN(const Interaction &ref, const Point2f *u, int n,
+                    LightLiSample *samples) const;
     Float Pdf_Li(const Interaction &, const Vector3f &) const;
     Spectrum Sample_Le(const Point2f &u1, const Point2f &u2, Float time,
                        Ray *ray, Normal3f *nLight, Float *pdfPos,
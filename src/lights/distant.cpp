@@ -44,7 +44,8 @@ DistantLight::DistantLight(const Transform &LightToWorld, const Spectrum &L,
                            const Vector3f &wLight)
     : Light((int)LightFlags::DeltaDirection, LightToWorld, MediumInterface()),
       L(L),
-      wLight(Normalize(LightToWorld(wLight))) {}
+      wLight(Normalize(LightToWorld(wLight))),
+      trCache(this->wLight) {}
 
 Spectrum DistantLight::Sample_Li(const Interaction &ref, const Point2f &u,
                                  Vector3f *wi, Float *pdf,
@@ -53,8 +54,20 @@ Spectrum DistantLight::Sample_Li(const Interaction &ref, const Point2f &u,
     *wi = wLight;
     *pdf = 1;
     Point3f pOutside = ref.p + wLight * (2 * worldRadius);
-    *vis =
-        VisibilityTester(ref, Interaction(pOutside, ref.time, mediumInterface));
+    *vis = VisibilityTester(
+        ref, Interaction(pOutside, ref.time, mediumInterface), &trCache);
+    return L;
+}
+
+Spectrum DistantLight::Sample_Li_Fast(const Interaction &ref, const Point2f &u,
+                                      Vector3f *wi, Float *pdf,
+                                      ShadowRayDescriptor *shadow) const {
+    ProfilePhase _(Prof::LightSample);
+    *wi = wLight;
+    *pdf = 1;
+    shadow->p = ref.p + wLight * (2 * worldRadius);
+    shadow->pError = Vector3f();
+    shadow->n = Normal3f();
     return L;
 }
 
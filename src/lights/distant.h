@@ -57,6 +57,9 @@ class DistantLight : public Light {
     }
     Spectrum Sample_Li(const Interaction &ref, const Point2f &u, Vector3f *wi,
                        Float *pdf, VisibilityTester *vis) const;
+    Spectrum Sample_Li_Fast(const Interaction &ref, const Point2f &u,
+                            Vector3f *wi, Float *pdf,
+                            ShadowRayDescriptor *shadow) const;
     Spectrum Power() const;
     Float Pdf_Li(const Interaction &, const Vector3f &) const;
     Spectrum Sample_Le(const Point2f &u1, const Point2f &u2, Float time,
@@ -69,6 +72,9 @@ class DistantLight : public Light {
     // DistantLight Private Data
     const Spectrum L;
     const Vector3f wLight;
+    // All shadow rays toward the light share the direction _wLight_, so
+    // medium transmittance along them is cached; see TransmittanceCache.
+    TransmittanceCache trCache;
     Point3f worldCenter;
     Float worldRadius;
 };
@@ -33,6 +33,7 @@
 
 // lights/goniometric.cpp*
 #include "lights/goniometric.h"
+#include "parallel.h"
 #include "paramset.h"
 #include "sampling.h"
 #include "stats.h"
@@ -40,6 +41,66 @@
 namespace pbrt {
 
 // GonioPhotometricLight Method Definitions
+GonioPhotometricLight::GonioPhotometricLight(
+    const Transform &LightToWorld, const MediumInterface &mediumInterface,
+    const Spectrum &I, const std::string &texname)
+    : Light((int)LightFlags::DeltaPosition, LightToWorld, mediumInterface),
+      pLight(LightToWorld(Point3f(0, 0, 0))),
+      I(I) {
+    // Create _mipmap_ for _GonioPhotometricLight_
+    Point2i resolution;
+    std::unique_ptr<RGBSpectrum[]> texels = ReadImage(texname, &resolution);
+    if (texels)
+        mipmap.reset(new MIPMap<RGBSpectrum>(resolution, texels.get()));
+    if (!mipmap) return;
+
+    // Resample the goniophotometric map into an equal-area octahedral
+    // table; IES-derived maps are low resolution, so the table stays
+    // compact while the per-texel spherical conversion here replaces two
+    // inverse trigonometric calls and a mip lookup per emitted sample.
+    octRes = std::max(mipmap->Width(), mipmap->Height());
+    octMap.resize((size_t)octRes * octRes);
+    Float filterWidth = 1.f / octRes;
+    ParallelFor(
+        [&](int64_t y) {
+            for (int x = 0; x < octRes; ++x) {
+                Vector3f w = OctahedralDirection(
+                    Point2f((x + .5f) / octRes, (y + .5f) / octRes));
+                // The goniometric map's polar axis is the light-space
+                // $y$ axis; see Scale()
+                std::swap(w.y, w.z);
+                Point2f st(SphericalPhi(w) * Inv2Pi,
+                           SphericalTheta(w) * InvPi);
+                octMap[x + y * octRes] = mipmap->Lookup(st, filterWidth);
+            }
+        },
+        octRes, 32);
+
+    // Build the emission sampling distribution jointly over the same
+    // table; octahedral texels subtend equal solid angle, so no
+    // $\sin\theta$ correction is needed.
+    std::unique_ptr<Float[]> img(new Float[(size_t)octRes * octRes]);
+    for (int i = 0; i < octRes * octRes; ++i) img[i] = octMap[i].y();
+    distribution.reset(new Distribution2D(img.get(), octRes, octRes));
+}
+
+Spectrum GonioPhotometricLight::Scale(const Vector3f &w) const {
+    if (!mipmap) return Spectrum(1.f);
+    // Bilinear fetch from the octahedral table; see OctahedralUV()
+    Point2f uv = OctahedralUV(Normalize(WorldToLight(w)));
+    Float fx = uv.x * octRes - .5f, fy = uv.y * octRes - .5f;
+    int x0 = (int)std::floor(fx), y0 = (int)std::floor(fy);
+    Float dx = fx - x0, dy = fy - y0;
+    int x1 = Clamp(x0 + 1, 0, octRes - 1), y1 = Clamp(y0 + 1, 0, octRes - 1);
+    x0 = Clamp(x0, 0, octRes - 1);
+    y0 = Clamp(y0, 0, octRes - 1);
+    RGBSpectrum s = (1 - dx) * (1 - dy) * octMap[x0 + y0 * octRes] +
+                    dx * (1 - dy) * octMap[x1 + y0 * octRes] +
+                    (1 - dx) * dy * octMap[x0 + y1 * octRes] +
+                    dx * dy * octMap[x1 + y1 * octRes];
+    return Spectrum(s, SpectrumType::Illuminant);
+}
+
 Spectrum GonioPhotometricLight::Sample_Li(const Interaction &ref,
                                           const Point2f &u, Vector3f *wi,
                                           Float *pdf,
@@ -52,6 +113,18 @@ Spectrum GonioPhotometricLight::Sample_Li(const Interaction &ref,
     return I * Scale(-*wi) / DistanceSquared(pLight, ref.p);
 }
 
+Spectrum GonioPhotometricLight::Sample_Li_Fast(
+    const Interaction &ref, const Point2f &u, Vector3f *wi, Float *pdf,
+    ShadowRayDescriptor *shadow) const {
+    ProfilePhase _(Prof::LightSample);
+    *wi = Normalize(pLight - ref.p);
+    *pdf = 1.f;
+    shadow->p = pLight;
+    shadow->pError = Vector3f();
+    shadow->n = Normal3f();
+    return I * Scale(-*wi) / DistanceSquared(pLight, ref.p);
+}
+
 Spectrum GonioPhotometricLight::Power() const {
     return 4 * Pi * I * Spectrum(mipmap ? mipmap->Lookup(Point2f(.5f, .5f), .5f)
                                         : RGBSpectrum(1.f),
@@ -68,19 +141,35 @@ Spectrum GonioPhotometricLight::Sample_Le(const Point2f &u1, const Point2f &u2,
                                           Normal3f *nLight, Float *pdfPos,
                                           Float *pdfDir) const {
     ProfilePhase _(Prof::LightSample);
-    *ray = Ray(pLight, UniformSampleSphere(u1), Infinity, time,
-               mediumInterface.inside);
+    // Sample an emission direction from the octahedral distribution;
+    // texels subtend equal solid angle, so the $(u,v)$ density converts by
+    // the constant factor $1/(4\pi)$.
+    Vector3f w;
+    if (distribution) {
+        Float mapPdf;
+        Point2f uv = distribution->SampleContinuous(u1, &mapPdf);
+        if (mapPdf == 0) return Spectrum(0.f);
+        w = LightToWorld(OctahedralDirection(uv));
+        *pdfDir = mapPdf * Inv4Pi;
+    } else {
+        w = UniformSampleSphere(u1);
+        *pdfDir = UniformSpherePdf();
+    }
+    *ray = Ray(pLight, w, Infinity, time, mediumInterface.inside);
     *nLight = (Normal3f)ray->d;
     *pdfPos = 1.f;
-    *pdfDir = UniformSpherePdf();
     return I * Scale(ray->d);
 }
 
-void GonioPhotometricLight::Pdf_Le(const Ray &, const Normal3f &, Float *pdfPos,
-                                   Float *pdfDir) const {
+void GonioPhotometricLight::Pdf_Le(const Ray &ray, const Normal3f &,
+                                   Float *pdfPos, Float *pdfDir) const {
     ProfilePhase _(Prof::LightPdf);
     *pdfPos = 0.f;
-    *pdfDir = UniformSpherePdf();
+    *pdfDir =
+        distribution
+            ? distribution->Pdf(OctahedralUV(Normalize(WorldToLight(ray.d)))) *
+                  Inv4Pi
+            : UniformSpherePdf();
 }
 
 std::shared_ptr<GonioPhotometricLight> CreateGoniometricLight(
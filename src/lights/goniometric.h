@@ -45,6 +45,7 @@
 #include "scene.h"
 #include "mipmap.h"
 #include "imageio.h"
+#include "sampling.h"
 
 namespace pbrt {
 
@@ -54,27 +55,13 @@ class GonioPhotometricLight : public Light {
     // GonioPhotometricLight Public Methods
     Spectrum Sample_Li(const Interaction &ref, const Point2f &u, Vector3f *wi,
                        Float *pdf, VisibilityTester *vis) const;
+    Spectrum Sample_Li_Fast(const Interaction &ref, const Point2f &u,
+                            Vector3f *wi, Float *pdf,
+                            ShadowRayDescriptor *shadow) const;
     GonioPhotometricLight(const Transform &LightToWorld,
                           const MediumInterface &mediumInterface,
-                          const Spectrum &I, const std::string &texname)
-        : Light((int)LightFlags::DeltaPosition, LightToWorld, mediumInterface),
-          pLight(LightToWorld(Point3f(0, 0, 0))),
-          I(I) {
-        // Create _mipmap_ for _GonioPhotometricLight_
-        Point2i resolution;
-        std::unique_ptr<RGBSpectrum[]> texels = ReadImage(texname, &resolution);
-        if (texels)
-            mipmap.reset(new MIPMap<RGBSpectrum>(resolution, texels.get()));
-    }
-    Spectrum Scale(const Vector3f &w) const {
-        Vector3f wp = Normalize(WorldToLight(w));
-        std::swap(wp.y, wp.z);
-        Float theta = SphericalTheta(wp);
-        Float phi = SphericalPhi(wp);
-        Point2f st(phi * Inv2Pi, theta * InvPi);
-        return !mipmap ? RGBSpectrum(1.f)
-                       : Spectrum(mipmap->Lookup(st), SpectrumType::Illuminant);
-    }
+                          const Spectrum &I, const std::string &texname);
+    Spectrum Scale(const Vector3f &w) const;
     Spectrum Power() const;
     Float Pdf_Li(const Interaction &, const Vector3f &) const;
     Spectrum Sample_Le(const Point2f &u1, const Point2f &u2, Float time,
@@ -88,6 +75,13 @@ class GonioPhotometricLight : public Light {
     const Point3f pLight;
     const Spectrum I;
     std::unique_ptr<MIPMap<RGBSpectrum>> mipmap;
+    // Equal-area octahedral resampling of the goniophotometric map;
+    // Scale() indexes it directly with no trigonometry, and
+    // _distribution_, built jointly over the same table,
+    // importance-samples emitted directions in Sample_Le().
+    std::vector<RGBSpectrum> octMap;
+    int octRes = 0;
+    std::unique_ptr<Distribution2D> distribution;
 };
 
 std::shared_ptr<GonioPhotometricLight> CreateGoniometricLight(
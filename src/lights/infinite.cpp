@@ -79,8 +79,28 @@ InfiniteAreaLight::InfiniteAreaLight(const Transform &LightToWorld,
         },
         height, 32);
 
-    // Compute sampling distributions for rows and columns of image
-    distribution.reset(new Distribution2D(img.get(), width, height));
+    // Build the hierarchical sampling pyramid over the image.  MIPMap
+    // rounds its resolution up to a power of two, so _width_ and _height_
+    // satisfy Hierarchical2DWarp's requirements directly.
+    distribution.reset(new Hierarchical2DWarp(img.get(), width, height));
+
+    // Resample the environment map into an octahedral parameterization for
+    // Le(); one spherical conversion per texel here replaces two inverse
+    // trigonometric calls per escaped ray at render time.
+    octRes = std::max(Lmap->Width(), Lmap->Height());
+    octMap.resize((size_t)octRes * octRes);
+    Float filterWidth = 1.f / octRes;
+    ParallelFor(
+        [&](int64_t y) {
+            for (int x = 0; x < octRes; ++x) {
+                Vector3f w = OctahedralDirection(
+                    Point2f((x + .5f) / octRes, (y + .5f) / octRes));
+                Point2f st(SphericalPhi(w) * Inv2Pi,
+                           SphericalTheta(w) * InvPi);
+                octMap[x + y * octRes] = Lmap->Lookup(st, filterWidth);
+            }
+        },
+        octRes, 32);
 }
 
 Spectrum InfiniteAreaLight::Power() const {
@@ -91,8 +111,19 @@ Spectrum InfiniteAreaLight::Power() const {
 
 Spectrum InfiniteAreaLight::Le(const RayDifferential &ray) const {
     Vector3f w = Normalize(WorldToLight(ray.d));
-    Point2f st(SphericalPhi(w) * Inv2Pi, SphericalTheta(w) * InvPi);
-    return Spectrum(Lmap->Lookup(st), SpectrumType::Illuminant);
+    // Bilinear fetch from the octahedral map; see OctahedralUV()
+    Point2f uv = OctahedralUV(w);
+    Float fx = uv.x * octRes - .5f, fy = uv.y * octRes - .5f;
+    int x0 = (int)std::floor(fx), y0 = (int)std::floor(fy);
+    Float dx = fx - x0, dy = fy - y0;
+    int x1 = Clamp(x0 + 1, 0, octRes - 1), y1 = Clamp(y0 + 1, 0, octRes - 1);
+    x0 = Clamp(x0, 0, octRes - 1);
+    y0 = Clamp(y0, 0, octRes - 1);
+    RGBSpectrum L = (1 - dx) * (1 - dy) * octMap[x0 + y0 * octRes] +
+                    dx * (1 - dy) * octMap[x1 + y0 * octRes] +
+                    (1 - dx) * dy * octMap[x0 + y1 * octRes] +
+                    dx * dy * octMap[x1 + y1 * octRes];
+    return Spectrum(L, SpectrumType::Illuminant);
 }
 
 Spectrum InfiniteAreaLight::Sample_Li(const Interaction &ref, const Point2f &u,
@@ -121,6 +152,34 @@ Spectrum InfiniteAreaLight::Sample_Li(const Interaction &ref, const Point2f &u,
     return Spectrum(Lmap->Lookup(uv), SpectrumType::Illuminant);
 }
 
+Spectrum InfiniteAreaLight::Sample_Li_Fast(const Interaction &ref,
+                                           const Point2f &u, Vector3f *wi,
+                                           Float *pdf,
+                                           ShadowRayDescriptor *shadow) const {
+    ProfilePhase _(Prof::LightSample);
+    // Find $(u,v)$ sample coordinates in infinite light texture
+    Float mapPdf;
+    Point2f uv = distribution->SampleContinuous(u, &mapPdf);
+    if (mapPdf == 0) return Spectrum(0.f);
+
+    // Convert infinite light sample point to direction
+    Float theta = uv[1] * Pi, phi = uv[0] * 2 * Pi;
+    Float cosTheta = std::cos(theta), sinTheta = std::sin(theta);
+    Float sinPhi = std::sin(phi), cosPhi = std::cos(phi);
+    *wi =
+        LightToWorld(Vector3f(sinTheta * cosPhi, sinTheta * sinPhi, cosTheta));
+
+    // Compute PDF for sampled infinite light direction
+    *pdf = mapPdf / (2 * Pi * Pi * sinTheta);
+    if (sinTheta == 0) *pdf = 0;
+
+    // Return radiance value for infinite light direction
+    shadow->p = ref.p + *wi * (2 * worldRadius);
+    shadow->pError = Vector3f();
+    shadow->n = Normal3f();
+    return Spectrum(Lmap->Lookup(uv), SpectrumType::Illuminant);
+}
+
 Float InfiniteAreaLight::Pdf_Li(const Interaction &, const Vector3f &w) const {
     ProfilePhase _(Prof::LightPdf);
     Vector3f wi = WorldToLight(w);
@@ -61,6 +61,9 @@ class InfiniteAreaLight : public Light {
     Spectrum Le(const RayDifferential &ray) const;
     Spectrum Sample_Li(const Interaction &ref, const Point2f &u, Vector3f *wi,
                        Float *pdf, VisibilityTester *vis) const;
+    Spectrum Sample_Li_Fast(const Interaction &ref, const Point2f &u,
+                            Vector3f *wi, Float *pdf,
+                            ShadowRayDescriptor *shadow) const;
     Float Pdf_Li(const Interaction &, const Vector3f &) const;
     Spectrum Sample_Le(const Point2f &u1, const Point2f &u2, Float time,
                        Ray *ray, Normal3f *nLight, Float *pdfPos,
@@ -71,9 +74,14 @@ class InfiniteAreaLight : public Light {
   private:
     // InfiniteAreaLight Private Data
     std::unique_ptr<MIPMap<RGBSpectrum>> Lmap;
+    // Octahedral-mapped copy of the environment map, resampled from the
+    // lat-long source at load; Le() maps directions into it with
+    // arithmetic only instead of per-ray inverse trigonometry.
+    int octRes;
+    std::vector<RGBSpectrum> octMap;
     Point3f worldCenter;
     Float worldRadius;
-    std::unique_ptr<Distribution2D> distribution;
+    std::unique_ptr<Hierarchical2DWarp> distribution;
 };
 
 std::shared_ptr<InfiniteAreaLight> CreateInfiniteLight(
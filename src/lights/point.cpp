@@ -52,6 +52,18 @@ Spectrum PointLight::Sample_Li(const Interaction &ref, const Point2f &u,
     return I / DistanceSquared(pLight, ref.p);
 }
 
+Spectrum PointLight::Sample_Li_Fast(const Interaction &ref, const Point2f &u,
+                                    Vector3f *wi, Float *pdf,
+                                    ShadowRayDescriptor *shadow) const {
+    ProfilePhase _(Prof::LightSample);
+    *wi = Normalize(pLight - ref.p);
+    *pdf = 1.f;
+    shadow->p = pLight;
+    shadow->pError = Vector3f();
+    shadow->n = Normal3f();
+    return I / DistanceSquared(pLight, ref.p);
+}
+
 Spectrum PointLight::Power() const { return 4 * Pi * I; }
 
 Float PointLight::Pdf_Li(const Interaction &, const Vector3f &) const {
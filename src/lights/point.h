@@ -56,6 +56,9 @@ class PointLight : public Light {
           I(I) {}
     Spectrum Sample_Li(const Interaction &ref, const Point2f &u, Vector3f *wi,
                        Float *pdf, VisibilityTester *vis) const;
+    Spectrum Sample_Li_Fast(const Interaction &ref, const Point2f &u,
+                            Vector3f *wi, Float *pdf,
+                            ShadowRayDescriptor *shadow) const;
     Spectrum Power() const;
     Float Pdf_Li(const Interaction &, const Vector3f &) const;
     Spectrum Sample_Le(const Point2f &u1, const Point2f &u2, Float time,
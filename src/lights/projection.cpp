@@ -52,8 +52,12 @@ ProjectionLight::ProjectionLight(const Transform &LightToWorld,
     // Create _ProjectionLight_ MIP map
     Point2i resolution;
     std::unique_ptr<RGBSpectrum[]> texels = ReadImage(texname, &resolution);
-    if (texels)
+    if (texels) {
         projectionMap.reset(new MIPMap<RGBSpectrum>(resolution, texels.get()));
+        // Keep the finest level for direct lookups in Projection()
+        projTexels = std::move(texels);
+        projResolution = resolution;
+    }
 
     // Initialize _ProjectionLight_ projection matrix
     Float aspect =
@@ -84,6 +88,19 @@ Spectrum ProjectionLight::Sample_Li(const Interaction &ref, const Point2f &u,
     return I * Projection(-*wi) / DistanceSquared(pLight, ref.p);
 }
 
+Spectrum ProjectionLight::Sample_Li_Fast(const Interaction &ref,
+                                         const Point2f &u, Vector3f *wi,
+                                         Float *pdf,
+                                         ShadowRayDescriptor *shadow) const {
+    ProfilePhase _(Prof::LightSample);
+    *wi = Normalize(pLight - ref.p);
+    *pdf = 1;
+    shadow->p = pLight;
+    shadow->pError = Vector3f();
+    shadow->n = Normal3f();
+    return I * Projection(-*wi) / DistanceSquared(pLight, ref.p);
+}
+
 Spectrum ProjectionLight::Projection(const Vector3f &w) const {
     Vector3f wl = WorldToLight(w);
     // Discard directions behind projection light
@@ -94,7 +111,37 @@ Spectrum ProjectionLight::Projection(const Vector3f &w) const {
     if (!Inside(Point2f(p.x, p.y), screenBounds)) return 0.f;
     if (!projectionMap) return 1;
     Point2f st = Point2f(screenBounds.Offset(Point2f(p.x, p.y)));
-    return Spectrum(projectionMap->Lookup(st), SpectrumType::Illuminant);
+
+    // Bilinearly interpolate the finest-level texels directly; see the
+    // note at _projTexels_.
+    Float s = st.x * projResolution.x - .5f, t = st.y * projResolution.y - .5f;
+    int s0 = std::floor(s), t0 = std::floor(t);
+    Float ds = s - s0, dt = t - t0;
+    auto texel = [this](int si, int ti) -> const RGBSpectrum & {
+        si = Clamp(si, 0, projResolution.x - 1);
+        ti = Clamp(ti, 0, projResolution.y - 1);
+        return projTexels[ti * projResolution.x + si];
+    };
+    RGBSpectrum v = (1 - ds) * (1 - dt) * texel(s0, t0) +
+                    (1 - ds) * dt * texel(s0, t0 + 1) +
+                    ds * (1 - dt) * texel(s0 + 1, t0) +
+                    ds * dt * texel(s0 + 1, t0 + 1);
+    return Spectrum(v, SpectrumType::Illuminant);
+}
+
+void ProjectionLight::Sample_LiN(const Interaction &ref, const Point2f *u,
+                                 int n, LightLiSample *samples) const {
+    ProfilePhase _(Prof::LightSample);
+    Vector3f wi = Normalize(pLight - ref.p);
+    Spectrum Li = I * Projection(-wi) / DistanceSquared(pLight, ref.p);
+    VisibilityTester vis(ref,
+                         Interaction(pLight, ref.time, mediumInterface));
+    for (int i = 0; i < n; ++i) {
+        samples[i].Li = Li;
+        samples[i].wi = wi;
+        samples[i].pdf = 1;
+        samples[i].vis = vis;
+    }
 }
 
 Spectrum ProjectionLight::Power() const {
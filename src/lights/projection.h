@@ -55,7 +55,14 @@ class ProjectionLight : public Light {
                     const std::string &texname, Float fov);
     Spectrum Sample_Li(const Interaction &ref, const Point2f &u, Vector3f *wi,
                        Float *pdf, VisibilityTester *vis) const;
+    Spectrum Sample_Li_Fast(const Interaction &ref, const Point2f &u,
+                            Vector3f *wi, Float *pdf,
+                            ShadowRayDescriptor *shadow) const;
     Spectrum Projection(const Vector3f &w) const;
+    // Delta light: the batch computes the direction and the projection
+    // map lookup once and replicates them across the samples.
+    void Sample_LiN(const Interaction &ref, const Point2f *u, int n,
+                    LightLiSample *samples) const;
     Spectrum Power() const;
     Float Pdf_Li(const Interaction &, const Vector3f &) const;
     Spectrum Sample_Le(const Point2f &u1, const Point2f &u2, Float time,
@@ -67,6 +74,12 @@ class ProjectionLight : public Light {
   private:
     // ProjectionLight Private Data
     std::unique_ptr<MIPMap<RGBSpectrum>> projectionMap;
+    // The finest-level texels, kept alongside the MIPMap so Projection()
+    // can bilinearly interpolate them directly; a delta light projects
+    // from a single point, so there is no footprint to mip-filter and the
+    // per-sample Lookup() level selection is pure overhead.
+    std::unique_ptr<RGBSpectrum[]> projTexels;
+    Point2i projResolution;
     const Point3f pLight;
     const Spectrum I;
     Transform lightProjection;
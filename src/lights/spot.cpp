@@ -48,7 +48,14 @@ SpotLight::SpotLight(const Transform &LightToWorld,
       pLight(LightToWorld(Point3f(0, 0, 0))),
       I(I),
       cosTotalWidth(std::cos(Radians(totalWidth))),
-      cosFalloffStart(std::cos(Radians(falloffStart))) {}
+      cosFalloffStart(std::cos(Radians(falloffStart))) {
+    // Tabulate the quartic smoothstep used between the cone edges
+    invDeltaCos = 1 / (cosFalloffStart - cosTotalWidth);
+    for (int i = 0; i < falloffLUTSize; ++i) {
+        Float delta = Float(i) / (falloffLUTSize - 1);
+        falloffLUT[i] = (delta * delta) * (delta * delta);
+    }
+}
 
 Spectrum SpotLight::Sample_Li(const Interaction &ref, const Point2f &u,
                               Vector3f *wi, Float *pdf,
@@ -61,15 +68,43 @@ Spectrum SpotLight::Sample_Li(const Interaction &ref, const Point2f &u,
     return I * Falloff(-*wi) / DistanceSquared(pLight, ref.p);
 }
 
+Spectrum SpotLight::Sample_Li_Fast(const Interaction &ref, const Point2f &u,
+                                   Vector3f *wi, Float *pdf,
+                                   ShadowRayDescriptor *shadow) const {
+    ProfilePhase _(Prof::LightSample);
+    *wi = Normalize(pLight - ref.p);
+    *pdf = 1.f;
+    shadow->p = pLight;
+    shadow->pError = Vector3f();
+    shadow->n = Normal3f();
+    return I * Falloff(-*wi) / DistanceSquared(pLight, ref.p);
+}
+
 Float SpotLight::Falloff(const Vector3f &w) const {
     Vector3f wl = Normalize(WorldToLight(w));
     Float cosTheta = wl.z;
     if (cosTheta < cosTotalWidth) return 0;
     if (cosTheta >= cosFalloffStart) return 1;
-    // Compute falloff inside spotlight cone
-    Float delta =
-        (cosTheta - cosTotalWidth) / (cosFalloffStart - cosTotalWidth);
-    return (delta * delta) * (delta * delta);
+    // Look up falloff inside spotlight cone
+    Float delta = (cosTheta - cosTotalWidth) * invDeltaCos;
+    Float d = delta * (falloffLUTSize - 1);
+    int i = std::min((int)d, falloffLUTSize - 2);
+    return Lerp(d - i, falloffLUT[i], falloffLUT[i + 1]);
+}
+
+void SpotLight::Sample_LiN(const Interaction &ref, const Point2f *u, int n,
+                           LightLiSample *samples) const {
+    ProfilePhase _(Prof::LightSample);
+    Vector3f wi = Normalize(pLight - ref.p);
+    Spectrum Li = I * Falloff(-wi) / DistanceSquared(pLight, ref.p);
+    VisibilityTester vis(ref,
+                         Interaction(pLight, ref.time, mediumInterface));
+    for (int i = 0; i < n; ++i) {
+        samples[i].Li = Li;
+        samples[i].wi = wi;
+        samples[i].pdf = 1;
+        samples[i].vis = vis;
+    }
 }
 
 Spectrum SpotLight::Power() const {
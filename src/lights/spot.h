@@ -53,7 +53,15 @@ class SpotLight : public Light {
               const Spectrum &I, Float totalWidth, Float falloffStart);
     Spectrum Sample_Li(const Interaction &ref, const Point2f &u, Vector3f *wi,
                        Float *pdf, VisibilityTester *vis) const;
+    Spectrum Sample_Li_Fast(const Interaction &ref, const Point2f &u,
+                            Vector3f *wi, Float *pdf,
+                            ShadowRayDescriptor *shadow) const;
     Float Falloff(const Vector3f &w) const;
+    // Delta light: every sample from one reference point is identical, so
+    // the batch evaluates the direction, falloff, and distance term once
+    // and replicates them instead of repeating the work per sample.
+    void Sample_LiN(const Interaction &ref, const Point2f *u, int n,
+                    LightLiSample *samples) const;
     Spectrum Power() const;
     Float Pdf_Li(const Interaction &, const Vector3f &) const;
     Spectrum Sample_Le(const Point2f &u1, const Point2f &u2, Float time,
@@ -67,6 +75,13 @@ class SpotLight : public Light {
     const Point3f pLight;
     const Spectrum I;
     const Float cosTotalWidth, cosFalloffStart;
+    // Falloff between the cone edges tabulated over
+    // (cosTheta - cosTotalWidth) / (cosFalloffStart - cosTotalWidth),
+    // looked up with linear interpolation; _invDeltaCos_ is the
+    // precomputed reciprocal of that denominator.
+    static PBRT_CONSTEXPR int falloffLUTSize = 64;
+    Float falloffLUT[falloffLUTSize];
+    Float invDeltaCos;
 };
 
 std::shared_ptr<SpotLight> CreateSpotLight(const Transform &l2w,
@@ -34,25 +34,115 @@
 // main/pbrt.cpp*
 #include "pbrt.h"
 #include "api.h"
+#include "benchmark.h"
 #include "parser.h"
 #include "parallel.h"
 #include <glog/logging.h>
 
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <set>
+#include <thread>
+#include <sys/stat.h>
+#include <sys/types.h>
+
 using namespace pbrt;
 
 static void usage(const char *msg = nullptr) {
     if (msg)
         fprintf(stderr, "pbrt: %s\n\n", msg);
 
-    fprintf(stderr, R"(usage: pbrt [<options>] <filename.pbrt...>
+    fputs(R"(usage: pbrt [<options>] <filename.pbrt...>
 Rendering options:
+  --benchmark          Render as a fixed deterministic benchmark workload
+                       (16 samples per pixel, 4 threads unless --nthreads is
+                       given) and report phase-separated wall times (parse,
+                       accelerator build, render, image output) as JSON.
+  --benchmark-baseline <filename> Compare the benchmark phase times against
+                       the JSON written by a previous --benchmark run; exit
+                       with a nonzero status if the total time regressed by
+                       more than 5%.
+  --benchmark-out <filename> Write the benchmark JSON to the given file
+                       instead of standard output.
+  --checkpointseconds <num> Seconds between render checkpoints; 0 disables
+                       checkpointing. Default: 300.
+  --costheatmap        Accumulate per-pixel render cost during rendering and
+                       write it as a normalized false-color image with a
+                       "_cost" suffix next to the final image.
   --cropwindow <x0,x1,y0,y1> Specify an image crop window.
+  --distcoordinator <port> Coordinate a distributed render: listen on the
+                       given TCP port and hand film tiles to connecting
+                       worker processes (rendering locally as well).
+  --distworker <host:port> Join a distributed render as a worker: parse the
+                       same scene file, connect to the coordinator, and
+                       render the tiles it hands out.
+  --deterministic      Render bit-identically at any thread count: sampler
+                       seeds derive from tile identity, film tiles merge in
+                       a fixed order, and splats accumulate in a canonical
+                       order (buffered in memory until the image is
+                       written). Disables cost-based tile scheduling and
+                       adaptive splat outlier rejection.
+  --display <host:port> Connect to a tev-style display server and stream
+                       the in-progress image to it while rendering.
+  --gpu                Run BVH traversal and wavefront shading on the GPU,
+                       with the CPU handling parsing, sampling, and film.
+                       Requires a CUDA-enabled build; other builds print a
+                       warning and render on the CPU.
+  --gpu-validate       With --gpu, also run the CPU intersection path and
+                       compare the device's results against it, reporting
+                       any mismatches.
   --help               Print this help text.
+  --memorybudget <MB>  Ask registered subsystems to spill memory when their
+                       combined usage approaches the given number of
+                       megabytes. Default: 0 (disabled).
   --nthreads <num>     Use specified number of threads for rendering.
   --outfile <filename> Write the final image to the given filename.
+  --partitiongrid <nx> <ny> Number of screen regions along x and y for
+                       --partitionmanifest. Default: 1 1.
+  --partitionmanifest <base> Instead of rendering, split the image into a
+                       grid of screen regions and write one manifest per
+                       region (<base>_rX_Y.txt) holding the region's crop
+                       window and the geometry/texture files whose bounds
+                       can affect it, so each farm node renders its region
+                       with only a fraction of the scene resident.
+  --perfcounters       Sample hardware performance counters (cycles,
+                       instructions, cache and branch misses) for the scene
+                       construction and rendering phases and include them in
+                       the statistics output. Linux only.
+  --previewseconds <num> Write a progressive preview image (suffix
+                       "_preview") every given number of seconds while
+                       rendering. Default: 0 (disabled).
+  --progressfile <filename> Periodically rewrite the given file with one
+                       JSON object holding the current run phase (parse,
+                       build, render), fraction complete, elapsed time, and
+                       a cost-weighted ETA, for farm schedulers to poll.
+  --profile-out <name> Write structured profiler output alongside the
+                       printed summary: <name>.trace.json holds a
+                       per-thread timeline in Chrome trace_event format
+                       (load it at chrome://tracing) and <name>.folded.txt
+                       holds collapsed stacks for flamegraph tools.
+  --progressive        Render in doubling sample-count waves (1, 2, 4, ...
+                       spp) over the whole film, writing the accumulated
+                       image after every wave, so the render can be stopped
+                       at any time with the best available result.
   --quick              Automatically reduce a number of quality settings to
                        render more quickly.
   --quiet              Suppress all text output other than error messages.
+  --resume             Restore the film and completed tiles from the
+                       checkpoint file left by an interrupted render.
+  --texcachemb <MB>    Page large texture MIP map levels out to a tiled
+                       on-disk cache and keep at most the given number of
+                       megabytes of tiles resident. Default: 0 (all
+                       textures stay resident).
+  --texreport          Record which MIP levels and tiles of each image
+                       texture are sampled during rendering and print a
+                       per-texture residency report afterwards.
+  --session            Stay alive after rendering, watch the scene file(s)
+                       (including Include files) for edits, and re-render on
+                       each change, reusing unchanged geometry, textures,
+                       and the previous acceleration structure. Exit with
+                       Ctrl-C.
 
 Logging options:
   --logdir <dir>       Specify directory that log files should be written to.
@@ -68,7 +158,14 @@ Reformatting options:
   --toply              Print a reformatted version of the input file(s) to
                        standard output and convert all triangle meshes to
                        PLY files. Does not render an image.
-)");
+  --toformat-binary    Convert each input file (with Include files inlined)
+                       to the binary scene format, written next to it with a
+                       ".pbb" extension. Binary scenes load without any text
+                       parsing and are detected automatically when given to
+                       pbrt or referenced by Include. Does not render an
+                       image.
+)",
+          stderr);
     exit(msg ? 1 : 0);
 }
 
@@ -98,6 +195,19 @@ int main(int argc, char *argv[]) {
             options.cropWindow[0][1] = atof(argv[++i]);
             options.cropWindow[1][0] = atof(argv[++i]);
             options.cropWindow[1][1] = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--partitiongrid") ||
+                   !strcmp(argv[i], "-partitiongrid")) {
+            if (i + 2 >= argc)
+                usage("missing value after --partitiongrid argument");
+            options.partitionGridX = atoi(argv[++i]);
+            options.partitionGridY = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--partitionmanifest") ||
+                   !strcmp(argv[i], "-partitionmanifest")) {
+            if (i + 1 == argc)
+                usage("missing value after --partitionmanifest argument");
+            options.partitionManifest = argv[++i];
+        } else if (!strncmp(argv[i], "--partitionmanifest=", 20)) {
+            options.partitionManifest = &argv[i][20];
         } else if (!strncmp(argv[i], "--outfile=", 10)) {
             options.imageFile = &argv[i][10];
         } else if (!strcmp(argv[i], "--logdir") || !strcmp(argv[i], "-logdir")) {
@@ -113,6 +223,112 @@ int main(int argc, char *argv[]) {
             FLAGS_minloglevel = atoi(argv[++i]);
         } else if (!strncmp(argv[i], "--minloglevel=", 14)) {
             FLAGS_minloglevel = atoi(&argv[i][14]);
+        } else if (!strcmp(argv[i], "--distcoordinator") ||
+                   !strcmp(argv[i], "-distcoordinator")) {
+            if (i + 1 == argc)
+                usage("missing value after --distcoordinator argument");
+            options.distCoordinatorPort = atoi(argv[++i]);
+        } else if (!strncmp(argv[i], "--distcoordinator=", 18)) {
+            options.distCoordinatorPort = atoi(&argv[i][18]);
+        } else if (!strcmp(argv[i], "--distworker") ||
+                   !strcmp(argv[i], "-distworker")) {
+            if (i + 1 == argc)
+                usage("missing value after --distworker argument");
+            options.distWorkerAddress = argv[++i];
+        } else if (!strncmp(argv[i], "--distworker=", 13)) {
+            options.distWorkerAddress = &argv[i][13];
+        } else if (!strcmp(argv[i], "--checkpointseconds") ||
+                   !strcmp(argv[i], "-checkpointseconds")) {
+            if (i + 1 == argc)
+                usage("missing value after --checkpointseconds argument");
+            options.checkpointSeconds = atoi(argv[++i]);
+        } else if (!strncmp(argv[i], "--checkpointseconds=", 20)) {
+            options.checkpointSeconds = atoi(&argv[i][20]);
+        } else if (!strcmp(argv[i], "--resume") || !strcmp(argv[i], "-resume")) {
+            options.resume = true;
+        } else if (!strcmp(argv[i], "--session") ||
+                   !strcmp(argv[i], "-session")) {
+            options.sessionMode = true;
+        } else if (!strcmp(argv[i], "--memorybudget") ||
+                   !strcmp(argv[i], "-memorybudget")) {
+            if (i + 1 == argc)
+                usage("missing value after --memorybudget argument");
+            options.memoryBudgetMB = atoi(argv[++i]);
+        } else if (!strncmp(argv[i], "--memorybudget=", 15)) {
+            options.memoryBudgetMB = atoi(&argv[i][15]);
+        } else if (!strcmp(argv[i], "--texcachemb") ||
+                   !strcmp(argv[i], "-texcachemb")) {
+            if (i + 1 == argc)
+                usage("missing value after --texcachemb argument");
+            options.texCacheMB = atoi(argv[++i]);
+        } else if (!strncmp(argv[i], "--texcachemb=", 13)) {
+            options.texCacheMB = atoi(&argv[i][13]);
+        } else if (!strcmp(argv[i], "--costheatmap") ||
+                   !strcmp(argv[i], "-costheatmap")) {
+            options.costHeatmap = true;
+        } else if (!strcmp(argv[i], "--gpu") || !strcmp(argv[i], "-gpu")) {
+            options.useGPU = true;
+        } else if (!strcmp(argv[i], "--gpu-validate") ||
+                   !strcmp(argv[i], "-gpu-validate")) {
+            options.useGPU = true;
+            options.gpuValidate = true;
+        } else if (!strcmp(argv[i], "--perfcounters") ||
+                   !strcmp(argv[i], "-perfcounters")) {
+            options.perfCounters = true;
+        } else if (!strcmp(argv[i], "--benchmark") ||
+                   !strcmp(argv[i], "-benchmark")) {
+            options.benchmark = true;
+        } else if (!strcmp(argv[i], "--deterministic") ||
+                   !strcmp(argv[i], "-deterministic")) {
+            options.deterministic = true;
+        } else if (!strcmp(argv[i], "--benchmark-out") ||
+                   !strcmp(argv[i], "-benchmark-out")) {
+            if (i + 1 == argc)
+                usage("missing filename after --benchmark-out argument");
+            options.benchmarkOutFile = argv[++i];
+        } else if (!strncmp(argv[i], "--benchmark-out=", 16)) {
+            options.benchmarkOutFile = &argv[i][16];
+        } else if (!strcmp(argv[i], "--benchmark-baseline") ||
+                   !strcmp(argv[i], "-benchmark-baseline")) {
+            if (i + 1 == argc)
+                usage("missing filename after --benchmark-baseline argument");
+            options.benchmarkBaseline = argv[++i];
+        } else if (!strncmp(argv[i], "--benchmark-baseline=", 21)) {
+            options.benchmarkBaseline = &argv[i][21];
+        } else if (!strcmp(argv[i], "--progressive") ||
+                   !strcmp(argv[i], "-progressive")) {
+            options.progressive = true;
+        } else if (!strcmp(argv[i], "--texreport") ||
+                   !strcmp(argv[i], "-texreport")) {
+            options.texAccessReport = true;
+        } else if (!strcmp(argv[i], "--display") ||
+                   !strcmp(argv[i], "-display")) {
+            if (i + 1 == argc)
+                usage("missing value after --display argument");
+            options.displayServer = argv[++i];
+        } else if (!strncmp(argv[i], "--display=", 10)) {
+            options.displayServer = &argv[i][10];
+        } else if (!strcmp(argv[i], "--previewseconds") ||
+                   !strcmp(argv[i], "-previewseconds")) {
+            if (i + 1 == argc)
+                usage("missing value after --previewseconds argument");
+            options.previewSeconds = atoi(argv[++i]);
+        } else if (!strncmp(argv[i], "--previewseconds=", 17)) {
+            options.previewSeconds = atoi(&argv[i][17]);
+        } else if (!strcmp(argv[i], "--progressfile") ||
+                   !strcmp(argv[i], "-progressfile")) {
+            if (i + 1 == argc)
+                usage("missing value after --progressfile argument");
+            options.progressFile = argv[++i];
+        } else if (!strncmp(argv[i], "--progressfile=", 15)) {
+            options.progressFile = &argv[i][15];
+        } else if (!strcmp(argv[i], "--profile-out") ||
+                   !strcmp(argv[i], "-profile-out")) {
+            if (i + 1 == argc)
+                usage("missing value after --profile-out argument");
+            options.profileOutFile = argv[++i];
+        } else if (!strncmp(argv[i], "--profile-out=", 14)) {
+            options.profileOutFile = &argv[i][14];
         } else if (!strcmp(argv[i], "--quick") || !strcmp(argv[i], "-quick")) {
             options.quickRender = true;
         } else if (!strcmp(argv[i], "--quiet") || !strcmp(argv[i], "-quiet")) {
@@ -121,6 +337,9 @@ int main(int argc, char *argv[]) {
             options.cat = true;
         } else if (!strcmp(argv[i], "--toply") || !strcmp(argv[i], "-toply")) {
             options.toPly = true;
+        } else if (!strcmp(argv[i], "--toformat-binary") ||
+                   !strcmp(argv[i], "-toformat-binary")) {
+            options.toBinary = true;
         } else if (!strcmp(argv[i], "--v") || !strcmp(argv[i], "-v")) {
             if (i + 1 == argc)
                 usage("missing value after --v argument");
@@ -139,7 +358,8 @@ int main(int argc, char *argv[]) {
     }
 
     // Print welcome banner
-    if (!options.quiet && !options.cat && !options.toPly) {
+    if (!options.quiet && !options.cat && !options.toPly &&
+        !options.toBinary) {
         if (sizeof(void *) == 4)
             printf("*** WARNING: This is a 32-bit build of pbrt. It will crash "
                    "if used to render highly complex scenes. ***\n");
@@ -158,6 +378,12 @@ int main(int argc, char *argv[]) {
         printf("See the file LICENSE.txt for the conditions of the license.\n");
         fflush(stdout);
     }
+    if (options.sessionMode && filenames.empty())
+        usage("--session requires scene files to be given explicitly");
+    // Benchmark runs pin the thread count so timings are comparable
+    // across runs and builds on the same machine.
+    if (options.benchmark && options.nThreads == 0)
+        options.nThreads = std::min(4, NumSystemCores());
     pbrtInit(options);
     // Process scene description
     if (filenames.empty()) {
@@ -165,9 +391,53 @@ int main(int argc, char *argv[]) {
         pbrtParseFile("-");
     } else {
         // Parse scene from input files
-        for (const std::string &f : filenames)
+        std::set<std::string> sceneFiles;
+        for (const std::string &f : filenames) {
             pbrtParseFile(f);
+            for (const std::string &parsed : GetParsedFilenames())
+                sceneFiles.insert(parsed);
+        }
+        // In session mode, watch the parsed scene files and re-render
+        // whenever one of them is edited; the API layer reuses unchanged
+        // shapes and the previous aggregate across the re-parse.
+        while (options.sessionMode) {
+            std::map<std::string, time_t> modTimes;
+            for (const std::string &f : sceneFiles) {
+                struct stat statBuffer;
+                if (stat(f.c_str(), &statBuffer) == 0)
+                    modTimes[f] = statBuffer.st_mtime;
+            }
+            printf("Session: watching %d scene file(s); edit and save to "
+                   "re-render, Ctrl-C to exit.\n",
+                   (int)sceneFiles.size());
+            fflush(stdout);
+            std::string changed;
+            while (changed.empty()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(500));
+                for (const auto &entry : modTimes) {
+                    struct stat statBuffer;
+                    // A failed stat() is usually an editor mid-save;
+                    // the file will be back with a new time shortly.
+                    if (stat(entry.first.c_str(), &statBuffer) == 0 &&
+                        statBuffer.st_mtime != entry.second) {
+                        changed = entry.first;
+                        break;
+                    }
+                }
+            }
+            printf("Session: \"%s\" changed; re-rendering.\n",
+                   changed.c_str());
+            fflush(stdout);
+            // Give the editor a moment to finish writing the file.
+            std::this_thread::sleep_for(std::chrono::milliseconds(250));
+            sceneFiles.clear();
+            for (const std::string &f : filenames) {
+                pbrtParseFile(f);
+                for (const std::string &parsed : GetParsedFilenames())
+                    sceneFiles.insert(parsed);
+            }
+        }
     }
     pbrtCleanup();
-    return 0;
+    return BenchmarkRegressed() ? 1 : 0;
 }
@@ -53,6 +53,7 @@ licensed under a slightly-modified Apache 2.0 license.
 #include "interaction.h"
 #include "paramset.h"
 #include "reflection.h"
+#include "sampling.h"
 #include "stats.h"
 #include "stringprint.h"
 #include "texture.h"
@@ -86,275 +87,239 @@ inline Spectrum FrSchlick(const Spectrum &R0, Float cosTheta) {
 // coming from air..
 inline Float SchlickR0FromEta(Float eta) { return sqr(eta - 1) / sqr(eta + 1); }
 
-///////////////////////////////////////////////////////////////////////////
-// DisneyDiffuse
-
-class DisneyDiffuse : public BxDF {
-  public:
-    DisneyDiffuse(const Spectrum &R)
-        : BxDF(BxDFType(BSDF_REFLECTION | BSDF_DIFFUSE)), R(R) {}
-    Spectrum f(const Vector3f &wo, const Vector3f &wi) const;
-    Spectrum rho(const Vector3f &, int, const Point2f *) const { return R; }
-    Spectrum rho(int, const Point2f *, const Point2f *) const { return R; }
-    std::string ToString() const;
-
-  private:
-    Spectrum R;
-};
-
-Spectrum DisneyDiffuse::f(const Vector3f &wo, const Vector3f &wi) const {
-    Float Fo = SchlickWeight(AbsCosTheta(wo)),
-          Fi = SchlickWeight(AbsCosTheta(wi));
-
-    // Diffuse fresnel - go from 1 at normal incidence to .5 at grazing.
-    // Burley 2015, eq (4).
-    return R * InvPi * (1 - Fo / 2) * (1 - Fi / 2);
+inline Float GTR1(Float cosTheta, Float alpha) {
+    Float alpha2 = alpha * alpha;
+    return (alpha2 - 1) /
+           (Pi * std::log(alpha2) * (1 + (alpha2 - 1) * cosTheta * cosTheta));
 }
 
-std::string DisneyDiffuse::ToString() const {
-    return StringPrintf("[ DisneyDiffuse R: %s ]", R.ToString().c_str());
+// Smith masking/shadowing term.
+inline Float smithG_GGX(Float cosTheta, Float alpha) {
+    Float alpha2 = alpha * alpha;
+    Float cosTheta2 = cosTheta * cosTheta;
+    return 1 / (cosTheta + sqrt(alpha2 + cosTheta2 - alpha2 * cosTheta2));
 }
 
 ///////////////////////////////////////////////////////////////////////////
-// DisneyFakeSS
+// DisneyMicrofacetDistribution
 
-// "Fake" subsurface scattering lobe, based on the Hanrahan-Krueger BRDF
-// approximation of the BSSRDF.
-class DisneyFakeSS : public BxDF {
-  public:
-    DisneyFakeSS(const Spectrum &R, Float roughness)
-        : BxDF(BxDFType(BSDF_REFLECTION | BSDF_DIFFUSE)),
-          R(R),
-          roughness(roughness) {}
-    Spectrum f(const Vector3f &wo, const Vector3f &wi) const;
-    Spectrum rho(const Vector3f &, int, const Point2f *) const { return R; }
-    Spectrum rho(int, const Point2f *, const Point2f *) const { return R; }
-    std::string ToString() const;
+class DisneyMicrofacetDistribution : public TrowbridgeReitzDistribution {
+public:
+    DisneyMicrofacetDistribution(Float alphax, Float alphay)
+        : TrowbridgeReitzDistribution(alphax, alphay) {}
 
-  private:
-    Spectrum R;
-    Float roughness;
+    Float G(const Vector3f &wo, const Vector3f &wi) const {
+        // Disney uses the separable masking-shadowing model.
+        return G1(wo) * G1(wi);
+    }
+    void G_N(const Vector3f &wo, const Vector3f *wi, int n,
+             Float *Gout) const {
+        // Batch counterpart of the separable model above; Lambda_N()
+        // provides the vectorized per-direction terms.
+        Float g1o = G1(wo);
+        Lambda_N(wi, n, Gout);
+        for (int i = 0; i < n; ++i) Gout[i] = g1o / (1 + Gout[i]);
+    }
 };
 
-Spectrum DisneyFakeSS::f(const Vector3f &wo, const Vector3f &wi) const {
-    Vector3f wh = wi + wo;
-    if (wh.x == 0 && wh.y == 0 && wh.z == 0) return Spectrum(0.);
-    wh = Normalize(wh);
-    Float cosThetaD = Dot(wi, wh);
-
-    // Fss90 used to "flatten" retroreflection based on roughness
-    Float Fss90 = cosThetaD * cosThetaD * roughness;
-    Float Fo = SchlickWeight(AbsCosTheta(wo)),
-          Fi = SchlickWeight(AbsCosTheta(wi));
-    Float Fss = Lerp(Fo, 1.0, Fss90) * Lerp(Fi, 1.0, Fss90);
-    // 1.25 scale is used to (roughly) preserve albedo
-    Float ss =
-        1.25f * (Fss * (1 / (AbsCosTheta(wo) + AbsCosTheta(wi)) - .5f) + .5f);
-
-    return R * InvPi * ss;
-}
-
-std::string DisneyFakeSS::ToString() const {
-    return StringPrintf("[ DisneyFakeSS R: %s roughness: %f ]",
-                        R.ToString().c_str(), roughness);
-}
-
 ///////////////////////////////////////////////////////////////////////////
-// DisneyRetro
-
-class DisneyRetro : public BxDF {
+// DisneyFusedReflection
+
+// All of the reflective lobes of the Disney BSDF--diffuse, fake
+// subsurface, retro-reflection, sheen, specular, and clearcoat--fused
+// into a single BxDF.  The lobes share a number of intermediate values
+// (the half-angle vector, the Schlick weights for wo and wi, Fresnel
+// terms), so evaluating them in one pass avoids both recomputing those
+// and the per-lobe virtual dispatch that BSDF::f() would otherwise do.
+// Sampling selects among the lobes' sampling routines with
+// probabilities proportional to their approximate reflectance rather
+// than uniformly, as BSDF::Sample_f() does across separate BxDFs.
+class DisneyFusedReflection : public BxDF {
   public:
-    DisneyRetro(const Spectrum &R, Float roughness)
-        : BxDF(BxDFType(BSDF_REFLECTION | BSDF_DIFFUSE)),
-          R(R),
-          roughness(roughness) {}
+    DisneyFusedReflection(const Spectrum &Rdiffuse, const Spectrum &Rfakess,
+                          const Spectrum &Rretro, const Spectrum &Rsheen,
+                          Float roughness, const Spectrum &Cspec0,
+                          Float metallic, Float eta,
+                          const MicrofacetDistribution *distrib, Float ccWeight,
+                          Float ccGloss)
+        // Declared glossy-only even though the fused lobe also carries
+        // the diffuse terms: MatchesFlags() requires the query flags to
+        // be a superset of the BxDF's type, so declaring both characters
+        // would make the lobe match neither a DIFFUSE-only nor a
+        // GLOSSY-only probe (SPPM uses exactly those to decide where to
+        // put visible points). FourierBSDF sets the same precedent for
+        // multi-character lobes.
+        : BxDF(BxDFType(BSDF_REFLECTION | BSDF_GLOSSY)),
+          Rdiffuse(Rdiffuse),
+          Rfakess(Rfakess),
+          Rretro(Rretro),
+          Rsheen(Rsheen),
+          roughness(roughness),
+          Cspec0(Cspec0),
+          metallic(metallic),
+          eta(eta),
+          distrib(distrib),
+          ccWeight(ccWeight),
+          ccGloss(ccGloss) {
+        // Compute lobe-selection probabilities from approximate
+        // reflectances.  The specular term uses the Fresnel mixture at
+        // normal incidence with a floor so that dielectric highlights
+        // still get sampled; the clearcoat weight doubles its
+        // normal-incidence Fresnel (0.04) to account for the boost
+        // toward grazing angles.
+        Spectrum Rdiff = Rdiffuse + Rfakess + Rretro + Rsheen;
+        Float wDiffuse = Rdiff.y();
+        Float wSpec = std::max(
+            Float(.04), Lerp(metallic, SchlickR0FromEta(eta), Cspec0.y()));
+        Float wCC = .08f * ccWeight;
+        Float invSum = 1 / (wDiffuse + wSpec + wCC);
+        pDiffuse = wDiffuse * invSum;
+        pSpec = wSpec * invSum;
+        pCC = wCC * invSum;
+    }
     Spectrum f(const Vector3f &wo, const Vector3f &wi) const;
-    Spectrum rho(const Vector3f &, int, const Point2f *) const { return R; }
-    Spectrum rho(int, const Point2f *, const Point2f *) const { return R; }
+    Spectrum Sample_f(const Vector3f &wo, Vector3f *wi, const Point2f &u,
+                      Float *pdf, BxDFType *sampledType) const;
+    Float Pdf(const Vector3f &wo, const Vector3f &wi) const;
+    Spectrum rho(const Vector3f &, int, const Point2f *) const {
+        return Rdiffuse + Rfakess + Rretro + Rsheen + Cspec0;
+    }
+    Spectrum rho(int, const Point2f *, const Point2f *) const {
+        return Rdiffuse + Rfakess + Rretro + Rsheen + Cspec0;
+    }
     std::string ToString() const;
 
   private:
-    Spectrum R;
+    Spectrum Rdiffuse, Rfakess, Rretro, Rsheen;
     Float roughness;
+    Spectrum Cspec0;
+    Float metallic, eta;
+    const MicrofacetDistribution *distrib;
+    Float ccWeight, ccGloss;
+    Float pDiffuse, pSpec, pCC;
 };
 
-Spectrum DisneyRetro::f(const Vector3f &wo, const Vector3f &wi) const {
-    Vector3f wh = wi + wo;
-    if (wh.x == 0 && wh.y == 0 && wh.z == 0) return Spectrum(0.);
-    wh = Normalize(wh);
-    Float cosThetaD = Dot(wi, wh);
-
-    Float Fo = SchlickWeight(AbsCosTheta(wo)),
-          Fi = SchlickWeight(AbsCosTheta(wi));
-    Float Rr = 2 * roughness * cosThetaD * cosThetaD;
+Spectrum DisneyFusedReflection::f(const Vector3f &wo,
+                                  const Vector3f &wi) const {
+    Float cosThetaO = AbsCosTheta(wo), cosThetaI = AbsCosTheta(wi);
+    Float Fo = SchlickWeight(cosThetaO), Fi = SchlickWeight(cosThetaI);
 
+    // Diffuse fresnel - go from 1 at normal incidence to .5 at grazing.
     // Burley 2015, eq (4).
-    return R * InvPi * Rr * (Fo + Fi + Fo * Fi * (Rr - 1));
-}
-
-std::string DisneyRetro::ToString() const {
-    return StringPrintf("[ DisneyRetro R: %s roughness: %f ]",
-                        R.ToString().c_str(), roughness);
-}
-
-///////////////////////////////////////////////////////////////////////////
-// DisneySheen
-
-class DisneySheen : public BxDF {
-  public:
-    DisneySheen(const Spectrum &R)
-        : BxDF(BxDFType(BSDF_REFLECTION | BSDF_DIFFUSE)), R(R) {}
-    Spectrum f(const Vector3f &wo, const Vector3f &wi) const;
-    Spectrum rho(const Vector3f &, int, const Point2f *) const { return R; }
-    Spectrum rho(int, const Point2f *, const Point2f *) const { return R; }
-    std::string ToString() const;
+    Spectrum result = Rdiffuse * (InvPi * (1 - Fo / 2) * (1 - Fi / 2));
 
-  private:
-    Spectrum R;
-};
-
-Spectrum DisneySheen::f(const Vector3f &wo, const Vector3f &wi) const {
+    // The remaining lobes all depend on the half-angle vector.
     Vector3f wh = wi + wo;
-    if (wh.x == 0 && wh.y == 0 && wh.z == 0) return Spectrum(0.);
+    if (wh.x == 0 && wh.y == 0 && wh.z == 0) return result;
     wh = Normalize(wh);
     Float cosThetaD = Dot(wi, wh);
 
-    return R * SchlickWeight(cosThetaD);
-}
-
-std::string DisneySheen::ToString() const {
-    return StringPrintf("[ DisneySheen R: %s]", R.ToString().c_str());
-}
-
-///////////////////////////////////////////////////////////////////////////
-// DisneyClearcoat
-
-class DisneyClearcoat : public BxDF {
-  public:
-    DisneyClearcoat(Float weight, Float gloss)
-        : BxDF(BxDFType(BSDF_REFLECTION | BSDF_GLOSSY)),
-          weight(weight),
-          gloss(gloss) {}
-    Spectrum f(const Vector3f &wo, const Vector3f &wi) const;
-    Spectrum Sample_f(const Vector3f &wo, Vector3f *wi, const Point2f &u,
-                      Float *pdf, BxDFType *sampledType) const;
-    Float Pdf(const Vector3f &wo, const Vector3f &wi) const;
-    std::string ToString() const;
-
-  private:
-    Float weight, gloss;
-};
-
-inline Float GTR1(Float cosTheta, Float alpha) {
-    Float alpha2 = alpha * alpha;
-    return (alpha2 - 1) /
-           (Pi * std::log(alpha2) * (1 + (alpha2 - 1) * cosTheta * cosTheta));
-}
-
-// Smith masking/shadowing term.
-inline Float smithG_GGX(Float cosTheta, Float alpha) {
-    Float alpha2 = alpha * alpha;
-    Float cosTheta2 = cosTheta * cosTheta;
-    return 1 / (cosTheta + sqrt(alpha2 + cosTheta2 - alpha2 * cosTheta2));
-}
+    if (!Rfakess.IsBlack()) {
+        // "Fake" subsurface scattering lobe, based on the
+        // Hanrahan-Krueger BRDF approximation of the BSSRDF.
+        // Fss90 used to "flatten" retroreflection based on roughness
+        Float Fss90 = cosThetaD * cosThetaD * roughness;
+        Float Fss = Lerp(Fo, 1.0, Fss90) * Lerp(Fi, 1.0, Fss90);
+        // 1.25 scale is used to (roughly) preserve albedo
+        Float ss = 1.25f * (Fss * (1 / (cosThetaO + cosThetaI) - .5f) + .5f);
+        result += Rfakess * (InvPi * ss);
+    }
 
-Spectrum DisneyClearcoat::f(const Vector3f &wo, const Vector3f &wi) const {
-    Vector3f wh = wi + wo;
-    if (wh.x == 0 && wh.y == 0 && wh.z == 0) return Spectrum(0.);
-    wh = Normalize(wh);
+    if (!Rretro.IsBlack()) {
+        // Retro-reflection; Burley 2015, eq (4).
+        Float Rr = 2 * roughness * cosThetaD * cosThetaD;
+        result += Rretro * (InvPi * Rr * (Fo + Fi + Fo * Fi * (Rr - 1)));
+    }
 
-    // Clearcoat has ior = 1.5 hardcoded -> F0 = 0.04. It then uses the
-    // GTR1 distribution, which has even fatter tails than Trowbridge-Reitz
-    // (which is GTR2).
-    Float Dr = GTR1(AbsCosTheta(wh), gloss);
-    Float Fr = FrSchlick(.04, Dot(wo, wh));
-    // The geometric term always based on alpha = 0.25.
-    Float Gr =
-        smithG_GGX(AbsCosTheta(wo), .25) * smithG_GGX(AbsCosTheta(wi), .25);
+    if (!Rsheen.IsBlack()) result += Rsheen * SchlickWeight(cosThetaD);
+
+    if (cosThetaO != 0 && cosThetaI != 0) {
+        // Specular: Trowbridge-Reitz with a Fresnel function based on a
+        // mixture between dielectric and the Schlick approximation.
+        // For the Fresnel call, make sure that wh is in the same
+        // hemisphere as the surface normal, so that TIR is handled
+        // correctly.
+        Float cosF = Dot(wi, Faceforward(wh, Vector3f(0, 0, 1)));
+        Spectrum F = Lerp(metallic, Spectrum(FrDielectric(cosF, 1, eta)),
+                          FrSchlick(Cspec0, cosF));
+        result += distrib->D(wh) * distrib->G(wo, wi) * F /
+                  (4 * cosThetaI * cosThetaO);
+    }
 
-    return weight * Gr * Fr * Dr / 4;
+    if (ccWeight > 0) {
+        // Clearcoat has ior = 1.5 hardcoded -> F0 = 0.04. It then uses
+        // the GTR1 distribution, which has even fatter tails than
+        // Trowbridge-Reitz (which is GTR2).
+        Float Dr = GTR1(AbsCosTheta(wh), ccGloss);
+        Float Fr = FrSchlick(.04, Dot(wo, wh));
+        // The geometric term always based on alpha = 0.25.
+        Float Gr = smithG_GGX(cosThetaO, .25) * smithG_GGX(cosThetaI, .25);
+        result += Spectrum(ccWeight * Gr * Fr * Dr / 4);
+    }
+    return result;
 }
 
-Spectrum DisneyClearcoat::Sample_f(const Vector3f &wo, Vector3f *wi,
-                                   const Point2f &u, Float *pdf,
-                                   BxDFType *sampledType) const {
-    // TODO: double check all this: there still seem to be some very
-    // occasional fireflies with clearcoat; presumably there is a bug
-    // somewhere.
+Spectrum DisneyFusedReflection::Sample_f(const Vector3f &wo, Vector3f *wi,
+                                         const Point2f &u, Float *pdf,
+                                         BxDFType *sampledType) const {
     if (wo.z == 0) return 0.;
-
-    Float alpha2 = gloss * gloss;
-    Float cosTheta = std::sqrt(
-        std::max(Float(0), (1 - std::pow(alpha2, 1 - u[0])) / (1 - alpha2)));
-    Float sinTheta = std::sqrt(std::max((Float)0, 1 - cosTheta * cosTheta));
-    Float phi = 2 * Pi * u[1];
-    Vector3f wh = SphericalDirection(sinTheta, cosTheta, phi);
-    if (!SameHemisphere(wo, wh)) wh = -wh;
-
-    *wi = Reflect(wo, wh);
-    if (!SameHemisphere(wo, *wi)) return Spectrum(0.f);
-
+    // Choose a lobe sampling technique according to the precomputed
+    // probabilities and remap _u[0]_ to cover the full [0,1) range again.
+    if (u[0] < pDiffuse) {
+        Point2f uRemapped(std::min(u[0] / pDiffuse, OneMinusEpsilon), u[1]);
+        *wi = CosineSampleHemisphere(uRemapped);
+        if (wo.z < 0) wi->z *= -1;
+    } else if (u[0] < pDiffuse + pSpec) {
+        Point2f uRemapped(
+            std::min((u[0] - pDiffuse) / pSpec, OneMinusEpsilon), u[1]);
+        Vector3f wh = distrib->Sample_wh(wo, uRemapped);
+        *wi = Reflect(wo, wh);
+        if (!SameHemisphere(wo, *wi)) return Spectrum(0.f);
+    } else {
+        Point2f uRemapped(
+            std::min((u[0] - pDiffuse - pSpec) / pCC, OneMinusEpsilon), u[1]);
+        // Sample wh exactly from the GTR1 distribution
+        Float alpha2 = ccGloss * ccGloss;
+        Float cosTheta = std::sqrt(std::max(
+            Float(0), (1 - std::pow(alpha2, 1 - uRemapped[0])) / (1 - alpha2)));
+        Float sinTheta = std::sqrt(std::max((Float)0, 1 - cosTheta * cosTheta));
+        Float phi = 2 * Pi * uRemapped[1];
+        Vector3f wh = SphericalDirection(sinTheta, cosTheta, phi);
+        if (!SameHemisphere(wo, wh)) wh = -wh;
+        *wi = Reflect(wo, wh);
+        if (!SameHemisphere(wo, *wi)) return Spectrum(0.f);
+    }
     *pdf = Pdf(wo, *wi);
     return f(wo, *wi);
 }
 
-Float DisneyClearcoat::Pdf(const Vector3f &wo, const Vector3f &wi) const {
+Float DisneyFusedReflection::Pdf(const Vector3f &wo,
+                                 const Vector3f &wi) const {
     if (!SameHemisphere(wo, wi)) return 0;
-
+    // The PDF is the selection-probability-weighted mixture of the
+    // individual techniques' PDFs.
+    Float pdf = pDiffuse * AbsCosTheta(wi) * InvPi;
     Vector3f wh = wi + wo;
-    if (wh.x == 0 && wh.y == 0 && wh.z == 0) return 0;
+    if (wh.x == 0 && wh.y == 0 && wh.z == 0) return pdf;
     wh = Normalize(wh);
-
-    // The sampling routine samples wh exactly from the GTR1 distribution.
-    // Thus, the final value of the PDF is just the value of the
-    // distribution for wh converted to a mesure with respect to the
-    // surface normal.
-    Float Dr = GTR1(AbsCosTheta(wh), gloss);
-    return Dr * AbsCosTheta(wh) / (4 * Dot(wo, wh));
+    if (pSpec > 0) pdf += pSpec * distrib->Pdf(wo, wh) / (4 * Dot(wo, wh));
+    if (pCC > 0) {
+        Float Dr = GTR1(AbsCosTheta(wh), ccGloss);
+        pdf += pCC * Dr * AbsCosTheta(wh) / (4 * Dot(wo, wh));
+    }
+    return pdf;
 }
 
-std::string DisneyClearcoat::ToString() const {
-    return StringPrintf("[ DisneyClearcoat weight: %f gloss: %f ]", weight,
-                        gloss);
+std::string DisneyFusedReflection::ToString() const {
+    return StringPrintf(
+        "[ DisneyFusedReflection Rdiffuse: %s Rfakess: %s Rretro: %s "
+        "Rsheen: %s roughness: %f Cspec0: %s metallic: %f eta: %f "
+        "ccWeight: %f ccGloss: %f ]",
+        Rdiffuse.ToString().c_str(), Rfakess.ToString().c_str(),
+        Rretro.ToString().c_str(), Rsheen.ToString().c_str(), roughness,
+        Cspec0.ToString().c_str(), metallic, eta, ccWeight, ccGloss);
 }
 
-///////////////////////////////////////////////////////////////////////////
-// DisneyFresnel
-
-// Specialized Fresnel function used for the specular component, based on
-// a mixture between dielectric and the Schlick Fresnel approximation.
-class DisneyFresnel : public Fresnel {
-  public:
-    DisneyFresnel(const Spectrum &R0, Float metallic, Float eta)
-        : R0(R0), metallic(metallic), eta(eta) {}
-    Spectrum Evaluate(Float cosI) const {
-        return Lerp(metallic, Spectrum(FrDielectric(cosI, 1, eta)),
-                    FrSchlick(R0, cosI));
-    }
-    std::string ToString() const {
-        return StringPrintf("[ DisneyFresnel R0: %s metallic: %f eta: %f ]",
-                            R0.ToString().c_str(), metallic, eta);
-    }
-
-  private:
-    const Spectrum R0;
-    const Float metallic, eta;
-};
-
-///////////////////////////////////////////////////////////////////////////
-// DisneyMicrofacetDistribution
-
-class DisneyMicrofacetDistribution : public TrowbridgeReitzDistribution {
-public:
-    DisneyMicrofacetDistribution(Float alphax, Float alphay)
-        : TrowbridgeReitzDistribution(alphax, alphay) {}
-
-    Float G(const Vector3f &wo, const Vector3f &wi) const {
-        // Disney uses the separable masking-shadowing model.
-        return G1(wo) * G1(wi);
-    }
-};
-
 ///////////////////////////////////////////////////////////////////////////
 // DisneyBSSRDF
 
@@ -479,7 +444,7 @@ void DisneyMaterial::ComputeScatteringFunctions(SurfaceInteraction *si,
     if (bumpMap) Bump(bumpMap, si);
 
     // Evaluate textures for _DisneyMaterial_ material and allocate BRDF
-    si->bsdf = ARENA_ALLOC(arena, BSDF)(*si);
+    si->bsdf = BSDF_ALLOC(si, arena, BSDF)(*si);
 
     // Diffuse
     Spectrum c = color->Evaluate(*si).Clamp();
@@ -501,39 +466,36 @@ void DisneyMaterial::ComputeScatteringFunctions(SurfaceInteraction *si,
         Csheen = Lerp(stint, Spectrum(1.), Ctint);
     }
 
+    // Compute the weights of the reflective lobes; they are all handled
+    // by a single fused BxDF below.
+    Spectrum Rdiffuse(0.f), Rfakess(0.f), Rretro(0.f), Rsheen(0.f);
     if (diffuseWeight > 0) {
         if (thin) {
             Float flat = flatness->Evaluate(*si);
-            // Blend between DisneyDiffuse and fake subsurface based on
+            // Blend between diffuse and fake subsurface based on
             // flatness.  Additionally, weight using diffTrans.
-            si->bsdf->Add(ARENA_ALLOC(arena, DisneyDiffuse)(
-                diffuseWeight * (1 - flat) * (1 - dt) * c));
-            si->bsdf->Add(ARENA_ALLOC(arena, DisneyFakeSS)(
-                diffuseWeight * flat * (1 - dt) * c, rough));
+            Rdiffuse = diffuseWeight * (1 - flat) * (1 - dt) * c;
+            Rfakess = diffuseWeight * flat * (1 - dt) * c;
         } else {
             Spectrum sd = scatterDistance->Evaluate(*si);
             if (sd.IsBlack())
                 // No subsurface scattering; use regular (Fresnel modified)
                 // diffuse.
-                si->bsdf->Add(
-                    ARENA_ALLOC(arena, DisneyDiffuse)(diffuseWeight * c));
+                Rdiffuse = diffuseWeight * c;
             else {
                 // Use a BSSRDF instead.
-                si->bsdf->Add(ARENA_ALLOC(arena, SpecularTransmission)(
+                si->bsdf->Add(BSDF_ALLOC(si, arena, SpecularTransmission)(
                     1.f, 1.f, e, mode));
-                si->bssrdf = ARENA_ALLOC(arena, DisneyBSSRDF)(
+                si->bssrdf = BSDF_ALLOC(si, arena, DisneyBSSRDF)(
                     c * diffuseWeight, sd, *si, e, this, mode);
             }
         }
 
         // Retro-reflection.
-        si->bsdf->Add(
-            ARENA_ALLOC(arena, DisneyRetro)(diffuseWeight * c, rough));
+        Rretro = diffuseWeight * c;
 
         // Sheen (if enabled)
-        if (sheenWeight > 0)
-            si->bsdf->Add(ARENA_ALLOC(arena, DisneySheen)(
-                diffuseWeight * sheenWeight * Csheen));
+        if (sheenWeight > 0) Rsheen = diffuseWeight * sheenWeight * Csheen;
     }
 
     // Create the microfacet distribution for metallic and/or specular
@@ -542,24 +504,20 @@ void DisneyMaterial::ComputeScatteringFunctions(SurfaceInteraction *si,
     Float ax = std::max(Float(.001), sqr(rough) / aspect);
     Float ay = std::max(Float(.001), sqr(rough) * aspect);
     MicrofacetDistribution *distrib =
-        ARENA_ALLOC(arena, DisneyMicrofacetDistribution)(ax, ay);
+        BSDF_ALLOC(si, arena, DisneyMicrofacetDistribution)(ax, ay);
 
     // Specular is Trowbridge-Reitz with a modified Fresnel function.
     Float specTint = specularTint->Evaluate(*si);
     Spectrum Cspec0 =
         Lerp(metallicWeight,
              SchlickR0FromEta(e) * Lerp(specTint, Spectrum(1.), Ctint), c);
-    Fresnel *fresnel =
-        ARENA_ALLOC(arena, DisneyFresnel)(Cspec0, metallicWeight, e);
-    si->bsdf->Add(
-        ARENA_ALLOC(arena, MicrofacetReflection)(Spectrum(1.), distrib, fresnel));
 
-    // Clearcoat
+    // Add the fused reflection lobe covering diffuse, fake subsurface,
+    // retro-reflection, sheen, specular, and clearcoat.
     Float cc = clearcoat->Evaluate(*si);
-    if (cc > 0) {
-        si->bsdf->Add(ARENA_ALLOC(arena, DisneyClearcoat)(
-            cc, Lerp(clearcoatGloss->Evaluate(*si), .1, .001)));
-    }
+    si->bsdf->Add(BSDF_ALLOC(si, arena, DisneyFusedReflection)(
+        Rdiffuse, Rfakess, Rretro, Rsheen, rough, Cspec0, metallicWeight, e,
+        distrib, cc, Lerp(clearcoatGloss->Evaluate(*si), .1, .001)));
 
     // BTDF
     if (strans > 0) {
@@ -573,16 +531,16 @@ void DisneyMaterial::ComputeScatteringFunctions(SurfaceInteraction *si,
             Float ax = std::max(Float(.001), sqr(rscaled) / aspect);
             Float ay = std::max(Float(.001), sqr(rscaled) * aspect);
             MicrofacetDistribution *scaledDistrib =
-                ARENA_ALLOC(arena, TrowbridgeReitzDistribution)(ax, ay);
-            si->bsdf->Add(ARENA_ALLOC(arena, MicrofacetTransmission)(
+                BSDF_ALLOC(si, arena, TrowbridgeReitzDistribution)(ax, ay);
+            si->bsdf->Add(BSDF_ALLOC(si, arena, MicrofacetTransmission)(
                 T, scaledDistrib, 1., e, mode));
         } else
-            si->bsdf->Add(ARENA_ALLOC(arena, MicrofacetTransmission)(
+            si->bsdf->Add(BSDF_ALLOC(si, arena, MicrofacetTransmission)(
                 T, distrib, 1., e, mode));
     }
     if (thin) {
         // Lambertian, weighted by (1 - diffTrans)
-        si->bsdf->Add(ARENA_ALLOC(arena, LambertianTransmission)(dt * c));
+        si->bsdf->Add(BSDF_ALLOC(si, arena, LambertianTransmission)(dt * c));
     }
 }
 
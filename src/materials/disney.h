@@ -83,6 +83,9 @@ class DisneyMaterial : public Material {
     void ComputeScatteringFunctions(SurfaceInteraction *si, MemoryArena &arena,
                                     TransportMode mode,
                                     bool allowMultipleLobes) const;
+    // Conservative: a BSSRDF is only created where _scatterDistance_ is
+    // nonzero, which isn't known until textures are evaluated
+    bool HasSubsurfaceScattering() const { return true; }
 
   private:
     // DisneyMaterial Private Data
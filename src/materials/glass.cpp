@@ -48,20 +48,20 @@ void GlassMaterial::ComputeScatteringFunctions(SurfaceInteraction *si,
                                                bool allowMultipleLobes) const {
     // Perform bump mapping with _bumpMap_, if present
     if (bumpMap) Bump(bumpMap, si);
-    Float eta = index->Evaluate(*si);
-    Float urough = uRoughness->Evaluate(*si);
-    Float vrough = vRoughness->Evaluate(*si);
-    Spectrum R = Kr->Evaluate(*si).Clamp();
-    Spectrum T = Kt->Evaluate(*si).Clamp();
+    Float eta = EvaluateMemoized(index, *si);
+    Float urough = EvaluateMemoized(uRoughness, *si);
+    Float vrough = EvaluateMemoized(vRoughness, *si);
+    Spectrum R = EvaluateMemoized(Kr, *si).Clamp();
+    Spectrum T = EvaluateMemoized(Kt, *si).Clamp();
     // Initialize _bsdf_ for smooth or rough dielectric
-    si->bsdf = ARENA_ALLOC(arena, BSDF)(*si, eta);
+    si->bsdf = BSDF_ALLOC(si, arena, BSDF)(*si, eta);
 
     if (R.IsBlack() && T.IsBlack()) return;
 
     bool isSpecular = urough == 0 && vrough == 0;
     if (isSpecular && allowMultipleLobes) {
         si->bsdf->Add(
-            ARENA_ALLOC(arena, FresnelSpecular)(R, T, 1.f, eta, mode));
+            BSDF_ALLOC(si, arena, FresnelSpecular)(R, T, 1.f, eta, mode));
     } else {
         if (remapRoughness) {
             urough = TrowbridgeReitzDistribution::RoughnessToAlpha(urough);
@@ -69,23 +69,23 @@ void GlassMaterial::ComputeScatteringFunctions(SurfaceInteraction *si,
         }
         MicrofacetDistribution *distrib =
             isSpecular ? nullptr
-                       : ARENA_ALLOC(arena, TrowbridgeReitzDistribution)(
+                       : BSDF_ALLOC(si, arena, TrowbridgeReitzDistribution)(
                              urough, vrough);
         if (!R.IsBlack()) {
-            Fresnel *fresnel = ARENA_ALLOC(arena, FresnelDielectric)(1.f, eta);
+            Fresnel *fresnel = BSDF_ALLOC(si, arena, FresnelDielectric)(1.f, eta);
             if (isSpecular)
                 si->bsdf->Add(
-                    ARENA_ALLOC(arena, SpecularReflection)(R, fresnel));
+                    BSDF_ALLOC(si, arena, SpecularReflection)(R, fresnel));
             else
-                si->bsdf->Add(ARENA_ALLOC(arena, MicrofacetReflection)(
+                si->bsdf->Add(BSDF_ALLOC(si, arena, MicrofacetReflection)(
                     R, distrib, fresnel));
         }
         if (!T.IsBlack()) {
             if (isSpecular)
-                si->bsdf->Add(ARENA_ALLOC(arena, SpecularTransmission)(
+                si->bsdf->Add(BSDF_ALLOC(si, arena, SpecularTransmission)(
                     T, 1.f, eta, mode));
             else
-                si->bsdf->Add(ARENA_ALLOC(arena, MicrofacetTransmission)(
+                si->bsdf->Add(BSDF_ALLOC(si, arena, MicrofacetTransmission)(
                     T, distrib, 1.f, eta, mode));
         }
     }
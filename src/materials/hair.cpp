@@ -61,18 +61,31 @@ static Float Mp(Float cosThetaI, Float cosThetaO, Float sinThetaI,
 }
 
 inline Float I0(Float x) {
-    Float val = 0;
-    Float x2i = 1;
-    int64_t ifact = 1;
-    int i4 = 1;
-    // I0(x) \approx Sum_i x^(2i) / (4^i (i!)^2)
-    for (int i = 0; i < 10; ++i) {
-        if (i > 1) ifact *= i;
-        val += x2i / (i4 * Sqr(ifact));
-        x2i *= x * x;
-        i4 *= 4;
+    // Polynomial approximations from Abramowitz and Stegun, 9.8.1 and
+    // 9.8.2; both have relative error below 2e-7, which beats the
+    // truncated series this used previously at large arguments while
+    // replacing its division-heavy loop with a pair of Horner forms.
+    Float ax = std::abs(x);
+    if (ax < 3.75f) {
+        Float t = Sqr(x / 3.75f);
+        return 1 +
+               t * (3.5156229f +
+                    t * (3.0899424f +
+                         t * (1.2067492f +
+                              t * (0.2659732f +
+                                   t * (0.0360768f + t * 0.0045813f)))));
     }
-    return val;
+    Float t = 3.75f / ax;
+    return std::exp(ax) / std::sqrt(ax) *
+           (0.39894228f +
+            t * (0.01328592f +
+                 t * (0.00225319f +
+                      t * (-0.00157565f +
+                           t * (0.00916281f +
+                                t * (-0.02057706f +
+                                     t * (0.02635537f +
+                                          t * (-0.01647633f +
+                                               t * 0.00392377f))))))));
 }
 
 inline Float LogI0(Float x) {
@@ -120,12 +133,16 @@ inline Float TrimmedLogistic(Float x, Float s, Float a, Float b) {
     return Logistic(x, s) / (LogisticCDF(b, s) - LogisticCDF(a, s));
 }
 
-inline Float Np(Float phi, int p, Float s, Float gammaO, Float gammaT) {
+// _azNorm_ is the $[-\pi,\pi]$ trimmed logistic normalization
+// $\mbox{CDF}(\pi) - \mbox{CDF}(-\pi)$, which only depends on _s_ and is
+// computed once in the HairBSDF constructor.
+inline Float Np(Float phi, int p, Float s, Float gammaO, Float gammaT,
+                Float azNorm) {
     Float dphi = phi - Phi(p, gammaO, gammaT);
     // Remap _dphi_ to $[-\pi,\pi]$
     while (dphi > Pi) dphi -= 2 * Pi;
     while (dphi < -Pi) dphi += 2 * Pi;
-    return TrimmedLogistic(dphi, s, -Pi, Pi);
+    return Logistic(dphi, s) / azNorm;
 }
 
 static Float SampleTrimmedLogistic(Float u, Float s, Float a, Float b) {
@@ -146,7 +163,7 @@ void HairMaterial::ComputeScatteringFunctions(SurfaceInteraction *si,
     Float a = alpha->Evaluate(*si);
     Float e = eta->Evaluate(*si);
 
-    si->bsdf = ARENA_ALLOC(arena, BSDF)(*si, e);
+    si->bsdf = BSDF_ALLOC(si, arena, BSDF)(*si, e);
 
     Spectrum sig_a;
     if (sigma_a)
@@ -163,7 +180,7 @@ void HairMaterial::ComputeScatteringFunctions(SurfaceInteraction *si,
 
     // Offset along width
     Float h = -1 + 2 * si->uv[1];
-    si->bsdf->Add(ARENA_ALLOC(arena, HairBSDF)(h, e, sig_a, bm, bn, a));
+    si->bsdf->Add(BSDF_ALLOC(si, arena, HairBSDF)(h, e, sig_a, bm, bn, a));
 }
 
 HairMaterial *CreateHairMaterial(const TextureParams &mp) {
@@ -252,6 +269,9 @@ HairBSDF::HairBSDF(Float h, Float eta, const Spectrum &sigma_a, Float beta_m,
         (0.265f * beta_n + 1.194f * Sqr(beta_n) + 5.372f * Pow<22>(beta_n));
     CHECK(!std::isnan(s));
 
+    // Precompute the azimuthal logistic normalization over $[-\pi,\pi]$
+    azNorm = LogisticCDF(Pi, s) - LogisticCDF(-Pi, s);
+
     // Compute $\alpha$ terms for hair scales
     sin2kAlpha[0] = std::sin(Radians(alpha));
     cos2kAlpha[0] = SafeSqrt(1 - Sqr(sin2kAlpha[0]));
@@ -261,127 +281,121 @@ HairBSDF::HairBSDF(Float h, Float eta, const Spectrum &sigma_a, Float beta_m,
     }
 }
 
-Spectrum HairBSDF::f(const Vector3f &wo, const Vector3f &wi) const {
-    // Compute hair coordinate system terms related to _wo_
-    Float sinThetaO = wo.x;
-    Float cosThetaO = SafeSqrt(1 - Sqr(sinThetaO));
-    Float phiO = std::atan2(wo.z, wo.y);
+HairBSDF::WoTerms HairBSDF::ComputeWoTerms(const Vector3f &wo) const {
+    WoTerms c;
 
-    // Compute hair coordinate system terms related to _wi_
-    Float sinThetaI = wi.x;
-    Float cosThetaI = SafeSqrt(1 - Sqr(sinThetaI));
-    Float phiI = std::atan2(wi.z, wi.y);
+    // Compute hair coordinate system terms related to _wo_
+    c.sinThetaO = wo.x;
+    c.cosThetaO = SafeSqrt(1 - Sqr(c.sinThetaO));
+    c.phiO = std::atan2(wo.z, wo.y);
 
     // Compute $\cos \thetat$ for refracted ray
-    Float sinThetaT = sinThetaO / eta;
+    Float sinThetaT = c.sinThetaO / eta;
     Float cosThetaT = SafeSqrt(1 - Sqr(sinThetaT));
 
     // Compute $\gammat$ for refracted ray
-    Float etap = std::sqrt(eta * eta - Sqr(sinThetaO)) / cosThetaO;
+    Float etap = std::sqrt(eta * eta - Sqr(c.sinThetaO)) / c.cosThetaO;
     Float sinGammaT = h / etap;
     Float cosGammaT = SafeSqrt(1 - Sqr(sinGammaT));
-    Float gammaT = SafeASin(sinGammaT);
+    c.gammaT = SafeASin(sinGammaT);
 
     // Compute the transmittance _T_ of a single path through the cylinder
     Spectrum T = Exp(-sigma_a * (2 * cosGammaT / cosThetaT));
+    c.ap = Ap(c.cosThetaO, eta, h, T);
 
-    // Evaluate hair BSDF
-    Float phi = phiI - phiO;
-    std::array<Spectrum, pMax + 1> ap = Ap(cosThetaO, eta, h, T);
-    Spectrum fsum(0.);
+    // Compute $A_p$ PDF from individual $A_p$ terms
+    Float sumY =
+        std::accumulate(c.ap.begin(), c.ap.end(), Float(0),
+                        [](Float s, const Spectrum &ap) { return s + ap.y(); });
+    for (int i = 0; i <= pMax; ++i) c.apPdf[i] = c.ap[i].y() / sumY;
+
+    // Compute $\sin \thetao$ and $\cos \thetao$ terms accounting for scales
     for (int p = 0; p < pMax; ++p) {
-        // Compute $\sin \thetao$ and $\cos \thetao$ terms accounting for scales
-        Float sinThetaOp, cosThetaOp;
         if (p == 0) {
-            sinThetaOp = sinThetaO * cos2kAlpha[1] - cosThetaO * sin2kAlpha[1];
-            cosThetaOp = cosThetaO * cos2kAlpha[1] + sinThetaO * sin2kAlpha[1];
+            c.sinThetaOp[p] =
+                c.sinThetaO * cos2kAlpha[1] - c.cosThetaO * sin2kAlpha[1];
+            c.cosThetaOp[p] =
+                c.cosThetaO * cos2kAlpha[1] + c.sinThetaO * sin2kAlpha[1];
         }
 
         // Handle remainder of $p$ values for hair scale tilt
         else if (p == 1) {
-            sinThetaOp = sinThetaO * cos2kAlpha[0] + cosThetaO * sin2kAlpha[0];
-            cosThetaOp = cosThetaO * cos2kAlpha[0] - sinThetaO * sin2kAlpha[0];
+            c.sinThetaOp[p] =
+                c.sinThetaO * cos2kAlpha[0] + c.cosThetaO * sin2kAlpha[0];
+            c.cosThetaOp[p] =
+                c.cosThetaO * cos2kAlpha[0] - c.sinThetaO * sin2kAlpha[0];
         } else if (p == 2) {
-            sinThetaOp = sinThetaO * cos2kAlpha[2] + cosThetaO * sin2kAlpha[2];
-            cosThetaOp = cosThetaO * cos2kAlpha[2] - sinThetaO * sin2kAlpha[2];
+            c.sinThetaOp[p] =
+                c.sinThetaO * cos2kAlpha[2] + c.cosThetaO * sin2kAlpha[2];
+            c.cosThetaOp[p] =
+                c.cosThetaO * cos2kAlpha[2] - c.sinThetaO * sin2kAlpha[2];
         } else {
-            sinThetaOp = sinThetaO;
-            cosThetaOp = cosThetaO;
+            c.sinThetaOp[p] = c.sinThetaO;
+            c.cosThetaOp[p] = c.cosThetaO;
         }
+    }
+    return c;
+}
 
+Spectrum HairBSDF::f(const Vector3f &wo, const Vector3f &wi) const {
+    return f(wi, ComputeWoTerms(wo));
+}
+
+Spectrum HairBSDF::f(const Vector3f &wi, const WoTerms &oc) const {
+    // Compute hair coordinate system terms related to _wi_
+    Float sinThetaI = wi.x;
+    Float cosThetaI = SafeSqrt(1 - Sqr(sinThetaI));
+    Float phiI = std::atan2(wi.z, wi.y);
+
+    // Evaluate hair BSDF
+    Float phi = phiI - oc.phiO;
+    Spectrum fsum(0.);
+    for (int p = 0; p < pMax; ++p) {
         // Handle out-of-range $\cos \thetao$ from scale adjustment
-        cosThetaOp = std::abs(cosThetaOp);
-        fsum += Mp(cosThetaI, cosThetaOp, sinThetaI, sinThetaOp, v[p]) * ap[p] *
-                Np(phi, p, s, gammaO, gammaT);
+        Float cosThetaOp = std::abs(oc.cosThetaOp[p]);
+        fsum += Mp(cosThetaI, cosThetaOp, sinThetaI, oc.sinThetaOp[p], v[p]) *
+                oc.ap[p] * Np(phi, p, s, gammaO, oc.gammaT, azNorm);
     }
 
     // Compute contribution of remaining terms after _pMax_
-    fsum += Mp(cosThetaI, cosThetaO, sinThetaI, sinThetaO, v[pMax]) * ap[pMax] /
-            (2.f * Pi);
+    fsum += Mp(cosThetaI, oc.cosThetaO, sinThetaI, oc.sinThetaO, v[pMax]) *
+            oc.ap[pMax] / (2.f * Pi);
     if (AbsCosTheta(wi) > 0) fsum /= AbsCosTheta(wi);
     CHECK(!std::isinf(fsum.y()) && !std::isnan(fsum.y()));
     return fsum;
 }
 
-std::array<Float, pMax + 1> HairBSDF::ComputeApPdf(Float cosThetaO) const {
-    // Compute array of $A_p$ values for _cosThetaO_
-    Float sinThetaO = SafeSqrt(1 - cosThetaO * cosThetaO);
-
-    // Compute $\cos \thetat$ for refracted ray
-    Float sinThetaT = sinThetaO / eta;
-    Float cosThetaT = SafeSqrt(1 - Sqr(sinThetaT));
-
-    // Compute $\gammat$ for refracted ray
-    Float etap = std::sqrt(eta * eta - Sqr(sinThetaO)) / cosThetaO;
-    Float sinGammaT = h / etap;
-    Float cosGammaT = SafeSqrt(1 - Sqr(sinGammaT));
-
-    // Compute the transmittance _T_ of a single path through the cylinder
-    Spectrum T = Exp(-sigma_a * (2 * cosGammaT / cosThetaT));
-    std::array<Spectrum, pMax + 1> ap = Ap(cosThetaO, eta, h, T);
-
-    // Compute $A_p$ PDF from individual $A_p$ terms
-    std::array<Float, pMax + 1> apPdf;
-    Float sumY =
-        std::accumulate(ap.begin(), ap.end(), Float(0),
-                        [](Float s, const Spectrum &ap) { return s + ap.y(); });
-    for (int i = 0; i <= pMax; ++i) apPdf[i] = ap[i].y() / sumY;
-    return apPdf;
+void HairBSDF::f_N(const Vector3f &wo, const Vector3f *wi, int n,
+                   Spectrum *out) const {
+    // Compute the _wo_ terms once so that the loop below only does the
+    // incident-angle work per direction.
+    WoTerms oc = ComputeWoTerms(wo);
+    for (int i = 0; i < n; ++i) out[i] = f(wi[i], oc);
 }
 
 Spectrum HairBSDF::Sample_f(const Vector3f &wo, Vector3f *wi, const Point2f &u2,
                             Float *pdf, BxDFType *sampledType) const {
-    // Compute hair coordinate system terms related to _wo_
-    Float sinThetaO = wo.x;
-    Float cosThetaO = SafeSqrt(1 - Sqr(sinThetaO));
-    Float phiO = std::atan2(wo.z, wo.y);
+    // Compute attenuation and angle terms that only depend on _wo_
+    WoTerms oc = ComputeWoTerms(wo);
 
     // Derive four random samples from _u2_
     Point2f u[2] = {DemuxFloat(u2[0]), DemuxFloat(u2[1])};
 
     // Determine which term $p$ to sample for hair scattering
-    std::array<Float, pMax + 1> apPdf = ComputeApPdf(cosThetaO);
     int p;
     for (p = 0; p < pMax; ++p) {
-        if (u[0][0] < apPdf[p]) break;
-        u[0][0] -= apPdf[p];
+        if (u[0][0] < oc.apPdf[p]) break;
+        u[0][0] -= oc.apPdf[p];
     }
 
     // Rotate $\sin \thetao$ and $\cos \thetao$ to account for hair scale tilt
     Float sinThetaOp, cosThetaOp;
-    if (p == 0) {
-        sinThetaOp = sinThetaO * cos2kAlpha[1] - cosThetaO * sin2kAlpha[1];
-        cosThetaOp = cosThetaO * cos2kAlpha[1] + sinThetaO * sin2kAlpha[1];
-    }
-    else if (p == 1) {
-        sinThetaOp = sinThetaO * cos2kAlpha[0] + cosThetaO * sin2kAlpha[0];
-        cosThetaOp = cosThetaO * cos2kAlpha[0] - sinThetaO * sin2kAlpha[0];
-    } else if (p == 2) {
-        sinThetaOp = sinThetaO * cos2kAlpha[2] + cosThetaO * sin2kAlpha[2];
-        cosThetaOp = cosThetaO * cos2kAlpha[2] - sinThetaO * sin2kAlpha[2];
+    if (p < pMax) {
+        sinThetaOp = oc.sinThetaOp[p];
+        cosThetaOp = oc.cosThetaOp[p];
     } else {
-        sinThetaOp = sinThetaO;
-        cosThetaOp = cosThetaO;
+        sinThetaOp = oc.sinThetaO;
+        cosThetaOp = oc.cosThetaO;
     }
 
     // Sample $M_p$ to compute $\thetai$
@@ -394,105 +408,53 @@ Spectrum HairBSDF::Sample_f(const Vector3f &wo, Vector3f *wi, const Point2f &u2,
     Float cosThetaI = SafeSqrt(1 - Sqr(sinThetaI));
 
     // Sample $N_p$ to compute $\Delta\phi$
-
-    // Compute $\gammat$ for refracted ray
-    Float etap = std::sqrt(eta * eta - Sqr(sinThetaO)) / cosThetaO;
-    Float sinGammaT = h / etap;
-    Float gammaT = SafeASin(sinGammaT);
     Float dphi;
     if (p < pMax)
-        dphi =
-            Phi(p, gammaO, gammaT) + SampleTrimmedLogistic(u[0][1], s, -Pi, Pi);
+        dphi = Phi(p, gammaO, oc.gammaT) +
+               SampleTrimmedLogistic(u[0][1], s, -Pi, Pi);
     else
         dphi = 2 * Pi * u[0][1];
 
     // Compute _wi_ from sampled hair scattering angles
-    Float phiI = phiO + dphi;
+    Float phiI = oc.phiO + dphi;
     *wi = Vector3f(sinThetaI, cosThetaI * std::cos(phiI),
                    cosThetaI * std::sin(phiI));
 
     // Compute PDF for sampled hair scattering direction _wi_
     *pdf = 0;
     for (int p = 0; p < pMax; ++p) {
-        // Compute $\sin \thetao$ and $\cos \thetao$ terms accounting for scales
-        Float sinThetaOp, cosThetaOp;
-        if (p == 0) {
-            sinThetaOp = sinThetaO * cos2kAlpha[1] - cosThetaO * sin2kAlpha[1];
-            cosThetaOp = cosThetaO * cos2kAlpha[1] + sinThetaO * sin2kAlpha[1];
-        }
-
-        // Handle remainder of $p$ values for hair scale tilt
-        else if (p == 1) {
-            sinThetaOp = sinThetaO * cos2kAlpha[0] + cosThetaO * sin2kAlpha[0];
-            cosThetaOp = cosThetaO * cos2kAlpha[0] - sinThetaO * sin2kAlpha[0];
-        } else if (p == 2) {
-            sinThetaOp = sinThetaO * cos2kAlpha[2] + cosThetaO * sin2kAlpha[2];
-            cosThetaOp = cosThetaO * cos2kAlpha[2] - sinThetaO * sin2kAlpha[2];
-        } else {
-            sinThetaOp = sinThetaO;
-            cosThetaOp = cosThetaO;
-        }
-
         // Handle out-of-range $\cos \thetao$ from scale adjustment
-        cosThetaOp = std::abs(cosThetaOp);
-        *pdf += Mp(cosThetaI, cosThetaOp, sinThetaI, sinThetaOp, v[p]) *
-                apPdf[p] * Np(dphi, p, s, gammaO, gammaT);
+        Float cosThetaOp = std::abs(oc.cosThetaOp[p]);
+        *pdf += Mp(cosThetaI, cosThetaOp, sinThetaI, oc.sinThetaOp[p], v[p]) *
+                oc.apPdf[p] * Np(dphi, p, s, gammaO, oc.gammaT, azNorm);
     }
-    *pdf += Mp(cosThetaI, cosThetaO, sinThetaI, sinThetaO, v[pMax]) *
-            apPdf[pMax] * (1 / (2 * Pi));
+    *pdf += Mp(cosThetaI, oc.cosThetaO, sinThetaI, oc.sinThetaO, v[pMax]) *
+            oc.apPdf[pMax] * (1 / (2 * Pi));
     // if (std::abs(wi->x) < .9999) CHECK_NEAR(*pdf, Pdf(wo, *wi), .01);
-    return f(wo, *wi);
+    return f(*wi, oc);
 }
 
 Float HairBSDF::Pdf(const Vector3f &wo, const Vector3f &wi) const {
-    // Compute hair coordinate system terms related to _wo_
-    Float sinThetaO = wo.x;
-    Float cosThetaO = SafeSqrt(1 - Sqr(sinThetaO));
-    Float phiO = std::atan2(wo.z, wo.y);
+    return Pdf(wi, ComputeWoTerms(wo));
+}
 
+Float HairBSDF::Pdf(const Vector3f &wi, const WoTerms &oc) const {
     // Compute hair coordinate system terms related to _wi_
     Float sinThetaI = wi.x;
     Float cosThetaI = SafeSqrt(1 - Sqr(sinThetaI));
     Float phiI = std::atan2(wi.z, wi.y);
 
-    // Compute $\gammat$ for refracted ray
-    Float etap = std::sqrt(eta * eta - Sqr(sinThetaO)) / cosThetaO;
-    Float sinGammaT = h / etap;
-    Float gammaT = SafeASin(sinGammaT);
-
-    // Compute PDF for $A_p$ terms
-    std::array<Float, pMax + 1> apPdf = ComputeApPdf(cosThetaO);
-
     // Compute PDF sum for hair scattering events
-    Float phi = phiI - phiO;
+    Float phi = phiI - oc.phiO;
     Float pdf = 0;
     for (int p = 0; p < pMax; ++p) {
-        // Compute $\sin \thetao$ and $\cos \thetao$ terms accounting for scales
-        Float sinThetaOp, cosThetaOp;
-        if (p == 0) {
-            sinThetaOp = sinThetaO * cos2kAlpha[1] - cosThetaO * sin2kAlpha[1];
-            cosThetaOp = cosThetaO * cos2kAlpha[1] + sinThetaO * sin2kAlpha[1];
-        }
-
-        // Handle remainder of $p$ values for hair scale tilt
-        else if (p == 1) {
-            sinThetaOp = sinThetaO * cos2kAlpha[0] + cosThetaO * sin2kAlpha[0];
-            cosThetaOp = cosThetaO * cos2kAlpha[0] - sinThetaO * sin2kAlpha[0];
-        } else if (p == 2) {
-            sinThetaOp = sinThetaO * cos2kAlpha[2] + cosThetaO * sin2kAlpha[2];
-            cosThetaOp = cosThetaO * cos2kAlpha[2] - sinThetaO * sin2kAlpha[2];
-        } else {
-            sinThetaOp = sinThetaO;
-            cosThetaOp = cosThetaO;
-        }
-
         // Handle out-of-range $\cos \thetao$ from scale adjustment
-        cosThetaOp = std::abs(cosThetaOp);
-        pdf += Mp(cosThetaI, cosThetaOp, sinThetaI, sinThetaOp, v[p]) *
-               apPdf[p] * Np(phi, p, s, gammaO, gammaT);
+        Float cosThetaOp = std::abs(oc.cosThetaOp[p]);
+        pdf += Mp(cosThetaI, cosThetaOp, sinThetaI, oc.sinThetaOp[p], v[p]) *
+               oc.apPdf[p] * Np(phi, p, s, gammaO, oc.gammaT, azNorm);
     }
-    pdf += Mp(cosThetaI, cosThetaO, sinThetaI, sinThetaO, v[pMax]) *
-           apPdf[pMax] * (1 / (2 * Pi));
+    pdf += Mp(cosThetaI, oc.cosThetaO, sinThetaI, oc.sinThetaO, v[pMax]) *
+           oc.apPdf[pMax] * (1 / (2 * Pi));
     return pdf;
 }
 
@@ -97,6 +97,8 @@ class HairBSDF : public BxDF {
     HairBSDF(Float h, Float eta, const Spectrum &sigma_a, Float beta_m,
              Float beta_n, Float alpha);
     Spectrum f(const Vector3f &wo, const Vector3f &wi) const;
+    void f_N(const Vector3f &wo, const Vector3f *wi, int n,
+             Spectrum *out) const;
     Spectrum Sample_f(const Vector3f &wo, Vector3f *wi, const Point2f &u,
                       Float *pdf, BxDFType *sampledType) const;
     Float Pdf(const Vector3f &wo, const Vector3f &wi) const;
@@ -105,15 +107,32 @@ class HairBSDF : public BxDF {
     static Spectrum SigmaAFromReflectance(const Spectrum &c, Float beta_n);
 
   private:
+    // HairBSDF Private Declarations
+    // Terms that only depend on the outgoing direction, computed once per
+    // _wo_ and passed between f(), Pdf(), and f_N(), which would otherwise
+    // each redo the attenuation and refraction work.  They live on the
+    // caller's stack: BSDFs can be evaluated from several threads at once
+    // (SPPM's photon pass shares the visible points' BSDFs), so the BxDF
+    // itself must stay immutable after construction.
+    struct WoTerms {
+        Float sinThetaO, cosThetaO, phiO;
+        Float gammaT;
+        std::array<Spectrum, pMax + 1> ap;
+        std::array<Float, pMax + 1> apPdf;
+        Float sinThetaOp[pMax], cosThetaOp[pMax];
+    };
+
     // HairBSDF Private Methods
-    std::array<Float, pMax + 1> ComputeApPdf(Float cosThetaO) const;
+    WoTerms ComputeWoTerms(const Vector3f &wo) const;
+    Spectrum f(const Vector3f &wi, const WoTerms &oc) const;
+    Float Pdf(const Vector3f &wi, const WoTerms &oc) const;
 
     // HairBSDF Private Data
     const Float h, gammaO, eta;
     const Spectrum sigma_a;
     const Float beta_m, beta_n;
     Float v[pMax + 1];
-    Float s;
+    Float s, azNorm;
     Float sin2kAlpha[3], cos2kAlpha[3];
 };
 
@@ -53,14 +53,14 @@ void KdSubsurfaceMaterial::ComputeScatteringFunctions(
     Float vrough = vRoughness->Evaluate(*si);
 
     // Initialize _bsdf_ for smooth or rough dielectric
-    si->bsdf = ARENA_ALLOC(arena, BSDF)(*si, eta);
+    si->bsdf = BSDF_ALLOC(si, arena, BSDF)(*si, eta);
 
     if (R.IsBlack() && T.IsBlack()) return;
 
     bool isSpecular = urough == 0 && vrough == 0;
     if (isSpecular && allowMultipleLobes) {
         si->bsdf->Add(
-            ARENA_ALLOC(arena, FresnelSpecular)(R, T, 1.f, eta, mode));
+            BSDF_ALLOC(si, arena, FresnelSpecular)(R, T, 1.f, eta, mode));
     } else {
         if (remapRoughness) {
             urough = TrowbridgeReitzDistribution::RoughnessToAlpha(urough);
@@ -68,23 +68,23 @@ void KdSubsurfaceMaterial::ComputeScatteringFunctions(
         }
         MicrofacetDistribution *distrib =
             isSpecular ? nullptr
-                       : ARENA_ALLOC(arena, TrowbridgeReitzDistribution)(
+                       : BSDF_ALLOC(si, arena, TrowbridgeReitzDistribution)(
                              urough, vrough);
         if (!R.IsBlack()) {
-            Fresnel *fresnel = ARENA_ALLOC(arena, FresnelDielectric)(1.f, eta);
+            Fresnel *fresnel = BSDF_ALLOC(si, arena, FresnelDielectric)(1.f, eta);
             if (isSpecular)
                 si->bsdf->Add(
-                    ARENA_ALLOC(arena, SpecularReflection)(R, fresnel));
+                    BSDF_ALLOC(si, arena, SpecularReflection)(R, fresnel));
             else
-                si->bsdf->Add(ARENA_ALLOC(arena, MicrofacetReflection)(
+                si->bsdf->Add(BSDF_ALLOC(si, arena, MicrofacetReflection)(
                     R, distrib, fresnel));
         }
         if (!T.IsBlack()) {
             if (isSpecular)
-                si->bsdf->Add(ARENA_ALLOC(arena, SpecularTransmission)(
+                si->bsdf->Add(BSDF_ALLOC(si, arena, SpecularTransmission)(
                     T, 1.f, eta, mode));
             else
-                si->bsdf->Add(ARENA_ALLOC(arena, MicrofacetTransmission)(
+                si->bsdf->Add(BSDF_ALLOC(si, arena, MicrofacetTransmission)(
                     T, distrib, 1.f, eta, mode));
         }
     }
@@ -93,7 +93,7 @@ void KdSubsurfaceMaterial::ComputeScatteringFunctions(
     Spectrum kd = Kd->Evaluate(*si).Clamp();
     Spectrum sig_a, sig_s;
     SubsurfaceFromDiffuse(table, kd, mfree, &sig_a, &sig_s);
-    si->bssrdf = ARENA_ALLOC(arena, TabulatedBSSRDF)(*si, this, mode, eta,
+    si->bssrdf = BSDF_ALLOC(si, arena, TabulatedBSSRDF)(*si, this, mode, eta,
                                                      sig_a, sig_s, table);
 }
 
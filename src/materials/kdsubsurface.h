@@ -76,6 +76,7 @@ class KdSubsurfaceMaterial : public Material {
     void ComputeScatteringFunctions(SurfaceInteraction *si, MemoryArena &arena,
                                     TransportMode mode,
                                     bool allowMultipleLobes) const;
+    bool HasSubsurfaceScattering() const { return true; }
 
   private:
     // KdSubsurfaceMaterial Private Data
@@ -50,14 +50,14 @@ void MatteMaterial::ComputeScatteringFunctions(SurfaceInteraction *si,
     if (bumpMap) Bump(bumpMap, si);
 
     // Evaluate textures for _MatteMaterial_ material and allocate BRDF
-    si->bsdf = ARENA_ALLOC(arena, BSDF)(*si);
-    Spectrum r = Kd->Evaluate(*si).Clamp();
-    Float sig = Clamp(sigma->Evaluate(*si), 0, 90);
+    si->bsdf = BSDF_ALLOC(si, arena, BSDF)(*si);
+    Spectrum r = EvaluateMemoized(Kd, *si).Clamp();
+    Float sig = Clamp(EvaluateMemoized(sigma, *si), 0, 90);
     if (!r.IsBlack()) {
         if (sig == 0)
-            si->bsdf->Add(ARENA_ALLOC(arena, LambertianReflection)(r));
+            si->bsdf->Add(BSDF_ALLOC(si, arena, LambertianReflection)(r));
         else
-            si->bsdf->Add(ARENA_ALLOC(arena, OrenNayar)(r, sig));
+            si->bsdf->Add(BSDF_ALLOC(si, arena, OrenNayar)(r, sig));
     }
 }
 
@@ -48,11 +48,11 @@ void MirrorMaterial::ComputeScatteringFunctions(SurfaceInteraction *si,
                                                 bool allowMultipleLobes) const {
     // Perform bump mapping with _bumpMap_, if present
     if (bumpMap) Bump(bumpMap, si);
-    si->bsdf = ARENA_ALLOC(arena, BSDF)(*si);
+    si->bsdf = BSDF_ALLOC(si, arena, BSDF)(*si);
     Spectrum R = Kr->Evaluate(*si).Clamp();
     if (!R.IsBlack())
-        si->bsdf->Add(ARENA_ALLOC(arena, SpecularReflection)(
-            R, ARENA_ALLOC(arena, FresnelNoOp)()));
+        si->bsdf->Add(BSDF_ALLOC(si, arena, SpecularReflection)(
+            R, BSDF_ALLOC(si, arena, FresnelNoOp)()));
 }
 
 MirrorMaterial *CreateMirrorMaterial(const TextureParams &mp) {
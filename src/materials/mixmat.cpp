@@ -39,6 +39,8 @@
 #include "paramset.h"
 #include "texture.h"
 #include "interaction.h"
+#include "rng.h"
+#include "parallel.h"
 
 namespace pbrt {
 
@@ -50,7 +52,45 @@ void MixMaterial::ComputeScatteringFunctions(SurfaceInteraction *si,
     // Compute weights and original _BxDF_s for mix material
     Spectrum s1 = scale->Evaluate(*si).Clamp();
     Spectrum s2 = (Spectrum(1.f) - s1).Clamp();
+
+    // Evaluate only the contributing child where the mix amount is a
+    // binary mask; amount textures painted as masks make this the common
+    // case, and it skips the other material's texture evaluations and BxDF
+    // construction entirely.
+    if (s1.IsBlack() || s2.IsBlack()) {
+        const Material *m = s1.IsBlack() ? m2.get() : m1.get();
+        const Spectrum &s = s1.IsBlack() ? s2 : s1;
+        m->ComputeScatteringFunctions(si, arena, mode, allowMultipleLobes);
+        if (si->bsdf && !(s == Spectrum(1.f)))
+            for (int i = 0; i < si->bsdf->NumComponents(); ++i)
+                si->bsdf->bxdfs[i] =
+                    BSDF_ALLOC(si, arena, ScaledBxDF)(si->bsdf->bxdfs[i], s);
+        return;
+    }
+
+    // In stochastic mode, evaluate a single child chosen with probability
+    // proportional to its mix weight; dividing the chosen weight by the
+    // selection probability keeps the estimator unbiased, so the image
+    // converges to the full mixture. The choice is made once per hit, so
+    // direct lighting and BSDF sampling at the hit see a consistent BSDF.
+    if (stochastic) {
+        static PBRT_THREAD_LOCAL RNG rng(ThreadIndex);
+        Float w1 = s1.y(), w2 = s2.y();
+        Float p = w1 + w2 > 0 ? w1 / (w1 + w2) : (Float).5;
+        bool first = rng.UniformFloat() < p;
+        const Material *m = first ? m1.get() : m2.get();
+        Spectrum s = first ? s1 / p : s2 / (1 - p);
+        m->ComputeScatteringFunctions(si, arena, mode, allowMultipleLobes);
+        if (si->bsdf)
+            for (int i = 0; i < si->bsdf->NumComponents(); ++i)
+                si->bsdf->bxdfs[i] =
+                    BSDF_ALLOC(si, arena, ScaledBxDF)(si->bsdf->bxdfs[i], s);
+        return;
+    }
     SurfaceInteraction si2 = *si;
+    // _si2_'s BxDFs are wrapped below and referenced from _si->bsdf_ after
+    // _si2_ goes away, so they can't live in _si2_'s inline storage.
+    si2.inlineShadingAllowed = false;
     m1->ComputeScatteringFunctions(si, arena, mode, allowMultipleLobes);
     m2->ComputeScatteringFunctions(&si2, arena, mode, allowMultipleLobes);
 
@@ -58,9 +98,9 @@ void MixMaterial::ComputeScatteringFunctions(SurfaceInteraction *si,
     int n1 = si->bsdf->NumComponents(), n2 = si2.bsdf->NumComponents();
     for (int i = 0; i < n1; ++i)
         si->bsdf->bxdfs[i] =
-            ARENA_ALLOC(arena, ScaledBxDF)(si->bsdf->bxdfs[i], s1);
+            BSDF_ALLOC(si, arena, ScaledBxDF)(si->bsdf->bxdfs[i], s1);
     for (int i = 0; i < n2; ++i)
-        si->bsdf->Add(ARENA_ALLOC(arena, ScaledBxDF)(si2.bsdf->bxdfs[i], s2));
+        si->bsdf->Add(BSDF_ALLOC(si, arena, ScaledBxDF)(si2.bsdf->bxdfs[i], s2));
 }
 
 MixMaterial *CreateMixMaterial(const TextureParams &mp,
@@ -68,7 +108,8 @@ MixMaterial *CreateMixMaterial(const TextureParams &mp,
                                const std::shared_ptr<Material> &m2) {
     std::shared_ptr<Texture<Spectrum>> scale =
         mp.GetSpectrumTexture("amount", Spectrum(0.5f));
-    return new MixMaterial(m1, m2, scale);
+    bool stochastic = mp.FindBool("stochastic", false);
+    return new MixMaterial(m1, m2, scale, stochastic);
 }
 
 }  // namespace pbrt
@@ -48,18 +48,28 @@ namespace pbrt {
 class MixMaterial : public Material {
   public:
     // MixMaterial Public Methods
+    // _stochastic_ selects the single-child fast mode: each hit evaluates
+    // just one of the two materials, chosen with probability proportional
+    // to its mix weight and reweighted to keep the estimator unbiased, so
+    // renders converge to the full mixture at roughly half the shading
+    // cost.
     MixMaterial(const std::shared_ptr<Material> &m1,
                 const std::shared_ptr<Material> &m2,
-                const std::shared_ptr<Texture<Spectrum>> &scale)
-        : m1(m1), m2(m2), scale(scale) {}
+                const std::shared_ptr<Texture<Spectrum>> &scale,
+                bool stochastic = false)
+        : m1(m1), m2(m2), scale(scale), stochastic(stochastic) {}
     void ComputeScatteringFunctions(SurfaceInteraction *si, MemoryArena &arena,
                                     TransportMode mode,
                                     bool allowMultipleLobes) const;
+    bool HasSubsurfaceScattering() const {
+        return m1->HasSubsurfaceScattering() || m2->HasSubsurfaceScattering();
+    }
 
   private:
     // MixMaterial Private Data
     std::shared_ptr<Material> m1, m2;
     std::shared_ptr<Texture<Spectrum>> scale;
+    bool stochastic;
 };
 
 MixMaterial *CreateMixMaterial(const TextureParams &mp,
@@ -47,24 +47,24 @@ void PlasticMaterial::ComputeScatteringFunctions(
     bool allowMultipleLobes) const {
     // Perform bump mapping with _bumpMap_, if present
     if (bumpMap) Bump(bumpMap, si);
-    si->bsdf = ARENA_ALLOC(arena, BSDF)(*si);
+    si->bsdf = BSDF_ALLOC(si, arena, BSDF)(*si);
     // Initialize diffuse component of plastic material
-    Spectrum kd = Kd->Evaluate(*si).Clamp();
+    Spectrum kd = EvaluateMemoized(Kd, *si).Clamp();
     if (!kd.IsBlack())
-        si->bsdf->Add(ARENA_ALLOC(arena, LambertianReflection)(kd));
+        si->bsdf->Add(BSDF_ALLOC(si, arena, LambertianReflection)(kd));
 
     // Initialize specular component of plastic material
-    Spectrum ks = Ks->Evaluate(*si).Clamp();
+    Spectrum ks = EvaluateMemoized(Ks, *si).Clamp();
     if (!ks.IsBlack()) {
-        Fresnel *fresnel = ARENA_ALLOC(arena, FresnelDielectric)(1.5f, 1.f);
+        Fresnel *fresnel = BSDF_ALLOC(si, arena, FresnelDielectric)(1.5f, 1.f);
         // Create microfacet distribution _distrib_ for plastic material
-        Float rough = roughness->Evaluate(*si);
+        Float rough = EvaluateMemoized(roughness, *si);
         if (remapRoughness)
             rough = TrowbridgeReitzDistribution::RoughnessToAlpha(rough);
         MicrofacetDistribution *distrib =
-            ARENA_ALLOC(arena, TrowbridgeReitzDistribution)(rough, rough);
+            BSDF_ALLOC(si, arena, TrowbridgeReitzDistribution)(rough, rough);
         BxDF *spec =
-            ARENA_ALLOC(arena, MicrofacetReflection)(ks, distrib, fresnel);
+            BSDF_ALLOC(si, arena, MicrofacetReflection)(ks, distrib, fresnel);
         si->bsdf->Add(spec);
     }
 }
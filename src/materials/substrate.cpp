@@ -47,11 +47,11 @@ void SubstrateMaterial::ComputeScatteringFunctions(
     bool allowMultipleLobes) const {
     // Perform bump mapping with _bumpMap_, if present
     if (bumpMap) Bump(bumpMap, si);
-    si->bsdf = ARENA_ALLOC(arena, BSDF)(*si);
-    Spectrum d = Kd->Evaluate(*si).Clamp();
-    Spectrum s = Ks->Evaluate(*si).Clamp();
-    Float roughu = nu->Evaluate(*si);
-    Float roughv = nv->Evaluate(*si);
+    si->bsdf = BSDF_ALLOC(si, arena, BSDF)(*si);
+    Spectrum d = EvaluateMemoized(Kd, *si).Clamp();
+    Spectrum s = EvaluateMemoized(Ks, *si).Clamp();
+    Float roughu = EvaluateMemoized(nu, *si);
+    Float roughv = EvaluateMemoized(nv, *si);
 
     if (!d.IsBlack() || !s.IsBlack()) {
         if (remapRoughness) {
@@ -59,8 +59,8 @@ void SubstrateMaterial::ComputeScatteringFunctions(
             roughv = TrowbridgeReitzDistribution::RoughnessToAlpha(roughv);
         }
         MicrofacetDistribution *distrib =
-            ARENA_ALLOC(arena, TrowbridgeReitzDistribution)(roughu, roughv);
-        si->bsdf->Add(ARENA_ALLOC(arena, FresnelBlend)(d, s, distrib));
+            BSDF_ALLOC(si, arena, TrowbridgeReitzDistribution)(roughu, roughv);
+        si->bsdf->Add(BSDF_ALLOC(si, arena, FresnelBlend)(d, s, distrib));
     }
 }
 
@@ -76,6 +76,7 @@ class SubsurfaceMaterial : public Material {
     void ComputeScatteringFunctions(SurfaceInteraction *si, MemoryArena &arena,
                                     TransportMode mode,
                                     bool allowMultipleLobes) const;
+    bool HasSubsurfaceScattering() const { return true; }
 
   private:
     // SubsurfaceMaterial Private Data
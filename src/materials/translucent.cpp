@@ -48,33 +48,33 @@ void TranslucentMaterial::ComputeScatteringFunctions(
     // Perform bump mapping with _bumpMap_, if present
     if (bumpMap) Bump(bumpMap, si);
     Float eta = 1.5f;
-    si->bsdf = ARENA_ALLOC(arena, BSDF)(*si, eta);
+    si->bsdf = BSDF_ALLOC(si, arena, BSDF)(*si, eta);
 
-    Spectrum r = reflect->Evaluate(*si).Clamp();
-    Spectrum t = transmit->Evaluate(*si).Clamp();
+    Spectrum r = EvaluateMemoized(reflect, *si).Clamp();
+    Spectrum t = EvaluateMemoized(transmit, *si).Clamp();
     if (r.IsBlack() && t.IsBlack()) return;
 
-    Spectrum kd = Kd->Evaluate(*si).Clamp();
+    Spectrum kd = EvaluateMemoized(Kd, *si).Clamp();
     if (!kd.IsBlack()) {
         if (!r.IsBlack())
-            si->bsdf->Add(ARENA_ALLOC(arena, LambertianReflection)(r * kd));
+            si->bsdf->Add(BSDF_ALLOC(si, arena, LambertianReflection)(r * kd));
         if (!t.IsBlack())
-            si->bsdf->Add(ARENA_ALLOC(arena, LambertianTransmission)(t * kd));
+            si->bsdf->Add(BSDF_ALLOC(si, arena, LambertianTransmission)(t * kd));
     }
-    Spectrum ks = Ks->Evaluate(*si).Clamp();
+    Spectrum ks = EvaluateMemoized(Ks, *si).Clamp();
     if (!ks.IsBlack() && (!r.IsBlack() || !t.IsBlack())) {
-        Float rough = roughness->Evaluate(*si);
+        Float rough = EvaluateMemoized(roughness, *si);
         if (remapRoughness)
             rough = TrowbridgeReitzDistribution::RoughnessToAlpha(rough);
         MicrofacetDistribution *distrib =
-            ARENA_ALLOC(arena, TrowbridgeReitzDistribution)(rough, rough);
+            BSDF_ALLOC(si, arena, TrowbridgeReitzDistribution)(rough, rough);
         if (!r.IsBlack()) {
-            Fresnel *fresnel = ARENA_ALLOC(arena, FresnelDielectric)(1.f, eta);
-            si->bsdf->Add(ARENA_ALLOC(arena, MicrofacetReflection)(
+            Fresnel *fresnel = BSDF_ALLOC(si, arena, FresnelDielectric)(1.f, eta);
+            si->bsdf->Add(BSDF_ALLOC(si, arena, MicrofacetReflection)(
                 r * ks, distrib, fresnel));
         }
         if (!t.IsBlack())
-            si->bsdf->Add(ARENA_ALLOC(arena, MicrofacetTransmission)(
+            si->bsdf->Add(BSDF_ALLOC(si, arena, MicrofacetTransmission)(
                 t * ks, distrib, 1.f, eta, mode));
     }
 }
@@ -48,33 +48,33 @@ void UberMaterial::ComputeScatteringFunctions(SurfaceInteraction *si,
                                               bool allowMultipleLobes) const {
     // Perform bump mapping with _bumpMap_, if present
     if (bumpMap) Bump(bumpMap, si);
-    Float e = eta->Evaluate(*si);
+    Float e = EvaluateMemoized(eta, *si);
 
-    Spectrum op = opacity->Evaluate(*si).Clamp();
+    Spectrum op = EvaluateMemoized(opacity, *si).Clamp();
     Spectrum t = (-op + Spectrum(1.f)).Clamp();
     if (!t.IsBlack()) {
-        si->bsdf = ARENA_ALLOC(arena, BSDF)(*si, 1.f);
-        BxDF *tr = ARENA_ALLOC(arena, SpecularTransmission)(t, 1.f, 1.f, mode);
+        si->bsdf = BSDF_ALLOC(si, arena, BSDF)(*si, 1.f);
+        BxDF *tr = BSDF_ALLOC(si, arena, SpecularTransmission)(t, 1.f, 1.f, mode);
         si->bsdf->Add(tr);
     } else
-        si->bsdf = ARENA_ALLOC(arena, BSDF)(*si, e);
+        si->bsdf = BSDF_ALLOC(si, arena, BSDF)(*si, e);
 
-    Spectrum kd = op * Kd->Evaluate(*si).Clamp();
+    Spectrum kd = op * EvaluateMemoized(Kd, *si).Clamp();
     if (!kd.IsBlack()) {
-        BxDF *diff = ARENA_ALLOC(arena, LambertianReflection)(kd);
+        BxDF *diff = BSDF_ALLOC(si, arena, LambertianReflection)(kd);
         si->bsdf->Add(diff);
     }
 
-    Spectrum ks = op * Ks->Evaluate(*si).Clamp();
+    Spectrum ks = op * EvaluateMemoized(Ks, *si).Clamp();
     if (!ks.IsBlack()) {
-        Fresnel *fresnel = ARENA_ALLOC(arena, FresnelDielectric)(1.f, e);
+        Fresnel *fresnel = BSDF_ALLOC(si, arena, FresnelDielectric)(1.f, e);
         Float roughu, roughv;
         if (roughnessu)
-            roughu = roughnessu->Evaluate(*si);
+            roughu = EvaluateMemoized(roughnessu, *si);
         else
-            roughu = roughness->Evaluate(*si);
+            roughu = EvaluateMemoized(roughness, *si);
         if (roughnessv)
-            roughv = roughnessv->Evaluate(*si);
+            roughv = EvaluateMemoized(roughnessv, *si);
         else
             roughv = roughu;
         if (remapRoughness) {
@@ -82,22 +82,22 @@ void UberMaterial::ComputeScatteringFunctions(SurfaceInteraction *si,
             roughv = TrowbridgeReitzDistribution::RoughnessToAlpha(roughv);
         }
         MicrofacetDistribution *distrib =
-            ARENA_ALLOC(arena, TrowbridgeReitzDistribution)(roughu, roughv);
+            BSDF_ALLOC(si, arena, TrowbridgeReitzDistribution)(roughu, roughv);
         BxDF *spec =
-            ARENA_ALLOC(arena, MicrofacetReflection)(ks, distrib, fresnel);
+            BSDF_ALLOC(si, arena, MicrofacetReflection)(ks, distrib, fresnel);
         si->bsdf->Add(spec);
     }
 
-    Spectrum kr = op * Kr->Evaluate(*si).Clamp();
+    Spectrum kr = op * EvaluateMemoized(Kr, *si).Clamp();
     if (!kr.IsBlack()) {
-        Fresnel *fresnel = ARENA_ALLOC(arena, FresnelDielectric)(1.f, e);
-        si->bsdf->Add(ARENA_ALLOC(arena, SpecularReflection)(kr, fresnel));
+        Fresnel *fresnel = BSDF_ALLOC(si, arena, FresnelDielectric)(1.f, e);
+        si->bsdf->Add(BSDF_ALLOC(si, arena, SpecularReflection)(kr, fresnel));
     }
 
-    Spectrum kt = op * Kt->Evaluate(*si).Clamp();
+    Spectrum kt = op * EvaluateMemoized(Kt, *si).Clamp();
     if (!kt.IsBlack())
         si->bsdf->Add(
-            ARENA_ALLOC(arena, SpecularTransmission)(kt, 1.f, e, mode));
+            BSDF_ALLOC(si, arena, SpecularTransmission)(kt, 1.f, e, mode));
 }
 
 UberMaterial *CreateUberMaterial(const TextureParams &mp) {
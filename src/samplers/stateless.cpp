@@ -0,0 +1,126 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+
+// samplers/stateless.cpp*
+#include "samplers/stateless.h"
+#include "paramset.h"
+#include "stats.h"
+
+namespace pbrt {
+
+// Counters are partitioned so that on-demand dimensions and array samples
+// never alias: the top two bits tag the counter space and the remaining
+// bits pack the addressing coordinates.
+//
+//   scalar:   [sample:46 | dimension:16]
+//   1D array: [1,0 | array index:14 | sample:24 | entry:24]
+//   2D array: [0,1 | array index:14 | sample:24 | entry:24]
+static PBRT_CONSTEXPR uint64_t Array1DCounterTag = 1ull << 63;
+static PBRT_CONSTEXPR uint64_t Array2DCounterTag = 1ull << 62;
+
+// StatelessRandomSampler Method Definitions
+StatelessRandomSampler::StatelessRandomSampler(int64_t samplesPerPixel,
+                                               int seed)
+    : Sampler(samplesPerPixel), seed(seed) {}
+
+void StatelessRandomSampler::StartPixel(const Point2i &p) {
+    ProfilePhase _(Prof::StartPixel);
+    // Key the RNG for the current pixel; all values drawn below and by
+    // _Get1D()_ / _Get2D()_ depend only on this key and the counter, so
+    // they are independent of tile shape, thread count, and the order
+    // pixels and samples are visited in.
+    rng = CounterRNG(CounterRNG::MixBits((uint64_t(uint32_t(p.x)) << 32) ^
+                                         uint32_t(p.y)) ^
+                     (uint64_t(seed) << 16));
+    dimension = 0;
+
+    // Generate array samples from their dedicated counter ranges
+    for (size_t i = 0; i < sampleArray1D.size(); ++i)
+        for (size_t j = 0; j < sampleArray1D[i].size(); ++j)
+            sampleArray1D[i][j] = rng.UniformFloat(
+                Array1DCounterTag | (uint64_t(i) << 48) | uint64_t(j));
+
+    for (size_t i = 0; i < sampleArray2D.size(); ++i)
+        for (size_t j = 0; j < sampleArray2D[i].size(); ++j) {
+            uint64_t c = Array2DCounterTag | (uint64_t(i) << 48) |
+                         (uint64_t(j) << 1);
+            sampleArray2D[i][j] = {rng.UniformFloat(c),
+                                   rng.UniformFloat(c | 1)};
+        }
+    Sampler::StartPixel(p);
+}
+
+Float StatelessRandomSampler::Get1D() {
+    ProfilePhase _(Prof::GetSample);
+    CHECK_LT(currentPixelSampleIndex, samplesPerPixel);
+    return rng.UniformFloat((uint64_t(currentPixelSampleIndex) << 16) |
+                            uint64_t(dimension++));
+}
+
+Point2f StatelessRandomSampler::Get2D() {
+    ProfilePhase _(Prof::GetSample);
+    CHECK_LT(currentPixelSampleIndex, samplesPerPixel);
+    uint64_t c = (uint64_t(currentPixelSampleIndex) << 16) |
+                 uint64_t(dimension);
+    dimension += 2;
+    return {rng.UniformFloat(c), rng.UniformFloat(c + 1)};
+}
+
+bool StatelessRandomSampler::StartNextSample() {
+    dimension = 0;
+    return Sampler::StartNextSample();
+}
+
+bool StatelessRandomSampler::SetSampleNumber(int64_t sampleNum) {
+    dimension = 0;
+    return Sampler::SetSampleNumber(sampleNum);
+}
+
+std::unique_ptr<Sampler> StatelessRandomSampler::Clone(int seed) {
+    // Clones deliberately keep the original seed: decorrelation comes from
+    // the per-pixel key, so every clone computes identical values for a
+    // given (pixel, sample, dimension).
+    return std::unique_ptr<Sampler>(new StatelessRandomSampler(*this));
+}
+
+StatelessRandomSampler *CreateStatelessRandomSampler(const ParamSet &params) {
+    int nsamp = params.FindOneInt("pixelsamples", 16);
+    int seed = params.FindOneInt("seed", 0);
+    if (PbrtOptions.quickRender) nsamp = 1;
+    // Benchmark mode renders a fixed number of samples per pixel so the
+    // workload is comparable across scenes and builds.
+    if (PbrtOptions.benchmark) nsamp = 16;
+    return new StatelessRandomSampler(nsamp, seed);
+}
+
+}  // namespace pbrt
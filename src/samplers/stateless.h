@@ -0,0 +1,76 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_SAMPLERS_STATELESS_H
+#define PBRT_SAMPLERS_STATELESS_H
+
+// samplers/stateless.h*
+#include "sampler.h"
+#include "rng.h"
+
+namespace pbrt {
+
+// StatelessRandomSampler Declarations
+
+// Uniform random samples from a counter-based RNG addressed by (pixel,
+// sample, dimension): every value is a pure function of those
+// coordinates and the seed, so samples can be evaluated in any order
+// across any number of threads with bitwise identical results. The
+// sampler adapter the batched/wavefront shading paths assume.
+class StatelessRandomSampler : public Sampler {
+  public:
+    // StatelessRandomSampler Public Methods
+    StatelessRandomSampler(int64_t samplesPerPixel, int seed = 0);
+    void StartPixel(const Point2i &p);
+    Float Get1D();
+    Point2f Get2D();
+    bool StartNextSample();
+    bool SetSampleNumber(int64_t sampleNum);
+    std::unique_ptr<Sampler> Clone(int seed);
+
+  private:
+    // StatelessRandomSampler Private Data
+    const int seed;
+    CounterRNG rng;
+    int dimension = 0;
+};
+
+StatelessRandomSampler *CreateStatelessRandomSampler(const ParamSet &params);
+
+}  // namespace pbrt
+
+#endif  // PBRT_SAMPLERS_STATELESS_H
@@ -42,17 +42,8 @@ namespace pbrt {
 // StratifiedSampler Method Definitions
 void StratifiedSampler::StartPixel(const Point2i &p) {
     ProfilePhase _(Prof::StartPixel);
-    // Generate single stratified samples for the pixel
-    for (size_t i = 0; i < samples1D.size(); ++i) {
-        StratifiedSample1D(&samples1D[i][0], xPixelSamples * yPixelSamples, rng,
-                           jitterSamples);
-        Shuffle(&samples1D[i][0], xPixelSamples * yPixelSamples, 1, rng);
-    }
-    for (size_t i = 0; i < samples2D.size(); ++i) {
-        StratifiedSample2D(&samples2D[i][0], xPixelSamples, yPixelSamples, rng,
-                           jitterSamples);
-        Shuffle(&samples2D[i][0], xPixelSamples * yPixelSamples, 1, rng);
-    }
+    // Single stratified samples are generated per dimension on first use;
+    // see _GenerateDimension1D()_ below.
 
     // Generate arrays of stratified samples for the pixel
     for (size_t i = 0; i < samples1DArraySizes.size(); ++i)
@@ -70,6 +61,18 @@ void StratifiedSampler::StartPixel(const Point2i &p) {
     PixelSampler::StartPixel(p);
 }
 
+void StratifiedSampler::GenerateDimension1D(int dim) {
+    StratifiedSample1D(&samples1D[dim][0], xPixelSamples * yPixelSamples, rng,
+                       jitterSamples);
+    Shuffle(&samples1D[dim][0], xPixelSamples * yPixelSamples, 1, rng);
+}
+
+void StratifiedSampler::GenerateDimension2D(int dim) {
+    StratifiedSample2D(&samples2D[dim][0], xPixelSamples, yPixelSamples, rng,
+                       jitterSamples);
+    Shuffle(&samples2D[dim][0], xPixelSamples * yPixelSamples, 1, rng);
+}
+
 std::unique_ptr<Sampler> StratifiedSampler::Clone(int seed) {
     StratifiedSampler *ss = new StratifiedSampler(*this);
     ss->rng.SetSequence(seed);
@@ -82,7 +85,11 @@ StratifiedSampler *CreateStratifiedSampler(const ParamSet &params) {
     int ysamp = params.FindOneInt("ysamples", 4);
     int sd = params.FindOneInt("dimensions", 4);
     if (PbrtOptions.quickRender) xsamp = ysamp = 1;
-    return new StratifiedSampler(xsamp, ysamp, jitter, sd);
+    // Benchmark mode renders a fixed number of samples per pixel so the
+    // workload is comparable across scenes and builds.
+    if (PbrtOptions.benchmark) xsamp = ysamp = 4;
+    bool pad = params.FindOneBool("paddimensions", false);
+    return new StratifiedSampler(xsamp, ysamp, jitter, sd, pad);
 }
 
 }  // namespace pbrt
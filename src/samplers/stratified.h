@@ -49,14 +49,20 @@ class StratifiedSampler : public PixelSampler {
   public:
     // StratifiedSampler Public Methods
     StratifiedSampler(int xPixelSamples, int yPixelSamples, bool jitterSamples,
-                      int nSampledDimensions)
-        : PixelSampler(xPixelSamples * yPixelSamples, nSampledDimensions),
+                      int nSampledDimensions, bool padDimensions = false)
+        : PixelSampler(xPixelSamples * yPixelSamples, nSampledDimensions,
+                       padDimensions),
           xPixelSamples(xPixelSamples),
           yPixelSamples(yPixelSamples),
           jitterSamples(jitterSamples) {}
     void StartPixel(const Point2i &);
     std::unique_ptr<Sampler> Clone(int seed);
 
+  protected:
+    // StratifiedSampler Protected Methods
+    void GenerateDimension1D(int dim);
+    void GenerateDimension2D(int dim);
+
   private:
     // StratifiedSampler Private Data
     const int xPixelSamples, yPixelSamples;
@@ -41,8 +41,10 @@ namespace pbrt {
 
 // ZeroTwoSequenceSampler Method Definitions
 ZeroTwoSequenceSampler::ZeroTwoSequenceSampler(int64_t samplesPerPixel,
-                                               int nSampledDimensions)
-    : PixelSampler(RoundUpPow2(samplesPerPixel), nSampledDimensions) {
+                                               int nSampledDimensions,
+                                               bool padDimensions)
+    : PixelSampler(RoundUpPow2(samplesPerPixel), nSampledDimensions,
+                   padDimensions) {
     if (!IsPowerOf2(samplesPerPixel))
         Warning(
             "Pixel samples being rounded up to power of 2 "
@@ -52,11 +54,8 @@ ZeroTwoSequenceSampler::ZeroTwoSequenceSampler(int64_t samplesPerPixel,
 
 void ZeroTwoSequenceSampler::StartPixel(const Point2i &p) {
     ProfilePhase _(Prof::StartPixel);
-    // Generate 1D and 2D pixel sample components using $(0,2)$-sequence
-    for (size_t i = 0; i < samples1D.size(); ++i)
-        VanDerCorput(1, samplesPerPixel, &samples1D[i][0], rng);
-    for (size_t i = 0; i < samples2D.size(); ++i)
-        Sobol2D(1, samplesPerPixel, &samples2D[i][0], rng);
+    // 1D and 2D pixel sample components are generated per dimension on
+    // first use; see _GenerateDimension1D()_ below.
 
     // Generate 1D and 2D array samples using $(0,2)$-sequence
     for (size_t i = 0; i < samples1DArraySizes.size(); ++i)
@@ -68,6 +67,14 @@ void ZeroTwoSequenceSampler::StartPixel(const Point2i &p) {
     PixelSampler::StartPixel(p);
 }
 
+void ZeroTwoSequenceSampler::GenerateDimension1D(int dim) {
+    VanDerCorput(1, samplesPerPixel, &samples1D[dim][0], rng);
+}
+
+void ZeroTwoSequenceSampler::GenerateDimension2D(int dim) {
+    Sobol2D(1, samplesPerPixel, &samples2D[dim][0], rng);
+}
+
 std::unique_ptr<Sampler> ZeroTwoSequenceSampler::Clone(int seed) {
     ZeroTwoSequenceSampler *lds = new ZeroTwoSequenceSampler(*this);
     lds->rng.SetSequence(seed);
@@ -78,7 +85,11 @@ ZeroTwoSequenceSampler *CreateZeroTwoSequenceSampler(const ParamSet &params) {
     int nsamp = params.FindOneInt("pixelsamples", 16);
     int sd = params.FindOneInt("dimensions", 4);
     if (PbrtOptions.quickRender) nsamp = 1;
-    return new ZeroTwoSequenceSampler(nsamp, sd);
+    // Benchmark mode renders a fixed number of samples per pixel so the
+    // workload is comparable across scenes and builds.
+    if (PbrtOptions.benchmark) nsamp = 16;
+    bool pad = params.FindOneBool("paddimensions", false);
+    return new ZeroTwoSequenceSampler(nsamp, sd, pad);
 }
 
 }  // namespace pbrt
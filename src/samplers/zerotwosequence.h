@@ -47,10 +47,16 @@ namespace pbrt {
 class ZeroTwoSequenceSampler : public PixelSampler {
   public:
     // ZeroTwoSequenceSampler Public Methods
-    ZeroTwoSequenceSampler(int64_t samplesPerPixel, int nSampledDimensions = 4);
+    ZeroTwoSequenceSampler(int64_t samplesPerPixel, int nSampledDimensions = 4,
+                           bool padDimensions = false);
     void StartPixel(const Point2i &);
     std::unique_ptr<Sampler> Clone(int seed);
     int RoundCount(int count) const { return RoundUpPow2(count); }
+
+  protected:
+    // ZeroTwoSequenceSampler Protected Methods
+    void GenerateDimension1D(int dim);
+    void GenerateDimension2D(int dim);
 };
 
 ZeroTwoSequenceSampler *CreateZeroTwoSequenceSampler(const ParamSet &params);
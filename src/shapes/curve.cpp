@@ -36,6 +36,11 @@
 #include "paramset.h"
 #include "stats.h"
 
+#if defined(__AVX2__) && !defined(PBRT_FLOAT_AS_DOUBLE)
+#include <immintrin.h>
+#define PBRT_CURVE_HAVE_AVX2
+#endif
+
 namespace pbrt {
 
 STAT_MEMORY_COUNTER("Memory/Curves", curveBytes);
@@ -62,6 +67,57 @@ inline void SubdivideBezier(const Point3f cp[4], Point3f cpSplit[7]) {
     cpSplit[6] = cp[3];
 }
 
+// Writes the control points of the 2^depth segments that uniformly
+// subdividing _cp_ _depth_ times produces to _out_, which must have room
+// for 3 * 2^depth + 1 points; adjacent segments share their endpoints.
+static void SubdivideBezierFlat(const Point3f cp[4], Point3f *out, int depth) {
+    if (depth == 0) {
+        for (int i = 0; i < 4; ++i) out[i] = cp[i];
+    } else {
+        Point3f cpSplit[7];
+        SubdivideBezier(cp, cpSplit);
+        SubdivideBezierFlat(cpSplit, out, depth - 1);
+        SubdivideBezierFlat(cpSplit + 3, out + 3 * (1 << (depth - 1)),
+                            depth - 1);
+    }
+}
+
+// Returns the number of recursive subdivisions after which the linear
+// segment approximation error falls below 1/20th of the curve width; the
+// projection to the per-ray coordinate system is rigid, so this can be
+// evaluated once from the object-space control points at creation rather
+// than per ray. (The max-per-axis second difference below isn't exactly
+// rotation invariant, but is within a constant factor, which the
+// conservative eps absorbs.)
+static int CurveRefinementDepth(const Point3f cp[4], Float width0,
+                                Float width1) {
+    Float L0 = 0;
+    for (int i = 0; i < 2; ++i)
+        L0 = std::max(
+            L0, std::max(
+                    std::max(std::abs(cp[i].x - 2 * cp[i + 1].x + cp[i + 2].x),
+                             std::abs(cp[i].y - 2 * cp[i + 1].y + cp[i + 2].y)),
+                    std::abs(cp[i].z - 2 * cp[i + 1].z + cp[i + 2].z)));
+
+    Float eps = std::max(width0, width1) * .05f;  // width / 20
+    auto Log2 = [](float v) -> int {
+        if (v < 1) return 0;
+        uint32_t bits = FloatToBits(v);
+        // https://graphics.stanford.edu/~seander/bithacks.html#IntegerLog
+        // (With an additional add so get round-to-nearest rather than
+        // round down.)
+        return (bits >> 23) - 127 + (bits & (1 << 22) ? 1 : 0);
+    };
+    // Compute log base 4 by dividing log2 in half.
+    int r0 = Log2(1.41421356237f * 6.f * L0 / (8.f * eps)) / 2;
+    return Clamp(r0, 0, 10);
+}
+
+// Cap on the depth of the flattened subdivision cache below each Curve
+// segment, bounding its memory and the per-ray transform work; segments
+// that want finer refinement recurse below the cached leaves.
+static PBRT_CONSTEXPR int maxSegCacheDepth = 5;
+
 static Point3f EvalBezier(const Point3f cp[4], Float u,
                           Vector3f *deriv = nullptr) {
     Point3f cp1[3] = {Lerp(u, cp[0], cp[1]), Lerp(u, cp[1], cp[2]),
@@ -100,6 +156,27 @@ CurveCommon::CurveCommon(const Point3f c[4], Float width0, Float width1,
     ++nCurves;
 }
 
+Curve::Curve(const Transform *ObjectToWorld, const Transform *WorldToObject,
+             bool reverseOrientation, const std::shared_ptr<CurveCommon> &common,
+             Float uMin, Float uMax, int segIndex)
+    : Shape(ObjectToWorld, WorldToObject, reverseOrientation),
+      common(common),
+      uMin(uMin),
+      uMax(uMax),
+      segIndex(segIndex) {
+    // Compute object-space control points for curve segment, _cpObjSeg_
+    cpObjSeg[0] = BlossomBezier(common->cpObj, uMin, uMin, uMin);
+    cpObjSeg[1] = BlossomBezier(common->cpObj, uMin, uMin, uMax);
+    cpObjSeg[2] = BlossomBezier(common->cpObj, uMin, uMax, uMax);
+    cpObjSeg[3] = BlossomBezier(common->cpObj, uMax, uMax, uMax);
+
+    // Precompute refinement depth and the recursion left below the leaves
+    // of the shared subdivision cache
+    maxDepth =
+        CurveRefinementDepth(cpObjSeg, common->width[0], common->width[1]);
+    restDepth = std::max(0, maxDepth - common->segCacheDepth);
+}
+
 std::vector<std::shared_ptr<Shape>> CreateCurve(
     const Transform *o2w, const Transform *w2o, bool reverseOrientation,
     const Point3f *c, Float w0, Float w1, CurveType type,
@@ -108,25 +185,56 @@ std::vector<std::shared_ptr<Shape>> CreateCurve(
     std::shared_ptr<CurveCommon> common =
         std::make_shared<CurveCommon>(c, w0, w1, type, norm);
     const int nSegments = 1 << splitDepth;
+
+    // Build the flattened subdivision cache shared by this curve's
+    // segments. Using the coarsest refinement depth any segment wants (and
+    // letting segments that want more recurse below the cached leaves via
+    // _restDepth_) reproduces exactly the segments the recursive
+    // subdivision would test.
+    int segCacheDepth = maxSegCacheDepth;
+    for (int i = 0; i < nSegments; ++i) {
+        Float uMin = i / (Float)nSegments, uMax = (i + 1) / (Float)nSegments;
+        Point3f cpSeg[4] = {BlossomBezier(common->cpObj, uMin, uMin, uMin),
+                            BlossomBezier(common->cpObj, uMin, uMin, uMax),
+                            BlossomBezier(common->cpObj, uMin, uMax, uMax),
+                            BlossomBezier(common->cpObj, uMax, uMax, uMax)};
+        segCacheDepth = std::min(
+            segCacheDepth,
+            CurveRefinementDepth(cpSeg, common->width[0], common->width[1]));
+    }
+    common->segCacheDepth = segCacheDepth;
+    if (segCacheDepth > 0) {
+        int leavesPerSegment = 1 << segCacheDepth;
+        common->leafCpObj.resize(3 * nSegments * leavesPerSegment + 1);
+        for (int i = 0; i < nSegments; ++i) {
+            Float uMin = i / (Float)nSegments,
+                  uMax = (i + 1) / (Float)nSegments;
+            Point3f cpSeg[4] = {BlossomBezier(common->cpObj, uMin, uMin, uMin),
+                                BlossomBezier(common->cpObj, uMin, uMin, uMax),
+                                BlossomBezier(common->cpObj, uMin, uMax, uMax),
+                                BlossomBezier(common->cpObj, uMax, uMax, uMax)};
+            SubdivideBezierFlat(cpSeg,
+                                &common->leafCpObj[3 * i * leavesPerSegment],
+                                segCacheDepth);
+        }
+    }
+
     segments.reserve(nSegments);
     for (int i = 0; i < nSegments; ++i) {
         Float uMin = i / (Float)nSegments;
         Float uMax = (i + 1) / (Float)nSegments;
         segments.push_back(std::make_shared<Curve>(o2w, w2o, reverseOrientation,
-                                                   common, uMin, uMax));
+                                                   common, uMin, uMax, i));
         ++nSplitCurves;
     }
-    curveBytes += sizeof(CurveCommon) + nSegments * sizeof(Curve);
+    curveBytes += sizeof(CurveCommon) + nSegments * sizeof(Curve) +
+                  common->leafCpObj.size() * sizeof(Point3f);
     return segments;
 }
 
 Bounds3f Curve::ObjectBound() const {
-    // Compute object-space control points for curve segment, _cpObj_
-    Point3f cpObj[4];
-    cpObj[0] = BlossomBezier(common->cpObj, uMin, uMin, uMin);
-    cpObj[1] = BlossomBezier(common->cpObj, uMin, uMin, uMax);
-    cpObj[2] = BlossomBezier(common->cpObj, uMin, uMax, uMax);
-    cpObj[3] = BlossomBezier(common->cpObj, uMax, uMax, uMax);
+    // Use object-space control points for curve segment, _cpObjSeg_
+    const Point3f *cpObj = cpObjSeg;
     Bounds3f b =
         Union(Bounds3f(cpObj[0], cpObj[1]), Bounds3f(cpObj[2], cpObj[3]));
     Float width[2] = {Lerp(uMin, common->width[0], common->width[1]),
@@ -142,12 +250,8 @@ bool Curve::Intersect(const Ray &r, Float *tHit, SurfaceInteraction *isect,
     Vector3f oErr, dErr;
     Ray ray = (*WorldToObject)(r, &oErr, &dErr);
 
-    // Compute object-space control points for curve segment, _cpObj_
-    Point3f cpObj[4];
-    cpObj[0] = BlossomBezier(common->cpObj, uMin, uMin, uMin);
-    cpObj[1] = BlossomBezier(common->cpObj, uMin, uMin, uMax);
-    cpObj[2] = BlossomBezier(common->cpObj, uMin, uMax, uMax);
-    cpObj[3] = BlossomBezier(common->cpObj, uMax, uMax, uMax);
+    // Use object-space control points for curve segment, _cpObjSeg_
+    const Point3f *cpObj = cpObjSeg;
 
     // Project curve control points to plane perpendicular to ray
 
@@ -201,32 +305,113 @@ bool Curve::Intersect(const Ray &r, Float *tHit, SurfaceInteraction *isect,
             0.5f * maxWidth > zMax)
         return false;
 
-    // Compute refinement depth for curve, _maxDepth_
-    Float L0 = 0;
-    for (int i = 0; i < 2; ++i)
-        L0 = std::max(
-            L0, std::max(
-                    std::max(std::abs(cp[i].x - 2 * cp[i + 1].x + cp[i + 2].x),
-                             std::abs(cp[i].y - 2 * cp[i + 1].y + cp[i + 2].y)),
-                    std::abs(cp[i].z - 2 * cp[i + 1].z + cp[i + 2].z)));
-
-    Float eps =
-        std::max(common->width[0], common->width[1]) * .05f;  // width / 20
-    auto Log2 = [](float v) -> int {
-        if (v < 1) return 0;
-        uint32_t bits = FloatToBits(v);
-        // https://graphics.stanford.edu/~seander/bithacks.html#IntegerLog
-        // (With an additional add so get round-to-nearest rather than
-        // round down.)
-        return (bits >> 23) - 127 + (bits & (1 << 22) ? 1 : 0);
-    };
-    // Compute log base 4 by dividing log2 in half.
-    int r0 = Log2(1.41421356237f * 6.f * L0 / (8.f * eps)) / 2;
-    int maxDepth = Clamp(r0, 0, 10);
     ReportValue(refinementLevel, maxDepth);
 
-    return recursiveIntersect(ray, tHit, isect, cp, Inverse(objectToRay), uMin,
-                              uMax, maxDepth);
+    // If there is no subdivision cache to draw from (or no subdivision is
+    // needed at all), fall back to per-ray recursive subdivision
+    if (common->segCacheDepth == 0 || maxDepth == 0)
+        return recursiveIntersect(ray, tHit, isect, cp, Inverse(objectToRay),
+                                  uMin, uMax, maxDepth);
+
+    // Transform this segment's slice of the cached subdivision to the ray
+    // coordinate system. The leaves are exactly the segments that
+    // _maxDepth_ levels of the recursion above would produce (modulo
+    // rounding--subdivision and the rigid projection commute), so the
+    // recursion is replaced by a flat sweep over the leaf bounds.
+    int nLeaf = 1 << common->segCacheDepth;
+    int nPts = 3 * nLeaf + 1;
+    const Point3f *cpCache = &common->leafCpObj[3 * segIndex * nLeaf];
+    Float x[3 * (1 << maxSegCacheDepth) + 1], y[3 * (1 << maxSegCacheDepth) + 1],
+        z[3 * (1 << maxSegCacheDepth) + 1];
+    for (int i = 0; i < nPts; ++i) {
+        Point3f p = objectToRay(cpCache[i]);
+        x[i] = p.x;
+        y[i] = p.y;
+        z[i] = p.z;
+    }
+
+    // Compute per-leaf conservative half-widths
+    Float halfWidth[1 << maxSegCacheDepth];
+    for (int s = 0; s < nLeaf; ++s) {
+        Float us0 = Lerp(s / (Float)nLeaf, uMin, uMax);
+        Float us1 = Lerp((s + 1) / (Float)nLeaf, uMin, uMax);
+        halfWidth[s] =
+            0.5f * std::max(Lerp(us0, common->width[0], common->width[1]),
+                            Lerp(us1, common->width[0], common->width[1]));
+    }
+
+    // Cull leaves whose bounds can't overlap the ray, as in
+    // recursiveIntersect(); the convex hull property makes leaf-level
+    // culling admit exactly the leaves the per-level recursive tests would
+    uint32_t keep = 0;
+    int s = 0;
+#if defined(PBRT_CURVE_HAVE_AVX2)
+    if (nLeaf >= 8) {
+        // Test eight consecutive leaves at a time, gathering each leaf's
+        // four control points from the transformed SoA arrays
+        __m256i base = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+        __m256 zero = _mm256_setzero_ps();
+        __m256 zMaxv = _mm256_set1_ps(zMax);
+        for (; s + 8 <= nLeaf; s += 8) {
+            __m256i idx = _mm256_add_epi32(base, _mm256_set1_epi32(3 * s));
+            __m256 hw = _mm256_loadu_ps(halfWidth + s);
+            __m256 keepv = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+            for (int axis = 0; axis < 3; ++axis) {
+                const Float *c = (axis == 0) ? y : (axis == 1) ? x : z;
+                __m256 c0 = _mm256_i32gather_ps(c, idx, 4);
+                __m256 c1 = _mm256_i32gather_ps(c + 1, idx, 4);
+                __m256 c2 = _mm256_i32gather_ps(c + 2, idx, 4);
+                __m256 c3 = _mm256_i32gather_ps(c + 3, idx, 4);
+                __m256 cMin = _mm256_min_ps(_mm256_min_ps(c0, c1),
+                                            _mm256_min_ps(c2, c3));
+                __m256 cMax = _mm256_max_ps(_mm256_max_ps(c0, c1),
+                                            _mm256_max_ps(c2, c3));
+                __m256 hi = (axis == 2) ? zMaxv : zero;
+                keepv = _mm256_and_ps(
+                    keepv,
+                    _mm256_and_ps(
+                        _mm256_cmp_ps(_mm256_add_ps(cMax, hw), zero,
+                                      _CMP_GE_OQ),
+                        _mm256_cmp_ps(_mm256_sub_ps(cMin, hw), hi,
+                                      _CMP_LE_OQ)));
+            }
+            keep |= (uint32_t)_mm256_movemask_ps(keepv) << s;
+        }
+    }
+#endif  // PBRT_CURVE_HAVE_AVX2
+    for (; s < nLeaf; ++s) {
+        const Float *axes[3] = {y, x, z};
+        bool ok = true;
+        for (int axis = 0; axis < 3 && ok; ++axis) {
+            const Float *c = axes[axis] + 3 * s;
+            Float cMin = std::min(std::min(c[0], c[1]), std::min(c[2], c[3]));
+            Float cMax = std::max(std::max(c[0], c[1]), std::max(c[2], c[3]));
+            Float hi = (axis == 2) ? zMax : 0;
+            ok = cMax + halfWidth[s] >= 0 && cMin - halfWidth[s] <= hi;
+        }
+        if (ok) keep |= 1u << s;
+    }
+    if (keep == 0) return false;
+
+    // Run the leaf intersection test (continuing the subdivision when the
+    // cache is shallower than _maxDepth_) on the surviving leaves
+    Transform rayToObject = Inverse(objectToRay);
+    bool hit = false;
+    for (int s = 0; s < nLeaf; ++s) {
+        if (!(keep & (1u << s))) continue;
+        Point3f cps[4] = {Point3f(x[3 * s], y[3 * s], z[3 * s]),
+                          Point3f(x[3 * s + 1], y[3 * s + 1], z[3 * s + 1]),
+                          Point3f(x[3 * s + 2], y[3 * s + 2], z[3 * s + 2]),
+                          Point3f(x[3 * s + 3], y[3 * s + 3], z[3 * s + 3])};
+        hit |= recursiveIntersect(ray, tHit, isect, cps, rayToObject,
+                                  Lerp(s / (Float)nLeaf, uMin, uMax),
+                                  Lerp((s + 1) / (Float)nLeaf, uMin, uMax),
+                                  restDepth);
+        // If we found an intersection and this is a shadow ray, we can
+        // exit out immediately.
+        if (hit && !tHit) return true;
+    }
+    return hit;
 }
 
 bool Curve::recursiveIntersect(const Ray &ray, Float *tHit,
@@ -374,12 +559,8 @@ bool Curve::recursiveIntersect(const Ray &ray, Float *tHit,
 }
 
 Float Curve::Area() const {
-    // Compute object-space control points for curve segment, _cpObj_
-    Point3f cpObj[4];
-    cpObj[0] = BlossomBezier(common->cpObj, uMin, uMin, uMin);
-    cpObj[1] = BlossomBezier(common->cpObj, uMin, uMin, uMax);
-    cpObj[2] = BlossomBezier(common->cpObj, uMin, uMax, uMax);
-    cpObj[3] = BlossomBezier(common->cpObj, uMax, uMax, uMax);
+    // Use object-space control points for curve segment, _cpObjSeg_
+    const Point3f *cpObj = cpObjSeg;
     Float width0 = Lerp(uMin, common->width[0], common->width[1]);
     Float width1 = Lerp(uMax, common->width[0], common->width[1]);
     Float avgWidth = (width0 + width1) * 0.5f;
@@ -56,6 +56,17 @@ struct CurveCommon {
     Float width[2];
     Normal3f n[2];
     Float normalAngle, invSinNormalAngle;
+    // Flattened subdivision cache, built once in CreateCurve() and shared
+    // read-only by all the Curve shapes split from this curve: the
+    // object-space control points of the Bezier segments obtained by
+    // uniformly subdividing each Curve _segCacheDepth_ more times. The
+    // four control points of leaf _s_ are _leafCpObj[3 * s]_ through
+    // _leafCpObj[3 * s + 3]_; adjacent leaves share their endpoints.
+    // Because the per-ray projection to the ray coordinate system is
+    // rigid, these can be transformed per ray in place of re-running the
+    // recursive subdivision that would produce the same segments.
+    int segCacheDepth = 0;
+    std::vector<Point3f> leafCpObj;
 };
 
 // Curve Declarations
@@ -64,11 +75,7 @@ class Curve : public Shape {
     // Curve Public Methods
     Curve(const Transform *ObjectToWorld, const Transform *WorldToObject,
           bool reverseOrientation, const std::shared_ptr<CurveCommon> &common,
-          Float uMin, Float uMax)
-        : Shape(ObjectToWorld, WorldToObject, reverseOrientation),
-          common(common),
-          uMin(uMin),
-          uMax(uMax) {}
+          Float uMin, Float uMax, int segIndex = 0);
     Bounds3f ObjectBound() const;
     bool Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
                    bool testAlphaTexture) const;
@@ -85,6 +92,15 @@ class Curve : public Shape {
     // Curve Private Data
     const std::shared_ptr<CurveCommon> common;
     const Float uMin, uMax;
+    // Blossomed control points for [uMin, uMax], cached at creation
+    Point3f cpObjSeg[4];
+    // Index of this segment among its curve's 2^splitdepth pieces, used to
+    // locate its slice of the shared subdivision cache
+    const int segIndex;
+    // Refinement depth for this segment and the depth remaining below the
+    // cached leaves, both precomputed at creation; see the discussion in
+    // Curve::Intersect()
+    int maxDepth, restDepth;
 };
 
 std::vector<std::shared_ptr<Shape>> CreateCurveShape(const Transform *o2w,
@@ -37,8 +37,79 @@
 #include "efloat.h"
 #include "stats.h"
 
+// The batched occlusion kernel below culls definite misses eight rays at
+// a time with conservative float arithmetic; survivors fall back to the
+// exact single-ray EFloat test.
+#if defined(__AVX__) && !defined(PBRT_FLOAT_AS_DOUBLE)
+#include <immintrin.h>
+#define PBRT_QUADRIC_HAVE_AVX
+#endif
+
 namespace pbrt {
 
+STAT_PERCENT("Intersections/Quadric exact EFloat solves", nEFloatQuadrics,
+             nQuadricSolves);
+
+// Solve the cylinder quadratic for the object-space _ray_; see the
+// corresponding SphereQuadratic() for the dual-kernel scheme.  A fast
+// non-conservative float solve is tried first and the exact _EFloat_
+// arithmetic is only used when the fast result is within its error slop
+// of the discriminant's sign or of a $(0, \mathit{tMax})$ boundary.
+static bool CylinderQuadratic(const Ray &ray, const Vector3f &oErr,
+                              const Vector3f &dErr, Float radius, Float *t0,
+                              Float *t1, bool *t0Pos, bool *t0BelowMax,
+                              bool *t1Pos, bool *t1BelowMax) {
+    ++nQuadricSolves;
+    Float ox = ray.o.x, oy = ray.o.y;
+    Float dx = ray.d.x, dy = ray.d.y;
+    Float a = dx * dx + dy * dy;
+    Float b = 2 * (dx * ox + dy * oy);
+    Float c = ox * ox + oy * oy - radius * radius;
+
+    // Bound the coefficients' absolute error: the transform's returned
+    // per-component bounds propagated through the products, plus a
+    // generous relative term for the rounding of the sums themselves
+    const Float qEps = 1e-4f;
+    Float aErr = 2 * (std::abs(dx) * dErr.x + std::abs(dy) * dErr.y) + qEps * a;
+    Float bErr = 2 * (std::abs(dx) * oErr.x + std::abs(ox) * dErr.x +
+                      std::abs(dy) * oErr.y + std::abs(oy) * dErr.y) +
+                 qEps * 2 * (std::abs(dx * ox) + std::abs(dy * oy));
+    Float cErr = 2 * (std::abs(ox) * oErr.x + std::abs(oy) * oErr.y) +
+                 qEps * (ox * ox + oy * oy + radius * radius);
+
+    // Accept the fast solve if every consulted comparison is definitive
+    bool hasRoots;
+    Float tSlop;
+    if (QuadraticFast(a, b, c, aErr, bErr, cErr, &hasRoots, t0, t1, &tSlop)) {
+        if (!hasRoots) return false;
+        if (std::abs(*t0) > tSlop && std::abs(*t0 - ray.tMax) > tSlop &&
+            std::abs(*t1) > tSlop && std::abs(*t1 - ray.tMax) > tSlop) {
+            *t0Pos = *t0 > 0;
+            *t0BelowMax = *t0 < ray.tMax;
+            *t1Pos = *t1 > 0;
+            *t1BelowMax = *t1 < ray.tMax;
+            return true;
+        }
+    }
+
+    // Fall back to the conservative _EFloat_ solve
+    ++nEFloatQuadrics;
+    EFloat eox(ox, oErr.x), eoy(oy, oErr.y);
+    EFloat edx(dx, dErr.x), edy(dy, dErr.y);
+    EFloat ea = edx * edx + edy * edy;
+    EFloat eb = 2 * (edx * eox + edy * eoy);
+    EFloat ec = eox * eox + eoy * eoy - EFloat(radius) * EFloat(radius);
+    EFloat et0, et1;
+    if (!Quadratic(ea, eb, ec, &et0, &et1)) return false;
+    *t0 = (Float)et0;
+    *t1 = (Float)et1;
+    *t0Pos = et0.LowerBound() > 0;
+    *t0BelowMax = !(et0.UpperBound() > ray.tMax);
+    *t1Pos = et1.LowerBound() > 0;
+    *t1BelowMax = !(et1.UpperBound() > ray.tMax);
+    return true;
+}
+
 // Cylinder Method Definitions
 Bounds3f Cylinder::ObjectBound() const {
     return Bounds3f(Point3f(-radius, -radius, zMin),
@@ -54,29 +125,23 @@ bool Cylinder::Intersect(const Ray &r, Float *tHit, SurfaceInteraction *isect,
     Vector3f oErr, dErr;
     Ray ray = (*WorldToObject)(r, &oErr, &dErr);
 
-    // Compute quadratic cylinder coefficients
-
-    // Initialize _EFloat_ ray coordinate values
-    EFloat ox(ray.o.x, oErr.x), oy(ray.o.y, oErr.y), oz(ray.o.z, oErr.z);
-    EFloat dx(ray.d.x, dErr.x), dy(ray.d.y, dErr.y), dz(ray.d.z, dErr.z);
-    EFloat a = dx * dx + dy * dy;
-    EFloat b = 2 * (dx * ox + dy * oy);
-    EFloat c = ox * ox + oy * oy - EFloat(radius) * EFloat(radius);
-
     // Solve quadratic equation for _t_ values
-    EFloat t0, t1;
-    if (!Quadratic(a, b, c, &t0, &t1)) return false;
+    Float t0, t1;
+    bool t0Pos, t0BelowMax, t1Pos, t1BelowMax;
+    if (!CylinderQuadratic(ray, oErr, dErr, radius, &t0, &t1, &t0Pos,
+                           &t0BelowMax, &t1Pos, &t1BelowMax))
+        return false;
 
     // Check quadric shape _t0_ and _t1_ for nearest intersection
-    if (t0.UpperBound() > ray.tMax || t1.LowerBound() <= 0) return false;
-    EFloat tShapeHit = t0;
-    if (tShapeHit.LowerBound() <= 0) {
+    if (!t0BelowMax || !t1Pos) return false;
+    Float tShapeHit = t0;
+    if (!t0Pos) {
         tShapeHit = t1;
-        if (tShapeHit.UpperBound() > ray.tMax) return false;
+        if (!t1BelowMax) return false;
     }
 
     // Compute cylinder hit point and $\phi$
-    pHit = ray((Float)tShapeHit);
+    pHit = ray(tShapeHit);
 
     // Refine cylinder intersection point
     Float hitRad = std::sqrt(pHit.x * pHit.x + pHit.y * pHit.y);
@@ -89,9 +154,9 @@ bool Cylinder::Intersect(const Ray &r, Float *tHit, SurfaceInteraction *isect,
     if (pHit.z < zMin || pHit.z > zMax || phi > phiMax) {
         if (tShapeHit == t1) return false;
         tShapeHit = t1;
-        if (t1.UpperBound() > ray.tMax) return false;
+        if (!t1BelowMax) return false;
         // Compute cylinder hit point and $\phi$
-        pHit = ray((Float)tShapeHit);
+        pHit = ray(tShapeHit);
 
         // Refine cylinder intersection point
         Float hitRad = std::sqrt(pHit.x * pHit.x + pHit.y * pHit.y);
@@ -139,7 +204,7 @@ bool Cylinder::Intersect(const Ray &r, Float *tHit, SurfaceInteraction *isect,
                                                  ray.time, this));
 
     // Update _tHit_ for quadric intersection
-    *tHit = (Float)tShapeHit;
+    *tHit = tShapeHit;
     return true;
 }
 
@@ -151,29 +216,23 @@ bool Cylinder::IntersectP(const Ray &r, bool testAlphaTexture) const {
     Vector3f oErr, dErr;
     Ray ray = (*WorldToObject)(r, &oErr, &dErr);
 
-    // Compute quadratic cylinder coefficients
-
-    // Initialize _EFloat_ ray coordinate values
-    EFloat ox(ray.o.x, oErr.x), oy(ray.o.y, oErr.y), oz(ray.o.z, oErr.z);
-    EFloat dx(ray.d.x, dErr.x), dy(ray.d.y, dErr.y), dz(ray.d.z, dErr.z);
-    EFloat a = dx * dx + dy * dy;
-    EFloat b = 2 * (dx * ox + dy * oy);
-    EFloat c = ox * ox + oy * oy - EFloat(radius) * EFloat(radius);
-
     // Solve quadratic equation for _t_ values
-    EFloat t0, t1;
-    if (!Quadratic(a, b, c, &t0, &t1)) return false;
+    Float t0, t1;
+    bool t0Pos, t0BelowMax, t1Pos, t1BelowMax;
+    if (!CylinderQuadratic(ray, oErr, dErr, radius, &t0, &t1, &t0Pos,
+                           &t0BelowMax, &t1Pos, &t1BelowMax))
+        return false;
 
     // Check quadric shape _t0_ and _t1_ for nearest intersection
-    if (t0.UpperBound() > ray.tMax || t1.LowerBound() <= 0) return false;
-    EFloat tShapeHit = t0;
-    if (tShapeHit.LowerBound() <= 0) {
+    if (!t0BelowMax || !t1Pos) return false;
+    Float tShapeHit = t0;
+    if (!t0Pos) {
         tShapeHit = t1;
-        if (tShapeHit.UpperBound() > ray.tMax) return false;
+        if (!t1BelowMax) return false;
     }
 
     // Compute cylinder hit point and $\phi$
-    pHit = ray((Float)tShapeHit);
+    pHit = ray(tShapeHit);
 
     // Refine cylinder intersection point
     Float hitRad = std::sqrt(pHit.x * pHit.x + pHit.y * pHit.y);
@@ -186,9 +245,9 @@ bool Cylinder::IntersectP(const Ray &r, bool testAlphaTexture) const {
     if (pHit.z < zMin || pHit.z > zMax || phi > phiMax) {
         if (tShapeHit == t1) return false;
         tShapeHit = t1;
-        if (t1.UpperBound() > ray.tMax) return false;
+        if (!t1BelowMax) return false;
         // Compute cylinder hit point and $\phi$
-        pHit = ray((Float)tShapeHit);
+        pHit = ray(tShapeHit);
 
         // Refine cylinder intersection point
         Float hitRad = std::sqrt(pHit.x * pHit.x + pHit.y * pHit.y);
@@ -201,6 +260,99 @@ bool Cylinder::IntersectP(const Ray &r, bool testAlphaTexture) const {
     return true;
 }
 
+bool Cylinder::HasBatchedIntersectP() const {
+#ifdef PBRT_QUADRIC_HAVE_AVX
+    return true;
+#else
+    return false;
+#endif
+}
+
+void Cylinder::IntersectPN(const Ray *rays, int n, bool *hits,
+                           bool testAlphaTexture) const {
+#ifndef PBRT_QUADRIC_HAVE_AVX
+    Shape::IntersectPN(rays, n, hits, testAlphaTexture);
+#else
+    ProfilePhase p(Prof::ShapeIntersectP);
+    for (int base = 0; base < n; base += 8) {
+        int m = std::min(8, n - base);
+        // Transform the rays to object space, in SoA order; lanes past
+        // the end of the span repeat the first ray.
+        float ox[8], oy[8], oz[8], dx[8], dy[8], dz[8], tMax[8];
+        for (int k = 0; k < 8; ++k) {
+            Ray r = (*WorldToObject)(rays[base + (k < m ? k : 0)]);
+            ox[k] = r.o.x;
+            oy[k] = r.o.y;
+            oz[k] = r.o.z;
+            dx[k] = r.d.x;
+            dy[k] = r.d.y;
+            dz[k] = r.d.z;
+            tMax[k] = r.tMax;
+        }
+
+        // Conservative eight-wide cull on the $xy$ quadratic and the
+        // $z$ extent of the ray over $[0, \mono{tMax}]$. The slop terms
+        // bound the float rounding error by a wide margin, so any lane
+        // the exact EFloat test might accept survives to the single-ray
+        // IntersectP() call below.
+        __m256 oxv = _mm256_loadu_ps(ox), oyv = _mm256_loadu_ps(oy);
+        __m256 dxv = _mm256_loadu_ps(dx), dyv = _mm256_loadu_ps(dy);
+        __m256 av = _mm256_add_ps(_mm256_mul_ps(dxv, dxv),
+                                  _mm256_mul_ps(dyv, dyv));
+        __m256 bxv = _mm256_mul_ps(oxv, dxv), byv = _mm256_mul_ps(oyv, dyv);
+        __m256 bv = _mm256_mul_ps(_mm256_set1_ps(2.f),
+                                  _mm256_add_ps(bxv, byv));
+        __m256 oov = _mm256_add_ps(_mm256_mul_ps(oxv, oxv),
+                                   _mm256_mul_ps(oyv, oyv));
+        __m256 r2v = _mm256_set1_ps(radius * radius);
+        __m256 cv = _mm256_sub_ps(oov, r2v);
+        __m256 b2v = _mm256_mul_ps(bv, bv);
+        __m256 fourAC = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(4.f), av),
+                                      cv);
+        __m256 disc = _mm256_sub_ps(b2v, fourAC);
+        const __m256 eps = _mm256_set1_ps(1e-3f);
+        const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+        __m256 discSlop = _mm256_mul_ps(
+            eps, _mm256_add_ps(b2v, _mm256_and_ps(fourAC, absMask)));
+        __m256 missDisc = _mm256_cmp_ps(_mm256_add_ps(disc, discSlop),
+                                        _mm256_setzero_ps(), _CMP_LT_OQ);
+        // Clearly outside in $xy$ and receding: $b > 0$ and $c > 0$
+        // imply both roots are negative.
+        __m256 sumAbs = _mm256_add_ps(_mm256_and_ps(bxv, absMask),
+                                      _mm256_and_ps(byv, absMask));
+        __m256 missAway = _mm256_and_ps(
+            _mm256_cmp_ps(
+                bv,
+                _mm256_mul_ps(eps, _mm256_mul_ps(_mm256_set1_ps(2.f), sumAbs)),
+                _CMP_GT_OQ),
+            _mm256_cmp_ps(cv, _mm256_mul_ps(eps, _mm256_add_ps(oov, r2v)),
+                          _CMP_GT_OQ));
+        // The ray's $z$ extent over $[0, \mono{tMax}]$ clearly misses
+        // $[\mono{zMin}, \mono{zMax}]$. NaN lanes (e.g. infinite
+        // _tMax_ times zero direction) compare false and survive.
+        __m256 ozv = _mm256_loadu_ps(oz), dzv = _mm256_loadu_ps(dz);
+        __m256 zEnd = _mm256_add_ps(
+            ozv, _mm256_mul_ps(_mm256_loadu_ps(tMax), dzv));
+        __m256 zLo = _mm256_min_ps(ozv, zEnd), zHi = _mm256_max_ps(ozv, zEnd);
+        __m256 zSlop = _mm256_mul_ps(
+            eps, _mm256_add_ps(_mm256_max_ps(_mm256_and_ps(zLo, absMask),
+                                             _mm256_and_ps(zHi, absMask)),
+                               _mm256_set1_ps(std::abs(zMin) +
+                                              std::abs(zMax))));
+        __m256 missZ = _mm256_or_ps(
+            _mm256_cmp_ps(_mm256_sub_ps(zLo, zSlop), _mm256_set1_ps(zMax),
+                          _CMP_GT_OQ),
+            _mm256_cmp_ps(_mm256_add_ps(zHi, zSlop), _mm256_set1_ps(zMin),
+                          _CMP_LT_OQ));
+        int miss = _mm256_movemask_ps(
+            _mm256_or_ps(_mm256_or_ps(missDisc, missAway), missZ));
+        for (int k = 0; k < m; ++k)
+            hits[base + k] = !(miss & (1 << k)) &&
+                             IntersectP(rays[base + k], testAlphaTexture);
+    }
+#endif
+}
+
 Float Cylinder::Area() const { return (zMax - zMin) * radius * phiMax; }
 
 Interaction Cylinder::Sample(const Point2f &u, Float *pdf) const {
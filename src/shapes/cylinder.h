@@ -59,6 +59,9 @@ class Cylinder : public Shape {
     bool Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
                    bool testAlphaTexture) const;
     bool IntersectP(const Ray &ray, bool testAlphaTexture) const;
+    void IntersectPN(const Ray *rays, int n, bool *hits,
+                     bool testAlphaTexture = true) const;
+    bool HasBatchedIntersectP() const;
     Float Area() const;
     Interaction Sample(const Point2f &u, Float *pdf) const;
 
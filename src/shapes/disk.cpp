@@ -37,6 +37,14 @@
 #include "sampling.h"
 #include "stats.h"
 
+// The batched occlusion kernel below culls definite misses eight rays at
+// a time with conservative float arithmetic; survivors fall back to the
+// exact single-ray test.
+#if defined(__AVX__) && !defined(PBRT_FLOAT_AS_DOUBLE)
+#include <immintrin.h>
+#define PBRT_QUADRIC_HAVE_AVX
+#endif
+
 namespace pbrt {
 
 // Disk Method Definitions
@@ -121,6 +129,82 @@ bool Disk::IntersectP(const Ray &r, bool testAlphaTexture) const {
     return true;
 }
 
+bool Disk::HasBatchedIntersectP() const {
+#ifdef PBRT_QUADRIC_HAVE_AVX
+    return true;
+#else
+    return false;
+#endif
+}
+
+void Disk::IntersectPN(const Ray *rays, int n, bool *hits,
+                       bool testAlphaTexture) const {
+#ifndef PBRT_QUADRIC_HAVE_AVX
+    Shape::IntersectPN(rays, n, hits, testAlphaTexture);
+#else
+    ProfilePhase p(Prof::ShapeIntersectP);
+    for (int base = 0; base < n; base += 8) {
+        int m = std::min(8, n - base);
+        // Transform the rays to object space, in SoA order; lanes past
+        // the end of the span repeat the first ray.
+        float ox[8], oy[8], oz[8], dx[8], dy[8], dz[8], tMax[8];
+        for (int k = 0; k < 8; ++k) {
+            Ray r = (*WorldToObject)(rays[base + (k < m ? k : 0)]);
+            ox[k] = r.o.x;
+            oy[k] = r.o.y;
+            oz[k] = r.o.z;
+            dx[k] = r.d.x;
+            dy[k] = r.d.y;
+            dz[k] = r.d.z;
+            tMax[k] = r.tMax;
+        }
+
+        // Conservative eight-wide cull on the plane intersection and the
+        // radius window. The slop terms bound the float rounding error by
+        // a wide margin; any lane that might hit (including rays parallel
+        // to the plane, whose lanes evaluate to NaN and compare false)
+        // survives to the single-ray IntersectP() call below.
+        __m256 ozv = _mm256_loadu_ps(oz), dzv = _mm256_loadu_ps(dz);
+        __m256 invDz = _mm256_div_ps(_mm256_set1_ps(1.f), dzv);
+        __m256 num = _mm256_sub_ps(_mm256_set1_ps(height), ozv);
+        __m256 tv = _mm256_mul_ps(num, invDz);
+        const __m256 eps = _mm256_set1_ps(1e-3f);
+        const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+        __m256 tSlop = _mm256_mul_ps(
+            eps, _mm256_add_ps(
+                     _mm256_and_ps(tv, absMask),
+                     _mm256_mul_ps(
+                         _mm256_add_ps(_mm256_and_ps(ozv, absMask),
+                                       _mm256_set1_ps(std::abs(height))),
+                         _mm256_and_ps(invDz, absMask))));
+        __m256 missT = _mm256_or_ps(
+            _mm256_cmp_ps(_mm256_add_ps(tv, tSlop), _mm256_setzero_ps(),
+                          _CMP_LE_OQ),
+            _mm256_cmp_ps(_mm256_sub_ps(tv, tSlop), _mm256_loadu_ps(tMax),
+                          _CMP_GE_OQ));
+        // Hit point clearly outside the disk radii
+        __m256 oxv = _mm256_loadu_ps(ox), oyv = _mm256_loadu_ps(oy);
+        __m256 dxv = _mm256_loadu_ps(dx), dyv = _mm256_loadu_ps(dy);
+        __m256 px = _mm256_add_ps(oxv, _mm256_mul_ps(tv, dxv));
+        __m256 py = _mm256_add_ps(oyv, _mm256_mul_ps(tv, dyv));
+        __m256 dist2 = _mm256_add_ps(_mm256_mul_ps(px, px),
+                                     _mm256_mul_ps(py, py));
+        __m256 rSlop = _mm256_mul_ps(
+            eps, _mm256_add_ps(dist2, _mm256_set1_ps(radius * radius)));
+        __m256 missR = _mm256_or_ps(
+            _mm256_cmp_ps(_mm256_sub_ps(dist2, rSlop),
+                          _mm256_set1_ps(radius * radius), _CMP_GT_OQ),
+            _mm256_cmp_ps(_mm256_add_ps(dist2, rSlop),
+                          _mm256_set1_ps(innerRadius * innerRadius),
+                          _CMP_LT_OQ));
+        int miss = _mm256_movemask_ps(_mm256_or_ps(missT, missR));
+        for (int k = 0; k < m; ++k)
+            hits[base + k] = !(miss & (1 << k)) &&
+                             IntersectP(rays[base + k], testAlphaTexture);
+    }
+#endif
+}
+
 Float Disk::Area() const {
     return phiMax * 0.5 * (radius * radius - innerRadius * innerRadius);
 }
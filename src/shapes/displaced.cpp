@@ -0,0 +1,384 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+
+// shapes/displaced.cpp*
+#include "shapes/displaced.h"
+#include "shapes/triangle.h"
+#include "interaction.h"
+#include "paramset.h"
+#include "stats.h"
+#include "textures/constant.h"
+#include <list>
+#include <mutex>
+
+namespace pbrt {
+
+STAT_COUNTER("Scene/Displaced base triangles", nDisplacedTris);
+STAT_COUNTER("Intersections/Displacement dicings", nDisplacementDicings);
+STAT_MEMORY_COUNTER("Memory/Diced displacement cache", dicedCacheBytes);
+
+// DisplacedMesh Local Structures
+struct DicedGrid {
+    std::vector<std::shared_ptr<Shape>> tris;
+    size_t bytes;
+    std::list<int>::iterator lruIter;
+};
+
+// DisplacedMeshCommon holds the state shared by the DisplacedTriangle
+// shapes created for one mesh: the base mesh in object space, the
+// displacement function, and a bounded cache of diced micro-grids with
+// least-recently-used replacement. Base triangles are diced the first
+// time a ray reaches them, so the full displaced geometry is never
+// resident at once.
+struct DisplacedMeshCommon {
+    // Base mesh, in object space
+    std::vector<int> indices;
+    std::vector<Point3f> p;
+    std::vector<Normal3f> n;   // empty -> geometric normals
+    std::vector<Point2f> uv;   // empty -> (0,0),(1,0),(1,1) per triangle
+    std::shared_ptr<Texture<Float>> displacement;
+    Float scale, maxDisplacement;
+    int dicingRate;
+    const Transform *ObjectToWorld, *WorldToObject;
+    bool reverseOrientation;
+    // Dicing cache, indexed by base triangle and protected by _mutex_;
+    // _lru_ lists cached triangle indices, most recently used first.
+    size_t maxCacheBytes;
+    std::mutex mutex;
+    size_t cacheBytes = 0;
+    std::vector<std::shared_ptr<DicedGrid>> cache;
+    std::list<int> lru;
+};
+
+// DisplacedMesh Local Functions
+
+// Evaluates the displacement texture at a point on the base surface. The
+// texture sees the undisplaced world-space position, interpolated uv, and
+// shading normal; differentials are zero, so textures that filter over
+// ray footprints evaluate unfiltered.
+static Float EvalDisplacement(const DisplacedMeshCommon &common,
+                              const Point3f &pObj, const Normal3f &nObj,
+                              const Point2f &uv) {
+    SurfaceInteraction si;
+    si.p = (*common.ObjectToWorld)(pObj);
+    si.uv = uv;
+    si.n = si.shading.n = Normalize((*common.ObjectToWorld)(nObj));
+    return common.scale * common.displacement->Evaluate(si);
+}
+
+// Dices base triangle _triIndex_ into a micro-grid of
+// _common.dicingRate_^2 triangles, displacing each grid vertex along its
+// interpolated shading normal. Vertices on a shared edge depend only on
+// the edge's endpoint attributes and so match between the two adjacent
+// base triangles, keeping the diced mesh watertight when the base mesh
+// has per-vertex normals; without "N", neighboring triangles displace
+// along different geometric normals and cracks can appear.
+static std::vector<std::shared_ptr<Shape>> DiceTriangle(
+    DisplacedMeshCommon *common, int triIndex) {
+    const int *vi = &common->indices[3 * triIndex];
+    const Point3f p[3] = {common->p[vi[0]], common->p[vi[1]],
+                          common->p[vi[2]]};
+    Normal3f n[3];
+    if (!common->n.empty()) {
+        n[0] = common->n[vi[0]];
+        n[1] = common->n[vi[1]];
+        n[2] = common->n[vi[2]];
+    } else
+        n[0] = n[1] = n[2] = Normal3f(Cross(p[1] - p[0], p[2] - p[0]));
+    Point2f uv[3];
+    if (!common->uv.empty()) {
+        uv[0] = common->uv[vi[0]];
+        uv[1] = common->uv[vi[1]];
+        uv[2] = common->uv[vi[2]];
+    } else {
+        uv[0] = Point2f(0, 0);
+        uv[1] = Point2f(1, 0);
+        uv[2] = Point2f(1, 1);
+    }
+
+    // Generate displaced grid vertices at barycentric positions
+    // $(i/n, j/n)$; row $i$ holds vertices $j = 0 \ldots n - i$.
+    int nd = common->dicingRate;
+    std::vector<Point3f> pDiced;
+    std::vector<Point2f> uvDiced;
+    pDiced.reserve((nd + 1) * (nd + 2) / 2);
+    uvDiced.reserve((nd + 1) * (nd + 2) / 2);
+    for (int i = 0; i <= nd; ++i) {
+        for (int j = 0; j <= nd - i; ++j) {
+            Float b1 = Float(i) / Float(nd), b2 = Float(j) / Float(nd);
+            Float b0 = 1 - b1 - b2;
+            Point3f pBase = b0 * p[0] + Vector3f(b1 * p[1]) +
+                            Vector3f(b2 * p[2]);
+            Normal3f nBase = Normalize(b0 * n[0] + b1 * n[1] + b2 * n[2]);
+            Point2f uvBase = b0 * uv[0] + Vector2f(b1 * uv[1]) +
+                             Vector2f(b2 * uv[2]);
+            Float d = EvalDisplacement(*common, pBase, nBase, uvBase);
+            pDiced.push_back(pBase + d * Vector3f(nBase));
+            uvDiced.push_back(uvBase);
+        }
+    }
+
+    // Build micro-triangle indices over the grid; vertex $(i, j)$ is at
+    // offset $i (n + 1) - i (i - 1) / 2 + j$.
+    auto vertIndex = [nd](int i, int j) {
+        return i * (nd + 1) - i * (i - 1) / 2 + j;
+    };
+    std::vector<int> idx;
+    idx.reserve(3 * nd * nd);
+    for (int i = 0; i < nd; ++i) {
+        for (int j = 0; j < nd - i; ++j) {
+            idx.push_back(vertIndex(i, j));
+            idx.push_back(vertIndex(i + 1, j));
+            idx.push_back(vertIndex(i, j + 1));
+            if (j + 1 <= nd - i - 1) {
+                idx.push_back(vertIndex(i + 1, j));
+                idx.push_back(vertIndex(i + 1, j + 1));
+                idx.push_back(vertIndex(i, j + 1));
+            }
+        }
+    }
+    return CreateTriangleMesh(common->ObjectToWorld, common->WorldToObject,
+                              common->reverseOrientation, idx.size() / 3,
+                              &idx[0], pDiced.size(), &pDiced[0], nullptr,
+                              nullptr, &uvDiced[0], nullptr, nullptr);
+}
+
+// DisplacedTriangle Declarations
+class DisplacedTriangle : public Shape {
+  public:
+    // DisplacedTriangle Public Methods
+    DisplacedTriangle(const Transform *ObjectToWorld,
+                      const Transform *WorldToObject, bool reverseOrientation,
+                      const std::shared_ptr<DisplacedMeshCommon> &common,
+                      int triIndex)
+        : Shape(ObjectToWorld, WorldToObject, reverseOrientation),
+          common(common),
+          triIndex(triIndex) {
+        // The displaced surface lies within the base triangle's bound
+        // expanded by the displacement bound.
+        const int *vi = &common->indices[3 * triIndex];
+        Bounds3f b(common->p[vi[0]], common->p[vi[1]]);
+        b = Union(b, common->p[vi[2]]);
+        objBound = Expand(b, common->maxDisplacement);
+    }
+    Bounds3f ObjectBound() const { return objBound; }
+    bool Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
+                   bool testAlphaTexture) const;
+    bool IntersectP(const Ray &ray, bool testAlphaTexture) const;
+    Float Area() const;
+    Interaction Sample(const Point2f &u, Float *pdf) const;
+
+  private:
+    // DisplacedTriangle Private Methods
+    std::shared_ptr<DicedGrid> GetGrid() const;
+
+    // DisplacedTriangle Private Data
+    const std::shared_ptr<DisplacedMeshCommon> common;
+    const int triIndex;
+    Bounds3f objBound;
+};
+
+// DisplacedTriangle Method Definitions
+std::shared_ptr<DicedGrid> DisplacedTriangle::GetGrid() const {
+    std::lock_guard<std::mutex> lock(common->mutex);
+    std::shared_ptr<DicedGrid> grid = common->cache[triIndex];
+    if (grid) {
+        // Move this grid to the front of the LRU list
+        common->lru.erase(grid->lruIter);
+    } else {
+        // Dice this triangle and account for its memory
+        ++nDisplacementDicings;
+        grid = std::make_shared<DicedGrid>();
+        grid->tris = DiceTriangle(common.get(), triIndex);
+        // Estimate the micro-grid storage; shared vertices are counted
+        // once per triangle, so this slightly overestimates.
+        grid->bytes =
+            grid->tris.size() * (sizeof(Triangle) + 3 * sizeof(int) +
+                                 sizeof(Point3f) + sizeof(Point2f));
+        common->cacheBytes += grid->bytes;
+        dicedCacheBytes += grid->bytes;
+        common->cache[triIndex] = grid;
+
+        // Evict least recently used grids while over budget; the new
+        // entry isn't on the LRU list yet and so is never evicted, and
+        // callers holding a _DicedGrid_ keep evicted grids alive until
+        // they finish with them.
+        while (common->cacheBytes > common->maxCacheBytes &&
+               !common->lru.empty()) {
+            int evict = common->lru.back();
+            common->lru.pop_back();
+            common->cacheBytes -= common->cache[evict]->bytes;
+            dicedCacheBytes -= common->cache[evict]->bytes;
+            common->cache[evict] = nullptr;
+        }
+    }
+    common->lru.push_front(triIndex);
+    grid->lruIter = common->lru.begin();
+    return grid;
+}
+
+bool DisplacedTriangle::Intersect(const Ray &r, Float *tHit,
+                                  SurfaceInteraction *isect,
+                                  bool testAlphaTexture) const {
+    std::shared_ptr<DicedGrid> grid = GetGrid();
+    Ray ray = r;
+    bool hit = false;
+    for (const auto &tri : grid->tris) {
+        Float t;
+        if (tri->Intersect(ray, &t, isect, testAlphaTexture)) {
+            hit = true;
+            ray.tMax = t;
+            *tHit = t;
+        }
+    }
+    return hit;
+}
+
+bool DisplacedTriangle::IntersectP(const Ray &ray,
+                                   bool testAlphaTexture) const {
+    std::shared_ptr<DicedGrid> grid = GetGrid();
+    for (const auto &tri : grid->tris)
+        if (tri->IntersectP(ray, testAlphaTexture)) return true;
+    return false;
+}
+
+Float DisplacedTriangle::Area() const {
+    std::shared_ptr<DicedGrid> grid = GetGrid();
+    Float area = 0;
+    for (const auto &tri : grid->tris) area += tri->Area();
+    return area;
+}
+
+Interaction DisplacedTriangle::Sample(const Point2f &u, Float *pdf) const {
+    LOG(FATAL) << "DisplacedTriangle::Sample not implemented.";
+    return Interaction();
+}
+
+std::vector<std::shared_ptr<Shape>> CreateDisplacedMeshShape(
+    const Transform *o2w, const Transform *w2o, bool reverseOrientation,
+    const ParamSet &params,
+    std::map<std::string, std::shared_ptr<Texture<Float>>> *floatTextures) {
+    int nvi, npi, nuvi, nni;
+    const int *vi = params.FindInt("indices", &nvi);
+    const Point3f *P = params.FindPoint3f("P", &npi);
+    if (!vi) {
+        Error(
+            "Vertex indices \"indices\" not provided with displacedmesh "
+            "shape");
+        return std::vector<std::shared_ptr<Shape>>();
+    }
+    if (!P) {
+        Error("Vertex positions \"P\" not provided with displacedmesh shape");
+        return std::vector<std::shared_ptr<Shape>>();
+    }
+    for (int i = 0; i < nvi; ++i)
+        if (vi[i] >= npi) {
+            Error(
+                "displacedmesh has out of-bounds vertex index %d (%d \"P\" "
+                "values were given",
+                vi[i], npi);
+            return std::vector<std::shared_ptr<Shape>>();
+        }
+    const Point2f *uvs = params.FindPoint2f("uv", &nuvi);
+    if (!uvs) uvs = params.FindPoint2f("st", &nuvi);
+    if (uvs && nuvi < npi) {
+        Error(
+            "Not enough of \"uv\"s for displacedmesh shape.  Expected %d, "
+            "found %d.  Discarding.",
+            npi, nuvi);
+        uvs = nullptr;
+    }
+    const Normal3f *N = params.FindNormal3f("N", &nni);
+    if (N && nni != npi) {
+        Error("Number of \"N\"s for displacedmesh shape must match \"P\"s");
+        N = nullptr;
+    }
+
+    // Find displacement texture; a constant "displacement" float may be
+    // given instead, which is mostly useful for debugging.
+    std::shared_ptr<Texture<Float>> displacement;
+    std::string texName = params.FindTexture("displacement");
+    if (texName != "") {
+        if (floatTextures->find(texName) != floatTextures->end())
+            displacement = (*floatTextures)[texName];
+        else {
+            Error(
+                "Couldn't find float texture \"%s\" for \"displacement\" "
+                "parameter",
+                texName.c_str());
+            return std::vector<std::shared_ptr<Shape>>();
+        }
+    } else
+        displacement.reset(new ConstantTexture<Float>(
+            params.FindOneFloat("displacement", 0.f)));
+
+    std::shared_ptr<DisplacedMeshCommon> common =
+        std::make_shared<DisplacedMeshCommon>();
+    common->indices.assign(vi, vi + nvi);
+    common->p.assign(P, P + npi);
+    if (N) common->n.assign(N, N + npi);
+    if (uvs) common->uv.assign(uvs, uvs + npi);
+    common->displacement = displacement;
+    common->scale = params.FindOneFloat("displacementscale", 1.f);
+    // "maxdisplacement" bounds |scale * displacement| over the surface;
+    // the per-triangle bounds are padded by it, so an underestimate leads
+    // to missed intersections.
+    int nmd;
+    const Float *maxDisp = params.FindFloat("maxdisplacement", &nmd);
+    if (maxDisp)
+        common->maxDisplacement = std::abs(*maxDisp);
+    else {
+        Warning(
+            "Parameter \"maxdisplacement\" not provided for displacedmesh "
+            "shape; using 1.");
+        common->maxDisplacement = 1.f;
+    }
+    common->dicingRate =
+        Clamp(params.FindOneInt("dicingrate", 16), 1, 256);
+    common->ObjectToWorld = o2w;
+    common->WorldToObject = w2o;
+    common->reverseOrientation = reverseOrientation;
+    common->maxCacheBytes = size_t(1024 * 1024) *
+                            params.FindOneInt("dicingcachemb", 256);
+    int nTris = nvi / 3;
+    common->cache.assign(nTris, nullptr);
+    std::vector<std::shared_ptr<Shape>> tris;
+    tris.reserve(nTris);
+    for (int i = 0; i < nTris; ++i)
+        tris.push_back(std::make_shared<DisplacedTriangle>(
+            o2w, w2o, reverseOrientation, common, i));
+    nDisplacedTris += nTris;
+    return tris;
+}
+
+}  // namespace pbrt
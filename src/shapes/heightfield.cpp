@@ -34,10 +34,379 @@
 // shapes/heightfield.cpp*
 #include "shapes/heightfield.h"
 #include "shapes/triangle.h"
+#include "interaction.h"
 #include "paramset.h"
+#include "stats.h"
+#include <algorithm>
 
 namespace pbrt {
 
+STAT_MEMORY_COUNTER("Memory/Heightfield grids", heightfieldGridBytes);
+STAT_COUNTER("Intersections/Heightfield cell tests", nHeightfieldCellTests);
+
+// Heightfield Local Definitions
+
+// Watertight ray--triangle test using the coordinate permutation and
+// shear approach of Triangle::Intersect().  The result depends only on
+// the ray and the vertex positions, so the shared edge between two
+// adjacent heightfield cells sees exactly the same edge function values
+// from both sides and the grid traversal can't leak rays between cells.
+static bool IntersectHeightfieldTriangle(const Ray &ray, const Point3f &p0,
+                                         const Point3f &p1, const Point3f &p2,
+                                         Float *tHit, Float *b0Hit,
+                                         Float *b1Hit, Float *b2Hit) {
+    // Transform triangle vertices to ray coordinate space
+
+    // Translate vertices based on ray origin
+    Point3f p0t = p0 - Vector3f(ray.o);
+    Point3f p1t = p1 - Vector3f(ray.o);
+    Point3f p2t = p2 - Vector3f(ray.o);
+
+    // Permute components of triangle vertices and ray direction
+    int kz = MaxDimension(Abs(ray.d));
+    int kx = kz + 1;
+    if (kx == 3) kx = 0;
+    int ky = kx + 1;
+    if (ky == 3) ky = 0;
+    Vector3f d = Permute(ray.d, kx, ky, kz);
+    p0t = Permute(p0t, kx, ky, kz);
+    p1t = Permute(p1t, kx, ky, kz);
+    p2t = Permute(p2t, kx, ky, kz);
+
+    // Apply shear transformation to translated vertex positions
+    Float Sx = -d.x / d.z;
+    Float Sy = -d.y / d.z;
+    Float Sz = 1.f / d.z;
+    p0t.x += Sx * p0t.z;
+    p0t.y += Sy * p0t.z;
+    p1t.x += Sx * p1t.z;
+    p1t.y += Sy * p1t.z;
+    p2t.x += Sx * p2t.z;
+    p2t.y += Sy * p2t.z;
+
+    // Compute edge function coefficients _e0_, _e1_, and _e2_
+    Float e0 = p1t.x * p2t.y - p1t.y * p2t.x;
+    Float e1 = p2t.x * p0t.y - p2t.y * p0t.x;
+    Float e2 = p0t.x * p1t.y - p0t.y * p1t.x;
+
+    // Fall back to double precision test at triangle edges
+    if (sizeof(Float) == sizeof(float) &&
+        (e0 == 0.0f || e1 == 0.0f || e2 == 0.0f)) {
+        double p2txp1ty = (double)p2t.x * (double)p1t.y;
+        double p2typ1tx = (double)p2t.y * (double)p1t.x;
+        e0 = (float)(p2typ1tx - p2txp1ty);
+        double p0txp2ty = (double)p0t.x * (double)p2t.y;
+        double p0typ2tx = (double)p0t.y * (double)p2t.x;
+        e1 = (float)(p0typ2tx - p0txp2ty);
+        double p1txp0ty = (double)p1t.x * (double)p0t.y;
+        double p1typ0tx = (double)p1t.y * (double)p0t.x;
+        e2 = (float)(p1typ0tx - p1txp0ty);
+    }
+
+    // Perform triangle edge and determinant tests
+    if ((e0 < 0 || e1 < 0 || e2 < 0) && (e0 > 0 || e1 > 0 || e2 > 0))
+        return false;
+    Float det = e0 + e1 + e2;
+    if (det == 0) return false;
+
+    // Compute scaled hit distance to triangle and test against ray $t$ range
+    p0t.z *= Sz;
+    p1t.z *= Sz;
+    p2t.z *= Sz;
+    Float tScaled = e0 * p0t.z + e1 * p1t.z + e2 * p2t.z;
+    if (det < 0 && (tScaled >= 0 || tScaled < ray.tMax * det))
+        return false;
+    else if (det > 0 && (tScaled <= 0 || tScaled > ray.tMax * det))
+        return false;
+
+    // Compute barycentric coordinates and $t$ value for triangle intersection
+    Float invDet = 1 / det;
+    Float b0 = e0 * invDet;
+    Float b1 = e1 * invDet;
+    Float b2 = e2 * invDet;
+    Float t = tScaled * invDet;
+
+    // Ensure that computed triangle $t$ is conservatively greater than zero
+
+    // Compute $\delta_z$ term for triangle $t$ error bounds
+    Float maxZt = MaxComponent(Abs(Vector3f(p0t.z, p1t.z, p2t.z)));
+    Float deltaZ = gamma(3) * maxZt;
+
+    // Compute $\delta_x$ and $\delta_y$ terms for triangle $t$ error bounds
+    Float maxXt = MaxComponent(Abs(Vector3f(p0t.x, p1t.x, p2t.x)));
+    Float maxYt = MaxComponent(Abs(Vector3f(p0t.y, p1t.y, p2t.y)));
+    Float deltaX = gamma(5) * (maxXt + maxZt);
+    Float deltaY = gamma(5) * (maxYt + maxZt);
+
+    // Compute $\delta_e$ term for triangle $t$ error bounds
+    Float deltaE =
+        2 * (gamma(2) * maxXt * maxYt + deltaY * maxXt + deltaX * maxYt);
+
+    // Compute $\delta_t$ term for triangle $t$ error bounds and check _t_
+    Float maxE = MaxComponent(Abs(Vector3f(e0, e1, e2)));
+    Float deltaT = 3 *
+                   (gamma(3) * maxE * maxZt + deltaE * maxZt + deltaZ * maxE) *
+                   std::abs(invDet);
+    if (t <= deltaT) return false;
+
+    *tHit = t;
+    *b0Hit = b0;
+    *b1Hit = b1;
+    *b2Hit = b2;
+    return true;
+}
+
+// Heightfield Declarations
+
+// Native heightfield shape: stores the height grid directly and
+// intersects rays by traversing a min--max height pyramid over the grid
+// cells, descending front to back and only testing the two triangles of
+// cells whose height range the ray actually passes through.  The
+// triangles tested are exactly those that CreateHeightfield()'s triangle
+// expansion would have produced, but the grid plus pyramid takes a small
+// constant factor over the raw height data instead of two orders of
+// magnitude more for an expanded mesh and its BVH.
+class Heightfield : public Shape {
+  public:
+    // Heightfield Public Methods
+    Heightfield(const Transform *ObjectToWorld, const Transform *WorldToObject,
+                bool reverseOrientation, int nx, int ny, const Float *zv);
+    Bounds3f ObjectBound() const {
+        return Bounds3f(Point3f(0, 0, zGridMin), Point3f(1, 1, zGridMax));
+    }
+    bool Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
+                   bool testAlphaTexture) const;
+    bool IntersectP(const Ray &ray, bool testAlphaTexture) const;
+    Float Area() const;
+    Interaction Sample(const Point2f &u, Float *pdf) const;
+
+  private:
+    // Heightfield Private Declarations
+    struct ZRange {
+        Float zMin, zMax;
+    };
+    struct HFHit {
+        Float t, b0, b1, b2;
+        Point3f p0, p1, p2;
+    };
+
+    // Heightfield Private Methods
+    Float Height(int x, int y) const { return z[y * nx + x]; }
+    Point3f Vert(int x, int y) const {
+        return Point3f(x * invNx1, y * invNy1, Height(x, y));
+    }
+    Bounds3f CellBounds(int level, int x, int y) const {
+        // A pyramid cell at _level_ covers $2^{level}$ base cells per axis
+        int scale = 1 << level;
+        const ZRange &zr = pyramid[level][y * levelRes[level].x + x];
+        return Bounds3f(
+            Point3f(x * scale * invNx1, y * scale * invNy1, zr.zMin),
+            Point3f(std::min((x + 1) * scale, nx - 1) * invNx1,
+                    std::min((y + 1) * scale, ny - 1) * invNy1, zr.zMax));
+    }
+    bool IntersectCell(const Ray &ray, int x, int y, Float *tMax,
+                       HFHit *hit) const;
+    bool Traverse(const Ray &ray, int level, int x, int y, Float *tMax,
+                  HFHit *hit, bool anyHit) const;
+
+    // Heightfield Private Data
+    const int nx, ny;
+    const Float invNx1, invNy1;
+    std::vector<Float> z;
+    Float zGridMin, zGridMax;
+    // Min--max height pyramid over the $(nx-1) \times (ny-1)$ grid cells;
+    // level 0 holds per-cell height ranges and each coarser level the
+    // union of up to $2 \times 2$ ranges of the level below.
+    std::vector<std::vector<ZRange>> pyramid;
+    std::vector<Point2i> levelRes;
+};
+
+// Heightfield Method Definitions
+Heightfield::Heightfield(const Transform *ObjectToWorld,
+                         const Transform *WorldToObject,
+                         bool reverseOrientation, int nx, int ny,
+                         const Float *zv)
+    : Shape(ObjectToWorld, WorldToObject, reverseOrientation),
+      nx(nx),
+      ny(ny),
+      invNx1((Float)1 / (nx - 1)),
+      invNy1((Float)1 / (ny - 1)),
+      z(zv, zv + nx * ny) {
+    zGridMin = zGridMax = z[0];
+    for (Float h : z) {
+        zGridMin = std::min(zGridMin, h);
+        zGridMax = std::max(zGridMax, h);
+    }
+
+    // Build min--max height pyramid over grid cells
+    Point2i res(nx - 1, ny - 1);
+    pyramid.push_back(std::vector<ZRange>(res.x * res.y));
+    levelRes.push_back(res);
+    for (int y = 0; y < res.y; ++y)
+        for (int x = 0; x < res.x; ++x) {
+            Float z00 = Height(x, y), z10 = Height(x + 1, y);
+            Float z01 = Height(x, y + 1), z11 = Height(x + 1, y + 1);
+            ZRange &zr = pyramid[0][y * res.x + x];
+            zr.zMin = std::min(std::min(z00, z10), std::min(z01, z11));
+            zr.zMax = std::max(std::max(z00, z10), std::max(z01, z11));
+        }
+    while (res.x > 1 || res.y > 1) {
+        Point2i cres((res.x + 1) / 2, (res.y + 1) / 2);
+        std::vector<ZRange> coarse(cres.x * cres.y);
+        const std::vector<ZRange> &fine = pyramid.back();
+        for (int y = 0; y < cres.y; ++y)
+            for (int x = 0; x < cres.x; ++x) {
+                ZRange zr = fine[std::min(2 * y, res.y - 1) * res.x +
+                                 std::min(2 * x, res.x - 1)];
+                for (int j = 0; j < 2; ++j)
+                    for (int i = 0; i < 2; ++i) {
+                        if (2 * x + i >= res.x || 2 * y + j >= res.y) continue;
+                        const ZRange &c = fine[(2 * y + j) * res.x + 2 * x + i];
+                        zr.zMin = std::min(zr.zMin, c.zMin);
+                        zr.zMax = std::max(zr.zMax, c.zMax);
+                    }
+                coarse[y * cres.x + x] = zr;
+            }
+        pyramid.push_back(std::move(coarse));
+        levelRes.push_back(cres);
+        res = cres;
+    }
+    size_t bytes = z.size() * sizeof(Float);
+    for (const auto &level : pyramid) bytes += level.size() * sizeof(ZRange);
+    heightfieldGridBytes += bytes;
+}
+
+bool Heightfield::IntersectCell(const Ray &ray, int x, int y, Float *tMax,
+                                HFHit *hit) const {
+    ++nHeightfieldCellTests;
+    // Test the cell's two triangles, split along the same diagonal as
+    // CreateHeightfield()'s triangle expansion
+    Point3f p00 = Vert(x, y), p10 = Vert(x + 1, y);
+    Point3f p11 = Vert(x + 1, y + 1), p01 = Vert(x, y + 1);
+    Ray r = ray;
+    r.tMax = *tMax;
+    bool hitCell = false;
+    Float t, b0, b1, b2;
+    if (IntersectHeightfieldTriangle(r, p00, p10, p11, &t, &b0, &b1, &b2)) {
+        *tMax = r.tMax = t;
+        *hit = HFHit{t, b0, b1, b2, p00, p10, p11};
+        hitCell = true;
+    }
+    if (IntersectHeightfieldTriangle(r, p00, p11, p01, &t, &b0, &b1, &b2)) {
+        *tMax = t;
+        *hit = HFHit{t, b0, b1, b2, p00, p11, p01};
+        hitCell = true;
+    }
+    return hitCell;
+}
+
+bool Heightfield::Traverse(const Ray &ray, int level, int x, int y,
+                           Float *tMax, HFHit *hit, bool anyHit) const {
+    if (level == 0) return IntersectCell(ray, x, y, tMax, hit);
+
+    // Collect the child cells the ray passes through, nearest first
+    struct ChildEntry {
+        Float t0;
+        int x, y;
+    } children[4];
+    int nChildren = 0;
+    const Point2i &cres = levelRes[level - 1];
+    for (int j = 0; j < 2; ++j)
+        for (int i = 0; i < 2; ++i) {
+            int cx = 2 * x + i, cy = 2 * y + j;
+            if (cx >= cres.x || cy >= cres.y) continue;
+            Float t0, t1;
+            if (!CellBounds(level - 1, cx, cy).IntersectP(ray, &t0, &t1) ||
+                t0 > *tMax)
+                continue;
+            children[nChildren++] = ChildEntry{t0, cx, cy};
+        }
+    std::sort(children, children + nChildren,
+              [](const ChildEntry &a, const ChildEntry &b) {
+                  return a.t0 < b.t0;
+              });
+
+    // Recurse front to back, stopping once a hit precedes the next child
+    bool hitAny = false;
+    for (int i = 0; i < nChildren; ++i) {
+        if (children[i].t0 > *tMax) break;
+        if (Traverse(ray, level - 1, children[i].x, children[i].y, tMax, hit,
+                     anyHit)) {
+            hitAny = true;
+            if (anyHit) return true;
+        }
+    }
+    return hitAny;
+}
+
+bool Heightfield::Intersect(const Ray &r, Float *tHit,
+                            SurfaceInteraction *isect,
+                            bool testAlphaTexture) const {
+    ProfilePhase p(Prof::ShapeIntersect);
+    // Transform _Ray_ to object space and traverse the height pyramid
+    Ray ray = (*WorldToObject)(r);
+    Float tMax = ray.tMax;
+    HFHit hit;
+    int top = (int)pyramid.size() - 1;
+    if (!Traverse(ray, top, 0, 0, &tMax, &hit, false)) return false;
+
+    // Interpolate hit position and $(u,v)$ from barycentric coordinates
+    Point3f pHit = hit.b0 * hit.p0 + hit.b1 * hit.p1 + hit.b2 * hit.p2;
+    // The heightfield's $(u,v)$ parameterization is its $(x,y)$ plane
+    Point2f uv0(hit.p0.x, hit.p0.y), uv1(hit.p1.x, hit.p1.y);
+    Point2f uv2(hit.p2.x, hit.p2.y);
+    Point2f uvHit = hit.b0 * uv0 + hit.b1 * uv1 + hit.b2 * uv2;
+
+    // Compute triangle partial derivatives
+    Vector2f duv02 = uv0 - uv2, duv12 = uv1 - uv2;
+    Vector3f dp02 = hit.p0 - hit.p2, dp12 = hit.p1 - hit.p2;
+    Float determinant = duv02[0] * duv12[1] - duv02[1] * duv12[0];
+    Float invdet = 1 / determinant;
+    Vector3f dpdu = (duv12[1] * dp02 - duv02[1] * dp12) * invdet;
+    Vector3f dpdv = (-duv12[0] * dp02 + duv02[0] * dp12) * invdet;
+
+    // Compute error bounds for heightfield intersection
+    Float xAbsSum = std::abs(hit.b0 * hit.p0.x) + std::abs(hit.b1 * hit.p1.x) +
+                    std::abs(hit.b2 * hit.p2.x);
+    Float yAbsSum = std::abs(hit.b0 * hit.p0.y) + std::abs(hit.b1 * hit.p1.y) +
+                    std::abs(hit.b2 * hit.p2.y);
+    Float zAbsSum = std::abs(hit.b0 * hit.p0.z) + std::abs(hit.b1 * hit.p1.z) +
+                    std::abs(hit.b2 * hit.p2.z);
+    Vector3f pError = gamma(7) * Vector3f(xAbsSum, yAbsSum, zAbsSum);
+
+    *isect = (*ObjectToWorld)(SurfaceInteraction(
+        pHit, pError, uvHit, -ray.d, dpdu, dpdv, Normal3f(0, 0, 0),
+        Normal3f(0, 0, 0), ray.time, this));
+    *tHit = hit.t;
+    return true;
+}
+
+bool Heightfield::IntersectP(const Ray &r, bool testAlphaTexture) const {
+    ProfilePhase p(Prof::ShapeIntersectP);
+    Ray ray = (*WorldToObject)(r);
+    Float tMax = ray.tMax;
+    HFHit hit;
+    return Traverse(ray, (int)pyramid.size() - 1, 0, 0, &tMax, &hit, true);
+}
+
+Float Heightfield::Area() const {
+    // Rarely needed, so just sum the triangle areas on demand
+    Float area = 0;
+    for (int y = 0; y < ny - 1; ++y)
+        for (int x = 0; x < nx - 1; ++x) {
+            Point3f p00 = Vert(x, y), p10 = Vert(x + 1, y);
+            Point3f p11 = Vert(x + 1, y + 1), p01 = Vert(x, y + 1);
+            area += 0.5f * Cross(p10 - p00, p11 - p00).Length() +
+                    0.5f * Cross(p11 - p00, p01 - p00).Length();
+        }
+    return area;
+}
+
+Interaction Heightfield::Sample(const Point2f &u, Float *pdf) const {
+    LOG(FATAL) << "Heightfield::Sample not implemented.";
+    return Interaction();
+}
+
 // Heightfield Definitions
 std::vector<std::shared_ptr<Shape>> CreateHeightfield(
     const Transform *ObjectToWorld, const Transform *WorldToObject,
@@ -49,6 +418,14 @@ std::vector<std::shared_ptr<Shape>> CreateHeightfield(
     CHECK_EQ(nitems, nx * ny);
     CHECK(nx != -1 && ny != -1 && z != nullptr);
 
+    // Optionally intersect the height grid directly rather than expanding
+    // it into triangles: for large terrain grids the expanded mesh and
+    // its acceleration structure take orders of magnitude more memory
+    // than the heights themselves.
+    if (params.FindOneBool("ddatraversal", false))
+        return {std::make_shared<Heightfield>(ObjectToWorld, WorldToObject,
+                                              reverseOrientation, nx, ny, z)};
+
     int ntris = 2 * (nx - 1) * (ny - 1);
     std::unique_ptr<int[]> indices(new int[3 * ntris]);
     std::unique_ptr<Point3f[]> P(new Point3f[nx * ny]);
@@ -35,11 +35,18 @@
 #include "shapes/loopsubdiv.h"
 #include "shapes/triangle.h"
 #include "paramset.h"
-#include <set>
+#include "stats.h"
+#include <list>
 #include <map>
+#include <mutex>
+#include <set>
 
 namespace pbrt {
 
+STAT_COUNTER("Scene/Loop subdivision patches", nLoopPatches);
+STAT_COUNTER("Intersections/Loop patch tessellations", nPatchTessellations);
+STAT_MEMORY_COUNTER("Memory/Loop patch cache", loopPatchCacheBytes);
+
 struct SDFace;
 struct SDVertex;
 
@@ -145,21 +152,31 @@ inline Float loopGamma(int valence) {
     return 1.f / (valence + 3.f / (8.f * beta(valence)));
 }
 
-// LoopSubdiv Function Definitions
-static std::vector<std::shared_ptr<Shape>> LoopSubdivide(
-    const Transform *ObjectToWorld, const Transform *WorldToObject,
-    bool reverseOrientation, int nLevels, int nIndices,
-    const int *vertexIndices, int nVertices, const Point3f *p) {
+// SDBaseMesh holds the base control mesh; for lazily tessellated
+// subdivision surfaces it is kept alive for the lifetime of the scene so
+// patches can be (re)tessellated from it on demand.
+struct SDBaseMesh {
+    std::unique_ptr<SDVertex[]> verts;
+    std::unique_ptr<SDFace[]> fs;
     std::vector<SDVertex *> vertices;
     std::vector<SDFace *> faces;
+};
+
+// LoopSubdiv Function Definitions
+static void InitBaseMesh(int nIndices, const int *vertexIndices, int nVertices,
+                         const Point3f *p, SDBaseMesh *mesh) {
+    std::vector<SDVertex *> &vertices = mesh->vertices;
+    std::vector<SDFace *> &faces = mesh->faces;
     // Allocate _LoopSubdiv_ vertices and faces
-    std::unique_ptr<SDVertex[]> verts(new SDVertex[nVertices]);
+    mesh->verts.reset(new SDVertex[nVertices]);
+    SDVertex *verts = mesh->verts.get();
     for (int i = 0; i < nVertices; ++i) {
         verts[i] = SDVertex(p[i]);
         vertices.push_back(&verts[i]);
     }
     int nFaces = nIndices / 3;
-    std::unique_ptr<SDFace[]> fs(new SDFace[nFaces]);
+    mesh->fs.reset(new SDFace[nFaces]);
+    SDFace *fs = mesh->fs.get();
     for (int i = 0; i < nFaces; ++i) faces.push_back(&fs[i]);
 
     // Set face to vertex pointers
@@ -211,12 +228,14 @@ static std::vector<std::shared_ptr<Shape>> LoopSubdivide(
         else
             v->regular = false;
     }
+}
 
-    // Refine _LoopSubdiv_ into triangles
-    std::vector<SDFace *> f = faces;
-    std::vector<SDVertex *> v = vertices;
-    MemoryArena arena;
-    for (int i = 0; i < nLevels; ++i) {
+static void SubdivideOneLevel(std::vector<SDFace *> *fPtr,
+                              std::vector<SDVertex *> *vPtr,
+                              MemoryArena &arena) {
+    std::vector<SDFace *> &f = *fPtr;
+    std::vector<SDVertex *> &v = *vPtr;
+    {
         // Update _f_ and _v_ for next level of subdivision
         std::vector<SDFace *> newFaces;
         std::vector<SDVertex *> newVertices;
@@ -329,7 +348,17 @@ static std::vector<std::shared_ptr<Shape>> LoopSubdivide(
         f = newFaces;
         v = newVertices;
     }
+}
 
+// Pushes the vertices used by the faces _f_ to the limit surface, computes
+// their limit normals, and creates the corresponding triangle mesh. _v_
+// must contain every vertex referenced by _f_ (and may contain more, e.g.
+// the outer support vertices of a lazily tessellated patch, which are
+// skipped).
+static std::vector<std::shared_ptr<Shape>> MeshFromFaces(
+    const std::vector<SDFace *> &f, const std::vector<SDVertex *> &v,
+    const Transform *ObjectToWorld, const Transform *WorldToObject,
+    bool reverseOrientation) {
     // Push vertices to limit surface
     std::unique_ptr<Point3f[]> pLimit(new Point3f[v.size()]);
     for (size_t i = 0; i < v.size(); ++i) {
@@ -378,27 +407,292 @@ static std::vector<std::shared_ptr<Shape>> LoopSubdivide(
         Ns.push_back(Normal3f(Cross(S, T)));
     }
 
-    // Create triangle mesh from subdivision mesh
+    // Create triangle mesh from subdivision mesh, compacting to the
+    // vertices the faces actually reference
     {
         size_t ntris = f.size();
         std::unique_ptr<int[]> verts(new int[3 * ntris]);
         int *vp = verts.get();
-        size_t totVerts = v.size();
+        std::map<SDVertex *, int> vertIndex;
+        for (size_t i = 0; i < v.size(); ++i) vertIndex[v[i]] = i;
         std::map<SDVertex *, int> usedVerts;
-        for (size_t i = 0; i < totVerts; ++i) usedVerts[v[i]] = i;
+        std::vector<Point3f> pUsed;
+        std::vector<Normal3f> nUsed;
         for (size_t i = 0; i < ntris; ++i) {
             for (int j = 0; j < 3; ++j) {
-                *vp = usedVerts[f[i]->v[j]];
+                SDVertex *vert = f[i]->v[j];
+                auto iter = usedVerts.find(vert);
+                if (iter == usedVerts.end()) {
+                    iter = usedVerts.insert({vert, (int)pUsed.size()}).first;
+                    pUsed.push_back(vert->p);
+                    nUsed.push_back(Ns[vertIndex[vert]]);
+                }
+                *vp = iter->second;
                 ++vp;
             }
         }
         return CreateTriangleMesh(ObjectToWorld, WorldToObject,
                                   reverseOrientation, ntris, verts.get(),
-                                  totVerts, pLimit.get(), nullptr, &Ns[0],
+                                  pUsed.size(), &pUsed[0], nullptr, &nUsed[0],
                                   nullptr, nullptr, nullptr);
     }
 }
 
+static std::vector<std::shared_ptr<Shape>> LoopSubdivide(
+    const Transform *ObjectToWorld, const Transform *WorldToObject,
+    bool reverseOrientation, int nLevels, int nIndices,
+    const int *vertexIndices, int nVertices, const Point3f *p) {
+    SDBaseMesh mesh;
+    InitBaseMesh(nIndices, vertexIndices, nVertices, p, &mesh);
+
+    // Refine _LoopSubdiv_ into triangles
+    std::vector<SDFace *> f = mesh.faces;
+    std::vector<SDVertex *> v = mesh.vertices;
+    MemoryArena arena;
+    for (int i = 0; i < nLevels; ++i) SubdivideOneLevel(&f, &v, arena);
+    return MeshFromFaces(f, v, ObjectToWorld, WorldToObject,
+                         reverseOrientation);
+}
+
+// Collects the base faces incident to the three corner vertices of face
+// _faceIndex_. The limit surface over that face depends only on the
+// vertices of these faces, and the property is preserved by subdivision:
+// the control set of each child face lies within the children of these
+// faces. They therefore suffice to tessellate the patch in isolation.
+static void GatherPatchRegion(const SDBaseMesh &mesh, int faceIndex,
+                              std::vector<SDFace *> *regionFaces) {
+    SDFace *face = mesh.faces[faceIndex];
+    std::set<SDFace *> seen;
+    for (int j = 0; j < 3; ++j) {
+        SDVertex *v = face->v[j];
+        // Collect faces incident to corner vertex _v_
+        SDFace *f = v->startFace;
+        if (!v->boundary) {
+            do {
+                if (seen.insert(f).second) regionFaces->push_back(f);
+                f = f->nextFace(v);
+            } while (f != v->startFace);
+        } else {
+            while (f != nullptr) {
+                if (seen.insert(f).second) regionFaces->push_back(f);
+                f = f->nextFace(v);
+            }
+            f = v->startFace->prevFace(v);
+            while (f != nullptr) {
+                if (seen.insert(f).second) regionFaces->push_back(f);
+                f = f->prevFace(v);
+            }
+        }
+    }
+}
+
+// LoopSubdivCommon holds the state shared by the LoopSubdivPatch shapes
+// created for one subdivision surface: the base control mesh, the
+// tessellation parameters, and a bounded cache of per-patch tessellations
+// with least-recently-used replacement.
+struct LoopPatchTess {
+    std::vector<std::shared_ptr<Shape>> tris;
+    size_t bytes;
+    std::list<int>::iterator lruIter;
+};
+
+struct LoopSubdivCommon {
+    SDBaseMesh mesh;
+    int nLevels;
+    const Transform *ObjectToWorld, *WorldToObject;
+    bool reverseOrientation;
+    // Tessellation cache, indexed by base face and protected by _mutex_;
+    // _lru_ lists cached face indices, most recently used first.
+    size_t maxCacheBytes;
+    std::mutex mutex;
+    size_t cacheBytes = 0;
+    std::vector<std::shared_ptr<LoopPatchTess>> cache;
+    std::list<int> lru;
+};
+
+// Tessellates the patch over base face _faceIndex_, producing exactly the
+// triangles that subdividing the full mesh _common->nLevels_ times would
+// generate for that face.
+static std::vector<std::shared_ptr<Shape>> TessellatePatch(
+    LoopSubdivCommon *common, int faceIndex) {
+    std::vector<SDFace *> regionFaces;
+    GatherPatchRegion(common->mesh, faceIndex, &regionFaces);
+
+    // Copy the control region into local vertices and faces. Neighbor
+    // pointers that lead outside the region become _nullptr_ and the
+    // affected vertices are treated as boundary vertices below; their
+    // subdivided positions are wrong, but by the closure property above
+    // they never contribute to the central face's descendants.
+    std::map<SDVertex *, SDVertex *> vertMap;
+    std::map<SDFace *, SDFace *> faceMap;
+    std::vector<SDVertex *> origVerts;
+    for (SDFace *face : regionFaces)
+        for (int j = 0; j < 3; ++j)
+            if (vertMap.insert({face->v[j], nullptr}).second)
+                origVerts.push_back(face->v[j]);
+    std::unique_ptr<SDVertex[]> verts(new SDVertex[origVerts.size()]);
+    std::unique_ptr<SDFace[]> faces(new SDFace[regionFaces.size()]);
+    for (size_t i = 0; i < origVerts.size(); ++i) {
+        verts[i] = SDVertex(origVerts[i]->p);
+        vertMap[origVerts[i]] = &verts[i];
+    }
+    for (size_t i = 0; i < regionFaces.size(); ++i)
+        faceMap[regionFaces[i]] = &faces[i];
+    for (size_t i = 0; i < regionFaces.size(); ++i) {
+        SDFace *orig = regionFaces[i], *face = &faces[i];
+        for (int j = 0; j < 3; ++j) {
+            face->v[j] = vertMap[orig->v[j]];
+            face->v[j]->startFace = face;
+            auto iter = faceMap.find(orig->f[j]);
+            face->f[j] = iter != faceMap.end() ? iter->second : nullptr;
+        }
+    }
+
+    // Recompute boundary and regular flags for the local region; vertices
+    // with clipped face rings become boundary vertices so that the ring
+    // traversals in valence() and oneRing() stay within the region.
+    for (size_t i = 0; i < origVerts.size(); ++i) {
+        SDVertex *v = &verts[i];
+        SDFace *f = v->startFace;
+        do {
+            f = f->nextFace(v);
+        } while (f && f != v->startFace);
+        v->boundary = (f == nullptr);
+        v->regular = (!v->boundary && v->valence() == 6) ||
+                     (v->boundary && v->valence() == 4);
+    }
+
+    // Subdivide the region, tracking the descendants of the central face;
+    // children are visited in the same order as in LoopSubdivide() so the
+    // resulting triangles match those of full subdivision exactly.
+    std::vector<SDFace *> central = {faceMap[common->mesh.faces[faceIndex]]};
+    std::vector<SDFace *> f;
+    for (size_t i = 0; i < regionFaces.size(); ++i) f.push_back(&faces[i]);
+    std::vector<SDVertex *> v;
+    for (size_t i = 0; i < origVerts.size(); ++i) v.push_back(&verts[i]);
+    MemoryArena arena;
+    for (int level = 0; level < common->nLevels; ++level) {
+        SubdivideOneLevel(&f, &v, arena);
+        std::vector<SDFace *> nextCentral;
+        for (SDFace *c : central)
+            for (int k = 0; k < 4; ++k) nextCentral.push_back(c->children[k]);
+        central = nextCentral;
+    }
+    return MeshFromFaces(central, v, common->ObjectToWorld,
+                         common->WorldToObject, common->reverseOrientation);
+}
+
+// LoopSubdivPatch Declarations
+class LoopSubdivPatch : public Shape {
+  public:
+    // LoopSubdivPatch Public Methods
+    LoopSubdivPatch(const Transform *ObjectToWorld,
+                    const Transform *WorldToObject, bool reverseOrientation,
+                    const std::shared_ptr<LoopSubdivCommon> &common,
+                    int faceIndex)
+        : Shape(ObjectToWorld, WorldToObject, reverseOrientation),
+          common(common),
+          faceIndex(faceIndex) {
+        // The subdivision rules are convex combinations, so the limit
+        // patch lies in the convex hull of its control vertices.
+        std::vector<SDFace *> regionFaces;
+        GatherPatchRegion(common->mesh, faceIndex, &regionFaces);
+        for (SDFace *f : regionFaces)
+            for (int j = 0; j < 3; ++j)
+                objBound = Union(objBound, f->v[j]->p);
+    }
+    Bounds3f ObjectBound() const { return objBound; }
+    bool Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
+                   bool testAlphaTexture) const;
+    bool IntersectP(const Ray &ray, bool testAlphaTexture) const;
+    Float Area() const;
+    Interaction Sample(const Point2f &u, Float *pdf) const;
+
+  private:
+    // LoopSubdivPatch Private Methods
+    std::shared_ptr<LoopPatchTess> GetTess() const;
+
+    // LoopSubdivPatch Private Data
+    const std::shared_ptr<LoopSubdivCommon> common;
+    const int faceIndex;
+    Bounds3f objBound;
+};
+
+// LoopSubdivPatch Method Definitions
+std::shared_ptr<LoopPatchTess> LoopSubdivPatch::GetTess() const {
+    std::lock_guard<std::mutex> lock(common->mutex);
+    std::shared_ptr<LoopPatchTess> tess = common->cache[faceIndex];
+    if (tess) {
+        // Move this patch to the front of the LRU list
+        common->lru.erase(tess->lruIter);
+    } else {
+        // Tessellate this patch and account for its memory
+        ++nPatchTessellations;
+        tess = std::make_shared<LoopPatchTess>();
+        tess->tris = TessellatePatch(common.get(), faceIndex);
+        // Estimate the triangle mesh storage; shared vertices are counted
+        // once per triangle, so this slightly overestimates.
+        tess->bytes =
+            tess->tris.size() * (sizeof(Triangle) + 3 * sizeof(int) +
+                                 2 * (sizeof(Point3f) + sizeof(Normal3f)));
+        common->cacheBytes += tess->bytes;
+        loopPatchCacheBytes += tess->bytes;
+        common->cache[faceIndex] = tess;
+
+        // Evict least recently used tessellations while over budget. The
+        // new entry isn't on the LRU list yet and so is never evicted;
+        // callers holding a _LoopPatchTess_ keep evicted tessellations
+        // alive until they finish with them.
+        while (common->cacheBytes > common->maxCacheBytes &&
+               !common->lru.empty()) {
+            int evict = common->lru.back();
+            common->lru.pop_back();
+            common->cacheBytes -= common->cache[evict]->bytes;
+            loopPatchCacheBytes -= common->cache[evict]->bytes;
+            common->cache[evict] = nullptr;
+        }
+    }
+    common->lru.push_front(faceIndex);
+    tess->lruIter = common->lru.begin();
+    return tess;
+}
+
+bool LoopSubdivPatch::Intersect(const Ray &r, Float *tHit,
+                                SurfaceInteraction *isect,
+                                bool testAlphaTexture) const {
+    std::shared_ptr<LoopPatchTess> tess = GetTess();
+    Ray ray = r;
+    bool hit = false;
+    for (const auto &tri : tess->tris) {
+        Float t;
+        if (tri->Intersect(ray, &t, isect, testAlphaTexture)) {
+            hit = true;
+            ray.tMax = t;
+            *tHit = t;
+        }
+    }
+    return hit;
+}
+
+bool LoopSubdivPatch::IntersectP(const Ray &ray, bool testAlphaTexture) const {
+    std::shared_ptr<LoopPatchTess> tess = GetTess();
+    for (const auto &tri : tess->tris)
+        if (tri->IntersectP(ray, testAlphaTexture)) return true;
+    return false;
+}
+
+Float LoopSubdivPatch::Area() const {
+    std::shared_ptr<LoopPatchTess> tess = GetTess();
+    Float area = 0;
+    for (const auto &tri : tess->tris) area += tri->Area();
+    return area;
+}
+
+Interaction LoopSubdivPatch::Sample(const Point2f &u, Float *pdf) const {
+    LOG(FATAL) << "LoopSubdivPatch::Sample not implemented.";
+    return Interaction();
+}
+
 std::vector<std::shared_ptr<Shape>> CreateLoopSubdiv(const Transform *o2w,
                                                      const Transform *w2o,
                                                      bool reverseOrientation,
@@ -419,6 +713,30 @@ std::vector<std::shared_ptr<Shape>> CreateLoopSubdiv(const Transform *o2w,
 
     // don't actually use this for now...
     std::string scheme = params.FindOneString("scheme", "loop");
+
+    // With "lazytessellation" each base face becomes a _LoopSubdivPatch_
+    // that tessellates itself the first time a ray reaches it, with the
+    // tessellations kept in a bounded LRU cache. Since the patches can't
+    // be sampled, the default remains up-front tessellation.
+    if (params.FindOneBool("lazytessellation", false)) {
+        std::shared_ptr<LoopSubdivCommon> common =
+            std::make_shared<LoopSubdivCommon>();
+        InitBaseMesh(nIndices, vertexIndices, nps, P, &common->mesh);
+        common->nLevels = nLevels;
+        common->ObjectToWorld = o2w;
+        common->WorldToObject = w2o;
+        common->reverseOrientation = reverseOrientation;
+        common->maxCacheBytes =
+            size_t(1024 * 1024) *
+            params.FindOneInt("tessellationcachemb", 128);
+        common->cache.assign(common->mesh.faces.size(), nullptr);
+        std::vector<std::shared_ptr<Shape>> patches;
+        for (size_t i = 0; i < common->mesh.faces.size(); ++i)
+            patches.push_back(std::make_shared<LoopSubdivPatch>(
+                o2w, w2o, reverseOrientation, common, int(i)));
+        nLoopPatches += patches.size();
+        return patches;
+    }
     return LoopSubdivide(o2w, w2o, reverseOrientation, nLevels, nIndices,
                          vertexIndices, nps, P);
 }
@@ -34,10 +34,12 @@
 // shapes/plymesh.cpp*
 #include "shapes/triangle.h"
 #include "textures/constant.h"
+#include "fileutil.h"
 #include "paramset.h"
 #include "ext/rply.h"
 
 #include <iostream>
+#include <sstream>
 
 namespace pbrt {
 using namespace std;
@@ -154,106 +156,350 @@ int rply_face_callback(p_ply_argument argument) {
     return 1;
 }
 
+// Fast path for binary little-endian PLY files, the format our exporters
+// write: rather than dispatching rply's per-scalar callbacks, validate the
+// header against the layouts we understand (all-float vertex properties
+// with x/y/z, optionally nx/ny/nz and a UV pair, then a single
+// uchar-counted int vertex_indices list) and bulk-read the vertex and face
+// blocks in one pass over the file contents. Returns false -- before
+// touching *context -- if the file doesn't match, in which case the caller
+// falls back to rply; after validation it always returns true and reports
+// data errors through context->error, like the callback path.
+static bool ReadBinaryPLY(const std::string &filename,
+                          const std::string &contents,
+                          CallbackContext *context, long *vertexCountOut,
+                          long *faceCountOut) {
+    size_t endHeader = contents.find("end_header");
+    if (endHeader == std::string::npos) return false;
+    size_t dataOffset = contents.find('\n', endHeader);
+    if (dataOffset == std::string::npos) return false;
+    ++dataOffset;
+
+    // Parse the header; bail out to rply on anything unexpected.
+    std::istringstream header(contents.substr(0, dataOffset));
+    std::string line;
+    if (!std::getline(header, line) || line.compare(0, 3, "ply") != 0)
+        return false;
+    long vertexCount = 0, faceCount = 0;
+    std::vector<std::string> vertexProps;
+    bool haveFormat = false, inVertex = false, inFace = false,
+         haveFaceList = false;
+    while (std::getline(header, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        std::istringstream ls(line);
+        std::string word;
+        ls >> word;
+        if (word == "format") {
+            std::string fmt, version;
+            ls >> fmt >> version;
+            if (fmt != "binary_little_endian" || version != "1.0")
+                return false;
+            haveFormat = true;
+        } else if (word == "comment" || word == "obj_info") {
+            // ignored
+        } else if (word == "element") {
+            std::string name;
+            long n;
+            ls >> name >> n;
+            if (name == "vertex" && !inVertex && !inFace) {
+                inVertex = true;
+                vertexCount = n;
+            } else if (name == "face" && inVertex && !inFace) {
+                inVertex = false;
+                inFace = true;
+                faceCount = n;
+            } else
+                return false;
+        } else if (word == "property") {
+            std::string type;
+            ls >> type;
+            if (inVertex) {
+                if (type != "float" && type != "float32") return false;
+                std::string name;
+                ls >> name;
+                vertexProps.push_back(name);
+            } else if (inFace) {
+                std::string countType, indexType, name;
+                ls >> countType >> indexType >> name;
+                if (haveFaceList || type != "list" ||
+                    (countType != "uchar" && countType != "uint8") ||
+                    (indexType != "int" && indexType != "int32" &&
+                     indexType != "uint" && indexType != "uint32") ||
+                    name != "vertex_indices")
+                    return false;
+                haveFaceList = true;
+            } else
+                return false;
+        } else if (word == "end_header")
+            break;
+        else
+            return false;
+    }
+    if (!haveFormat || !haveFaceList || vertexCount <= 0 || faceCount <= 0)
+        return false;
+
+    // Locate the x/y/z, nx/ny/nz, and UV property triples/pairs, requiring
+    // each group to be consecutive so it can be copied as a block.
+    auto propOffset = [&vertexProps](const char *a, const char *b,
+                                     const char *cc = nullptr) {
+        for (size_t i = 0; i < vertexProps.size(); ++i)
+            if (vertexProps[i] == a) {
+                if (i + 1 >= vertexProps.size() || vertexProps[i + 1] != b)
+                    return -2;
+                if (cc && (i + 2 >= vertexProps.size() ||
+                           vertexProps[i + 2] != cc))
+                    return -2;
+                return int(i);
+            }
+        return -1;  // not present
+    };
+    int xOffset = propOffset("x", "y", "z");
+    int nxOffset = propOffset("nx", "ny", "nz");
+    int uvOffset = propOffset("u", "v");
+    if (uvOffset == -1) uvOffset = propOffset("s", "t");
+    if (uvOffset == -1) uvOffset = propOffset("texture_u", "texture_v");
+    if (uvOffset == -1) uvOffset = propOffset("texture_s", "texture_t");
+    if (xOffset < 0 || nxOffset == -2 || uvOffset == -2) return false;
+
+    size_t vertexStride = 4 * vertexProps.size();
+    if (contents.size() - dataOffset < (size_t)vertexCount * vertexStride)
+        return false;
+
+    // The layout is supported; commit to the fast path. Bulk-convert the
+    // vertex block...
+    const char *data = contents.data() + dataOffset;
+    context->p = new Point3f[vertexCount];
+    if (nxOffset >= 0) context->n = new Normal3f[vertexCount];
+    if (uvOffset >= 0) context->uv = new Point2f[vertexCount];
+    context->vertexCount = vertexCount;
+    for (long i = 0; i < vertexCount; ++i) {
+        const char *v = data + i * vertexStride;
+        float f[3];
+        memcpy(f, v + 4 * xOffset, 3 * sizeof(float));
+        context->p[i] = Point3f(f[0], f[1], f[2]);
+        if (nxOffset >= 0) {
+            memcpy(f, v + 4 * nxOffset, 3 * sizeof(float));
+            context->n[i] = Normal3f(f[0], f[1], f[2]);
+        }
+        if (uvOffset >= 0) {
+            memcpy(f, v + 4 * uvOffset, 2 * sizeof(float));
+            context->uv[i] = Point2f(f[0], f[1]);
+        }
+    }
+
+    // ...then walk the face block, triangulating quads the same way the
+    // callback path does.
+    const char *fptr = data + (size_t)vertexCount * vertexStride;
+    const char *fend = contents.data() + contents.size();
+    context->indices = new int[faceCount * 6];
+    for (long i = 0; i < faceCount; ++i) {
+        if (fptr == fend) {
+            Error("%s: PLY file is truncated", filename.c_str());
+            context->error = true;
+            break;
+        }
+        int count = (unsigned char)*fptr++;
+        if (fend - fptr < 4 * count) {
+            Error("%s: PLY file is truncated", filename.c_str());
+            context->error = true;
+            break;
+        }
+        if (count != 3 && count != 4) {
+            Warning("plymesh: Ignoring face with %i vertices (only triangles "
+                    "and quads are supported!)",
+                    count);
+            fptr += 4 * count;
+            continue;
+        }
+        int32_t face[4];
+        memcpy(face, fptr, 4 * count);
+        fptr += 4 * count;
+        for (int j = 0; j < count; ++j)
+            if (face[j] < 0 || face[j] >= vertexCount) {
+                Error(
+                    "plymesh: Vertex reference %i is out of bounds! "
+                    "Valid range is [0..%i)",
+                    face[j], (int)vertexCount);
+                context->error = true;
+            }
+        for (int j = 0; j < 3; ++j)
+            context->indices[context->indexCtr++] = face[j];
+        if (count == 4) {
+            /* This was a quad */
+            context->indices[context->indexCtr++] = face[3];
+            context->indices[context->indexCtr++] = face[0];
+            context->indices[context->indexCtr++] = face[2];
+        }
+    }
+
+    *vertexCountOut = vertexCount;
+    *faceCountOut = faceCount;
+    return true;
+}
+
 std::vector<std::shared_ptr<Shape>> CreatePLYMesh(
     const Transform *o2w, const Transform *w2o, bool reverseOrientation,
     const ParamSet &params,
     std::map<std::string, std::shared_ptr<Texture<Float>>> *floatTextures) {
     const std::string filename = params.FindOneFilename("filename", "");
-    p_ply ply = ply_open(filename.c_str(), rply_message_callback, 0, nullptr);
-    if (!ply) {
-        Error("Couldn't open PLY file \"%s\"", filename.c_str());
-        return std::vector<std::shared_ptr<Shape>>();
-    }
-
-    if (!ply_read_header(ply)) {
-        Error("Unable to read the header of PLY file \"%s\"", filename.c_str());
-        return std::vector<std::shared_ptr<Shape>>();
+    // Whole-file contents, filled either for the bulk-read fast path or
+    // (for compressed inputs) to back the rply stream; must stay alive
+    // until ply_close().
+    std::string contents;
+    if (IsCompressedFile(filename)) {
+        if (!DecompressFile(filename, &contents)) {
+            Error("Couldn't decompress PLY file \"%s\"", filename.c_str());
+            return std::vector<std::shared_ptr<Shape>>();
+        }
+    } else {
+        // Probe the header and slurp the file only if it looks like a
+        // binary little-endian PLY that the fast path may handle.
+        FILE *f = fopen(filename.c_str(), "rb");
+        if (f) {
+            char probe[256];
+            size_t n = fread(probe, 1, sizeof(probe), f);
+            if (n >= 3 && memcmp(probe, "ply", 3) == 0 &&
+                std::string(probe, n).find("binary_little_endian") !=
+                    std::string::npos &&
+                fseek(f, 0, SEEK_END) == 0) {
+                long size = ftell(f);
+                if (size > 0) {
+                    contents.resize(size);
+                    rewind(f);
+                    if (fread(&contents[0], 1, size, f) != (size_t)size)
+                        contents.clear();
+                }
+            }
+            fclose(f);
+        }
     }
 
-    p_ply_element element = nullptr;
+    CallbackContext context;
     long vertexCount = 0, faceCount = 0;
+    bool bulkRead =
+        !contents.empty() &&
+        ReadBinaryPLY(filename, contents, &context, &vertexCount, &faceCount);
+
+    if (!bulkRead) {
+        p_ply ply;
+        if (IsCompressedFile(filename)) {
+#ifdef PBRT_IS_WINDOWS
+            // No fmemopen(); spill the decompressed bytes to a temporary
+            // file.
+            FILE *f = tmpfile();
+            if (f && contents.size() > 0 &&
+                fwrite(contents.data(), 1, contents.size(), f) !=
+                    contents.size()) {
+                fclose(f);
+                f = nullptr;
+            }
+            if (f) rewind(f);
+#else
+            FILE *f =
+                fmemopen((void *)contents.data(), contents.size(), "rb");
+#endif
+            if (!f) {
+                Error("Couldn't buffer decompressed PLY file \"%s\"",
+                      filename.c_str());
+                return std::vector<std::shared_ptr<Shape>>();
+            }
+            ply = ply_open_from_file(f, rply_message_callback, 0, nullptr);
+        } else
+            ply = ply_open(filename.c_str(), rply_message_callback, 0,
+                           nullptr);
+        if (!ply) {
+            Error("Couldn't open PLY file \"%s\"", filename.c_str());
+            return std::vector<std::shared_ptr<Shape>>();
+        }
 
-    /* Inspect the structure of the PLY file */
-    while ((element = ply_get_next_element(ply, element)) != nullptr) {
-        const char *name;
-        long nInstances;
+        if (!ply_read_header(ply)) {
+            Error("Unable to read the header of PLY file \"%s\"",
+                  filename.c_str());
+            return std::vector<std::shared_ptr<Shape>>();
+        }
 
-        ply_get_element_info(element, &name, &nInstances);
-        if (!strcmp(name, "vertex"))
-            vertexCount = nInstances;
-        else if (!strcmp(name, "face"))
-            faceCount = nInstances;
-    }
+        p_ply_element element = nullptr;
 
-    if (vertexCount == 0 || faceCount == 0) {
-        Error("%s: PLY file is invalid! No face/vertex elements found!",
-              filename.c_str());
-        return std::vector<std::shared_ptr<Shape>>();
-    }
+        /* Inspect the structure of the PLY file */
+        while ((element = ply_get_next_element(ply, element)) != nullptr) {
+            const char *name;
+            long nInstances;
 
-    CallbackContext context;
+            ply_get_element_info(element, &name, &nInstances);
+            if (!strcmp(name, "vertex"))
+                vertexCount = nInstances;
+            else if (!strcmp(name, "face"))
+                faceCount = nInstances;
+        }
 
-    if (ply_set_read_cb(ply, "vertex", "x", rply_vertex_callback, &context,
-                        0x030) &&
-        ply_set_read_cb(ply, "vertex", "y", rply_vertex_callback, &context,
-                        0x031) &&
-        ply_set_read_cb(ply, "vertex", "z", rply_vertex_callback, &context,
-                        0x032)) {
-        context.p = new Point3f[vertexCount];
-    } else {
-        Error("%s: Vertex coordinate property not found!",
-              filename.c_str());
-        return std::vector<std::shared_ptr<Shape>>();
-    }
+        if (vertexCount == 0 || faceCount == 0) {
+            Error("%s: PLY file is invalid! No face/vertex elements found!",
+                  filename.c_str());
+            return std::vector<std::shared_ptr<Shape>>();
+        }
+
+        if (ply_set_read_cb(ply, "vertex", "x", rply_vertex_callback,
+                            &context, 0x030) &&
+            ply_set_read_cb(ply, "vertex", "y", rply_vertex_callback,
+                            &context, 0x031) &&
+            ply_set_read_cb(ply, "vertex", "z", rply_vertex_callback,
+                            &context, 0x032)) {
+            context.p = new Point3f[vertexCount];
+        } else {
+            Error("%s: Vertex coordinate property not found!",
+                  filename.c_str());
+            return std::vector<std::shared_ptr<Shape>>();
+        }
+
+        if (ply_set_read_cb(ply, "vertex", "nx", rply_vertex_callback,
+                            &context, 0x130) &&
+            ply_set_read_cb(ply, "vertex", "ny", rply_vertex_callback,
+                            &context, 0x131) &&
+            ply_set_read_cb(ply, "vertex", "nz", rply_vertex_callback,
+                            &context, 0x132))
+            context.n = new Normal3f[vertexCount];
+
+        /* There seem to be lots of different conventions regarding UV
+         * coordinate names */
+        if ((ply_set_read_cb(ply, "vertex", "u", rply_vertex_callback,
+                             &context, 0x220) &&
+             ply_set_read_cb(ply, "vertex", "v", rply_vertex_callback,
+                             &context, 0x221)) ||
+            (ply_set_read_cb(ply, "vertex", "s", rply_vertex_callback,
+                             &context, 0x220) &&
+             ply_set_read_cb(ply, "vertex", "t", rply_vertex_callback,
+                             &context, 0x221)) ||
+            (ply_set_read_cb(ply, "vertex", "texture_u", rply_vertex_callback,
+                             &context, 0x220) &&
+             ply_set_read_cb(ply, "vertex", "texture_v", rply_vertex_callback,
+                             &context, 0x221)) ||
+            (ply_set_read_cb(ply, "vertex", "texture_s", rply_vertex_callback,
+                             &context, 0x220) &&
+             ply_set_read_cb(ply, "vertex", "texture_t", rply_vertex_callback,
+                             &context, 0x221)))
+            context.uv = new Point2f[vertexCount];
+
+        /* Allocate enough space in case all faces are quads */
+        context.indices = new int[faceCount * 6];
+        context.vertexCount = vertexCount;
+
+        ply_set_read_cb(ply, "face", "vertex_indices", rply_face_callback,
+                        &context, 0);
+        if (ply_set_read_cb(ply, "face", "face_indices", rply_face_callback,
+                            &context, 1))
+            // Extra space in case they're quads
+            context.faceIndices = new int[faceCount];
+
+        if (!ply_read(ply)) {
+            Error("%s: unable to read the contents of PLY file",
+                  filename.c_str());
+            ply_close(ply);
+            return std::vector<std::shared_ptr<Shape>>();
+        }
 
-    if (ply_set_read_cb(ply, "vertex", "nx", rply_vertex_callback, &context,
-                        0x130) &&
-        ply_set_read_cb(ply, "vertex", "ny", rply_vertex_callback, &context,
-                        0x131) &&
-        ply_set_read_cb(ply, "vertex", "nz", rply_vertex_callback, &context,
-                        0x132))
-        context.n = new Normal3f[vertexCount];
-
-    /* There seem to be lots of different conventions regarding UV coordinate
-     * names */
-    if ((ply_set_read_cb(ply, "vertex", "u", rply_vertex_callback, &context,
-                         0x220) &&
-         ply_set_read_cb(ply, "vertex", "v", rply_vertex_callback, &context,
-                         0x221)) ||
-        (ply_set_read_cb(ply, "vertex", "s", rply_vertex_callback, &context,
-                         0x220) &&
-         ply_set_read_cb(ply, "vertex", "t", rply_vertex_callback, &context,
-                         0x221)) ||
-        (ply_set_read_cb(ply, "vertex", "texture_u", rply_vertex_callback,
-                         &context, 0x220) &&
-         ply_set_read_cb(ply, "vertex", "texture_v", rply_vertex_callback,
-                         &context, 0x221)) ||
-        (ply_set_read_cb(ply, "vertex", "texture_s", rply_vertex_callback,
-                         &context, 0x220) &&
-         ply_set_read_cb(ply, "vertex", "texture_t", rply_vertex_callback,
-                         &context, 0x221)))
-        context.uv = new Point2f[vertexCount];
-
-    /* Allocate enough space in case all faces are quads */
-    context.indices = new int[faceCount * 6];
-    context.vertexCount = vertexCount;
-
-    ply_set_read_cb(ply, "face", "vertex_indices", rply_face_callback, &context,
-                    0);
-    if (ply_set_read_cb(ply, "face", "face_indices", rply_face_callback, &context,
-                        1))
-        // Extra space in case they're quads
-        context.faceIndices = new int[faceCount];
-
-    if (!ply_read(ply)) {
-        Error("%s: unable to read the contents of PLY file",
-              filename.c_str());
         ply_close(ply);
-        return std::vector<std::shared_ptr<Shape>>();
     }
 
-    ply_close(ply);
-
     if (context.error) return std::vector<std::shared_ptr<Shape>>();
 
     // Look up an alpha texture, if applicable
@@ -282,11 +528,21 @@ std::vector<std::shared_ptr<Shape>> CreatePLYMesh(
     } else if (params.FindOneFloat("shadowalpha", 1.f) == 0.f)
         shadowAlphaTex.reset(new ConstantTexture<Float>(0.f));
 
+    // Parse compact vertex attribute storage options
+    bool compactAttributes = params.FindOneBool("compactattributes", false);
+    bool compactPositions = params.FindOneBool("compactpositions", false);
+    if (compactPositions && !compactAttributes) {
+        Warning(
+            "\"compactpositions\" requires \"compactattributes\"; ignoring.");
+        compactPositions = false;
+    }
+
     return CreateTriangleMesh(o2w, w2o, reverseOrientation,
                               context.indexCtr / 3, context.indices,
                               vertexCount, context.p, nullptr, context.n,
                               context.uv, alphaTex, shadowAlphaTex,
-                              context.faceIndices);
+                              context.faceIndices, compactAttributes,
+                              compactPositions);
 }
 
 }  // namespace pbrt
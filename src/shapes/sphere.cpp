@@ -38,8 +38,87 @@
 #include "efloat.h"
 #include "stats.h"
 
+// The batched kernels below process eight rays or samples at a time with
+// AVX; definite misses are culled with conservative float arithmetic and
+// the survivors fall back to the exact single-ray EFloat test.
+#if defined(__AVX__) && !defined(PBRT_FLOAT_AS_DOUBLE)
+#include <immintrin.h>
+#define PBRT_QUADRIC_HAVE_AVX
+#endif
+
 namespace pbrt {
 
+STAT_PERCENT("Intersections/Quadric exact EFloat solves", nEFloatQuadrics,
+             nQuadricSolves);
+
+// Solve the sphere quadratic for the object-space _ray_, returning the
+// roots as plain floats together with the definitive outcomes of their
+// tests against the $(0, \mathit{tMax})$ range.  A fast non-conservative
+// float solve is tried first; only when its result lands within its error
+// slop of the discriminant's sign or of a range boundary is the solve
+// redone with the exact _EFloat_ arithmetic, so the conservative path's
+// robustness guarantees are kept while the common case avoids its cost.
+static bool SphereQuadratic(const Ray &ray, const Vector3f &oErr,
+                            const Vector3f &dErr, Float radius, Float *t0,
+                            Float *t1, bool *t0Pos, bool *t0BelowMax,
+                            bool *t1Pos, bool *t1BelowMax) {
+    ++nQuadricSolves;
+    Float ox = ray.o.x, oy = ray.o.y, oz = ray.o.z;
+    Float dx = ray.d.x, dy = ray.d.y, dz = ray.d.z;
+    Float a = dx * dx + dy * dy + dz * dz;
+    Float b = 2 * (dx * ox + dy * oy + dz * oz);
+    Float c = ox * ox + oy * oy + oz * oz - radius * radius;
+
+    // Bound the coefficients' absolute error: the transform's returned
+    // per-component bounds propagated through the products, plus a
+    // generous relative term for the rounding of the sums themselves
+    const Float qEps = 1e-4f;
+    Float aErr = 2 * (std::abs(dx) * dErr.x + std::abs(dy) * dErr.y +
+                      std::abs(dz) * dErr.z) +
+                 qEps * a;
+    Float bErr = 2 * (std::abs(dx) * oErr.x + std::abs(ox) * dErr.x +
+                      std::abs(dy) * oErr.y + std::abs(oy) * dErr.y +
+                      std::abs(dz) * oErr.z + std::abs(oz) * dErr.z) +
+                 qEps * 2 *
+                     (std::abs(dx * ox) + std::abs(dy * oy) + std::abs(dz * oz));
+    Float cErr = 2 * (std::abs(ox) * oErr.x + std::abs(oy) * oErr.y +
+                      std::abs(oz) * oErr.z) +
+                 qEps * (ox * ox + oy * oy + oz * oz + radius * radius);
+
+    // Accept the fast solve if every consulted comparison is definitive
+    bool hasRoots;
+    Float tSlop;
+    if (QuadraticFast(a, b, c, aErr, bErr, cErr, &hasRoots, t0, t1, &tSlop)) {
+        if (!hasRoots) return false;
+        if (std::abs(*t0) > tSlop && std::abs(*t0 - ray.tMax) > tSlop &&
+            std::abs(*t1) > tSlop && std::abs(*t1 - ray.tMax) > tSlop) {
+            *t0Pos = *t0 > 0;
+            *t0BelowMax = *t0 < ray.tMax;
+            *t1Pos = *t1 > 0;
+            *t1BelowMax = *t1 < ray.tMax;
+            return true;
+        }
+    }
+
+    // Fall back to the conservative _EFloat_ solve
+    ++nEFloatQuadrics;
+    EFloat eox(ox, oErr.x), eoy(oy, oErr.y), eoz(oz, oErr.z);
+    EFloat edx(dx, dErr.x), edy(dy, dErr.y), edz(dz, dErr.z);
+    EFloat ea = edx * edx + edy * edy + edz * edz;
+    EFloat eb = 2 * (edx * eox + edy * eoy + edz * eoz);
+    EFloat ec = eox * eox + eoy * eoy + eoz * eoz -
+                EFloat(radius) * EFloat(radius);
+    EFloat et0, et1;
+    if (!Quadratic(ea, eb, ec, &et0, &et1)) return false;
+    *t0 = (Float)et0;
+    *t1 = (Float)et1;
+    *t0Pos = et0.LowerBound() > 0;
+    *t0BelowMax = !(et0.UpperBound() > ray.tMax);
+    *t1Pos = et1.LowerBound() > 0;
+    *t1BelowMax = !(et1.UpperBound() > ray.tMax);
+    return true;
+}
+
 // Sphere Method Definitions
 Bounds3f Sphere::ObjectBound() const {
     return Bounds3f(Point3f(-radius, -radius, zMin),
@@ -55,29 +134,23 @@ bool Sphere::Intersect(const Ray &r, Float *tHit, SurfaceInteraction *isect,
     Vector3f oErr, dErr;
     Ray ray = (*WorldToObject)(r, &oErr, &dErr);
 
-    // Compute quadratic sphere coefficients
-
-    // Initialize _EFloat_ ray coordinate values
-    EFloat ox(ray.o.x, oErr.x), oy(ray.o.y, oErr.y), oz(ray.o.z, oErr.z);
-    EFloat dx(ray.d.x, dErr.x), dy(ray.d.y, dErr.y), dz(ray.d.z, dErr.z);
-    EFloat a = dx * dx + dy * dy + dz * dz;
-    EFloat b = 2 * (dx * ox + dy * oy + dz * oz);
-    EFloat c = ox * ox + oy * oy + oz * oz - EFloat(radius) * EFloat(radius);
-
     // Solve quadratic equation for _t_ values
-    EFloat t0, t1;
-    if (!Quadratic(a, b, c, &t0, &t1)) return false;
+    Float t0, t1;
+    bool t0Pos, t0BelowMax, t1Pos, t1BelowMax;
+    if (!SphereQuadratic(ray, oErr, dErr, radius, &t0, &t1, &t0Pos,
+                         &t0BelowMax, &t1Pos, &t1BelowMax))
+        return false;
 
     // Check quadric shape _t0_ and _t1_ for nearest intersection
-    if (t0.UpperBound() > ray.tMax || t1.LowerBound() <= 0) return false;
-    EFloat tShapeHit = t0;
-    if (tShapeHit.LowerBound() <= 0) {
+    if (!t0BelowMax || !t1Pos) return false;
+    Float tShapeHit = t0;
+    if (!t0Pos) {
         tShapeHit = t1;
-        if (tShapeHit.UpperBound() > ray.tMax) return false;
+        if (!t1BelowMax) return false;
     }
 
     // Compute sphere hit position and $\phi$
-    pHit = ray((Float)tShapeHit);
+    pHit = ray(tShapeHit);
 
     // Refine sphere intersection point
     pHit *= radius / Distance(pHit, Point3f(0, 0, 0));
@@ -89,10 +162,10 @@ bool Sphere::Intersect(const Ray &r, Float *tHit, SurfaceInteraction *isect,
     if ((zMin > -radius && pHit.z < zMin) || (zMax < radius && pHit.z > zMax) ||
         phi > phiMax) {
         if (tShapeHit == t1) return false;
-        if (t1.UpperBound() > ray.tMax) return false;
+        if (!t1BelowMax) return false;
         tShapeHit = t1;
         // Compute sphere hit position and $\phi$
-        pHit = ray((Float)tShapeHit);
+        pHit = ray(tShapeHit);
 
         // Refine sphere intersection point
         pHit *= radius / Distance(pHit, Point3f(0, 0, 0));
@@ -151,7 +224,7 @@ bool Sphere::Intersect(const Ray &r, Float *tHit, SurfaceInteraction *isect,
                                                  ray.time, this));
 
     // Update _tHit_ for quadric intersection
-    *tHit = (Float)tShapeHit;
+    *tHit = tShapeHit;
     return true;
 }
 
@@ -163,29 +236,23 @@ bool Sphere::IntersectP(const Ray &r, bool testAlphaTexture) const {
     Vector3f oErr, dErr;
     Ray ray = (*WorldToObject)(r, &oErr, &dErr);
 
-    // Compute quadratic sphere coefficients
-
-    // Initialize _EFloat_ ray coordinate values
-    EFloat ox(ray.o.x, oErr.x), oy(ray.o.y, oErr.y), oz(ray.o.z, oErr.z);
-    EFloat dx(ray.d.x, dErr.x), dy(ray.d.y, dErr.y), dz(ray.d.z, dErr.z);
-    EFloat a = dx * dx + dy * dy + dz * dz;
-    EFloat b = 2 * (dx * ox + dy * oy + dz * oz);
-    EFloat c = ox * ox + oy * oy + oz * oz - EFloat(radius) * EFloat(radius);
-
     // Solve quadratic equation for _t_ values
-    EFloat t0, t1;
-    if (!Quadratic(a, b, c, &t0, &t1)) return false;
+    Float t0, t1;
+    bool t0Pos, t0BelowMax, t1Pos, t1BelowMax;
+    if (!SphereQuadratic(ray, oErr, dErr, radius, &t0, &t1, &t0Pos,
+                         &t0BelowMax, &t1Pos, &t1BelowMax))
+        return false;
 
     // Check quadric shape _t0_ and _t1_ for nearest intersection
-    if (t0.UpperBound() > ray.tMax || t1.LowerBound() <= 0) return false;
-    EFloat tShapeHit = t0;
-    if (tShapeHit.LowerBound() <= 0) {
+    if (!t0BelowMax || !t1Pos) return false;
+    Float tShapeHit = t0;
+    if (!t0Pos) {
         tShapeHit = t1;
-        if (tShapeHit.UpperBound() > ray.tMax) return false;
+        if (!t1BelowMax) return false;
     }
 
     // Compute sphere hit position and $\phi$
-    pHit = ray((Float)tShapeHit);
+    pHit = ray(tShapeHit);
 
     // Refine sphere intersection point
     pHit *= radius / Distance(pHit, Point3f(0, 0, 0));
@@ -197,10 +264,10 @@ bool Sphere::IntersectP(const Ray &r, bool testAlphaTexture) const {
     if ((zMin > -radius && pHit.z < zMin) || (zMax < radius && pHit.z > zMax) ||
         phi > phiMax) {
         if (tShapeHit == t1) return false;
-        if (t1.UpperBound() > ray.tMax) return false;
+        if (!t1BelowMax) return false;
         tShapeHit = t1;
         // Compute sphere hit position and $\phi$
-        pHit = ray((Float)tShapeHit);
+        pHit = ray(tShapeHit);
 
         // Refine sphere intersection point
         pHit *= radius / Distance(pHit, Point3f(0, 0, 0));
@@ -214,6 +281,105 @@ bool Sphere::IntersectP(const Ray &r, bool testAlphaTexture) const {
     return true;
 }
 
+bool Sphere::HasBatchedIntersectP() const {
+#ifdef PBRT_QUADRIC_HAVE_AVX
+    return true;
+#else
+    return false;
+#endif
+}
+
+void Sphere::IntersectPN(const Ray *rays, int n, bool *hits,
+                         bool testAlphaTexture) const {
+#ifndef PBRT_QUADRIC_HAVE_AVX
+    Shape::IntersectPN(rays, n, hits, testAlphaTexture);
+#else
+    ProfilePhase p(Prof::ShapeIntersectP);
+    for (int base = 0; base < n; base += 8) {
+        int m = std::min(8, n - base);
+        // Transform the rays to object space, in SoA order; lanes past
+        // the end of the span repeat the first ray.
+        float ox[8], oy[8], oz[8], dx[8], dy[8], dz[8], tMax[8];
+        for (int k = 0; k < 8; ++k) {
+            Ray r = (*WorldToObject)(rays[base + (k < m ? k : 0)]);
+            ox[k] = r.o.x;
+            oy[k] = r.o.y;
+            oz[k] = r.o.z;
+            dx[k] = r.d.x;
+            dy[k] = r.d.y;
+            dz[k] = r.d.z;
+            tMax[k] = r.tMax;
+        }
+
+        // Conservative eight-wide quadratic cull. A lane is a definite
+        // miss when the discriminant is clearly negative, the ray clearly
+        // starts outside the sphere pointing away from it, or the nearest
+        // root clearly lies beyond _tMax_. The slop terms bound the float
+        // rounding error by a wide margin, so any lane the exact EFloat
+        // test might accept survives to the single-ray IntersectP() call
+        // below, which remains the final arbiter.
+        __m256 oxv = _mm256_loadu_ps(ox), oyv = _mm256_loadu_ps(oy),
+               ozv = _mm256_loadu_ps(oz);
+        __m256 dxv = _mm256_loadu_ps(dx), dyv = _mm256_loadu_ps(dy),
+               dzv = _mm256_loadu_ps(dz);
+        __m256 av = _mm256_add_ps(
+            _mm256_add_ps(_mm256_mul_ps(dxv, dxv), _mm256_mul_ps(dyv, dyv)),
+            _mm256_mul_ps(dzv, dzv));
+        __m256 bxv = _mm256_mul_ps(oxv, dxv), byv = _mm256_mul_ps(oyv, dyv),
+               bzv = _mm256_mul_ps(ozv, dzv);
+        __m256 bv = _mm256_mul_ps(_mm256_set1_ps(2.f),
+                                  _mm256_add_ps(_mm256_add_ps(bxv, byv), bzv));
+        __m256 oov = _mm256_add_ps(
+            _mm256_add_ps(_mm256_mul_ps(oxv, oxv), _mm256_mul_ps(oyv, oyv)),
+            _mm256_mul_ps(ozv, ozv));
+        __m256 r2v = _mm256_set1_ps(radius * radius);
+        __m256 cv = _mm256_sub_ps(oov, r2v);
+        __m256 b2v = _mm256_mul_ps(bv, bv);
+        __m256 fourAC = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(4.f), av),
+                                      cv);
+        __m256 disc = _mm256_sub_ps(b2v, fourAC);
+        const __m256 eps = _mm256_set1_ps(1e-3f);
+        const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+        __m256 discSlop = _mm256_mul_ps(
+            eps, _mm256_add_ps(b2v, _mm256_and_ps(fourAC, absMask)));
+        __m256 discHi = _mm256_add_ps(disc, discSlop);
+        __m256 missDisc = _mm256_cmp_ps(discHi, _mm256_setzero_ps(),
+                                        _CMP_LT_OQ);
+        // Clearly outside and receding: $b > 0$ and $c > 0$ imply both
+        // roots are negative.
+        __m256 sumAbs = _mm256_add_ps(
+            _mm256_add_ps(_mm256_and_ps(bxv, absMask),
+                          _mm256_and_ps(byv, absMask)),
+            _mm256_and_ps(bzv, absMask));
+        __m256 bSlop = _mm256_mul_ps(eps, _mm256_mul_ps(_mm256_set1_ps(2.f),
+                                                        sumAbs));
+        __m256 cSlop = _mm256_mul_ps(eps, _mm256_add_ps(oov, r2v));
+        __m256 missAway = _mm256_and_ps(
+            _mm256_cmp_ps(bv, bSlop, _CMP_GT_OQ),
+            _mm256_cmp_ps(cv, cSlop, _CMP_GT_OQ));
+        // Nearest root clearly past the end of the ray
+        __m256 rootDisc =
+            _mm256_sqrt_ps(_mm256_max_ps(discHi, _mm256_setzero_ps()));
+        __m256 inv2a = _mm256_div_ps(
+            _mm256_set1_ps(1.f), _mm256_mul_ps(_mm256_set1_ps(2.f), av));
+        __m256 num = _mm256_sub_ps(_mm256_sub_ps(_mm256_setzero_ps(), bv),
+                                   rootDisc);
+        __m256 tNear = _mm256_mul_ps(num, inv2a);
+        __m256 tSlop = _mm256_mul_ps(
+            eps, _mm256_mul_ps(
+                     _mm256_add_ps(_mm256_and_ps(bv, absMask), rootDisc),
+                     _mm256_and_ps(inv2a, absMask)));
+        __m256 missFar = _mm256_cmp_ps(_mm256_sub_ps(tNear, tSlop),
+                                       _mm256_loadu_ps(tMax), _CMP_GT_OQ);
+        int miss = _mm256_movemask_ps(
+            _mm256_or_ps(_mm256_or_ps(missDisc, missAway), missFar));
+        for (int k = 0; k < m; ++k)
+            hits[base + k] = !(miss & (1 << k)) &&
+                             IntersectP(rays[base + k], testAlphaTexture);
+    }
+#endif
+}
+
 Float Sphere::Area() const { return phiMax * radius * (zMax - zMin); }
 
 Interaction Sphere::Sample(const Point2f &u, Float *pdf) const {
@@ -300,6 +466,106 @@ Interaction Sphere::Sample(const Interaction &ref, const Point2f &u,
     return it;
 }
 
+void Sphere::SampleN(const Interaction &ref, const Point2f *u, int n,
+                     Interaction *its, Float *pdf) const {
+#ifndef PBRT_QUADRIC_HAVE_AVX
+    Shape::SampleN(ref, u, n, its, pdf);
+#else
+    Point3f pCenter = (*ObjectToWorld)(Point3f(0, 0, 0));
+    Point3f pOrigin =
+        OffsetRayOrigin(ref.p, ref.pError, ref.n, pCenter - ref.p);
+    // Fall back to the scalar path for reference points inside the
+    // sphere, which sample the whole surface by area instead of the cone.
+    if (DistanceSquared(pOrigin, pCenter) <= radius * radius) {
+        Shape::SampleN(ref, u, n, its, pdf);
+        return;
+    }
+
+    // Hoist the per-reference-point setup of Sample() out of the loop
+    Float dc = Distance(ref.p, pCenter);
+    Float invDc = 1 / dc;
+    Vector3f wc = (pCenter - ref.p) * invDc;
+    Vector3f wcX, wcY;
+    CoordinateSystem(wc, &wcX, &wcY);
+    Float sinThetaMax = radius * invDc;
+    Float sinThetaMax2 = sinThetaMax * sinThetaMax;
+    Float invSinThetaMax = 1 / sinThetaMax;
+    Float cosThetaMax = std::sqrt(std::max((Float)0.f, 1 - sinThetaMax2));
+    bool smallAngle = sinThetaMax2 < 0.00068523f /* sin^2(1.5 deg) */;
+    Float pdfVal = 1 / (2 * Pi * (1 - cosThetaMax));
+
+    for (int base = 0; base < n; base += 8) {
+        int m = std::min(8, n - base);
+        // Gather sample values; $\phi$ trigonometry stays scalar since
+        // there is no AVX sin/cos. Lanes past the span repeat sample 0.
+        float u0[8], cosPhi[8], sinPhi[8];
+        for (int k = 0; k < 8; ++k) {
+            const Point2f &uk = u[base + (k < m ? k : 0)];
+            u0[k] = uk[0];
+            Float phi = uk[1] * 2 * Pi;
+            cosPhi[k] = std::cos(phi);
+            sinPhi[k] = std::sin(phi);
+        }
+
+        // Compute $\theta$ and $\phi$ values for eight cone samples
+        __m256 u0v = _mm256_loadu_ps(u0);
+        __m256 one = _mm256_set1_ps(1.f), zero = _mm256_setzero_ps();
+        __m256 cosTheta, sinTheta2;
+        if (!smallAngle) {
+            cosTheta = _mm256_add_ps(
+                _mm256_mul_ps(_mm256_set1_ps(cosThetaMax - 1), u0v), one);
+            sinTheta2 =
+                _mm256_sub_ps(one, _mm256_mul_ps(cosTheta, cosTheta));
+        } else {
+            // Taylor series fallback for small angles, as in Sample()
+            sinTheta2 = _mm256_mul_ps(_mm256_set1_ps(sinThetaMax2), u0v);
+            cosTheta = _mm256_sqrt_ps(_mm256_sub_ps(one, sinTheta2));
+        }
+
+        // Compute angle $\alpha$ from center of sphere to sampled points
+        __m256 cosAlpha = _mm256_add_ps(
+            _mm256_mul_ps(sinTheta2, _mm256_set1_ps(invSinThetaMax)),
+            _mm256_mul_ps(
+                cosTheta,
+                _mm256_sqrt_ps(_mm256_max_ps(
+                    zero,
+                    _mm256_sub_ps(
+                        one, _mm256_mul_ps(sinTheta2,
+                                           _mm256_set1_ps(invSinThetaMax *
+                                                          invSinThetaMax)))))));
+        __m256 sinAlpha = _mm256_sqrt_ps(_mm256_max_ps(
+            zero, _mm256_sub_ps(one, _mm256_mul_ps(cosAlpha, cosAlpha))));
+
+        // Compute surface normals and sampled points on the sphere,
+        // $\w{} = -(\sin\alpha \cos\phi \, \wcX + \sin\alpha \sin\phi \,
+        // \wcY + \cos\alpha \, \wc)$
+        __m256 sc = _mm256_mul_ps(sinAlpha, _mm256_loadu_ps(cosPhi));
+        __m256 ss = _mm256_mul_ps(sinAlpha, _mm256_loadu_ps(sinPhi));
+        float nx[8], ny[8], nz[8];
+        for (int axis = 0; axis < 3; ++axis) {
+            __m256 nv = _mm256_sub_ps(
+                zero,
+                _mm256_add_ps(
+                    _mm256_add_ps(
+                        _mm256_mul_ps(sc, _mm256_set1_ps(wcX[axis])),
+                        _mm256_mul_ps(ss, _mm256_set1_ps(wcY[axis]))),
+                    _mm256_mul_ps(cosAlpha, _mm256_set1_ps(wc[axis]))));
+            _mm256_storeu_ps(axis == 0 ? nx : (axis == 1 ? ny : nz), nv);
+        }
+        for (int k = 0; k < m; ++k) {
+            Vector3f nWorld(nx[k], ny[k], nz[k]);
+            Interaction it;
+            it.p = pCenter + radius * Point3f(nWorld.x, nWorld.y, nWorld.z);
+            it.pError = gamma(5) * Abs((Vector3f)it.p);
+            it.n = Normal3f(nWorld);
+            if (reverseOrientation) it.n *= -1;
+            its[base + k] = it;
+            pdf[base + k] = pdfVal;
+        }
+    }
+#endif
+}
+
 Float Sphere::Pdf(const Interaction &ref, const Vector3f &wi) const {
     Point3f pCenter = (*ObjectToWorld)(Point3f(0, 0, 0));
     // Return uniform PDF if point is inside sphere
@@ -61,10 +61,15 @@ class Sphere : public Shape {
     bool Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
                    bool testAlphaTexture) const;
     bool IntersectP(const Ray &ray, bool testAlphaTexture) const;
+    void IntersectPN(const Ray *rays, int n, bool *hits,
+                     bool testAlphaTexture = true) const;
+    bool HasBatchedIntersectP() const;
     Float Area() const;
     Interaction Sample(const Point2f &u, Float *pdf) const;
     Interaction Sample(const Interaction &ref, const Point2f &u,
                        Float *pdf) const;
+    void SampleN(const Interaction &ref, const Point2f *u, int n,
+                 Interaction *its, Float *pdf) const;
     Float Pdf(const Interaction &ref, const Vector3f &wi) const;
     Float SolidAngle(const Point3f &p, int nSamples) const;
 
@@ -49,6 +49,80 @@ static void PlyErrorCallback(p_ply, const char *message) {
     Error("PLY writing error: %s", message);
 }
 
+STAT_PERCENT("Intersections/Alpha tests resolved by packed mask",
+             nAlphaMaskFast, nAlphaMaskTests);
+
+// Point sample _texture_ over _domain_ and classify each of the packed
+// mask's cells; see the comment in triangle.h for the conservative
+// neighborhood rule that decides which cells get a definite bit.
+static std::shared_ptr<PackedAlphaMask> BuildPackedAlphaMask(
+    const std::shared_ptr<Texture<Float>> &texture, Bounds2f domain) {
+    // The sweep below varies only si.uv, so it can only classify textures
+    // that are driven by uv alone; a texture reading si.p (planar or 3D
+    // mappings, procedural solid textures) would see a constant point and
+    // classify every cell as definite, silently disabling the cutout.
+    if (!texture->IsUVDriven()) return nullptr;
+    PBRT_CONSTEXPR int res = PackedAlphaMaskResolution;
+    PBRT_CONSTEXPR int samplesPerCell = 4;  // 4x4 grid per cell
+    // Guard against meshes whose UVs are degenerate along an axis
+    Vector2f extent = domain.Diagonal();
+    if (extent.x <= 0) domain.pMax.x = domain.pMin.x + 1;
+    if (extent.y <= 0) domain.pMax.y = domain.pMin.y + 1;
+    extent = domain.Diagonal();
+
+    // Classify each cell from a dense grid of point samples
+    std::vector<uint8_t> cellClass(res * res);
+    SurfaceInteraction si;
+    for (int y = 0; y < res; ++y)
+        for (int x = 0; x < res; ++x) {
+            bool anyZero = false, anyNonZero = false;
+            for (int sy = 0; sy < samplesPerCell; ++sy)
+                for (int sx = 0; sx < samplesPerCell; ++sx) {
+                    si.uv = domain.Lerp(
+                        Point2f((x + (sx + .5f) / samplesPerCell) / res,
+                                (y + (sy + .5f) / samplesPerCell) / res));
+                    // The interaction is reused across samples; drop any
+                    // values Scale/Mix textures memoized at the previous uv
+                    si.ClearTextureCache();
+                    if (texture->Evaluate(si) == 0)
+                        anyZero = true;
+                    else
+                        anyNonZero = true;
+                }
+            cellClass[y * res + x] =
+                anyZero ? (anyNonZero ? PackedAlphaMask::Mixed
+                                      : PackedAlphaMask::Transparent)
+                        : PackedAlphaMask::Opaque;
+        }
+
+    // Set a cell's definite bit only when its 3x3 neighborhood agrees
+    std::shared_ptr<PackedAlphaMask> mask =
+        std::make_shared<PackedAlphaMask>();
+    mask->domain = domain;
+    mask->cellScale = Vector2f(res / extent.x, res / extent.y);
+    memset(mask->transparentBits, 0, sizeof(mask->transparentBits));
+    memset(mask->opaqueBits, 0, sizeof(mask->opaqueBits));
+    for (int y = 0; y < res; ++y)
+        for (int x = 0; x < res; ++x) {
+            int cls = cellClass[y * res + x];
+            if (cls == PackedAlphaMask::Mixed) continue;
+            bool agree = true;
+            for (int dy = -1; dy <= 1 && agree; ++dy)
+                for (int dx = -1; dx <= 1 && agree; ++dx) {
+                    int nx = Clamp(x + dx, 0, res - 1);
+                    int ny = Clamp(y + dy, 0, res - 1);
+                    agree = cellClass[ny * res + nx] == cls;
+                }
+            if (!agree) continue;
+            int cell = y * res + x;
+            uint64_t *bits = cls == PackedAlphaMask::Transparent
+                                 ? mask->transparentBits
+                                 : mask->opaqueBits;
+            bits[cell >> 6] |= 1ull << (cell & 63);
+        }
+    return mask;
+}
+
 // Triangle Method Definitions
 STAT_RATIO("Scene/Triangles per triangle mesh", nTris, nMeshes);
 TriangleMesh::TriangleMesh(
@@ -56,7 +130,7 @@ TriangleMesh::TriangleMesh(
     int nVertices, const Point3f *P, const Vector3f *S, const Normal3f *N,
     const Point2f *UV, const std::shared_ptr<Texture<Float>> &alphaMask,
     const std::shared_ptr<Texture<Float>> &shadowAlphaMask,
-    const int *fIndices)
+    const int *fIndices, bool compactAttributes, bool compactPositions)
     : nTriangles(nTriangles),
       nVertices(nVertices),
       vertexIndices(vertexIndices, vertexIndices + 3 * nTriangles),
@@ -64,31 +138,206 @@ TriangleMesh::TriangleMesh(
       shadowAlphaMask(shadowAlphaMask) {
     ++nMeshes;
     nTris += nTriangles;
-    triMeshBytes += sizeof(*this) + this->vertexIndices.size() * sizeof(int) +
-                    nVertices * (sizeof(*P) + (N ? sizeof(*N) : 0) +
-                                 (S ? sizeof(*S) : 0) + (UV ? sizeof(*UV) : 0) +
-                                 (fIndices ? sizeof(*fIndices) : 0));
 
     // Transform mesh vertices to world space
-    p.reset(new Point3f[nVertices]);
-    for (int i = 0; i < nVertices; ++i) p[i] = ObjectToWorld(P[i]);
+    if (compactAttributes && compactPositions) {
+        // Quantize vertex positions to a 16-bit lattice over the mesh's
+        // world-space bounds.  Cells are rounded to the nearest lattice
+        // point, so positions move by at most half a cell and shared
+        // vertices still dequantize identically, keeping meshes watertight.
+        for (int i = 0; i < nVertices; ++i)
+            quantizedBounds = Union(quantizedBounds, ObjectToWorld(P[i]));
+        Vector3f diag = quantizedBounds.Diagonal();
+        quantizedScale = Vector3f(diag.x / 65535, diag.y / 65535,
+                                  diag.z / 65535);
+        Vector3f invScale(
+            quantizedScale.x > 0 ? 1 / quantizedScale.x : 0,
+            quantizedScale.y > 0 ? 1 / quantizedScale.y : 0,
+            quantizedScale.z > 0 ? 1 / quantizedScale.z : 0);
+        pQuantized = AllocAlignedArray<uint16_t>(3 * nVertices);
+        for (int i = 0; i < nVertices; ++i) {
+            Vector3f offset = ObjectToWorld(P[i]) - quantizedBounds.pMin;
+            pQuantized[3 * i] =
+                (uint16_t)Clamp(offset.x * invScale.x + 0.5f, 0, 65535);
+            pQuantized[3 * i + 1] =
+                (uint16_t)Clamp(offset.y * invScale.y + 0.5f, 0, 65535);
+            pQuantized[3 * i + 2] =
+                (uint16_t)Clamp(offset.z * invScale.z + 0.5f, 0, 65535);
+        }
+    } else {
+        p = AllocAlignedArray<Point3f>(nVertices);
+        for (int i = 0; i < nVertices; ++i) p[i] = ObjectToWorld(P[i]);
+    }
 
     // Copy _UV_, _N_, and _S_ vertex data, if present
     if (UV) {
-        uv.reset(new Point2f[nVertices]);
-        memcpy(uv.get(), UV, nVertices * sizeof(Point2f));
+        if (compactAttributes) {
+            uvHalf = AllocAlignedArray<uint16_t>(2 * nVertices);
+            for (int i = 0; i < nVertices; ++i) {
+                uvHalf[2 * i] = FloatToHalf(UV[i].x);
+                uvHalf[2 * i + 1] = FloatToHalf(UV[i].y);
+            }
+        } else {
+            uv = AllocAlignedArray<Point2f>(nVertices);
+            memcpy(uv.get(), UV, nVertices * sizeof(Point2f));
+        }
     }
     if (N) {
-        n.reset(new Normal3f[nVertices]);
-        for (int i = 0; i < nVertices; ++i) n[i] = ObjectToWorld(N[i]);
+        if (compactAttributes) {
+            nOct = AllocAlignedArray<uint16_t>(2 * nVertices);
+            for (int i = 0; i < nVertices; ++i)
+                OctEncodeNormal(ObjectToWorld(N[i]), &nOct[2 * i]);
+        } else {
+            n = AllocAlignedArray<Normal3f>(nVertices);
+            for (int i = 0; i < nVertices; ++i) n[i] = ObjectToWorld(N[i]);
+        }
     }
     if (S) {
-        s.reset(new Vector3f[nVertices]);
+        s = AllocAlignedArray<Vector3f>(nVertices);
         for (int i = 0; i < nVertices; ++i) s[i] = ObjectToWorld(S[i]);
     }
 
     if (fIndices)
         faceIndices = std::vector<int>(fIndices, fIndices + nTriangles);
+
+    // Precompute each triangle's UV derivative matrix, mirroring both the
+    // partial derivative computation in Triangle::Intersect() and the
+    // dimension choice SurfaceInteraction::ComputeDifferentialsNow() would
+    // make, so the fast path reproduces the generic solve's results.
+    // Triangles with degenerate UVs get zero gradients; the generic path
+    // would only produce derivatives relative to an arbitrary frame there.
+    if (UV) {
+        uvGradients.assign(2 * (size_t)nTriangles, Vector3f());
+        for (int i = 0; i < nTriangles; ++i) {
+            const int *vi = &this->vertexIndices[3 * i];
+            Point3f p0 = Position(vi[0]), p1 = Position(vi[1]),
+                    p2 = Position(vi[2]);
+            Point2f uv0 = this->UV(vi[0]), uv1 = this->UV(vi[1]),
+                    uv2 = this->UV(vi[2]);
+            Vector2f duv02 = uv0 - uv2, duv12 = uv1 - uv2;
+            Vector3f dp02 = p0 - p2, dp12 = p1 - p2;
+            Float determinant = duv02[0] * duv12[1] - duv02[1] * duv12[0];
+            if (determinant == 0) continue;
+            Float invdet = 1 / determinant;
+            Vector3f dpdu = (duv12[1] * dp02 - duv02[1] * dp12) * invdet;
+            Vector3f dpdv = (-duv12[0] * dp02 + duv02[0] * dp12) * invdet;
+
+            // Choose the same two dimensions the generic solve would use
+            Vector3f ng = Cross(dpdu, dpdv);
+            int dim[2];
+            if (std::abs(ng.x) > std::abs(ng.y) &&
+                std::abs(ng.x) > std::abs(ng.z)) {
+                dim[0] = 1;
+                dim[1] = 2;
+            } else if (std::abs(ng.y) > std::abs(ng.z)) {
+                dim[0] = 0;
+                dim[1] = 2;
+            } else {
+                dim[0] = 0;
+                dim[1] = 1;
+            }
+
+            // Invert the 2x2 system and store its rows as gradients
+            Float A[2][2] = {{dpdu[dim[0]], dpdv[dim[0]]},
+                             {dpdu[dim[1]], dpdv[dim[1]]}};
+            Float det = A[0][0] * A[1][1] - A[0][1] * A[1][0];
+            if (std::abs(det) < 1e-10f) continue;
+            Vector3f &gu = uvGradients[2 * (size_t)i];
+            Vector3f &gv = uvGradients[2 * (size_t)i + 1];
+            gu[dim[0]] = A[1][1] / det;
+            gu[dim[1]] = -A[0][1] / det;
+            gv[dim[0]] = -A[1][0] / det;
+            gv[dim[1]] = A[0][0] / det;
+        }
+        triMeshBytes += uvGradients.size() * sizeof(Vector3f);
+    }
+
+    // Precompute packed classifications of the alpha cutout textures over
+    // the mesh's UV domain
+    if (alphaMask || shadowAlphaMask) {
+        Bounds2f uvDomain(Point2f(0, 0), Point2f(1, 1));
+        if (UV) {
+            uvDomain = Bounds2f(UV[0], UV[0]);
+            for (int i = 1; i < nVertices; ++i)
+                uvDomain = Union(uvDomain, UV[i]);
+        }
+        if (alphaMask)
+            packedAlphaMask = BuildPackedAlphaMask(alphaMask, uvDomain);
+        if (shadowAlphaMask)
+            packedShadowAlphaMask =
+                shadowAlphaMask == alphaMask
+                    ? packedAlphaMask
+                    : BuildPackedAlphaMask(shadowAlphaMask, uvDomain);
+        triMeshBytes += (packedAlphaMask ? sizeof(PackedAlphaMask) : 0) +
+                        (packedShadowAlphaMask != packedAlphaMask
+                             ? sizeof(PackedAlphaMask)
+                             : 0);
+    }
+
+    triMeshBytes +=
+        sizeof(*this) + this->vertexIndices.size() * sizeof(int) +
+        nVertices *
+            ((pQuantized ? 3 * sizeof(uint16_t) : sizeof(Point3f)) +
+             (N ? (nOct ? 2 * sizeof(uint16_t) : sizeof(Normal3f)) : 0) +
+             (S ? sizeof(*S) : 0) +
+             (UV ? (uvHalf ? 2 * sizeof(uint16_t) : sizeof(Point2f)) : 0) +
+             (fIndices ? sizeof(*fIndices) : 0));
+}
+
+// Per-mesh specialized triangle variants. CreateTriangleMesh() instantiates
+// the variant matching the mesh's features, so the intersection kernels for
+// the common case -- no alpha cutouts, no shading geometry -- carry none of
+// the corresponding branches. The variants add no data members, so they
+// share Triangle's memory footprint.
+template <bool MeshHasAlpha, bool HasShadingGeometry>
+class SpecializedTriangle : public Triangle {
+  public:
+    // SpecializedTriangle Public Methods
+    using Triangle::Triangle;
+    bool Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
+                   bool testAlphaTexture = true) const {
+        Float t;
+        Point2f bary;
+        if (!IntersectCompactImpl<MeshHasAlpha>(ray, &t, &bary,
+                                                testAlphaTexture))
+            return false;
+        ComputeInteractionImpl<HasShadingGeometry>(ray, t, bary, isect);
+        *tHit = t;
+        return true;
+    }
+    bool IntersectP(const Ray &ray, bool testAlphaTexture = true) const {
+        return IntersectPImpl<MeshHasAlpha>(ray, testAlphaTexture);
+    }
+    bool IntersectCompact(const Ray &ray, Float *tHit, Point2f *bary,
+                          bool testAlphaTexture = true) const {
+        return IntersectCompactImpl<MeshHasAlpha>(ray, tHit, bary,
+                                                  testAlphaTexture);
+    }
+    void ComputeInteraction(const Ray &ray, Float tHit, const Point2f &bary,
+                            SurfaceInteraction *isect) const {
+        ComputeInteractionImpl<HasShadingGeometry>(ray, tHit, bary, isect);
+    }
+};
+
+// Allocate all of the mesh's triangles in a single block and alias the
+// returned shared_ptrs to it; this gives one allocation and one control
+// block for the whole mesh instead of two per triangle, and teardown
+// releases the block in one free rather than millions.
+template <typename Tri>
+static std::vector<std::shared_ptr<Shape>> AllocateMeshTriangles(
+    const Transform *ObjectToWorld, const Transform *WorldToObject,
+    bool reverseOrientation, const std::shared_ptr<TriangleMesh> &mesh,
+    int nTriangles) {
+    auto triangles = std::make_shared<std::vector<Tri>>();
+    triangles->reserve(nTriangles);
+    for (int i = 0; i < nTriangles; ++i)
+        triangles->emplace_back(ObjectToWorld, WorldToObject,
+                                reverseOrientation, mesh, i);
+    std::vector<std::shared_ptr<Shape>> tris;
+    tris.reserve(nTriangles);
+    for (int i = 0; i < nTriangles; ++i)
+        tris.push_back(std::shared_ptr<Shape>(triangles, &(*triangles)[i]));
+    return tris;
 }
 
 std::vector<std::shared_ptr<Shape>> CreateTriangleMesh(
@@ -97,16 +346,30 @@ std::vector<std::shared_ptr<Shape>> CreateTriangleMesh(
     int nVertices, const Point3f *p, const Vector3f *s, const Normal3f *n,
     const Point2f *uv, const std::shared_ptr<Texture<Float>> &alphaMask,
     const std::shared_ptr<Texture<Float>> &shadowAlphaMask,
-    const int *faceIndices) {
+    const int *faceIndices, bool compactAttributes, bool compactPositions) {
     std::shared_ptr<TriangleMesh> mesh = std::make_shared<TriangleMesh>(
         *ObjectToWorld, nTriangles, vertexIndices, nVertices, p, s, n, uv,
-        alphaMask, shadowAlphaMask, faceIndices);
-    std::vector<std::shared_ptr<Shape>> tris;
-    tris.reserve(nTriangles);
-    for (int i = 0; i < nTriangles; ++i)
-        tris.push_back(std::make_shared<Triangle>(ObjectToWorld, WorldToObject,
-                                                  reverseOrientation, mesh, i));
-    return tris;
+        alphaMask, shadowAlphaMask, faceIndices, compactAttributes,
+        compactPositions);
+    // Instantiate the triangle variant specialized for the mesh's features
+    bool hasAlpha = mesh->alphaMask != nullptr ||
+                    mesh->shadowAlphaMask != nullptr;
+    bool hasShading = mesh->HasNormals() || mesh->s != nullptr;
+    if (hasAlpha)
+        return hasShading
+                   ? AllocateMeshTriangles<SpecializedTriangle<true, true>>(
+                         ObjectToWorld, WorldToObject, reverseOrientation,
+                         mesh, nTriangles)
+                   : AllocateMeshTriangles<SpecializedTriangle<true, false>>(
+                         ObjectToWorld, WorldToObject, reverseOrientation,
+                         mesh, nTriangles);
+    return hasShading
+               ? AllocateMeshTriangles<SpecializedTriangle<false, true>>(
+                     ObjectToWorld, WorldToObject, reverseOrientation, mesh,
+                     nTriangles)
+               : AllocateMeshTriangles<SpecializedTriangle<false, false>>(
+                     ObjectToWorld, WorldToObject, reverseOrientation, mesh,
+                     nTriangles);
 }
 
 bool WritePlyFile(const std::string &filename, int nTriangles,
@@ -170,29 +433,40 @@ bool WritePlyFile(const std::string &filename, int nTriangles,
 
 Bounds3f Triangle::ObjectBound() const {
     // Get triangle vertices in _p0_, _p1_, and _p2_
-    const Point3f &p0 = mesh->p[v[0]];
-    const Point3f &p1 = mesh->p[v[1]];
-    const Point3f &p2 = mesh->p[v[2]];
+    const Point3f p0 = mesh->Position(v[0]);
+    const Point3f p1 = mesh->Position(v[1]);
+    const Point3f p2 = mesh->Position(v[2]);
     return Union(Bounds3f((*WorldToObject)(p0), (*WorldToObject)(p1)),
                  (*WorldToObject)(p2));
 }
 
 Bounds3f Triangle::WorldBound() const {
     // Get triangle vertices in _p0_, _p1_, and _p2_
-    const Point3f &p0 = mesh->p[v[0]];
-    const Point3f &p1 = mesh->p[v[1]];
-    const Point3f &p2 = mesh->p[v[2]];
+    const Point3f p0 = mesh->Position(v[0]);
+    const Point3f p1 = mesh->Position(v[1]);
+    const Point3f p2 = mesh->Position(v[2]);
     return Union(Bounds3f(p0, p1), p2);
 }
 
 bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
                          bool testAlphaTexture) const {
+    Float t;
+    Point2f bary;
+    if (!IntersectCompact(ray, &t, &bary, testAlphaTexture)) return false;
+    ComputeInteraction(ray, t, bary, isect);
+    *tHit = t;
+    return true;
+}
+
+template <bool MeshHasAlpha>
+bool Triangle::IntersectCompactImpl(const Ray &ray, Float *tHit, Point2f *bary,
+                                    bool testAlphaTexture) const {
     ProfilePhase p(Prof::TriIntersect);
     ++nTests;
     // Get triangle vertices in _p0_, _p1_, and _p2_
-    const Point3f &p0 = mesh->p[v[0]];
-    const Point3f &p1 = mesh->p[v[1]];
-    const Point3f &p2 = mesh->p[v[2]];
+    const Point3f p0 = mesh->Position(v[0]);
+    const Point3f p1 = mesh->Position(v[1]);
+    const Point3f p2 = mesh->Position(v[2]);
 
     // Perform ray--triangle intersection test
 
@@ -290,6 +564,80 @@ bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
                    std::abs(invDet);
     if (t <= deltaT) return false;
 
+    // Try to resolve an alpha cutout with the packed alpha mask before
+    // computing the intersection's geometric representation
+    bool alphaResolved = !(MeshHasAlpha && testAlphaTexture && mesh->alphaMask);
+    if (!alphaResolved) {
+        ++nAlphaMaskTests;
+        if (mesh->packedAlphaMask) {
+            Point2f uvA[3];
+            GetUVs(uvA);
+            int cls = mesh->packedAlphaMask->Classify(b0 * uvA[0] +
+                                                      b1 * uvA[1] +
+                                                      b2 * uvA[2]);
+            if (cls == PackedAlphaMask::Transparent) {
+                ++nAlphaMaskFast;
+                return false;
+            }
+            if (cls == PackedAlphaMask::Opaque) {
+                ++nAlphaMaskFast;
+                alphaResolved = true;
+            }
+        }
+    }
+
+    // Reject hits on degenerate triangles; ComputeInteraction() relies on
+    // the triangle having nonzero area.
+    if (Cross(p2 - p0, p1 - p0).LengthSquared() == 0) return false;
+
+    // Evaluate the alpha texture if the packed mask couldn't decide; this
+    // needs the hit's geometric representation, which is otherwise left to
+    // ComputeInteraction()
+    if (!alphaResolved) {
+        Vector3f dpdu, dpdv;
+        Point2f uv[3];
+        GetUVs(uv);
+        Vector2f duv02 = uv[0] - uv[2], duv12 = uv[1] - uv[2];
+        Vector3f dp02 = p0 - p2, dp12 = p1 - p2;
+        Float determinant = duv02[0] * duv12[1] - duv02[1] * duv12[0];
+        bool degenerateUV = std::abs(determinant) < 1e-8;
+        if (!degenerateUV) {
+            Float invdet = 1 / determinant;
+            dpdu = (duv12[1] * dp02 - duv02[1] * dp12) * invdet;
+            dpdv = (-duv12[0] * dp02 + duv02[0] * dp12) * invdet;
+        }
+        if (degenerateUV || Cross(dpdu, dpdv).LengthSquared() == 0)
+            CoordinateSystem(Normalize(Cross(p2 - p0, p1 - p0)), &dpdu,
+                             &dpdv);
+        Point3f pHit = b0 * p0 + b1 * p1 + b2 * p2;
+        Point2f uvHit = b0 * uv[0] + b1 * uv[1] + b2 * uv[2];
+        SurfaceInteraction isectLocal(pHit, Vector3f(0, 0, 0), uvHit, -ray.d,
+                                      dpdu, dpdv, Normal3f(0, 0, 0),
+                                      Normal3f(0, 0, 0), ray.time, this);
+        if (mesh->alphaMask->Evaluate(isectLocal) == 0) return false;
+    }
+
+    *tHit = t;
+    *bary = Point2f(b0, b1);
+    ++nHits;
+    return true;
+}
+
+bool Triangle::IntersectCompact(const Ray &ray, Float *tHit, Point2f *bary,
+                                bool testAlphaTexture) const {
+    return IntersectCompactImpl<true>(ray, tHit, bary, testAlphaTexture);
+}
+
+template <bool HasShadingGeometry>
+void Triangle::ComputeInteractionImpl(const Ray &ray, Float tHit,
+                                      const Point2f &bary,
+                                      SurfaceInteraction *isect) const {
+    // Get triangle vertices in _p0_, _p1_, and _p2_
+    const Point3f p0 = mesh->Position(v[0]);
+    const Point3f p1 = mesh->Position(v[1]);
+    const Point3f p2 = mesh->Position(v[2]);
+    Float b0 = bary.x, b1 = bary.y, b2 = 1 - bary.x - bary.y;
+
     // Compute triangle partial derivatives
     Vector3f dpdu, dpdv;
     Point2f uv[3];
@@ -305,16 +653,10 @@ bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
         dpdu = (duv12[1] * dp02 - duv02[1] * dp12) * invdet;
         dpdv = (-duv12[0] * dp02 + duv02[0] * dp12) * invdet;
     }
-    if (degenerateUV || Cross(dpdu, dpdv).LengthSquared() == 0) {
-        // Handle zero determinant for triangle partial derivative matrix
-        Vector3f ng = Cross(p2 - p0, p1 - p0);
-        if (ng.LengthSquared() == 0)
-            // The triangle is actually degenerate; the intersection is
-            // bogus.
-            return false;
-
-        CoordinateSystem(Normalize(ng), &dpdu, &dpdv);
-    }
+    if (degenerateUV || Cross(dpdu, dpdv).LengthSquared() == 0)
+        // Handle zero determinant for triangle partial derivative matrix;
+        // IntersectCompact() rejected hits on triangles with zero area.
+        CoordinateSystem(Normalize(Cross(p2 - p0, p1 - p0)), &dpdu, &dpdv);
 
     // Compute error bounds for triangle intersection
     Float xAbsSum =
@@ -329,14 +671,6 @@ bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
     Point3f pHit = b0 * p0 + b1 * p1 + b2 * p2;
     Point2f uvHit = b0 * uv[0] + b1 * uv[1] + b2 * uv[2];
 
-    // Test intersection against alpha texture, if present
-    if (testAlphaTexture && mesh->alphaMask) {
-        SurfaceInteraction isectLocal(pHit, Vector3f(0, 0, 0), uvHit, -ray.d,
-                                      dpdu, dpdv, Normal3f(0, 0, 0),
-                                      Normal3f(0, 0, 0), ray.time, this);
-        if (mesh->alphaMask->Evaluate(isectLocal) == 0) return false;
-    }
-
     // Fill in _SurfaceInteraction_ from triangle hit
     *isect = SurfaceInteraction(pHit, pError, uvHit, -ray.d, dpdu, dpdv,
                                 Normal3f(0, 0, 0), Normal3f(0, 0, 0), ray.time,
@@ -347,13 +681,13 @@ bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
     if (reverseOrientation ^ transformSwapsHandedness)
         isect->n = isect->shading.n = -isect->n;
 
-    if (mesh->n || mesh->s) {
+    if (HasShadingGeometry && (mesh->HasNormals() || mesh->s)) {
         // Initialize _Triangle_ shading geometry
 
         // Compute shading normal _ns_ for triangle
         Normal3f ns;
-        if (mesh->n) {
-            ns = (b0 * mesh->n[v[0]] + b1 * mesh->n[v[1]] + b2 * mesh->n[v[2]]);
+        if (mesh->HasNormals()) {
+            ns = (b0 * mesh->GetNormal(v[0]) + b1 * mesh->GetNormal(v[1]) + b2 * mesh->GetNormal(v[2]));
             if (ns.LengthSquared() > 0)
                 ns = Normalize(ns);
             else
@@ -382,12 +716,12 @@ bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
 
         // Compute $\dndu$ and $\dndv$ for triangle shading geometry
         Normal3f dndu, dndv;
-        if (mesh->n) {
+        if (mesh->HasNormals()) {
             // Compute deltas for triangle partial derivatives of normal
             Vector2f duv02 = uv[0] - uv[2];
             Vector2f duv12 = uv[1] - uv[2];
-            Normal3f dn1 = mesh->n[v[0]] - mesh->n[v[2]];
-            Normal3f dn2 = mesh->n[v[1]] - mesh->n[v[2]];
+            Normal3f dn1 = mesh->GetNormal(v[0]) - mesh->GetNormal(v[2]);
+            Normal3f dn2 = mesh->GetNormal(v[1]) - mesh->GetNormal(v[2]);
             Float determinant = duv02[0] * duv12[1] - duv02[1] * duv12[0];
             bool degenerateUV = std::abs(determinant) < 1e-8;
             if (degenerateUV) {
@@ -397,8 +731,8 @@ bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
                 // (rather than giving up) so that ray differentials for
                 // rays reflected from triangles with degenerate
                 // parameterizations are still reasonable.
-                Vector3f dn = Cross(Vector3f(mesh->n[v[2]] - mesh->n[v[0]]),
-                                    Vector3f(mesh->n[v[1]] - mesh->n[v[0]]));
+                Vector3f dn = Cross(Vector3f(mesh->GetNormal(v[2]) - mesh->GetNormal(v[0])),
+                                    Vector3f(mesh->GetNormal(v[1]) - mesh->GetNormal(v[0])));
                 if (dn.LengthSquared() == 0)
                     dndu = dndv = Normal3f(0, 0, 0);
                 else {
@@ -417,19 +751,22 @@ bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
         if (reverseOrientation) ts = -ts;
         isect->SetShadingGeometry(ss, ts, dndu, dndv, true);
     }
+}
 
-    *tHit = t;
-    ++nHits;
-    return true;
+void Triangle::ComputeInteraction(const Ray &ray, Float tHit,
+                                  const Point2f &bary,
+                                  SurfaceInteraction *isect) const {
+    ComputeInteractionImpl<true>(ray, tHit, bary, isect);
 }
 
-bool Triangle::IntersectP(const Ray &ray, bool testAlphaTexture) const {
+template <bool MeshHasAlpha>
+bool Triangle::IntersectPImpl(const Ray &ray, bool testAlphaTexture) const {
     ProfilePhase p(Prof::TriIntersectP);
     ++nTests;
     // Get triangle vertices in _p0_, _p1_, and _p2_
-    const Point3f &p0 = mesh->p[v[0]];
-    const Point3f &p1 = mesh->p[v[1]];
-    const Point3f &p2 = mesh->p[v[2]];
+    const Point3f p0 = mesh->Position(v[0]);
+    const Point3f p1 = mesh->Position(v[1]);
+    const Point3f p2 = mesh->Position(v[2]);
 
     // Perform ray--triangle intersection test
 
@@ -528,7 +865,37 @@ bool Triangle::IntersectP(const Ray &ray, bool testAlphaTexture) const {
     if (t <= deltaT) return false;
 
     // Test shadow ray intersection against alpha texture, if present
-    if (testAlphaTexture && (mesh->alphaMask || mesh->shadowAlphaMask)) {
+    if (MeshHasAlpha && testAlphaTexture &&
+        (mesh->alphaMask || mesh->shadowAlphaMask)) {
+        // Try to resolve the alpha cutouts with the packed alpha masks
+        // before computing the intersection's geometric representation
+        Point2f uvA[3];
+        GetUVs(uvA);
+        Point2f uvHitA = b0 * uvA[0] + b1 * uvA[1] + b2 * uvA[2];
+        ++nAlphaMaskTests;
+        int clsAlpha = !mesh->alphaMask
+                           ? (int)PackedAlphaMask::Opaque
+                           : mesh->packedAlphaMask
+                                 ? mesh->packedAlphaMask->Classify(uvHitA)
+                                 : (int)PackedAlphaMask::Mixed;
+        int clsShadow =
+            !mesh->shadowAlphaMask
+                ? (int)PackedAlphaMask::Opaque
+                : mesh->packedShadowAlphaMask
+                      ? mesh->packedShadowAlphaMask->Classify(uvHitA)
+                      : (int)PackedAlphaMask::Mixed;
+        if (clsAlpha == PackedAlphaMask::Transparent ||
+            clsShadow == PackedAlphaMask::Transparent) {
+            ++nAlphaMaskFast;
+            return false;
+        }
+        if (clsAlpha == PackedAlphaMask::Opaque &&
+            clsShadow == PackedAlphaMask::Opaque) {
+            ++nAlphaMaskFast;
+            ++nHits;
+            return true;
+        }
+
         // Compute triangle partial derivatives
         Vector3f dpdu, dpdv;
         Point2f uv[3];
@@ -571,29 +938,48 @@ bool Triangle::IntersectP(const Ray &ray, bool testAlphaTexture) const {
     return true;
 }
 
+bool Triangle::IntersectP(const Ray &ray, bool testAlphaTexture) const {
+    return IntersectPImpl<true>(ray, testAlphaTexture);
+}
+
+bool Triangle::ComputeUVDifferentials(const Vector3f &dpdx,
+                                      const Vector3f &dpdy, Float *dudx,
+                                      Float *dvdx, Float *dudy,
+                                      Float *dvdy) const {
+    if (mesh->uvGradients.empty()) return false;
+    int triNumber = int((v - &mesh->vertexIndices[0]) / 3);
+    const Vector3f &gu = mesh->uvGradients[2 * (size_t)triNumber];
+    const Vector3f &gv = mesh->uvGradients[2 * (size_t)triNumber + 1];
+    *dudx = Dot(gu, dpdx);
+    *dvdx = Dot(gv, dpdx);
+    *dudy = Dot(gu, dpdy);
+    *dvdy = Dot(gv, dpdy);
+    return true;
+}
+
 Float Triangle::Area() const {
     // Get triangle vertices in _p0_, _p1_, and _p2_
-    const Point3f &p0 = mesh->p[v[0]];
-    const Point3f &p1 = mesh->p[v[1]];
-    const Point3f &p2 = mesh->p[v[2]];
+    const Point3f p0 = mesh->Position(v[0]);
+    const Point3f p1 = mesh->Position(v[1]);
+    const Point3f p2 = mesh->Position(v[2]);
     return 0.5 * Cross(p1 - p0, p2 - p0).Length();
 }
 
 Interaction Triangle::Sample(const Point2f &u, Float *pdf) const {
     Point2f b = UniformSampleTriangle(u);
     // Get triangle vertices in _p0_, _p1_, and _p2_
-    const Point3f &p0 = mesh->p[v[0]];
-    const Point3f &p1 = mesh->p[v[1]];
-    const Point3f &p2 = mesh->p[v[2]];
+    const Point3f p0 = mesh->Position(v[0]);
+    const Point3f p1 = mesh->Position(v[1]);
+    const Point3f p2 = mesh->Position(v[2]);
     Interaction it;
     it.p = b[0] * p0 + b[1] * p1 + (1 - b[0] - b[1]) * p2;
     // Compute surface normal for sampled point on triangle
     it.n = Normalize(Normal3f(Cross(p1 - p0, p2 - p0)));
     // Ensure correct orientation of the geometric normal; follow the same
     // approach as was used in Triangle::Intersect().
-    if (mesh->n) {
-        Normal3f ns(b[0] * mesh->n[v[0]] + b[1] * mesh->n[v[1]] +
-                    (1 - b[0] - b[1]) * mesh->n[v[2]]);
+    if (mesh->HasNormals()) {
+        Normal3f ns(b[0] * mesh->GetNormal(v[0]) + b[1] * mesh->GetNormal(v[1]) +
+                    (1 - b[0] - b[1]) * mesh->GetNormal(v[2]));
         it.n = Faceforward(it.n, ns);
     } else if (reverseOrientation ^ transformSwapsHandedness)
         it.n *= -1;
@@ -606,11 +992,133 @@ Interaction Triangle::Sample(const Point2f &u, Float *pdf) const {
     return it;
 }
 
+// Solid angles outside this range are sampled uniformly by area instead;
+// the spherical excess cancels catastrophically for distant triangles, and
+// nearly-hemispherical triangles stress the arc interpolation.
+static PBRT_CONSTEXPR Float minSphericalSampleArea = 3e-4;
+static PBRT_CONSTEXPR Float maxSphericalSampleArea = 6.22;
+
+Interaction Triangle::Sample(const Interaction &ref, const Point2f &u,
+                             Float *pdf) const {
+    Float solidAngle = SolidAngle(ref.p);
+    if (solidAngle < minSphericalSampleArea ||
+        solidAngle > maxSphericalSampleArea)
+        return Shape::Sample(ref, u, pdf);
+
+    // Get triangle vertices in _p0_, _p1_, and _p2_
+    const Point3f p0 = mesh->Position(v[0]);
+    const Point3f p1 = mesh->Position(v[1]);
+    const Point3f p2 = mesh->Position(v[2]);
+
+    // Project the vertices onto the unit sphere around _ref_
+    Vector3f a = Normalize(p0 - ref.p), b = Normalize(p1 - ref.p),
+             c = Normalize(p2 - ref.p);
+    Vector3f nAB = Cross(a, b), nBC = Cross(b, c), nCA = Cross(c, a);
+    if (nAB.LengthSquared() == 0 || nBC.LengthSquared() == 0 ||
+        nCA.LengthSquared() == 0)
+        return Shape::Sample(ref, u, pdf);
+    nAB = Normalize(nAB);
+    nBC = Normalize(nBC);
+    nCA = Normalize(nCA);
+
+    // Compute the spherical triangle's interior angles and its area via
+    // Girard's theorem, as in SolidAngle()
+    Float alpha = std::acos(Clamp(Dot(nCA, -nAB), -1, 1));
+    Float beta = std::acos(Clamp(Dot(nAB, -nBC), -1, 1));
+    Float gammaAngle = std::acos(Clamp(Dot(nBC, -nCA), -1, 1));
+    Float sphArea = alpha + beta + gammaAngle - Pi;
+    if (sphArea <= 0) return Shape::Sample(ref, u, pdf);
+
+    // Uniformly sample the spherical triangle following Arvo (1995):
+    // choose a sub-triangle whose area is a _u[0]_ fraction of the whole by
+    // sliding vertex _c_ along the arc toward _a_, then sample a point on
+    // the arc from _b_ to the new vertex with _u[1]_.
+    // _areaS_ is the sub-triangle's interior angle sum (its area plus
+    // $\pi$), which is what the expressions below are parameterized by.
+    Float areaS = Pi + u[0] * sphArea;
+
+    // Compute $\sin$ and $\cos$ of the angle $\phi = \hat{A} - \alpha$
+    Float cosAlpha = std::cos(alpha), sinAlpha = std::sin(alpha);
+    Float sinPhi = std::sin(areaS) * cosAlpha - std::cos(areaS) * sinAlpha;
+    Float cosPhi = std::cos(areaS) * cosAlpha + std::sin(areaS) * sinAlpha;
+
+    // Compute $\cos \hat{b}'$ for the sub-triangle's third vertex
+    Float k1 = cosPhi + cosAlpha;
+    Float k2 = sinPhi - sinAlpha * Dot(a, b);
+    Float cosBp = (k2 + (k2 * cosPhi - k1 * sinPhi) * cosAlpha) /
+                  ((k2 * sinPhi + k1 * cosPhi) * sinAlpha);
+    cosBp = Clamp(cosBp, -1, 1);
+    Float sinBp = std::sqrt(std::max((Float)0, 1 - cosBp * cosBp));
+
+    // Slide _c_ to _cp_, the sub-triangle's third vertex
+    Vector3f cPerp = c - Dot(c, a) * a;
+    if (cPerp.LengthSquared() == 0) return Shape::Sample(ref, u, pdf);
+    Vector3f cp = cosBp * a + sinBp * Normalize(cPerp);
+
+    // Sample the direction _w_ along the arc between _b_ and _cp_
+    Float cosTheta = 1 - u[1] * (1 - Dot(cp, b));
+    Float sinTheta = std::sqrt(std::max((Float)0, 1 - cosTheta * cosTheta));
+    Vector3f wPerp = cp - Dot(cp, b) * b;
+    if (wPerp.LengthSquared() == 0) return Shape::Sample(ref, u, pdf);
+    Vector3f w = cosTheta * b + sinTheta * Normalize(wPerp);
+
+    // Compute the barycentric coordinates where the ray from _ref_ along
+    // _w_ meets the triangle's plane
+    Vector3f e1 = p1 - p0, e2 = p2 - p0;
+    Vector3f s1 = Cross(w, e2);
+    Float divisor = Dot(s1, e1);
+    if (divisor == 0) return Shape::Sample(ref, u, pdf);
+    Float invDivisor = 1 / divisor;
+    Vector3f s = ref.p - p0;
+    Float b1 = Clamp(Dot(s, s1) * invDivisor, 0, 1);
+    Float b2 = Clamp(Dot(Cross(s, e1), w) * invDivisor, 0, 1);
+    if (b1 + b2 > 1) {
+        Float invSum = 1 / (b1 + b2);
+        b1 *= invSum;
+        b2 *= invSum;
+    }
+    Float b0 = 1 - b1 - b2;
+
+    Interaction it;
+    it.p = b0 * p0 + b1 * p1 + b2 * p2;
+    // Compute surface normal for sampled point on triangle
+    it.n = Normalize(Normal3f(Cross(p1 - p0, p2 - p0)));
+    // Ensure correct orientation of the geometric normal; follow the same
+    // approach as was used in Triangle::Intersect().
+    if (mesh->HasNormals()) {
+        Normal3f ns(b0 * mesh->GetNormal(v[0]) + b1 * mesh->GetNormal(v[1]) +
+                    b2 * mesh->GetNormal(v[2]));
+        it.n = Faceforward(it.n, ns);
+    } else if (reverseOrientation ^ transformSwapsHandedness)
+        it.n *= -1;
+
+    // Compute error bounds for sampled point on triangle
+    Point3f pAbsSum = Abs(b0 * p0) + Abs(b1 * p1) + Abs(b2 * p2);
+    it.pError = gamma(6) * Vector3f(pAbsSum.x, pAbsSum.y, pAbsSum.z);
+    *pdf = 1 / solidAngle;
+    return it;
+}
+
+Float Triangle::Pdf(const Interaction &ref, const Vector3f &wi) const {
+    Float solidAngle = SolidAngle(ref.p);
+    if (solidAngle < minSphericalSampleArea ||
+        solidAngle > maxSphericalSampleArea)
+        return Shape::Pdf(ref, wi);
+    // Uniform in solid angle over the spherical triangle; zero for
+    // directions that miss it. As in Shape::Pdf(), ignore any alpha texture.
+    Ray ray = ref.SpawnRay(wi);
+    Float tHit;
+    SurfaceInteraction isectLight;
+    if (!Intersect(ray, &tHit, &isectLight, false)) return 0;
+    return 1 / solidAngle;
+}
+
 Float Triangle::SolidAngle(const Point3f &p, int nSamples) const {
     // Project the vertices into the unit sphere around p.
     std::array<Vector3f, 3> pSphere = {
-        Normalize(mesh->p[v[0]] - p), Normalize(mesh->p[v[1]] - p),
-        Normalize(mesh->p[v[2]] - p)
+        Normalize(mesh->Position(v[0]) - p),
+        Normalize(mesh->Position(v[1]) - p),
+        Normalize(mesh->Position(v[2]) - p)
     };
 
     // http://math.stackexchange.com/questions/9819/area-of-a-spherical-triangle
@@ -738,8 +1246,18 @@ std::vector<std::shared_ptr<Shape>> CreateTriangleMeshShape(
     } else if (params.FindOneFloat("shadowalpha", 1.f) == 0.f)
         shadowAlphaTex.reset(new ConstantTexture<Float>(0.f));
 
+    // Parse compact vertex attribute storage options
+    bool compactAttributes = params.FindOneBool("compactattributes", false);
+    bool compactPositions = params.FindOneBool("compactpositions", false);
+    if (compactPositions && !compactAttributes) {
+        Warning(
+            "\"compactpositions\" requires \"compactattributes\"; ignoring.");
+        compactPositions = false;
+    }
+
     return CreateTriangleMesh(o2w, w2o, reverseOrientation, nvi / 3, vi, npi, P,
-                              S, N, uvs, alphaTex, shadowAlphaTex, faceIndices);
+                              S, N, uvs, alphaTex, shadowAlphaTex, faceIndices,
+                              compactAttributes, compactPositions);
 }
 
 }  // namespace pbrt
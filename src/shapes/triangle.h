@@ -41,12 +41,118 @@
 // shapes/triangle.h*
 #include "shape.h"
 #include "stats.h"
+#include "memory.h"
 #include <map>
 
 namespace pbrt {
 
 STAT_MEMORY_COUNTER("Memory/Triangle meshes", triMeshBytes);
 
+// Compact Vertex Attribute Encoding Declarations
+// IEEE half (binary16) conversions, used for compact UV storage.
+inline uint16_t FloatToHalf(float f) {
+    uint32_t bits = FloatToBits(f);
+    uint32_t sign = (bits >> 16) & 0x8000;
+    int32_t exponent = int32_t((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+    // Flush values too small for a half to (signed) zero.
+    if (exponent <= 0) return (uint16_t)sign;
+    // Map overflow and infinity to infinity.
+    if (exponent >= 31) return (uint16_t)(sign | 0x7c00);
+    // Round the mantissa to the nearest representable half.
+    mantissa += 0x1000;
+    if (mantissa & 0x800000) {
+        mantissa = 0;
+        if (++exponent >= 31) return (uint16_t)(sign | 0x7c00);
+    }
+    return (uint16_t)(sign | (exponent << 10) | (mantissa >> 13));
+}
+
+inline float HalfToFloat(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ff;
+    uint32_t bits;
+    if (exponent == 0) {
+        if (mantissa == 0)
+            bits = sign;
+        else {
+            // Normalize the half-precision denormal.
+            exponent = 127 - 15 + 1;
+            while (!(mantissa & 0x400)) {
+                mantissa <<= 1;
+                --exponent;
+            }
+            bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+        }
+    } else if (exponent == 31)
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    else
+        bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    return BitsToFloat(bits);
+}
+
+// Octahedral unit-vector encoding (Meyer et al. 2010), used for compact
+// normal storage: the sphere is mapped to an octahedron whose lower half is
+// folded outward, giving a square that 2x16 bits sample nearly uniformly.
+inline void OctEncodeNormal(const Normal3f &n, uint16_t enc[2]) {
+    Float sum = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if (sum == 0) sum = 1;  // degenerate normal; encode an arbitrary vector
+    Float u = n.x / sum, v = n.y / sum;
+    if (n.z < 0) {
+        Float uOld = u;
+        u = (1 - std::abs(v)) * (uOld >= 0 ? 1 : -1);
+        v = (1 - std::abs(uOld)) * (v >= 0 ? 1 : -1);
+    }
+    enc[0] = (uint16_t)std::min((Float)65535, std::floor((u + 1) / 2 * 65536));
+    enc[1] = (uint16_t)std::min((Float)65535, std::floor((v + 1) / 2 * 65536));
+}
+
+inline Normal3f OctDecodeNormal(const uint16_t enc[2]) {
+    Float u = -1 + 2 * ((enc[0] + 0.5f) / 65536);
+    Float v = -1 + 2 * ((enc[1] + 0.5f) / 65536);
+    Vector3f n(u, v, 1 - std::abs(u) - std::abs(v));
+    if (n.z < 0) {
+        Float xOld = n.x;
+        n.x = (1 - std::abs(n.y)) * (xOld >= 0 ? 1 : -1);
+        n.y = (1 - std::abs(xOld)) * (n.y >= 0 ? 1 : -1);
+    }
+    return Normal3f(Normalize(n));
+}
+
+// PackedAlphaMask Declarations
+// Bit-packed classification of an alpha cutout texture over the mesh's UV
+// domain, built once per mesh so that traversal can resolve most alpha
+// tests with two bit probes instead of a SurfaceInteraction and a texture
+// evaluation. Cells are classified by dense point sampling at mesh creation
+// time and a cell is only marked definitely transparent or definitely
+// opaque when every sample in the cell and in its eight neighbors agrees;
+// everything else is left Mixed and falls back to evaluating the texture,
+// so filtered edges and fine detail keep their exact result.
+PBRT_CONSTEXPR int PackedAlphaMaskResolution = 64;
+struct PackedAlphaMask {
+    enum { Transparent = 0, Opaque = 1, Mixed = 2 };
+    int Classify(const Point2f &uv) const {
+        PBRT_CONSTEXPR int res = PackedAlphaMaskResolution;
+        int x = Clamp((int)((uv.x - domain.pMin.x) * cellScale.x), 0, res - 1);
+        int y = Clamp((int)((uv.y - domain.pMin.y) * cellScale.y), 0, res - 1);
+        int cell = y * res + x;
+        if (transparentBits[cell >> 6] & (1ull << (cell & 63)))
+            return Transparent;
+        if (opaqueBits[cell >> 6] & (1ull << (cell & 63))) return Opaque;
+        return Mixed;
+    }
+
+    Bounds2f domain;
+    // _PackedAlphaMaskResolution_ cells per axis, divided by the domain's
+    // extent
+    Vector2f cellScale;
+    uint64_t transparentBits[PackedAlphaMaskResolution *
+                             PackedAlphaMaskResolution / 64];
+    uint64_t opaqueBits[PackedAlphaMaskResolution * PackedAlphaMaskResolution /
+                        64];
+};
+
 // Triangle Declarations
 struct TriangleMesh {
     // TriangleMesh Public Methods
@@ -55,17 +161,57 @@ struct TriangleMesh {
                  const Vector3f *S, const Normal3f *N, const Point2f *uv,
                  const std::shared_ptr<Texture<Float>> &alphaMask,
                  const std::shared_ptr<Texture<Float>> &shadowAlphaMask,
-                 const int *faceIndices);
+                 const int *faceIndices, bool compactAttributes = false,
+                 bool compactPositions = false);
+    // Vertex attribute accessors; these hide whether the mesh uses the
+    // full-precision or the compact representation.
+    Point3f Position(int i) const {
+        if (p) return p[i];
+        return quantizedBounds.pMin +
+               Vector3f(pQuantized[3 * i] * quantizedScale.x,
+                        pQuantized[3 * i + 1] * quantizedScale.y,
+                        pQuantized[3 * i + 2] * quantizedScale.z);
+    }
+    bool HasNormals() const { return n != nullptr || nOct != nullptr; }
+    Normal3f GetNormal(int i) const {
+        if (n) return n[i];
+        return OctDecodeNormal(&nOct[2 * i]);
+    }
+    bool HasUVs() const { return uv != nullptr || uvHalf != nullptr; }
+    Point2f UV(int i) const {
+        if (uv) return uv[i];
+        return Point2f(HalfToFloat(uvHalf[2 * i]),
+                       HalfToFloat(uvHalf[2 * i + 1]));
+    }
 
     // TriangleMesh Data
     const int nTriangles, nVertices;
     std::vector<int> vertexIndices;
-    std::unique_ptr<Point3f[]> p;
-    std::unique_ptr<Normal3f[]> n;
-    std::unique_ptr<Vector3f[]> s;
-    std::unique_ptr<Point2f[]> uv;
+    AlignedUniquePtr<Point3f> p;
+    AlignedUniquePtr<Normal3f> n;
+    AlignedUniquePtr<Vector3f> s;
+    AlignedUniquePtr<Point2f> uv;
     std::shared_ptr<Texture<Float>> alphaMask, shadowAlphaMask;
+    // Packed classifications of _alphaMask_ and _shadowAlphaMask_, shared
+    // when both point at the same texture; null when the mesh has no alpha
+    // textures.
+    std::shared_ptr<PackedAlphaMask> packedAlphaMask, packedShadowAlphaMask;
     std::vector<int> faceIndices;
+    // Per-triangle world-space UV derivative matrices, stored as the
+    // gradients of $u$ and $v$ with respect to position (two Vector3fs per
+    // triangle); Triangle::ComputeUVDifferentials() dots these with the
+    // ray-differential position offsets instead of solving a linear system
+    // per hit. Only built for meshes with texture coordinates.
+    std::vector<Vector3f> uvGradients;
+    // Compact attribute storage, used in place of _p_, _n_, and _uv_ when
+    // the mesh was created with compact attributes enabled: oct-encoded
+    // 16-bit normals, half-float UVs, and (optionally) positions quantized
+    // to a 16-bit lattice over the mesh's world-space bounds.
+    AlignedUniquePtr<uint16_t> pQuantized;
+    AlignedUniquePtr<uint16_t> nOct;
+    AlignedUniquePtr<uint16_t> uvHalf;
+    Bounds3f quantizedBounds;
+    Vector3f quantizedScale;
 };
 
 class Triangle : public Shape {
@@ -84,22 +230,67 @@ class Triangle : public Shape {
     bool Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
                    bool testAlphaTexture = true) const;
     bool IntersectP(const Ray &ray, bool testAlphaTexture = true) const;
+    // Compact intersection: performs the watertight test (including alpha
+    // cutouts) and records the hit's barycentric coordinates in _bary_;
+    // ComputeInteraction() rebuilds the full interaction from them.
+    // Intersect() above is the composition of the two.
+    bool IntersectCompact(const Ray &ray, Float *tHit, Point2f *bary,
+                          bool testAlphaTexture = true) const;
+    void ComputeInteraction(const Ray &ray, Float tHit, const Point2f &bary,
+                            SurfaceInteraction *isect) const;
+    bool ComputeUVDifferentials(const Vector3f &dpdx, const Vector3f &dpdy,
+                                Float *dudx, Float *dvdx, Float *dudy,
+                                Float *dvdy) const;
+    bool GetTriangleVertices(Point3f p[3]) const {
+        p[0] = mesh->Position(v[0]);
+        p[1] = mesh->Position(v[1]);
+        p[2] = mesh->Position(v[2]);
+        return true;
+    }
     Float Area() const;
 
     using Shape::Sample;  // Bring in the other Sample() overload.
     Interaction Sample(const Point2f &u, Float *pdf) const;
+    // Samples the spherical triangle subtended at _ref_ uniformly in solid
+    // angle, so that area lights seen edge-on or up close aren't dominated
+    // by wasted low-contribution samples; very small and very large
+    // subtended angles fall back to uniform-by-area sampling, where the
+    // default does fine. Pdf() applies the matching density.
+    Interaction Sample(const Interaction &ref, const Point2f &u,
+                       Float *pdf) const;
+    using Shape::Pdf;  // Bring in the other Pdf() overload.
+    Float Pdf(const Interaction &ref, const Vector3f &wi) const;
 
     // Returns the solid angle subtended by the triangle w.r.t. the given
     // reference point p.
     Float SolidAngle(const Point3f &p, int nSamples = 0) const;
 
+  protected:
+    // Triangle Protected Methods
+    // Kernel bodies shared by Triangle and the per-mesh specialized
+    // variants that CreateTriangleMesh() instantiates. When _MeshHasAlpha_
+    // is false the alpha-cutout tests compile away entirely, and when
+    // _HasShadingGeometry_ is false ComputeInteractionImpl() drops the
+    // shading normal and tangent interpolation; the generic methods above
+    // pass true and keep the runtime checks, so triangles created outside
+    // CreateTriangleMesh() behave as before.
+    template <bool MeshHasAlpha>
+    bool IntersectCompactImpl(const Ray &ray, Float *tHit, Point2f *bary,
+                              bool testAlphaTexture) const;
+    template <bool MeshHasAlpha>
+    bool IntersectPImpl(const Ray &ray, bool testAlphaTexture) const;
+    template <bool HasShadingGeometry>
+    void ComputeInteractionImpl(const Ray &ray, Float tHit,
+                                const Point2f &bary,
+                                SurfaceInteraction *isect) const;
+
   private:
     // Triangle Private Methods
     void GetUVs(Point2f uv[3]) const {
-        if (mesh->uv) {
-            uv[0] = mesh->uv[v[0]];
-            uv[1] = mesh->uv[v[1]];
-            uv[2] = mesh->uv[v[2]];
+        if (mesh->HasUVs()) {
+            uv[0] = mesh->UV(v[0]);
+            uv[1] = mesh->UV(v[1]);
+            uv[2] = mesh->UV(v[2]);
         } else {
             uv[0] = Point2f(0, 0);
             uv[1] = Point2f(1, 0);
@@ -119,7 +310,8 @@ std::vector<std::shared_ptr<Shape>> CreateTriangleMesh(
     const Vector3f *s, const Normal3f *n, const Point2f *uv,
     const std::shared_ptr<Texture<Float>> &alphaTexture,
     const std::shared_ptr<Texture<Float>> &shadowAlphaTexture,
-    const int *faceIndices = nullptr);
+    const int *faceIndices = nullptr, bool compactAttributes = false,
+    bool compactPositions = false);
 std::vector<std::shared_ptr<Shape>> CreateTriangleMeshShape(
     const Transform *o2w, const Transform *w2o, bool reverseOrientation,
     const ParamSet &params,
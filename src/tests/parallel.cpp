@@ -2,7 +2,12 @@
 #include "tests/gtest/gtest.h"
 #include "pbrt.h"
 #include "parallel.h"
+#include "rng.h"
+#include <algorithm>
 #include <atomic>
+#include <limits>
+#include <utility>
+#include <vector>
 
 using namespace pbrt;
 
@@ -37,3 +42,94 @@ TEST(Parallel, DoNothing) {
 
     ParallelCleanup();
 }
+
+// Exercise both the serial fallback (small counts) and the chunked
+// parallel paths (counts above the internal 4096-element threshold) of the
+// scan and reduction primitives against straightforward serial references.
+TEST(Parallel, Reduce) {
+    ParallelInit();
+
+    for (int64_t count : {0, 1, 100, 4095, 4096, 100000}) {
+        RNG rng(count);
+        std::vector<int64_t> v(count);
+        int64_t expected = 0;
+        for (int64_t i = 0; i < count; ++i) {
+            v[i] = rng.UniformUInt32() % 1000;
+            expected += v[i];
+        }
+
+        int64_t sum = ParallelReduce(
+            v.data(), count, int64_t(0),
+            [](int64_t a, int64_t b) { return a + b; });
+        EXPECT_EQ(expected, sum) << "count " << count;
+
+        int64_t max = ParallelReduce(
+            v.data(), count, std::numeric_limits<int64_t>::min(),
+            [](int64_t a, int64_t b) { return std::max(a, b); });
+        if (count == 0)
+            EXPECT_EQ(std::numeric_limits<int64_t>::min(), max);
+        else
+            EXPECT_EQ(*std::max_element(v.begin(), v.end()), max)
+                << "count " << count;
+    }
+
+    ParallelCleanup();
+}
+
+TEST(Parallel, ExclusiveScan) {
+    ParallelInit();
+
+    for (int64_t count : {0, 1, 100, 4095, 4096, 100000}) {
+        RNG rng(count);
+        std::vector<int64_t> v(count);
+        for (int64_t i = 0; i < count; ++i) v[i] = rng.UniformUInt32() % 1000;
+
+        std::vector<int64_t> expected(count);
+        int64_t running = 0;
+        for (int64_t i = 0; i < count; ++i) {
+            expected[i] = running;
+            running += v[i];
+        }
+
+        std::vector<int64_t> out(count);
+        int64_t total =
+            ParallelExclusiveScan(v.data(), count, out.data());
+        EXPECT_EQ(running, total) << "count " << count;
+        EXPECT_EQ(expected, out) << "count " << count;
+
+        // The scan may run in place.
+        total = ParallelExclusiveScan(v.data(), count, v.data());
+        EXPECT_EQ(running, total) << "count " << count;
+        EXPECT_EQ(expected, v) << "count " << count;
+    }
+
+    ParallelCleanup();
+}
+
+TEST(Parallel, Partition) {
+    ParallelInit();
+
+    for (int64_t count : {0, 1, 100, 4095, 4096, 100000}) {
+        RNG rng(count);
+        // Tag each element with its original index so stability is
+        // checkable.
+        std::vector<std::pair<int, int64_t>> v(count);
+        for (int64_t i = 0; i < count; ++i)
+            v[i] = {int(rng.UniformUInt32() % 100), i};
+        auto pred = [](const std::pair<int, int64_t> &p) {
+            return p.first < 37;
+        };
+
+        std::vector<std::pair<int, int64_t>> expected(v);
+        std::stable_partition(expected.begin(), expected.end(), pred);
+        int64_t expectedTrue =
+            std::count_if(v.begin(), v.end(), pred);
+
+        std::vector<std::pair<int, int64_t>> out(count);
+        int64_t nTrue = ParallelPartition(v.data(), count, out.data(), pred);
+        EXPECT_EQ(expectedTrue, nTrue) << "count " << count;
+        EXPECT_EQ(expected, out) << "count " << count;
+    }
+
+    ParallelCleanup();
+}
@@ -0,0 +1,56 @@
+
+#include "tests/gtest/gtest.h"
+#include <map>
+#include <set>
+#include "pbrt.h"
+#include "rng.h"
+
+using namespace pbrt;
+
+TEST(CounterRNG, Deterministic) {
+    // Values are a pure function of (key, counter): any order, any
+    // interleaving, any number of instances gives the same results.
+    CounterRNG rng(0x123456789abcdef0ULL);
+    CounterRNG rngSame(0x123456789abcdef0ULL);
+    for (uint64_t c = 1000; c-- > 0;) {
+        EXPECT_EQ(rng.UniformUInt32(c), rngSame.UniformUInt32(c));
+        EXPECT_EQ(rng.UniformFloat(c), rng.UniformFloat(c));
+    }
+
+    // Different keys give different streams.
+    CounterRNG rngOther(0x123456789abcdef1ULL);
+    int nSame = 0;
+    for (uint64_t c = 0; c < 1000; ++c)
+        if (rng.UniformUInt32(c) == rngOther.UniformUInt32(c)) ++nSame;
+    EXPECT_LT(nSame, 3);
+}
+
+TEST(CounterRNG, MixBitsInjective) {
+    // The counter mixer is an invertible 64-bit permutation, so distinct
+    // counters can never collide before the key is folded in.
+    std::set<uint64_t> seen;
+    for (uint64_t c = 0; c < 1 << 16; ++c)
+        EXPECT_TRUE(seen.insert(CounterRNG::MixBits(c)).second) << c;
+    // Also for sparse, structured counters like (pixel << 32) | sample.
+    for (uint64_t c = 1; c < 1 << 12; ++c)
+        EXPECT_TRUE(seen.insert(CounterRNG::MixBits(c << 32)).second) << c;
+}
+
+TEST(CounterRNG, Uniformity) {
+    // Consecutive counters--the common addressing pattern--should give
+    // roughly uniform floats.
+    CounterRNG rng(0xfeed);
+    const int n = 1 << 16, nBuckets = 64;
+    int bucketCount[nBuckets] = {0};
+    double sum = 0;
+    for (int c = 0; c < n; ++c) {
+        Float u = rng.UniformFloat(c);
+        EXPECT_GE(u, 0);
+        EXPECT_LT(u, 1);
+        sum += u;
+        ++bucketCount[int(u * nBuckets)];
+    }
+    EXPECT_NEAR(.5, sum / n, .01);
+    for (int b = 0; b < nBuckets; ++b)
+        EXPECT_NEAR(n / nBuckets, bucketCount[b], .15 * n / nBuckets) << b;
+}
@@ -279,6 +279,140 @@ TEST(Distribution1D, Discrete) {
     }
 }
 
+TEST(AliasTable, MatchesWeights) {
+    RNG rng;
+    // Use a size that isn't a power of two, and include zero weights.
+    std::vector<Float> w(257);
+    Float sum = 0;
+    for (size_t i = 0; i < w.size(); ++i) {
+        w[i] = (i % 5 == 0) ? 0. : rng.UniformFloat() + .01;
+        sum += w[i];
+    }
+    AliasTable table(&w[0], w.size());
+    EXPECT_EQ((int)w.size(), table.Count());
+
+    for (size_t i = 0; i < w.size(); ++i)
+        EXPECT_NEAR(w[i] / sum, table.PDF(i), 1e-5);
+
+    // Sample with a dense equidistributed set of u values and make sure the
+    // observed frequencies match the weights and that the returned PDF and
+    // remapped u value are consistent.
+    std::vector<int> count(w.size(), 0);
+    const int n = 1 << 20;
+    for (int j = 0; j < n; ++j) {
+        Float pdf, uRemapped;
+        int offset = table.Sample(RadicalInverse(0, j), &pdf, &uRemapped);
+        ASSERT_GE(offset, 0);
+        ASSERT_LT(offset, (int)w.size());
+        EXPECT_EQ(table.PDF(offset), pdf);
+        EXPECT_GE(uRemapped, 0);
+        EXPECT_LT(uRemapped, 1);
+        ++count[offset];
+    }
+    for (size_t i = 0; i < w.size(); ++i) {
+        if (w[i] == 0)
+            EXPECT_EQ(0, count[i]);
+        else
+            EXPECT_NEAR(w[i] / sum, Float(count[i]) / n,
+                        .05 * w[i] / sum + 1e-4);
+    }
+}
+
+TEST(AliasTable, Distribution1DConsistency) {
+    // A distribution big enough that SampleDiscrete() goes through the
+    // alias table rather than the CDF binary search; its results should
+    // agree with DiscretePDF() and with SampleDiscreteN().
+    RNG rng;
+    std::vector<Float> func(2048);
+    for (Float &f : func) f = rng.UniformFloat();
+    Distribution1D dist(&func[0], func.size());
+
+    std::vector<Float> u(8192);
+    for (size_t i = 0; i < u.size(); ++i) u[i] = RadicalInverse(0, i);
+    std::vector<int> offset(u.size());
+    std::vector<Float> pdf(u.size());
+    dist.SampleDiscreteN(&u[0], u.size(), &offset[0], &pdf[0]);
+
+    std::vector<int> count(func.size(), 0);
+    for (size_t i = 0; i < u.size(); ++i) {
+        Float pdfSingle;
+        EXPECT_EQ(offset[i], dist.SampleDiscrete(u[i], &pdfSingle));
+        EXPECT_EQ(pdf[i], pdfSingle);
+        EXPECT_FLOAT_EQ(dist.DiscretePDF(offset[i]), pdf[i]);
+        ++count[offset[i]];
+    }
+
+    // Coarse frequency check: aggregate the bins so the expected counts are
+    // large enough to be stable.
+    for (int chunk = 0; chunk < 16; ++chunk) {
+        Float expected = 0;
+        int observed = 0;
+        for (size_t i = chunk * func.size() / 16;
+             i < (chunk + 1) * func.size() / 16; ++i) {
+            expected += dist.DiscretePDF(i);
+            observed += count[i];
+        }
+        EXPECT_NEAR(expected, Float(observed) / u.size(), .05 * expected);
+    }
+}
+
+TEST(Hierarchical2DWarp, MatchesDistribution2D) {
+    // The hierarchical warp samples the same piecewise-constant density as
+    // Distribution2D, so their PDFs should agree and the warp's samples
+    // should integrate the function correctly. Resolutions must be powers
+    // of two; include non-square and single-row cases.
+    for (std::pair<int, int> res :
+         {std::make_pair(64, 32), std::make_pair(16, 16),
+          std::make_pair(1, 128), std::make_pair(4, 4)}) {
+        int nu = res.first, nv = res.second;
+        RNG rng(nu * nv);
+        std::vector<Float> func(nu * nv);
+        Float funcSum = 0;
+        for (Float &f : func) {
+            // Include zero-valued texels.
+            f = rng.UniformFloat() < .2 ? 0. : rng.UniformFloat() + .05;
+            funcSum += f;
+        }
+        if (funcSum == 0) func[0] = funcSum = 1;
+
+        Distribution2D ref(&func[0], nu, nv);
+        Hierarchical2DWarp warp(&func[0], nu, nv);
+
+        double areaEstimate = 0, integralEstimate = 0;
+        const int count = 64 * 1024;
+        for (int j = 0; j < count; ++j) {
+            Point2f u{RadicalInverse(0, j), RadicalInverse(1, j)};
+            Float pdf;
+            Point2f p = warp.SampleContinuous(u, &pdf);
+            ASSERT_GT(pdf, 0);
+            EXPECT_GE(p.x, 0);
+            EXPECT_LT(p.x, 1);
+            EXPECT_GE(p.y, 0);
+            EXPECT_LT(p.y, 1);
+
+            // The returned PDF, Pdf(), and Distribution2D's PDF are all
+            // the same piecewise-constant function.
+            EXPECT_NEAR(pdf, warp.Pdf(p), 1e-3 * pdf);
+            EXPECT_NEAR(pdf, ref.Pdf(p), 1e-3 * pdf);
+
+            areaEstimate += 1. / (count * pdf);
+            int iu = std::min(int(p.x * nu), nu - 1);
+            int iv = std::min(int(p.y * nv), nv - 1);
+            integralEstimate += func[iv * nu + iu] / (count * pdf);
+        }
+        // E[1/pdf] is the area of the function's support; E[f/pdf] is its
+        // integral.
+        double support = 0;
+        for (Float f : func)
+            if (f > 0) support += 1. / (nu * nv);
+        EXPECT_NEAR(support, areaEstimate, .02 * support)
+            << nu << "x" << nv;
+        EXPECT_NEAR(funcSum / (nu * nv), integralEstimate,
+                    .02 * funcSum / (nu * nv))
+            << nu << "x" << nv;
+    }
+}
+
 TEST(Distribution1D, Continuous) {
     Float func[] = {1, 1, 2, 4, 8};
     Distribution1D dist(func, sizeof(func) / sizeof(func[0]));
@@ -316,6 +316,52 @@ TEST(Triangle, SolidAngle) {
     }
 }
 
+// Triangle::Sample(ref, ...) samples uniformly in solid angle for
+// moderately-subtended triangles; check that the returned density is then
+// exactly the reciprocal subtended solid angle and that Triangle::Pdf()
+// reports a matching value for the sampled direction.
+TEST(Triangle, SphericalSampling) {
+    int nSpherical = 0;
+    for (int i = 0; i < 200; ++i) {
+        const Float range = 10;
+        RNG rng(1000 + i);
+        std::shared_ptr<Triangle> tri =
+            GetRandomTriangle([&]() { return pUnif(rng, range); });
+        if (!tri) continue;
+
+        Point3f pc{pUnif(rng, range), pUnif(rng, range), pUnif(rng, range)};
+        pc[rng.UniformUInt32() % 3] =
+            rng.UniformFloat() > .5 ? (-range - 3) : (range + 3);
+        Float solidAngle = tri->SolidAngle(pc);
+        // Stay conservatively inside the range where Sample() takes the
+        // spherical path rather than falling back to uniform-by-area.
+        bool spherical = solidAngle > 1e-3 && solidAngle < 6;
+        if (spherical) ++nSpherical;
+
+        Interaction ref(pc, Normal3f(), Vector3f(), Vector3f(0, 0, 1), 0,
+                        MediumInterface{});
+        for (int j = 0; j < 64; ++j) {
+            Point2f u{rng.UniformFloat(), rng.UniformFloat()};
+            Float pdf;
+            Interaction pTri = tri->Sample(ref, u, &pdf);
+            ASSERT_GT(pdf, 0);
+            if (spherical) EXPECT_FLOAT_EQ(1 / solidAngle, pdf);
+
+            // Pdf() should agree with the density Sample() reported for
+            // the direction it sampled. Round-off can make the ray toward
+            // a point right at the triangle's edge miss; skip those.
+            Vector3f wi = Normalize(pTri.p - pc);
+            Float pdfW = tri->Pdf(ref, wi);
+            if (pdfW > 0)
+                EXPECT_LT(std::abs(pdf - pdfW) / pdf, .01)
+                    << "pdf " << pdf << " vs Pdf() " << pdfW << ", tri " << i;
+        }
+    }
+    // The triangles above are large enough that the spherical path should
+    // be what's usually tested.
+    EXPECT_GT(nSpherical, 50);
+}
+
 // Use Quasi Monte Carlo with uniform sphere sampling to esimate the solid
 // angle subtended by the given shape from the given point.
 static Float mcSolidAngle(const Point3f &p, const Shape &shape, int nSamples) {
@@ -52,6 +52,12 @@ class ConstantTexture : public Texture<T> {
     // ConstantTexture Public Methods
     ConstantTexture(const T &value) : value(value) {}
     T Evaluate(const SurfaceInteraction &) const { return value; }
+    T EvaluateWithGradient(const SurfaceInteraction &, Float, Float, T *dfdu,
+                           T *dfdv) const {
+        *dfdu = *dfdv = T(0.f);
+        return value;
+    }
+    bool IsUVDriven() const { return true; }
 
   private:
     T value;
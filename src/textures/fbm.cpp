@@ -33,6 +33,7 @@
 
 // textures/fbm.cpp*
 #include "textures/fbm.h"
+#include "interaction.h"
 
 namespace pbrt {
 
@@ -42,6 +42,7 @@
 #include "pbrt.h"
 #include "texture.h"
 #include "paramset.h"
+#include <vector>
 
 namespace pbrt {
 
@@ -58,6 +59,17 @@ class FBmTexture : public Texture<T> {
         Point3f P = mapping->Map(si, &dpdx, &dpdy);
         return FBm(P, dpdx, dpdy, omega, octaves);
     }
+    void EvaluateN(const SurfaceInteraction si[], int n, T *out) const {
+        // Map the interactions, then sum the noise octaves in batches
+        std::vector<Point3f> P(n);
+        std::vector<Vector3f> dpdx(n), dpdy(n);
+        for (int i = 0; i < n; ++i)
+            P[i] = mapping->Map(si[i], &dpdx[i], &dpdy[i]);
+        std::vector<Float> fbm(n);
+        FBmN(P.data(), dpdx.data(), dpdy.data(), n, omega, octaves,
+             fbm.data());
+        for (int i = 0; i < n; ++i) out[i] = fbm[i];
+    }
 
   private:
     std::unique_ptr<TextureMapping3D> mapping;
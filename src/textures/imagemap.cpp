@@ -34,73 +34,262 @@
 // textures/imagemap.cpp*
 #include "textures/imagemap.h"
 #include "imageio.h"
+#include "interaction.h"
 #include "stats.h"
+#include "stringprint.h"
+#include <unordered_map>
 
 namespace pbrt {
 
+// ImageTexture Local Definitions
+
+// Decoded (and y-flipped) images, shared across both ImageTexture
+// instantiations and all parameter variants. Entries are keyed by a hash
+// of the decoded texels, so identical pixel data referenced under
+// different filenames is stored once; a second map remembers each
+// filename's hash so other parameter variants of a file skip the decode
+// entirely. The cache only lives while the scene parses -- see
+// ClearDecodedImageCache().
+struct DecodedImage {
+    Point2i resolution;
+    std::unique_ptr<RGBSpectrum[]> texels;
+};
+static std::unordered_map<uint64_t, std::shared_ptr<DecodedImage>>
+    decodedImages;
+static std::unordered_map<std::string, uint64_t> decodedImageHashes;
+static std::mutex decodedImageMutex;
+
+// Hash the decoded texels and resolution; FNV-1a.
+static uint64_t HashDecodedImage(const DecodedImage &img) {
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&hash](const void *data, size_t size) {
+        const unsigned char *bytes = (const unsigned char *)data;
+        for (size_t i = 0; i < size; ++i) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+    };
+    mix(&img.resolution, sizeof(img.resolution));
+    mix(img.texels.get(),
+        (size_t)img.resolution.x * img.resolution.y * sizeof(RGBSpectrum));
+    return hash;
+}
+
+// Return _filename_'s decoded image, reading and flipping it only if no
+// other parameter variant has already done so, or nullptr if it can't be
+// read. Concurrent first loads of the same file (e.g. by the texture
+// preloading workers) may both decode it; the first to publish wins and
+// the duplicate is discarded, mirroring how the MIPMap cache below
+// resolves the same race.
+static std::shared_ptr<DecodedImage> GetDecodedImage(
+    const std::string &filename) {
+    {
+        std::lock_guard<std::mutex> lock(decodedImageMutex);
+        auto iter = decodedImageHashes.find(filename);
+        if (iter != decodedImageHashes.end())
+            return decodedImages[iter->second];
+    }
+
+    auto img = std::make_shared<DecodedImage>();
+    img->texels = ReadImage(filename, &img->resolution);
+    if (!img->texels) return nullptr;
+
+    // Flip image in y; texture coordinate space has (0,0) at the lower
+    // left corner.
+    for (int y = 0; y < img->resolution.y / 2; ++y)
+        for (int x = 0; x < img->resolution.x; ++x) {
+            int o1 = y * img->resolution.x + x;
+            int o2 = (img->resolution.y - 1 - y) * img->resolution.x + x;
+            std::swap(img->texels[o1], img->texels[o2]);
+        }
+
+    uint64_t hash = HashDecodedImage(*img);
+    std::lock_guard<std::mutex> lock(decodedImageMutex);
+    decodedImageHashes[filename] = hash;
+    std::shared_ptr<DecodedImage> &entry = decodedImages[hash];
+    if (!entry) entry = std::move(img);
+    return entry;
+}
+
+void ClearDecodedImageCache() {
+    std::lock_guard<std::mutex> lock(decodedImageMutex);
+    decodedImages.clear();
+    decodedImageHashes.clear();
+}
+
+// Substitute the tile number for the "<UDIM>" marker in _pattern_.
+static std::string UdimTileFilename(const std::string &pattern,
+                                    int tileNumber) {
+    std::string filename = pattern;
+    size_t pos = filename.find("<UDIM>");
+    CHECK_NE(pos, std::string::npos);
+    filename.replace(pos, 6, StringPrintf("%d", tileNumber));
+    return filename;
+}
+
 // ImageTexture Method Definitions
 template <typename Tmemory, typename Treturn>
 ImageTexture<Tmemory, Treturn>::ImageTexture(
     std::unique_ptr<TextureMapping2D> mapping, const std::string &filename,
     bool doTrilinear, Float maxAniso, ImageWrap wrapMode, Float scale,
-    bool gamma)
+    bool gamma, bool compress)
     : mapping(std::move(mapping)) {
-    mipmap =
-        GetTexture(filename, doTrilinear, maxAniso, wrapMode, scale, gamma);
+    if (filename.find("<UDIM>") != std::string::npos) {
+        // UDIM atlas: remember the pattern and parameters; each tile's
+        // MIP map is bound by TileMipMap() on its first lookup, so tiles
+        // the renderer never touches are never read.
+        udimPattern = filename;
+        udimParams = {doTrilinear, maxAniso, wrapMode, scale, gamma,
+                      compress};
+        udimTiles.reset(new std::atomic<MIPMap<Tmemory> *>[nUdimTiles]);
+        for (int i = 0; i < nUdimTiles; ++i)
+            udimTiles[i].store(nullptr, std::memory_order_relaxed);
+        mipmap = nullptr;
+    } else
+        mipmap = GetTexture(filename, doTrilinear, maxAniso, wrapMode, scale,
+                            gamma, compress);
+}
+
+template <typename Tmemory, typename Treturn>
+MIPMap<Tmemory> *ImageTexture<Tmemory, Treturn>::TileMipMap(
+    Point2f *st) const {
+    // UDIM tiles cover the unit squares of a 10x10 layout starting at the
+    // origin: tile 1001 + u + 10 * v spans [u, u + 1) x [v, v + 1).
+    // Lookups outside the layout clamp to its edge tiles.
+    Float us = std::floor(st->x), vs = std::floor(st->y);
+    st->x -= us;
+    st->y -= vs;
+    int tile =
+        10 * Clamp((int)vs, 0, 9) + Clamp((int)us, 0, 9);
+    MIPMap<Tmemory> *m = udimTiles[tile].load(std::memory_order_acquire);
+    if (!m) {
+        // First access binds the tile. Concurrent binds are harmless:
+        // GetTexture() returns one shared MIPMap per resolved filename,
+        // so every thread stores the same pointer.
+        m = GetTexture(UdimTileFilename(udimPattern, 1001 + tile),
+                       udimParams.doTrilinear, udimParams.maxAniso,
+                       udimParams.wrapMode, udimParams.scale,
+                       udimParams.gamma, udimParams.compress);
+        udimTiles[tile].store(m, std::memory_order_release);
+    }
+    return m;
 }
 
 template <typename Tmemory, typename Treturn>
 MIPMap<Tmemory> *ImageTexture<Tmemory, Treturn>::GetTexture(
     const std::string &filename, bool doTrilinear, Float maxAniso,
-    ImageWrap wrap, Float scale, bool gamma) {
+    ImageWrap wrap, Float scale, bool gamma, bool compress) {
     // Return _MIPMap_ from texture cache if present
-    TexInfo texInfo(filename, doTrilinear, maxAniso, wrap, scale, gamma);
-    if (textures.find(texInfo) != textures.end())
-        return textures[texInfo].get();
+    TexInfo texInfo(filename, doTrilinear, maxAniso, wrap, scale, gamma,
+                    compress);
+    {
+        std::lock_guard<std::mutex> lock(textureCacheMutex);
+        auto iter = textures.find(texInfo);
+        if (iter != textures.end()) return iter->second.get();
+    }
 
     // Create _MIPMap_ for _filename_
     ProfilePhase _(Prof::TextureLoading);
-    Point2i resolution;
-    std::unique_ptr<RGBSpectrum[]> texels = ReadImage(filename, &resolution);
-    if (!texels) {
-        Warning("Creating a constant grey texture to replace \"%s\".",
-                filename.c_str());
-        resolution.x = resolution.y = 1;
-        RGBSpectrum *rgb = new RGBSpectrum[1];
-        *rgb = RGBSpectrum(0.5f);
-        texels.reset(rgb);
-    }
+    MIPMap<Tmemory> *mipmap = nullptr;
 
-    // Flip image in y; texture coordinate space has (0,0) at the lower
-    // left corner.
-    for (int y = 0; y < resolution.y / 2; ++y)
-        for (int x = 0; x < resolution.x; ++x) {
-            int o1 = y * resolution.x + x;
-            int o2 = (resolution.y - 1 - y) * resolution.x + x;
-            std::swap(texels[o1], texels[o2]);
+    // Pre-mipped .txp files are mapped and wrapped directly; on failure fall
+    // through, where _ReadImage()_ reports the error and the constant grey
+    // replacement below takes over. Block compression doesn't apply here:
+    // mapped levels cost no heap memory to begin with.
+    if (HasExtension(filename, ".txp"))
+        mipmap = GetTxpTexture(filename, doTrilinear, maxAniso, wrap, scale,
+                               gamma);
+    if (!mipmap) {
+        std::shared_ptr<DecodedImage> img = GetDecodedImage(filename);
+        if (!img) {
+            Warning("Creating a constant grey texture to replace \"%s\".",
+                    filename.c_str());
+            img = std::make_shared<DecodedImage>();
+            img->resolution.x = img->resolution.y = 1;
+            img->texels.reset(new RGBSpectrum[1]);
+            img->texels[0] = RGBSpectrum(0.5f);
         }
 
-    MIPMap<Tmemory> *mipmap = nullptr;
-    if (texels) {
         // Convert texels to type _Tmemory_ and create _MIPMap_
+        const Point2i &resolution = img->resolution;
         std::unique_ptr<Tmemory[]> convertedTexels(
             new Tmemory[resolution.x * resolution.y]);
         for (int i = 0; i < resolution.x * resolution.y; ++i)
-            convertIn(texels[i], &convertedTexels[i], scale, gamma);
+            convertIn(img->texels[i], &convertedTexels[i], scale, gamma);
         mipmap = new MIPMap<Tmemory>(resolution, convertedTexels.get(),
-                                     doTrilinear, maxAniso, wrap);
-    } else {
-        // Create one-valued _MIPMap_
-        Tmemory oneVal = scale;
-        mipmap = new MIPMap<Tmemory>(Point2i(1, 1), &oneVal);
+                                     doTrilinear, maxAniso, wrap, compress);
     }
-    textures[texInfo].reset(mipmap);
+    if (PbrtOptions.texAccessReport) mipmap->SetAccessName(filename);
+    std::lock_guard<std::mutex> lock(textureCacheMutex);
+    std::unique_ptr<MIPMap<Tmemory>> &entry = textures[texInfo];
+    if (entry) {
+        // Another thread loaded the same texture concurrently; keep its
+        // copy, since MIPMap pointers it returned are already in use.
+        delete mipmap;
+        return entry.get();
+    }
+    entry.reset(mipmap);
     return mipmap;
 }
 
+// Wrap a pre-mipped .txp file (written by "imgtool maketx") as a MIPMap
+// without rebuilding the pyramid. When the map's texel layout matches the
+// file's RGB float32 texels and no scale or gamma adjustment is needed, the
+// levels alias the read-only file mapping directly and cost no heap memory;
+// otherwise each level is converted through _convertIn()_ as usual. Returns
+// nullptr if the file can't be read.
+template <typename Tmemory, typename Treturn>
+MIPMap<Tmemory> *ImageTexture<Tmemory, Treturn>::GetTxpTexture(
+    const std::string &filename, bool doTrilinear, Float maxAniso,
+    ImageWrap wrap, Float scale, bool gamma) {
+    TxpFile txp;
+    if (!ReadTxpFile(filename, &txp)) return nullptr;
+    if ((ImageWrap)txp.header.wrapMode != wrap)
+        Warning(
+            "\"%s\" was pre-mipped with a different wrap mode than the "
+            "scene requests; its boundary resampling may not match.",
+            filename.c_str());
+
+    Point2i resolution(txp.header.resolution[0], txp.header.resolution[1]);
+    std::vector<const Tmemory *> levels;
+    if (std::is_same<Tmemory, RGBSpectrum>::value &&
+        sizeof(Tmemory) == 3 * sizeof(float) && scale == 1 && !gamma) {
+        // Zero-copy: the levels alias the file mapping
+        for (const float *level : txp.levels)
+            levels.push_back(reinterpret_cast<const Tmemory *>(level));
+        return new MIPMap<Tmemory>(resolution, std::move(levels),
+                                   txp.mapping, 0, doTrilinear, maxAniso,
+                                   wrap);
+    }
+
+    // Convert the levels to _Tmemory_, applying scale and gamma as usual
+    size_t nTexels = 0;
+    for (size_t i = 0; i < txp.levels.size(); ++i)
+        nTexels += (size_t)std::max(1, resolution.x >> i) *
+                   std::max(1, resolution.y >> i);
+    std::shared_ptr<Tmemory> converted(new Tmemory[nTexels],
+                                       std::default_delete<Tmemory[]>());
+    Tmemory *dst = converted.get();
+    for (size_t i = 0; i < txp.levels.size(); ++i) {
+        levels.push_back(dst);
+        size_t n = (size_t)std::max(1, resolution.x >> i) *
+                   std::max(1, resolution.y >> i);
+        const float *src = txp.levels[i];
+        for (size_t j = 0; j < n; ++j, ++dst, src += 3) {
+            Float rgb[3] = {src[0], src[1], src[2]};
+            convertIn(RGBSpectrum::FromRGB(rgb), dst, scale, gamma);
+        }
+    }
+    return new MIPMap<Tmemory>(resolution, std::move(levels), converted,
+                               nTexels * sizeof(Tmemory), doTrilinear,
+                               maxAniso, wrap);
+}
+
 template <typename Tmemory, typename Treturn>
 std::map<TexInfo, std::unique_ptr<MIPMap<Tmemory>>>
     ImageTexture<Tmemory, Treturn>::textures;
+template <typename Tmemory, typename Treturn>
+std::mutex ImageTexture<Tmemory, Treturn>::textureCacheMutex;
 ImageTexture<Float, Float> *CreateImageFloatTexture(const Transform &tex2world,
                                                     const TextureParams &tp) {
     // Initialize 2D texture mapping _map_ from _tp_
@@ -139,8 +328,15 @@ ImageTexture<Float, Float> *CreateImageFloatTexture(const Transform &tex2world,
     std::string filename = tp.FindFilename("filename");
     bool gamma = tp.FindBool("gamma", HasExtension(filename, ".tga") ||
                                           HasExtension(filename, ".png"));
+    std::string encoding = tp.FindString("encoding", "float");
+    if (encoding != "float" && encoding != "compressed") {
+        Error("Texture encoding \"%s\" unknown; using \"float\".",
+              encoding.c_str());
+        encoding = "float";
+    }
     return new ImageTexture<Float, Float>(std::move(map), filename, trilerp,
-                                          maxAniso, wrapMode, scale, gamma);
+                                          maxAniso, wrapMode, scale, gamma,
+                                          encoding == "compressed");
 }
 
 ImageTexture<RGBSpectrum, Spectrum> *CreateImageSpectrumTexture(
@@ -181,8 +377,46 @@ ImageTexture<RGBSpectrum, Spectrum> *CreateImageSpectrumTexture(
     std::string filename = tp.FindFilename("filename");
     bool gamma = tp.FindBool("gamma", HasExtension(filename, ".tga") ||
                                           HasExtension(filename, ".png"));
+    std::string encoding = tp.FindString("encoding", "float");
+    if (encoding != "float" && encoding != "compressed") {
+        Error("Texture encoding \"%s\" unknown; using \"float\".",
+              encoding.c_str());
+        encoding = "float";
+    }
     return new ImageTexture<RGBSpectrum, Spectrum>(
-        std::move(map), filename, trilerp, maxAniso, wrapMode, scale, gamma);
+        std::move(map), filename, trilerp, maxAniso, wrapMode, scale, gamma,
+        encoding == "compressed");
+}
+
+template <typename Tmemory, typename Treturn>
+Treturn ImageTexture<Tmemory, Treturn>::EvaluateWithGradient(
+    const SurfaceInteraction &si, Float du, Float dv, Treturn *dfdu,
+    Treturn *dfdv) const {
+    // Filtered value and its exact (s, t) derivatives in one lookup
+    Vector2f dstdx, dstdy;
+    Point2f st = mapping->Map(si, &dstdx, &dstdy);
+    MIPMap<Tmemory> *map = udimTiles ? TileMipMap(&st) : mipmap;
+    Tmemory dfds, dfdt;
+    Tmemory mem = map->LookupWithGradient(st, dstdx, dstdy, &dfds, &dfdt);
+
+    // Chain the (s, t) derivatives to (u, v) through the mapping's
+    // Jacobian, finite-differenced from the shifted interactions; the
+    // mapping evaluations are pure arithmetic, so no further texels are
+    // touched.
+    SurfaceInteraction siShift = si;
+    siShift.p = si.p + du * si.shading.dpdu;
+    siShift.uv = si.uv + Vector2f(du, 0.f);
+    Point2f stU = mapping->Map(siShift, &dstdx, &dstdy);
+    siShift.p = si.p + dv * si.shading.dpdv;
+    siShift.uv = si.uv + Vector2f(0.f, dv);
+    Point2f stV = mapping->Map(siShift, &dstdx, &dstdy);
+    Tmemory memDu = dfds * ((stU.x - st.x) / du) + dfdt * ((stU.y - st.y) / du);
+    Tmemory memDv = dfds * ((stV.x - st.x) / dv) + dfdt * ((stV.y - st.y) / dv);
+    Treturn ret;
+    convertOut(mem, &ret);
+    convertOut(memDu, dfdu);
+    convertOut(memDv, dfdv);
+    return ret;
 }
 
 template class ImageTexture<Float, Float>;
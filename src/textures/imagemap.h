@@ -43,32 +43,37 @@
 #include "texture.h"
 #include "mipmap.h"
 #include "paramset.h"
+#include <atomic>
 #include <map>
+#include <mutex>
 
 namespace pbrt {
 
 // TexInfo Declarations
 struct TexInfo {
     TexInfo(const std::string &f, bool dt, Float ma, ImageWrap wm, Float sc,
-            bool gamma)
+            bool gamma, bool compress)
         : filename(f),
           doTrilinear(dt),
           maxAniso(ma),
           wrapMode(wm),
           scale(sc),
-          gamma(gamma) {}
+          gamma(gamma),
+          compress(compress) {}
     std::string filename;
     bool doTrilinear;
     Float maxAniso;
     ImageWrap wrapMode;
     Float scale;
     bool gamma;
+    bool compress;
     bool operator<(const TexInfo &t2) const {
         if (filename != t2.filename) return filename < t2.filename;
         if (doTrilinear != t2.doTrilinear) return doTrilinear < t2.doTrilinear;
         if (maxAniso != t2.maxAniso) return maxAniso < t2.maxAniso;
         if (scale != t2.scale) return scale < t2.scale;
         if (gamma != t2.gamma) return !gamma;
+        if (compress != t2.compress) return !compress;
         return wrapMode < t2.wrapMode;
     }
 };
@@ -80,24 +85,45 @@ class ImageTexture : public Texture<Treturn> {
     // ImageTexture Public Methods
     ImageTexture(std::unique_ptr<TextureMapping2D> m,
                  const std::string &filename, bool doTri, Float maxAniso,
-                 ImageWrap wm, Float scale, bool gamma);
+                 ImageWrap wm, Float scale, bool gamma,
+                 bool compress = false);
     static void ClearCache() {
+        std::lock_guard<std::mutex> lock(textureCacheMutex);
         textures.erase(textures.begin(), textures.end());
     }
     Treturn Evaluate(const SurfaceInteraction &si) const {
         Vector2f dstdx, dstdy;
         Point2f st = mapping->Map(si, &dstdx, &dstdy);
-        Tmemory mem = mipmap->Lookup(st, dstdx, dstdy);
+        MIPMap<Tmemory> *map = udimTiles ? TileMipMap(&st) : mipmap;
+        Tmemory mem = map->Lookup(st, dstdx, dstdy);
         Treturn ret;
         convertOut(mem, &ret);
         return ret;
     }
+    // Answers from a single filtered lookup: the MIP map returns the
+    // filtered value along with its (s, t) derivatives, which are chained
+    // through the mapping's finite-differenced Jacobian to (u, v).
+    Treturn EvaluateWithGradient(const SurfaceInteraction &si, Float du,
+                                 Float dv, Treturn *dfdu,
+                                 Treturn *dfdv) const;
+    bool IsUVDriven() const { return mapping->IsUVMapping(); }
 
   private:
     // ImageTexture Private Methods
+    // The MIPMap cache is shared across threads: the texture preloading
+    // workers (see api.cpp) load images concurrently during parsing.
     static MIPMap<Tmemory> *GetTexture(const std::string &filename,
                                        bool doTrilinear, Float maxAniso,
-                                       ImageWrap wm, Float scale, bool gamma);
+                                       ImageWrap wm, Float scale, bool gamma,
+                                       bool compress);
+    static MIPMap<Tmemory> *GetTxpTexture(const std::string &filename,
+                                          bool doTrilinear, Float maxAniso,
+                                          ImageWrap wm, Float scale,
+                                          bool gamma);
+    // Select the UDIM tile from the integer part of *st, leaving the
+    // fractional part for the lookup; the tile's MIP map is bound (loaded
+    // through the shared cache) on its first access.
+    MIPMap<Tmemory> *TileMipMap(Point2f *st) const;
     static void convertIn(const RGBSpectrum &from, RGBSpectrum *to, Float scale,
                           bool gamma) {
         for (int i = 0; i < RGBSpectrum::nSamples; ++i)
@@ -117,12 +143,33 @@ class ImageTexture : public Texture<Treturn> {
     // ImageTexture Private Data
     std::unique_ptr<TextureMapping2D> mapping;
     MIPMap<Tmemory> *mipmap;
+    // UDIM state: when the filename carries a "<UDIM>" marker, _mipmap_
+    // stays null, _udimTiles_ holds the (lazily bound) per-tile MIP maps
+    // of the standard 10x10 layout, and _udimParams_ keeps the creation
+    // parameters the deferred GetTexture() calls need.
+    static PBRT_CONSTEXPR int nUdimTiles = 100;
+    std::string udimPattern;
+    struct {
+        bool doTrilinear;
+        Float maxAniso;
+        ImageWrap wrapMode;
+        Float scale;
+        bool gamma;
+        bool compress;
+    } udimParams;
+    mutable std::unique_ptr<std::atomic<MIPMap<Tmemory> *>[]> udimTiles;
     static std::map<TexInfo, std::unique_ptr<MIPMap<Tmemory>>> textures;
+    static std::mutex textureCacheMutex;
 };
 
 extern template class ImageTexture<Float, Float>;
 extern template class ImageTexture<RGBSpectrum, Spectrum>;
 
+// Release the cache of decoded images that MIPMap construction draws
+// from; called once parsing is done, since the MIPMaps themselves don't
+// reference it and no more textures will be created during rendering.
+void ClearDecodedImageCache();
+
 ImageTexture<Float, Float> *CreateImageFloatTexture(const Transform &tex2world,
                                                     const TextureParams &tp);
 ImageTexture<RGBSpectrum, Spectrum> *CreateImageSpectrumTexture(
@@ -55,10 +55,14 @@ class MixTexture : public Texture<T> {
                const std::shared_ptr<Texture<Float>> &amount)
         : tex1(tex1), tex2(tex2), amount(amount) {}
     T Evaluate(const SurfaceInteraction &si) const {
-        T t1 = tex1->Evaluate(si), t2 = tex2->Evaluate(si);
-        Float amt = amount->Evaluate(si);
+        T t1 = EvaluateMemoized(tex1, si), t2 = EvaluateMemoized(tex2, si);
+        Float amt = EvaluateMemoized(amount, si);
         return (1 - amt) * t1 + amt * t2;
     }
+    bool IsUVDriven() const {
+        return tex1->IsUVDriven() && tex2->IsUVDriven() &&
+               amount->IsUVDriven();
+    }
 
   private:
     std::shared_ptr<Texture<T>> tex1, tex2;
@@ -35,6 +35,7 @@
 
 #include "error.h"
 #include "interaction.h"
+#include "parallel.h"
 #include "paramset.h"
 #include "stats.h"
 
@@ -44,10 +45,15 @@ namespace pbrt {
 
 namespace {
 
-// Reference count for the cache. Note: we assume that PtexTextures aren't
-// being created/destroyed concurrently by multiple threads.
+// The ptex caches are sharded: each file is bound to one cache by a hash
+// of its filename, so concurrent first touches of different textures
+// don't serialize on a single cache's internal lock. (Steady-state
+// lookups don't take it at all; see PerThreadHandle below.) Note: we
+// assume that PtexTextures aren't being created/destroyed concurrently
+// by multiple threads.
+PBRT_CONSTEXPR int nCacheShards = 8;
 int nActiveTextures;
-Ptex::PtexCache *cache;
+Ptex::PtexCache *cacheShards[nCacheShards];
 
 STAT_COUNTER("Texture/Ptex lookups", nLookups);
 STAT_COUNTER("Texture/Ptex files accessed", nFilesAccessed);
@@ -58,29 +64,52 @@ struct : public PtexErrorHandler {
     void reportError(const char *error) override { Error("%s", error); }
 } errorHandler;
 
+// FNV-1a of the filename selects the file's cache shard
+Ptex::PtexCache *ShardForFile(const std::string &filename) {
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : filename) {
+        hash ^= (unsigned char)c;
+        hash *= 1099511628211ull;
+    }
+    return cacheShards[hash % nCacheShards];
+}
+
 }  // anonymous namespace
 
+// Each thread's pinned texture and filter for one PtexTexture; ptex
+// filters aren't thread-safe to share, and going back through
+// PtexCache::get() on every lookup contends on the cache lock.
+template <typename T>
+struct PtexTexture<T>::PerThreadHandle {
+    Ptex::PtexTexture *texture = nullptr;
+    Ptex::PtexFilter *filter = nullptr;
+};
+
 // PtexTexture Method Definitions
 template <typename T>
 PtexTexture<T>::PtexTexture(const std::string &filename, Float gamma)
     : filename(filename), gamma(gamma) {
-    if (!cache) {
+    if (!cacheShards[0]) {
         CHECK_EQ(nActiveTextures, 0);
         int maxFiles = 100;
-        size_t maxMem = 1ull << 32;  // 4GB
+        size_t maxMem = 1ull << 32;  // 4GB across all of the shards
         bool premultiply = true;
 
-        cache = Ptex::PtexCache::create(maxFiles, maxMem, premultiply, nullptr,
-                                        &errorHandler);
+        for (int i = 0; i < nCacheShards; ++i)
+            cacheShards[i] =
+                Ptex::PtexCache::create(maxFiles, maxMem / nCacheShards,
+                                        premultiply, nullptr, &errorHandler);
         // TODO? cache->setSearchPath(...);
     }
     ++nActiveTextures;
+    threadHandles.reset(new PerThreadHandle[MaxThreadIndex()]);
 
     // Issue an error if the texture doesn't exist or has an unsupported
     // number of channels.
     valid = false;
     Ptex::String error;
-    Ptex::PtexTexture *texture = cache->get(filename.c_str(), error);
+    Ptex::PtexTexture *texture =
+        ShardForFile(filename)->get(filename.c_str(), error);
     if (!texture)
         Error("%s", error.c_str());
     else {
@@ -97,16 +126,24 @@ PtexTexture<T>::PtexTexture(const std::string &filename, Float gamma)
 
 template <typename T>
 PtexTexture<T>::~PtexTexture() {
+    // Release the per-thread handles before the caches can go away below
+    for (int i = 0; i < MaxThreadIndex(); ++i) {
+        if (threadHandles[i].filter) threadHandles[i].filter->release();
+        if (threadHandles[i].texture) threadHandles[i].texture->release();
+    }
+
     if (--nActiveTextures == 0) {
         LOG(INFO) << "Releasing ptex cache";
-        Ptex::PtexCache::Stats stats;
-        cache->getStats(stats);
-        nFilesAccessed += stats.filesAccessed;
-        nBlockReads += stats.blockReads;
-        peakMemoryUsed = stats.peakMemUsed;
-
-        cache->release();
-        cache = nullptr;
+        for (int i = 0; i < nCacheShards; ++i) {
+            Ptex::PtexCache::Stats stats;
+            cacheShards[i]->getStats(stats);
+            nFilesAccessed += stats.filesAccessed;
+            nBlockReads += stats.blockReads;
+            peakMemoryUsed += stats.peakMemUsed;
+
+            cacheShards[i]->release();
+            cacheShards[i] = nullptr;
+        }
     }
 }
 
@@ -140,20 +177,26 @@ T PtexTexture<T>::Evaluate(const SurfaceInteraction &si) const {
     if (!valid) return T{};
 
     ++nLookups;
-    Ptex::String error;
-    Ptex::PtexTexture *texture = cache->get(filename.c_str(), error);
-    CHECK(texture != nullptr);
-    // TODO: make the filter an option?
-    Ptex::PtexFilter::Options opts(Ptex::PtexFilter::FilterType::f_bspline);
-    Ptex::PtexFilter *filter = Ptex::PtexFilter::getFilter(texture, opts);
-    int nc = texture->numChannels();
+    // Get the calling thread's handle for this texture, pinning the file
+    // and building a filter on the thread's first lookup; after that,
+    // evaluations touch no shared cache state.
+    PerThreadHandle &handle = threadHandles[ThreadIndex];
+    if (!handle.filter) {
+        Ptex::String error;
+        handle.texture = ShardForFile(filename)->get(filename.c_str(), error);
+        CHECK(handle.texture != nullptr);
+        // TODO: make the filter an option?
+        Ptex::PtexFilter::Options opts(
+            Ptex::PtexFilter::FilterType::f_bspline);
+        handle.filter = Ptex::PtexFilter::getFilter(handle.texture, opts);
+    }
+    int nc = handle.texture->numChannels();
 
     float result[3];
     int firstChan = 0;
-    filter->eval(result, firstChan, nc, si.faceIndex, si.uv[0],
-                 si.uv[1], si.dudx, si.dvdx, si.dudy, si.dvdy);
-    filter->release();
-    texture->release();
+    si.EnsureDifferentials();
+    handle.filter->eval(result, firstChan, nc, si.faceIndex, si.uv[0],
+                        si.uv[1], si.dudx, si.dvdx, si.dudy, si.dvdy);
 
     if (gamma != 1)
         for (int i = 0; i < nc; ++i)
@@ -42,6 +42,7 @@
 #include "pbrt.h"
 #include "texture.h"
 
+#include <memory>
 #include <string>
 
 namespace pbrt {
@@ -56,9 +57,14 @@ class PtexTexture : public Texture<T> {
     T Evaluate(const SurfaceInteraction &) const;
 
   private:
+    // Per-thread texture and filter handles, created lazily the first
+    // time each thread evaluates this texture, so that lookups don't take
+    // the ptex cache's internal lock (see ptex.cpp).
+    struct PerThreadHandle;
     bool valid;
     const std::string filename;
     const Float gamma;
+    mutable std::unique_ptr<PerThreadHandle[]> threadHandles;
 };
 
 PtexTexture<Float> *CreatePtexFloatTexture(const Transform &tex2world,
@@ -54,7 +54,10 @@ class ScaleTexture : public Texture<T2> {
                  const std::shared_ptr<Texture<T2>> &tex2)
         : tex1(tex1), tex2(tex2) {}
     T2 Evaluate(const SurfaceInteraction &si) const {
-        return tex1->Evaluate(si) * tex2->Evaluate(si);
+        return EvaluateMemoized(tex1, si) * EvaluateMemoized(tex2, si);
+    }
+    bool IsUVDriven() const {
+        return tex1->IsUVDriven() && tex2->IsUVDriven();
     }
 
   private:
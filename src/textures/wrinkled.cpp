@@ -33,6 +33,7 @@
 
 // textures/wrinkled.cpp*
 #include "textures/wrinkled.h"
+#include "interaction.h"
 
 namespace pbrt {
 
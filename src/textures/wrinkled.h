@@ -42,6 +42,7 @@
 #include "pbrt.h"
 #include "texture.h"
 #include "paramset.h"
+#include <vector>
 
 namespace pbrt {
 
@@ -58,6 +59,17 @@ class WrinkledTexture : public Texture<T> {
         Point3f p = mapping->Map(si, &dpdx, &dpdy);
         return Turbulence(p, dpdx, dpdy, omega, octaves);
     }
+    void EvaluateN(const SurfaceInteraction si[], int n, T *out) const {
+        // Map the interactions, then sum the noise octaves in batches
+        std::vector<Point3f> p(n);
+        std::vector<Vector3f> dpdx(n), dpdy(n);
+        for (int i = 0; i < n; ++i)
+            p[i] = mapping->Map(si[i], &dpdx[i], &dpdy[i]);
+        std::vector<Float> turb(n);
+        TurbulenceN(p.data(), dpdx.data(), dpdy.data(), n, omega, octaves,
+                    turb.data());
+        for (int i = 0; i < n; ++i) out[i] = turb[i];
+    }
 
   private:
     // WrinkledTexture Private Data
@@ -397,22 +397,93 @@ bool CyHair::ToCubicBezierCurves(std::vector<float> *vertices,
 // The above is cyhair_loader.{h,cc} basically directly; pbrt specific
 // code follows...
 
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <algorithm>
+#include <string>
+#include <thread>
 #include <vector>
 
+// Accumulates a pbrt token stream in memory, either as scene file text or
+// as the binary scene format that pbrt's tokenizer reads directly (see the
+// .pbb format notes in core/parser.cpp: 'S' records hold length-prefixed
+// tokens, quotes included, and 'N' records hold binary doubles). Each
+// conversion thread fills its own buffer and the buffers are concatenated
+// in strand order, so the output is independent of thread scheduling.
+class SceneBuffer {
+  public:
+    explicit SceneBuffer(bool binary) : binary(binary) {}
+
+    // A bare directive or parameter-list punctuation token.
+    void Token(const char *s) {
+        if (binary)
+            Record(s, strlen(s));
+        else {
+            buf += s;
+            buf += ' ';
+        }
+    }
+    void String(const std::string &s) {
+        if (binary) {
+            std::string quoted;
+            quoted.reserve(s.size() + 2);
+            quoted += '"';
+            quoted += s;
+            quoted += '"';
+            Record(quoted.data(), quoted.size());
+        } else {
+            buf += '"';
+            buf += s;
+            buf += "\" ";
+        }
+    }
+    void Number(double d) {
+        if (binary) {
+            buf += 'N';
+            buf.append(reinterpret_cast<const char *>(&d), sizeof(d));
+        } else {
+            char s[64];
+            snprintf(s, sizeof(s), "%.10g ", d);
+            buf += s;
+        }
+    }
+    void Newline() {
+        if (!binary) buf += '\n';
+    }
+
+    std::string &Contents() { return buf; }
+
+  private:
+    void Record(const char *ptr, size_t len) {
+        buf += 'S';
+        uint32_t n = static_cast<uint32_t>(len);
+        buf.append(reinterpret_cast<const char *>(&n), sizeof(n));
+        buf.append(ptr, len);
+    }
+
+    bool binary;
+    std::string buf;
+};
+
 int main(int argc, char *argv[]) {
     if (argc <= 2 || strcmp(argv[1], "--help") == 0 ||
         strcmp(argv[1], "-h") == 0) {
         fprintf(stderr,
                 "usage: cyhair2pbrt [CyHair filename] [pbrt output filename] "
-                "(max strands) (thickness)\n");
+                "(max strands) (thickness)\n"
+                "A \".pbb\" output filename selects pbrt's binary scene "
+                "format.\n");
         return EXIT_FAILURE;
     }
 
-    FILE *f = (strcmp(argv[2], "-") == 0) ? stdout : fopen(argv[2], "w");
+    size_t outLen = strlen(argv[2]);
+    const bool binaryOutput =
+        outLen > 4 && strcmp(argv[2] + outLen - 4, ".pbb") == 0;
+    FILE *f = (strcmp(argv[2], "-") == 0)
+                  ? stdout
+                  : fopen(argv[2], binaryOutput ? "wb" : "w");
     if (!f) {
         perror(argv[2]);
         return EXIT_FAILURE;
@@ -459,26 +530,66 @@ int main(int argc, char *argv[]) {
                          static_cast<double>(points[3 * i + c]) + thickness);
         }
     }
-    fprintf(f, "# Converted from \"%s\" by cyhair2pbrt\n", argv[1]);
-    fprintf(f, "# The number of strands = %d. user_thickness = %f\n",
-            static_cast<int>(radiuss.size() / 4),
-            static_cast<double>(user_thickness));
-    fprintf(f, "# Scene bounds: (%f, %f, %f) - (%f, %f, %f)\n\n\n",
-            bounds[0][0], bounds[0][1], bounds[0][2], bounds[1][0],
-            bounds[1][1], bounds[1][2]);
+    if (binaryOutput) {
+        const char magic[4] = {'P', 'B', 'B', '\0'};
+        const uint32_t version = 1;
+        fwrite(magic, sizeof(magic), 1, f);
+        fwrite(&version, sizeof(version), 1, f);
+    } else {
+        fprintf(f, "# Converted from \"%s\" by cyhair2pbrt\n", argv[1]);
+        fprintf(f, "# The number of strands = %d. user_thickness = %f\n",
+                static_cast<int>(radiuss.size() / 4),
+                static_cast<double>(user_thickness));
+        fprintf(f, "# Scene bounds: (%f, %f, %f) - (%f, %f, %f)\n\n\n",
+                bounds[0][0], bounds[0][1], bounds[0][2], bounds[1][0],
+                bounds[1][1], bounds[1][2]);
+    }
 
+    // Emit the curves in parallel: the curve range is split into equal
+    // chunks, each thread fills a buffer for its chunk, and the buffers
+    // are written out in order.
     const size_t num_curves = radiuss.size() / 4;
-    for (size_t i = 0; i < num_curves; i++) {
-        fprintf(
-            f,
-            "Shape \"curve\" \"string type\" [ \"cylinder\" ] \"point P\" [ ");
-        for (size_t j = 0; j < 12; j++) {
-            fprintf(f, "%f ", static_cast<double>(points[12 * i + j]));
+    const size_t num_chunks =
+        std::max<size_t>(1, std::min<size_t>(
+                                std::thread::hardware_concurrency(),
+                                (num_curves + 4095) / 4096));
+    std::vector<std::string> chunkOutputs(num_chunks);
+    auto emitChunk = [&](size_t chunk) {
+        size_t begin = chunk * num_curves / num_chunks;
+        size_t end = (chunk + 1) * num_curves / num_chunks;
+        SceneBuffer w(binaryOutput);
+        for (size_t i = begin; i < end; i++) {
+            w.Token("Shape");
+            w.String("curve");
+            w.String("string type");
+            w.Token("[");
+            w.String("cylinder");
+            w.Token("]");
+            w.String("point P");
+            w.Token("[");
+            for (size_t j = 0; j < 12; j++)
+                w.Number(static_cast<double>(points[12 * i + j]));
+            w.Token("]");
+            w.String("float width0");
+            w.Token("[");
+            w.Number(static_cast<double>(radiuss[4 * i + 0]));
+            w.Token("]");
+            w.String("float width1");
+            w.Token("[");
+            w.Number(static_cast<double>(radiuss[4 * i + 3]));
+            w.Token("]");
+            w.Newline();
         }
-        fprintf(f, " ] \"float width0\" [ %f ] \"float width1\" [ %f ]\n",
-                static_cast<double>(radiuss[4 * i + 0]),
-                static_cast<double>(radiuss[4 * i + 3]));
-    }
+        chunkOutputs[chunk] = std::move(w.Contents());
+    };
+    std::vector<std::thread> workers;
+    for (size_t chunk = 1; chunk < num_chunks; ++chunk)
+        workers.push_back(std::thread(emitChunk, chunk));
+    emitChunk(0);
+    for (std::thread &t : workers) t.join();
+
+    for (const std::string &out : chunkOutputs)
+        fwrite(out.data(), 1, out.size(), f);
 
     if (f != stdout) fclose(f);
 
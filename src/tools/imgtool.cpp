@@ -9,8 +9,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
 #include "fileutil.h"
+#include "film.h"
 #include "imageio.h"
+#include "mipmap.h"
 #include "pbrt.h"
 #include "spectrum.h"
 #include "parallel.h"
@@ -31,10 +38,21 @@ static void usage(const char *msg = nullptr, ...) {
     }
     fprintf(stderr, R"(usage: imgtool <command> [options] <filenames...>
 
-commands: assemble, cat, convert, diff, info, makesky
+commands: assemble, batch, cat, convert, diff, info, makesky, maketx
 
 assemble option:
     --outfile          Output image filename.
+    Input files may be cropped EXR images or ".bucket" contribution
+    buffers written by the film's "bucket" mode; bucket inputs also merge
+    splat contributions that fell outside each shard's crop window.
+
+batch options:
+    Applies the given "convert" options to each of the input files in
+    turn, overlapping the read, process, and write of successive images.
+    Accepts all of the "convert" options, plus:
+    --outsuffix <s>    Suffix inserted before each input filename's
+                       extension to form the output filename.
+                       Default: "_out"
 
 cat option:
     --sort             Sort output by pixel luminance.
@@ -80,6 +98,14 @@ makesky options:
                        (Horizontal resolution is twice this value.)
                        Default: 2048
 
+maketx option:
+    --wrap <mode>      Wrap mode used if the input must be resampled to a
+                       power-of-two resolution: "repeat", "black", or
+                       "clamp". Default: repeat
+    Converts an image to a pre-mipped ".txp" texture file that pbrt maps
+    into memory directly, with no resampling or filtering work at render
+    startup.
+
 )");
     exit(1);
 }
@@ -155,7 +181,6 @@ int makesky(int argc, char *argv[]) {
 
     int nTheta = resolution, nPhi = 2 * nTheta;
     std::vector<Float> img(3 * nTheta * nPhi, 0.f);
-    ParallelInit();
     ParallelFor([&](int64_t t) {
         Float theta = float(t + 0.5) / nTheta * Pi;
         if (theta > Pi / 2.) return;
@@ -183,7 +208,171 @@ int makesky(int argc, char *argv[]) {
 
     WriteImage(outfile, (Float *)&img[0], Bounds2i({0, 0}, {nPhi, nTheta}),
                {nPhi, nTheta});
-    ParallelCleanup();
+    return 0;
+}
+
+int maketx(int argc, char *argv[]) {
+    ImageWrap wrap = ImageWrap::Repeat;
+    const char *inFilename = nullptr, *outFilename = nullptr;
+    for (int i = 0; i < argc; ++i) {
+        if (!strcmp(argv[i], "--wrap") || !strcmp(argv[i], "-wrap")) {
+            if (i + 1 == argc)
+                usage("missing value after %s flag", argv[i]);
+            ++i;
+            if (!strcmp(argv[i], "repeat"))
+                wrap = ImageWrap::Repeat;
+            else if (!strcmp(argv[i], "black"))
+                wrap = ImageWrap::Black;
+            else if (!strcmp(argv[i], "clamp"))
+                wrap = ImageWrap::Clamp;
+            else
+                usage("--wrap must be \"repeat\", \"black\", or \"clamp\"");
+        } else if (argv[i][0] == '-')
+            usage("unknown \"maketx\" option");
+        else if (!inFilename)
+            inFilename = argv[i];
+        else if (!outFilename)
+            outFilename = argv[i];
+        else
+            usage("excess filenames provided to \"maketx\"");
+    }
+    if (!inFilename || !outFilename)
+        usage("expecting input and output filenames for \"maketx\"");
+
+    Point2i res;
+    std::unique_ptr<RGBSpectrum[]> image = ReadImage(inFilename, &res);
+    if (!image) {
+        fprintf(stderr, "imgtool: couldn't read image \"%s\"\n", inFilename);
+        return 1;
+    }
+
+    // Flip image in y to match texture coordinate space, as ImageTexture
+    // does when it loads other formats, so .txp levels need no fixup.
+    for (int y = 0; y < res.y / 2; ++y)
+        for (int x = 0; x < res.x; ++x) {
+            int o1 = y * res.x + x;
+            int o2 = (res.y - 1 - y) * res.x + x;
+            std::swap(image[o1], image[o2]);
+        }
+
+    // Build the MIP pyramid and serialize it, finest level first. With no
+    // texture cache budget set, all of the levels stay resident and
+    // Texel() reads them straight out of the pyramid.
+    {
+        MIPMap<RGBSpectrum> mipmap(res, image.get(), false, 8.f, wrap);
+
+        FILE *f = fopen(outFilename, "wb");
+        if (!f) {
+            fprintf(stderr, "imgtool: couldn't open \"%s\"\n", outFilename);
+            return 1;
+        }
+        TxpHeader header = {};
+        header.magic = TxpHeader::Magic;
+        header.resolution[0] = mipmap.Width();
+        header.resolution[1] = mipmap.Height();
+        header.nLevels = mipmap.Levels();
+        header.wrapMode = (int32_t)wrap;
+        bool writeError = fwrite(&header, sizeof(header), 1, f) != 1;
+        for (int level = 0; level < mipmap.Levels() && !writeError; ++level) {
+            int w = std::max(1, mipmap.Width() >> level);
+            int h = std::max(1, mipmap.Height() >> level);
+            std::vector<float> row(3 * w);
+            for (int t = 0; t < h && !writeError; ++t) {
+                for (int s = 0; s < w; ++s) {
+                    Float rgb[3];
+                    mipmap.Texel(level, s, t).ToRGB(rgb);
+                    for (int c = 0; c < 3; ++c) row[3 * s + c] = rgb[c];
+                }
+                writeError = fwrite(&row[0], row.size() * sizeof(float), 1,
+                                    f) != 1;
+            }
+        }
+        if (writeError || fclose(f) != 0) {
+            fprintf(stderr, "imgtool: error writing \"%s\"\n", outFilename);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Merge ".bucket" contribution buffers (see FilmBucketHeader in
+// core/film.h): sum the per-pixel accumulators across the shards, then
+// apply the same weight normalization, splat scale, and scale that
+// Film::WriteImage() applies. Since the shards' crop windows partition the
+// pixels, each pixel's sample sums come entirely from one shard and the
+// result matches a single-machine render.
+static int assembleBuckets(const char *outfile,
+                           const std::vector<const char *> &infiles) {
+    FilmBucketHeader header;
+    std::vector<Float> sums;
+    for (const char *file : infiles) {
+        if (!HasExtension(file, ".bucket")) {
+            fprintf(stderr,
+                    "%s: can't mix \".bucket\" and image inputs to "
+                    "\"assemble\".\n", file);
+            return 1;
+        }
+        FILE *f = fopen(file, "rb");
+        if (!f) {
+            fprintf(stderr, "%s: unable to open file.\n", file);
+            return 1;
+        }
+        FilmBucketHeader h;
+        if (fread(&h, sizeof(h), 1, f) != 1 || h.magic != filmBucketMagic ||
+            h.floatSize != sizeof(Float)) {
+            fprintf(stderr, "%s: not a compatible bucket file.\n", file);
+            fclose(f);
+            return 1;
+        }
+        size_t nPixels = (size_t)h.resolution[0] * h.resolution[1];
+        if (sums.empty()) {
+            header = h;
+            sums.assign(7 * nPixels, 0);
+        } else if (h.resolution[0] != header.resolution[0] ||
+                   h.resolution[1] != header.resolution[1] ||
+                   h.scale != header.scale ||
+                   h.splatScale != header.splatScale) {
+            fprintf(stderr,
+                    "%s: resolution or scales don't match the first bucket "
+                    "file. Ignoring this file.\n", file);
+            fclose(f);
+            continue;
+        }
+        std::vector<Float> records(7 * nPixels);
+        if (fread(&records[0], 7 * sizeof(Float), nPixels, f) != nPixels) {
+            fprintf(stderr, "%s: premature end of file.\n", file);
+            fclose(f);
+            return 1;
+        }
+        fclose(f);
+        for (size_t i = 0; i < 7 * nPixels; ++i) sums[i] += records[i];
+    }
+    if (sums.empty()) {
+        fprintf(stderr, "assemble: no bucket files read.\n");
+        return 1;
+    }
+
+    // Convert the merged accumulators to RGB as Film::WriteImage() does.
+    Point2i fullRes(header.resolution[0], header.resolution[1]);
+    size_t nPixels = (size_t)fullRes.x * fullRes.y;
+    std::unique_ptr<Float[]> rgb(new Float[3 * nPixels]);
+    for (size_t i = 0; i < nPixels; ++i) {
+        const Float *record = &sums[7 * i];
+        XYZToRGB(record, &rgb[3 * i]);
+        Float filterWeightSum = record[3];
+        if (filterWeightSum != 0) {
+            Float invWt = (Float)1 / filterWeightSum;
+            for (int c = 0; c < 3; ++c)
+                rgb[3 * i + c] = std::max((Float)0, rgb[3 * i + c] * invWt);
+        }
+        Float splatRGB[3];
+        XYZToRGB(record + 4, splatRGB);
+        for (int c = 0; c < 3; ++c) {
+            rgb[3 * i + c] += (Float)header.splatScale * splatRGB[c];
+            rgb[3 * i + c] *= (Float)header.scale;
+        }
+    }
+    WriteImage(outfile, &rgb[0], Bounds2i(Point2i(0, 0), fullRes), fullRes);
     return 0;
 }
 
@@ -204,6 +393,9 @@ int assemble(int argc, char *argv[]) {
 
     if (!outfile) usage("--outfile not provided for \"assemble\"");
 
+    if (!infiles.empty() && HasExtension(infiles[0], ".bucket"))
+        return assembleBuckets(outfile, infiles);
+
     std::unique_ptr<RGBSpectrum[]> fullImg;
     std::vector<bool> seenPixel;
     int seenMultiple = 0;
@@ -389,30 +581,52 @@ int diff(int argc, char *argv[]) {
     std::unique_ptr<RGBSpectrum[]> diffImage;
     if (outfile) diffImage.reset(new RGBSpectrum[res[0].x * res[0].y]);
 
+    // Accumulate difference statistics for each scanline independently in
+    // parallel and then reduce the per-scanline partial sums serially, so
+    // that the reported values don't depend on the number of threads.
+    struct DiffStats {
+        double sum[2] = {0., 0.};
+        double mse = 0.;
+        int smallDiff = 0, bigDiff = 0;
+    };
+    std::vector<DiffStats> rowStats(res[0].y);
+    ParallelFor(
+        [&](int64_t y) {
+            DiffStats &stats = rowStats[y];
+            for (int x = 0; x < res[0].x; ++x) {
+                int i = y * res[0].x + x;
+                Float rgb[2][3];
+                imgs[0][i].ToRGB(rgb[0]);
+                imgs[1][i].ToRGB(rgb[1]);
+
+                Float diffRGB[3];
+                for (int c = 0; c < 3; ++c) {
+                    Float c0 = rgb[0][c], c1 = rgb[1][c];
+                    diffRGB[c] = std::abs(c0 - c1);
+
+                    if (c0 == 0 && c1 == 0) continue;
+
+                    stats.sum[0] += c0;
+                    stats.sum[1] += c1;
+
+                    float d = std::abs(c0 - c1) / c0;
+                    stats.mse += (c0 - c1) * (c0 - c1);
+                    if (d > .005) ++stats.smallDiff;
+                    if (d > .05) ++stats.bigDiff;
+                }
+                if (diffImage) diffImage[i] = RGBSpectrum::FromRGB(diffRGB);
+            }
+        },
+        res[0].y, 16);
     double sum[2] = {0., 0.};
     int smallDiff = 0, bigDiff = 0;
     double mse = 0.f;
-    for (int i = 0; i < res[0].x * res[0].y; ++i) {
-        Float rgb[2][3];
-        imgs[0][i].ToRGB(rgb[0]);
-        imgs[1][i].ToRGB(rgb[1]);
-
-        Float diffRGB[3];
-        for (int c = 0; c < 3; ++c) {
-            Float c0 = rgb[0][c], c1 = rgb[1][c];
-            diffRGB[c] = std::abs(c0 - c1);
-
-            if (c0 == 0 && c1 == 0) continue;
-
-            sum[0] += c0;
-            sum[1] += c1;
-
-            float d = std::abs(c0 - c1) / c0;
-            mse += (c0 - c1) * (c0 - c1);
-            if (d > .005) ++smallDiff;
-            if (d > .05) ++bigDiff;
-        }
-        if (diffImage) diffImage[i] = RGBSpectrum::FromRGB(diffRGB);
+    for (const DiffStats &stats : rowStats) {
+        sum[0] += stats.sum[0];
+        sum[1] += stats.sum[1];
+        mse += stats.mse;
+        smallDiff += stats.smallDiff;
+        bigDiff += stats.bigDiff;
     }
 
     double avg[2] = {sum[0] / (3. * res[0].x * res[0].y),
@@ -495,17 +709,24 @@ std::unique_ptr<RGBSpectrum[]> bloom(std::unique_ptr<RGBSpectrum[]> image,
     std::vector<std::unique_ptr<RGBSpectrum[]>> blurred;
 
     // First, threshold the source image
-    int nSurvivors = 0;
+    std::atomic<int> nSurvivors(0);
     std::unique_ptr<RGBSpectrum[]> thresholded(new RGBSpectrum[res.x * res.y]);
-    for (int i = 0; i < res.x * res.y; ++i) {
-        Float rgb[3];
-        image[i].ToRGB(rgb);
-        if (rgb[0] > level || rgb[1] > level || rgb[2] > level) {
-            ++nSurvivors;
-            thresholded[i] = image[i];
-        } else
-            thresholded[i] = 0.f;
-    }
+    ParallelFor(
+        [&](int64_t y) {
+            int nRowSurvivors = 0;
+            for (int x = 0; x < res.x; ++x) {
+                int i = y * res.x + x;
+                Float rgb[3];
+                image[i].ToRGB(rgb);
+                if (rgb[0] > level || rgb[1] > level || rgb[2] > level) {
+                    ++nRowSurvivors;
+                    thresholded[i] = image[i];
+                } else
+                    thresholded[i] = 0.f;
+            }
+            nSurvivors += nRowSurvivors;
+        },
+        res.y, 16);
     if (nSurvivors == 0) {
         fprintf(stderr,
                 "imgtool: warning: no pixels were above bloom threshold %f\n",
@@ -548,41 +769,51 @@ std::unique_ptr<RGBSpectrum[]> bloom(std::unique_ptr<RGBSpectrum[]> image,
     std::unique_ptr<RGBSpectrum[]> blurx(new RGBSpectrum[res.x * res.y]);
     for (int iter = 0; iter < iters; ++iter) {
         // Separable blur; first blur in x into blurx
-        for (int y = 0; y < res.y; ++y) {
-            for (int x = 0; x < res.x; ++x) {
-                RGBSpectrum result = 0;
-                for (int r = -radius; r <= radius; ++r)
-                    result +=
-                        wts[r + radius] * getTexel(blurred.back(), {x + r, y});
-                blurx[y * res.x + x] = result;
-            }
-        }
+        ParallelFor(
+            [&](int64_t y) {
+                for (int x = 0; x < res.x; ++x) {
+                    RGBSpectrum result = 0;
+                    for (int r = -radius; r <= radius; ++r)
+                        result += wts[r + radius] *
+                                  getTexel(blurred.back(), {x + r, int(y)});
+                    blurx[y * res.x + x] = result;
+                }
+            },
+            res.y, 16);
 
         // Now blur in y from blur x to the result
         std::unique_ptr<RGBSpectrum[]> blury(new RGBSpectrum[res.x * res.y]);
-        for (int y = 0; y < res.y; ++y) {
-            for (int x = 0; x < res.x; ++x) {
-                RGBSpectrum result = 0;
-                for (int r = -radius; r <= radius; ++r)
-                    result += wts[r + radius] * getTexel(blurx, {x, y + r});
-                blury[y * res.x + x] = result;
-            }
-        }
+        ParallelFor(
+            [&](int64_t y) {
+                for (int x = 0; x < res.x; ++x) {
+                    RGBSpectrum result = 0;
+                    for (int r = -radius; r <= radius; ++r)
+                        result +=
+                            wts[r + radius] * getTexel(blurx, {x, int(y) + r});
+                    blury[y * res.x + x] = result;
+                }
+            },
+            res.y, 16);
         blurred.push_back(std::move(blury));
     }
 
     // Finally, add all of the blurred images, scaled, to the original.
-    for (int i = 0; i < res.x * res.y; ++i) {
-        RGBSpectrum blurredSum = 0.f;
-        // Skip the thresholded image, since it's already present in the
-        // original; just add pixels from the blurred ones.
-        for (size_t j = 1; j < blurred.size(); ++j) blurredSum += blurred[j][i];
-        image[i] += (scale / iters) * blurredSum;
-    }
+    ParallelFor(
+        [&](int64_t i) {
+            RGBSpectrum blurredSum = 0.f;
+            // Skip the thresholded image, since it's already present in the
+            // original; just add pixels from the blurred ones.
+            for (size_t j = 1; j < blurred.size(); ++j)
+                blurredSum += blurred[j][i];
+            image[i] += (scale / iters) * blurredSum;
+        },
+        res.x * res.y, 4096);
     return image;
 }
 
-int convert(int argc, char *argv[]) {
+// Options controlling the post-processing performed by the "convert" and
+// "batch" commands.
+struct ConvertOptions {
     float scale = 1.f;
     int repeat = 1;
     bool flipy = false;
@@ -594,10 +825,15 @@ int convert(int argc, char *argv[]) {
     Float maxY = 1.;
     Float despikeLimit = Infinity;
     bool preserveColors = false;
+};
 
-    int i;
+// Attempt to parse argv[*i] as one of the "convert" command's flags,
+// updating *opts and *i accordingly. Returns false if the flag isn't one
+// that "convert" understands, so that callers can handle their own flags.
+static bool parseConvertOption(int argc, char *argv[], int *i,
+                               ConvertOptions *opts) {
     auto parseArg = [&]() -> std::pair<std::string, double> {
-        const char *ptr = argv[i];
+        const char *ptr = argv[*i];
         // Skip over a leading dash or two.
         CHECK_EQ(*ptr, '-');
         ++ptr;
@@ -607,47 +843,197 @@ int convert(int argc, char *argv[]) {
         std::string flag;
         while (*ptr && *ptr != '=') flag += *ptr++;
 
-        if (!*ptr && i + 1 == argc)
-            usage("missing value after %s flag", argv[i]);
-        const char *value = (*ptr == '=') ? (ptr + 1) : argv[++i];
+        if (!*ptr && *i + 1 == argc)
+            usage("missing value after %s flag", argv[*i]);
+        const char *value = (*ptr == '=') ? (ptr + 1) : argv[++*i];
         return {flag, atof(value)};
     };
 
-    std::pair<std::string, double> arg;
-    for (i = 0; i < argc; ++i) {
-        if (argv[i][0] != '-') break;
-        if (!strcmp(argv[i], "--flipy") || !strcmp(argv[i], "-flipy"))
-            flipy = !flipy;
-        else if (!strcmp(argv[i], "--tonemap") || !strcmp(argv[i], "-tonemap"))
-            tonemap = !tonemap;
-        else if (!strcmp(argv[i], "--preservecolors") || !strcmp(argv[i], "-preservecolors"))
-            preserveColors = !preserveColors;
+    if (!strcmp(argv[*i], "--flipy") || !strcmp(argv[*i], "-flipy"))
+        opts->flipy = !opts->flipy;
+    else if (!strcmp(argv[*i], "--tonemap") || !strcmp(argv[*i], "-tonemap"))
+        opts->tonemap = !opts->tonemap;
+    else if (!strcmp(argv[*i], "--preservecolors") ||
+             !strcmp(argv[*i], "-preservecolors"))
+        opts->preserveColors = !opts->preserveColors;
+    else {
+        int iOrig = *i;
+        std::pair<std::string, double> arg = parseArg();
+        if (std::get<0>(arg) == "maxluminance") {
+            opts->maxY = std::get<1>(arg);
+            if (opts->maxY <= 0)
+                usage("--maxluminance value must be greater than zero");
+        } else if (std::get<0>(arg) == "repeatpix") {
+            opts->repeat = int(std::get<1>(arg));
+            if (opts->repeat <= 0)
+                usage("--repeatpix value must be greater than zero");
+        } else if (std::get<0>(arg) == "scale") {
+            opts->scale = std::get<1>(arg);
+            if (opts->scale == 0) usage("--scale value must be non-zero");
+        } else if (std::get<0>(arg) == "bloomlevel")
+            opts->bloomLevel = std::get<1>(arg);
+        else if (std::get<0>(arg) == "bloomwidth")
+            opts->bloomWidth = int(std::get<1>(arg));
+        else if (std::get<0>(arg) == "bloomscale")
+            opts->bloomScale = std::get<1>(arg);
+        else if (std::get<0>(arg) == "bloomiters")
+            opts->bloomIters = int(std::get<1>(arg));
+        else if (std::get<0>(arg) == "despike")
+            opts->despikeLimit = std::get<1>(arg);
         else {
-            std::pair<std::string, double> arg = parseArg();
-            if (std::get<0>(arg) == "maxluminance") {
-                maxY = std::get<1>(arg);
-                if (maxY <= 0)
-                    usage("--maxluminance value must be greater than zero");
-            } else if (std::get<0>(arg) == "repeatpix") {
-                repeat = int(std::get<1>(arg));
-                if (repeat <= 0)
-                    usage("--repeatpix value must be greater than zero");
-            } else if (std::get<0>(arg) == "scale") {
-                scale = std::get<1>(arg);
-                if (scale == 0) usage("--scale value must be non-zero");
-            } else if (std::get<0>(arg) == "bloomlevel")
-                bloomLevel = std::get<1>(arg);
-            else if (std::get<0>(arg) == "bloomwidth")
-                bloomWidth = int(std::get<1>(arg));
-            else if (std::get<0>(arg) == "bloomscale")
-                bloomScale = std::get<1>(arg);
-            else if (std::get<0>(arg) == "bloomiters")
-                bloomIters = int(std::get<1>(arg));
-            else if (std::get<0>(arg) == "despike")
-                despikeLimit = std::get<1>(arg);
-            else
-                usage();
+            *i = iOrig;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Apply the given post-processing options to the image, updating *res if
+// the operations change its resolution. The passes all run in parallel
+// over scanlines; |name| is only used for diagnostic messages.
+static std::unique_ptr<RGBSpectrum[]> applyConvert(
+    std::unique_ptr<RGBSpectrum[]> image, Point2i *resp,
+    const ConvertOptions &opts, const char *name) {
+    Point2i res = *resp;
+
+    if (opts.scale != 1.f)
+        ParallelFor([&](int64_t i) { image[i] *= opts.scale; }, res.x * res.y,
+                    4096);
+
+    if (opts.despikeLimit < Infinity) {
+        // Despike in bands of scanlines so that only a small slice of the
+        // image needs to be double-buffered. Each band is computed in
+        // parallel from the original pixels and then written back in
+        // place; a copy of the band's last original scanline provides the
+        // y-1 neighbors for the band that follows it.
+        const int bandRows = 64;
+        std::vector<RGBSpectrum> bandOut(std::min(bandRows, res.y) * res.x);
+        std::vector<RGBSpectrum> prevRow(res.x);
+        std::atomic<int> despikeCount(0);
+        for (int y0 = 0; y0 < res.y; y0 += bandRows) {
+            int y1 = std::min(y0 + bandRows, res.y);
+            std::vector<RGBSpectrum> lastRow(&image[(y1 - 1) * res.x],
+                                             &image[(y1 - 1) * res.x] + res.x);
+            ParallelFor(
+                [&](int64_t by) {
+                    int y = y0 + int(by), nRowDespiked = 0;
+                    for (int x = 0; x < res.x; ++x) {
+                        if (image[y * res.x + x].y() < opts.despikeLimit) {
+                            bandOut[(y - y0) * res.x + x] =
+                                image[y * res.x + x];
+                            continue;
+                        }
+
+                        // Copy all of the valid neighbor pixels into
+                        // neighbors[].
+                        ++nRowDespiked;
+                        int validNeighbors = 0;
+                        RGBSpectrum neighbors[9];
+                        for (int dy = -1; dy <= 1; ++dy) {
+                            if (y + dy < 0 || y + dy >= res.y) continue;
+                            const RGBSpectrum *row =
+                                (y + dy < y0) ? prevRow.data()
+                                              : &image[(y + dy) * res.x];
+                            for (int dx = -1; dx <= 1; ++dx) {
+                                if (x + dx < 0 || x + dx >= res.x) continue;
+                                neighbors[validNeighbors++] = row[x + dx];
+                            }
+                        }
+
+                        // Find the median of the neighbors, sorted by
+                        // luminance.
+                        int mid = validNeighbors / 2;
+                        std::nth_element(
+                            &neighbors[0], &neighbors[mid],
+                            &neighbors[validNeighbors],
+                            [](const RGBSpectrum &a,
+                               const RGBSpectrum &b) -> bool {
+                                return a.y() < b.y();
+                            });
+                        bandOut[(y - y0) * res.x + x] = neighbors[mid];
+                    }
+                    despikeCount += nRowDespiked;
+                },
+                y1 - y0, 4);
+            prevRow = std::move(lastRow);
+            std::copy(bandOut.begin(), bandOut.begin() + (y1 - y0) * res.x,
+                      &image[y0 * res.x]);
         }
+        fprintf(stderr, "%s: despiked %d pixels\n", name, int(despikeCount));
+    }
+
+    if (opts.bloomLevel < Infinity)
+        image = bloom(std::move(image), res, opts.bloomLevel, opts.bloomWidth,
+                      opts.bloomScale, opts.bloomIters);
+
+    if (opts.tonemap) {
+        Float maxY = opts.maxY;
+        ParallelFor(
+            [&](int64_t i) {
+                Float y = image[i].y();
+                // Reinhard et al. photographic tone mapping operator.
+                Float scale = (1 + y / (maxY * maxY)) / (1 + y);
+                image[i] *= scale;
+            },
+            res.x * res.y, 4096);
+    }
+
+    if (opts.preserveColors) {
+        ParallelFor(
+            [&](int64_t i) {
+                Float rgb[3];
+                image[i].ToRGB(rgb);
+                Float m = std::max(rgb[0], std::max(rgb[1], rgb[2]));
+                if (m > 1) {
+                    rgb[0] /= m;
+                    rgb[1] /= m;
+                    rgb[2] /= m;
+                    image[i] = RGBSpectrum::FromRGB(rgb);
+                }
+            },
+            res.x * res.y, 4096);
+    }
+
+    if (opts.repeat > 1) {
+        int repeat = opts.repeat;
+        std::unique_ptr<RGBSpectrum[]> rscale(
+            new RGBSpectrum[repeat * res.x * repeat * res.y]);
+        ParallelFor(
+            [&](int64_t y) {
+                int yy = y / repeat;
+                RGBSpectrum *rsp = &rscale[y * repeat * res.x];
+                for (int x = 0; x < repeat * res.x; ++x) {
+                    int xx = x / repeat;
+                    *rsp++ = image[yy * res.x + xx];
+                }
+            },
+            repeat * res.y, 16);
+        res.x *= repeat;
+        res.y *= repeat;
+        image = std::move(rscale);
+    }
+
+    if (opts.flipy) {
+        ParallelFor(
+            [&](int64_t y) {
+                int yo = res.y - 1 - int(y);
+                for (int x = 0; x < res.x; ++x)
+                    std::swap(image[y * res.x + x], image[yo * res.x + x]);
+            },
+            res.y / 2, 16);
+    }
+
+    *resp = res;
+    return image;
+}
+
+int convert(int argc, char *argv[]) {
+    ConvertOptions opts;
+
+    int i;
+    for (i = 0; i < argc; ++i) {
+        if (argv[i][0] != '-') break;
+        if (!parseConvertOption(argc, argv, &i, &opts)) usage();
     }
 
     if (i + 1 >= argc)
@@ -663,102 +1049,127 @@ int convert(int argc, char *argv[]) {
         return 1;
     }
 
-    for (int i = 0; i < res.x * res.y; ++i) image[i] *= scale;
+    image = applyConvert(std::move(image), &res, opts, inFilename);
 
-    if (despikeLimit < Infinity) {
-        std::unique_ptr<RGBSpectrum[]> filteredImg(
-            new RGBSpectrum[res.x * res.y]);
-        int despikeCount = 0;
-        for (int y = 0; y < res.y; ++y) {
-            for (int x = 0; x < res.x; ++x) {
-                if (image[y * res.x + x].y() < despikeLimit) {
-                    filteredImg[y * res.x + x] = image[y * res.x + x];
-                    continue;
-                }
+    // FIXME: another bad RGBSpectrum -> Float cast.
+    WriteImage(outFilename, (Float *)image.get(), Bounds2i(Point2i(0, 0), res),
+               res);
 
-                // Copy all of the valid neighbor pixels into neighbors[].
-                ++despikeCount;
-                int validNeighbors = 0;
-                RGBSpectrum neighbors[9];
-                for (int dy = -1; dy <= 1; ++dy) {
-                    if (y + dy < 0 || y + dy >= res.y) continue;
-                    for (int dx = -1; dx <= 1; ++dx) {
-                        if (x + dx < 0 || x + dx > res.x) continue;
-                        int offset = (y + dy) * res.x + x + dx;
-                        neighbors[validNeighbors++] = image[offset];
-                    }
-                }
+    return 0;
+}
 
-                // Find the median of the neighbors, sorted by luminance.
-                int mid = validNeighbors / 2;
-                std::nth_element(
-                    &neighbors[0], &neighbors[mid], &neighbors[validNeighbors],
-                    [](const RGBSpectrum &a, const RGBSpectrum &b) -> bool {
-                        return a.y() < b.y();
-                    });
-                filteredImg[y * res.x + x] = neighbors[mid];
-            }
-        }
-        std::swap(image, filteredImg);
-        fprintf(stderr, "%s: despiked %d pixels\n", inFilename, despikeCount);
+int batch(int argc, char *argv[]) {
+    ConvertOptions opts;
+    std::string outSuffix = "_out";
+
+    int i;
+    for (i = 0; i < argc; ++i) {
+        if (argv[i][0] != '-') break;
+        if (!strcmp(argv[i], "--outsuffix") || !strcmp(argv[i], "-outsuffix")) {
+            if (i + 1 == argc)
+                usage("missing suffix after %s option", argv[i]);
+            outSuffix = argv[++i];
+        } else if (!strncmp(argv[i], "--outsuffix=", 12))
+            outSuffix = &argv[i][12];
+        else if (!parseConvertOption(argc, argv, &i, &opts))
+            usage("unknown \"batch\" option");
     }
 
-    if (bloomLevel < Infinity)
-        image = bloom(std::move(image), res, bloomLevel, bloomWidth, bloomScale,
-                      bloomIters);
+    if (i >= argc) usage("missing filenames for \"batch\"");
 
-    if (tonemap) {
-        for (int i = 0; i < res.x * res.y; ++i) {
-            Float y = image[i].y();
-            // Reinhard et al. photographic tone mapping operator.
-            Float scale = (1 + y / (maxY * maxY)) / (1 + y);
-            image[i] *= scale;
-        }
-    }
+    // The images are processed as a three-stage pipeline: a reader thread
+    // decodes the next input while the main thread applies the (already
+    // parallel) conversion passes to the current one and a writer thread
+    // encodes the previous result. The queues are bounded so that at most
+    // a few images are in memory at once, regardless of how many files
+    // are given.
+    struct BatchWorkItem {
+        std::string inFilename, outFilename;
+        Point2i res;
+        std::unique_ptr<RGBSpectrum[]> image;
+    };
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<BatchWorkItem> readQueue, writeQueue;
+    bool readDone = false, writeDone = false;
+    std::atomic<int> err(0);
+    const size_t maxQueued = 2;
+
+    std::thread reader([&]() {
+        for (int j = i; j < argc; ++j) {
+            BatchWorkItem item;
+            item.inFilename = argv[j];
+            item.outFilename = argv[j];
+            size_t dot = item.outFilename.find_last_of('.');
+            if (dot == std::string::npos)
+                item.outFilename += outSuffix;
+            else
+                item.outFilename.insert(dot, outSuffix);
 
-    if (preserveColors) {
-        for (int i = 0; i < res.x * res.y; ++i) {
-            Float rgb[3];
-            image[i].ToRGB(rgb);
-            Float m = std::max(rgb[0], std::max(rgb[1], rgb[2]));
-            if (m > 1) {
-                rgb[0] /= m;
-                rgb[1] /= m;
-                rgb[2] /= m;
-                image[i] = RGBSpectrum::FromRGB(rgb);
+            item.image = ReadImage(item.inFilename, &item.res);
+            if (!item.image) {
+                fprintf(stderr, "%s: unable to read image\n", argv[j]);
+                err = 1;
+                continue;
             }
-        }
-    }
 
-    if (repeat > 1) {
-        std::unique_ptr<RGBSpectrum[]> rscale(
-            new RGBSpectrum[repeat * res.x * repeat * res.y]);
-        RGBSpectrum *rsp = rscale.get();
-        for (int y = 0; y < repeat * res.y; ++y) {
-            int yy = y / repeat;
-            for (int x = 0; x < repeat * res.x; ++x) {
-                int xx = x / repeat;
-                *rsp++ = image[yy * res.x + xx];
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock,
+                           [&]() { return readQueue.size() < maxQueued; });
+            readQueue.push_back(std::move(item));
+            condition.notify_all();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        readDone = true;
+        condition.notify_all();
+    });
+
+    std::thread writer([&]() {
+        for (;;) {
+            BatchWorkItem item;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [&]() {
+                    return !writeQueue.empty() || writeDone;
+                });
+                if (writeQueue.empty()) return;
+                item = std::move(writeQueue.front());
+                writeQueue.pop_front();
+                condition.notify_all();
             }
+            // FIXME: another bad RGBSpectrum -> Float cast.
+            WriteImage(item.outFilename, (Float *)item.image.get(),
+                       Bounds2i(Point2i(0, 0), item.res), item.res);
         }
-        res.x *= repeat;
-        res.y *= repeat;
-        image = std::move(rscale);
-    }
-
-    if (flipy) {
-        for (int y = 0; y < res.y / 2; ++y) {
-            int yo = res.y - 1 - y;
-            for (int x = 0; x < res.x; ++x)
-                std::swap(image[y * res.x + x], image[yo * res.x + x]);
+    });
+
+    for (;;) {
+        BatchWorkItem item;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock,
+                           [&]() { return !readQueue.empty() || readDone; });
+            if (readQueue.empty()) break;
+            item = std::move(readQueue.front());
+            readQueue.pop_front();
+            condition.notify_all();
         }
+        item.image = applyConvert(std::move(item.image), &item.res, opts,
+                                  item.inFilename.c_str());
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [&]() { return writeQueue.size() < maxQueued; });
+        writeQueue.push_back(std::move(item));
+        condition.notify_all();
     }
+    reader.join();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        writeDone = true;
+        condition.notify_all();
+    }
+    writer.join();
 
-    // FIXME: another bad RGBSpectrum -> Float cast.
-    WriteImage(outFilename, (Float *)image.get(), Bounds2i(Point2i(0, 0), res),
-               res);
-
-    return 0;
+    return err;
 }
 
 int main(int argc, char *argv[]) {
@@ -767,20 +1178,29 @@ int main(int argc, char *argv[]) {
 
     if (argc < 2) usage();
 
+    // The image processing loops below use ParallelFor().
+    ParallelInit();
+
+    int ret;
     if (!strcmp(argv[1], "assemble"))
-        return assemble(argc - 2, argv + 2);
+        ret = assemble(argc - 2, argv + 2);
+    else if (!strcmp(argv[1], "batch"))
+        ret = batch(argc - 2, argv + 2);
     else if (!strcmp(argv[1], "cat"))
-        return cat(argc - 2, argv + 2);
+        ret = cat(argc - 2, argv + 2);
     else if (!strcmp(argv[1], "convert"))
-        return convert(argc - 2, argv + 2);
+        ret = convert(argc - 2, argv + 2);
     else if (!strcmp(argv[1], "diff"))
-        return diff(argc - 2, argv + 2);
+        ret = diff(argc - 2, argv + 2);
     else if (!strcmp(argv[1], "info"))
-        return info(argc - 2, argv + 2);
+        ret = info(argc - 2, argv + 2);
     else if (!strcmp(argv[1], "makesky"))
-        return makesky(argc - 2, argv + 2);
+        ret = makesky(argc - 2, argv + 2);
+    else if (!strcmp(argv[1], "maketx"))
+        ret = maketx(argc - 2, argv + 2);
     else
         usage("unknown command \"%s\"", argv[1]);
 
-    return 0;
+    ParallelCleanup();
+    return ret;
 }
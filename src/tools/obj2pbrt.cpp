@@ -1295,22 +1295,100 @@ bool LoadObj(std::vector<shape_t> &shapes,       // [output]
 #include <stdio.h>
 #include <string.h>
 #include <algorithm>
+#include <atomic>
+#include <thread>
 
 using namespace tinyobj;
 
 static void usage() {
-    fprintf(stderr, "usage: obj2pbrt [--ptexquads] <OBJ filename> <pbrt filename>\n");
+    fprintf(stderr,
+            "usage: obj2pbrt [--ptexquads] [--binary] <OBJ filename> "
+            "<pbrt filename>\n"
+            "With --binary (or a \".pbb\" output filename), the scene is "
+            "written in\npbrt's binary scene format, which the renderer "
+            "loads without re-parsing\nthe geometry from text.\n");
     exit(1);
 }
 
+// Accumulates a pbrt token stream in memory, either as scene file text or
+// as the binary scene format that pbrt's tokenizer reads directly (see the
+// .pbb format notes in core/parser.cpp: 'S' records hold length-prefixed
+// tokens, quotes included, and 'N' records hold binary doubles). Each
+// conversion thread fills its own buffer and the buffers are concatenated
+// in input order, so the output is independent of thread scheduling.
+class SceneBuffer {
+  public:
+    explicit SceneBuffer(bool binary) : binary(binary) {}
+
+    // A bare directive or parameter-list punctuation token.
+    void Token(const char *s) {
+        if (binary)
+            Record(s, strlen(s));
+        else {
+            buf += s;
+            buf += ' ';
+        }
+    }
+    void String(const std::string &s) {
+        if (binary) {
+            std::string quoted;
+            quoted.reserve(s.size() + 2);
+            quoted += '"';
+            quoted += s;
+            quoted += '"';
+            Record(quoted.data(), quoted.size());
+        } else {
+            buf += '"';
+            buf += s;
+            buf += "\" ";
+        }
+    }
+    void Number(double d) {
+        if (binary) {
+            buf += 'N';
+            buf.append(reinterpret_cast<const char *>(&d), sizeof(d));
+        } else {
+            char s[64];
+            snprintf(s, sizeof(s), "%.10g ", d);
+            buf += s;
+        }
+    }
+    // Comments and line breaks only appear in the text format.
+    void Comment(const std::string &s) {
+        if (!binary) {
+            buf += "# ";
+            buf += s;
+            buf += '\n';
+        }
+    }
+    void Newline() {
+        if (!binary) buf += '\n';
+    }
+
+    std::string &Contents() { return buf; }
+
+  private:
+    void Record(const char *ptr, size_t len) {
+        buf += 'S';
+        uint32_t n = static_cast<uint32_t>(len);
+        buf.append(reinterpret_cast<const char *>(&n), sizeof(n));
+        buf.append(ptr, len);
+    }
+
+    bool binary;
+    std::string buf;
+};
+
 int main(int argc, char *argv[]) {
     const char *objFilename = nullptr, *pbrtFilename = nullptr;
-    bool ptexQuads = false;
+    bool ptexQuads = false, binaryOutput = false;
     for (int i = 1; i < argc; ++i) {
         if (!strcmp(argv[i], "--help") || !strcmp(argv[i], "-h"))
             usage();
         else if (!strcmp(argv[i], "--ptexquads"))
             ptexQuads = true;
+        else if (!strcmp(argv[i], "--binary"))
+            binaryOutput = true;
         else if (!objFilename)
             objFilename = argv[i];
         else if (!pbrtFilename)
@@ -1320,6 +1398,9 @@ int main(int argc, char *argv[]) {
     }
     if (!pbrtFilename)
         usage();
+    size_t outLen = strlen(pbrtFilename);
+    if (outLen > 4 && !strcmp(pbrtFilename + outLen - 4, ".pbb"))
+        binaryOutput = true;
 
     std::vector<shape_t> shapes;
     std::vector<material_t> materials;
@@ -1330,7 +1411,9 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    FILE *f = (strcmp(pbrtFilename, "-") == 0) ? stdout : fopen(pbrtFilename, "w");
+    FILE *f = (strcmp(pbrtFilename, "-") == 0)
+                  ? stdout
+                  : fopen(pbrtFilename, binaryOutput ? "wb" : "w");
     if (!f) {
         perror(pbrtFilename);
         return 1;
@@ -1346,36 +1429,61 @@ int main(int argc, char *argv[]) {
             bounds[1][c] = std::max(bounds[1][c], mesh.positions[i]);
         }
     }
-    fprintf(f, "# Converted from \"%s\" by obj2pbrt\n", objFilename);
-    fprintf(f, "# Scene bounds: (%f, %f, %f) - (%f, %f, %f)\n\n\n",
-            bounds[0][0], bounds[0][1], bounds[0][2], bounds[1][0],
-            bounds[1][1], bounds[1][2]);
+    if (binaryOutput) {
+        const char magic[4] = {'P', 'B', 'B', '\0'};
+        const uint32_t version = 1;
+        fwrite(magic, sizeof(magic), 1, f);
+        fwrite(&version, sizeof(version), 1, f);
+    } else {
+        fprintf(f, "# Converted from \"%s\" by obj2pbrt\n", objFilename);
+        fprintf(f, "# Scene bounds: (%f, %f, %f) - (%f, %f, %f)\n\n\n",
+                bounds[0][0], bounds[0][1], bounds[0][2], bounds[1][0],
+                bounds[1][1], bounds[1][2]);
+    }
 
-    int numAreaLights = 0;
-    int numTriangles = 0;
+    std::atomic<int> numAreaLights(0);
+    std::atomic<int> numTriangles(0);
     int numMeshes = shapes.size();
 
     // First, make named materials for all of the materials.
+    SceneBuffer mtlBuf(binaryOutput);
     for (const material_t &mtl : materials) {
         bool hasDiffuseTex = (mtl.diffuse_texname != "");
         if (mtl.diffuse_texname != "") {
             if (mtl.diffuse[0] != 0 || mtl.diffuse[1] != 0 ||
                 mtl.diffuse[2] != 0) {
-                fprintf(f,
-                        "Texture \"%s-kd-img\" \"color\" \"imagemap\" "
-                        "\"string filename\" [\"%s\"]\n",
-                        mtl.name.c_str(), mtl.diffuse_texname.c_str());
-                fprintf(
-                    f,
-                    "Texture \"%s-kd\" \"color\" \"scale\" \"texture tex1\" "
-                    "\"%s-kd-img\" \"color tex2\" [%f %f %f]\n",
-                    mtl.name.c_str(), mtl.name.c_str(), mtl.diffuse[0],
-                    mtl.diffuse[1], mtl.diffuse[2]);
+                mtlBuf.Token("Texture");
+                mtlBuf.String(mtl.name + "-kd-img");
+                mtlBuf.String("color");
+                mtlBuf.String("imagemap");
+                mtlBuf.String("string filename");
+                mtlBuf.Token("[");
+                mtlBuf.String(mtl.diffuse_texname);
+                mtlBuf.Token("]");
+                mtlBuf.Newline();
+                mtlBuf.Token("Texture");
+                mtlBuf.String(mtl.name + "-kd");
+                mtlBuf.String("color");
+                mtlBuf.String("scale");
+                mtlBuf.String("texture tex1");
+                mtlBuf.String(mtl.name + "-kd-img");
+                mtlBuf.String("color tex2");
+                mtlBuf.Token("[");
+                mtlBuf.Number(mtl.diffuse[0]);
+                mtlBuf.Number(mtl.diffuse[1]);
+                mtlBuf.Number(mtl.diffuse[2]);
+                mtlBuf.Token("]");
+                mtlBuf.Newline();
             } else {
-                fprintf(f,
-                        "Texture \"%s-kd\" \"color\" \"imagemap\" "
-                        "\"string filename\" [\"%s\"]\n",
-                        mtl.name.c_str(), mtl.diffuse_texname.c_str());
+                mtlBuf.Token("Texture");
+                mtlBuf.String(mtl.name + "-kd");
+                mtlBuf.String("color");
+                mtlBuf.String("imagemap");
+                mtlBuf.String("string filename");
+                mtlBuf.Token("[");
+                mtlBuf.String(mtl.diffuse_texname);
+                mtlBuf.Token("]");
+                mtlBuf.Newline();
             }
         }
 
@@ -1383,62 +1491,123 @@ int main(int argc, char *argv[]) {
         if (mtl.specular_texname != "") {
             if (mtl.specular[0] != 0 || mtl.specular[1] != 0 ||
                 mtl.specular[2] != 0) {
-                fprintf(f,
-                        "Texture \"%s-ks-img\" \"color\" \"imagemap\" "
-                        "\"string filename\" [\"%s\"]\n",
-                        mtl.name.c_str(), mtl.specular_texname.c_str());
-                fprintf(
-                    f,
-                    "Texture \"%s-ks\" \"color\" \"scale\" \"texture tex1\" "
-                    "\"%s-ks-img\" \"color tex2\" [%f %f %f]\n",
-                    mtl.name.c_str(), mtl.name.c_str(), mtl.specular[0],
-                    mtl.specular[1], mtl.specular[2]);
+                mtlBuf.Token("Texture");
+                mtlBuf.String(mtl.name + "-ks-img");
+                mtlBuf.String("color");
+                mtlBuf.String("imagemap");
+                mtlBuf.String("string filename");
+                mtlBuf.Token("[");
+                mtlBuf.String(mtl.specular_texname);
+                mtlBuf.Token("]");
+                mtlBuf.Newline();
+                mtlBuf.Token("Texture");
+                mtlBuf.String(mtl.name + "-ks");
+                mtlBuf.String("color");
+                mtlBuf.String("scale");
+                mtlBuf.String("texture tex1");
+                mtlBuf.String(mtl.name + "-ks-img");
+                mtlBuf.String("color tex2");
+                mtlBuf.Token("[");
+                mtlBuf.Number(mtl.specular[0]);
+                mtlBuf.Number(mtl.specular[1]);
+                mtlBuf.Number(mtl.specular[2]);
+                mtlBuf.Token("]");
+                mtlBuf.Newline();
             } else {
-                fprintf(f,
-                        "Texture \"%s-ks\" \"color\" \"imagemap\" "
-                        "\"string filename\" [\"%s\"]\n",
-                        mtl.name.c_str(), mtl.specular_texname.c_str());
+                mtlBuf.Token("Texture");
+                mtlBuf.String(mtl.name + "-ks");
+                mtlBuf.String("color");
+                mtlBuf.String("imagemap");
+                mtlBuf.String("string filename");
+                mtlBuf.Token("[");
+                mtlBuf.String(mtl.specular_texname);
+                mtlBuf.Token("]");
+                mtlBuf.Newline();
             }
         }
 
         if (mtl.bump_texname != "") {
-            fprintf(f,
-                    "Texture \"%s-bump\" \"float\" \"imagemap\" "
-                    "\"string filename\" [\"%s\"]\n",
-                    mtl.name.c_str(), mtl.bump_texname.c_str());
+            mtlBuf.Token("Texture");
+            mtlBuf.String(mtl.name + "-bump");
+            mtlBuf.String("float");
+            mtlBuf.String("imagemap");
+            mtlBuf.String("string filename");
+            mtlBuf.Token("[");
+            mtlBuf.String(mtl.bump_texname);
+            mtlBuf.Token("]");
+            mtlBuf.Newline();
         }
 
         float roughness = (mtl.shininess == 0) ? 0. : (1.f / mtl.shininess);
-        fprintf(f, "MakeNamedMaterial \"%s\" \"string type\" \"uber\" ",
-                mtl.name.c_str());
-
-        if (hasDiffuseTex)
-            fprintf(f, "\"texture Kd\" \"%s-kd\" ", mtl.name.c_str());
-        else
-            fprintf(f, "\"color Kd\" [%f %f %f] ", mtl.diffuse[0],
-                    mtl.diffuse[1], mtl.diffuse[2]);
-        if (hasSpecularTex)
-            fprintf(f, "\"texture Ks\" \"%s-ks\" ", mtl.name.c_str());
-        else
-            fprintf(f, "\"color Ks\" [%f %f %f] ", mtl.specular[0],
-                    mtl.specular[1], mtl.specular[2]);
-        fprintf(f,
-                "\"float roughness\" [%f] "
-                "\"rgb Kt\" [%f %f %f] \"float index\" [%f] "
-                "\"rgb opacity\" [%f %f %f] ",
-                roughness, mtl.transmittance[0], mtl.transmittance[1],
-                mtl.transmittance[2], mtl.ior, mtl.dissolve, mtl.dissolve,
-                mtl.dissolve);
-        if (mtl.bump_texname != "")
-            fprintf(f, "\"texture bumpmap\" \"%s-bump\" ", mtl.name.c_str());
-        fprintf(f, "\n\n");
+        mtlBuf.Token("MakeNamedMaterial");
+        mtlBuf.String(mtl.name);
+        mtlBuf.String("string type");
+        mtlBuf.String("uber");
+
+        if (hasDiffuseTex) {
+            mtlBuf.String("texture Kd");
+            mtlBuf.String(mtl.name + "-kd");
+        } else {
+            mtlBuf.String("color Kd");
+            mtlBuf.Token("[");
+            mtlBuf.Number(mtl.diffuse[0]);
+            mtlBuf.Number(mtl.diffuse[1]);
+            mtlBuf.Number(mtl.diffuse[2]);
+            mtlBuf.Token("]");
+        }
+        if (hasSpecularTex) {
+            mtlBuf.String("texture Ks");
+            mtlBuf.String(mtl.name + "-ks");
+        } else {
+            mtlBuf.String("color Ks");
+            mtlBuf.Token("[");
+            mtlBuf.Number(mtl.specular[0]);
+            mtlBuf.Number(mtl.specular[1]);
+            mtlBuf.Number(mtl.specular[2]);
+            mtlBuf.Token("]");
+        }
+        mtlBuf.String("float roughness");
+        mtlBuf.Token("[");
+        mtlBuf.Number(roughness);
+        mtlBuf.Token("]");
+        mtlBuf.String("rgb Kt");
+        mtlBuf.Token("[");
+        mtlBuf.Number(mtl.transmittance[0]);
+        mtlBuf.Number(mtl.transmittance[1]);
+        mtlBuf.Number(mtl.transmittance[2]);
+        mtlBuf.Token("]");
+        mtlBuf.String("float index");
+        mtlBuf.Token("[");
+        mtlBuf.Number(mtl.ior);
+        mtlBuf.Token("]");
+        mtlBuf.String("rgb opacity");
+        mtlBuf.Token("[");
+        mtlBuf.Number(mtl.dissolve);
+        mtlBuf.Number(mtl.dissolve);
+        mtlBuf.Number(mtl.dissolve);
+        mtlBuf.Token("]");
+        if (mtl.bump_texname != "") {
+            mtlBuf.String("texture bumpmap");
+            mtlBuf.String(mtl.name + "-bump");
+        }
+        mtlBuf.Newline();
+        mtlBuf.Newline();
     }
-
-    for (const shape_t &shape : shapes) {
+    fwrite(mtlBuf.Contents().data(), 1, mtlBuf.Contents().size(), f);
+
+    // Convert the meshes in parallel: worker threads claim shapes with an
+    // atomic counter and emit each one into its own buffer; the buffers
+    // are then written out in shape order.
+    std::vector<std::string> shapeOutputs(shapes.size());
+    std::atomic<size_t> nextShape(0);
+    auto convertShape = [&](size_t shapeIndex) {
+        const shape_t &shape = shapes[shapeIndex];
         const mesh_t &mesh = shape.mesh;
+        SceneBuffer w(binaryOutput);
 
-        fprintf(f, "# Name \"%s\"\n", shape.name.c_str());
-        fprintf(f, "AttributeBegin\n");
+        w.Comment("Name \"" + shape.name + "\"");
+        w.Token("AttributeBegin");
+        w.Newline();
 
         // Get the set of material ids used for faces in this mesh.
         std::set<int> materialIds;
@@ -1447,7 +1616,7 @@ int main(int argc, char *argv[]) {
         // Now emit the chunks of the mesh for each material
         for (int id : materialIds) {
             if (id == -1) {
-                fprintf(f, "# Material unspecified in OBJ file\n");
+                w.Comment("Material unspecified in OBJ file");
             } else {
                 const material_t &mtl = materials[id];
 
@@ -1459,12 +1628,21 @@ int main(int argc, char *argv[]) {
 
                 if (mtl.emission[0] > 0 || mtl.emission[1] > 0 ||
                     mtl.emission[2] > 0) {
-                  fprintf(f, "AreaLightSource \"area\" \"rgb L\" [ %f %f %f ]\n",
-                          mtl.emission[0], mtl.emission[1], mtl.emission[2]);
+                  w.Token("AreaLightSource");
+                  w.String("area");
+                  w.String("rgb L");
+                  w.Token("[");
+                  w.Number(mtl.emission[0]);
+                  w.Number(mtl.emission[1]);
+                  w.Number(mtl.emission[2]);
+                  w.Token("]");
+                  w.Newline();
                   ++numAreaLights;
                 }
 
-                fprintf(f, "NamedMaterial \"%s\"\n", mtl.name.c_str());
+                w.Token("NamedMaterial");
+                w.String(mtl.name);
+                w.Newline();
             }
 
             // Now emit all the faces that have the matching material id.
@@ -1556,39 +1734,99 @@ int main(int argc, char *argv[]) {
                 }
             }
 
-            fprintf(f, "Shape \"trianglemesh\"\n");
-            fprintf(f, "  \"point3 P\" [ \n");
-            for (Point3f p : P)
-                fprintf(f, "\t%.10g %.10g %.10g\n", p.x, p.y, p.z);
-            fprintf(f,"]\n");
+            w.Token("Shape");
+            w.String("trianglemesh");
+            w.Newline();
+            w.String("point3 P");
+            w.Token("[");
+            w.Newline();
+            for (Point3f p : P) {
+                w.Number(p.x);
+                w.Number(p.y);
+                w.Number(p.z);
+                w.Newline();
+            }
+            w.Token("]");
+            w.Newline();
             if (!N.empty()) {
-                fprintf(f, "  \"normal N\" [ \n");
-                for (Normal3f n : N)
-                    fprintf(f, "\t%.10g %.10g %.10g\n", n.x, n.y, n.z);
-                fprintf(f,"]\n");
+                w.String("normal N");
+                w.Token("[");
+                w.Newline();
+                for (Normal3f n : N) {
+                    w.Number(n.x);
+                    w.Number(n.y);
+                    w.Number(n.z);
+                    w.Newline();
+                }
+                w.Token("]");
+                w.Newline();
             }
             if (!st.empty()) {
-                fprintf(f, "  \"point2 st\" [ \n");
-                for (Point2f tex : st)
-                    fprintf(f, "\t%.10g %.10g\n", tex.x, tex.y);
-                fprintf(f,"]\n");
+                w.String("point2 st");
+                w.Token("[");
+                w.Newline();
+                for (Point2f tex : st) {
+                    w.Number(tex.x);
+                    w.Number(tex.y);
+                    w.Newline();
+                }
+                w.Token("]");
+                w.Newline();
             }
-            fprintf(f, "  \"integer indices\" [ \n\t");
-            for (size_t i = 0; i < indices.size(); ++i)
-                fprintf(f, "%d%s", indices[i], (i % 3) == 2 ? "\n\t" : " ");
+            w.String("integer indices");
+            w.Token("[");
+            w.Newline();
+            for (size_t i = 0; i < indices.size(); ++i) {
+                w.Number(indices[i]);
+                if ((i % 3) == 2) w.Newline();
+            }
+            w.Token("]");
+            w.Newline();
             if (!faceIndices.empty()) {
-                fprintf(f, "]\n  \"integer faceIndices\" [\n");
-                for (int i : faceIndices)
-                    fprintf(f, "\t%d\n", i);
+                w.String("integer faceIndices");
+                w.Token("[");
+                w.Newline();
+                for (int i : faceIndices) {
+                    w.Number(i);
+                    w.Newline();
+                }
+                w.Token("]");
+                w.Newline();
             }
-            fprintf(f, "]\n\n");
+            w.Newline();
         }
-        fprintf(f, "AttributeEnd\n\n\n");
+        w.Token("AttributeEnd");
+        w.Newline();
+        w.Newline();
+        w.Newline();
+        shapeOutputs[shapeIndex] = std::move(w.Contents());
+    };
+
+    unsigned int nThreads =
+        std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()),
+                         shapes.size());
+    std::vector<std::thread> workers;
+    for (unsigned int t = 0; t + 1 < nThreads; ++t)
+        workers.push_back(std::thread([&]() {
+            for (;;) {
+                size_t index = nextShape++;
+                if (index >= shapes.size()) return;
+                convertShape(index);
+            }
+        }));
+    for (;;) {
+        size_t index = nextShape++;
+        if (index >= shapes.size()) break;
+        convertShape(index);
     }
+    for (std::thread &t : workers) t.join();
+
+    for (const std::string &out : shapeOutputs)
+        fwrite(out.data(), 1, out.size(), f);
     if (f != stdout) fclose(f);
 
     fprintf(stderr, "Converted %d meshes (%d triangles, %d mesh emitters).\n",
-            numMeshes, numTriangles, numAreaLights);
+            numMeshes, numTriangles.load(), numAreaLights.load());
 
     return 0;
 }